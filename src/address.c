@@ -35,16 +35,21 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+//! Compare addresses binary IP (hash is checked first to discard most of them)
+#define ADDRESS_IP_EQUALS(addr1, addr2) \
+    ((addr1).hash == (addr2).hash && (addr1).family == (addr2).family \
+     && !memcmp(&(addr1).ip, &(addr2).ip, sizeof((addr1).ip)))
+
 bool
 addressport_equals(address_t addr1, address_t addr2)
 {
-    return addr1.port == addr2.port && !strcmp(addr1.ip, addr2.ip);
+    return addr1.port == addr2.port && ADDRESS_IP_EQUALS(addr1, addr2);
 }
 
 bool
 address_equals(address_t addr1, address_t addr2)
 {
-    return !strcmp(addr1.ip, addr2.ip);
+    return ADDRESS_IP_EQUALS(addr1, addr2);
 }
 
 bool
@@ -55,11 +60,7 @@ address_is_local(address_t addr)
     pcap_if_t *dev;
     pcap_addr_t *da;
     char errbuf[PCAP_ERRBUF_SIZE];
-    struct sockaddr_in *ipaddr;
-#ifdef USE_IPV6
-    struct sockaddr_in6 *ip6addr;
-#endif
-    char ip[ADDRESSLEN];
+    address_t local;
 
     // Get all network devices
     if (!devices) {
@@ -74,24 +75,24 @@ address_is_local(address_t addr)
                 continue;
 
             // Initialize variables
-            memset(ip, 0, sizeof(ip));
+            memset(&local, 0, sizeof(local));
 
             // Get address representation
             switch (da->addr->sa_family) {
             case AF_INET:
-                ipaddr = (struct sockaddr_in *) da->addr;
-                inet_ntop(AF_INET, &ipaddr->sin_addr, ip, sizeof(ip));
+                address_set_ip4(&local, &((struct sockaddr_in *) da->addr)->sin_addr);
                 break;
 #ifdef USE_IPV6
             case AF_INET6:
-                ip6addr = (struct sockaddr_in6 *) da->addr;
-                inet_ntop(AF_INET, &ip6addr->sin6_addr, ip, sizeof(ip));
+                address_set_ip6(&local, &((struct sockaddr_in6 *) da->addr)->sin6_addr);
                 break;
 #endif
+            default:
+                continue;
             }
 
             // Check if this address matches
-            if (!strcmp(addr.ip, ip)) {
+            if (address_equals(addr, local)) {
                 return true;
             }
 
@@ -114,9 +115,67 @@ address_from_str(const char *ipport)
     strncpy(scanipport, ipport, sizeof(scanipport));
 
     if (sscanf(scanipport, "%[^:]:%d", address, &port) == 2) {
-        strncpy(ret.ip, address, sizeof(ret.ip));
-        ret.port = port;
+        if (address_set_ip(&ret, address) == 0)
+            ret.port = port;
     }
 
     return ret;
 }
+
+void
+address_set_ip4(address_t *addr, const struct in_addr *ip)
+{
+    memset(&addr->ip, 0, sizeof(addr->ip));
+    addr->ip.v4 = *ip;
+    addr->family = AF_INET;
+    addr->hash = address_hash(addr);
+}
+
+void
+address_set_ip6(address_t *addr, const struct in6_addr *ip)
+{
+    addr->ip.v6 = *ip;
+    addr->family = AF_INET6;
+    addr->hash = address_hash(addr);
+}
+
+int
+address_set_ip(address_t *addr, const char *ip)
+{
+    struct in_addr ip4;
+#ifdef USE_IPV6
+    struct in6_addr ip6;
+#endif
+
+    if (inet_pton(AF_INET, ip, &ip4) == 1) {
+        address_set_ip4(addr, &ip4);
+        return 0;
+    }
+#ifdef USE_IPV6
+    if (inet_pton(AF_INET6, ip, &ip6) == 1) {
+        address_set_ip6(addr, &ip6);
+        return 0;
+    }
+#endif
+    return 1;
+}
+
+const char *
+address_get_ip(address_t addr, char *out)
+{
+    *out = '\0';
+    if (addr.family && !inet_ntop(addr.family, &addr.ip, out, ADDRESSLEN))
+        *out = '\0';
+    return out;
+}
+
+uint32_t
+address_hash(const address_t *addr)
+{
+    uint32_t hash = addr->family;
+    int i;
+
+    for (i = 0; i < 4; i++)
+        hash = hash * 31 + addr->ip.words[i];
+    return hash ^ (hash >> 16);
+}
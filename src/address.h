@@ -28,6 +28,8 @@
  * Multiple structures contain source and destination address.
  * This file contains the unification of all sngrep address containers.
  *
+ * Addresses are stored in binary form so they can be compared with a few
+ * integer operations. They are only converted to text when displayed.
  */
 
 #ifndef __SNGREP_ADDRESS_H
@@ -55,10 +57,18 @@ typedef struct address address_t;
  * @brief Network address
  */
 struct address {
-    //! IP address
-    char ip[ADDRESSLEN];
+    //! IP address family (AF_INET, AF_INET6 or 0 if not set)
+    uint16_t family;
     //! Port
     uint16_t port;
+    //! Hash of the IP address, updated when it is set
+    uint32_t hash;
+    //! IP address in network byte order (unused bytes are zero)
+    union {
+        struct in_addr v4;
+        struct in6_addr v6;
+        uint32_t words[4];
+    } ip;
 };
 
 /**
@@ -99,5 +109,43 @@ address_is_local(address_t addr);
 address_t
 address_from_str(const char *ipport);
 
+/**
+ * @brief Set the IPv4 address keeping the port
+ */
+void
+address_set_ip4(address_t *addr, const struct in_addr *ip);
+
+/**
+ * @brief Set the IPv6 address keeping the port
+ */
+void
+address_set_ip6(address_t *addr, const struct in6_addr *ip);
+
+/**
+ * @brief Set the IP address from its text representation keeping the port
+ *
+ * @param addr Address structure
+ * @param ip IPv4 (or IPv6 if supported) address
+ * @return 0 if address has been set, 1 if it is not valid
+ */
+int
+address_set_ip(address_t *addr, const char *ip);
+
+/**
+ * @brief Get the text representation of the IP address
+ *
+ * @param addr Address structure
+ * @param out character array of at least ADDRESSLEN bytes
+ * @return out (empty if the address is not set)
+ */
+const char *
+address_get_ip(address_t addr, char *out);
+
+/**
+ * @brief Compute the hash of address IP and family
+ */
+uint32_t
+address_hash(const address_t *addr);
+
 
 #endif /* __SNGREP_ADDRESS_H */
@@ -0,0 +1,208 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file affinity.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in affinity.h
+ *
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "affinity.h"
+
+/**
+ * @brief Configured CPUs of each thread role
+ */
+static struct
+{
+    //! CPUs of each role
+    affinity_set_t roles[AFFINITY_ROLE_COUNT];
+    //! Role has a configured list of CPUs
+    bool configured[AFFINITY_ROLE_COUNT];
+    //! SCHED_FIFO priority of capture threads (0 for default scheduling)
+    int priority;
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    //! CPUs sngrep was started with
+    cpu_set_t initial;
+    //! Main thread CPUs before affinity_push
+    cpu_set_t pushed;
+    //! Initial CPUs have been stored
+    bool saved;
+#endif
+} affinity;
+
+int
+affinity_parse(const char *cpus, affinity_set_t *set)
+{
+    unsigned long first, last, cpu;
+    const char *pos = cpus;
+    char *end;
+
+    memset(set, 0, sizeof(affinity_set_t));
+    if (!cpus || !*cpus)
+        return 1;
+
+    for (;;) {
+        // Each item is a CPU number or a range of them
+        first = strtoul(pos, &end, 10);
+        if (end == pos || *pos == '-' || *pos == '+')
+            return 1;
+        last = first;
+        if (*end == '-') {
+            pos = end + 1;
+            last = strtoul(pos, &end, 10);
+            if (end == pos || *pos == '-' || *pos == '+' || last < first)
+                return 1;
+        }
+        if (last >= AFFINITY_MAX_CPUS)
+            return 1;
+
+        for (cpu = first; cpu <= last; cpu++) {
+            if (!affinity_has_cpu(set, cpu)) {
+                set->cpus[cpu / 64] |= 1ULL << (cpu % 64);
+                set->count++;
+            }
+        }
+
+        if (*end == '\0')
+            return 0;
+        if (*end != ',')
+            return 1;
+        pos = end + 1;
+    }
+}
+
+bool
+affinity_has_cpu(const affinity_set_t *set, uint32_t cpu)
+{
+    if (cpu >= AFFINITY_MAX_CPUS)
+        return false;
+    return (set->cpus[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+int
+affinity_set_role(enum affinity_role role, const char *cpus)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    // Remember CPUs to restore roles without list
+    if (!affinity.saved) {
+        CPU_ZERO(&affinity.initial);
+        pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &affinity.initial);
+        affinity.saved = true;
+    }
+#endif
+
+    affinity.configured[role] = false;
+    if (!cpus || !*cpus)
+        return 0;
+
+    if (affinity_parse(cpus, &affinity.roles[role]) != 0)
+        return 1;
+
+    affinity.configured[role] = true;
+    return 0;
+}
+
+void
+affinity_set_priority(int priority)
+{
+    affinity.priority = (priority > 0) ? priority : 0;
+}
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+/**
+ * @brief Get the kernel CPU mask of a role
+ */
+static void
+affinity_role_mask(enum affinity_role role, cpu_set_t *mask)
+{
+    uint32_t cpu;
+
+    if (!affinity.configured[role]) {
+        memcpy(mask, &affinity.initial, sizeof(cpu_set_t));
+        return;
+    }
+
+    CPU_ZERO(mask);
+    for (cpu = 0; cpu < AFFINITY_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+        if (affinity_has_cpu(&affinity.roles[role], cpu))
+            CPU_SET(cpu, mask);
+    }
+}
+#endif
+
+int
+affinity_apply(enum affinity_role role)
+{
+    int ret = 0;
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t mask;
+
+    // Nothing has been configured
+    if (!affinity.saved)
+        return 0;
+
+    affinity_role_mask(role, &mask);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &mask) != 0)
+        ret = 1;
+#endif
+
+    // Capture threads can preempt any other thread
+    if (role == AFFINITY_CAPTURE && affinity.priority) {
+        struct sched_param param = { .sched_priority = affinity.priority };
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+            ret = 1;
+    }
+
+    return ret;
+}
+
+void
+affinity_push(enum affinity_role role)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t mask;
+
+    if (!affinity.configured[role])
+        return;
+
+    pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &affinity.pushed);
+    affinity_role_mask(role, &mask);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &mask);
+#endif
+}
+
+void
+affinity_pop()
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    if (CPU_COUNT(&affinity.pushed) == 0)
+        return;
+
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &affinity.pushed);
+    CPU_ZERO(&affinity.pushed);
+#endif
+}
@@ -0,0 +1,142 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file affinity.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to pin sngrep threads to CPUs
+ *
+ * Each thread role (capture, parser, writer, EEP listener and interface)
+ * can be restricted to a list of CPUs. Threads pin themselves when they
+ * start, and roles without a configured list keep the CPUs sngrep was
+ * started with.
+ *
+ * Memory is placed by the kernel in the NUMA node of the CPU that first
+ * touches it, so capture buffers are allocated while the main thread
+ * is temporarily pinned to capture CPUs.
+ */
+
+#ifndef __SNGREP_AFFINITY_H_
+#define __SNGREP_AFFINITY_H_
+
+#include "config.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+//! Highest number of CPUs that can be listed
+#define AFFINITY_MAX_CPUS   1024
+
+//! Thread roles with their own CPU list
+enum affinity_role {
+    //! Capture threads reading frames (libpcap, AF_PACKET)
+    AFFINITY_CAPTURE = 0,
+    //! Parser threads and their decoding workers
+    AFFINITY_PARSER,
+    //! Output file writer threads
+    AFFINITY_WRITER,
+    //! EEP/HEP listener and sender threads
+    AFFINITY_EEP,
+    //! Interface (main) thread
+    AFFINITY_UI,
+    //! Number of thread roles
+    AFFINITY_ROLE_COUNT
+};
+
+//! Shorter declaration of affinity_set structure
+typedef struct affinity_set affinity_set_t;
+
+/**
+ * @brief List of CPUs a thread can run on
+ */
+struct affinity_set {
+    //! One bit per CPU
+    uint64_t cpus[AFFINITY_MAX_CPUS / 64];
+    //! Number of CPUs in the list
+    uint32_t count;
+};
+
+/**
+ * @brief Parse a list of CPUs
+ *
+ * List is a comma separated list of CPU numbers or ranges (0-3,8,10-11)
+ * as used by taskset and cpuset.
+ *
+ * @param cpus List of CPUs text
+ * @param set Parsed list of CPUs
+ * @return 0 if list is valid, 1 otherwise
+ */
+int
+affinity_parse(const char *cpus, affinity_set_t *set);
+
+/**
+ * @brief Check if a CPU is in the list
+ */
+bool
+affinity_has_cpu(const affinity_set_t *set, uint32_t cpu);
+
+/**
+ * @brief Set CPUs of a thread role
+ *
+ * Current thread CPUs are stored the first time, so roles without a list
+ * can be reset to them.
+ *
+ * @param cpus List of CPUs text (NULL or empty to keep default CPUs)
+ * @return 0 if list is valid, 1 otherwise
+ */
+int
+affinity_set_role(enum affinity_role role, const char *cpus);
+
+/**
+ * @brief Set real time priority of capture threads
+ *
+ * @param priority SCHED_FIFO priority (1-99) or 0 to keep default scheduling
+ */
+void
+affinity_set_priority(int priority);
+
+/**
+ * @brief Pin the calling thread to its role CPUs
+ *
+ * Capture threads also get SCHED_FIFO scheduling if requested.
+ *
+ * @return 0 on success, 1 if thread could not be pinned
+ */
+int
+affinity_apply(enum affinity_role role);
+
+/**
+ * @brief Temporarily pin the calling thread to a role CPUs
+ *
+ * Used by main thread to allocate a role buffers in its NUMA node. Any
+ * thread created meanwhile inherits the role CPUs until it applies its
+ * own role.
+ */
+void
+affinity_push(enum affinity_role role);
+
+/**
+ * @brief Restore calling thread CPUs after affinity_push
+ */
+void
+affinity_pop();
+
+#endif /* __SNGREP_AFFINITY_H_ */
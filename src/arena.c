@@ -0,0 +1,126 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file arena.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in arena.h
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+//! Round a size up to the allocation alignment
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+
+arena_t *
+arena_create(size_t size)
+{
+    arena_chunk_t *chunk;
+    arena_t *arena;
+
+    // Region data is the first allocation of its first chunk
+    size = ARENA_ROUND(size) + ARENA_ROUND(sizeof(arena_t));
+    if (!(chunk = arena_chunk_create(size)))
+        return NULL;
+
+    arena = (arena_t *) chunk->data;
+    chunk->used = ARENA_ROUND(sizeof(arena_t));
+    arena->chunks = chunk;
+    arena->chunk_size = size;
+    arena->size = chunk->size;
+    return arena;
+}
+
+void
+arena_destroy(arena_t *arena)
+{
+    arena_chunk_t *chunk, *next;
+
+    if (!arena)
+        return;
+
+    // First chunk (holding region data) is the last one of the list
+    for (chunk = arena->chunks; chunk; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+}
+
+void *
+arena_alloc(arena_t *arena, size_t size)
+{
+    arena_chunk_t *chunk = arena->chunks;
+    void *data;
+
+    size = ARENA_ROUND(size);
+
+    // Start a new chunk when this one is full
+    if (chunk->used + size > chunk->size) {
+        if (arena->chunk_size < ARENA_MAX_CHUNK)
+            arena->chunk_size *= 2;
+        if (!(chunk = arena_chunk_create(size > arena->chunk_size ? size : arena->chunk_size)))
+            return NULL;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->size += chunk->size;
+    }
+
+    data = chunk->data + chunk->used;
+    chunk->used += size;
+    memset(data, 0, size);
+    return data;
+}
+
+char *
+arena_strndup(arena_t *arena, const char *str, size_t len)
+{
+    char *copy;
+
+    if (!(copy = arena_alloc(arena, len + 1)))
+        return NULL;
+
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+size_t
+arena_size(arena_t *arena)
+{
+    return arena->size;
+}
+
+arena_chunk_t *
+arena_chunk_create(size_t size)
+{
+    arena_chunk_t *chunk;
+
+    if (!(chunk = malloc(sizeof(arena_chunk_t) + size)))
+        return NULL;
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
@@ -0,0 +1,121 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file arena.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to manage memory regions
+ *
+ * Objects with the same lifetime (like a call and its messages) are
+ * allocated one after another in memory chunks instead of one by one,
+ * and are all released at once when the region is destroyed. Regions
+ * are not thread safe and memory can not be released individually.
+ */
+
+#ifndef __SNGREP_ARENA_H_
+#define __SNGREP_ARENA_H_
+
+#include "config.h"
+#include <stddef.h>
+
+//! Alignment of allocated memory
+#define ARENA_ALIGN         16
+//! Maximum size of a region chunk (bigger allocations get their own chunk)
+#define ARENA_MAX_CHUNK     16384
+
+//! Shorter declaration of arena structure
+typedef struct arena arena_t;
+//! Shorter declaration of arena_chunk structure
+typedef struct arena_chunk arena_chunk_t;
+
+/**
+ * @brief Block of memory where objects are allocated
+ */
+struct arena_chunk {
+    //! Previously allocated chunk
+    arena_chunk_t *next;
+    //! Usable bytes of this chunk
+    size_t size;
+    //! Bytes already allocated
+    size_t used;
+    //! Chunk memory
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+/**
+ * @brief Memory region
+ *
+ * Region data is stored in its first chunk.
+ */
+struct arena {
+    //! Chunk used for new allocations
+    arena_chunk_t *chunks;
+    //! Size of the next chunk
+    size_t chunk_size;
+    //! Total bytes allocated from chunks memory
+    size_t size;
+};
+
+/**
+ * @brief Create a new memory region
+ *
+ * @param size size of the first chunk, next chunks double it
+ * @return new region or NULL on memory error
+ */
+arena_t *
+arena_create(size_t size);
+
+/**
+ * @brief Release all memory allocated in a region
+ */
+void
+arena_destroy(arena_t *arena);
+
+/**
+ * @brief Allocate zero filled memory in a region
+ *
+ * @return allocated memory or NULL on memory error
+ */
+void *
+arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * @brief Copy a string in a region
+ *
+ * @return copy of the first len characters of str, ended with a zero byte
+ */
+char *
+arena_strndup(arena_t *arena, const char *str, size_t len);
+
+/**
+ * @brief Get the total size of the memory chunks of a region
+ */
+size_t
+arena_size(arena_t *arena);
+
+/**
+ * @brief Allocate a new chunk with at least size bytes
+ */
+arena_chunk_t *
+arena_chunk_create(size_t size);
+
+#endif /* __SNGREP_ARENA_H_ */
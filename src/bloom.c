@@ -0,0 +1,139 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file bloom.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in bloom.h
+ *
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include "bloom.h"
+
+bloom_t *
+bloom_create(uint32_t capacity)
+{
+    bloom_t *bloom;
+    uint64_t bits = 64;
+
+    // Round required bits to the next power of two
+    while (bits < (uint64_t) capacity * BLOOM_BITS_PER_KEY)
+        bits <<= 1;
+
+    if (!(bloom = calloc(1, sizeof(bloom_t))))
+        return NULL;
+
+    bloom->bits[0] = calloc(bits / 64, sizeof(uint64_t));
+    bloom->bits[1] = calloc(bits / 64, sizeof(uint64_t));
+    if (!bloom->bits[0] || !bloom->bits[1]) {
+        bloom_destroy(bloom);
+        return NULL;
+    }
+
+    bloom->mask = bits - 1;
+    bloom->capacity = capacity ? capacity : 1;
+    return bloom;
+}
+
+void
+bloom_destroy(bloom_t *bloom)
+{
+    if (!bloom)
+        return;
+    free(bloom->bits[0]);
+    free(bloom->bits[1]);
+    free(bloom);
+}
+
+void
+bloom_clear(bloom_t *bloom)
+{
+    memset(bloom->bits[0], 0, (bloom->mask + 1) / 8);
+    memset(bloom->bits[1], 0, (bloom->mask + 1) / 8);
+    bloom->count = 0;
+}
+
+uint64_t
+bloom_hash(const char *key, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    // FNV-1a followed by a finalizer so all bits depend on every byte
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char) key[i];
+        hash *= 0x100000001b3ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+/**
+ * @brief Check if all bits of a hash are set in a generation
+ */
+static bool
+bloom_check_bits(bloom_t *bloom, const uint64_t *bits, uint64_t hash)
+{
+    // Bits are selected by double hashing from both halves of the hash
+    uint64_t index = hash, step = (hash >> 32) | 1;
+    int i;
+
+    for (i = 0; i < BLOOM_HASHES; i++, index += step) {
+        if (!(bits[(index & bloom->mask) >> 6] & (1ULL << (index & 63))))
+            return false;
+    }
+    return true;
+}
+
+void
+bloom_add(bloom_t *bloom, uint64_t hash)
+{
+    uint64_t index = hash, step = (hash >> 32) | 1;
+    uint64_t *bits;
+    int i;
+
+    // Start a new generation, forgetting the oldest one
+    if (bloom->count >= bloom->capacity) {
+        bloom->current ^= 1;
+        memset(bloom->bits[bloom->current], 0, (bloom->mask + 1) / 8);
+        bloom->count = 0;
+    }
+
+    bits = bloom->bits[bloom->current];
+    for (i = 0; i < BLOOM_HASHES; i++, index += step) {
+        bits[(index & bloom->mask) >> 6] |= 1ULL << (index & 63);
+    }
+    bloom->count++;
+}
+
+bool
+bloom_check(bloom_t *bloom, uint64_t hash)
+{
+    return bloom_check_bits(bloom, bloom->bits[bloom->current], hash)
+           || bloom_check_bits(bloom, bloom->bits[bloom->current ^ 1], hash);
+}
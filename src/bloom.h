@@ -0,0 +1,113 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file bloom.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Compact filter to remember a set of keys
+ *
+ * Keys are not stored, only some bits selected by their hash, so a key
+ * that has never been added may be reported as present (about 1% of the
+ * times when the filter is full) but an added key is always found.
+ *
+ * The filter keeps two generations of bits. When the current one reaches
+ * its capacity, the previous one is discarded, so the filter can be used
+ * forever keeping its error rate while only the most recent keys are
+ * remembered.
+ */
+
+#ifndef __SNGREP_BLOOM_H_
+#define __SNGREP_BLOOM_H_
+
+#include "config.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//! Bits used per key of each generation
+#define BLOOM_BITS_PER_KEY  10
+//! Bits checked per key
+#define BLOOM_HASHES        7
+
+//! Shorter declaration of bloom structure
+typedef struct bloom bloom_t;
+
+/**
+ * @brief Structure to hold two generations of filter bits
+ */
+struct bloom {
+    //! Bits of current and previous generations
+    uint64_t *bits[2];
+    //! Mask to convert hashes into bit indexes (bits - 1)
+    uint64_t mask;
+    //! Keys added to a generation before it is replaced
+    uint32_t capacity;
+    //! Keys added to current generation
+    uint32_t count;
+    //! Index of current generation
+    uint32_t current;
+};
+
+/**
+ * @brief Create an empty filter
+ *
+ * @param capacity Keys remembered at least
+ * @return allocated filter or NULL on memory error
+ */
+bloom_t *
+bloom_create(uint32_t capacity);
+
+/**
+ * @brief Free filter memory
+ */
+void
+bloom_destroy(bloom_t *bloom);
+
+/**
+ * @brief Forget all added keys
+ */
+void
+bloom_clear(bloom_t *bloom);
+
+/**
+ * @brief Get the hash value used to add and check a key
+ *
+ * Hash is well mixed, so it can also be used to sample keys.
+ */
+uint64_t
+bloom_hash(const char *key, size_t len);
+
+/**
+ * @brief Add a key given its hash
+ */
+void
+bloom_add(bloom_t *bloom, uint64_t hash);
+
+/**
+ * @brief Check if a key has been added given its hash
+ *
+ * @return true if key has probably been added, false if not
+ */
+bool
+bloom_check(bloom_t *bloom, uint64_t hash);
+
+#endif /* __SNGREP_BLOOM_H_ */
@@ -32,20 +32,44 @@
 
 #include "config.h"
 #include <netdb.h>
+#include <errno.h>
 #include <string.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "capture.h"
 #ifdef USE_EEP
 #include "capture_eep.h"
 #endif
+#ifdef USE_TPACKET
+#include "capture_tpacket.h"
+#endif
+#include "capture_mmap.h"
+#include "capture_writer.h"
+#include "capture_disk.h"
+#include "capture_index.h"
+#include "capture_snapshot.h"
+#include "sip_export.h"
+#ifdef WITH_ZLIB
+#include "capture_zip.h"
+#endif
 #ifdef WITH_GNUTLS
 #include "capture_gnutls.h"
 #endif
 #ifdef WITH_OPENSSL
 #include "capture_openssl.h"
 #endif
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+#include "capture_tls.h"
+#include "capture_keylog.h"
+#endif
 #include "sip.h"
 #include "rtp.h"
+#include "affinity.h"
+#include "latency.h"
 #include "setting.h"
 #include "util.h"
 
@@ -59,10 +83,67 @@ capture_init(size_t limit, bool rtp_capture, bool rotate, size_t pcap_buffer_siz
     capture_cfg.limit = limit;
     capture_cfg.pcap_buffer_size = pcap_buffer_size;
     capture_cfg.rtp_capture = rtp_capture;
+    if (setting_get_intvalue(SETTING_CAPTURE_RTP_SAMPLES) > 0)
+        capture_cfg.rtp_samples = setting_get_intvalue(SETTING_CAPTURE_RTP_SAMPLES);
+    if (setting_get_intvalue(SETTING_CAPTURE_RTP_FILTER) > 0)
+        capture_cfg.rtp_filter = setting_get_intvalue(SETTING_CAPTURE_RTP_FILTER);
+
+    // Store captured dialogs to be restored in next start
+    capture_snapshot_init(setting_get_value(SETTING_CAPTURE_SNAPSHOT),
+                          setting_get_intvalue(SETTING_CAPTURE_SNAPSHOT_INTERVAL));
+
+    // Publish calls summaries for other processes
+    if (sip_export_init(setting_get_value(SETTING_SIP_EXPORT), setting_get_intvalue(SETTING_SIP_EXPORT_SLOTS)) != 0)
+        fprintf(stderr, "Unable to create shared memory %s: %s\n", setting_get_value(SETTING_SIP_EXPORT), strerror(errno));
     capture_cfg.rotate = rotate;
     capture_cfg.paused = 0;
     capture_cfg.sources = vector_create(1, 1);
 
+    // Frames that can be pending to be parsed per capture source
+    if (setting_get_intvalue(SETTING_CAPTURE_RINGSIZE) > 0) {
+        capture_cfg.ring_size = setting_get_intvalue(SETTING_CAPTURE_RINGSIZE);
+    } else {
+        capture_cfg.ring_size = CAPTURE_RING_SIZE;
+    }
+
+    // Pending IP fragments limits
+    if (setting_get_intvalue(SETTING_CAPTURE_REASM_TIMEOUT) > 0) {
+        capture_cfg.reasm_timeout = setting_get_intvalue(SETTING_CAPTURE_REASM_TIMEOUT);
+    } else {
+        capture_cfg.reasm_timeout = CAPTURE_REASM_TIMEOUT;
+    }
+    if (setting_get_intvalue(SETTING_CAPTURE_REASM_MEMORY) > 0) {
+        capture_cfg.reasm_memory = setting_get_intvalue(SETTING_CAPTURE_REASM_MEMORY) * 1024;
+    } else {
+        capture_cfg.reasm_memory = CAPTURE_REASM_MEMORY * 1024;
+    }
+
+    // Pending TCP data limits
+    if (setting_get_intvalue(SETTING_CAPTURE_TCP_TIMEOUT) > 0) {
+        capture_cfg.tcp_timeout = setting_get_intvalue(SETTING_CAPTURE_TCP_TIMEOUT);
+    } else {
+        capture_cfg.tcp_timeout = CAPTURE_TCP_TIMEOUT;
+    }
+    if (setting_get_intvalue(SETTING_CAPTURE_TCP_MEMORY) > 0) {
+        capture_cfg.tcp_memory = setting_get_intvalue(SETTING_CAPTURE_TCP_MEMORY) * 1024;
+    } else {
+        capture_cfg.tcp_memory = CAPTURE_TCP_MEMORY * 1024;
+    }
+
+    // Frames read and parsed together
+    if (setting_get_intvalue(SETTING_CAPTURE_BATCH) > 0) {
+        capture_cfg.batch_size = setting_get_intvalue(SETTING_CAPTURE_BATCH);
+    } else {
+        capture_cfg.batch_size = CAPTURE_BATCH_SIZE;
+    }
+
+    // Input files data requested ahead of reading position
+    if (setting_get_intvalue(SETTING_CAPTURE_OFFLINE_READAHEAD) >= 0) {
+        capture_cfg.readahead = (size_t) setting_get_intvalue(SETTING_CAPTURE_OFFLINE_READAHEAD) * 1024 * 1024;
+    } else {
+        capture_cfg.readahead = CAPTURE_READAHEAD * 1024 * 1024;
+    }
+
     // Fixme
     if (setting_has_value(SETTING_CAPTURE_STORAGE, "none")) {
         capture_cfg.storage = CAPTURE_STORAGE_NONE;
@@ -70,6 +151,24 @@ capture_init(size_t limit, bool rtp_capture, bool rotate, size_t pcap_buffer_siz
         capture_cfg.storage = CAPTURE_STORAGE_MEMORY;
     } else if (setting_has_value(SETTING_CAPTURE_STORAGE, "disk")) {
         capture_cfg.storage = CAPTURE_STORAGE_DISK;
+    } else if (setting_has_value(SETTING_CAPTURE_STORAGE, "compressed")) {
+        capture_cfg.storage = CAPTURE_STORAGE_COMPRESSED;
+    }
+
+    // Keep frames in memory if they can not be stored on disk
+    if (capture_cfg.storage == CAPTURE_STORAGE_DISK
+            && !(capture_cfg.disk = capture_disk_create())) {
+        capture_cfg.storage = CAPTURE_STORAGE_MEMORY;
+    }
+
+    // Keep frames uncompressed if zlib is not available
+    if (capture_cfg.storage == CAPTURE_STORAGE_COMPRESSED) {
+#ifdef WITH_ZLIB
+        if (!(capture_cfg.zip = capture_zip_create()))
+            capture_cfg.storage = CAPTURE_STORAGE_MEMORY;
+#else
+        capture_cfg.storage = CAPTURE_STORAGE_MEMORY;
+#endif
     }
 
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
@@ -78,29 +177,59 @@ capture_init(size_t limit, bool rtp_capture, bool rotate, size_t pcap_buffer_siz
 #endif
 
     // Initialize calls lock
-    pthread_mutexattr_t attr;
-    pthread_mutexattr_init(&attr);
-#if defined(PTHREAD_MUTEX_RECURSIVE) || defined(__FreeBSD__) || defined(BSD) || defined (__OpenBSD__) || defined(__DragonFly__)
-    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-#else
-    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE_NP);
-#endif
-    pthread_mutex_init(&capture_cfg.lock, &attr);
-
+    pthread_rwlock_init(&capture_cfg.lock, NULL);
+
+    // Remove calls without messages, update media filter, write snapshots and export calls in background
+    atomic_init(&capture_cfg.launched, false);
+    atomic_init(&capture_cfg.expire_running, sip_calls_expire_enabled() || capture_cfg.rtp_filter
+                || capture_snapshot_enabled() || sip_export_enabled());
+    if (capture_cfg.expire_running
+            && pthread_create(&capture_cfg.expire_t, NULL, capture_expire_thread, NULL) != 0) {
+        atomic_store(&capture_cfg.expire_running, false);
+    }
 }
 
 void
 capture_deinit()
 {
+    // Stop removing expired calls and updating media filter
+    if (atomic_exchange(&capture_cfg.expire_running, false))
+        pthread_join(capture_cfg.expire_t, NULL);
+
+    // Stop publishing calls summaries
+    sip_export_deinit();
+
     // Close pcap handler
     capture_close();
 
+    // Keep all parsed dialogs for next start
+    if (capture_snapshot_enabled())
+        capture_snapshot_save();
+    capture_snapshot_init(NULL, 0);
+
     // Deallocate vectors
     vector_set_destroyer(capture_cfg.sources, vector_generic_destroyer);
     vector_destroy(capture_cfg.sources);
 
-    // Remove capture mutex
-    pthread_mutex_destroy(&capture_cfg.lock);
+    // Stop storing frames on disk
+    capture_disk_destroy(capture_cfg.disk);
+    capture_cfg.disk = NULL;
+#ifdef WITH_ZLIB
+    // Stop compressing stored frames
+    capture_zip_destroy(capture_cfg.zip);
+    capture_cfg.zip = NULL;
+#endif
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+    // Discard loaded TLS master secrets
+    capture_keylog_close();
+#endif
+
+    // Discard last media filter
+    sng_free(capture_cfg.rtp_filter_text);
+    capture_cfg.rtp_filter_text = NULL;
+
+    // Remove calls lock
+    pthread_rwlock_destroy(&capture_cfg.lock);
 }
 
 int
@@ -111,6 +240,14 @@ capture_online(const char *dev, const char *outfile)
     //! Error string
     char errbuf[PCAP_ERRBUF_SIZE];
 
+#ifdef USE_TPACKET
+    // Check if native Linux capture has been requested for this device
+    const char *tpdev;
+    if ((tpdev = capture_tpacket_device(dev))) {
+        return capture_tpacket_online(tpdev, outfile);
+    }
+#endif
+
     // Create a new structure to handle this capture source
     if (!(capinfo = sng_malloc(sizeof(capture_info_t)))) {
         fprintf(stderr, "Can't allocate memory for capture data!\n");
@@ -167,24 +304,10 @@ capture_online(const char *dev, const char *outfile)
         fprintf(stderr, "Unable to handle linktype %d\n", capinfo->link);
         return 3;
     }
-
-    // Create Vectors for IP and TCP reassembly
-    capinfo->tcp_reasm = vector_create(0, 10);
-    capinfo->ip_reasm = vector_create(0, 10);
+    capinfo->link_decode = capture_link_decoder(capinfo->link);
 
     // Add this capture information as packet source
-    vector_append(capture_cfg.sources, capinfo);
-
-    // If requested store packets in a dump file
-    if (outfile && !capture_cfg.pd) {
-        if ((capture_cfg.pd = dump_open(outfile)) == NULL) {
-            fprintf(stderr, "Couldn't open output dump file %s: %s\n", outfile,
-                    pcap_geterr(capinfo->handle));
-            return 2;
-        }
-    }
-
-    return 0;
+    return capture_add_source(capinfo, outfile);
 }
 
 int
@@ -192,6 +315,7 @@ capture_offline(const char *infile, const char *outfile)
 {
     capture_info_t *capinfo;
     FILE *fstdin;
+    struct stat st;
 
     // Error text (in case of file open error)
     char errbuf[PCAP_ERRBUF_SIZE];
@@ -232,31 +356,217 @@ capture_offline(const char *infile, const char *outfile)
         fprintf(stderr, "Unable to handle linktype %d\n", capinfo->link);
         return 3;
     }
+    capinfo->link_decode = capture_link_decoder(capinfo->link);
 
-    // Create Vectors for IP and TCP reassembly
-    capinfo->tcp_reasm = vector_create(0, 10);
-    capinfo->ip_reasm = vector_create(0, 10);
+    // Get file size to report loading progress
+    if (stat(infile, &st) == 0 && S_ISREG(st.st_mode)) {
+        capinfo->infile_size = st.st_size;
+    }
+
+    // Decode regular files using multiple workers if possible
+    // Replayed files are read by a single thread to queue frames when they are due
+    if (strcmp(infile, "/dev/stdin") != 0 && !capture_replay_enabled()) {
+        capture_mmap_open(capinfo);
+    }
+
+    // Request data ahead of libpcap reads if file is not mapped
+    if (!capinfo->mmap && capinfo->infile_size && pcap_file(capinfo->handle)) {
+        capture_readahead_init(&capinfo->readahead, fileno(pcap_file(capinfo->handle)), NULL, capinfo->infile_size);
+    }
+
+    // Add this capture information as packet source
+    return capture_add_source(capinfo, outfile);
+}
+
+void
+capture_readahead_init(capture_readahead_t *ra, int fd, const u_char *map, size_t size)
+{
+    ra->fd = fd;
+    ra->map = map;
+    ra->size = size;
+    ra->requested = 0;
+
+    // Let the kernel also read ahead more than usual on its own
+    if (!map)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    capture_readahead(ra, 0);
+}
+
+void
+capture_readahead(capture_readahead_t *ra, size_t pos)
+{
+    size_t chunk = CAPTURE_READAHEAD_CHUNK * 1024 * 1024, len;
+
+    if (!capture_cfg.readahead)
+        return;
+
+    // Mapped chunks must start at page boundaries (chunk size is a multiple of pages)
+    while (ra->requested < ra->size && ra->requested < pos + capture_cfg.readahead) {
+        len = (ra->size - ra->requested < chunk) ? ra->size - ra->requested : chunk;
+        if (ra->map) {
+            madvise((void *) (ra->map + ra->requested), len, MADV_WILLNEED);
+        } else {
+            posix_fadvise(ra->fd, ra->requested, len, POSIX_FADV_WILLNEED);
+        }
+        ra->requested += len;
+    }
+}
+
+int
+capture_add_source(capture_info_t *capinfo, const char *outfile)
+{
+    // Create storage for IP and TCP reassembly
+    capture_reasm_init(capinfo);
 
     // Add this capture information as packet source
+    capinfo->id = vector_count(capture_cfg.sources);
     vector_append(capture_cfg.sources, capinfo);
 
     // If requested store packets in a dump file
-    if (outfile && !capture_cfg.pd) {
-        if ((capture_cfg.pd = dump_open(outfile)) == NULL) {
+    if (outfile && !capture_cfg.writer) {
+        if (vector_count(capture_cfg.sources) != 1
+                || !(capture_cfg.writer = capture_writer_open(capinfo->handle, outfile, capinfo->infile != NULL))) {
             fprintf(stderr, "Couldn't open output dump file %s: %s\n", outfile,
                     pcap_geterr(capinfo->handle));
             return 2;
         }
     }
 
+    // Describe this source in output files that support several interfaces
+    capture_writer_interface(capture_cfg.writer, capinfo);
+
     return 0;
 }
 
 void
-parse_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packet)
+capture_reasm_init(capture_info_t *capinfo)
+{
+    // Create Vectors for IP and TCP reassembly
+    capinfo->tcp_reasm = vector_create(0, 10);
+    capinfo->tcp_reasm_index = htable_create(CAPTURE_REASM_HASH);
+    capinfo->ip_reasm = vector_create(0, 10);
+    capinfo->ip_reasm_index = htable_create(CAPTURE_REASM_HASH);
+    capinfo->ip_reasm_data = sng_malloc(MAX_CAPTURE_LEN);
+}
+
+void
+capture_reasm_destroy(capture_info_t *capinfo)
+{
+    capture_ip_frag_t *frag;
+    capture_tcp_stream_t *stream;
+
+    sng_free(capinfo->ip_reasm_data);
+    capinfo->ip_reasm_data = NULL;
+
+    // Discard packets pending IP reassembly
+    while ((frag = vector_first(capinfo->ip_reasm)))
+        capture_ip_frag_evict(capinfo, frag);
+    vector_destroy(capinfo->ip_reasm);
+    capinfo->ip_reasm = NULL;
+    htable_destroy(capinfo->ip_reasm_index);
+    capinfo->ip_reasm_index = NULL;
+
+    // Discard connections pending TCP reassembly
+    while ((stream = vector_first(capinfo->tcp_reasm)))
+        capture_tcp_stream_destroy(capinfo, stream);
+    vector_destroy(capinfo->tcp_reasm);
+    capinfo->tcp_reasm = NULL;
+    htable_destroy(capinfo->tcp_reasm_index);
+    capinfo->tcp_reasm_index = NULL;
+}
+
+void
+capture_queue_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packet)
 {
     // Capture info
     capture_info_t *capinfo = (capture_info_t *) info;
+    // Copy of the captured frame
+    frame_buffer_t *frame;
+
+    // Ignore packets while capture is paused
+    if (capture_paused())
+        return;
+
+    // Check maximum capture length
+    if (header->caplen > MAX_CAPTURE_LEN)
+        return;
+
+    // Replayed files queue each frame when it is due
+    if (capinfo->infile && capture_replay_enabled())
+        capture_replay_wait(capinfo, header);
+
+    // Copy frame data, libpcap will reuse its buffer after this callback
+    if (!(frame = frame_buffer_create(header, packet)))
+        return;
+    frame->source = capinfo->id;
+
+    // Queue the frame for the parser thread
+    while (ring_push(capinfo->ring, frame) != 0) {
+        // Online captures can not wait: discard frame and count it
+        if (!capinfo->infile || capinfo->stopping) {
+            ring_add_overflow(capinfo->ring);
+            frame_buffer_destroy(frame);
+            return;
+        }
+        // Offline captures wait until parser has free slots
+        capture_parser_wakeup(capinfo, false);
+        usleep(100);
+    }
+}
+
+void
+capture_parser_wakeup(capture_info_t *capinfo, bool force)
+{
+    // Make queued frame visible before checking parser status
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // Only signal the parser if it is actually sleeping
+    if (force || atomic_load(&capinfo->parser_waiting)) {
+        pthread_mutex_lock(&capinfo->ring_lock);
+        pthread_cond_signal(&capinfo->ring_cond);
+        pthread_mutex_unlock(&capinfo->ring_lock);
+    }
+}
+
+void
+capture_parser_wait(capture_info_t *capinfo, ring_t *ring)
+{
+    struct timespec ts;
+
+    pthread_mutex_lock(&capinfo->ring_lock);
+    capinfo->parser_waiting = true;
+    // Finished captures won't queue more frames, but workers could still queue packets
+    if (ring_count(ring) == 0 && (!capinfo->eof || ring != capinfo->ring || !capture_parser_idle(capinfo))
+            && !capinfo->stopping) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += CAPTURE_RING_WAIT * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&capinfo->ring_cond, &capinfo->ring_lock, &ts);
+    }
+    capinfo->parser_waiting = false;
+    pthread_mutex_unlock(&capinfo->ring_lock);
+}
+
+bool
+capture_parser_idle(capture_info_t *capinfo)
+{
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+    // Some packets are still being decrypted
+    if (capture_tls_pending(capinfo))
+        return false;
+#endif
+    return true;
+}
+
+packet_t *
+parse_packet(capture_info_t *capinfo, frame_buffer_t *buffer)
+{
+    // PCAP Packet header
+    const struct pcap_pkthdr *header = &buffer->header;
     // UDP header data
     struct udphdr *udp;
     // UDP header size
@@ -266,7 +576,7 @@ parse_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packe
     // TCP header size
     uint16_t tcp_off;
     // Packet data
-    u_char data[MAX_CAPTURE_LEN];
+    u_char *data = buffer->data;
     // Packet payload data
     u_char *payload = NULL;
     // Whole packet size
@@ -276,28 +586,37 @@ parse_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packe
     // Captured packet info
     packet_t *pkt;
 
+    // Count all frames read from this source
+    atomic_fetch_add_explicit(&capinfo->frames, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&capinfo->bytes, header->len, memory_order_relaxed);
+
     // Ignore packets while capture is paused
-    if (capture_paused())
-        return;
+    if (capture_paused()) {
+        frame_buffer_destroy(buffer);
+        return NULL;
+    }
 
     // Check if we have reached capture limit
     if (capture_cfg.limit && sip_calls_count() >= capture_cfg.limit) {
         // If capture rotation is disabled, just skip this packet
         if (!capture_cfg.rotate) {
-            return;
+            frame_buffer_destroy(buffer);
+            return NULL;
         }
     }
 
     // Check maximum capture length
-    if (header->caplen > MAX_CAPTURE_LEN)
-        return;
-
-    // Copy packet payload
-    memcpy(data, packet, header->caplen);
+    if (header->caplen > MAX_CAPTURE_LEN) {
+        frame_buffer_destroy(buffer);
+        return NULL;
+    }
 
     // Check if we have a complete IP packet
-    if (!(pkt = capture_packet_reasm_ip(capinfo, header, data, &size_payload, &size_capture)))
-        return;
+    LATENCY_START(ip_start);
+    pkt = capture_packet_reasm_ip(capinfo, buffer, &data, &size_payload, &size_capture);
+    LATENCY_RECORD(LATENCY_IP, ip_start);
+    if (!pkt)
+        return NULL;
 
     // Only interested in UDP packets
     if (pkt->proto == IPPROTO_UDP) {
@@ -320,7 +639,7 @@ parse_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packe
 
         // Complete packet with Transport information
         packet_set_type(pkt, PACKET_SIP_UDP);
-        packet_set_payload(pkt, payload, size_payload);
+        capture_packet_set_payload(pkt, buffer, payload, size_payload);
 
     } else if (pkt->proto == IPPROTO_TCP) {
         // Get TCP header
@@ -342,16 +661,26 @@ parse_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packe
 
         // Complete packet with Transport information
         packet_set_type(pkt, PACKET_SIP_TCP);
-        packet_set_payload(pkt, payload, size_payload);
+        capture_packet_set_payload(pkt, buffer, payload, size_payload);
 
         // Create a structure for this captured packet
-        if (!(pkt = capture_packet_reasm_tcp(capinfo, pkt, tcp, payload, size_payload)))
-            return;
+        LATENCY_START(tcp_start);
+        pkt = capture_packet_reasm_tcp(capinfo, pkt, tcp, payload, size_payload);
+        LATENCY_RECORD(LATENCY_TCP, tcp_start);
+        if (!pkt)
+            return NULL;
 
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
         // Check if packet is TLS
-        if (capture_cfg.keyfile) {
+        if (capture_cfg.keyfile || capture_cfg.keylogfile) {
+            // Decrypt it in the worker of its connection
+            if (capinfo->tls) {
+                capture_tls_queue(capinfo, pkt, tcp);
+                return NULL;
+            }
+            LATENCY_START(tls_start);
             tls_process_segment(pkt, tcp);
+            LATENCY_RECORD(LATENCY_TLS, tls_start);
         }
 #endif
 
@@ -359,38 +688,75 @@ parse_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packe
         capture_ws_check_packet(pkt);
     } else {
         // Not handled protocol
+        packet_destroy(pkt);
+        return NULL;
+    }
+
+    return pkt;
+}
+
+void
+capture_packet_process(capture_info_t *capinfo, packet_t *pkt)
+{
+    // Limit could have been reached while this packet was decoded
+    if (capture_cfg.limit && !capture_cfg.rotate && sip_calls_count() >= capture_cfg.limit) {
         packet_destroy(pkt);
         return;
     }
 
-    // Avoid parsing from multiples sources.
-    // Avoid parsing while screen in being redrawn
-    capture_lock();
     // Check if we can handle this packet
     if (capture_packet_parse(pkt) == 0) {
 #ifdef USE_EEP
         // Send this packet through eep
         capture_eep_send(pkt);
 #endif
-        // Store this packets in output file
-        dump_packet(capture_cfg.pd, pkt);
-        // If storage is disabled, delete frames payload
-        if (capture_cfg.storage == 0) {
-            packet_free_frames(pkt);
-        }
-        // Allow Interface refresh and user input actions
-        capture_unlock();
+        // Queue this packet to be stored in output file
+        LATENCY_START(dump_start);
+        capture_writer_packet(capture_cfg.writer, pkt);
+        capture_packet_store(capinfo, pkt);
+        LATENCY_RECORD(LATENCY_DUMP, dump_start);
         return;
     }
 
     // Not an interesting packet ...
     packet_destroy(pkt);
-    // Allow Interface refresh and user input actions
-    capture_unlock();
+}
+
+void
+capture_packet_store(capture_info_t *capinfo, packet_t *pkt)
+{
+    // If storage is disabled, delete frames payload
+    if (capture_cfg.storage == 0) {
+        packet_free_frames(pkt);
+    } else if (capture_cfg.storage == CAPTURE_STORAGE_DISK) {
+        capture_disk_store_packet(capture_cfg.disk, pkt);
+#ifdef WITH_ZLIB
+    } else if (capture_cfg.storage == CAPTURE_STORAGE_COMPRESSED) {
+        capture_zip_store_packet(capture_cfg.zip, pkt);
+#endif
+    } else {
+        if (capinfo && capinfo->mmap)
+            capture_mmap_store_packet(capinfo, pkt);
+        // Retransmissions share their payload with the original packet
+        if (pkt->retrans)
+            packet_share_payload(pkt, pkt->retrans);
+    }
+    pkt->retrans = NULL;
+}
+
+void
+capture_packet_set_payload(packet_t *pkt, frame_buffer_t *buffer, u_char *payload, uint32_t size)
+{
+    // Payload inside the captured frame can be used without copying
+    if (payload >= buffer->data && payload + size <= buffer->data + buffer->header.caplen) {
+        packet_set_payload_ref(pkt, payload, size);
+    } else {
+        packet_set_payload(pkt, payload, size);
+    }
 }
 
 packet_t *
-capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *header, u_char *packet, uint32_t *size, uint32_t *caplen)
+capture_packet_reasm_ip(capture_info_t *capinfo, frame_buffer_t *buffer, u_char **data, uint32_t *size, uint32_t *caplen)
 {
     // IP header data
     struct ip *ip4;
@@ -422,46 +788,23 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
     vector_iter_t it;
     //! Packet containers
     packet_t *pkt;
+    //! Pending reassembly packet
+    capture_ip_frag_t *frag;
+    //! Pending reassembly lookup key
+    char key[ADDRESSLEN * 2 + 16];
+    char srcip[ADDRESSLEN], dstip[ADDRESSLEN];
     //! Storage for IP frame
     frame_t *frame;
     uint32_t len_data = 0;
-    //! Link + Extra header size
-    uint16_t link_hl = capinfo->link_hl;
-
-    // Skip VLAN header if present
-    if (capinfo->link == DLT_EN10MB) {
-        struct ether_header *eth = (struct ether_header *) packet;
-        if (ntohs(eth->ether_type) == ETHERTYPE_8021Q) {
-            link_hl += 4;
-        }
-    }
-
-#ifdef SLL_HDR_LEN
-    if (capinfo->link == DLT_LINUX_SLL) {
-        struct sll_header *sll = (struct sll_header *) packet;
-        if (ntohs(sll->sll_protocol) == ETHERTYPE_8021Q) {
-            link_hl += 4;
-        }
-    }
-#endif
-
-    // Skip NFLOG header if present
-    if (capinfo->link == DLT_NFLOG) {
-        // Parse NFLOG TLV headers
-        while (link_hl + 8 <= *caplen) {
-            nflog_tlv_t *tlv = (nflog_tlv_t *) (packet + link_hl);
-
-            if (!tlv) break;
-
-            if (tlv->tlv_type == NFULA_PAYLOAD) {
-                link_hl += 4;
-                break;
-            }
-
-            if (tlv->tlv_length >= 4) {
-                link_hl += ((tlv->tlv_length + 3) & ~3); /* next TLV aligned to 4B */
-            }
-        }
+    //! Captured packet data
+    u_char *packet = buffer->data;
+    //! Link + Extra header size (VLAN tags, NFLOG TLVs)
+    uint16_t link_hl = capinfo->link_decode(packet, *caplen, capinfo->link_hl);
+
+    // Frame too short to contain an IP header
+    if (link_hl + sizeof(struct ip) > *caplen) {
+        frame_buffer_destroy(buffer);
+        return NULL;
     }
 
     // Get IP header
@@ -486,8 +829,8 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
             ip_frag_off = (ip_frag) ? (ip_off & IP_OFFMASK) * 8 : 0;
             ip_id = ntohs(ip4->ip_id);
 
-            inet_ntop(AF_INET, &ip4->ip_src, src.ip, sizeof(src.ip));
-            inet_ntop(AF_INET, &ip4->ip_dst, dst.ip, sizeof(dst.ip));
+            address_set_ip4(&src, &ip4->ip_src);
+            address_set_ip4(&dst, &ip4->ip_dst);
             break;
 #ifdef USE_IPV6
         case 6:
@@ -501,11 +844,12 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
                 ip_id = ntohl(ip6f->ip6f_ident);
             }
 
-            inet_ntop(AF_INET6, &ip6->ip6_src, src.ip, sizeof(src.ip));
-            inet_ntop(AF_INET6, &ip6->ip6_dst, dst.ip, sizeof(dst.ip));
+            address_set_ip6(&src, &ip6->ip6_src);
+            address_set_ip6(&dst, &ip6->ip6_dst);
             break;
 #endif
         default:
+            frame_buffer_destroy(buffer);
             return NULL;
     }
 
@@ -517,30 +861,55 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
 
     // If no fragmentation
     if (ip_frag == 0) {
+        // Discard UDP packets that are not SIP nor RTP before allocating them
+        if (ip_proto == IPPROTO_UDP) {
+            // Only check data that has been actually captured
+            len_data = (buffer->header.caplen > link_hl + ip_hl) ? buffer->header.caplen - link_hl - ip_hl : 0;
+            if (len_data > *size)
+                len_data = *size;
+            if (capture_udp_is_candidate(packet + link_hl + ip_hl, len_data) != 0) {
+                frame_buffer_destroy(buffer);
+                return NULL;
+            }
+        }
+
         // Just create a new packet with given network data
         pkt = packet_create(ip_ver, ip_proto, src, dst, ip_id);
-        packet_add_frame(pkt, header, packet);
+        packet_add_frame_buffer(pkt, buffer);
         return pkt;
     }
 
-    // Look for another packet with same id in IP reassembly vector
-    it = vector_iterator(capinfo->ip_reasm);
-    while ((pkt = vector_iterator_next(&it))) {
-        if (addressport_equals(pkt->src, src)
-                && addressport_equals(pkt->dst, dst)
-                && pkt->ip_id == ip_id) {
-            break;
+    // Discard pending packets that will not be completed
+    capture_ip_frag_expire(capinfo, &buffer->header.ts);
+
+    // Look for another packet with same id in IP reassembly table
+    snprintf(key, sizeof(key), "%s %s %u %u",
+             address_get_ip(src, srcip), address_get_ip(dst, dstip), ip_id, ip_proto);
+    if (!(frag = htable_find(capinfo->ip_reasm_index, key))) {
+        // Add To the possible reassembly list
+        if (!(frag = sng_malloc(sizeof(capture_ip_frag_t)))) {
+            frame_buffer_destroy(buffer);
+            return NULL;
         }
+        strcpy(frag->key, key);
+        frag->packet = packet_create(ip_ver, ip_proto, src, dst, ip_id);
+        frag->ts = buffer->header.ts;
+        htable_insert(capinfo->ip_reasm_index, frag->key, frag);
+        vector_append(capinfo->ip_reasm, frag);
     }
 
-    // If we already have this packet stored, append this frames to existing one
-    if (pkt) {
-        packet_add_frame(pkt, header, packet);
-    } else {
-        // Add To the possible reassembly list
-        pkt = packet_create(ip_ver, ip_proto, src, dst, ip_id);
-        packet_add_frame(pkt, header, packet);
-        vector_append(capinfo->ip_reasm, pkt);
+    // Append this frame to the pending packet
+    pkt = frag->packet;
+    packet_add_frame_buffer(pkt, buffer);
+    frag->size += buffer->header.caplen;
+    capinfo->ip_reasm_size += buffer->header.caplen;
+
+    // Discard oldest pending packets until memory limit is honored
+    while (capinfo->ip_reasm_size > capture_cfg.reasm_memory) {
+        capture_ip_frag_t *oldest = vector_first(capinfo->ip_reasm);
+        capture_ip_frag_evict(capinfo, oldest);
+        if (oldest == frag)
+            return NULL;
     }
 
     // Add this IP content length to the total captured of the packet
@@ -565,8 +934,13 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
         }
 
         // Check packet content length
-        if (len_data > MAX_CAPTURE_LEN)
+        if (len_data > MAX_CAPTURE_LEN) {
+            capture_ip_frag_evict(capinfo, frag);
             return NULL;
+        }
+
+        // Captured frames are owned by the packet, assembly in source buffer
+        packet = *data = capinfo->ip_reasm_data;
 
         // Initialize memory for the assembly packet
         memset(packet, 0, link_hl + ip_hl + len_data);
@@ -584,108 +958,128 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
         *size = len_data;
 
         // Return the assembled IP packet
-        vector_remove(capinfo->ip_reasm, pkt);
+        capture_ip_frag_remove(capinfo, frag);
         return pkt;
     }
 
     return NULL;
 }
 
+int
+capture_udp_is_candidate(u_char *udp, uint32_t size)
+{
+    // Not enough data for UDP header and some payload
+    if (size <= sizeof(struct udphdr))
+        return 1;
+
+    udp += sizeof(struct udphdr);
+    size -= sizeof(struct udphdr);
+
+    // Payload could be SIP or belong to a RTP stream
+    if (data_is_sip(udp, size) == 0 || data_is_rtp(udp, size) == 0 || data_is_rtcp(udp, size) == 0)
+        return 0;
+
+    return 1;
+}
+
+void
+capture_ip_frag_remove(capture_info_t *capinfo, capture_ip_frag_t *frag)
+{
+    htable_remove(capinfo->ip_reasm_index, frag->key);
+    vector_remove(capinfo->ip_reasm, frag);
+    capinfo->ip_reasm_size -= frag->size;
+    sng_free(frag);
+}
+
+void
+capture_ip_frag_evict(capture_info_t *capinfo, capture_ip_frag_t *frag)
+{
+    atomic_fetch_add(&capinfo->ip_reasm_evicted, vector_count(frag->packet->frames));
+    packet_destroy(frag->packet);
+    capture_ip_frag_remove(capinfo, frag);
+}
+
+void
+capture_ip_frag_expire(capture_info_t *capinfo, const struct timeval *now)
+{
+    capture_ip_frag_t *frag;
+
+    // Pending packets are sorted by first fragment time
+    while ((frag = vector_first(capinfo->ip_reasm))) {
+        if (frag->ts.tv_sec + capture_cfg.reasm_timeout >= now->tv_sec)
+            break;
+        capture_ip_frag_evict(capinfo, frag);
+    }
+}
+
 packet_t *
 capture_packet_reasm_tcp(capture_info_t *capinfo, packet_t *packet, struct tcphdr *tcp, u_char *payload, int size_payload) {
 
-    vector_iter_t it = vector_iterator(capinfo->tcp_reasm);
-    packet_t *pkt;
-    u_char *new_payload;
-    u_char full_payload[MAX_CAPTURE_LEN + 1];
+    capture_tcp_stream_t *stream;
+    sip_validate_state_t state = { };
+    struct timeval now = packet_time(packet);
+    char key[ADDRESSLEN * 2 + 16];
+    char srcip[ADDRESSLEN], dstip[ADDRESSLEN];
+    uint32_t seq = ntohl(tcp->th_seq);
+    uint32_t msglen, size;
+    int ret;
 
     //! Assembled
     if ((int32_t) size_payload <= 0)
         return packet;
 
-    while ((pkt = vector_iterator_next(&it))) {
-        if (addressport_equals(pkt->src, packet->src) &&
-                addressport_equals(pkt->dst, packet->dst)) {
-            break;
-        }
-    }
+    // Discard connections that are not receiving data anymore
+    capture_tcp_stream_expire(capinfo, &now);
 
-    // If we already have this packet stored
-    if (pkt) {
-        frame_t *frame;
-        // Append this frames to the original packet
-        vector_iter_t frames = vector_iterator(packet->frames);
-        while ((frame = vector_iterator_next(&frames)))
-            packet_add_frame(pkt, frame->header, frame->data);
-        // Destroy current packet as its frames belong to the stored packet
-        packet_destroy(packet);
-    } else {
-        // First time this packet has been seen
-        pkt = packet;
-        // Add To the possible reassembly list
-        vector_append(capinfo->tcp_reasm, packet);
-    }
+    // Store tcp sequence
+    packet->tcp_seq = seq;
 
-    // Store firt tcp sequence
-    if (pkt->tcp_seq == 0) {
-        pkt->tcp_seq = ntohl(tcp->th_seq);
-    }
+    // Look for pending data of this connection
+    snprintf(key, sizeof(key), "%s:%u %s:%u",
+             address_get_ip(packet->src, srcip), packet->src.port,
+             address_get_ip(packet->dst, dstip), packet->dst.port);
 
-    // If the first frame of this packet
-    if (vector_count(pkt->frames) == 1) {
-        // Set initial payload
-        packet_set_payload(pkt, payload, size_payload);
-    } else {
-        // Check payload length. Dont handle too big payload packets
-        if (pkt->payload_len + size_payload > MAX_CAPTURE_LEN) {
-            packet_destroy(pkt);
-            vector_remove(capinfo->tcp_reasm, pkt);
+    if (!(stream = htable_find(capinfo->tcp_reasm_index, key))) {
+        // Most messages fit in one segment and are returned without copying them
+        int valid = sip_validate_payload(payload, size_payload, &state, &msglen);
+        if (valid == VALIDATE_COMPLETE_SIP)
+            return packet;
+        // Not a SIP packet, store until PSH flag
+        if (valid == VALIDATE_NOT_SIP && (tcp->th_flags & TH_PUSH))
+            return packet;
+
+        // First time this connection has pending data
+        if (!(stream = capture_tcp_stream_create(capinfo, key, packet, seq))) {
+            packet_destroy(packet);
             return NULL;
         }
-        new_payload = sng_malloc(pkt->payload_len + size_payload);
-        if (pkt->tcp_seq < ntohl(tcp->th_seq)) {
-            // Append payload to the existing
-            pkt->tcp_seq =  ntohl(tcp->th_seq);
-            memcpy(new_payload, pkt->payload, pkt->payload_len);
-            memcpy(new_payload + pkt->payload_len, payload, size_payload);
-        } else {
-            // Prepend payload to the existing
-            memcpy(new_payload, payload, size_payload);
-            memcpy(new_payload + size_payload, pkt->payload, pkt->payload_len);
+        *stream->validate = state;
+        capinfo->tcp_reasm_size += stream->size;
+    } else {
+        size = stream->size;
+        ret = capture_tcp_stream_add(stream, packet, seq);
+        capinfo->tcp_reasm_size += stream->size - size;
+        if (ret != 0) {
+            // Dont handle too big payload packets
+            capture_tcp_stream_destroy(capinfo, stream);
+            return NULL;
         }
-        packet_set_payload(pkt, new_payload, pkt->payload_len + size_payload);
-        sng_free(new_payload);
     }
+    stream->ts = now;
 
-    // Store full payload content
-    memset(full_payload, 0, MAX_CAPTURE_LEN);
-    memcpy(full_payload, pkt->payload, pkt->payload_len);
+    // Keep pending connections under the memory limit
+    if (capture_tcp_stream_trim(capinfo, stream) != 0)
+        return NULL;
 
     // This packet is ready to be parsed
-    int original_size = pkt->payload_len;
-    int valid = sip_validate_packet(pkt);
-    if (valid == VALIDATE_COMPLETE_SIP) {
-        // Full SIP packet!
-        vector_remove(capinfo->tcp_reasm, pkt);
-        return pkt;
-    } else if (valid == VALIDATE_MULTIPLE_SIP) {
-        vector_remove(capinfo->tcp_reasm, pkt);
-
-        // We have a full SIP Packet, but do not remove everything from the reasm queue
-        packet_t *cont = packet_clone(pkt);
-        int pldiff = original_size - pkt->payload_len;
-        if (pldiff > 0 && pldiff < MAX_CAPTURE_LEN) {
-            packet_set_payload(cont, full_payload + pkt->payload_len, pldiff);
-            vector_append(capinfo->tcp_reasm, cont);
-        }
-
-        // Return the full initial packet
-        return pkt;
-    } else if (valid == VALIDATE_NOT_SIP) {
+    stream->valid = sip_validate_payload(stream->data, stream->len, stream->validate, &msglen);
+    if (stream->valid == VALIDATE_COMPLETE_SIP || stream->valid == VALIDATE_MULTIPLE_SIP) {
+        // Full SIP packet! Remaining data is kept for the next message
+        return capture_tcp_stream_extract(capinfo, stream, msglen);
+    } else if (stream->valid == VALIDATE_NOT_SIP) {
         // Not a SIP packet, store until PSH flag
         if (tcp->th_flags & TH_PUSH) {
-            vector_remove(capinfo->tcp_reasm, pkt);
-            return pkt;
+            return capture_tcp_stream_extract(capinfo, stream, stream->len);
         }
     }
 
@@ -693,18 +1087,261 @@ capture_packet_reasm_tcp(capture_info_t *capinfo, packet_t *packet, struct tcphd
     return NULL;
 }
 
-int
-capture_ws_check_packet(packet_t *packet)
+capture_tcp_stream_t *
+capture_tcp_stream_create(capture_info_t *capinfo, const char *key, packet_t *packet, uint32_t seq)
 {
-    int ws_off = 0;
-    u_char ws_fin;
-    u_char ws_opcode;
-    u_char ws_mask;
-    uint8_t ws_len;
-    u_char ws_mask_key[4];
-    u_char *payload, *newpayload;
-    uint32_t size_payload;
-    int i;
+    capture_tcp_stream_t *stream;
+
+    if (!(stream = sng_malloc(sizeof(capture_tcp_stream_t))))
+        return NULL;
+
+    strcpy(stream->key, key);
+    stream->seq = seq;
+    stream->segments = vector_create(0, 4);
+    stream->validate = sng_malloc(sizeof(sip_validate_state_t));
+
+    // Copy first segment payload
+    if (capture_tcp_stream_append(stream, packet_payload(packet), packet_payloadlen(packet)) != 0) {
+        vector_destroy(stream->segments);
+        sng_free(stream->validate);
+        sng_free(stream);
+        return NULL;
+    }
+    stream->packet = packet;
+
+    htable_insert(capinfo->tcp_reasm_index, stream->key, stream);
+    vector_append(capinfo->tcp_reasm, stream);
+    return stream;
+}
+
+void
+capture_tcp_stream_destroy(capture_info_t *capinfo, capture_tcp_stream_t *stream)
+{
+    if (capinfo->tcp_ready == stream)
+        capinfo->tcp_ready = NULL;
+    htable_remove(capinfo->tcp_reasm_index, stream->key);
+    vector_remove(capinfo->tcp_reasm, stream);
+    capinfo->tcp_reasm_size -= stream->size;
+    vector_set_destroyer(stream->segments, packet_destroyer);
+    vector_destroy(stream->segments);
+    packet_destroy(stream->packet);
+    sng_free(stream->validate);
+    sng_free(stream->data);
+    sng_free(stream);
+}
+
+int
+capture_tcp_stream_append(capture_tcp_stream_t *stream, const u_char *data, uint32_t len)
+{
+    u_char *newdata;
+    uint32_t alloc;
+
+    // Check payload length
+    if (stream->len + len > MAX_CAPTURE_LEN)
+        return 1;
+
+    // Grow assembled payload memory, keeping room for the zero byte
+    if (stream->len + len + 1 > stream->alloc) {
+        alloc = stream->alloc ? stream->alloc : 1024;
+        while (alloc < stream->len + len + 1)
+            alloc *= 2;
+        if (!(newdata = realloc(stream->data, alloc)))
+            return 1;
+        stream->data = newdata;
+        stream->size += alloc - stream->alloc;
+        stream->alloc = alloc;
+    }
+
+    memcpy(stream->data + stream->len, data, len);
+    stream->len += len;
+    stream->data[stream->len] = '\0';
+    return 0;
+}
+
+int
+capture_tcp_stream_add(capture_tcp_stream_t *stream, packet_t *segment, uint32_t seq)
+{
+    packet_t *pending;
+    int32_t offset = seq - stream->seq;
+    uint32_t len = packet_payloadlen(segment);
+    u_char *data;
+    uint32_t datalen;
+    int pos, ret = 0;
+
+    // Segment belongs after a missing one: keep it sorted by sequence
+    if (offset > (int32_t) stream->len) {
+        if (offset + len > MAX_CAPTURE_LEN) {
+            packet_destroy(segment);
+            return 1;
+        }
+        for (pos = 0; pos < vector_count(stream->segments); pos++) {
+            pending = vector_item(stream->segments, pos);
+            if ((int32_t) (seq - pending->tcp_seq) < 0)
+                break;
+        }
+        vector_append(stream->segments, segment);
+        vector_insert(stream->segments, segment, pos);
+        stream->size += len;
+        return 0;
+    }
+
+    if (offset < 0) {
+        if (offset + (int32_t) len == 0 && stream->valid == VALIDATE_NOT_SIP) {
+            // Data before the first received segment, that was not a message start
+            datalen = stream->len;
+            data = sng_malloc(datalen);
+            memcpy(data, stream->data, datalen);
+            stream->len = 0;
+            ret = capture_tcp_stream_append(stream, packet_payload(segment), len)
+                  || capture_tcp_stream_append(stream, data, datalen);
+            sng_free(data);
+            stream->seq = seq;
+            memset(stream->validate, 0, sizeof(sip_validate_state_t));
+        }
+    } else if (offset + len > stream->len) {
+        // Only use data that was not already assembled (retransmissions)
+        ret = capture_tcp_stream_append(stream, packet_payload(segment) + (stream->len - offset),
+                                        offset + len - stream->len);
+    }
+
+    // Segment data has been used or is retransmitted data
+    packet_move_frames(stream->packet, segment);
+    packet_destroy(segment);
+    if (ret != 0)
+        return 1;
+
+    // Add stored segments that are now in sequence
+    while ((pending = vector_first(stream->segments))) {
+        if ((int32_t) (pending->tcp_seq - stream->seq) > (int32_t) stream->len)
+            break;
+        vector_remove(stream->segments, pending);
+        stream->size -= packet_payloadlen(pending);
+        if (capture_tcp_stream_add(stream, pending, pending->tcp_seq) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+packet_t *
+capture_tcp_stream_extract(capture_info_t *capinfo, capture_tcp_stream_t *stream, uint32_t len)
+{
+    packet_t *pkt = stream->packet;
+
+    // Set the message payload
+    packet_set_payload(pkt, stream->data, len);
+
+    // No more data pending in this connection
+    if (len == stream->len && vector_count(stream->segments) == 0) {
+        stream->packet = NULL;
+        capture_tcp_stream_destroy(capinfo, stream);
+        return pkt;
+    }
+
+    // Remaining data frames are shared with the returned message
+    if (len < stream->len) {
+        stream->packet = packet_clone(pkt);
+    } else {
+        stream->packet = packet_create(pkt->ip_version, pkt->proto, pkt->src, pkt->dst, pkt->ip_id);
+    }
+    packet_set_type(stream->packet, pkt->type);
+
+    // Keep data for the next message
+    memmove(stream->data, stream->data + len, stream->len - len);
+    stream->len -= len;
+    stream->data[stream->len] = '\0';
+    stream->seq += len;
+    memset(stream->validate, 0, sizeof(sip_validate_state_t));
+
+    // Remaining data could already contain another message
+    capinfo->tcp_ready = (stream->len) ? stream : NULL;
+
+    return pkt;
+}
+
+void
+capture_tcp_stream_evict(capture_info_t *capinfo, capture_tcp_stream_t *stream)
+{
+    atomic_fetch_add(&capinfo->tcp_reasm_evicted, 1);
+    capture_tcp_stream_destroy(capinfo, stream);
+}
+
+void
+capture_tcp_stream_expire(capture_info_t *capinfo, const struct timeval *now)
+{
+    capture_tcp_stream_t *stream;
+    int i;
+
+    // Don't check all connections for every segment
+    if (now->tv_sec < capinfo->tcp_reasm_sweep)
+        return;
+    capinfo->tcp_reasm_sweep = now->tv_sec + 1;
+
+    for (i = vector_count(capinfo->tcp_reasm) - 1; i >= 0; i--) {
+        stream = vector_item(capinfo->tcp_reasm, i);
+        if (stream->ts.tv_sec + capture_cfg.tcp_timeout < now->tv_sec)
+            capture_tcp_stream_evict(capinfo, stream);
+    }
+}
+
+int
+capture_tcp_stream_trim(capture_info_t *capinfo, capture_tcp_stream_t *current)
+{
+    capture_tcp_stream_t *stream, *oldest;
+    vector_iter_t it;
+
+    while (capinfo->tcp_reasm_size > capture_cfg.tcp_memory) {
+        // Look for the connection that received data first
+        oldest = NULL;
+        it = vector_iterator(capinfo->tcp_reasm);
+        while ((stream = vector_iterator_next(&it))) {
+            if (stream == current)
+                continue;
+            if (!oldest || timercmp(&stream->ts, &oldest->ts, <))
+                oldest = stream;
+        }
+
+        // Only current connection is left
+        if (!oldest) {
+            capture_tcp_stream_evict(capinfo, current);
+            return 1;
+        }
+        capture_tcp_stream_evict(capinfo, oldest);
+    }
+
+    return 0;
+}
+
+packet_t *
+capture_tcp_stream_next(capture_info_t *capinfo)
+{
+    capture_tcp_stream_t *stream = capinfo->tcp_ready;
+    uint32_t msglen;
+
+    if (!stream)
+        return NULL;
+
+    // Check if remaining data of last assembled segment is a full message
+    capinfo->tcp_ready = NULL;
+    stream->valid = sip_validate_payload(stream->data, stream->len, stream->validate, &msglen);
+    if (stream->valid == VALIDATE_COMPLETE_SIP || stream->valid == VALIDATE_MULTIPLE_SIP)
+        return capture_tcp_stream_extract(capinfo, stream, msglen);
+
+    return NULL;
+}
+
+int
+capture_ws_check_packet(packet_t *packet)
+{
+    int ws_off = 0;
+    u_char ws_fin;
+    u_char ws_opcode;
+    u_char ws_mask;
+    uint8_t ws_len;
+    u_char ws_mask_key[4];
+    u_char *payload, *newpayload;
+    uint32_t size_payload;
+    int i;
 
     /**
      * WSocket header definition according to RFC 6455
@@ -800,16 +1437,23 @@ capture_packet_parse(packet_t *packet)
 {
     // Media structure for RTP packets
     rtp_stream_t *stream;
+    sip_call_t *call;
 
     // We're only interested in packets with payload
     if (packet_payloadlen(packet)) {
         // Parse this header and payload
+        LATENCY_START(sip_start);
         if (sip_check_packet(packet)) {
+            LATENCY_RECORD(LATENCY_SIP, sip_start);
             return 0;
         }
+        LATENCY_RECORD(LATENCY_SIP, sip_start);
 
         // Check if this packet belongs to a RTP stream
-        if ((stream = rtp_check_packet(packet))) {
+        LATENCY_START(rtp_start);
+        stream = rtp_check_packet(packet);
+        LATENCY_RECORD(LATENCY_RTP, rtp_start);
+        if (stream) {
             // We have an RTP packet!
             packet_set_type(packet, PACKET_RTP);
             // Store this pacekt if capture rtp is enabled
@@ -817,11 +1461,38 @@ capture_packet_parse(packet_t *packet)
                 call_add_rtp_packet(stream_get_call(stream), packet);
                 return 0;
             }
+            // Calls with running streams are not the least recently updated
+            if ((call = stream_get_call(stream)))
+                sip_calls_update(call, 0);
+            // Otherwise only stream counters are updated, unless last packets are kept
+            if (capture_cfg.rtp_samples && stream_add_sample(stream, packet, capture_cfg.rtp_samples) == 0)
+                return 0;
         }
     }
     return 1;
 }
 
+size_t
+capture_packet_size(packet_t *packet)
+{
+    frame_t *frame;
+    size_t size = sizeof(packet_t) + sizeof(vector_t);
+
+    vector_iter_t it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        size += sizeof(frame_t) + sizeof(struct pcap_pkthdr);
+        // Compressed packets are counted uncompressed
+        if (capture_cfg.storage == CAPTURE_STORAGE_MEMORY || capture_cfg.storage == CAPTURE_STORAGE_COMPRESSED)
+            size += frame->header->caplen;
+    }
+
+    // Payload not stored in frames (it is always copied without storage)
+    if (capture_cfg.storage != CAPTURE_STORAGE_DISK && (!packet->payload_ref || capture_cfg.storage == 0))
+        size += packet->payload_len + 1;
+
+    return size;
+}
+
 void
 capture_close()
 {
@@ -831,28 +1502,62 @@ capture_close()
     if (vector_count(capture_cfg.sources) == 0)
         return;
 
-    // Close dump file
-    if (capture_cfg.pd) {
-        dump_close(capture_cfg.pd);
-    }
-
     // Stop all captures
     vector_iter_t it = vector_iterator(capture_cfg.sources);
     while ((capinfo = vector_iterator_next(&it))) {
+        // Capture threads were never launched for this source
+        if (!capinfo->ring)
+            continue;
+
         //Close PCAP file
         if (capinfo->handle) {
-            if (capinfo->running) {
+            if (!capinfo->eof) {
                 /* We must cancel the thread here instead of joining because, according to pcap_breakloop man page,
                  * you can only break pcap_loop from within the same thread.
                  * @see: https://www.tcpdump.org/manpages/pcap_breakloop.3pcap.html
                  */
                 pcap_breakloop(capinfo->handle);
                 pthread_cancel(capinfo->capture_t);
-                pthread_join(capinfo->capture_t, NULL);
             }
+            pthread_join(capinfo->capture_t, NULL);
         }
+
+        // Discard filter never applied by capture thread
+        sng_free(atomic_exchange(&capinfo->filter_pending, NULL));
+
+#ifdef USE_TPACKET
+        // Release kernel capture ring
+        capture_tpacket_close(capinfo);
+#endif
+
+        // Parser thread does not read from libpcap, so it can be stopped gracefully
+        capinfo->stopping = true;
+        capture_parser_wakeup(capinfo, true);
+        pthread_join(capinfo->parser_t, NULL);
+
+        // Stop decoding workers of mapped input files
+        capture_mmap_close(capinfo);
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+        // Stop decrypting workers
+        capture_tls_close(capinfo);
+#endif
+
+        // Discard any frame that has not been parsed
+        frame_buffer_t *frame;
+        while ((frame = ring_pop(capinfo->ring)))
+            frame_buffer_destroy(frame);
+        ring_destroy(capinfo->ring);
+        capinfo->ring = NULL;
+
+        // Discard data pending IP and TCP reassembly
+        capture_reasm_destroy(capinfo);
+        pthread_cond_destroy(&capinfo->ring_cond);
+        pthread_mutex_destroy(&capinfo->ring_lock);
     }
 
+    // Write pending frames and close dump file
+    capture_writer_close(capture_cfg.writer);
+    capture_cfg.writer = NULL;
 }
 
 int
@@ -865,14 +1570,41 @@ capture_launch_thread(capture_info_t *capinfo)
     // Start all captures threads
     vector_iter_t it = vector_iterator(capture_cfg.sources);
     while ((capinfo = vector_iterator_next(&it))) {
+        // Create the queue between capture and parser threads
+        if (!(capinfo->ring = ring_create(capture_cfg.ring_size))) {
+            return 1;
+        }
+        atomic_init(&capinfo->eof, false);
+        atomic_init(&capinfo->stopping, false);
+        atomic_init(&capinfo->parser_waiting, false);
+        pthread_mutex_init(&capinfo->ring_lock, NULL);
+        pthread_cond_init(&capinfo->ring_cond, NULL);
+
+        // Start decoding workers of mapped input files
+        if (capinfo->mmap && capture_mmap_launch(capinfo) != 0) {
+            return 1;
+        }
+
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+        // Mapped files workers already decrypt their own connections
+        if (!capinfo->mmap && (capture_cfg.keyfile || capture_cfg.keylogfile)
+                && capture_tls_launch(capinfo) != 0) {
+            return 1;
+        }
+#endif
+
         // Mark capture as running
         capinfo->running = true;
+        if (pthread_create(&capinfo->parser_t, &attr, (void *) capture_parser_thread, capinfo)) {
+            return 1;
+        }
         if (pthread_create(&capinfo->capture_t, &attr, (void *) capture_thread, capinfo)) {
             return 1;
         }
     }
 
     pthread_attr_destroy(&attr);
+    atomic_store(&capture_cfg.launched, true);
     return 0;
 }
 
@@ -880,12 +1612,256 @@ void
 capture_thread(void *info)
 {
     capture_info_t *capinfo = (capture_info_t *) info;
+    time_t stats = 0;
+    int ret;
+
+    // Run on CPUs close to the capture device
+    affinity_apply(AFFINITY_CAPTURE);
 
-    // Parse available packets
-    pcap_loop(capinfo->handle, -1, parse_packet, (u_char *) capinfo);
+    // Queue available packets
+#ifdef USE_TPACKET
+    if (capinfo->tpacket) {
+        capture_tpacket_loop(capinfo);
+    } else
+#endif
+    if (capinfo->mmap) {
+        capture_mmap_loop(capinfo);
+    } else
+    for (;;) {
+        // Queue a batch of frames and notify parser once
+        ret = pcap_dispatch(capinfo->handle, capture_cfg.batch_size,
+                            capture_queue_packet, (u_char *) capinfo);
+        // Capture has been stopped or failed
+        if (ret < 0)
+            break;
+        // No more frames in the input file
+        if (ret == 0 && capinfo->infile)
+            break;
+        // Keep next file chunks being read while this batch is parsed
+        if (capinfo->readahead.size)
+            capture_readahead(&capinfo->readahead, ftell(pcap_file(capinfo->handle)));
+        capture_parser_wakeup(capinfo, false);
+        // Handler filter can only be changed from this thread
+        if (atomic_load(&capinfo->filter_pending))
+            capture_filter_apply(capinfo);
+        // Handler statistics can only be read from this thread
+        if (!capinfo->infile && time(NULL) - stats >= CAPTURE_STATS_INTERVAL) {
+            capture_pcap_stats(capinfo);
+            stats = time(NULL);
+        }
+    }
+
+    // Let the parser know no more frames will be queued
+    capinfo->eof = true;
+    capture_parser_wakeup(capinfo, true);
+}
+
+void
+capture_parser_thread(void *info)
+{
+    capture_info_t *capinfo = (capture_info_t *) info;
+    frame_buffer_t *frame;
+    packet_t **batch;
+    size_t count, i;
+    ring_t *ring;
+
+    affinity_apply(AFFINITY_PARSER);
+
+    // Decoded packets waiting to be processed
+    if (!(batch = sng_malloc(sizeof(packet_t *) * capture_cfg.batch_size))) {
+        capinfo->running = false;
+        return;
+    }
+
+    while (!capinfo->stopping) {
+        // Decode a batch of queued frames without locking
+        for (count = 0; count < capture_cfg.batch_size;) {
+            // Packets decoded by workers are processed in file order
+            if (capinfo->mmap) {
+                if (!(batch[count] = capture_mmap_next(capinfo)))
+                    break;
+                count++;
+                continue;
+            }
+            // Messages sent in the same TCP segment than the previous one
+            if ((batch[count] = capture_tcp_stream_next(capinfo))) {
+                count++;
+                continue;
+            }
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+            // Packets already decrypted by TLS workers
+            if ((batch[count] = capture_tls_next(capinfo))) {
+                count++;
+                continue;
+            }
+#endif
+            if (!(frame = ring_pop(capinfo->ring)))
+                break;
+            LATENCY_START(packet_start);
+            if ((batch[count] = parse_packet(capinfo, frame)))
+                count++;
+            LATENCY_RECORD(LATENCY_PACKET, packet_start);
+        }
+
+        // Let other threads know pending reassembly data
+        capture_reasm_publish(capinfo);
+
+        if (count) {
+            // File index is only used by this thread
+            for (i = 0; i < count; i++)
+                capture_index_packet(capinfo->index, batch[i]);
+            // Avoid parsing from multiples sources.
+            // Avoid parsing while screen in being redrawn
+            LATENCY_START(lock_start);
+            capture_lock();
+            LATENCY_RECORD(LATENCY_LOCK, lock_start);
+            for (i = 0; i < count; i++)
+                capture_packet_process(capinfo, batch[i]);
+            // Allow Interface refresh and user input actions
+            capture_unlock();
+            capture_writer_wakeup(capture_cfg.writer, false);
+            continue;
+        }
+
+        // Mapped files wait for the worker decoding next frame
+        ring = (capinfo->mmap) ? capture_mmap_ring(capinfo) : capinfo->ring;
+
+        // All frames from a finished capture have been parsed
+        if (capinfo->eof && ring == capinfo->ring && ring_count(ring) == 0
+                && capture_parser_idle(capinfo))
+            break;
+
+        // Wait until capture thread queues more frames
+        capture_parser_wait(capinfo, ring);
+    }
+
+    // Store input file index once all its frames have been parsed
+    if (!capinfo->stopping)
+        capture_index_save(capinfo->index);
+
+    sng_free(batch);
     capinfo->running = false;
 }
 
+void *
+capture_expire_thread(void *none)
+{
+    time_t last = 0, filter = 0;
+
+    while (atomic_load(&capture_cfg.expire_running)) {
+        if (time(NULL) != last) {
+            last = time(NULL);
+            if (sip_calls_expire_enabled()) {
+                capture_lock();
+                sip_calls_expire(last);
+                capture_unlock();
+            }
+            // Sources can not be walked until all of them have been added
+            if (capture_cfg.rtp_filter && atomic_load(&capture_cfg.launched)
+                    && last - filter >= capture_cfg.rtp_filter) {
+                capture_rtp_filter_update();
+                filter = last;
+            }
+            if (capture_snapshot_due(last))
+                capture_snapshot_save();
+        }
+        // Calls changes are published more often than other tasks
+        if (sip_export_enabled()) {
+            capture_lock();
+            sip_export_update();
+            capture_unlock();
+        }
+        usleep(CAPTURE_EXPIRE_WAIT * 1000);
+    }
+
+    return NULL;
+}
+
+char *
+capture_rtp_filter_build()
+{
+    static address_t dsts[CAPTURE_RTP_FILTER_MAX];
+    const char *base = capture_cfg.filter ? capture_cfg.filter : CAPTURE_RTP_FILTER_SIP;
+    char ip[ADDRESSLEN];
+    char *text;
+    size_t size, len;
+    int count, i;
+
+    capture_lock_read();
+    count = rtp_index_destinations(dsts, CAPTURE_RTP_FILTER_MAX);
+    capture_unlock();
+
+    size = strlen(base) + 128 + (count > 0 ? count : 0) * (ADDRESSLEN + 40);
+    if (!(text = sng_malloc(size)))
+        return NULL;
+
+    // Signalling and IP fragments (only first fragment has UDP header)
+    len = snprintf(text, size, "(%s) or (ip[6:2] & 0x3fff != 0) or (ip6 and ip6[6] == 44)", base);
+
+    if (count < 0) {
+        // Too many streams to list them all
+        snprintf(text + len, size - len, " or udp");
+    } else if (count > 0) {
+        len += snprintf(text + len, size - len, " or (udp and (");
+        for (i = 0; i < count; i++) {
+            len += snprintf(text + len, size - len, "%s(dst host %s and dst port %u)",
+                            i ? " or " : "", address_get_ip(dsts[i], ip), dsts[i].port);
+        }
+        snprintf(text + len, size - len, "))");
+    }
+
+    return text;
+}
+
+void
+capture_rtp_filter_update()
+{
+    capture_info_t *capinfo;
+    char *filter;
+
+    if (!(filter = capture_rtp_filter_build()))
+        return;
+
+    // Media has not changed since last update
+    if (capture_cfg.rtp_filter_text && !strcmp(filter, capture_cfg.rtp_filter_text)) {
+        sng_free(filter);
+        return;
+    }
+    sng_free(capture_cfg.rtp_filter_text);
+    capture_cfg.rtp_filter_text = filter;
+
+    vector_iter_t it = vector_iterator(capture_cfg.sources);
+    while ((capinfo = vector_iterator_next(&it))) {
+        // Only online sources read by libpcap threads have kernel filters
+        if (capinfo->infile || !capinfo->handle || !capinfo->running)
+            continue;
+#ifdef USE_TPACKET
+        if (capinfo->tpacket)
+            continue;
+#endif
+        // Replace any filter capture thread has not applied yet
+        sng_free(atomic_exchange(&capinfo->filter_pending, strdup(filter)));
+    }
+}
+
+void
+capture_filter_apply(capture_info_t *capinfo)
+{
+    struct bpf_program fp;
+    char *filter;
+
+    if (!(filter = atomic_exchange(&capinfo->filter_pending, NULL)))
+        return;
+
+    // Keep previous filter if new one can not be used
+    if (pcap_compile(capinfo->handle, &fp, filter, 1, capinfo->mask) == 0) {
+        pcap_setfilter(capinfo->handle, &fp);
+        pcap_freecode(&fp);
+    }
+
+    sng_free(filter);
+}
+
 int
 capture_is_online()
 {
@@ -918,6 +1894,20 @@ capture_set_bpf_filter(const char *filter)
 
     // Apply the given filter to all sources
     while ((capinfo = vector_iterator_next(&it))) {
+#ifdef USE_TPACKET
+        // AF_PACKET sources filter frames by themselves
+        if (capinfo->tpacket) {
+            if (capture_tpacket_set_filter(capinfo, filter) != 0)
+                return 1;
+            continue;
+        }
+#endif
+        // Mapped input files are not read by libpcap
+        if (capinfo->mmap) {
+            if (capture_mmap_set_filter(capinfo, filter) != 0)
+                return 1;
+            continue;
+        }
         //! Check if filter compiles
         if (pcap_compile(capinfo->handle, &capture_cfg.fp, filter, 0, capinfo->mask) == -1)
             return 1;
@@ -953,11 +1943,117 @@ capture_paused()
     return capture_cfg.paused;
 }
 
+int
+capture_set_replay(const char *speed)
+{
+    char *copy, *token, *end;
+    double value;
+
+    capture_cfg.replay_speed = 0;
+    capture_cfg.replay_pps = 0;
+
+    if (!speed || !strlen(speed))
+        return 0;
+
+    if (!(copy = strdup(speed)))
+        return 1;
+
+    for (token = strtok(copy, ","); token; token = strtok(NULL, ",")) {
+        value = strtod(token, &end);
+        if (value <= 0 || end == token)
+            break;
+        if (!strcasecmp(end, "x")) {
+            capture_cfg.replay_speed = value;
+        } else if (!strcasecmp(end, "pps") && value <= UINT32_MAX) {
+            capture_cfg.replay_pps = value;
+        } else {
+            break;
+        }
+    }
+    sng_free(copy);
+
+    // Some part of the speed text is not valid
+    if (token) {
+        capture_cfg.replay_speed = 0;
+        capture_cfg.replay_pps = 0;
+        return 1;
+    }
+    return 0;
+}
+
+bool
+capture_replay_enabled()
+{
+    return capture_cfg.replay_speed > 0 || capture_cfg.replay_pps > 0;
+}
+
+void
+capture_replay_wait(capture_info_t *capinfo, const struct pcap_pkthdr *header)
+{
+    struct timespec ts;
+    uint64_t now, due = 0, rate_due, frames;
+    int64_t offset;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    // First frame is replayed at once and sets the reference for the rest
+    frames = atomic_load_explicit(&capinfo->replay_frames, memory_order_relaxed);
+    if (frames == 0) {
+        capinfo->replay_ts = header->ts;
+        capinfo->replay_start = now;
+    }
+
+    // Frame is due when its capture offset (scaled by speed) has passed
+    if (capture_cfg.replay_speed > 0) {
+        offset = (int64_t) (header->ts.tv_sec - capinfo->replay_ts.tv_sec) * 1000000000LL
+                 + (int64_t) (header->ts.tv_usec - capinfo->replay_ts.tv_usec) * 1000LL;
+        // Frames captured before the first one are replayed at once
+        if (offset > 0)
+            due = capinfo->replay_start + (uint64_t) (offset / capture_cfg.replay_speed);
+    }
+
+    // But never sooner than the max frame rate allows
+    if (capture_cfg.replay_pps > 0) {
+        rate_due = capinfo->replay_start + frames * 1000000000ULL / capture_cfg.replay_pps;
+        if (rate_due > due)
+            due = rate_due;
+    }
+
+    // Sleep only if frame is not due soon, shorter waits are not worth a wakeup
+    if (due > now && due - now >= CAPTURE_REPLAY_SLACK * 1000ULL) {
+        // Let the parser process frames already queued while waiting
+        capture_parser_wakeup(capinfo, false);
+        ts.tv_sec = due / 1000000000ULL;
+        ts.tv_nsec = due % 1000000000ULL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            continue;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now = (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    // Publish replay progress
+    atomic_store_explicit(&capinfo->replay_frames, frames + 1, memory_order_relaxed);
+    atomic_store_explicit(&capinfo->replay_elapsed, (now - capinfo->replay_start) / 1000, memory_order_relaxed);
+    // Frames without due time (first and out of order ones) are never late
+    offset = (due && now > due) ? (now - due) / 1000 : 0;
+    atomic_store_explicit(&capinfo->replay_lag, offset, memory_order_relaxed);
+    if ((uint64_t) offset > atomic_load_explicit(&capinfo->replay_lag_max, memory_order_relaxed))
+        atomic_store_explicit(&capinfo->replay_lag_max, offset, memory_order_relaxed);
+}
+
 const char *
 capture_status_desc()
 {
     int online = 0, offline = 0, loading = 0;
-
+    uint32_t usage, ring_usage = 0;
+    unsigned long ring_drops = 0, frag_evicted = 0, tcp_evicted = 0, dump_drops;
+    unsigned long eep_drops = 0, eep_errors = 0, eep_unsent = 0;
+    unsigned long replay_rate = 0, replay_lag = 0, elapsed;
+    size_t loaded = 0, total = 0;
+    const char *status;
+    static char desc[256];
+    int len;
 
     capture_info_t *capinfo;
     vector_iter_t it = vector_iterator(capture_cfg.sources);
@@ -966,44 +2062,119 @@ capture_status_desc()
             offline++;
             if (capinfo->running) {
                 loading++;
+                // Get read bytes of files being loaded
+                if (capinfo->infile_size) {
+                    loaded += capture_offline_loaded(capinfo);
+                    total += capinfo->infile_size;
+                }
+                // Get achieved rate and lag of files being replayed
+                if ((elapsed = atomic_load_explicit(&capinfo->replay_elapsed, memory_order_relaxed)) > 0) {
+                    replay_rate += atomic_load_explicit(&capinfo->replay_frames, memory_order_relaxed)
+                                   * 1000000ULL / elapsed;
+                    if (atomic_load_explicit(&capinfo->replay_lag, memory_order_relaxed) > replay_lag)
+                        replay_lag = atomic_load_explicit(&capinfo->replay_lag, memory_order_relaxed);
+                }
             }
         } else {
             online++;
         }
+
+        // Get the most used ring and all discarded frames
+        if (capinfo->ring) {
+            usage = ring_count(capinfo->ring) * 100 / ring_size(capinfo->ring);
+            if (usage > ring_usage)
+                ring_usage = usage;
+            ring_drops += ring_overflows(capinfo->ring);
+        }
+
+        // Get all discarded IP fragments and TCP connections
+        frag_evicted += atomic_load(&capinfo->ip_reasm_evicted);
+        tcp_evicted += atomic_load(&capinfo->tcp_reasm_evicted);
+        if (capinfo->mmap)
+            capture_mmap_evicted(capinfo, &frag_evicted, &tcp_evicted);
     }
 
 #ifdef USE_EEP
     // EEP Listen mode is always considered online
     if (capture_eep_listen_port()) {
         online++;
+        capture_eep_listen_stats(&eep_drops, &eep_errors);
     }
+    eep_unsent = capture_eep_send_dropped();
 #endif
 
     if (capture_paused()) {
         if (online > 0 && offline == 0) {
-            return "Online (Paused)";
+            status = "Online (Paused)";
         } else if (online == 0 && offline > 0) {
-            return "Offline (Paused)";
+            status = "Offline (Paused)";
         } else {
-            return "Mixed (Paused)";
+            status = "Mixed (Paused)";
         }
     } else if (loading > 0) {
         if (online > 0 && offline == 0) {
-            return "Online (Loading)";
+            status = "Online (Loading)";
         } else if (online == 0 && offline > 0) {
-            return "Offline (Loading)";
+            status = "Offline (Loading)";
         } else {
-            return "Mixed (Loading)";
+            status = "Mixed (Loading)";
         }
     } else {
         if (online > 0 && offline == 0) {
-            return "Online";
+            status = "Online";
         } else if (online == 0 && offline > 0) {
-            return "Offline";
+            status = "Offline";
         } else {
-            return "Mixed";
+            status = "Mixed";
         }
     }
+
+    // Only report queue status while there are frames or drops to show
+    // Get frames that could not be stored in output file
+    dump_drops = capture_writer_dropped(capture_cfg.writer);
+
+    if (ring_usage == 0 && ring_drops == 0 && frag_evicted == 0 && tcp_evicted == 0 && total == 0
+            && replay_rate == 0 && dump_drops == 0 && eep_drops == 0 && eep_errors == 0 && eep_unsent == 0)
+        return status;
+
+    len = snprintf(desc, sizeof(desc), "%s", status);
+    if (total)
+        len += snprintf(desc + len, sizeof(desc) - len, " [Loaded %u%%]", (uint32_t) (loaded * 100 / total));
+    if (replay_rate)
+        len += snprintf(desc + len, sizeof(desc) - len, " [Replay %lu fps, %lu ms late]", replay_rate, replay_lag / 1000);
+    if (ring_usage || ring_drops)
+        len += snprintf(desc + len, sizeof(desc) - len, " [Queue %u%%, %lu dropped]", ring_usage, ring_drops);
+    if (frag_evicted)
+        len += snprintf(desc + len, sizeof(desc) - len, " [%lu fragments discarded]", frag_evicted);
+    if (tcp_evicted)
+        len += snprintf(desc + len, sizeof(desc) - len, " [%lu TCP streams discarded]", tcp_evicted);
+    if (dump_drops)
+        len += snprintf(desc + len, sizeof(desc) - len, " [%lu frames not saved]", dump_drops);
+    if (eep_drops || eep_errors)
+        len += snprintf(desc + len, sizeof(desc) - len, " [HEP %lu dropped, %lu invalid]", eep_drops, eep_errors);
+    if (eep_unsent)
+        snprintf(desc + len, sizeof(desc) - len, " [HEP %lu not sent]", eep_unsent);
+    return desc;
+}
+
+size_t
+capture_offline_loaded(capture_info_t *capinfo)
+{
+    FILE *file;
+    long pos;
+
+    if (!capinfo->infile)
+        return 0;
+
+    // Mapped files keep the offset of next record
+    if (capinfo->mmap)
+        return capture_mmap_loaded(capinfo);
+
+    // Files read by libpcap
+    if (capinfo->handle && (file = pcap_file(capinfo->handle)) && (pos = ftell(file)) > 0)
+        return pos;
+
+    return 0;
 }
 
 const char*
@@ -1049,6 +2220,18 @@ capture_set_keyfile(const char *keyfile)
     capture_cfg.keyfile = keyfile;
 }
 
+const char*
+capture_keylogfile()
+{
+    return capture_cfg.keylogfile;
+}
+
+void
+capture_set_keylogfile(const char *keylogfile)
+{
+    capture_cfg.keylogfile = keylogfile;
+}
+
 address_t
 capture_tls_server()
 {
@@ -1061,6 +2244,78 @@ capture_sources_count()
     return vector_count(capture_cfg.sources);
 }
 
+const char *
+capture_source_stats(int index, capture_stats_t *stats)
+{
+    capture_info_t *capinfo;
+    unsigned long elapsed;
+
+    memset(stats, 0, sizeof(capture_stats_t));
+    if (!(capinfo = vector_item(capture_cfg.sources, index)))
+        return NULL;
+
+    stats->frames = atomic_load_explicit(&capinfo->frames, memory_order_relaxed);
+    stats->bytes = atomic_load_explicit(&capinfo->bytes, memory_order_relaxed);
+    stats->pcap_recv = atomic_load_explicit(&capinfo->pcap_recv, memory_order_relaxed);
+    stats->pcap_drop = atomic_load_explicit(&capinfo->pcap_drop, memory_order_relaxed);
+    stats->pcap_ifdrop = atomic_load_explicit(&capinfo->pcap_ifdrop, memory_order_relaxed);
+    stats->ip_reasm_pending = atomic_load_explicit(&capinfo->ip_reasm_pending, memory_order_relaxed);
+    stats->ip_reasm_memory = atomic_load_explicit(&capinfo->ip_reasm_memory, memory_order_relaxed);
+    stats->tcp_reasm_pending = atomic_load_explicit(&capinfo->tcp_reasm_pending, memory_order_relaxed);
+    stats->tcp_reasm_memory = atomic_load_explicit(&capinfo->tcp_reasm_memory, memory_order_relaxed);
+    stats->ip_reasm_evicted = atomic_load(&capinfo->ip_reasm_evicted);
+    stats->tcp_reasm_evicted = atomic_load(&capinfo->tcp_reasm_evicted);
+    stats->replay_lag = atomic_load_explicit(&capinfo->replay_lag, memory_order_relaxed);
+    stats->replay_lag_max = atomic_load_explicit(&capinfo->replay_lag_max, memory_order_relaxed);
+    if ((elapsed = atomic_load_explicit(&capinfo->replay_elapsed, memory_order_relaxed)) > 0) {
+        stats->replay_rate = atomic_load_explicit(&capinfo->replay_frames, memory_order_relaxed)
+                             * 1000000ULL / elapsed;
+    }
+
+    if (capinfo->ring) {
+        stats->ring_count = ring_count(capinfo->ring);
+        stats->ring_size = ring_size(capinfo->ring);
+        stats->ring_drops = ring_overflows(capinfo->ring);
+    }
+
+    // Frames of mapped files are decoded by workers
+    if (capinfo->mmap)
+        capture_mmap_stats(capinfo, stats);
+
+    if (capinfo->device)
+        return capinfo->device;
+    return (capinfo->infile) ? capinfo->infile : "";
+}
+
+void
+capture_reasm_publish(capture_info_t *capinfo)
+{
+    atomic_store_explicit(&capinfo->ip_reasm_pending, vector_count(capinfo->ip_reasm), memory_order_relaxed);
+    atomic_store_explicit(&capinfo->ip_reasm_memory, capinfo->ip_reasm_size, memory_order_relaxed);
+    atomic_store_explicit(&capinfo->tcp_reasm_pending, vector_count(capinfo->tcp_reasm), memory_order_relaxed);
+    atomic_store_explicit(&capinfo->tcp_reasm_memory, capinfo->tcp_reasm_size, memory_order_relaxed);
+}
+
+void
+capture_pcap_stats(capture_info_t *capinfo)
+{
+    struct pcap_stat stats;
+
+    if (pcap_stats(capinfo->handle, &stats) != 0)
+        return;
+
+    atomic_store_explicit(&capinfo->pcap_recv, stats.ps_recv, memory_order_relaxed);
+    atomic_store_explicit(&capinfo->pcap_drop, stats.ps_drop, memory_order_relaxed);
+    atomic_store_explicit(&capinfo->pcap_ifdrop, stats.ps_ifdrop, memory_order_relaxed);
+}
+
+void
+capture_lock_stats(unsigned long *waits, unsigned long *wait_time)
+{
+    *waits = atomic_load_explicit(&capture_cfg.lock_waits, memory_order_relaxed);
+    *wait_time = atomic_load_explicit(&capture_cfg.lock_wait_time, memory_order_relaxed);
+}
+
 char *
 capture_last_error()
 {
@@ -1076,43 +2331,114 @@ capture_last_error()
 void
 capture_lock()
 {
+    struct timespec start, end;
+
+    // Lock is usually free, only measure contended requests
+    if (pthread_rwlock_trywrlock(&capture_cfg.lock) == 0)
+        return;
+
     // Avoid parsing more packet
-    pthread_mutex_lock(&capture_cfg.lock);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_rwlock_wrlock(&capture_cfg.lock);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    atomic_fetch_add_explicit(&capture_cfg.lock_waits, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&capture_cfg.lock_wait_time,
+                              (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000,
+                              memory_order_relaxed);
+}
+
+void
+capture_lock_read()
+{
+    // Avoid parsing more packets, other readers are allowed
+    pthread_rwlock_rdlock(&capture_cfg.lock);
 }
 
 void
 capture_unlock()
 {
     // Allow parsing more packets
-    pthread_mutex_unlock(&capture_cfg.lock);
+    pthread_rwlock_unlock(&capture_cfg.lock);
 }
 
 
 
-void
-capture_packet_time_sorter(vector_t *vector, void *item)
+capture_link_decode_t
+capture_link_decoder(int datalink)
 {
-    struct timeval curts, prevts;
-    int count = vector_count(vector);
-    int i;
+    switch (datalink) {
+        case DLT_EN10MB:
+            return capture_link_ether;
+#ifdef DLT_LINUX_SLL
+        case DLT_LINUX_SLL:
+            return capture_link_sll;
+#endif
+        case DLT_NFLOG:
+            return capture_link_nflog;
+        default:
+            return capture_link_fixed;
+    }
+}
 
-    // TODO Implement multiframe packets
-    curts = packet_time(item);
+/**
+ * @brief Skip stacked VLAN tags after a fixed link header
+ *
+ * @param type offset of the header Ethernet type field
+ */
+static inline uint32_t
+capture_link_vlan(const u_char *packet, uint32_t caplen, uint32_t type)
+{
+    uint16_t ethertype;
 
-    for (i = count - 2 ; i >= 0; i--) {
-        // Get previous packet
-        prevts = packet_time(vector_item(vector, i));
-        // Check if the item is already in a sorted position
-        if (timeval_is_older(curts, prevts)) {
-            vector_insert(vector, item, i + 1);
-            return;
-        }
+    // Each tag ends with the Ethernet type of the next header
+    while (type + 6 <= caplen) {
+        ethertype = (packet[type] << 8) | packet[type + 1];
+        if (ethertype != ETHERTYPE_8021Q && ethertype != ETHERTYPE_8021AD && ethertype != ETHERTYPE_QINQ)
+            break;
+        type += 4;
     }
 
-    // Put this item at the begining of the vector
-    vector_insert(vector, item, 0);
+    return type + 2;
 }
 
+uint32_t
+capture_link_ether(const u_char *packet, uint32_t caplen, uint32_t link_hl)
+{
+    return capture_link_vlan(packet, caplen, 12);
+}
+
+uint32_t
+capture_link_sll(const u_char *packet, uint32_t caplen, uint32_t link_hl)
+{
+    return capture_link_vlan(packet, caplen, 14);
+}
+
+uint32_t
+capture_link_nflog(const u_char *packet, uint32_t caplen, uint32_t link_hl)
+{
+    const nflog_tlv_t *tlv;
+
+    // TLVs follow NFLOG header, payload is the last one
+    while (link_hl + 8 <= caplen) {
+        tlv = (const nflog_tlv_t *) (packet + link_hl);
+        if (tlv->tlv_type == NFULA_PAYLOAD)
+            return link_hl + 4;
+        // Malformed TLV, there is no payload to find
+        if (tlv->tlv_length < 4)
+            break;
+        // Next TLV is aligned to 4 bytes
+        link_hl += ((tlv->tlv_length + 3) & ~3);
+    }
+
+    return link_hl;
+}
+
+uint32_t
+capture_link_fixed(const u_char *packet, uint32_t caplen, uint32_t link_hl)
+{
+    return link_hl;
+}
 
 int8_t
 datalink_size(int datalink)
@@ -1175,11 +2501,76 @@ dump_packet(pcap_dumper_t *pd, const packet_t *packet)
     if (!pd || !packet)
         return;
 
+#ifdef WITH_ZLIB
+    // Compressed frames must be uncompressed before dumping them
+    if (packet->zip && capture_zip_load(packet->zip) != 0)
+        return;
+#endif
+
     vector_iter_t it = vector_iterator(packet->frames);
     frame_t *frame;
+    u_char *data;
     while ((frame = vector_iterator_next(&it))) {
-        pcap_dump((u_char*) pd, frame->header, frame->data);
+        if (frame->shared) {
+            // Retransmitted frames are dumped with the original payload
+            if ((data = frame_shared_data(frame))) {
+                pcap_dump((u_char*) pd, frame->header, data);
+                free(data);
+            }
+        } else {
+            pcap_dump((u_char*) pd, frame->header, frame->data);
+        }
     }
+}
+
+uint32_t
+dump_packet_frames(const packet_t *packet, frame_buffer_t **frames)
+{
+    frame_t *frame;
+    u_char *data;
+    uint32_t count = 0;
+
+#ifdef WITH_ZLIB
+    // Compressed frames must be uncompressed before copying them
+    if (packet->zip && capture_zip_load(packet->zip) != 0)
+        return 0;
+#endif
+
+    vector_iter_t it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        if (frame->shared) {
+            // Retransmitted frames are dumped with the original payload
+            if (!(data = frame_shared_data(frame)))
+                continue;
+            frames[count] = frame_buffer_create(frame->header, data);
+            free(data);
+        } else if (frame->buffer) {
+            frames[count] = frame_buffer_ref(frame->buffer);
+        } else if (frame->data) {
+            frames[count] = frame_buffer_create(frame->header, frame->data);
+        } else {
+            continue;
+        }
+        if (frames[count])
+            count++;
+    }
+
+    return count;
+}
+
+void
+dump_frame(pcap_dumper_t *pd, const frame_buffer_t *frame)
+{
+    if (!pd || !frame)
+        return;
+    pcap_dump((u_char*) pd, &frame->header, frame->data);
+}
+
+void
+dump_flush(pcap_dumper_t *pd)
+{
+    if (!pd)
+        return;
     pcap_dump_flush(pd);
 }
 
@@ -81,16 +81,53 @@
 #include <stdbool.h>
 #include "packet.h"
 #include "vector.h"
+#include "ring.h"
+#include "hash.h"
 
 //! Max allowed packet assembled size
 #define MAX_CAPTURE_LEN 20480
 //! Max allowed packet length
 #define MAXIMUM_SNAPLEN 262144
+//! Default number of frames pending to be parsed per capture source
+#define CAPTURE_RING_SIZE 8192
+//! Max time parser thread sleeps waiting for new frames (ms)
+#define CAPTURE_RING_WAIT 10
+//! Default number of frames read and parsed together
+#define CAPTURE_BATCH_SIZE 64
+//! Time expire thread sleeps between checks of its running flag (ms)
+#define CAPTURE_EXPIRE_WAIT 100
+//! Signalling filter extended with media destinations when no BPF filter is given
+#define CAPTURE_RTP_FILTER_SIP "port 5060 or port 5061"
+//! Max media destinations in the capture filter (more capture all UDP)
+#define CAPTURE_RTP_FILTER_MAX 256
+//! Seconds between libpcap statistics updates of online sources
+#define CAPTURE_STATS_INTERVAL 1
+//! Number of buckets of IP reassembly lookup table
+#define CAPTURE_REASM_HASH 1024
+//! Default max time to receive all fragments of an IP packet (seconds)
+#define CAPTURE_REASM_TIMEOUT 30
+//! Default max memory used by pending IP fragments per capture source (KB)
+#define CAPTURE_REASM_MEMORY 4096
+//! Default max time a TCP connection can keep pending data without activity (seconds)
+#define CAPTURE_TCP_TIMEOUT 60
+//! Default max memory used by pending TCP data per capture source (KB)
+#define CAPTURE_TCP_MEMORY 8192
+//! Shortest wait to replay a frame at its time (us), frames due sooner are replayed at once
+#define CAPTURE_REPLAY_SLACK 200
+//! Default input file data requested ahead of reading position (MB)
+#define CAPTURE_READAHEAD 32
+//! Input file data requested in each read ahead request (MB)
+#define CAPTURE_READAHEAD_CHUNK 4
 
 //! Define VLAN 802.1Q Ethernet type
 #ifndef ETHERTYPE_8021Q
 #define ETHERTYPE_8021Q 0x8100
 #endif
+//! Define QinQ 802.1ad Ethernet types (and pre-standard one)
+#ifndef ETHERTYPE_8021AD
+#define ETHERTYPE_8021AD 0x88a8
+#endif
+#define ETHERTYPE_QINQ 0x9100
 
 //! NFLOG Support (for libpcap <1.6.0)
 #define DLT_NFLOG       239
@@ -112,13 +149,24 @@ typedef struct nflog_tlv {
 enum capture_storage {
     CAPTURE_STORAGE_NONE = 0,
     CAPTURE_STORAGE_MEMORY,
-    CAPTURE_STORAGE_DISK
+    CAPTURE_STORAGE_DISK,
+    CAPTURE_STORAGE_COMPRESSED
 };
 
 //! Shorter declaration of capture_config structure
 typedef struct capture_config capture_config_t;
 //; Shorter declaration of capture_info structure
 typedef struct capture_info capture_info_t;
+//! Shorter declaration of capture_stats structure
+typedef struct capture_stats capture_stats_t;
+//! Shorter declaration of capture_ip_frag structure
+typedef struct capture_ip_frag capture_ip_frag_t;
+//! Shorter declaration of capture_tcp_stream structure
+typedef struct capture_tcp_stream capture_tcp_stream_t;
+//! Shorter declaration of capture_readahead structure
+typedef struct capture_readahead capture_readahead_t;
+//! Link layer decode routine, returns the frame link header size
+typedef uint32_t (*capture_link_decode_t)(const u_char *packet, uint32_t caplen, uint32_t link_hl);
 
 /**
  * @brief Capture common configuration
@@ -130,28 +178,133 @@ struct capture_config {
     size_t limit;
     //! Set size of pcap buffer
     size_t pcap_buffer_size;
+    //! Number of frames that can be pending to be parsed per source
+    size_t ring_size;
+    //! Number of frames read and parsed together
+    size_t batch_size;
+    //! Seconds to wait for all fragments of an IP packet
+    uint32_t reasm_timeout;
+    //! Bytes of pending IP fragments allowed per source
+    uint32_t reasm_memory;
+    //! Seconds a TCP connection can keep pending data without activity
+    uint32_t tcp_timeout;
+    //! Bytes of pending TCP data allowed per source
+    uint32_t tcp_memory;
     //! Also capture RTP packets
     bool rtp_capture;
+    //! Last RTP packets kept per stream when RTP packets are not captured
+    uint32_t rtp_samples;
     //! Rotate capturad dialogs when limit have reached
     bool rotate;
+    //! Input files replay speed relative to capture time (0 to read them as fast as possible)
+    double replay_speed;
+    //! Max frames per second replayed from input files (0 for no limit)
+    uint32_t replay_pps;
+    //! Input file bytes requested ahead of reading position (0 for disabling)
+    size_t readahead;
+    //! Seconds between capture filter updates with media destinations (0 for disabling)
+    uint32_t rtp_filter;
+    //! Last capture filter built with media destinations
+    char *rtp_filter_text;
     //! Capture sources are paused (all packets are skipped)
     int paused;
     //! Where should we store captured packets
     enum capture_storage storage;
     //! Key file for TLS decrypt
     const char *keyfile;
+    //! Key log file with TLS master secrets
+    const char *keylogfile;
     //! TLS Server address
     address_t tlsserver;
     //! capture filter expression text
     const char *filter;
     //! The compiled filter expression
     struct bpf_program fp;
-    //! libpcap dump file handler
-    pcap_dumper_t *pd;
+    //! Output file writer for captured packets
+    struct capture_writer *writer;
+    //! Disk storage for captured frames (when storage is disk)
+    struct capture_disk *disk;
+    //! Compressed storage for captured frames (when storage is compressed)
+    struct capture_zip *zip;
     //! Capture sources
     vector_t *sources;
-    //! Capture Lock. Avoid parsing and handling data at the same time
-    pthread_mutex_t lock;
+    //! Calls store lock. Packet parsing writes, interface drawing reads
+    pthread_rwlock_t lock;
+    //! Times writers had to wait for calls store lock
+    atomic_ulong lock_waits;
+    //! Total time writers waited for calls store lock (us)
+    atomic_ulong lock_wait_time;
+    //! Thread removing expired calls
+    pthread_t expire_t;
+    //! Expire thread is running
+    atomic_bool expire_running;
+    //! Capture threads have been launched (sources no longer change)
+    atomic_bool launched;
+};
+
+/**
+ * @brief Read ahead requests state of an input file
+ *
+ * Input files are read in small pieces (one record at a time by libpcap or
+ * by touching pages of the mapped file), so the kernel only reads a bit
+ * ahead of them. Instead, several big chunks ahead of the reading position
+ * are requested without waiting for them, so most records are already in
+ * memory when they are reached.
+ */
+struct capture_readahead
+{
+    //! File descriptor (used if file is not mapped)
+    int fd;
+    //! Mapped file contents (NULL if file is not mapped)
+    const u_char *map;
+    //! File length
+    size_t size;
+    //! Offset until file data has been requested
+    size_t requested;
+};
+
+/**
+ * @brief IP packet pending to receive all its fragments
+ */
+struct capture_ip_frag
+{
+    //! Lookup key built from addresses, IP id and protocol
+    char key[ADDRESSLEN * 2 + 16];
+    //! Packet storing received fragments
+    packet_t *packet;
+    //! Capture time of the first received fragment
+    struct timeval ts;
+    //! Bytes of all received fragments
+    uint32_t size;
+};
+
+/**
+ * @brief TCP connection data pending to be assembled
+ */
+struct capture_tcp_stream
+{
+    //! Lookup key built from source and destination addresses
+    char key[ADDRESSLEN * 2 + 16];
+    //! Packet storing received segments
+    packet_t *packet;
+    //! Capture time of the last received segment
+    struct timeval ts;
+    //! Memory used by assembled payload and stored segments
+    uint32_t size;
+    //! Assembled payload (zero terminated)
+    u_char *data;
+    //! Assembled payload length
+    uint32_t len;
+    //! Allocated memory for assembled payload
+    uint32_t alloc;
+    //! TCP sequence of the first assembled payload byte
+    uint32_t seq;
+    //! Segments received after a missing one sorted by sequence (packet_t)
+    vector_t *segments;
+    //! Assembled payload validation progress
+    struct sip_validate_state *validate;
+    //! Last validation result
+    int valid;
 };
 
 /**
@@ -163,10 +316,14 @@ struct capture_info
 {
     //! Flag to determine if capture is running
     bool running;
+    //! Position of this source in capture sources list
+    uint16_t id;
     //! libpcap link type
     int link;
     //! libpcap link header size
     int8_t link_hl;
+    //! Link layer decode routine for this link type
+    capture_link_decode_t link_decode;
     //! libpcap capture handler
     pcap_t *handle;
     //! Netmask of our sniffing device
@@ -175,14 +332,117 @@ struct capture_info
     bpf_u_int32 net;
     //! Input file in Offline capture
     const char *infile;
+    //! Input file size in Offline capture (0 if unknown)
+    size_t infile_size;
+    //! Read ahead requests of input file read by libpcap
+    capture_readahead_t readahead;
     //! Capture device in Online mode
     const char *device;
-    //! Packets pending IP reassembly
+    //! Packets pending IP reassembly (capture_ip_frag_t) sorted by age
     vector_t *ip_reasm;
-    //! Packets pending TCP reassembly
+    //! Packets pending IP reassembly indexed by fragment key
+    htable_t *ip_reasm_index;
+    //! Bytes of pending IP fragments
+    uint32_t ip_reasm_size;
+    //! Fragments discarded by timeout or memory limit
+    atomic_ulong ip_reasm_evicted;
+    //! Connections pending TCP reassembly (capture_tcp_stream_t)
     vector_t *tcp_reasm;
+    //! Connections pending TCP reassembly indexed by addresses
+    htable_t *tcp_reasm_index;
+    //! Connection with assembled data left after the last returned message
+    capture_tcp_stream_t *tcp_ready;
+    //! Memory used by connections pending TCP reassembly
+    uint32_t tcp_reasm_size;
+    //! Capture time of next search for idle connections
+    time_t tcp_reasm_sweep;
+    //! Connections discarded by timeout or memory limit
+    atomic_ulong tcp_reasm_evicted;
+    //! Frames and bytes read by the parser (or decoding worker)
+    atomic_ulong frames;
+    atomic_ulong bytes;
+    //! Pending IP packets and connections, published by parser after each batch
+    atomic_uint ip_reasm_pending;
+    atomic_uint ip_reasm_memory;
+    atomic_uint tcp_reasm_pending;
+    atomic_uint tcp_reasm_memory;
+    //! Packets received and dropped by kernel and interface (online libpcap sources)
+    atomic_uint pcap_recv;
+    atomic_uint pcap_drop;
+    atomic_uint pcap_ifdrop;
+    //! Capture time and monotonic time (ns) of the first replayed frame
+    struct timeval replay_ts;
+    uint64_t replay_start;
+    //! Frames replayed and time elapsed since the first one (us)
+    atomic_ulong replay_frames;
+    atomic_ulong replay_elapsed;
+    //! Time the last replayed frame was late (us) and the highest one
+    atomic_ulong replay_lag;
+    atomic_ulong replay_lag_max;
+    //! Buffer to build reassembled IP packets
+    u_char *ip_reasm_data;
     //! Capture thread for online capturing
     pthread_t capture_t;
+    //! Capture filter waiting to be applied by capture thread
+    _Atomic(char *) filter_pending;
+#ifdef USE_TPACKET
+    //! AF_PACKET capture data (NULL for libpcap sources)
+    struct capture_tpacket *tpacket;
+#endif
+    //! Mapped input file decoded by workers (NULL if read by libpcap)
+    struct capture_mmap *mmap;
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+    //! TLS decrypting workers (NULL if decrypted by parser thread)
+    struct capture_tls *tls;
+#endif
+    //! Input file index being built or used to read records (capture_index.h)
+    struct capture_index *index;
+    //! Frames read by capture thread pending to be parsed
+    ring_t *ring;
+    //! Parser thread for frames in the ring
+    pthread_t parser_t;
+    //! Capture thread has finished reading packets
+    atomic_bool eof;
+    //! Parser thread has been requested to stop
+    atomic_bool stopping;
+    //! Parser thread is sleeping waiting for frames
+    atomic_bool parser_waiting;
+    //! Lock and condition to wake up parser thread
+    pthread_mutex_t ring_lock;
+    pthread_cond_t ring_cond;
+};
+
+/**
+ * @brief Counters and queue usage of a capture source
+ */
+struct capture_stats
+{
+    //! Frames and bytes read
+    unsigned long frames;
+    unsigned long bytes;
+    //! Frames pending to be parsed and max allowed
+    unsigned long ring_count;
+    unsigned long ring_size;
+    //! Frames discarded because parser queue was full
+    unsigned long ring_drops;
+    //! libpcap statistics (only for online libpcap sources)
+    unsigned long pcap_recv;
+    unsigned long pcap_drop;
+    unsigned long pcap_ifdrop;
+    //! IP packets pending to be reassembled and their fragments size
+    unsigned long ip_reasm_pending;
+    unsigned long ip_reasm_memory;
+    //! TCP connections pending to be reassembled and their memory
+    unsigned long tcp_reasm_pending;
+    unsigned long tcp_reasm_memory;
+    //! Fragments and connections discarded by timeout or memory limit
+    unsigned long ip_reasm_evicted;
+    unsigned long tcp_reasm_evicted;
+    //! Frames per second replayed from input file (only when replay is enabled)
+    unsigned long replay_rate;
+    //! Time the last replayed frame was late and the highest one (us)
+    unsigned long replay_lag;
+    unsigned long replay_lag_max;
 };
 
 /**
@@ -217,7 +477,8 @@ capture_online(const char *dev, const char *outfile);
  * @brief Read from pcap file and fill sngrep sctuctures
  *
  * This function will use libpcap files and previous structures to
- * parse the pcap file.
+ * parse the pcap file. Regular pcap files are mapped in memory and decoded
+ * by several workers instead (see capture_mmap.h).
  *
  * @param infile File to read packets from
  *
@@ -227,15 +488,143 @@ int
 capture_offline(const char *infile, const char *outfile);
 
 /**
- * @brief Read the next package and parse SIP messages
+ * @brief Start read ahead requests of an input file
+ *
+ * @param fd File descriptor to request data with posix_fadvise
+ * @param map File mapping to request data with madvise (or NULL)
+ * @param size File length
+ */
+void
+capture_readahead_init(capture_readahead_t *ra, int fd, const u_char *map, size_t size);
+
+/**
+ * @brief Request input file data ahead of reading position
+ *
+ * Data is requested in CAPTURE_READAHEAD_CHUNK pieces until capture.offline.readahead
+ * bytes after reading position have been requested. Requests don't wait
+ * for the data to be read, so several of them are in flight at the same time.
+ *
+ * @param pos Current reading position
+ */
+void
+capture_readahead(capture_readahead_t *ra, size_t pos);
+
+/**
+ * @brief Add an opened capture handler to the packet sources
+ *
+ * Prepare reassembly storage for the new source and, if requested, open
+ * dump file for captured packets.
+ *
+ * @param capinfo Capture source with an opened handler
+ * @param outfile Dumpfile for captured packets or NULL
+ * @return 0 on success, 2 if dump file can not be opened
+ */
+int
+capture_add_source(capture_info_t *capinfo, const char *outfile);
+
+/**
+ * @brief Create IP and TCP reassembly storage of a capture source
+ */
+void
+capture_reasm_init(capture_info_t *capinfo);
+
+/**
+ * @brief Discard pending reassembly data and free its storage
+ */
+void
+capture_reasm_destroy(capture_info_t *capinfo);
+
+/**
+ * @brief Queue a captured frame to be parsed
+ *
+ * This is the libpcap callback for both online and offline capture.
+ * libpcap buffers are only valid during the callback, so the frame is
+ * copied into a frame buffer and queued in the source ring. That copy
+ * will be owned by the packet frames, so capture data is never copied
+ * again while parsing. When the ring is full, online
+ * sources discard the frame while offline sources wait for the parser.
+ */
+void
+capture_queue_packet(u_char *capinfo, const struct pcap_pkthdr *header, const u_char *packet);
+
+/**
+ * @brief Wake up parser thread of a capture source
+ *
+ * @param capinfo Capture source
+ * @param force Signal parser even if it is not waiting for frames
+ */
+void
+capture_parser_wakeup(capture_info_t *capinfo, bool force);
+
+/**
+ * @brief Sleep parser thread until there are items in the given ring
+ *
+ * Parser also wakes up when capture is stopped, capture thread has
+ * finished or after CAPTURE_RING_WAIT milliseconds.
+ *
+ * @param capinfo Capture source
+ * @param ring Ring the parser reads items from
+ */
+void
+capture_parser_wait(capture_info_t *capinfo, ring_t *ring);
+
+/**
+ * @brief Check parser thread has no packets pending in other threads
+ *
+ * @return true if all packets handed to decrypting workers have been returned
+ */
+bool
+capture_parser_idle(capture_info_t *capinfo);
+
+/**
+ * @brief Decode the next package until its transport payload
  *
  * This function is shared between online and offline capture
- * methods using pcap. This will get the payload from a package and
- * add it to the SIP storage layer.
+ * methods using pcap. This will get the payload from a package,
+ * reassembling IP fragments and TCP segments when required.
+ *
+ * This is called from the parser thread for each frame in the ring
+ * without holding the capture lock.
+ * The frame buffer is either owned by the parsed packet or deallocated.
+ *
+ * @return a packet ready to be processed or NULL if not complete
+ */
+packet_t *
+parse_packet(capture_info_t *capinfo, frame_buffer_t *buffer);
+
+/**
+ * @brief Add a decoded packet to the SIP storage layer
+ *
+ * Packet will be stored, sent and dumped if it contains a SIP message,
+ * otherwise it will be deallocated.
+ * Caller must hold the capture lock.
+ *
+ * @param capinfo Capture source the packet has been read from
+ * @param packet Decoded packet
+ */
+void
+capture_packet_process(capture_info_t *capinfo, packet_t *packet);
+
+/**
+ * @brief Store frames of a parsed packet in configured storage
+ *
+ * Caller must hold the capture lock.
+ *
+ * @param capinfo Capture source the packet has been read from (NULL if
+ * it has not been read from any source)
+ * @param packet Parsed packet
+ */
+void
+capture_packet_store(capture_info_t *capinfo, packet_t *packet);
+
+/**
+ * @brief Set packet payload avoiding copies when possible
  *
+ * If payload is part of the captured frame buffer, packet payload will
+ * point to it instead of having its own copy.
  */
 void
-parse_packet(u_char *capinfo, const struct pcap_pkthdr *header, const u_char *packet);
+capture_packet_set_payload(packet_t *pkt, frame_buffer_t *buffer, u_char *payload, uint32_t size);
 
 /**
  * @brief Reassembly capture IP fragments
@@ -248,28 +637,73 @@ parse_packet(u_char *capinfo, const struct pcap_pkthdr *header, const u_char *pa
  * done to avoid reassembling too big packets, that aren't likely to be interesting
  * for sngrep.
  *
+ * Pending fragments are discarded when the whole packet is not received in
+ * capture.reasm.timeout seconds or when all pending fragments use more than
+ * capture.reasm.memory KB (oldest packets are discarded first).
+ *
  * TODO
  * Assembly only works when all of the IP fragments are received in the good order.
  * Properly check memory boundaries during packet reconstruction.
- * Implement a way to timeout pending IP fragments after some time.
  * TODO
  *
  * @param capinfo Packet capture session information
- * @para header Header received from libpcap callback
- * @para packet Packet contents received from libpcap callback
+ * @param buffer Captured frame (will be owned by returned or pending packets)
+ * @param packet Packet contents. Will point to reassembled data if required
  * @param size Packet size (not including Layer and Network headers)
  * @param caplen Full packet size (current fragment -> whole assembled packet)
  * @return a Packet structure when packet is not fragmented or fully reassembled
  * @return NULL when packet has not been completely assembled
  */
 packet_t *
-capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *header,
-                        u_char *packet, uint32_t *size, uint32_t *caplen);
+capture_packet_reasm_ip(capture_info_t *capinfo, frame_buffer_t *buffer,
+                        u_char **packet, uint32_t *size, uint32_t *caplen);
+
+/**
+ * @brief Check if an UDP packet could be SIP or RTP
+ *
+ * This is checked just looking at the first payload bytes, so packets that
+ * can not be interesting are discarded before allocating any packet data.
+ *
+ * @param udp UDP header and payload
+ * @param size UDP header and payload length
+ * @return 0 if packet must be parsed, 1 if it can be discarded
+ */
+int
+capture_udp_is_candidate(u_char *udp, uint32_t size);
+
+/**
+ * @brief Remove a pending IP packet from reassembly lists
+ *
+ * Packet fragments are not deallocated.
+ */
+void
+capture_ip_frag_remove(capture_info_t *capinfo, capture_ip_frag_t *frag);
+
+/**
+ * @brief Discard a pending IP packet and all its received fragments
+ */
+void
+capture_ip_frag_evict(capture_info_t *capinfo, capture_ip_frag_t *frag);
+
+/**
+ * @brief Discard pending IP packets older than capture.reasm.timeout
+ *
+ * @param now Capture time of the last received frame
+ */
+void
+capture_ip_frag_expire(capture_info_t *capinfo, const struct timeval *now);
 
 /**
  * @brief Reassembly capture TCP segments
  *
  * This function will try to assemble TCP segments of an existing packet.
+ * Segments of each connection are assembled in sequence order, storing the
+ * ones received after a missing segment until it arrives. Assembled payload
+ * validation continues where the previous segment left it.
+ *
+ * Pending connections are discarded after capture.tcp.timeout seconds without
+ * receiving data or when all pending connections use more than
+ * capture.tcp.memory KB (least active connections are discarded first).
  *
  * @note We assume packets higher than MAX_CAPTURE_LEN won't be SIP. This has been
  * done to avoid reassembling too big packets, that aren't likely to be interesting
@@ -286,6 +720,91 @@ packet_t *
 capture_packet_reasm_tcp(capture_info_t *capinfo, packet_t *packet, struct tcphdr *tcp,
                          u_char *payload, int size_payload);
 
+/**
+ * @brief Create a new TCP reassembly connection
+ *
+ * @param packet First received segment (will be owned by the connection)
+ * @param seq TCP sequence of the segment payload
+ * @return new connection or NULL on error
+ */
+capture_tcp_stream_t *
+capture_tcp_stream_create(capture_info_t *capinfo, const char *key, packet_t *packet, uint32_t seq);
+
+/**
+ * @brief Remove a TCP reassembly connection and all its pending segments
+ */
+void
+capture_tcp_stream_destroy(capture_info_t *capinfo, capture_tcp_stream_t *stream);
+
+/**
+ * @brief Append data to the connection assembled payload
+ *
+ * @return 0 on success, 1 if assembled payload would be too big
+ */
+int
+capture_tcp_stream_append(capture_tcp_stream_t *stream, const u_char *data, uint32_t len);
+
+/**
+ * @brief Add a segment to the connection
+ *
+ * Segment frames will be moved to the connection packet or stored until
+ * all previous segments have been received. Segment is owned by the
+ * connection after this call, even on error.
+ *
+ * @return 0 on success, 1 if assembled payload would be too big
+ */
+int
+capture_tcp_stream_add(capture_tcp_stream_t *stream, packet_t *segment, uint32_t seq);
+
+/**
+ * @brief Get the first message of the connection assembled payload
+ *
+ * Remaining assembled data is kept in the connection for the next message.
+ *
+ * @param len Assembled payload bytes of the message
+ * @return a Packet structure with the message payload
+ */
+packet_t *
+capture_tcp_stream_extract(capture_info_t *capinfo, capture_tcp_stream_t *stream, uint32_t len);
+
+/**
+ * @brief Discard a TCP connection pending data
+ *
+ * Connection is counted as evicted in the capture status.
+ */
+void
+capture_tcp_stream_evict(capture_info_t *capinfo, capture_tcp_stream_t *stream);
+
+/**
+ * @brief Discard TCP connections without activity for capture.tcp.timeout
+ *
+ * Pending connections are checked at most once per second of capture time.
+ *
+ * @param now Capture time of the last received frame
+ */
+void
+capture_tcp_stream_expire(capture_info_t *capinfo, const struct timeval *now);
+
+/**
+ * @brief Discard least active TCP connections until capture.tcp.memory is honored
+ *
+ * @param current Connection that has just received data, discarded the last
+ * @return 1 if current connection has been discarded, 0 otherwise
+ */
+int
+capture_tcp_stream_trim(capture_info_t *capinfo, capture_tcp_stream_t *current);
+
+/**
+ * @brief Get next message already assembled in a connection
+ *
+ * A single TCP segment can contain more than one message. After returning
+ * the first one, this will return the following ones.
+ *
+ * @return a Packet structure with the message payload or NULL
+ */
+packet_t *
+capture_tcp_stream_next(capture_info_t *capinfo);
+
 /**
  * @brief Check if given payload belongs to a Websocket connection
  *
@@ -309,6 +828,15 @@ capture_ws_check_packet(packet_t *packet);
 int
 capture_packet_parse(packet_t *pkt);
 
+/**
+ * @brief Get estimated memory used by a parsed packet once it is stored
+ *
+ * Frames data and payload are only counted when current storage keeps
+ * them in memory.
+ */
+size_t
+capture_packet_size(packet_t *packet);
+
 /**
  * @brief Create a capture thread for online mode
  *
@@ -326,6 +854,53 @@ capture_launch_thread();
 void
 capture_thread(void *none);
 
+/**
+ * @brief Parser Thread
+ *
+ * This function is used as worker thread for parsing frames queued by
+ * the capture thread. It will mark the capture source as not running
+ * once capture thread has finished and all its frames have been parsed.
+ */
+void
+capture_parser_thread(void *info);
+
+/**
+ * @brief Remove expired calls once per second
+ *
+ * This thread also updates capture filter with media destinations. It
+ * only runs when calls expiration or media filter are enabled.
+ */
+void *
+capture_expire_thread(void *none);
+
+/**
+ * @brief Build capture filter for signalling and current media streams
+ *
+ * Filter is the configured BPF filter (or default SIP ports) plus the
+ * destination address and port of each indexed RTP stream, so kernel
+ * drops any other traffic. When there are too many streams, all UDP
+ * traffic is captured.
+ *
+ * @return allocated filter text or NULL on memory error
+ */
+char *
+capture_rtp_filter_build();
+
+/**
+ * @brief Update capture filter of online sources if media has changed
+ *
+ * New filter is handed to each libpcap online source capture thread,
+ * the only one allowed to use its handler.
+ */
+void
+capture_rtp_filter_update();
+
+/**
+ * @brief Apply pending capture filter from source capture thread
+ */
+void
+capture_filter_apply(capture_info_t *capinfo);
+
 /**
  * @brief Check if capture is in Online mode
  *
@@ -367,6 +942,38 @@ capture_get_bpf_filter();
 void
 capture_set_paused(int pause);
 
+/**
+ * @brief Set input files replay speed
+ *
+ * Speed is given as a multiplier of frames capture time (2x, 0.5x) and/or
+ * a max number of frames per second (5000pps), separated by comma. When
+ * enabled, input files are read by a single thread that waits until each
+ * frame is due before queueing it.
+ *
+ * @param speed Replay speed text (NULL or empty to read as fast as possible)
+ * @return 0 if speed is valid, 1 otherwise
+ */
+int
+capture_set_replay(const char *speed);
+
+/**
+ * @brief Check if input files are replayed at a given speed
+ */
+bool
+capture_replay_enabled();
+
+/**
+ * @brief Wait until a frame read from an input file is due
+ *
+ * Due time is computed from the first replayed frame, so the time slept
+ * over a due time is not accumulated in following frames.
+ *
+ * @param capinfo Input file capture source
+ * @param header Frame header with its capture time
+ */
+void
+capture_replay_wait(capture_info_t *capinfo, const struct pcap_pkthdr *header);
+
 /**
  * @brief Check if capture is actually running
  *
@@ -383,10 +990,22 @@ capture_status();
 
 /**
  * @brief Return a string representing current capture status
+ *
+ * If there are frames pending to be parsed or discarded frames, the usage
+ * of the most loaded capture queue and total discarded frames are appended.
+ * While input files are being loaded, the percentage of read bytes is shown.
  */
 const char *
 capture_status_desc();
 
+/**
+ * @brief Get the number of bytes already read from an input file
+ *
+ * @return read bytes or 0 if source is not an input file
+ */
+size_t
+capture_offline_loaded(capture_info_t *capinfo);
+
 /**
  * @brief Get Input file from Offline mode
  *
@@ -421,6 +1040,22 @@ capture_keyfile();
 void
 capture_set_keyfile(const char *keyfile);
 
+/**
+ * @brief Get key log file used to decrypt TLS packets
+ *
+ * @return given key log file
+ */
+const char*
+capture_keylogfile();
+
+/**
+ * @brief Set key log file to decrypt TLS packets
+ *
+ * @param keylogfile Full path to NSS key log file
+ */
+void
+capture_set_keylogfile(const char *keylogfile);
+
 /**
  * @brief Get TLS Server address if configured
  * @return address scructure
@@ -435,6 +1070,44 @@ capture_tls_server();
 int
 capture_sources_count();
 
+/**
+ * @brief Get counters and queues usage of a capture source
+ *
+ * Mapped input files also include counters of their decoding workers.
+ *
+ * @param index Position of the source in capture sources list
+ * @param stats Structure filled with source statistics
+ * @return source name (device or input file) or NULL if source does not exist
+ */
+const char *
+capture_source_stats(int index, capture_stats_t *stats);
+
+/**
+ * @brief Publish reassembly usage of a capture source
+ *
+ * Called by the thread decoding frames of the source after each batch, so
+ * pending IP fragments and TCP connections can be read from other threads.
+ */
+void
+capture_reasm_publish(capture_info_t *capinfo);
+
+/**
+ * @brief Update libpcap statistics of an online source
+ *
+ * Called by the capture thread, which is the only one using the handler.
+ */
+void
+capture_pcap_stats(capture_info_t *capinfo);
+
+/**
+ * @brief Get how many times and how long writers waited for capture lock
+ *
+ * @param waits Times capture lock was already taken when requested
+ * @param wait_time Total waited time (us)
+ */
+void
+capture_lock_stats(unsigned long *waits, unsigned long *wait_time);
+
 /**
  * @brief Return the last capture error
  */
@@ -443,21 +1116,31 @@ capture_last_error();
 
 /**
  * @brief Avoid parsing more packets
+ *
+ * Takes the calls store lock for writing. Threads adding or removing
+ * calls and messages, and user actions changing them, must hold it.
+ * Unlike previous recursive mutex, it can not be taken twice.
  */
 void
 capture_lock();
 
 /**
- * @brief Allow parsing more packets
+ * @brief Avoid parsing more packets while reading calls
+ *
+ * Takes the calls store lock for reading, so several threads can read
+ * calls and messages at the same time.
  */
 void
-capture_unlock();
+capture_lock_read();
 
 /**
- * @brief Sorter by time for captured packets
+ * @brief Allow parsing more packets
+ *
+ * Releases the calls store lock taken by capture_lock or
+ * capture_lock_read.
  */
 void
-capture_packet_time_sorter(vector_t *vector, void *item);
+capture_unlock();
 
 /**
  * @brief Close pcap handler
@@ -472,6 +1155,39 @@ capture_close();
 int8_t
 datalink_size(int datalink);
 
+/**
+ * @brief Get the link layer decode routine of a datalink
+ *
+ * Routine is chosen once when the source is opened, so frames are
+ * decoded without checking their link type.
+ */
+capture_link_decode_t
+capture_link_decoder(int datalink);
+
+/**
+ * @brief Get Ethernet header size, including stacked VLAN tags
+ */
+uint32_t
+capture_link_ether(const u_char *packet, uint32_t caplen, uint32_t link_hl);
+
+/**
+ * @brief Get Linux cooked header size, including stacked VLAN tags
+ */
+uint32_t
+capture_link_sll(const u_char *packet, uint32_t caplen, uint32_t link_hl);
+
+/**
+ * @brief Get NFLOG header size, up to the payload TLV data
+ */
+uint32_t
+capture_link_nflog(const u_char *packet, uint32_t caplen, uint32_t link_hl);
+
+/**
+ * @brief Get header size of datalinks without variable headers
+ */
+uint32_t
+capture_link_fixed(const u_char *packet, uint32_t caplen, uint32_t link_hl);
+
 /**
  * @brief Open a new dumper file for capture handler
  */
@@ -481,11 +1197,38 @@ dump_open(const char *dumpfile);
 /**
  * @brief Store a packet in dump file
  *
- * File must be previously opened with dump_open
+ * File must be previously opened with dump_open. Packet may not be
+ * written to disk until dump_flush or dump_close are called.
  */
 void
 dump_packet(pcap_dumper_t *pd, const packet_t *packet);
 
+/**
+ * @brief Take a reference to all frames of a packet
+ *
+ * Frames not stored in their own buffer (disk, compressed or shared with
+ * a retransmission) are copied, so returned frames can be dumped after
+ * packet has been destroyed.
+ *
+ * @param packet Packet whose frames will be referenced
+ * @param frames Array with room for all packet frames
+ * @return number of frames stored in array
+ */
+uint32_t
+dump_packet_frames(const packet_t *packet, frame_buffer_t **frames);
+
+/**
+ * @brief Store a frame referenced with dump_packet_frames in dump file
+ */
+void
+dump_frame(pcap_dumper_t *pd, const frame_buffer_t *frame);
+
+/**
+ * @brief Write pending dumped packets to file
+ */
+void
+dump_flush(pcap_dumper_t *pd);
+
 /**
  * @brief Close a dump file
  */
@@ -0,0 +1,319 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_disk.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in capture_disk.h
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "capture.h"
+#include "capture_disk.h"
+#include "setting.h"
+#include "util.h"
+
+capture_disk_t *
+capture_disk_create()
+{
+    capture_disk_t *disk;
+
+    if (!(disk = sng_malloc(sizeof(capture_disk_t))))
+        return NULL;
+
+    // Directory for segment files
+    disk->path = setting_get_value(SETTING_CAPTURE_STORAGE_PATH);
+    if (!disk->path || !strlen(disk->path))
+        disk->path = getenv("TMPDIR");
+    if (!disk->path || !strlen(disk->path))
+        disk->path = CAPTURE_DISK_PATH;
+
+    // Each segment must be able to store the biggest frame
+    if (setting_get_intvalue(SETTING_CAPTURE_STORAGE_SEGMENT) > 0) {
+        disk->segment_size = (size_t) setting_get_intvalue(SETTING_CAPTURE_STORAGE_SEGMENT) * 1024 * 1024;
+    } else {
+        disk->segment_size = CAPTURE_DISK_SEGMENT * 1024 * 1024;
+    }
+    if (disk->segment_size < MAXIMUM_SNAPLEN * 2)
+        disk->segment_size = MAXIMUM_SNAPLEN * 2;
+
+    // Check we can create segments before starting the capture
+    if (!(disk->current = capture_disk_segment_create(disk->path, disk->segment_size))) {
+        fprintf(stderr, "Can't create storage file in %s: %s\n", disk->path, strerror(errno));
+        sng_free(disk);
+        return NULL;
+    }
+
+    return disk;
+}
+
+void
+capture_disk_store_packet(capture_disk_t *disk, packet_t *packet)
+{
+    capture_disk_segment_t *segment;
+    frame_t *frame;
+    u_char *data;
+
+    if (!disk || !packet)
+        return;
+
+    vector_iter_t it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        // Already stored or without data
+        if (frame->segment || !frame->data)
+            continue;
+
+        if (!(data = capture_disk_store(disk, frame->data, frame->header->caplen, &segment)))
+            continue;
+
+        // Payload pointing to this frame must use the stored copy
+        if (packet->payload_ref && packet->payload >= frame->data
+                && packet->payload <= frame->data + frame->header->caplen) {
+            packet->payload = data + (packet->payload - frame->data);
+        }
+
+        if (frame->buffer) {
+            // Keep frame header, it is used for packet timestamps
+            frame->header = malloc(sizeof(struct pcap_pkthdr));
+            memcpy(frame->header, &frame->buffer->header, sizeof(struct pcap_pkthdr));
+            frame_buffer_destroy(frame->buffer);
+            frame->buffer = NULL;
+        } else {
+            free(frame->data);
+        }
+        frame->data = data;
+        frame->segment = segment;
+    }
+
+    // Payload built from several frames (or decrypted) has its own memory
+    if (packet->payload && !packet->payload_ref && !packet->payload_segment) {
+        if ((data = capture_disk_store(disk, packet->payload, packet->payload_len, &segment))) {
+            free(packet->payload);
+            packet->payload = data;
+            packet->payload_ref = true;
+            packet->payload_segment = segment;
+        }
+    }
+}
+
+u_char *
+capture_disk_store(capture_disk_t *disk, const u_char *data, uint32_t len, capture_disk_segment_t **segment)
+{
+    capture_disk_segment_t *current = disk->current, *next;
+    // Stored data is followed by a zero byte, so it can be used as string
+    size_t required = ((size_t) len + 1 + 7) & ~((size_t) 7);
+    u_char *stored;
+
+    if (required > disk->segment_size)
+        return NULL;
+
+    // Continue in a new segment
+    if (!current || current->used + required > current->size) {
+        if (!(next = capture_disk_segment_create(disk->path, disk->segment_size)))
+            return NULL;
+        if (current)
+            capture_disk_segment_release(current);
+        current = disk->current = next;
+    }
+
+    if (pwrite(current->fd, data, len, current->used) != (ssize_t) len) {
+        // Don't use this segment anymore (disk is probably full)
+        current->used = current->size;
+        return NULL;
+    }
+
+    // Segment file is zero filled, so there is a zero after written data
+    stored = current->map + current->used;
+    current->used += required;
+    atomic_fetch_add_explicit(&current->refs, 1, memory_order_relaxed);
+    *segment = current;
+    return stored;
+}
+
+capture_disk_segment_t *
+capture_disk_segment_create(const char *path, size_t size)
+{
+    capture_disk_segment_t *segment;
+    char filename[PATH_MAX];
+
+    if (!(segment = sng_malloc(sizeof(capture_disk_segment_t))))
+        return NULL;
+
+    snprintf(filename, sizeof(filename), "%s/%s", path, CAPTURE_DISK_TEMPLATE);
+    if ((segment->fd = mkstemp(filename)) < 0) {
+        sng_free(segment);
+        return NULL;
+    }
+
+    // Nobody else needs this file, remove it once we are done
+    unlink(filename);
+
+    if (ftruncate(segment->fd, size) != 0
+            || (segment->map = mmap(NULL, size, PROT_READ, MAP_SHARED, segment->fd, 0)) == MAP_FAILED) {
+        close(segment->fd);
+        sng_free(segment);
+        return NULL;
+    }
+
+    segment->size = size;
+    atomic_init(&segment->refs, 1);
+    return segment;
+}
+
+capture_disk_segment_t *
+capture_disk_segment_wrap(const u_char *map, size_t size)
+{
+    capture_disk_segment_t *segment;
+
+    if (!(segment = sng_malloc(sizeof(capture_disk_segment_t))))
+        return NULL;
+
+    // Nothing can be appended to this segment
+    segment->fd = -1;
+    segment->map = (u_char *) map;
+    segment->size = segment->used = size;
+    atomic_init(&segment->refs, 1);
+    return segment;
+}
+
+capture_disk_segment_t *
+capture_disk_segment_ref(capture_disk_segment_t *segment)
+{
+    atomic_fetch_add_explicit(&segment->refs, 1, memory_order_relaxed);
+    return segment;
+}
+
+void
+capture_disk_segment_release(capture_disk_segment_t *segment)
+{
+    // Other frames are still stored in this segment
+    if (atomic_fetch_sub_explicit(&segment->refs, 1, memory_order_acq_rel) != 1)
+        return;
+
+    munmap(segment->map, segment->size);
+    if (segment->fd >= 0)
+        close(segment->fd);
+    sng_free(segment);
+}
+
+/**
+ * @brief Add a stored data range to a prefetch
+ */
+static void
+capture_disk_prefetch_add(capture_disk_prefetch_t *prefetch, const u_char *data, uint32_t len)
+{
+    uintptr_t (*ranges)[2];
+    uint32_t size;
+
+    if (!len)
+        return;
+
+    if (prefetch->count == prefetch->size) {
+        size = prefetch->size ? prefetch->size * 2 : 64;
+        if (!(ranges = realloc(prefetch->ranges, sizeof(*ranges) * size)))
+            return;
+        prefetch->ranges = ranges;
+        prefetch->size = size;
+    }
+
+    prefetch->ranges[prefetch->count][0] = (uintptr_t) data;
+    prefetch->ranges[prefetch->count][1] = (uintptr_t) data + len;
+    prefetch->count++;
+}
+
+void
+capture_disk_prefetch_packet(capture_disk_prefetch_t *prefetch, const packet_t *packet)
+{
+    frame_t *frame;
+
+    if (!packet)
+        return;
+
+    vector_iter_t it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        if (frame->segment && frame->data)
+            capture_disk_prefetch_add(prefetch, frame->data, frame->header->caplen);
+    }
+
+    // Payload not copied yet from its segment
+    if (packet->payload_segment && packet->payload_source && !packet->payload)
+        capture_disk_prefetch_add(prefetch, packet->payload_source, packet->payload_len);
+}
+
+/**
+ * @brief Sort prefetch ranges by their start address
+ */
+static int
+capture_disk_prefetch_cmp(const void *one, const void *two)
+{
+    uintptr_t a = ((const uintptr_t *) one)[0], b = ((const uintptr_t *) two)[0];
+    return (a > b) - (a < b);
+}
+
+void
+capture_disk_prefetch_run(capture_disk_prefetch_t *prefetch)
+{
+    uintptr_t page = sysconf(_SC_PAGESIZE), start, end;
+    uint32_t i;
+
+    if (prefetch->count) {
+        qsort(prefetch->ranges, prefetch->count, sizeof(*prefetch->ranges), capture_disk_prefetch_cmp);
+
+        // Ranges sharing pages are requested together (segments are page
+        // aligned, so merged pages are always mapped)
+        start = prefetch->ranges[0][0] & ~(page - 1);
+        end = prefetch->ranges[0][1];
+        for (i = 1; i <= prefetch->count; i++) {
+            if (i < prefetch->count && (prefetch->ranges[i][0] & ~(page - 1)) <= end) {
+                if (prefetch->ranges[i][1] > end)
+                    end = prefetch->ranges[i][1];
+                continue;
+            }
+            madvise((void *) start, end - start, MADV_WILLNEED);
+            if (i < prefetch->count) {
+                start = prefetch->ranges[i][0] & ~(page - 1);
+                end = prefetch->ranges[i][1];
+            }
+        }
+    }
+
+    sng_free(prefetch->ranges);
+    memset(prefetch, 0, sizeof(capture_disk_prefetch_t));
+}
+
+void
+capture_disk_destroy(capture_disk_t *disk)
+{
+    if (!disk)
+        return;
+
+    if (disk->current)
+        capture_disk_segment_release(disk->current);
+    sng_free(disk);
+}
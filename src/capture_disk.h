@@ -0,0 +1,190 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_disk.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to store captured frames data on disk
+ *
+ * When capture.storage is set to disk, frames of parsed packets are
+ * appended to segment files and their data is read back from a shared
+ * mapping of the segment. Only frame headers and parsed information of
+ * each message are kept in memory, so long captures don't grow the
+ * process memory with frame payloads.
+ *
+ * Segment files are removed as soon as they are created, so their disk
+ * space is released once all stored frames have been destroyed or
+ * sngrep exits.
+ */
+#ifndef __SNGREP_CAPTURE_DISK_H
+#define __SNGREP_CAPTURE_DISK_H
+
+#include "config.h"
+#include <stdint.h>
+#include <stdatomic.h>
+#include "packet.h"
+
+//! Default size of each segment file (MB)
+#define CAPTURE_DISK_SEGMENT    64
+//! Directory used for segment files if TMPDIR is not set
+#define CAPTURE_DISK_PATH       "/tmp"
+//! Segment file name template
+#define CAPTURE_DISK_TEMPLATE   "sngrep-XXXXXX"
+
+//! Shorter declaration of capture_disk structure
+typedef struct capture_disk capture_disk_t;
+//! Shorter declaration of capture_disk_segment structure
+typedef struct capture_disk_segment capture_disk_segment_t;
+//! Shorter declaration of capture_disk_prefetch structure
+typedef struct capture_disk_prefetch capture_disk_prefetch_t;
+
+/**
+ * @brief Segment file storing frames data
+ */
+struct capture_disk_segment
+{
+    //! Segment file descriptor (-1 if file was mapped by someone else)
+    int fd;
+    //! Read only mapping of the whole segment
+    u_char *map;
+    //! Segment file length
+    size_t size;
+    //! Offset where next frame data will be appended
+    size_t used;
+    //! Number of frames stored in this segment (plus one while being filled)
+    atomic_uint refs;
+};
+
+/**
+ * @brief Disk storage data
+ */
+struct capture_disk
+{
+    //! Directory where segment files are created
+    const char *path;
+    //! Size of each segment file
+    size_t segment_size;
+    //! Segment frames are being appended to
+    capture_disk_segment_t *current;
+};
+
+/**
+ * @brief Stored data ranges that will be read soon
+ *
+ * Reading many stored frames one by one faults their pages in one small
+ * synchronous read at a time. Ranges of all frames that are going to be
+ * read are collected first and the kernel is asked to read them all at
+ * once, so reads of contiguous frames are merged and several of them are
+ * in flight while the first frames are being copied.
+ */
+struct capture_disk_prefetch
+{
+    //! Start and end address of each range
+    uintptr_t (*ranges)[2];
+    //! Number of ranges and allocated size
+    uint32_t count, size;
+};
+
+/**
+ * @brief Create disk storage for captured frames
+ *
+ * @return disk storage data or NULL if first segment can not be created
+ */
+capture_disk_t *
+capture_disk_create();
+
+/**
+ * @brief Move all frames of a packet to disk storage
+ *
+ * Frames that can not be stored (for example, because disk is full) are
+ * kept in memory. Only one thread can store packets at the same time, so
+ * callers must be holding capture lock.
+ */
+void
+capture_disk_store_packet(capture_disk_t *disk, packet_t *packet);
+
+/**
+ * @brief Append a frame to the current segment
+ *
+ * @return pointer to stored frame data or NULL if it can not be stored
+ */
+u_char *
+capture_disk_store(capture_disk_t *disk, const u_char *data, uint32_t len, capture_disk_segment_t **segment);
+
+/**
+ * @brief Create a new segment file
+ *
+ * @return segment data or NULL if file can not be created
+ */
+capture_disk_segment_t *
+capture_disk_segment_create(const char *path, size_t size);
+
+/**
+ * @brief Use an already mapped read only file as segment
+ *
+ * Mapping is owned by the segment and released with its last frame.
+ *
+ * @return segment data or NULL on allocation error
+ */
+capture_disk_segment_t *
+capture_disk_segment_wrap(const u_char *map, size_t size);
+
+/**
+ * @brief Add a frame stored in a segment
+ */
+capture_disk_segment_t *
+capture_disk_segment_ref(capture_disk_segment_t *segment);
+
+/**
+ * @brief Release a segment stored frame
+ *
+ * Segment is unmapped once all its frames have been released.
+ */
+void
+capture_disk_segment_release(capture_disk_segment_t *segment);
+
+/**
+ * @brief Add stored frames and payload of a packet to a prefetch
+ *
+ * Packets kept in memory are ignored.
+ */
+void
+capture_disk_prefetch_packet(capture_disk_prefetch_t *prefetch, const packet_t *packet);
+
+/**
+ * @brief Request all prefetch ranges to be read and empty it
+ *
+ * Ranges are sorted and adjacent pages merged, so each segment region is
+ * requested once. Requests don't wait for data to be read.
+ */
+void
+capture_disk_prefetch_run(capture_disk_prefetch_t *prefetch);
+
+/**
+ * @brief Stop storing frames on disk
+ *
+ * Already stored frames are still readable until they are destroyed.
+ */
+void
+capture_disk_destroy(capture_disk_t *disk);
+
+#endif /* __SNGREP_CAPTURE_DISK_H */
@@ -47,8 +47,12 @@
 #include <unistd.h>
 #include <pcap.h>
 #include "capture_eep.h"
+#include "affinity.h"
 #include "util.h"
 #include "setting.h"
+#ifdef WITH_OPENSSL
+#include "capture_openssl.h"
+#endif
 
 capture_eep_config_t eep_cfg = { 0 };
 
@@ -59,6 +63,8 @@ int
 capture_eep_init()
 {
     struct addrinfo *ai, hints[1] = { { 0 } };
+    capture_eep_listener_t *listener;
+    int i, queue;
 
     // Setting for EEP client
     if (setting_enabled(SETTING_EEP_SEND)) {
@@ -69,10 +75,28 @@ capture_eep_init()
         eep_cfg.capt_password = setting_get_value(SETTING_EEP_SEND_PASS);
         eep_cfg.capt_id = setting_get_intvalue(SETTING_EEP_SEND_ID);;
 
+        if (setting_has_value(SETTING_EEP_SEND_PROTO, "tcp")) {
+            eep_cfg.capt_proto = CAPTURE_EEP_PROTO_TCP;
+        } else if (setting_has_value(SETTING_EEP_SEND_PROTO, "tls")) {
+#ifdef WITH_OPENSSL
+            eep_cfg.capt_proto = CAPTURE_EEP_PROTO_TLS;
+#else
+            fprintf(stderr, "EEP client: sngrep is not compiled with OpenSSL support\n");
+            return 1;
+#endif
+        } else {
+            eep_cfg.capt_proto = CAPTURE_EEP_PROTO_UDP;
+        }
+
         hints->ai_flags = AI_NUMERICSERV;
         hints->ai_family = AF_UNSPEC;
-        hints->ai_socktype = SOCK_DGRAM;
-        hints->ai_protocol = IPPROTO_UDP;
+        if (eep_cfg.capt_proto == CAPTURE_EEP_PROTO_UDP) {
+            hints->ai_socktype = SOCK_DGRAM;
+            hints->ai_protocol = IPPROTO_UDP;
+        } else {
+            hints->ai_socktype = SOCK_STREAM;
+            hints->ai_protocol = IPPROTO_TCP;
+        }
 
         if (getaddrinfo(eep_cfg.capt_host, eep_cfg.capt_port, hints, &ai)) {
             fprintf(stderr, "EEP client: failed getaddrinfo() for %s:%s\n",
@@ -80,17 +104,79 @@ capture_eep_init()
             return 1;
         }
 
-        eep_cfg.client_sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
-        if (eep_cfg.client_sock < 0) {
-            fprintf(stderr, "Sender socket creation failed: %s\n", strerror(errno));
-            return 1;
-        }
-
-        if (connect(eep_cfg.client_sock, ai->ai_addr, (socklen_t) (ai->ai_addrlen)) == -1) {
-            if (errno != EINPROGRESS) {
+        if (eep_cfg.capt_proto == CAPTURE_EEP_PROTO_UDP) {
+            eep_cfg.client_sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (eep_cfg.client_sock < 0) {
                 fprintf(stderr, "Sender socket creation failed: %s\n", strerror(errno));
                 return 1;
             }
+
+            if (connect(eep_cfg.client_sock, ai->ai_addr, (socklen_t) (ai->ai_addrlen)) == -1) {
+                if (errno != EINPROGRESS) {
+                    fprintf(stderr, "Sender socket creation failed: %s\n", strerror(errno));
+                    return 1;
+                }
+            }
+            freeaddrinfo(ai);
+        } else {
+            // Stream connections are opened (and reopened) by sender thread
+            eep_cfg.capt_addr = ai;
+            eep_cfg.client_sock = -1;
+            eep_cfg.reconnect_delay = CAPTURE_EEP_RECONNECT_MIN;
+
+            // Data pending to be written while collector is not reachable
+            if ((eep_cfg.spool_size = setting_get_intvalue(SETTING_EEP_SEND_SPOOL) * 1024) < CAPTURE_EEP_SEND_LEN)
+                eep_cfg.spool_size = CAPTURE_EEP_SEND_LEN;
+            if (!(eep_cfg.spool = sng_malloc(eep_cfg.spool_size))) {
+                fprintf(stderr, "Unable to allocate HEP send spool\n");
+                return 1;
+            }
+
+#ifdef WITH_OPENSSL
+            if (eep_cfg.capt_proto == CAPTURE_EEP_PROTO_TLS) {
+#if MODSSL_USE_OPENSSL_PRE_1_1_API
+                SSL_library_init();
+                SSL_load_error_strings();
+                eep_cfg.ssl_ctx = SSL_CTX_new(SSLv23_client_method());
+#else
+                eep_cfg.ssl_ctx = SSL_CTX_new(TLS_client_method());
+#endif
+                if (!eep_cfg.ssl_ctx) {
+                    fprintf(stderr, "EEP client: unable to create TLS context\n");
+                    return 1;
+                }
+                // Write pending data in several calls if socket is busy
+                SSL_CTX_set_mode(eep_cfg.ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE
+                                 | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+            }
+#endif
+        }
+
+        // Messages that can be pending to be sent
+        if ((queue = setting_get_intvalue(SETTING_EEP_SEND_QUEUE)) <= 0)
+            queue = CAPTURE_EEP_SEND_QUEUE;
+
+        eep_cfg.send_queue = ring_create(queue);
+        eep_cfg.send_free = ring_create(queue);
+        eep_cfg.send_msgs = sng_malloc((size_t) queue * sizeof(capture_eep_msg_t));
+        if (!eep_cfg.send_queue || !eep_cfg.send_free || !eep_cfg.send_msgs) {
+            fprintf(stderr, "Unable to allocate HEP send queue\n");
+            return 1;
+        }
+
+        for (i = 0; i < queue; i++)
+            ring_push(eep_cfg.send_free, &eep_cfg.send_msgs[i]);
+
+        atomic_init(&eep_cfg.send_dropped, 0);
+        atomic_init(&eep_cfg.send_stopping, false);
+        atomic_init(&eep_cfg.send_waiting, false);
+        pthread_mutex_init(&eep_cfg.send_lock, NULL);
+        pthread_cond_init(&eep_cfg.send_cond, NULL);
+
+        // Create a new thread for sending queued packets
+        if (pthread_create(&eep_cfg.send_thread, NULL, capture_eep_send_thread, NULL) != 0) {
+            fprintf(stderr, "Error creating sender thread: %s\n", strerror(errno));
+            return 1;
         }
     }
 
@@ -112,25 +198,61 @@ capture_eep_init()
             return 1;
         }
 
-        // Create a socket for a new TCP IPv4 connection
-        eep_cfg.server_sock = socket(AF_INET, SOCK_DGRAM, 0);
-        if (eep_cfg.client_sock < 0) {
-            fprintf(stderr, "Error creating server socket: %s\n", strerror(errno));
-            return 1;
-        }
+        // Datagrams received and parsed together
+        eep_cfg.srv_batch = setting_get_intvalue(SETTING_EEP_LISTEN_BATCH);
+        if (eep_cfg.srv_batch <= 0)
+            eep_cfg.srv_batch = CAPTURE_EEP_BATCH;
+        eep_cfg.srv_rcvbuf = setting_get_intvalue(SETTING_EEP_LISTEN_RCVBUF) * 1024;
+
+        // Threads receiving from the same port
+        eep_cfg.srv_threads = setting_get_intvalue(SETTING_EEP_LISTEN_THREADS);
+#ifdef SO_REUSEPORT
+        if (eep_cfg.srv_threads <= 0)
+            eep_cfg.srv_threads = 1;
+#else
+        eep_cfg.srv_threads = 1;
+#endif
+        eep_cfg.listeners = sng_malloc(eep_cfg.srv_threads * sizeof(capture_eep_listener_t));
 
-        // Bind that socket to the requested address and port
-        if (bind(eep_cfg.server_sock, ai->ai_addr, ai->ai_addrlen) == -1) {
-            fprintf(stderr, "Error binding address: %s\n", strerror(errno));
-            return 1;
-        }
+        for (i = 0; i < eep_cfg.srv_threads; i++) {
+            listener = &eep_cfg.listeners[i];
 
-        // Create a new thread for accepting client connections
-        if (pthread_create(&eep_cfg.server_thread, NULL, accept_eep_client, NULL) != 0) {
-            fprintf(stderr, "Error creating accept thread: %s\n", strerror(errno));
-            return 1;
-        }
+            // Create a socket for a new TCP IPv4 connection
+            listener->sock = socket(AF_INET, SOCK_DGRAM, 0);
+            if (listener->sock < 0) {
+                fprintf(stderr, "Error creating server socket: %s\n", strerror(errno));
+                return 1;
+            }
 
+#ifdef SO_REUSEPORT
+            // Let the kernel spread senders between listeners
+            if (eep_cfg.srv_threads > 1
+                && setsockopt(listener->sock, SOL_SOCKET, SO_REUSEPORT, &(int){ 1 }, sizeof(int)) == -1) {
+                fprintf(stderr, "Error sharing server port: %s\n", strerror(errno));
+                return 1;
+            }
+#endif
+
+            // Make room for bursts of many HEP agents
+            if (eep_cfg.srv_rcvbuf > 0)
+                setsockopt(listener->sock, SOL_SOCKET, SO_RCVBUF, &eep_cfg.srv_rcvbuf, sizeof(int));
+#ifdef SO_RXQ_OVFL
+            // Report datagrams dropped by the kernel
+            setsockopt(listener->sock, SOL_SOCKET, SO_RXQ_OVFL, &(int){ 1 }, sizeof(int));
+#endif
+
+            // Bind that socket to the requested address and port
+            if (bind(listener->sock, ai->ai_addr, ai->ai_addrlen) == -1) {
+                fprintf(stderr, "Error binding address: %s\n", strerror(errno));
+                return 1;
+            }
+
+            // Create a new thread for accepting client connections
+            if (pthread_create(&listener->thread, NULL, accept_eep_client, listener) != 0) {
+                fprintf(stderr, "Error creating accept thread: %s\n", strerror(errno));
+                return 1;
+            }
+        }
     }
 
     // Settings for EEP server
@@ -141,21 +263,59 @@ capture_eep_init()
 void *
 accept_eep_client(void *data)
 {
-    packet_t *pkt;
+    capture_eep_listener_t *listener = (capture_eep_listener_t *) data;
+    u_char *buffers;
+    uint32_t *lens;
+    packet_t **pkts;
+    int i, count, received;
+
+    // Pin before allocating, so buffers are in the listener NUMA node
+    affinity_apply(AFFINITY_EEP);
+
+    // Buffers for a full batch of datagrams, reused for every batch
+    buffers = sng_malloc((size_t) eep_cfg.srv_batch * MAX_CAPTURE_LEN);
+    lens = sng_malloc(eep_cfg.srv_batch * sizeof(uint32_t));
+    pkts = sng_malloc(eep_cfg.srv_batch * sizeof(packet_t *));
+    if (!buffers || !lens || !pkts) {
+        sng_free(buffers);
+        sng_free(lens);
+        sng_free(pkts);
+        pthread_exit(NULL);
+        return 0;
+    }
 
     // Begin accepting connections
-    while (eep_cfg.server_sock > 0) {
-        if ((pkt = capture_eep_receive())) {
-            // Avoid parsing from multiples sources.
-            // Avoid parsing while screen in being redrawn
-            capture_lock();
-            if (capture_packet_parse(pkt) != 0) {
-                packet_destroy(pkt);
+    while (listener->sock > 0) {
+        if ((received = capture_eep_receive_batch(listener, buffers, lens)) <= 0)
+            continue;
+
+        // Decode HEP headers before locking, in parallel with other listeners
+        for (i = 0, count = 0; i < received; i++) {
+            if ((pkts[count] = capture_eep_receive(buffers + (size_t) i * MAX_CAPTURE_LEN, lens[i]))) {
+                count++;
+            } else {
+                atomic_fetch_add(&eep_cfg.srv_errors, 1);
+            }
+        }
+
+        if (count == 0)
+            continue;
+
+        // Avoid parsing from multiples sources.
+        // Avoid parsing while screen in being redrawn
+        capture_lock();
+        for (i = 0; i < count; i++) {
+            if (capture_packet_parse(pkts[i]) != 0) {
+                packet_destroy(pkts[i]);
             }
-            capture_unlock();
         }
+        capture_unlock();
     }
 
+    sng_free(buffers);
+    sng_free(lens);
+    sng_free(pkts);
+
     // Leave the thread gracefully
     pthread_exit(NULL);
     return 0;
@@ -164,13 +324,47 @@ accept_eep_client(void *data)
 void
 capture_eep_deinit()
 {
-    if (eep_cfg.client_sock)
+    int i;
+
+    // Let the sender empty its queue
+    if (eep_cfg.send_msgs) {
+        eep_cfg.send_stopping = true;
+        pthread_mutex_lock(&eep_cfg.send_lock);
+        pthread_cond_signal(&eep_cfg.send_cond);
+        pthread_mutex_unlock(&eep_cfg.send_lock);
+        pthread_join(eep_cfg.send_thread, NULL);
+        pthread_cond_destroy(&eep_cfg.send_cond);
+        pthread_mutex_destroy(&eep_cfg.send_lock);
+    }
+
+    if (eep_cfg.capt_proto != CAPTURE_EEP_PROTO_UDP) {
+        capture_eep_disconnect();
+        if (eep_cfg.capt_addr)
+            freeaddrinfo(eep_cfg.capt_addr);
+        eep_cfg.capt_addr = NULL;
+        sng_free(eep_cfg.spool);
+        eep_cfg.spool = NULL;
+#ifdef WITH_OPENSSL
+        if (eep_cfg.ssl_ctx)
+            SSL_CTX_free(eep_cfg.ssl_ctx);
+        eep_cfg.ssl_ctx = NULL;
+#endif
+    } else if (eep_cfg.client_sock) {
         close(eep_cfg.client_sock);
+    }
 
-    if (eep_cfg.server_sock) {
-        close(eep_cfg.server_sock);
-        eep_cfg.server_sock = -1;
-        //pthread_join(&eep_cfg.server_thread, &ret);
+    ring_destroy(eep_cfg.send_queue);
+    ring_destroy(eep_cfg.send_free);
+    sng_free(eep_cfg.send_msgs);
+    eep_cfg.send_queue = eep_cfg.send_free = NULL;
+    eep_cfg.send_msgs = NULL;
+
+    for (i = 0; i < eep_cfg.srv_threads; i++) {
+        if (eep_cfg.listeners[i].sock) {
+            close(eep_cfg.listeners[i].sock);
+            eep_cfg.listeners[i].sock = -1;
+            //pthread_join(&eep_cfg.listeners[i].thread, &ret);
+        }
     }
 }
 
@@ -189,27 +383,50 @@ capture_eep_listen_port()
 int
 capture_eep_send(packet_t *pkt)
 {
+    capture_eep_msg_t *msg;
+    int ret = 1;
+
     // Dont send RTP packets
     if (pkt->type == PACKET_RTP)
         return 1;
 
-    // Check we have a connection established
-    if (!eep_cfg.client_sock)
+    // Check sender is running (stream connections may be down, packets
+    // are kept in the spool until they can be sent)
+    if (!eep_cfg.send_queue)
         return 1;
 
+    // Never wait for the collector while capturing
+    if (!(msg = ring_pop(eep_cfg.send_free))) {
+        atomic_fetch_add_explicit(&eep_cfg.send_dropped, 1, memory_order_relaxed);
+        return 1;
+    }
+
     switch (eep_cfg.capt_version) {
         case 2:
-            return capture_eep_send_v2(pkt);
+            ret = capture_eep_send_v2(pkt, msg);
+            break;
         case 3:
-            return capture_eep_send_v3(pkt);
+            ret = capture_eep_send_v3(pkt, msg);
+            break;
     }
-    return 1;
+
+    // Only sender thread returns messages to the free list, so
+    // messages that could not be encoded are queued empty
+    if (ret != 0) {
+        atomic_fetch_add_explicit(&eep_cfg.send_dropped, 1, memory_order_relaxed);
+        msg->len = 0;
+    }
+
+    // Queue has room for all messages
+    ring_push(eep_cfg.send_queue, msg);
+    capture_eep_send_wakeup();
+    return ret;
 }
 
 int
-capture_eep_send_v2(packet_t *pkt)
+capture_eep_send_v2(packet_t *pkt, capture_eep_msg_t *msg)
 {
-    void* buffer;
+    u_char *buffer = msg->data;
     uint32_t buflen = 0, tlen = 0;
     struct hep_hdr hdr;
     struct hep_timehdr hep_time;
@@ -222,6 +439,7 @@ capture_eep_send_v2(packet_t *pkt)
     frame_t *frame = vector_first(pkt->frames);
 
     /* Version && proto */
+    memset(&hdr, 0, sizeof(struct hep_hdr));
     hdr.hp_v = 2;
     hdr.hp_f = pkt->ip_version == 4 ? AF_INET : AF_INET6;
     hdr.hp_p = pkt->proto;
@@ -238,8 +456,8 @@ capture_eep_send_v2(packet_t *pkt)
 
     /* IPv4 */
     if (pkt->ip_version == 4) {
-        inet_pton(AF_INET, pkt->src.ip, &hep_ipheader.hp_src);
-        inet_pton(AF_INET, pkt->dst.ip, &hep_ipheader.hp_dst);
+        hep_ipheader.hp_src = pkt->src.ip.v4;
+        hep_ipheader.hp_dst = pkt->dst.ip.v4;
         tlen += sizeof(struct hep_iphdr);
         hdr.hp_l += sizeof(struct hep_iphdr);
     }
@@ -247,8 +465,8 @@ capture_eep_send_v2(packet_t *pkt)
 #ifdef USE_IPV6
     /* IPv6 */
     else if(pkt->ip_version == 6) {
-        inet_pton(AF_INET6, pkt->src.ip, &hep_ip6header.hp6_src);
-        inet_pton(AF_INET6, pkt->dst.ip, &hep_ip6header.hp6_dst);
+        hep_ip6header.hp6_src = pkt->src.ip.v6;
+        hep_ip6header.hp6_dst = pkt->dst.ip.v6;
         tlen += sizeof(struct hep_ip6hdr);
         hdr.hp_l += sizeof(struct hep_ip6hdr);
     }
@@ -258,50 +476,44 @@ capture_eep_send_v2(packet_t *pkt)
     tlen += len;
     hdr.hp_l = htons(tlen);
 
-    // Allocate memory for HEPv2 packet
-    if (!(buffer = sng_malloc(tlen)))
+    // Check HEPv2 packet fits in message
+    if (!data || tlen > sizeof(msg->data))
         return 1;
 
     // Copy basic headers
     buflen = 0;
-    memcpy((void*) buffer + buflen, &hdr, sizeof(struct hep_hdr));
+    memcpy(buffer + buflen, &hdr, sizeof(struct hep_hdr));
     buflen += sizeof(struct hep_hdr);
 
     // Copy IP header
     if (pkt->ip_version == 4) {
-        memcpy((void*) buffer + buflen, &hep_ipheader, sizeof(struct hep_iphdr));
+        memcpy(buffer + buflen, &hep_ipheader, sizeof(struct hep_iphdr));
         buflen += sizeof(struct hep_iphdr);
     }
 #ifdef USE_IPV6
     else if(pkt->ip_version == 6) {
-        memcpy((void*) buffer + buflen, &hep_ip6header, sizeof(struct hep_ip6hdr));
+        memcpy(buffer + buflen, &hep_ip6header, sizeof(struct hep_ip6hdr));
         buflen += sizeof(struct hep_ip6hdr);
     }
 #endif
 
     // Copy TImestamp header
-    memcpy((void*) buffer + buflen, &hep_time, sizeof(struct hep_timehdr));
+    memcpy(buffer + buflen, &hep_time, sizeof(struct hep_timehdr));
     buflen += sizeof(struct hep_timehdr);
 
     // Now copy payload itself
-    memcpy((void*) buffer + buflen, data, len);
+    memcpy(buffer + buflen, data, len);
     buflen += len;
 
-    if (send(eep_cfg.client_sock, buffer, buflen, 0) == -1) {
-        return 1;
-    }
-
-    /* FREE */
-    sng_free(buffer);
-
-    return 1;
+    msg->len = buflen;
+    return 0;
 }
 
 int
-capture_eep_send_v3(packet_t *pkt)
+capture_eep_send_v3(packet_t *pkt, capture_eep_msg_t *msg)
 {
-    struct hep_generic *hg = NULL;
-    void* buffer;
+    struct hep_generic hg;
+    u_char *buffer = msg->data;
     uint32_t buflen = 0, iplen = 0, tlen = 0;
     hep_chunk_ip4_t src_ip4, dst_ip4;
 #ifdef USE_IPV6
@@ -313,35 +525,35 @@ capture_eep_send_v3(packet_t *pkt)
     unsigned char *data = packet_payload(pkt);
     uint32_t len = packet_payloadlen(pkt);
 
-    hg = sng_malloc(sizeof(struct hep_generic));
+    memset(&hg, 0, sizeof(struct hep_generic));
 
     /* header set "HEP3" */
-    memcpy(hg->header.id, "\x48\x45\x50\x33", 4);
+    memcpy(hg.header.id, "\x48\x45\x50\x33", 4);
 
     /* IP proto */
-    hg->ip_family.chunk.vendor_id = htons(0x0000);
-    hg->ip_family.chunk.type_id = htons(0x0001);
-    hg->ip_family.data = pkt->ip_version == 4 ? AF_INET : AF_INET6;
-    hg->ip_family.chunk.length = htons(sizeof(hg->ip_family));
+    hg.ip_family.chunk.vendor_id = htons(0x0000);
+    hg.ip_family.chunk.type_id = htons(0x0001);
+    hg.ip_family.data = pkt->ip_version == 4 ? AF_INET : AF_INET6;
+    hg.ip_family.chunk.length = htons(sizeof(hg.ip_family));
 
     /* Proto ID */
-    hg->ip_proto.chunk.vendor_id = htons(0x0000);
-    hg->ip_proto.chunk.type_id = htons(0x0002);
-    hg->ip_proto.data = pkt->proto;
-    hg->ip_proto.chunk.length = htons(sizeof(hg->ip_proto));
+    hg.ip_proto.chunk.vendor_id = htons(0x0000);
+    hg.ip_proto.chunk.type_id = htons(0x0002);
+    hg.ip_proto.data = pkt->proto;
+    hg.ip_proto.chunk.length = htons(sizeof(hg.ip_proto));
 
     /* IPv4 */
     if (pkt->ip_version == 4) {
         /* SRC IP */
         src_ip4.chunk.vendor_id = htons(0x0000);
         src_ip4.chunk.type_id = htons(0x0003);
-        inet_pton(AF_INET, pkt->src.ip, &src_ip4.data);
+        src_ip4.data = pkt->src.ip.v4;
         src_ip4.chunk.length = htons(sizeof(src_ip4));
 
         /* DST IP */
         dst_ip4.chunk.vendor_id = htons(0x0000);
         dst_ip4.chunk.type_id = htons(0x0004);
-        inet_pton(AF_INET, pkt->dst.ip, &dst_ip4.data);
+        dst_ip4.data = pkt->dst.ip.v4;
         dst_ip4.chunk.length = htons(sizeof(dst_ip4));
 
         iplen = sizeof(dst_ip4) + sizeof(src_ip4);
@@ -353,13 +565,13 @@ capture_eep_send_v3(packet_t *pkt)
         /* SRC IPv6 */
         src_ip6.chunk.vendor_id = htons(0x0000);
         src_ip6.chunk.type_id = htons(0x0005);
-        inet_pton(AF_INET6, pkt->src.ip, &src_ip6.data);
+        src_ip6.data = pkt->src.ip.v6;
         src_ip6.chunk.length = htons(sizeof(src_ip6));
 
         /* DST IPv6 */
         dst_ip6.chunk.vendor_id = htons(0x0000);
         dst_ip6.chunk.type_id = htons(0x0006);
-        inet_pton(AF_INET6, pkt->dst.ip, &dst_ip6.data);
+        dst_ip6.data = pkt->dst.ip.v6;
         dst_ip6.chunk.length = htons(sizeof(dst_ip6));
 
         iplen = sizeof(dst_ip6) + sizeof(src_ip6);
@@ -367,40 +579,40 @@ capture_eep_send_v3(packet_t *pkt)
 #endif
 
     /* SRC PORT */
-    hg->src_port.chunk.vendor_id = htons(0x0000);
-    hg->src_port.chunk.type_id = htons(0x0007);
-    hg->src_port.data = htons(pkt->src.port);
-    hg->src_port.chunk.length = htons(sizeof(hg->src_port));
+    hg.src_port.chunk.vendor_id = htons(0x0000);
+    hg.src_port.chunk.type_id = htons(0x0007);
+    hg.src_port.data = htons(pkt->src.port);
+    hg.src_port.chunk.length = htons(sizeof(hg.src_port));
 
     /* DST PORT */
-    hg->dst_port.chunk.vendor_id = htons(0x0000);
-    hg->dst_port.chunk.type_id = htons(0x0008);
-    hg->dst_port.data = htons(pkt->dst.port);
-    hg->dst_port.chunk.length = htons(sizeof(hg->dst_port));
+    hg.dst_port.chunk.vendor_id = htons(0x0000);
+    hg.dst_port.chunk.type_id = htons(0x0008);
+    hg.dst_port.data = htons(pkt->dst.port);
+    hg.dst_port.chunk.length = htons(sizeof(hg.dst_port));
 
     /* TIMESTAMP SEC */
-    hg->time_sec.chunk.vendor_id = htons(0x0000);
-    hg->time_sec.chunk.type_id = htons(0x0009);
-    hg->time_sec.data = htonl(frame->header->ts.tv_sec);
-    hg->time_sec.chunk.length = htons(sizeof(hg->time_sec));
+    hg.time_sec.chunk.vendor_id = htons(0x0000);
+    hg.time_sec.chunk.type_id = htons(0x0009);
+    hg.time_sec.data = htonl(frame->header->ts.tv_sec);
+    hg.time_sec.chunk.length = htons(sizeof(hg.time_sec));
 
     /* TIMESTAMP USEC */
-    hg->time_usec.chunk.vendor_id = htons(0x0000);
-    hg->time_usec.chunk.type_id = htons(0x000a);
-    hg->time_usec.data = htonl(frame->header->ts.tv_usec);
-    hg->time_usec.chunk.length = htons(sizeof(hg->time_usec));
+    hg.time_usec.chunk.vendor_id = htons(0x0000);
+    hg.time_usec.chunk.type_id = htons(0x000a);
+    hg.time_usec.data = htonl(frame->header->ts.tv_usec);
+    hg.time_usec.chunk.length = htons(sizeof(hg.time_usec));
 
     /* Protocol TYPE */
-    hg->proto_t.chunk.vendor_id = htons(0x0000);
-    hg->proto_t.chunk.type_id = htons(0x000b);
-    hg->proto_t.data = 1;
-    hg->proto_t.chunk.length = htons(sizeof(hg->proto_t));
+    hg.proto_t.chunk.vendor_id = htons(0x0000);
+    hg.proto_t.chunk.type_id = htons(0x000b);
+    hg.proto_t.data = 1;
+    hg.proto_t.chunk.length = htons(sizeof(hg.proto_t));
 
     /* Capture ID */
-    hg->capt_id.chunk.vendor_id = htons(0x0000);
-    hg->capt_id.chunk.type_id = htons(0x000c);
-    hg->capt_id.data = htons(eep_cfg.capt_id);
-    hg->capt_id.chunk.length = htons(sizeof(hg->capt_id));
+    hg.capt_id.chunk.vendor_id = htons(0x0000);
+    hg.capt_id.chunk.type_id = htons(0x000c);
+    hg.capt_id.data = htons(eep_cfg.capt_id);
+    hg.capt_id.chunk.length = htons(sizeof(hg.capt_id));
 
     /* Payload */
     payload_chunk.vendor_id = htons(0x0000);
@@ -421,22 +633,22 @@ capture_eep_send_v3(packet_t *pkt)
     }
 
     /* total */
-    hg->header.length = htons(tlen);
+    hg.header.length = htons(tlen);
 
-    if (!(buffer = sng_malloc(tlen))) {
-        sng_free(hg);
+    // Check HEPv3 packet fits in message
+    if (!data || tlen > sizeof(msg->data))
         return 1;
-    }
-    memcpy((void*) buffer, hg, sizeof(struct hep_generic));
+
+    memcpy(buffer, &hg, sizeof(struct hep_generic));
     buflen = sizeof(struct hep_generic);
 
     /* IPv4 */
     if (pkt->ip_version == 4) {
         /* SRC IP */
-        memcpy((void*) buffer + buflen, &src_ip4, sizeof(struct hep_chunk_ip4));
+        memcpy(buffer + buflen, &src_ip4, sizeof(struct hep_chunk_ip4));
         buflen += sizeof(struct hep_chunk_ip4);
 
-        memcpy((void*) buffer + buflen, &dst_ip4, sizeof(struct hep_chunk_ip4));
+        memcpy(buffer + buflen, &dst_ip4, sizeof(struct hep_chunk_ip4));
         buflen += sizeof(struct hep_chunk_ip4);
     }
 
@@ -444,10 +656,10 @@ capture_eep_send_v3(packet_t *pkt)
     /* IPv6 */
     else if(pkt->ip_version == 6) {
         /* SRC IPv6 */
-        memcpy((void*) buffer+buflen, &src_ip6, sizeof(struct hep_chunk_ip6));
+        memcpy(buffer + buflen, &src_ip6, sizeof(struct hep_chunk_ip6));
         buflen += sizeof(struct hep_chunk_ip6);
 
-        memcpy((void*) buffer+buflen, &dst_ip6, sizeof(struct hep_chunk_ip6));
+        memcpy(buffer + buflen, &dst_ip6, sizeof(struct hep_chunk_ip6));
         buflen += sizeof(struct hep_chunk_ip6);
     }
 #endif
@@ -455,51 +667,367 @@ capture_eep_send_v3(packet_t *pkt)
     /* AUTH KEY CHUNK */
     if (eep_cfg.capt_password != NULL) {
 
-        memcpy((void*) buffer + buflen, &authkey_chunk, sizeof(struct hep_chunk));
+        memcpy(buffer + buflen, &authkey_chunk, sizeof(struct hep_chunk));
         buflen += sizeof(struct hep_chunk);
 
         /* Now copying payload self */
-        memcpy((void*) buffer + buflen, eep_cfg.capt_password, strlen(eep_cfg.capt_password));
+        memcpy(buffer + buflen, eep_cfg.capt_password, strlen(eep_cfg.capt_password));
         buflen += strlen(eep_cfg.capt_password);
     }
 
     /* PAYLOAD CHUNK */
-    memcpy((void*) buffer + buflen, &payload_chunk, sizeof(struct hep_chunk));
+    memcpy(buffer + buflen, &payload_chunk, sizeof(struct hep_chunk));
     buflen += sizeof(struct hep_chunk);
 
     /* Now copying payload itself */
-    memcpy((void*) buffer + buflen, data, len);
+    memcpy(buffer + buflen, data, len);
     buflen += len;
 
-    if (send(eep_cfg.client_sock, buffer, buflen, 0) == -1) {
+    msg->len = buflen;
+    return 0;
+}
+
+void
+capture_eep_send_wakeup()
+{
+    // Make queued messages visible before checking sender status
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // Only signal the sender if it is actually sleeping
+    if (atomic_load(&eep_cfg.send_waiting)) {
+        pthread_mutex_lock(&eep_cfg.send_lock);
+        pthread_cond_signal(&eep_cfg.send_cond);
+        pthread_mutex_unlock(&eep_cfg.send_lock);
+    }
+}
+
+void
+capture_eep_send_datagrams()
+{
+    capture_eep_msg_t *batch[CAPTURE_EEP_BATCH];
+    int count, sent, i;
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr msgs[CAPTURE_EEP_BATCH];
+    struct iovec iovs[CAPTURE_EEP_BATCH];
+    int len;
+#endif
+
+    // Send all queued messages
+    while ((batch[0] = ring_pop(eep_cfg.send_queue))) {
+        for (count = 1; count < CAPTURE_EEP_BATCH; count++) {
+            if (!(batch[count] = ring_pop(eep_cfg.send_queue)))
+                break;
+        }
+
+#ifdef HAVE_SENDMMSG
+        memset(msgs, 0, sizeof(struct mmsghdr) * count);
+        for (i = 0, len = 0; i < count; i++) {
+            if (batch[i]->len == 0)
+                continue;
+            iovs[len].iov_base = batch[i]->data;
+            iovs[len].iov_len = batch[i]->len;
+            msgs[len].msg_hdr.msg_iov = &iovs[len];
+            msgs[len].msg_hdr.msg_iovlen = 1;
+            len++;
+        }
+
+        // sendmmsg stops at the first message that can not be sent
+        for (sent = 0; sent < len;) {
+            if ((i = sendmmsg(eep_cfg.client_sock, msgs + sent, len - sent, 0)) <= 0) {
+                // Skip the failed message and try with the rest
+                atomic_fetch_add_explicit(&eep_cfg.send_dropped, 1, memory_order_relaxed);
+                sent++;
+                continue;
+            }
+            sent += i;
+        }
+#else
+        for (sent = 0; sent < count; sent++) {
+            if (batch[sent]->len && send(eep_cfg.client_sock, batch[sent]->data, batch[sent]->len, 0) == -1)
+                atomic_fetch_add_explicit(&eep_cfg.send_dropped, 1, memory_order_relaxed);
+        }
+#endif
+
+        // Let capture threads reuse sent messages
+        for (i = 0; i < count; i++)
+            ring_push(eep_cfg.send_free, batch[i]);
+    }
+}
+
+void
+capture_eep_spool_msgs()
+{
+    capture_eep_msg_t *msg;
+
+    while ((msg = ring_pop(eep_cfg.send_queue))) {
+        if (msg->len) {
+            // Move pending data to the beginning to make room at the end
+            if (eep_cfg.spool_head + eep_cfg.spool_len + msg->len > eep_cfg.spool_size
+                    && eep_cfg.spool_head > 0) {
+                memmove(eep_cfg.spool, eep_cfg.spool + eep_cfg.spool_head, eep_cfg.spool_len);
+                eep_cfg.spool_head = 0;
+            }
+
+            if (eep_cfg.spool_len + msg->len > eep_cfg.spool_size) {
+                // Spool is full, collector has been down for too long
+                atomic_fetch_add_explicit(&eep_cfg.send_dropped, 1, memory_order_relaxed);
+            } else {
+                memcpy(eep_cfg.spool + eep_cfg.spool_head + eep_cfg.spool_len, msg->data, msg->len);
+                eep_cfg.spool_len += msg->len;
+            }
+        }
+
+        // Let capture threads reuse spooled messages
+        ring_push(eep_cfg.send_free, msg);
+    }
+}
+
+int
+capture_eep_connect()
+{
+    struct addrinfo *ai = eep_cfg.capt_addr;
+    struct timeval timeout = { CAPTURE_EEP_CONNECT_TIMEOUT, 0 };
+
+    if ((eep_cfg.client_sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+        return 1;
+
+    // Limit the time waiting for the collector to accept the connection
+    setsockopt(eep_cfg.client_sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(eep_cfg.client_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (connect(eep_cfg.client_sock, ai->ai_addr, (socklen_t) ai->ai_addrlen) == -1) {
+        capture_eep_disconnect();
         return 1;
     }
 
-    /* FREE */
-    sng_free(buffer);
-    sng_free(hg);
+#ifdef WITH_OPENSSL
+    if (eep_cfg.capt_proto == CAPTURE_EEP_PROTO_TLS) {
+        if (!(eep_cfg.ssl = SSL_new(eep_cfg.ssl_ctx))) {
+            capture_eep_disconnect();
+            return 1;
+        }
+        SSL_set_fd(eep_cfg.ssl, eep_cfg.client_sock);
+        SSL_set_tlsext_host_name(eep_cfg.ssl, eep_cfg.capt_host);
+        if (SSL_connect(eep_cfg.ssl) != 1) {
+            capture_eep_disconnect();
+            return 1;
+        }
+    }
+#endif
+
+    // Don't wait for the collector longer than a spool cycle while writing
+    timeout.tv_sec = 0;
+    timeout.tv_usec = CAPTURE_EEP_SEND_TIMEOUT * 1000;
+    setsockopt(eep_cfg.client_sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // Partially written data from previous connection is lost
+    eep_cfg.spool_retry = 0;
     return 0;
 }
 
+void
+capture_eep_disconnect()
+{
+#ifdef WITH_OPENSSL
+    if (eep_cfg.ssl) {
+        SSL_free(eep_cfg.ssl);
+        eep_cfg.ssl = NULL;
+    }
+#endif
+    if (eep_cfg.client_sock >= 0) {
+        close(eep_cfg.client_sock);
+        eep_cfg.client_sock = -1;
+    }
+}
+
+void
+capture_eep_send_stream()
+{
+    struct timespec now;
+    uint32_t len;
+    ssize_t written;
+
+    // Keep queued messages while there is room in the spool
+    capture_eep_spool_msgs();
+
+    if (eep_cfg.client_sock < 0) {
+        // Wait until next connection attempt
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec < eep_cfg.reconnect_at)
+            return;
+
+        if (capture_eep_connect() != 0) {
+            // Try again later, waiting more after each failure
+            eep_cfg.reconnect_at = now.tv_sec + eep_cfg.reconnect_delay;
+            eep_cfg.reconnect_delay *= 2;
+            if (eep_cfg.reconnect_delay > CAPTURE_EEP_RECONNECT_MAX)
+                eep_cfg.reconnect_delay = CAPTURE_EEP_RECONNECT_MAX;
+            return;
+        }
+        eep_cfg.reconnect_delay = CAPTURE_EEP_RECONNECT_MIN;
+    }
+
+    // Write as many HEP packets as possible in a single call
+    while (eep_cfg.spool_len > 0) {
+        len = (eep_cfg.spool_retry) ? eep_cfg.spool_retry : eep_cfg.spool_len;
+#ifdef WITH_OPENSSL
+        if (eep_cfg.ssl) {
+            if ((written = SSL_write(eep_cfg.ssl, eep_cfg.spool + eep_cfg.spool_head, len)) <= 0) {
+                switch (SSL_get_error(eep_cfg.ssl, written)) {
+                    case SSL_ERROR_WANT_READ:
+                    case SSL_ERROR_WANT_WRITE:
+                        // TLS requires the same write to be retried
+                        eep_cfg.spool_retry = len;
+                        return;
+                    default:
+                        capture_eep_disconnect();
+                        return;
+                }
+            }
+        } else
+#endif
+        if ((written = send(eep_cfg.client_sock, eep_cfg.spool + eep_cfg.spool_head, len, MSG_NOSIGNAL)) < 0) {
+            // Collector is not reading fast enough, try again later
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return;
+            capture_eep_disconnect();
+            return;
+        }
+
+        eep_cfg.spool_retry = 0;
+        eep_cfg.spool_head += written;
+        eep_cfg.spool_len -= written;
+
+        // Keep spooling while writing
+        capture_eep_spool_msgs();
+    }
+    eep_cfg.spool_head = 0;
+}
+
+void *
+capture_eep_send_thread(void *data)
+{
+    struct timespec ts;
+
+    affinity_apply(AFFINITY_EEP);
+
+    for (;;) {
+        if (eep_cfg.capt_proto == CAPTURE_EEP_PROTO_UDP) {
+            capture_eep_send_datagrams();
+        } else {
+            capture_eep_send_stream();
+        }
+
+        if (eep_cfg.send_stopping)
+            break;
+
+        // Connected stream transports still have data to write
+        if (eep_cfg.spool_len && eep_cfg.client_sock >= 0)
+            continue;
+
+        // Wait until more messages are queued
+        pthread_mutex_lock(&eep_cfg.send_lock);
+        eep_cfg.send_waiting = true;
+        if (ring_count(eep_cfg.send_queue) == 0 && !eep_cfg.send_stopping) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += CAPTURE_RING_WAIT * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&eep_cfg.send_cond, &eep_cfg.send_lock, &ts);
+        }
+        eep_cfg.send_waiting = false;
+        pthread_mutex_unlock(&eep_cfg.send_lock);
+    }
+
+    return NULL;
+}
+
+unsigned long
+capture_eep_send_dropped()
+{
+    return atomic_load(&eep_cfg.send_dropped);
+}
+
+int
+capture_eep_receive_batch(capture_eep_listener_t *listener, u_char *buffers, uint32_t *lens)
+{
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr msgs[eep_cfg.srv_batch];
+    struct iovec iovs[eep_cfg.srv_batch];
+#ifdef SO_RXQ_OVFL
+    char control[eep_cfg.srv_batch][CMSG_SPACE(sizeof(uint32_t))];
+    struct cmsghdr *cmsg;
+    uint32_t drops;
+#endif
+    int i, received;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < eep_cfg.srv_batch; i++) {
+        iovs[i].iov_base = buffers + (size_t) i * MAX_CAPTURE_LEN;
+        iovs[i].iov_len = MAX_CAPTURE_LEN;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+#ifdef SO_RXQ_OVFL
+        msgs[i].msg_hdr.msg_control = control[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+#endif
+    }
+
+    // Wait for the first datagram, then take the already queued ones
+    if ((received = recvmmsg(listener->sock, msgs, eep_cfg.srv_batch, MSG_WAITFORONE, NULL)) <= 0)
+        return -1;
+
+    for (i = 0; i < received; i++) {
+        lens[i] = msgs[i].msg_len;
+#ifdef SO_RXQ_OVFL
+        // Kernel reports its total of dropped datagrams of this socket
+        for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+                memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+                if (drops != listener->drops) {
+                    atomic_fetch_add(&eep_cfg.srv_dropped, drops - listener->drops);
+                    listener->drops = drops;
+                }
+            }
+        }
+#endif
+    }
+    return received;
+#else
+    ssize_t len;
+    int received = 0;
+
+    // Wait for the first datagram, then take the already queued ones
+    while (received < eep_cfg.srv_batch) {
+        len = recv(listener->sock, buffers + (size_t) received * MAX_CAPTURE_LEN,
+                   MAX_CAPTURE_LEN, received ? MSG_DONTWAIT : 0);
+        if (len < 0)
+            break;
+        lens[received++] = len;
+    }
+    return received ? received : -1;
+#endif
+}
+
 packet_t *
-capture_eep_receive()
+capture_eep_receive(const u_char *data, uint32_t len)
 {
     switch (eep_cfg.capt_srv_version) {
         case 2:
-            return capture_eep_receive_v2();
+            return capture_eep_receive_v2(data, len);
         case 3:
-            return capture_eep_receive_v3();
+            return capture_eep_receive_v3(data, len);
     }
     return NULL;
 }
 
 packet_t *
-capture_eep_receive_v2()
+capture_eep_receive_v2(const u_char *buffer, uint32_t len)
 {
     uint8_t family, proto;
-    unsigned char *payload = 0;
     uint32_t pos;
-    char buffer[MAX_CAPTURE_LEN] ;
     //! Source Address
     address_t src;
     //! Destination address
@@ -508,9 +1036,8 @@ capture_eep_receive_v2()
     struct pcap_pkthdr header;
     //! New created packet pointer
     packet_t *pkt;
-    //! EEP client data
-    struct sockaddr eep_client;
-    socklen_t eep_client_len;
+    //! Frame holding received payload
+    frame_buffer_t *frame;
     struct hep_hdr hdr;
     struct hep_timehdr hep_time;
     struct hep_iphdr hep_ipheader;
@@ -518,11 +1045,8 @@ capture_eep_receive_v2()
     struct hep_ip6hdr hep_ip6header;
 #endif
 
-    // Initialize buffer
-    memset(buffer, 0, MAX_CAPTURE_LEN);
-
-    /* Receive EEP generic header */
-    if (recvfrom(eep_cfg.server_sock, buffer, MAX_CAPTURE_LEN, 0, &eep_client, &eep_client_len) == -1)
+    // Check all headers fit in received data
+    if (len < sizeof(struct hep_hdr) + sizeof(struct hep_timehdr) + sizeof(struct hep_iphdr))
         return NULL;
 
     /* Copy initial bytes to HEPv2 header */
@@ -539,19 +1063,24 @@ capture_eep_receive_v2()
 
     pos = sizeof(struct hep_hdr);
 
+    memset(&src, 0, sizeof(address_t));
+    memset(&dst, 0, sizeof(address_t));
+
     /* IPv4 */
     if (family == AF_INET) {
         memcpy(&hep_ipheader, (void*) buffer + pos, sizeof(struct hep_iphdr));
-        inet_ntop(AF_INET, &hep_ipheader.hp_src, src.ip, sizeof(src.ip));
-        inet_ntop(AF_INET, &hep_ipheader.hp_dst, dst.ip, sizeof(dst.ip));
+        address_set_ip4(&src, &hep_ipheader.hp_src);
+        address_set_ip4(&dst, &hep_ipheader.hp_dst);
         pos += sizeof(struct hep_iphdr);
     }
 #ifdef USE_IPV6
     /* IPv6 */
     else if(family == AF_INET6) {
+        if (len < pos + sizeof(struct hep_ip6hdr) + sizeof(struct hep_timehdr))
+            return NULL;
         memcpy(&hep_ip6header, (void*) buffer + pos, sizeof(struct hep_ip6hdr));
-        inet_ntop(AF_INET6, &hep_ip6header.hp6_src, src.ip, sizeof(src.ip));
-        inet_ntop(AF_INET6, &hep_ip6header.hp6_dst, dst.ip, sizeof(dst.ip));
+        address_set_ip6(&src, &hep_ip6header.hp6_src);
+        address_set_ip6(&dst, &hep_ip6header.hp6_dst);
         pos += sizeof(struct hep_ip6hdr);
     }
 #endif
@@ -570,26 +1099,41 @@ capture_eep_receive_v2()
     /* Capture ID */
 
     // Calculate payload size (Total size - headers size)
+    if (ntohs(hdr.hp_l) < pos || ntohs(hdr.hp_l) > len)
+        return NULL;
     header.caplen = header.len = ntohs(hdr.hp_l) - pos;
 
-    // Copy packet payload
-    payload = sng_malloc(header.caplen + 1);
-    memcpy(payload, (void*) buffer + pos, header.caplen);
+    // Copy payload once into the frame owned by the new packet
+    if (!(frame = frame_buffer_create(&header, buffer + pos)))
+        return NULL;
 
     // Create a new packet
-    pkt = packet_create((family == AF_INET) ? 4 : 6, proto, src, dst, 0);
-    packet_add_frame(pkt, &header, payload);
+    if (!(pkt = packet_create((family == AF_INET) ? 4 : 6, proto, src, dst, 0))) {
+        frame_buffer_destroy(frame);
+        return NULL;
+    }
+    packet_add_frame_buffer(pkt, frame);
     packet_set_transport_data(pkt, src.port, dst.port);
     packet_set_type(pkt, PACKET_SIP_UDP);
-    packet_set_payload(pkt, payload, header.caplen);
-
-    /* FREE */
-    sng_free(payload);
+    packet_set_payload_ref(pkt, frame->data, header.caplen);
     return pkt;
 
 }
 
 
+/**
+ * @brief Check a HEPv3 chunk is large enough for its expected data
+ *
+ * @param chunk_len Chunk length including its header
+ * @param size Expected size of chunk data
+ * @return true if chunk data has the expected size
+ */
+static inline bool
+capture_eep_chunk_fits(uint16_t chunk_len, size_t size)
+{
+    return chunk_len >= sizeof(hep_chunk_t) + size;
+}
+
 /**
  * @brief Received a HEP3 packet
  *
@@ -600,62 +1144,59 @@ capture_eep_receive_v2()
  * @return packet pointer
  */
 packet_t *
-capture_eep_receive_v3()
+capture_eep_receive_v3(const u_char *buffer, uint32_t len)
 {
-
-    struct hep_generic hg;
-    hep_chunk_ip4_t src_ip4, dst_ip4;
-#ifdef USE_IPV6
-    hep_chunk_ip6_t src_ip6, dst_ip6;
-#endif
-    hep_chunk_t payload_chunk;
-    hep_chunk_t authkey_chunk;
-    hep_chunk_t uuid_chunk;
-    char password[100];
-    int password_len;
-    unsigned char *payload = 0;
+    const hep_ctrl_t *ctrl;
+    const hep_chunk_t *chunk;
+    const u_char *data;
+    uint16_t chunk_vendor, chunk_type, chunk_len;
+    uint8_t ip_family = 0, ip_proto = 0;
+    uint16_t port;
+    uint32_t value;
+    const char *password = NULL, *correlation = NULL;
+    uint32_t password_len = 0, correlation_len = 0, node = 0;
+    const u_char *payload = NULL;
     uint32_t total_len, pos;
-    char buffer[MAX_CAPTURE_LEN] ;
     //! Source and Destination Address
     address_t src, dst;
-    //! EEP client data
-    struct sockaddr eep_client;
-    socklen_t eep_client_len;
     //! Packet header
     struct pcap_pkthdr header;
     //! New created packet pointer
     packet_t *pkt;
+    //! Frame holding received payload
+    frame_buffer_t *frame;
 
-    /* Receive EEP generic header */
-    if (recvfrom(eep_cfg.server_sock, buffer, MAX_CAPTURE_LEN, 0, &eep_client, &eep_client_len) == -1)
+    // Check control header fits in received data
+    if (len < sizeof(hep_ctrl_t))
         return NULL;
 
     // Initialize structs
-    memset(&hg, 0, sizeof(hep_generic_t));
-    memset(&password, 0, sizeof(password));
     memset(&src, 0, sizeof(address_t));
     memset(&dst, 0, sizeof(address_t));
     memset(&header, 0, sizeof(struct pcap_pkthdr));
 
-    /* Copy initial bytes to EEP Generic header */
-    memcpy(&hg.header, buffer, sizeof(struct hep_generic));
-
     /* header check */
-    if (memcmp(hg.header.id, "\x48\x45\x50\x33", 4) != 0)
+    ctrl = (const hep_ctrl_t *) buffer;
+    if (memcmp(ctrl->id, "\x48\x45\x50\x33", 4) != 0)
         return NULL;
 
-    total_len = ntohs(hg.header.length);
+    total_len = ntohs(ctrl->length);
     pos = sizeof(hep_ctrl_t);
 
-    while (pos < total_len) {
+    // Packet can not be larger than received data
+    if (total_len > len)
+        return NULL;
+
+    // Chunks are parsed in place, only the payload is copied
+    while (pos + sizeof(hep_chunk_t) <= total_len) {
 
-        hep_chunk_t *chunk = (struct hep_chunk*) (buffer + pos);
-        int chunk_vendor = ntohs(chunk->vendor_id);
-        int chunk_type = ntohs(chunk->type_id);
-        int chunk_len = ntohs(chunk->length);
+        chunk = (const hep_chunk_t *) (buffer + pos);
+        chunk_vendor = ntohs(chunk->vendor_id);
+        chunk_type = ntohs(chunk->type_id);
+        chunk_len = ntohs(chunk->length);
 
         /* Bad length, drop packet */
-        if (chunk_len == 0) {
+        if (chunk_len < sizeof(hep_chunk_t) || pos + chunk_len > total_len) {
             return NULL;
         }
 
@@ -665,69 +1206,81 @@ capture_eep_receive_v3()
             continue;
         }
 
+        data = buffer + pos + sizeof(hep_chunk_t);
+
         switch (chunk_type) {
             case CAPTURE_EEP_CHUNK_INVALID:
                 return NULL;
             case CAPTURE_EEP_CHUNK_FAMILY:
-                memcpy(&hg.ip_family, (void*) buffer + pos, sizeof(hep_chunk_uint8_t));
+                if (!capture_eep_chunk_fits(chunk_len, sizeof(uint8_t)))
+                    return NULL;
+                ip_family = *data;
                 break;
             case CAPTURE_EEP_CHUNK_PROTO:
-                memcpy(&hg.ip_proto, (void*) buffer + pos, sizeof(hep_chunk_uint8_t));
+                if (!capture_eep_chunk_fits(chunk_len, sizeof(uint8_t)))
+                    return NULL;
+                ip_proto = *data;
                 break;
             case CAPTURE_EEP_CHUNK_SRC_IP4:
-                memcpy(&src_ip4, (void*) buffer + pos, sizeof(struct hep_chunk_ip4));
-                inet_ntop(AF_INET, &src_ip4.data, src.ip, sizeof(src.ip));
-                break;
             case CAPTURE_EEP_CHUNK_DST_IP4:
-                memcpy(&dst_ip4, (void*) buffer + pos, sizeof(struct hep_chunk_ip4));
-                inet_ntop(AF_INET, &dst_ip4.data, dst.ip, sizeof(src.ip));
+                if (!capture_eep_chunk_fits(chunk_len, sizeof(struct in_addr)))
+                    return NULL;
+                address_set_ip4((chunk_type == CAPTURE_EEP_CHUNK_SRC_IP4) ? &src : &dst,
+                                (const struct in_addr *) data);
                 break;
 #ifdef USE_IPV6
             case CAPTURE_EEP_CHUNK_SRC_IP6:
-                memcpy(&src_ip6, (void*) buffer + pos, sizeof(struct hep_chunk_ip6));
-                inet_ntop(AF_INET6, &src_ip6.data, src.ip, sizeof(src.ip));
-                break;
             case CAPTURE_EEP_CHUNK_DST_IP6:
-                memcpy(&dst_ip6, (void*) buffer + pos, sizeof(struct hep_chunk_ip6));
-                inet_ntop(AF_INET6, &dst_ip6.data, dst.ip, sizeof(dst.ip));
+                if (!capture_eep_chunk_fits(chunk_len, sizeof(struct in6_addr)))
+                    return NULL;
+                address_set_ip6((chunk_type == CAPTURE_EEP_CHUNK_SRC_IP6) ? &src : &dst,
+                                (const struct in6_addr *) data);
                 break;
 #endif
             case CAPTURE_EEP_CHUNK_SRC_PORT:
-                memcpy(&hg.src_port, (void*) buffer + pos, sizeof(hep_chunk_uint16_t));
-                src.port = ntohs(hg.src_port.data);
-                break;
             case CAPTURE_EEP_CHUNK_DST_PORT:
-                memcpy(&hg.dst_port, (void*) buffer + pos, sizeof(hep_chunk_uint16_t));
-                dst.port = ntohs(hg.dst_port.data);
+                if (!capture_eep_chunk_fits(chunk_len, sizeof(uint16_t)))
+                    return NULL;
+                memcpy(&port, data, sizeof(uint16_t));
+                if (chunk_type == CAPTURE_EEP_CHUNK_SRC_PORT) {
+                    src.port = ntohs(port);
+                } else {
+                    dst.port = ntohs(port);
+                }
                 break;
             case CAPTURE_EEP_CHUNK_TS_SEC:
-                memcpy(&hg.time_sec, (void*) buffer + pos, sizeof(hep_chunk_uint32_t));
-                header.ts.tv_sec = ntohl(hg.time_sec.data);
+                if (!capture_eep_chunk_fits(chunk_len, sizeof(uint32_t)))
+                    return NULL;
+                memcpy(&value, data, sizeof(uint32_t));
+                header.ts.tv_sec = ntohl(value);
                 break;
             case CAPTURE_EEP_CHUNK_TS_USEC:
-                memcpy(&hg.time_usec, (void*) buffer + pos, sizeof(hep_chunk_uint32_t));
-                header.ts.tv_usec = ntohl(hg.time_usec.data);
+                if (!capture_eep_chunk_fits(chunk_len, sizeof(uint32_t)))
+                    return NULL;
+                memcpy(&value, data, sizeof(uint32_t));
+                header.ts.tv_usec = ntohl(value);
                 break;
             case CAPTURE_EEP_CHUNK_PROTO_TYPE:
-                memcpy(&hg.proto_t, (void*) buffer + pos, sizeof(hep_chunk_uint8_t));
                 break;
             case CAPTURE_EEP_CHUNK_CAPT_ID:
-                memcpy(&hg.capt_id, (void*) buffer + pos, sizeof(hep_chunk_uint32_t));
+                if (!capture_eep_chunk_fits(chunk_len, sizeof(uint32_t)))
+                    return NULL;
+                memcpy(&value, data, sizeof(uint32_t));
+                node = ntohl(value);
                 break;
             case CAPTURE_EEP_CHUNK_KEEP_TM:
                 break;
             case CAPTURE_EEP_CHUNK_AUTH_KEY:
-                memcpy(&authkey_chunk, (void*) buffer + pos, sizeof(authkey_chunk));
-                password_len = ntohs(authkey_chunk.length) - sizeof(authkey_chunk);
-                memcpy(password, (void*) buffer + pos + sizeof(hep_chunk_t), password_len);
+                password = (const char *) data;
+                password_len = chunk_len - sizeof(hep_chunk_t);
                 break;
             case CAPTURE_EEP_CHUNK_PAYLOAD:
-                memcpy(&payload_chunk, (void*) buffer + pos, sizeof(payload_chunk));
+                payload = data;
                 header.caplen = header.len = chunk_len - sizeof(hep_chunk_t);
-                payload = sng_malloc(header.caplen);
-                memcpy(payload, (void*) buffer + pos + sizeof(hep_chunk_t), header.caplen);
                 break;
             case CAPTURE_EEP_CHUNK_CORRELATION_ID:
+                correlation = (const char *) data;
+                correlation_len = chunk_len - sizeof(hep_chunk_t);
                 break;
             default:
                 break;
@@ -739,25 +1292,41 @@ capture_eep_receive_v3()
 
     // Validate password
     if (eep_cfg.capt_srv_password != NULL) {
-        // No password in packet
-        if (strlen(password) == 0)
-            return NULL;
-        // Check password matches configured
-        if (strncmp(password, eep_cfg.capt_srv_password, strlen(eep_cfg.capt_srv_password)) != 0)
+        // No password in packet or password doesn't match configured
+        if (password_len == 0 || password_len < strlen(eep_cfg.capt_srv_password)
+            || strncmp(password, eep_cfg.capt_srv_password, strlen(eep_cfg.capt_srv_password)) != 0) {
             return NULL;
+        }
     }
 
+    // Packet without payload
+    if (!payload)
+        return NULL;
+
+    // Copy payload once into the frame owned by the new packet
+    if (!(frame = frame_buffer_create(&header, payload)))
+        return NULL;
+
     // Create a new packet
-    pkt = packet_create((hg.ip_family.data == AF_INET)?4:6, hg.ip_proto.data, src, dst, 0);
-    packet_add_frame(pkt, &header, payload);
+    if (!(pkt = packet_create((ip_family == AF_INET)?4:6, ip_proto, src, dst, 0))) {
+        frame_buffer_destroy(frame);
+        return NULL;
+    }
+    packet_add_frame_buffer(pkt, frame);
     packet_set_type(pkt, PACKET_SIP_UDP);
-    packet_set_payload(pkt, payload, header.caplen);
+    packet_set_payload_ref(pkt, frame->data, header.caplen);
+    packet_set_hep_info(pkt, node, correlation, correlation_len);
 
-    /* FREE */
-    sng_free(payload);
     return pkt;
 }
 
+void
+capture_eep_listen_stats(unsigned long *dropped, unsigned long *errors)
+{
+    *dropped = atomic_load(&eep_cfg.srv_dropped);
+    *errors = atomic_load(&eep_cfg.srv_errors);
+}
+
 int
 capture_eep_set_server_url(const char *url)
 {
@@ -781,13 +1350,18 @@ int
 capture_eep_set_client_url(const char *url)
 {
     char urlstr[256];
-    char address[256], port[256];
+    char proto[16], address[256], port[256];
 
     memset(address, 0, sizeof(address));
     memset(port, 0, sizeof(port));
 
+    memset(proto, 0, sizeof(proto));
     strncpy(urlstr, url, sizeof(urlstr));
-    if (sscanf(urlstr, "%*[^:]:%[^:]:%s", address, port) == 2) {
+    if (sscanf(urlstr, "%15[^:]:%[^:]:%s", proto, address, port) == 3) {
+        // Transport must be one of the supported ones
+        if (strcmp(proto, "udp") && strcmp(proto, "tcp") && strcmp(proto, "tls"))
+            return 1;
+        setting_set_value(SETTING_EEP_SEND_PROTO, proto);
         setting_set_value(SETTING_EEP_SEND, SETTING_ON);
         setting_set_value(SETTING_EEP_SEND_ADDR, address);
         setting_set_value(SETTING_EEP_SEND_PORT, port);
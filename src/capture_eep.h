@@ -42,7 +42,34 @@
 #ifndef __SNGREP_CAPTURE_EEP_H
 #define __SNGREP_CAPTURE_EEP_H
 #include <pthread.h>
+#include <stdatomic.h>
 #include "capture.h"
+#include "sip.h"
+#ifdef WITH_OPENSSL
+#include <openssl/ssl.h>
+#endif
+
+//! Default number of HEP packets received and parsed together
+#define CAPTURE_EEP_BATCH 64
+//! Default number of HEP packets pending to be sent
+#define CAPTURE_EEP_SEND_QUEUE 1024
+//! Max length of an encoded HEP packet pending to be sent
+#define CAPTURE_EEP_SEND_LEN (MAX_SIP_PAYLOAD + 512)
+//! Max milliseconds sender thread waits for a busy collector connection
+#define CAPTURE_EEP_SEND_TIMEOUT 100
+//! Max seconds to wait for a collector connection to be established
+#define CAPTURE_EEP_CONNECT_TIMEOUT 5
+//! First and max seconds between collector reconnection attempts
+#define CAPTURE_EEP_RECONNECT_MIN 1
+#define CAPTURE_EEP_RECONNECT_MAX 30
+
+//! Transports to send EEP data
+enum capture_eep_proto
+{
+    CAPTURE_EEP_PROTO_UDP = 0,
+    CAPTURE_EEP_PROTO_TCP,
+    CAPTURE_EEP_PROTO_TLS
+};
 
 //! HEP chunk types
 enum
@@ -69,16 +96,66 @@ enum
 
 //! Shorter declaration of capture_eep_config structure
 typedef struct capture_eep_config  capture_eep_config_t;
+//! Shorter declaration of capture_eep_listener structure
+typedef struct capture_eep_listener capture_eep_listener_t;
+//! Shorter declaration of capture_eep_msg structure
+typedef struct capture_eep_msg capture_eep_msg_t;
+
+/**
+ * @brief Encoded HEP packet pending to be sent
+ *
+ * All messages are allocated when sender starts and move between the
+ * free list and the send queue, so sending never allocates memory.
+ */
+struct capture_eep_msg
+{
+    //! Encoded packet length
+    uint32_t len;
+    //! Encoded packet data
+    u_char data[CAPTURE_EEP_SEND_LEN];
+};
+
+/**
+ * @brief EEP Server receiving thread
+ *
+ * All listeners share the same local port (SO_REUSEPORT) so the kernel
+ * spreads HEP senders between them.
+ */
+struct capture_eep_listener
+{
+    //! Server socket for receiving EEP data
+    int sock;
+    //! Server thread to parse incoming data
+    pthread_t thread;
+    //! Last total of datagrams dropped by the kernel in this socket
+    uint32_t drops;
+};
 
 /**
  * @brief EEP  Client/Server configuration
  */
 struct capture_eep_config
 {
-    //! Client socket for sending EEP data
+    //! Client socket for sending EEP data (-1 if stream is not connected)
     int client_sock;
-    //! Server socket for receiving EEP data
-    int server_sock;
+    //! Transport to send EEP data
+    enum capture_eep_proto capt_proto;
+    //! Collector address for stream transports (used to reconnect)
+    struct addrinfo *capt_addr;
+    //! Encoded data pending to be written in stream transports
+    u_char *spool;
+    //! Spool size, offset of first pending byte and pending bytes
+    uint32_t spool_size, spool_head, spool_len;
+    //! Length of last incomplete TLS write, that must be retried as is
+    uint32_t spool_retry;
+    //! Next connection attempt (monotonic seconds) and delay after a failure
+    time_t reconnect_at;
+    uint32_t reconnect_delay;
+#ifdef WITH_OPENSSL
+    //! TLS context and connection to collector
+    SSL_CTX *ssl_ctx;
+    SSL *ssl;
+#endif
     //! Capture agent id
     int capt_id;
     //! Hep Version for sending data (2 or 3)
@@ -89,6 +166,23 @@ struct capture_eep_config
     const char *capt_port;
     //! Password for authenticate as client
     const char *capt_password;
+    //! Preallocated messages to be encoded and sent
+    capture_eep_msg_t *send_msgs;
+    //! Encoded messages pending to be sent (capture_eep_msg_t)
+    ring_t *send_queue;
+    //! Messages already sent that can be reused (capture_eep_msg_t)
+    ring_t *send_free;
+    //! HEP packets discarded because queue was full or send failed
+    atomic_ulong send_dropped;
+    //! Sender thread
+    pthread_t send_thread;
+    //! Sender thread has been requested to stop
+    atomic_bool send_stopping;
+    //! Sender thread is sleeping waiting for messages
+    atomic_bool send_waiting;
+    //! Lock and condition to wake up sender thread
+    pthread_mutex_t send_lock;
+    pthread_cond_t send_cond;
     // HEp version for receiving data (2 or 3)
     int capt_srv_version;
     //! IP address to received EEP data
@@ -97,8 +191,18 @@ struct capture_eep_config
     const char *capt_srv_port;
     //! Server password to authenticate incoming connections
     const char *capt_srv_password;
-    //! Server thread to parse incoming data
-    pthread_t server_thread;
+    //! Server sockets and threads to parse incoming data
+    capture_eep_listener_t *listeners;
+    //! Number of server listeners
+    int srv_threads;
+    //! Number of HEP packets received and parsed together
+    int srv_batch;
+    //! Size of server socket receive buffer (bytes, 0 for system default)
+    int srv_rcvbuf;
+    //! HEP packets dropped by the kernel because receive buffer was full
+    atomic_ulong srv_dropped;
+    //! Received HEP packets that could not be decoded
+    atomic_ulong srv_errors;
 };
 
 /* HEPv3 types */
@@ -268,6 +372,10 @@ capture_eep_listen_port();
 /**
  * @brief Wrapper for sending packet in configured EEP version
  *
+ * Packet is encoded into a preallocated message and queued to be sent
+ * by the sender thread. If the queue is full, packet is discarded
+ * instead of waiting for the collector.
+ *
  * @param pkt Packet Structure data
  * @return 1 on any error occurs, 0 otherwise
  */
@@ -275,63 +383,148 @@ int
 capture_eep_send(packet_t *pkt);
 
 /**
- * @brief Send a captured packet (EEP version 2)
+ * @brief Encode a captured packet (EEP version 2)
  *
- * Send a packet encapsulated into EEP through the client socket.
+ * Encode a packet into EEP to be sent through the client socket.
  * This function will only handle SIP packets if EEP client mode
  * has been enabled.
  *
  * @param pkt Packet Structure data
+ * @param msg Message to store encoded data
  * @return 1 on any error occurs, 0 otherwise
  */
 int
-capture_eep_send_v2(packet_t *pkt);
+capture_eep_send_v2(packet_t *pkt, capture_eep_msg_t *msg);
 
 /**
- * @brief Send a captured packet (EEP version 3)
+ * @brief Encode a captured packet (EEP version 3)
  *
- * Send a packet encapsulated into EEP through the client socket.
+ * Encode a packet into EEP to be sent through the client socket.
  * This function will only handle SIP packets if EEP client mode
  * has been enabled.
  *
  * @param pkt Packet Structure data
+ * @param msg Message to store encoded data
  * @return 1 on any error occurs, 0 otherwise
  */
 int
-capture_eep_send_v3(packet_t *pkt);
+capture_eep_send_v3(packet_t *pkt, capture_eep_msg_t *msg);
+
+/**
+ * @brief Send all queued messages through datagram client socket
+ */
+void
+capture_eep_send_datagrams();
+
+/**
+ * @brief Move all queued messages to the stream transport spool
+ *
+ * Messages that don't fit in the spool are discarded.
+ */
+void
+capture_eep_spool_msgs();
+
+/**
+ * @brief Open a stream connection to the collector
+ *
+ * @return 0 if connection has been established, 1 otherwise
+ */
+int
+capture_eep_connect();
+
+/**
+ * @brief Close current stream connection to the collector
+ */
+void
+capture_eep_disconnect();
+
+/**
+ * @brief Write spooled data through the stream connection
+ *
+ * Connection is reopened when needed, waiting more between each failed
+ * attempt. Spooled data is kept until it can be written.
+ */
+void
+capture_eep_send_stream();
+
+/**
+ * @brief Wake up sender thread if it is waiting for messages
+ */
+void
+capture_eep_send_wakeup();
+
+/**
+ * @brief Sender thread main function
+ *
+ * Send queued messages in batches until EEP is deinitialized.
+ */
+void *
+capture_eep_send_thread(void *data);
+
+/**
+ * @brief Get number of HEP packets that could not be sent
+ */
+unsigned long
+capture_eep_send_dropped();
+
+/**
+ * @brief Receive a batch of datagrams from the EEP server socket
+ *
+ * Wait until at least one datagram is received, then take the ones
+ * already queued without waiting (up to batch size).
+ *
+ * @param listener Server listener to receive from
+ * @param buffers Batch size consecutive buffers of MAX_CAPTURE_LEN bytes
+ * @param lens Length of each received datagram
+ * @return number of received datagrams, -1 on error
+ */
+int
+capture_eep_receive_batch(capture_eep_listener_t *listener, u_char *buffers, uint32_t *lens);
 
 /**
- * @brief Wrapper for receiving packet in configured EEP version
+ * @brief Wrapper for decoding a packet in configured EEP version
  *
+ * @param data Received datagram
+ * @param len Received datagram length
  * @return NULL on any error, packet structure otherwise
  */
 packet_t *
-capture_eep_receive();
-
+capture_eep_receive(const u_char *data, uint32_t len);
 
 /**
- * @brief Received a captured packet (EEP version 2)
+ * @brief Decode a received captured packet (EEP version 2)
  *
- * Wait for a packet to be received through the EEP server. This
- * function will parse received EEP data and create a new packet
+ * This function will parse received EEP data and create a new packet
  * structure.
  *
+ * @param data Received datagram
+ * @param len Received datagram length
  * @return NULL on any error, packet structure otherwise
  */
 packet_t *
-capture_eep_receive_v2();
+capture_eep_receive_v2(const u_char *data, uint32_t len);
 
 /**
- * @brief Received a captured packet (EEP version 3)
+ * @brief Decode a received captured packet (EEP version 3)
  *
- * Wait for a packet to be received through the EEP server. This
- * function will parse received EEP data and create a new packet
+ * This function will parse received EEP data and create a new packet
  * structure.
  *
+ * @param data Received datagram
+ * @param len Received datagram length
  * @return NULL on any error, packet structure otherwise
  */
 packet_t *
-capture_eep_receive_v3();
+capture_eep_receive_v3(const u_char *data, uint32_t len);
+
+/**
+ * @brief Get counters of HEP packets not parsed by the EEP server
+ *
+ * @param dropped Packets dropped because receive buffer was full
+ * @param errors Packets that could not be decoded
+ */
+void
+capture_eep_listen_stats(unsigned long *dropped, unsigned long *errors);
 
 /**
  * @brief Set EEP server url
@@ -31,19 +31,42 @@
  */
 
 #include <unistd.h>
+#include <pthread.h>
 #include "capture.h"
 #include "capture_gnutls.h"
+#include "capture_keylog.h"
 #include "option.h"
 #include "util.h"
 #include "sip.h"
-
-struct SSLConnection *connections;
+#include "setting.h"
+
+//! Detected connections (struct SSLConnection)
+static vector_t *connections;
+//! Detected connections indexed by their addresses
+static htable_t *connections_index;
+//! Seconds a connection is kept without receiving any segment
+static time_t connections_timeout;
+//! Capture time of next search for idle connections
+static time_t connections_sweep;
+//! Protects connections storage from concurrent decrypting threads
+static pthread_mutex_t connections_lock = PTHREAD_MUTEX_INITIALIZER;
 
 struct CipherData ciphers[] = {
 /*  { number, encoder,    ivlen, bits, digest, diglen, mode }, */
     { 0x002F, ENC_AES,    16, 128, DIG_SHA1,   20, MODE_CBC },   /* TLS_RSA_WITH_AES_128_CBC_SHA     */
     { 0x0035, ENC_AES256, 16, 256, DIG_SHA1,   20, MODE_CBC },   /* TLS_RSA_WITH_AES_256_CBC_SHA     */
+    { 0x009c, ENC_AES,    4,  128, DIG_SHA256, 32, MODE_GCM },   /* TLS_RSA_WITH_AES_128_GCM_SHA256  */
     { 0x009d, ENC_AES256, 4,  256, DIG_SHA384, 48, MODE_GCM },   /* TLS_RSA_WITH_AES_256_GCM_SHA384  */
+    { 0x0033, ENC_AES,    16, 128, DIG_SHA1,   20, MODE_CBC },   /* TLS_DHE_RSA_WITH_AES_128_CBC_SHA */
+    { 0x0039, ENC_AES256, 16, 256, DIG_SHA1,   20, MODE_CBC },   /* TLS_DHE_RSA_WITH_AES_256_CBC_SHA */
+    { 0xC009, ENC_AES,    16, 128, DIG_SHA1,   20, MODE_CBC },   /* TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA */
+    { 0xC00A, ENC_AES256, 16, 256, DIG_SHA1,   20, MODE_CBC },   /* TLS_ECDHE_ECDSA_WITH_AES_256_CBC_SHA */
+    { 0xC013, ENC_AES,    16, 128, DIG_SHA1,   20, MODE_CBC },   /* TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA */
+    { 0xC014, ENC_AES256, 16, 256, DIG_SHA1,   20, MODE_CBC },   /* TLS_ECDHE_RSA_WITH_AES_256_CBC_SHA */
+    { 0xC02B, ENC_AES,    4,  128, DIG_SHA256, 32, MODE_GCM },   /* TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256 */
+    { 0xC02C, ENC_AES256, 4,  256, DIG_SHA384, 48, MODE_GCM },   /* TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384 */
+    { 0xC02F, ENC_AES,    4,  128, DIG_SHA256, 32, MODE_GCM },   /* TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256 */
+    { 0xC030, ENC_AES256, 4,  256, DIG_SHA384, 48, MODE_GCM },   /* TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384 */
     { 0,      0,          0,  0,   0,          0,  0        }
 };
 
@@ -184,29 +207,21 @@ PRF(struct SSLConnection *conn,
     return dlen;
 }
 
-struct SSLConnection *
-tls_connection_create(struct in_addr caddr, uint16_t cport, struct in_addr saddr, uint16_t sport)
+gnutls_x509_privkey_t
+tls_load_key()
 {
-    struct SSLConnection *conn = NULL;
+    static gnutls_x509_privkey_t spkey = NULL;
     gnutls_datum_t keycontent = { NULL, 0 };
     FILE *keyfp;
-    gnutls_x509_privkey_t spkey;
     size_t br;
     int ret;
 
-    // Allocate memory for this connection
-    conn = sng_malloc(sizeof(struct SSLConnection));
-
-    memcpy(&conn->client_addr, &caddr, sizeof(struct in_addr));
-    memcpy(&conn->server_addr, &saddr, sizeof(struct in_addr));
-    memcpy(&conn->client_port, &cport, sizeof(uint16_t));
-    memcpy(&conn->server_port, &sport, sizeof(uint16_t));
+    // Key is loaded once and shared by all connections
+    if (spkey)
+        return spkey;
 
     gnutls_global_init();
 
-    if (gnutls_init(&conn->ssl, GNUTLS_SERVER) < GNUTLS_E_SUCCESS)
-        return NULL;
-
     if (!(keyfp = fopen(capture_keyfile(), "rb")))
         return NULL;
 
@@ -221,21 +236,50 @@ tls_connection_create(struct in_addr caddr, uint16_t cport, struct in_addr saddr
 
     // Import PEM key data
     ret = gnutls_x509_privkey_import(spkey, &keycontent, GNUTLS_X509_FMT_PEM);
-    if (ret != GNUTLS_E_SUCCESS)
-        return NULL;
-
     sng_free(keycontent.data);
 
     // Check this is a valid RSA key
-    if (gnutls_x509_privkey_get_pk_algorithm(spkey) != GNUTLS_PK_RSA)
+    if (ret != GNUTLS_E_SUCCESS || gnutls_x509_privkey_get_pk_algorithm(spkey) != GNUTLS_PK_RSA) {
+        gnutls_x509_privkey_deinit(spkey);
+        spkey = NULL;
+    }
+
+    return spkey;
+}
+
+struct SSLConnection *
+tls_connection_create(struct in_addr caddr, uint16_t cport, struct in_addr saddr, uint16_t sport)
+{
+    struct SSLConnection *conn = NULL;
+    gnutls_x509_privkey_t spkey;
+
+    // Without a private key, master secrets can only be read from key log file
+    spkey = (capture_keyfile()) ? tls_load_key() : NULL;
+    if (!spkey && !capture_keylogfile())
         return NULL;
 
+    // Create connections storage on first connection
+    if (!connections) {
+        connections = vector_create(64, 64);
+        connections_index = htable_create(TLS_CONNECTION_HASH);
+        connections_timeout = setting_get_intvalue(SETTING_CAPTURE_TLS_TIMEOUT);
+    }
+
+    // Allocate memory for this connection
+    conn = sng_malloc(sizeof(struct SSLConnection));
+
+    memcpy(&conn->client_addr, &caddr, sizeof(struct in_addr));
+    memcpy(&conn->server_addr, &saddr, sizeof(struct in_addr));
+    memcpy(&conn->client_port, &cport, sizeof(uint16_t));
+    memcpy(&conn->server_port, &sport, sizeof(uint16_t));
+
     // Store this key into the connection
     conn->server_private_key = spkey;
 
     // Add this connection to the list
-    conn->next = connections;
-    connections = conn;
+    tls_connection_key(conn->key, caddr, cport, saddr, sport);
+    vector_append(connections, conn);
+    htable_insert(connections_index, conn->key, conn);
 
     return conn;
 }
@@ -243,22 +287,15 @@ tls_connection_create(struct in_addr caddr, uint16_t cport, struct in_addr saddr
 void
 tls_connection_destroy(struct SSLConnection *conn)
 {
-    struct SSLConnection *c;
-
     // Remove connection from connections list
-    if (conn == connections) {
-        connections = conn->next;
-    } else {
-        for (c = connections; c; c = c->next) {
-            if (c->next == conn) {
-                c->next = conn->next;
-                break;
-            }
-        }
-    }
+    htable_remove(connections_index, conn->key);
+    vector_remove(connections, conn);
 
     // Deallocate connection memory
-    gnutls_deinit(conn->ssl);
+    if (conn->client_cipher_ctx)
+        gcry_cipher_close(conn->client_cipher_ctx);
+    if (conn->server_cipher_ctx)
+        gcry_cipher_close(conn->server_cipher_ctx);
     sng_free(conn->key_material.client_write_MAC_key);
     sng_free(conn->key_material.server_write_MAC_key);
     sng_free(conn->key_material.client_write_IV);
@@ -268,6 +305,15 @@ tls_connection_destroy(struct SSLConnection *conn)
     sng_free(conn);
 }
 
+void
+tls_connection_close(struct SSLConnection *conn)
+{
+    // Other threads could be using connections storage
+    pthread_mutex_lock(&connections_lock);
+    tls_connection_destroy(conn);
+    pthread_mutex_unlock(&connections_lock);
+}
+
 /**
  * FIXME Replace this with a tls_load_key function and use it
  * in tls_connection_create.
@@ -330,21 +376,46 @@ tls_connection_dir(struct SSLConnection *conn, struct in_addr addr, uint16_t por
     return -1;
 }
 
+void
+tls_connection_key(char *key, struct in_addr src, uint16_t sport, struct in_addr dst, uint16_t dport)
+{
+    uint32_t saddr = ntohl(src.s_addr), daddr = ntohl(dst.s_addr);
+
+    // Both directions of the connection use the same key
+    if (saddr < daddr || (saddr == daddr && sport < dport)) {
+        sprintf(key, "%08x:%04x-%08x:%04x", saddr, sport, daddr, dport);
+    } else {
+        sprintf(key, "%08x:%04x-%08x:%04x", daddr, dport, saddr, sport);
+    }
+}
+
 struct SSLConnection*
 tls_connection_find(struct in_addr src, uint16_t sport, struct in_addr dst, uint16_t dport) {
+    char key[TLS_CONNECTION_KEYLEN];
+
+    if (!connections_index)
+        return NULL;
+
+    tls_connection_key(key, src, sport, dst, dport);
+    return htable_find(connections_index, key);
+}
+
+void
+tls_connection_expire(time_t now)
+{
     struct SSLConnection *conn;
+    int i;
 
-    for (conn = connections; conn; conn = conn->next) {
-        if (tls_connection_dir(conn, src, sport) == 0 &&
-                tls_connection_dir(conn, dst, dport) == 1) {
-            return conn;
-        }
-        if (tls_connection_dir(conn, src, sport) == 1 &&
-                tls_connection_dir(conn, dst, dport) == 0) {
-            return conn;
-        }
+    // Don't check all connections for every segment
+    if (!connections || now < connections_sweep)
+        return;
+    connections_sweep = now + 1;
+
+    for (i = vector_count(connections) - 1; i >= 0; i--) {
+        conn = vector_item(connections, i);
+        if (conn->last + connections_timeout < now)
+            tls_connection_destroy(conn);
     }
-    return NULL;
 }
 
 int
@@ -362,13 +433,20 @@ tls_process_segment(packet_t *packet, struct tcphdr *tcp)
     address_t tlsserver = capture_tls_server();
 
     // Convert addresses
-    inet_pton(AF_INET, packet->src.ip, &ip_src);
-    inet_pton(AF_INET, packet->dst.ip, &ip_dst);
+    ip_src = packet->src.ip.v4;
+    ip_dst = packet->dst.ip.v4;
+
+    // Discard connections that are not receiving data anymore
+    pthread_mutex_lock(&connections_lock);
+    tls_connection_expire(packet_time(packet).tv_sec);
 
     // Try to find a session for this ip
     if ((conn = tls_connection_find(ip_src, sport, ip_dst, dport))) {
-        // Update last connection direction
+        // Update last connection direction and activity
         conn->direction = tls_connection_dir(conn, ip_src, sport);
+        conn->last = packet_time(packet).tv_sec;
+        // Connection state is only used by the thread decrypting its segments
+        pthread_mutex_unlock(&connections_lock);
 
         // Check current connection state
         switch (conn->state) {
@@ -405,7 +483,7 @@ tls_process_segment(packet_t *packet, struct tcphdr *tcp)
             case TCP_STATE_FIN:
             case TCP_STATE_CLOSED:
                 // We can delete this connection
-                tls_connection_destroy(conn);
+                tls_connection_close(conn);
                 break;
         }
     } else {
@@ -413,12 +491,15 @@ tls_process_segment(packet_t *packet, struct tcphdr *tcp)
         if (tlsserver.port) {
             if (addressport_equals(tlsserver, packet->dst)) {
                 // New connection, store it status and leave
-                tls_connection_create(ip_src, sport, ip_dst, dport);
+                if ((conn = tls_connection_create(ip_src, sport, ip_dst, dport)))
+                    conn->last = packet_time(packet).tv_sec;
             }
         } else {
             // New connection, store it status and leave
-            tls_connection_create(ip_src, sport, ip_dst, dport);
+            if ((conn = tls_connection_create(ip_src, sport, ip_dst, dport)))
+                conn->last = packet_time(packet).tv_sec;
         }
+        pthread_mutex_unlock(&connections_lock);
     }
 
     sng_free(out);
@@ -520,6 +601,14 @@ tls_process_record(struct SSLConnection *conn, const uint8_t *payload,
                     return 1;
                 break;
             case change_cipher_spec:
+                // Resumed sessions have no key exchange, use the logged master secret
+                if (!conn->client_cipher_ctx && conn->cipher_data.enc
+                        && capture_keylog_find((const uint8_t *) &conn->client_random, conn->master_secret.random) == 0
+                        && tls_connection_load_keys(conn) != 0) {
+                    tls_connection_close(conn);
+                    return 1;
+                }
+
                 // From now on, this connection will be encrypted using MasterSecret
                 if (conn->client_cipher_ctx && conn->server_cipher_ctx)
                     conn->encrypted = 1;
@@ -571,7 +660,7 @@ tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment,
 
                 // Check we have a TLS handshake
                 if (tls_valid_version(clienthello->client_version) != 0) {
-                    tls_connection_destroy(conn);
+                    tls_connection_close(conn);
                     return 1;
                 }
 
@@ -589,7 +678,7 @@ tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment,
                        sizeof(uint16_t));
                 // Check if we have a handled cipher
                 if (tls_connection_load_cipher(conn) != 0) {
-                    tls_connection_destroy(conn);
+                    tls_connection_close(conn);
                     return 1;
                 }
                 break;
@@ -599,118 +688,49 @@ tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment,
             case certificate_verify:
                 break;
             case client_key_exchange:
-                // Decrypt PreMasterKey
-                clientkeyex = (struct ClientKeyExchange *) body;
-
-                gnutls_datum_t exkeys, pms;
-                exkeys.size = UINT16_INT(clientkeyex->length);
-                exkeys.data = (unsigned char *)&clientkeyex->exchange_keys;
-                tls_debug_print_hex("exchange keys",exkeys.data, exkeys.size);
-
-                tls_privkey_decrypt_data(conn->server_private_key, 0, &exkeys, &pms);
-                if (!pms.data) break;
-
-                memcpy(&conn->pre_master_secret, pms.data, pms.size);
-                tls_debug_print_hex("pre_master_secret", pms.data, pms.size);
-                tls_debug_print_hex("client_random", &conn->client_random, sizeof(struct Random));
-                tls_debug_print_hex("server_random", &conn->server_random, sizeof(struct Random));
-
-                // Get MasterSecret
-                uint8_t *seed = sng_malloc(sizeof(struct Random) * 2);
-                memcpy(seed, &conn->client_random, sizeof(struct Random));
-                memcpy(seed + sizeof(struct Random), &conn->server_random, sizeof(struct Random));
-                PRF(conn, (unsigned char *) &conn->master_secret, sizeof(struct MasterSecret),
-                    (unsigned char *) &conn->pre_master_secret, sizeof(struct PreMasterSecret),
-                    (unsigned char *) "master secret", seed, sizeof(struct Random) * 2);
-
-                tls_debug_print_hex("master_secret", conn->master_secret.random, sizeof(struct MasterSecret));
-
-                memcpy(seed, &conn->server_random, sizeof(struct Random) * 2);
-                memcpy(seed + sizeof(struct Random), &conn->client_random, sizeof(struct Random));
-
-                int key_material_len = 0;
-                key_material_len += conn->cipher_data.diglen * 2;
-                key_material_len += conn->cipher_data.ivblock * 2;
-                key_material_len += conn->cipher_data.bits / 4;
-
-                // Generate MACs, Write Keys and IVs
-                uint8_t *key_material = sng_malloc(key_material_len);
-                PRF(conn, (unsigned char *) key_material, key_material_len,
-                    (unsigned char *) &conn->master_secret, sizeof(struct MasterSecret),
-                    (unsigned char *) "key expansion", seed, sizeof(struct Random) * 2);
-
-                // Get write mac keys
-                if (conn->cipher_data.mode == MODE_GCM) {
-                    // AEAD ciphers
-                    conn->key_material.client_write_MAC_key = 0;
-                    conn->key_material.server_write_MAC_key = 0;
-                } else {
-                    // Copy prf output to ssl connection key material
-                    int mk_len = conn->cipher_data.diglen;
-                    conn->key_material.client_write_MAC_key = sng_malloc(mk_len);
-                    memcpy(conn->key_material.client_write_MAC_key, key_material, mk_len);
-                    tls_debug_print_hex("client_write_MAC_key", key_material, mk_len);
-                    key_material += mk_len;
-                    conn->key_material.server_write_MAC_key = sng_malloc(mk_len);
-                    tls_debug_print_hex("server_write_MAC_key", key_material, mk_len);
-                    memcpy(conn->key_material.server_write_MAC_key, key_material, mk_len);
-                    key_material+=mk_len;
+                // Master secret logged by one of the endpoints
+                if (capture_keylog_find((const uint8_t *) &conn->client_random, conn->master_secret.random) != 0) {
+                    // Without a logged secret, only RSA key exchange can be decrypted
+                    if (!conn->server_private_key) {
+                        tls_connection_close(conn);
+                        return 1;
+                    }
+
+                    // Decrypt PreMasterKey
+                    clientkeyex = (struct ClientKeyExchange *) body;
+
+                    gnutls_datum_t exkeys, pms;
+                    exkeys.size = UINT16_INT(clientkeyex->length);
+                    exkeys.data = (unsigned char *)&clientkeyex->exchange_keys;
+                    tls_debug_print_hex("exchange keys",exkeys.data, exkeys.size);
+
+                    tls_privkey_decrypt_data(conn->server_private_key, 0, &exkeys, &pms);
+                    if (!pms.data) break;
+
+                    memcpy(&conn->pre_master_secret, pms.data, pms.size);
+                    tls_debug_print_hex("pre_master_secret", pms.data, pms.size);
+                    tls_debug_print_hex("client_random", &conn->client_random, sizeof(struct Random));
+                    tls_debug_print_hex("server_random", &conn->server_random, sizeof(struct Random));
+
+                    // Get MasterSecret
+                    uint8_t *seed = sng_malloc(sizeof(struct Random) * 2);
+                    memcpy(seed, &conn->client_random, sizeof(struct Random));
+                    memcpy(seed + sizeof(struct Random), &conn->server_random, sizeof(struct Random));
+                    PRF(conn, (unsigned char *) &conn->master_secret, sizeof(struct MasterSecret),
+                        (unsigned char *) &conn->pre_master_secret, sizeof(struct PreMasterSecret),
+                        (unsigned char *) "master secret", seed, sizeof(struct Random) * 2);
+
+                    tls_debug_print_hex("master_secret", conn->master_secret.random, sizeof(struct MasterSecret));
+
+                    // Done with the seed
+                    sng_free(seed);
                 }
 
-                // Get write keys
-                int wk_len = conn->cipher_data.bits / 8;
-                conn->key_material.client_write_key = sng_malloc(wk_len);
-                memcpy(conn->key_material.client_write_key, key_material, wk_len);
-                tls_debug_print_hex("client_write_key", key_material, wk_len);
-                key_material+=wk_len;
-
-                conn->key_material.server_write_key = sng_malloc(wk_len);
-                memcpy(conn->key_material.server_write_key, key_material, wk_len);
-                tls_debug_print_hex("server_write_key", key_material, wk_len);
-                key_material+=wk_len;
-
-                // Get IV blocks
-                conn->key_material.client_write_IV = sng_malloc(conn->cipher_data.ivblock);
-                memcpy(conn->key_material.client_write_IV, key_material, conn->cipher_data.ivblock);
-                tls_debug_print_hex("client_write_IV", key_material,  conn->cipher_data.ivblock);
-                key_material+=conn->cipher_data.ivblock;
-                conn->key_material.server_write_IV = sng_malloc(conn->cipher_data.ivblock);
-                memcpy(conn->key_material.server_write_IV, key_material, conn->cipher_data.ivblock);
-                tls_debug_print_hex("server_write_IV", key_material,  conn->cipher_data.ivblock);
-                /* key_material+=conn->cipher_data.ivblock; */
-
-                // Free temporally allocated memory
-                sng_free(seed);
-                //sng_free(key_material);
-
-                int mode = 0;
-                if (conn->cipher_data.mode == MODE_CBC) {
-                    mode = GCRY_CIPHER_MODE_CBC;
-                } else if (conn->cipher_data.mode == MODE_GCM) {
-                    mode = GCRY_CIPHER_MODE_CTR;
-                } else {
-                    tls_connection_destroy(conn);
+                // Generate keys and create decoders
+                if (tls_connection_load_keys(conn) != 0) {
+                    tls_connection_close(conn);
                     return 1;
                 }
-
-                // Create Client decoder
-                gcry_cipher_open(&conn->client_cipher_ctx, conn->ciph, mode, 0);
-                gcry_cipher_setkey(conn->client_cipher_ctx,
-                                   conn->key_material.client_write_key,
-                                   gcry_cipher_get_algo_keylen(conn->ciph));
-                gcry_cipher_setiv(conn->client_cipher_ctx,
-                                  conn->key_material.client_write_IV,
-                                  gcry_cipher_get_algo_blklen(conn->ciph));
-
-                // Create Server decoder
-                gcry_cipher_open(&conn->server_cipher_ctx, conn->ciph, mode, 0);
-                gcry_cipher_setkey(conn->server_cipher_ctx,
-                                   conn->key_material.server_write_key,
-                                   gcry_cipher_get_algo_keylen(conn->ciph));
-                gcry_cipher_setiv(conn->server_cipher_ctx,
-                                  conn->key_material.server_write_IV,
-                                  gcry_cipher_get_algo_blklen(conn->ciph));
-
                 break;
             case finished:
                 break;
@@ -831,6 +851,99 @@ tls_connection_load_cipher(struct SSLConnection *conn)
     return 0;
 }
 
+int
+tls_connection_load_keys(struct SSLConnection *conn)
+{
+    // Key expansion uses server random first
+    uint8_t *seed = sng_malloc(sizeof(struct Random) * 2);
+    memcpy(seed, &conn->server_random, sizeof(struct Random));
+    memcpy(seed + sizeof(struct Random), &conn->client_random, sizeof(struct Random));
+
+    int key_material_len = 0;
+    key_material_len += conn->cipher_data.diglen * 2;
+    key_material_len += conn->cipher_data.ivblock * 2;
+    key_material_len += conn->cipher_data.bits / 4;
+
+    // Generate MACs, Write Keys and IVs
+    uint8_t *key_material = sng_malloc(key_material_len);
+    PRF(conn, (unsigned char *) key_material, key_material_len,
+        (unsigned char *) &conn->master_secret, sizeof(struct MasterSecret),
+        (unsigned char *) "key expansion", seed, sizeof(struct Random) * 2);
+
+    // Get write mac keys
+    if (conn->cipher_data.mode == MODE_GCM) {
+        // AEAD ciphers
+        conn->key_material.client_write_MAC_key = 0;
+        conn->key_material.server_write_MAC_key = 0;
+    } else {
+        // Copy prf output to ssl connection key material
+        int mk_len = conn->cipher_data.diglen;
+        conn->key_material.client_write_MAC_key = sng_malloc(mk_len);
+        memcpy(conn->key_material.client_write_MAC_key, key_material, mk_len);
+        tls_debug_print_hex("client_write_MAC_key", key_material, mk_len);
+        key_material += mk_len;
+        conn->key_material.server_write_MAC_key = sng_malloc(mk_len);
+        tls_debug_print_hex("server_write_MAC_key", key_material, mk_len);
+        memcpy(conn->key_material.server_write_MAC_key, key_material, mk_len);
+        key_material+=mk_len;
+    }
+
+    // Get write keys
+    int wk_len = conn->cipher_data.bits / 8;
+    conn->key_material.client_write_key = sng_malloc(wk_len);
+    memcpy(conn->key_material.client_write_key, key_material, wk_len);
+    tls_debug_print_hex("client_write_key", key_material, wk_len);
+    key_material+=wk_len;
+
+    conn->key_material.server_write_key = sng_malloc(wk_len);
+    memcpy(conn->key_material.server_write_key, key_material, wk_len);
+    tls_debug_print_hex("server_write_key", key_material, wk_len);
+    key_material+=wk_len;
+
+    // Get IV blocks
+    conn->key_material.client_write_IV = sng_malloc(conn->cipher_data.ivblock);
+    memcpy(conn->key_material.client_write_IV, key_material, conn->cipher_data.ivblock);
+    tls_debug_print_hex("client_write_IV", key_material,  conn->cipher_data.ivblock);
+    key_material+=conn->cipher_data.ivblock;
+    conn->key_material.server_write_IV = sng_malloc(conn->cipher_data.ivblock);
+    memcpy(conn->key_material.server_write_IV, key_material, conn->cipher_data.ivblock);
+    tls_debug_print_hex("server_write_IV", key_material,  conn->cipher_data.ivblock);
+    /* key_material+=conn->cipher_data.ivblock; */
+
+    // Free temporally allocated memory
+    sng_free(seed);
+    //sng_free(key_material);
+
+    int mode = 0;
+    if (conn->cipher_data.mode == MODE_CBC) {
+        mode = GCRY_CIPHER_MODE_CBC;
+    } else if (conn->cipher_data.mode == MODE_GCM) {
+        mode = GCRY_CIPHER_MODE_CTR;
+    } else {
+        return 1;
+    }
+
+    // Create Client decoder
+    gcry_cipher_open(&conn->client_cipher_ctx, conn->ciph, mode, 0);
+    gcry_cipher_setkey(conn->client_cipher_ctx,
+                       conn->key_material.client_write_key,
+                       gcry_cipher_get_algo_keylen(conn->ciph));
+    gcry_cipher_setiv(conn->client_cipher_ctx,
+                      conn->key_material.client_write_IV,
+                      gcry_cipher_get_algo_blklen(conn->ciph));
+
+    // Create Server decoder
+    gcry_cipher_open(&conn->server_cipher_ctx, conn->ciph, mode, 0);
+    gcry_cipher_setkey(conn->server_cipher_ctx,
+                       conn->key_material.server_write_key,
+                       gcry_cipher_get_algo_keylen(conn->ciph));
+    gcry_cipher_setiv(conn->server_cipher_ctx,
+                      conn->key_material.server_write_IV,
+                      gcry_cipher_get_algo_blklen(conn->ciph));
+
+    return 0;
+}
+
 int
 tls_valid_version(struct ProtocolVersion version)
 {
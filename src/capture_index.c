@@ -0,0 +1,270 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_index.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in capture_index.h
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "capture.h"
+#include "capture_index.h"
+#include "setting.h"
+#include "sip.h"
+#include "util.h"
+
+//! Capture configuration
+extern capture_config_t capture_cfg;
+
+int
+capture_index_offset_sorter(const void *a, const void *b)
+{
+    uint64_t oa = *(const uint64_t *) a, ob = *(const uint64_t *) b;
+    return (oa > ob) - (oa < ob);
+}
+
+capture_index_t *
+capture_index_open(const char *infile)
+{
+    capture_index_t *index;
+    struct stat st;
+
+    if (!setting_enabled(SETTING_CAPTURE_OFFLINE_INDEX))
+        return NULL;
+
+    if (stat(infile, &st) != 0 || !S_ISREG(st.st_mode))
+        return NULL;
+
+    if (!(index = sng_malloc(sizeof(capture_index_t))))
+        return NULL;
+
+    snprintf(index->filename, sizeof(index->filename), "%s%s", infile, CAPTURE_INDEX_EXT);
+    index->file_size = st.st_size;
+    index->file_mtime = st.st_mtime;
+
+    // Use existing index to only read SIP messages
+    if (capture_index_load(index) == 0) {
+        // RTP packets are not indexed
+        if (capture_cfg.rtp_capture) {
+            capture_index_close(index);
+            return NULL;
+        }
+        return index;
+    }
+
+    // Build a new index while loading the file
+    index->dialogs = vector_create(1024, 128);
+    index->dialogs_index = htable_create(CAPTURE_INDEX_BUCKETS);
+    return index;
+}
+
+int
+capture_index_load(capture_index_t *index)
+{
+    FILE *f;
+    char *line = NULL, *field, *save;
+    size_t len = 0, i, count = 0;
+    unsigned long long size;
+    long mtime;
+    uint64_t offset;
+    int column;
+
+    if (!(f = fopen(index->filename, "r")))
+        return 1;
+
+    // Check index belongs to this input file
+    if (getline(&line, &len, f) == -1 || strncmp(line, CAPTURE_INDEX_HEADER, strlen(CAPTURE_INDEX_HEADER)) != 0
+            || getline(&line, &len, f) == -1 || sscanf(line, "# file %llu %ld", &size, &mtime) != 2
+            || size != index->file_size || mtime != index->file_mtime) {
+        free(line);
+        fclose(f);
+        return 1;
+    }
+
+    // Get frames offsets of all dialogs: callid xcallid start end offsets
+    while (getline(&line, &len, f) != -1) {
+        field = strtok_r(line, "\t\n", &save);
+        for (column = 0; field && column < 4; column++)
+            field = strtok_r(NULL, "\t\n", &save);
+        if (!field)
+            continue;
+
+        for (field = strtok_r(field, ",", &save); field; field = strtok_r(NULL, ",", &save)) {
+            if (!(offset = strtoull(field, NULL, 10)))
+                continue;
+            if (index->count == count) {
+                count = count ? count * 2 : 4096;
+                index->offsets = realloc(index->offsets, sizeof(uint64_t) * count);
+            }
+            index->offsets[index->count++] = offset;
+        }
+    }
+    free(line);
+    fclose(f);
+
+    // Records are read in file order, once each
+    if (index->count) {
+        qsort(index->offsets, index->count, sizeof(uint64_t), capture_index_offset_sorter);
+        for (i = 1, count = 1; i < index->count; i++) {
+            if (index->offsets[i] != index->offsets[count - 1])
+                index->offsets[count++] = index->offsets[i];
+        }
+        index->count = count;
+    }
+
+    // An empty index is still valid, but offsets must be set
+    if (!index->offsets)
+        index->offsets = sng_malloc(sizeof(uint64_t));
+
+    return 0;
+}
+
+void
+capture_index_packet(capture_index_t *index, packet_t *packet)
+{
+    capture_index_dialog_t *dialog;
+    char callid[1024], xcallid[1024];
+    const char *payload;
+    frame_t *frame;
+
+    // Not building an index
+    if (!index || !index->dialogs)
+        return;
+
+    if (!packet_payloadlen(packet) || data_is_sip(packet_payload(packet), packet_payloadlen(packet)) != 0)
+        return;
+
+    // Packet payload is always followed by a zero byte
+    payload = (const char *) packet_payload(packet);
+    memset(callid, 0, sizeof(callid));
+    if (!strlen(sip_get_callid(payload, callid)))
+        return;
+
+    if (!(dialog = htable_find(index->dialogs_index, callid))) {
+        if (!(dialog = sng_malloc(sizeof(capture_index_dialog_t))))
+            return;
+        memset(xcallid, 0, sizeof(xcallid));
+        dialog->callid = strdup(callid);
+        if (strlen(sip_get_xcallid(payload, xcallid)))
+            dialog->xcallid = strdup(xcallid);
+        dialog->start = packet_time(packet);
+        vector_append(index->dialogs, dialog);
+        htable_insert(index->dialogs_index, dialog->callid, dialog);
+    }
+
+    vector_iter_t it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        // Frame was not read from a mapped file
+        if (!frame->buffer || !frame->buffer->offset) {
+            index->discarded = true;
+            continue;
+        }
+        if (dialog->count == dialog->size) {
+            dialog->size = dialog->size ? dialog->size * 2 : 8;
+            dialog->offsets = realloc(dialog->offsets, sizeof(uint64_t) * dialog->size);
+        }
+        dialog->offsets[dialog->count++] = frame->buffer->offset;
+        if (timercmp(&frame->header->ts, &dialog->end, >))
+            dialog->end = frame->header->ts;
+    }
+}
+
+void
+capture_index_discard(capture_index_t *index)
+{
+    if (index)
+        index->discarded = true;
+}
+
+int
+capture_index_save(capture_index_t *index)
+{
+    capture_index_dialog_t *dialog;
+    char tmpname[PATH_MAX + 8];
+    FILE *f;
+    size_t i;
+
+    // Nothing to store or something has not been indexed
+    if (!index || !index->dialogs || index->discarded)
+        return 1;
+
+    // A filtered load does not contain all dialogs
+    if (capture_get_bpf_filter())
+        return 1;
+
+    // Write a temporal file so readers never see a partial index
+    snprintf(tmpname, sizeof(tmpname), "%s.tmp", index->filename);
+    if (!(f = fopen(tmpname, "w")))
+        return 1;
+
+    fprintf(f, "%s\n", CAPTURE_INDEX_HEADER);
+    fprintf(f, "# file %llu %ld\n", (unsigned long long) index->file_size, index->file_mtime);
+
+    vector_iter_t it = vector_iterator(index->dialogs);
+    while ((dialog = vector_iterator_next(&it))) {
+        fprintf(f, "%s\t%s\t%ld.%06ld\t%ld.%06ld\t", dialog->callid,
+                dialog->xcallid ? dialog->xcallid : "-",
+                (long) dialog->start.tv_sec, (long) dialog->start.tv_usec,
+                (long) dialog->end.tv_sec, (long) dialog->end.tv_usec);
+        for (i = 0; i < dialog->count; i++)
+            fprintf(f, "%s%llu", i ? "," : "", (unsigned long long) dialog->offsets[i]);
+        fprintf(f, "\n");
+    }
+
+    if (fclose(f) != 0 || rename(tmpname, index->filename) != 0) {
+        unlink(tmpname);
+        return 1;
+    }
+
+    return 0;
+}
+
+void
+capture_index_close(capture_index_t *index)
+{
+    capture_index_dialog_t *dialog;
+
+    if (!index)
+        return;
+
+    if (index->dialogs) {
+        vector_iter_t it = vector_iterator(index->dialogs);
+        while ((dialog = vector_iterator_next(&it))) {
+            htable_remove(index->dialogs_index, dialog->callid);
+            sng_free(dialog->callid);
+            sng_free(dialog->xcallid);
+            sng_free(dialog->offsets);
+            sng_free(dialog);
+        }
+        vector_destroy(index->dialogs);
+        htable_destroy(index->dialogs_index);
+    }
+
+    sng_free(index->offsets);
+    sng_free(index);
+}
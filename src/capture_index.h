@@ -0,0 +1,156 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_index.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to manage index files of input pcap files
+ *
+ * When capture.offline.index is enabled, the first time an input file is
+ * loaded an index file (same name ended in .sngidx) is stored next to it.
+ * Each line of the index contains a dialog Call-ID, its X-Call-ID, the
+ * capture time of its first and last frames and the file offsets of all
+ * frames of its SIP messages.
+ *
+ * Later loads of the same file only read the indexed records, skipping
+ * the rest of the traffic (RTP streams are not loaded in this case).
+ */
+#ifndef __SNGREP_CAPTURE_INDEX_H
+#define __SNGREP_CAPTURE_INDEX_H
+
+#include "config.h"
+#include <stdint.h>
+#include <limits.h>
+#include <sys/time.h>
+#include "packet.h"
+#include "hash.h"
+#include "vector.h"
+
+//! Extension of input files index
+#define CAPTURE_INDEX_EXT       ".sngidx"
+//! Index files first line
+#define CAPTURE_INDEX_HEADER    "# sngrep index 1"
+//! Number of buckets of dialogs index while building it
+#define CAPTURE_INDEX_BUCKETS   10007
+
+//! Shorter declaration of capture_index structure
+typedef struct capture_index capture_index_t;
+//! Shorter declaration of capture_index_dialog structure
+typedef struct capture_index_dialog capture_index_dialog_t;
+
+/**
+ * @brief Indexed dialog data
+ */
+struct capture_index_dialog
+{
+    //! Call-ID header value
+    char *callid;
+    //! X-Call-ID header value (NULL if not found)
+    char *xcallid;
+    //! Capture time of first and last frames
+    struct timeval start, end;
+    //! Offsets of the frames records in input file
+    uint64_t *offsets;
+    //! Number of offsets and allocated size
+    size_t count, size;
+};
+
+/**
+ * @brief Input file index data
+ */
+struct capture_index
+{
+    //! Index file name
+    char filename[PATH_MAX];
+    //! Input file size and modification time when index was built
+    uint64_t file_size;
+    long file_mtime;
+    //! Dialogs being indexed (capture_index_dialog_t)
+    vector_t *dialogs;
+    //! Dialogs being indexed by Call-ID
+    htable_t *dialogs_index;
+    //! Some frames have not been indexed, index must not be stored
+    bool discarded;
+    //! Sorted offsets of all indexed records (when index has been loaded)
+    uint64_t *offsets;
+    //! Number of indexed records
+    size_t count;
+};
+
+/**
+ * @brief Get the index of an input file
+ *
+ * If a valid index already exists it is loaded, so only its records must
+ * be read. Otherwise, an empty index is returned to be filled while the
+ * file is loaded.
+ *
+ * @return index data or NULL if indexing is disabled
+ */
+capture_index_t *
+capture_index_open(const char *infile);
+
+/**
+ * @brief Load index file records offsets
+ *
+ * @return 0 if index is valid for the input file, 1 otherwise
+ */
+int
+capture_index_load(capture_index_t *index);
+
+/**
+ * @brief Add the frames of a SIP packet to the index being built
+ *
+ * Frames must have been read from a mapped input file, so their offset
+ * is known.
+ */
+void
+capture_index_packet(capture_index_t *index, packet_t *packet);
+
+/**
+ * @brief Mark the index being built as incomplete
+ */
+void
+capture_index_discard(capture_index_t *index);
+
+/**
+ * @brief Store a built index in its file
+ *
+ * Index is only stored if all input file frames have been indexed.
+ *
+ * @return 0 if index has been stored, 1 otherwise
+ */
+int
+capture_index_save(capture_index_t *index);
+
+/**
+ * @brief Compare two records offsets (qsort function)
+ */
+int
+capture_index_offset_sorter(const void *a, const void *b);
+
+/**
+ * @brief Free all index data
+ */
+void
+capture_index_close(capture_index_t *index);
+
+#endif /* __SNGREP_CAPTURE_INDEX_H */
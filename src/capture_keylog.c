@@ -0,0 +1,229 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_keylog.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in capture_keylog.h
+ *
+ */
+#include "config.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "capture_keylog.h"
+
+//! Number of buckets of master secrets index
+#define KEYLOG_HASH 1024
+
+/**
+ * @brief Key log file data
+ */
+static struct
+{
+    //! Key log file path
+    char *file;
+    //! Offset of the first line not read yet
+    off_t offset;
+    //! Loaded master secrets (capture_keylog_entry_t)
+    vector_t *entries;
+    //! Loaded master secrets indexed by client random
+    htable_t *index;
+    //! Protects key log data from concurrent decrypting threads
+    pthread_mutex_t lock;
+} keylog = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief Decode an hex string of the given number of bytes
+ *
+ * @return 0 if all characters are hex digits, 1 otherwise
+ */
+static inline int
+capture_keylog_hex(const char *hex, uint8_t *out, size_t len)
+{
+    char byte[3] = { 0 };
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (!isxdigit((u_char) hex[i * 2]) || !isxdigit((u_char) hex[i * 2 + 1]))
+            return 1;
+        byte[0] = hex[i * 2];
+        byte[1] = hex[i * 2 + 1];
+        out[i] = (uint8_t) strtoul(byte, NULL, 16);
+    }
+    return 0;
+}
+
+int
+capture_keylog_open(const char *file)
+{
+    int ret;
+
+    pthread_mutex_lock(&keylog.lock);
+    keylog.file = strdup(file);
+    keylog.offset = 0;
+    keylog.entries = vector_create(0, 1024);
+    keylog.index = htable_create(KEYLOG_HASH);
+    ret = capture_keylog_read();
+    pthread_mutex_unlock(&keylog.lock);
+
+    return ret;
+}
+
+void
+capture_keylog_close()
+{
+    pthread_mutex_lock(&keylog.lock);
+    if (keylog.index)
+        htable_destroy(keylog.index);
+    vector_destroy_items(keylog.entries);
+    free(keylog.file);
+    keylog.index = NULL;
+    keylog.entries = NULL;
+    keylog.file = NULL;
+    pthread_mutex_unlock(&keylog.lock);
+}
+
+int
+capture_keylog_find(const uint8_t *random, uint8_t *secret)
+{
+    capture_keylog_entry_t *entry;
+    char key[KEYLOG_RANDOM_LEN * 2 + 1];
+    struct stat st;
+    int i;
+
+    for (i = 0; i < KEYLOG_RANDOM_LEN; i++)
+        sprintf(key + i * 2, "%02x", random[i]);
+
+    pthread_mutex_lock(&keylog.lock);
+    if (!keylog.index) {
+        pthread_mutex_unlock(&keylog.lock);
+        return 1;
+    }
+
+    // Secret could have been logged after file was last read
+    if (!(entry = htable_find(keylog.index, key))
+            && stat(keylog.file, &st) == 0 && st.st_size != keylog.offset) {
+        capture_keylog_read();
+        entry = htable_find(keylog.index, key);
+    }
+
+    if (entry)
+        memcpy(secret, entry->secret, KEYLOG_SECRET_LEN);
+    pthread_mutex_unlock(&keylog.lock);
+
+    return (entry) ? 0 : 1;
+}
+
+size_t
+capture_keylog_count()
+{
+    size_t count;
+
+    pthread_mutex_lock(&keylog.lock);
+    count = vector_count(keylog.entries);
+    pthread_mutex_unlock(&keylog.lock);
+    return count;
+}
+
+int
+capture_keylog_read()
+{
+    char line[KEYLOG_LINE_LEN];
+    struct stat st;
+    size_t len;
+    FILE *fp;
+    int c;
+
+    if (!(fp = fopen(keylog.file, "r")))
+        return 1;
+
+    // File has been truncated, read it again
+    if (fstat(fileno(fp), &st) == 0 && st.st_size < keylog.offset)
+        keylog.offset = 0;
+
+    if (fseeko(fp, keylog.offset, SEEK_SET) != 0) {
+        fclose(fp);
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        len = strlen(line);
+        if (len && line[len - 1] != '\n') {
+            // Line is still being written
+            if (len < sizeof(line) - 1)
+                break;
+            // Skip lines too long to contain a master secret
+            while ((c = fgetc(fp)) != EOF && c != '\n');
+            if (c == EOF)
+                break;
+        } else {
+            capture_keylog_parse(line);
+        }
+        keylog.offset = ftello(fp);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+int
+capture_keylog_parse(const char *line)
+{
+    capture_keylog_entry_t *entry;
+    uint8_t random[KEYLOG_RANDOM_LEN];
+    uint8_t secret[KEYLOG_SECRET_LEN];
+    char key[KEYLOG_RANDOM_LEN * 2 + 1];
+    const char *fields;
+    int i;
+
+    // Only master secret lines are used
+    if (!keylog.index || strncmp(line, KEYLOG_LABEL " ", strlen(KEYLOG_LABEL) + 1) != 0)
+        return 1;
+    fields = line + strlen(KEYLOG_LABEL) + 1;
+
+    // Check both fields have the expected length
+    if (strlen(fields) < KEYLOG_RANDOM_LEN * 2 + 1 + KEYLOG_SECRET_LEN * 2
+            || fields[KEYLOG_RANDOM_LEN * 2] != ' ')
+        return 1;
+
+    if (capture_keylog_hex(fields, random, KEYLOG_RANDOM_LEN) != 0
+            || capture_keylog_hex(fields + KEYLOG_RANDOM_LEN * 2 + 1, secret, KEYLOG_SECRET_LEN) != 0)
+        return 1;
+
+    // Index uses the same hex format than lookups
+    for (i = 0; i < KEYLOG_RANDOM_LEN; i++)
+        sprintf(key + i * 2, "%02x", random[i]);
+
+    if (!(entry = htable_find(keylog.index, key))) {
+        if (!(entry = malloc(sizeof(capture_keylog_entry_t))))
+            return 1;
+        memcpy(entry->random, key, sizeof(key));
+        vector_append(keylog.entries, entry);
+        htable_insert(keylog.index, entry->random, entry);
+    }
+
+    // Last logged secret of a session is used
+    memcpy(entry->secret, secret, KEYLOG_SECRET_LEN);
+    return 0;
+}
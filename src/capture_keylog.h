@@ -0,0 +1,126 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_keylog.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to read TLS master secrets from NSS key log files
+ *
+ * Key log files (the ones written by TLS libraries when SSLKEYLOGFILE
+ * environment variable is set) contain the master secret of each TLS
+ * session indexed by its ClientHello random:
+ *
+ *   CLIENT_RANDOM <64 hex client random> <96 hex master secret>
+ *
+ * With these secrets, sessions using any key exchange (including ECDHE)
+ * can be decrypted without the server private key. File is read once and
+ * lines appended later are read when a client random is not found.
+ */
+#ifndef __SNGREP_CAPTURE_KEYLOG_H
+#define __SNGREP_CAPTURE_KEYLOG_H
+
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "hash.h"
+#include "vector.h"
+
+//! Length of TLS client random
+#define KEYLOG_RANDOM_LEN   32
+//! Length of TLS master secret
+#define KEYLOG_SECRET_LEN   48
+//! Label of the key log lines with master secrets
+#define KEYLOG_LABEL        "CLIENT_RANDOM"
+//! Max length of a key log line
+#define KEYLOG_LINE_LEN     512
+
+//! Shorter declaration of capture_keylog_entry structure
+typedef struct capture_keylog_entry capture_keylog_entry_t;
+
+/**
+ * @brief Master secret of a TLS session
+ */
+struct capture_keylog_entry
+{
+    //! Client random in lowercase hex (entry key)
+    char random[KEYLOG_RANDOM_LEN * 2 + 1];
+    //! Session master secret
+    uint8_t secret[KEYLOG_SECRET_LEN];
+};
+
+/**
+ * @brief Load all master secrets from a key log file
+ *
+ * @param file Key log file path
+ * @return 0 if file has been read, 1 otherwise
+ */
+int
+capture_keylog_open(const char *file);
+
+/**
+ * @brief Discard all loaded master secrets
+ */
+void
+capture_keylog_close();
+
+/**
+ * @brief Get the master secret of a TLS session
+ *
+ * If the session is not found and the file has changed since it was last
+ * read, new lines are read before giving up.
+ *
+ * @param random ClientHello random of the session
+ * @param secret Master secret filled if found
+ * @return 0 if secret was found, 1 otherwise
+ */
+int
+capture_keylog_find(const uint8_t *random, uint8_t *secret);
+
+/**
+ * @brief Get number of master secrets loaded
+ */
+size_t
+capture_keylog_count();
+
+/**
+ * @brief Read key log lines not read yet
+ *
+ * Last line is not read until it is complete. If the file has been
+ * truncated it is read again from the start.
+ *
+ * @return 0 if file could be read, 1 otherwise
+ */
+int
+capture_keylog_read();
+
+/**
+ * @brief Parse a key log line and store its master secret
+ *
+ * Lines with other labels (TLS 1.3 traffic secrets, comments...) are ignored
+ *
+ * @return 0 if line contains a master secret, 1 otherwise
+ */
+int
+capture_keylog_parse(const char *line);
+
+#endif /* __SNGREP_CAPTURE_KEYLOG_H */
@@ -0,0 +1,656 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_mmap.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in capture_mmap.h
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "capture_mmap.h"
+#include "capture_index.h"
+#include "affinity.h"
+#include "latency.h"
+#include "setting.h"
+#include "util.h"
+
+//! Capture configuration
+extern capture_config_t capture_cfg;
+
+//! Queued by workers after the last packet decoded from a frame
+static char capture_mmap_frame_end;
+
+int
+capture_mmap_open(capture_info_t *capinfo)
+{
+    capture_mmap_t *mmap_info;
+    struct stat st;
+    uint32_t magic;
+    long workers;
+    void *map;
+    int fd;
+
+    // Get number of decoding workers
+    if (setting_get_intvalue(SETTING_CAPTURE_OFFLINE_WORKERS) > 0) {
+        workers = setting_get_intvalue(SETTING_CAPTURE_OFFLINE_WORKERS);
+    } else {
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+        if (workers > CAPTURE_MMAP_WORKERS)
+            workers = CAPTURE_MMAP_WORKERS;
+    }
+
+    // Not worth it with a single worker, unless file records are needed later
+    if (workers <= 1 && !setting_enabled(SETTING_CAPTURE_OFFLINE_INDEX)
+            && !setting_enabled(SETTING_CAPTURE_OFFLINE_LAZY))
+        return 1;
+    if (workers < 1)
+        workers = 1;
+
+    // TLS decrypting keeps its own connections state
+    if (capture_cfg.keyfile)
+        return 1;
+
+    // Only regular files can be mapped
+    if ((fd = open(capinfo->infile, O_RDONLY)) < 0)
+        return 1;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < CAPTURE_MMAP_FILE_HDR) {
+        close(fd);
+        return 1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 1;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    if (!(mmap_info = sng_malloc(sizeof(capture_mmap_t)))) {
+        munmap(map, st.st_size);
+        return 1;
+    }
+    mmap_info->map = map;
+    mmap_info->size = st.st_size;
+    mmap_info->lazy = setting_enabled(SETTING_CAPTURE_OFFLINE_LAZY);
+    capture_readahead_init(&mmap_info->readahead, -1, map, st.st_size);
+
+    // Check file format and byte order
+    memcpy(&magic, mmap_info->map, sizeof(magic));
+    if (magic == CAPTURE_MMAP_PCAPNG_SHB) {
+        // Byte order is checked again in each section
+        mmap_info->pcapng = true;
+    } else if (magic == CAPTURE_MMAP_MAGIC || magic == CAPTURE_MMAP_MAGIC_NSEC) {
+        mmap_info->swapped = false;
+    } else {
+        mmap_info->swapped = true;
+        magic = capture_mmap_read32(mmap_info, mmap_info->map);
+        if (magic != CAPTURE_MMAP_MAGIC && magic != CAPTURE_MMAP_MAGIC_NSEC) {
+            munmap(map, st.st_size);
+            sng_free(mmap_info);
+            return 1;
+        }
+    }
+    mmap_info->nsec = (magic == CAPTURE_MMAP_MAGIC_NSEC);
+    mmap_info->link = capinfo->link;
+    atomic_init(&mmap_info->offset, mmap_info->pcapng ? 0 : CAPTURE_MMAP_FILE_HDR);
+
+    // Mapping is kept until all frames stored in it are released
+    if (!(mmap_info->segment = capture_disk_segment_wrap(map, st.st_size))) {
+        munmap(map, st.st_size);
+        sng_free(mmap_info);
+        return 1;
+    }
+
+    // Create workers reassembly data
+    mmap_info->count = workers;
+    mmap_info->workers = sng_malloc(sizeof(capture_mmap_worker_t) * mmap_info->count);
+    for (uint32_t i = 0; i < mmap_info->count; i++) {
+        capture_mmap_worker_t *worker = &mmap_info->workers[i];
+        worker->source = capinfo;
+        worker->capinfo = sng_malloc(sizeof(capture_info_t));
+        worker->capinfo->infile = capinfo->infile;
+        worker->capinfo->link = capinfo->link;
+        worker->capinfo->link_hl = capinfo->link_hl;
+        worker->capinfo->link_decode = capinfo->link_decode;
+        capture_reasm_init(worker->capinfo);
+    }
+
+    capinfo->mmap = mmap_info;
+
+    // Records offsets are known, so they can be indexed (pcapng frames
+    // depend on previous interface blocks, so they can't be read alone)
+    if (!mmap_info->pcapng)
+        capinfo->index = capture_index_open(capinfo->infile);
+    return 0;
+}
+
+int
+capture_mmap_launch(capture_info_t *capinfo)
+{
+    capture_mmap_t *mmap = capinfo->mmap;
+    capture_info_t *wcapinfo;
+
+    for (uint32_t i = 0; i < mmap->count; i++) {
+        wcapinfo = mmap->workers[i].capinfo;
+
+        // Create the queues from reader and to parser threads
+        if (!(wcapinfo->ring = ring_create(capture_cfg.ring_size)))
+            return 1;
+        if (!(mmap->workers[i].decoded = ring_create(capture_cfg.ring_size)))
+            return 1;
+        atomic_init(&wcapinfo->eof, false);
+        atomic_init(&wcapinfo->stopping, false);
+        atomic_init(&wcapinfo->parser_waiting, false);
+        pthread_mutex_init(&wcapinfo->ring_lock, NULL);
+        pthread_cond_init(&wcapinfo->ring_cond, NULL);
+
+        wcapinfo->running = true;
+        if (pthread_create(&wcapinfo->parser_t, NULL, (void *) capture_mmap_worker_thread, &mmap->workers[i]))
+            return 1;
+    }
+
+    return 0;
+}
+
+void
+capture_mmap_loop(capture_info_t *capinfo)
+{
+    capture_mmap_t *mmap = capinfo->mmap;
+    capture_mmap_worker_t *worker;
+    struct pcap_pkthdr header;
+    frame_buffer_t *frame;
+    const u_char *record;
+    size_t offset = atomic_load(&mmap->offset), next;
+    uint32_t count = 0, i;
+    int ret;
+    // Records to read from a loaded index
+    capture_index_t *index = (capinfo->index && capinfo->index->offsets) ? capinfo->index : NULL;
+    size_t indexed = 0;
+
+    if (index)
+        offset = (index->count) ? index->offsets[0] : mmap->size;
+
+    while ((ret = capture_mmap_record(mmap, offset, &header, &record, &next)) >= 0) {
+        // Same checks done to frames read by libpcap
+        if (ret == 0 && !capture_paused() && header.caplen <= MAX_CAPTURE_LEN
+                && (!mmap->filtered || pcap_offline_filter(&mmap->fp, &header, record))
+                && (frame = frame_buffer_create(&header, record))) {
+            frame->offset = offset;
+            frame->source = capinfo->id;
+            // Queue the frame for the worker of its addresses
+            worker = capture_mmap_flow_worker(capinfo, record, header.caplen);
+            while (ring_push(worker->capinfo->ring, frame) != 0) {
+                capture_parser_wakeup(worker->capinfo, false);
+                usleep(100);
+            }
+            // Queue the worker so its packets are processed in file order
+            while (ring_push(capinfo->ring, worker) != 0) {
+                capture_parser_wakeup(capinfo, false);
+                usleep(100);
+            }
+        } else if (ret == 0 && capture_paused()) {
+            // Index must contain all file records
+            capture_index_discard(capinfo->index);
+        }
+
+        // Continue with next indexed record or the one after this
+        if (index) {
+            offset = (++indexed < index->count) ? index->offsets[indexed] : mmap->size;
+        } else {
+            offset = next;
+        }
+        atomic_store(&mmap->offset, offset);
+
+        // Notify workers once per batch
+        if (++count % capture_cfg.batch_size == 0) {
+            for (i = 0; i < mmap->count; i++)
+                capture_parser_wakeup(mmap->workers[i].capinfo, false);
+            // Keep next file chunks being read before touching their pages
+            capture_readahead(&mmap->readahead, offset);
+            // Reading from memory never blocks, allow capture_close to cancel us
+            pthread_testcancel();
+        }
+    }
+
+    // Let workers know no more frames will be queued
+    for (i = 0; i < mmap->count; i++) {
+        mmap->workers[i].capinfo->eof = true;
+        capture_parser_wakeup(mmap->workers[i].capinfo, true);
+    }
+}
+
+int
+capture_mmap_record(capture_mmap_t *mmap, size_t offset, struct pcap_pkthdr *header,
+                    const u_char **data, size_t *next)
+{
+    const u_char *record = mmap->map + offset;
+
+    if (mmap->pcapng)
+        return capture_mmap_pcapng_block(mmap, offset, header, data, next);
+
+    if (offset + CAPTURE_MMAP_RECORD_HDR > mmap->size)
+        return -1;
+
+    header->ts.tv_sec = capture_mmap_read32(mmap, record);
+    header->ts.tv_usec = capture_mmap_read32(mmap, record + 4);
+    if (mmap->nsec)
+        header->ts.tv_usec /= 1000;
+    header->caplen = capture_mmap_read32(mmap, record + 8);
+    header->len = capture_mmap_read32(mmap, record + 12);
+
+    // Last record has been truncated
+    if (header->caplen > mmap->size - offset - CAPTURE_MMAP_RECORD_HDR)
+        return -1;
+
+    *data = record + CAPTURE_MMAP_RECORD_HDR;
+    *next = offset + CAPTURE_MMAP_RECORD_HDR + header->caplen;
+    return 0;
+}
+
+int
+capture_mmap_pcapng_block(capture_mmap_t *mmap, size_t offset, struct pcap_pkthdr *header,
+                          const u_char **data, size_t *next)
+{
+    const u_char *block = mmap->map + offset;
+    capture_mmap_iface_t *iface;
+    uint32_t type, len, magic, id;
+    uint64_t ts;
+
+    if (offset + 12 > mmap->size)
+        return -1;
+
+    // Each section sets the byte order of its blocks
+    memcpy(&type, block, sizeof(type));
+    if (type == CAPTURE_MMAP_PCAPNG_SHB) {
+        memcpy(&magic, block + 8, sizeof(magic));
+        if (magic == CAPTURE_MMAP_PCAPNG_MAGIC) {
+            mmap->swapped = false;
+        } else if (magic == CAPTURE_MMAP_PCAPNG_MAGIC_SWAPPED) {
+            mmap->swapped = true;
+        } else {
+            return -1;
+        }
+        // Interface ids start again in each section
+        mmap->ifaces_count = 0;
+    }
+
+    type = capture_mmap_read32(mmap, block);
+    len = capture_mmap_read32(mmap, block + 4);
+    if (len < 12 || len % 4 != 0 || len > mmap->size - offset)
+        return -1;
+    *next = offset + len;
+
+    if (type == CAPTURE_MMAP_PCAPNG_IDB) {
+        capture_mmap_pcapng_iface(mmap, block, len);
+        return 1;
+    }
+
+    if (type != CAPTURE_MMAP_PCAPNG_EPB || len < CAPTURE_MMAP_PCAPNG_EPB_HDR + 4)
+        return 1;
+
+    header->caplen = capture_mmap_read32(mmap, block + 20);
+    header->len = capture_mmap_read32(mmap, block + 24);
+    if (header->caplen > len - CAPTURE_MMAP_PCAPNG_EPB_HDR - 4)
+        return -1;
+
+    // Frames of other link types can not be decoded
+    id = capture_mmap_read32(mmap, block + 8);
+    if (id >= mmap->ifaces_count || mmap->ifaces[id].link != mmap->link)
+        return 1;
+    iface = &mmap->ifaces[id];
+
+    ts = ((uint64_t) capture_mmap_read32(mmap, block + 12) << 32) | capture_mmap_read32(mmap, block + 16);
+    header->ts.tv_sec = ts / iface->units;
+    if (iface->units >= 1000000 && iface->units % 1000000 == 0) {
+        header->ts.tv_usec = (ts % iface->units) / (iface->units / 1000000);
+    } else {
+        header->ts.tv_usec = (double) (ts % iface->units) * 1000000 / iface->units;
+    }
+
+    *data = block + CAPTURE_MMAP_PCAPNG_EPB_HDR;
+    return 0;
+}
+
+void
+capture_mmap_pcapng_iface(capture_mmap_t *mmap, const u_char *block, uint32_t len)
+{
+    capture_mmap_iface_t *iface;
+    uint32_t offset = 16;
+    uint16_t code, optlen;
+    uint8_t tsresol;
+
+    if (len < 20)
+        return;
+
+    if (mmap->ifaces_count == mmap->ifaces_size) {
+        mmap->ifaces_size = mmap->ifaces_size ? mmap->ifaces_size * 2 : 4;
+        mmap->ifaces = realloc(mmap->ifaces, sizeof(capture_mmap_iface_t) * mmap->ifaces_size);
+    }
+
+    iface = &mmap->ifaces[mmap->ifaces_count++];
+    iface->link = capture_mmap_read16(mmap, block + 8);
+    // Microseconds resolution unless if_tsresol option is found
+    iface->units = 1000000;
+
+    while (offset + 4 <= len - 4) {
+        code = capture_mmap_read16(mmap, block + offset);
+        optlen = capture_mmap_read16(mmap, block + offset + 2);
+        if (code == 0 || offset + 4 + optlen > len - 4)
+            break;
+        if (code == CAPTURE_MMAP_PCAPNG_TSRESOL && optlen >= 1) {
+            tsresol = block[offset + 4];
+            // Power of 2 or power of 10 units (not representable ones are ignored)
+            if (tsresol & 0x80) {
+                if ((tsresol & 0x7f) < 64)
+                    iface->units = (uint64_t) 1 << (tsresol & 0x7f);
+            } else if (tsresol <= 19) {
+                iface->units = 1;
+                while (tsresol--)
+                    iface->units *= 10;
+            }
+        }
+        offset += 4 + ((optlen + 3) & ~3);
+    }
+}
+
+void
+capture_mmap_worker_thread(void *info)
+{
+    capture_mmap_worker_t *worker = (capture_mmap_worker_t *) info;
+    capture_info_t *capinfo = worker->capinfo;
+    frame_buffer_t *frame;
+    packet_t *packet;
+
+    affinity_apply(AFFINITY_PARSER);
+
+    while (!capinfo->stopping) {
+        if ((frame = ring_pop(capinfo->ring))) {
+            // Queue all packets completed by this frame
+            LATENCY_START(packet_start);
+            packet = parse_packet(capinfo, frame);
+            LATENCY_RECORD(LATENCY_PACKET, packet_start);
+            if (packet)
+                capture_mmap_worker_output(worker, packet);
+            while ((packet = capture_tcp_stream_next(capinfo)))
+                capture_mmap_worker_output(worker, packet);
+            capture_mmap_worker_output(worker, NULL);
+            capture_reasm_publish(capinfo);
+            continue;
+        }
+
+        // All frames have been decoded
+        if (capinfo->eof && ring_count(capinfo->ring) == 0)
+            break;
+
+        // Wait until reader thread queues more frames
+        capture_parser_wait(capinfo, capinfo->ring);
+    }
+
+    capinfo->running = false;
+}
+
+void
+capture_mmap_worker_output(capture_mmap_worker_t *worker, packet_t *packet)
+{
+    void *item = (packet) ? (void *) packet : (void *) &capture_mmap_frame_end;
+
+    while (ring_push(worker->decoded, item) != 0) {
+        // Nobody is going to process this packet
+        if (worker->capinfo->stopping) {
+            if (packet)
+                packet_destroy(packet);
+            return;
+        }
+        capture_parser_wakeup(worker->source, false);
+        usleep(100);
+    }
+
+    // Notify parser once per frame
+    if (!packet)
+        capture_parser_wakeup(worker->source, false);
+}
+
+packet_t *
+capture_mmap_next(capture_info_t *capinfo)
+{
+    capture_mmap_t *mmap = capinfo->mmap;
+    void *item;
+
+    for (;;) {
+        // Get the worker that decoded next frame
+        if (!mmap->current && !(mmap->current = ring_pop(capinfo->ring)))
+            return NULL;
+
+        // Worker is still decoding this frame
+        if (!(item = ring_pop(mmap->current->decoded)))
+            return NULL;
+
+        // All packets of this frame have been returned
+        if (item == &capture_mmap_frame_end) {
+            mmap->current = NULL;
+            continue;
+        }
+
+        return item;
+    }
+}
+
+ring_t *
+capture_mmap_ring(capture_info_t *capinfo)
+{
+    capture_mmap_t *mmap = capinfo->mmap;
+    return (mmap->current) ? mmap->current->decoded : capinfo->ring;
+}
+
+capture_mmap_worker_t *
+capture_mmap_flow_worker(capture_info_t *capinfo, const u_char *data, uint32_t len)
+{
+    capture_mmap_t *mmap = capinfo->mmap;
+    uint32_t link_hl = capinfo->link_decode(data, len, capinfo->link_hl), hash = 0, i;
+    const u_char *ip;
+
+    // Combine source and destination addresses so both directions match.
+    // Frames without addresses are handled by first worker
+    ip = data + link_hl;
+    if (link_hl < len) {
+        if ((ip[0] >> 4) == 4 && link_hl + 20 <= len) {
+            for (i = 0; i < 4; i++)
+                hash = hash * 31 + (ip[12 + i] ^ ip[16 + i]);
+        } else if ((ip[0] >> 4) == 6 && link_hl + 40 <= len) {
+            for (i = 0; i < 16; i++)
+                hash = hash * 31 + (ip[8 + i] ^ ip[24 + i]);
+        }
+    }
+
+    return &mmap->workers[(hash ^ (hash >> 16)) % mmap->count];
+}
+
+uint32_t
+capture_mmap_read32(capture_mmap_t *mmap, const u_char *data)
+{
+    uint32_t value;
+
+    memcpy(&value, data, sizeof(value));
+    if (!mmap->swapped)
+        return value;
+
+    return ((value & 0xff) << 24) | ((value & 0xff00) << 8)
+           | ((value >> 8) & 0xff00) | (value >> 24);
+}
+
+uint16_t
+capture_mmap_read16(capture_mmap_t *mmap, const u_char *data)
+{
+    uint16_t value;
+
+    memcpy(&value, data, sizeof(value));
+    if (!mmap->swapped)
+        return value;
+
+    return (uint16_t) ((value << 8) | (value >> 8));
+}
+
+void
+capture_mmap_store_packet(capture_info_t *capinfo, packet_t *packet)
+{
+    capture_mmap_t *mmap = capinfo->mmap;
+    frame_t *frame;
+    const u_char *data;
+
+    if (!mmap || !mmap->lazy || !packet)
+        return;
+
+    vector_iter_t it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        // Only frames read from the mapped file records
+        if (frame->segment || !frame->buffer || !frame->buffer->offset)
+            continue;
+
+        data = mmap->map + frame->buffer->offset
+               + (mmap->pcapng ? CAPTURE_MMAP_PCAPNG_EPB_HDR : CAPTURE_MMAP_RECORD_HDR);
+
+        // Payload pointing to this frame will be copied from the file
+        if (packet->payload_ref && packet->payload >= frame->data
+                && packet->payload <= frame->data + frame->header->caplen) {
+            packet_set_payload_source(packet, data + (packet->payload - frame->data));
+        }
+
+        // Keep frame header, it is used for packet timestamps
+        frame->header = malloc(sizeof(struct pcap_pkthdr));
+        memcpy(frame->header, &frame->buffer->header, sizeof(struct pcap_pkthdr));
+        frame_buffer_destroy(frame->buffer);
+        frame->buffer = NULL;
+        frame->data = (u_char *) data;
+        frame->segment = capture_disk_segment_ref(mmap->segment);
+    }
+}
+
+size_t
+capture_mmap_loaded(capture_info_t *capinfo)
+{
+    return atomic_load(&capinfo->mmap->offset);
+}
+
+void
+capture_mmap_evicted(capture_info_t *capinfo, unsigned long *frags, unsigned long *streams)
+{
+    capture_mmap_t *mmap = capinfo->mmap;
+
+    for (uint32_t i = 0; i < mmap->count; i++) {
+        *frags += atomic_load(&mmap->workers[i].capinfo->ip_reasm_evicted);
+        *streams += atomic_load(&mmap->workers[i].capinfo->tcp_reasm_evicted);
+    }
+}
+
+void
+capture_mmap_stats(capture_info_t *capinfo, capture_stats_t *stats)
+{
+    capture_mmap_t *mmap = capinfo->mmap;
+    capture_info_t *wcapinfo;
+
+    for (uint32_t i = 0; i < mmap->count; i++) {
+        wcapinfo = mmap->workers[i].capinfo;
+        stats->frames += atomic_load_explicit(&wcapinfo->frames, memory_order_relaxed);
+        stats->bytes += atomic_load_explicit(&wcapinfo->bytes, memory_order_relaxed);
+        stats->ip_reasm_pending += atomic_load_explicit(&wcapinfo->ip_reasm_pending, memory_order_relaxed);
+        stats->ip_reasm_memory += atomic_load_explicit(&wcapinfo->ip_reasm_memory, memory_order_relaxed);
+        stats->tcp_reasm_pending += atomic_load_explicit(&wcapinfo->tcp_reasm_pending, memory_order_relaxed);
+        stats->tcp_reasm_memory += atomic_load_explicit(&wcapinfo->tcp_reasm_memory, memory_order_relaxed);
+        stats->ip_reasm_evicted += atomic_load(&wcapinfo->ip_reasm_evicted);
+        stats->tcp_reasm_evicted += atomic_load(&wcapinfo->tcp_reasm_evicted);
+    }
+}
+
+int
+capture_mmap_set_filter(capture_info_t *capinfo, const char *filter)
+{
+    capture_mmap_t *mmap = capinfo->mmap;
+
+    // Records are not read by libpcap, so filter is applied to each one
+    if (pcap_compile(capinfo->handle, &mmap->fp, filter, 0, capinfo->mask) == -1)
+        return 1;
+
+    mmap->filtered = true;
+    return 0;
+}
+
+void
+capture_mmap_close(capture_info_t *capinfo)
+{
+    capture_mmap_t *mmap = capinfo->mmap;
+    capture_info_t *wcapinfo;
+    frame_buffer_t *frame;
+    void *item;
+
+    if (!mmap)
+        return;
+
+    // Forget workers of frames pending to be processed
+    if (capinfo->ring) {
+        while (ring_pop(capinfo->ring));
+    }
+
+    for (uint32_t i = 0; i < mmap->count; i++) {
+        wcapinfo = mmap->workers[i].capinfo;
+
+        // Worker threads have been launched
+        if (wcapinfo->ring) {
+            wcapinfo->stopping = true;
+            capture_parser_wakeup(wcapinfo, true);
+            pthread_join(wcapinfo->parser_t, NULL);
+
+            // Discard frames and packets that have not been processed
+            while ((frame = ring_pop(wcapinfo->ring)))
+                frame_buffer_destroy(frame);
+            ring_destroy(wcapinfo->ring);
+            pthread_cond_destroy(&wcapinfo->ring_cond);
+            pthread_mutex_destroy(&wcapinfo->ring_lock);
+        }
+
+        if (mmap->workers[i].decoded) {
+            while ((item = ring_pop(mmap->workers[i].decoded))) {
+                if (item != &capture_mmap_frame_end)
+                    packet_destroy(item);
+            }
+            ring_destroy(mmap->workers[i].decoded);
+        }
+
+        capture_reasm_destroy(wcapinfo);
+        sng_free(wcapinfo);
+    }
+
+    if (mmap->filtered)
+        pcap_freecode(&mmap->fp);
+    capture_disk_segment_release(mmap->segment);
+    sng_free(mmap->ifaces);
+    capture_index_close(capinfo->index);
+    capinfo->index = NULL;
+    sng_free(mmap->workers);
+    sng_free(mmap);
+    capinfo->mmap = NULL;
+}
@@ -0,0 +1,295 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_mmap.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to load pcap files using multiple decoding threads
+ *
+ * Input file is mapped in memory and its records are handed to a pool of
+ * workers. Frames of the same IP addresses pair are always decoded by the
+ * same worker, so each one keeps its own IP and TCP reassembly data.
+ * Decoded packets are processed in the same order their last frame was
+ * stored in the file, so dialogs are built exactly as if the file had been
+ * read by a single thread.
+ *
+ * Both classic pcap and pcapng files are read directly from the mapping.
+ * pcapng frames from interfaces with a link type different from the first
+ * one are skipped, as libpcap does.
+ */
+#ifndef __SNGREP_CAPTURE_MMAP_H
+#define __SNGREP_CAPTURE_MMAP_H
+
+#include "config.h"
+#include <stdint.h>
+#include <stdatomic.h>
+#include "capture.h"
+#include "capture_disk.h"
+
+//! Default max number of decoding workers per input file
+#define CAPTURE_MMAP_WORKERS    4
+//! Classic pcap file magic numbers (microseconds and nanoseconds timestamps)
+#define CAPTURE_MMAP_MAGIC      0xa1b2c3d4
+#define CAPTURE_MMAP_MAGIC_NSEC 0xa1b23c4d
+//! Classic pcap file header length
+#define CAPTURE_MMAP_FILE_HDR   24
+//! Classic pcap record header length
+#define CAPTURE_MMAP_RECORD_HDR 16
+//! pcapng block types and byte order magic
+#define CAPTURE_MMAP_PCAPNG_SHB 0x0A0D0D0A
+#define CAPTURE_MMAP_PCAPNG_IDB 0x00000001
+#define CAPTURE_MMAP_PCAPNG_EPB 0x00000006
+#define CAPTURE_MMAP_PCAPNG_MAGIC 0x1A2B3C4D
+#define CAPTURE_MMAP_PCAPNG_MAGIC_SWAPPED 0x4D3C2B1A
+//! Length of pcapng Enhanced Packet Block fields before frame data
+#define CAPTURE_MMAP_PCAPNG_EPB_HDR 28
+//! pcapng interface timestamp resolution option
+#define CAPTURE_MMAP_PCAPNG_TSRESOL 9
+
+//! Shorter declaration of capture_mmap structure
+typedef struct capture_mmap capture_mmap_t;
+//! Shorter declaration of capture_mmap_worker structure
+typedef struct capture_mmap_worker capture_mmap_worker_t;
+//! Shorter declaration of capture_mmap_iface structure
+typedef struct capture_mmap_iface capture_mmap_iface_t;
+
+/**
+ * @brief Interface described in a pcapng file
+ */
+struct capture_mmap_iface
+{
+    //! Link type of interface frames
+    int link;
+    //! Timestamp units per second
+    uint64_t units;
+};
+
+/**
+ * @brief Decoding thread of a mapped input file
+ */
+struct capture_mmap_worker
+{
+    //! Reassembly data and frames pending to be decoded by this worker
+    capture_info_t *capinfo;
+    //! Input file source this worker decodes frames for
+    capture_info_t *source;
+    //! Decoded packets pending to be processed (packet_t)
+    ring_t *decoded;
+};
+
+/**
+ * @brief Mapped input file data
+ */
+struct capture_mmap
+{
+    //! Mapped file contents
+    const u_char *map;
+    //! Mapped file length
+    size_t size;
+    //! Mapping shared with frames that keep their data in the file
+    capture_disk_segment_t *segment;
+    //! Stored frames data is read from the file instead of memory
+    bool lazy;
+    //! Offset of the next record to be read
+    atomic_size_t offset;
+    //! Read ahead requests of mapped file
+    capture_readahead_t readahead;
+    //! File records are stored in the opposite byte order
+    bool swapped;
+    //! File records timestamps have nanosecond precision
+    bool nsec;
+    //! File is stored in pcapng format
+    bool pcapng;
+    //! Link type of the frames that can be decoded
+    int link;
+    //! Interfaces of current pcapng section
+    capture_mmap_iface_t *ifaces;
+    //! Number of interfaces and allocated size
+    uint32_t ifaces_count, ifaces_size;
+    //! Decoding workers
+    capture_mmap_worker_t *workers;
+    //! Number of decoding workers
+    uint32_t count;
+    //! Worker decoding the frame whose packets are being processed
+    capture_mmap_worker_t *current;
+    //! Compiled capture filter (applied while reading records)
+    struct bpf_program fp;
+    //! Capture filter has been set
+    bool filtered;
+};
+
+/**
+ * @brief Map an input file to load it using decoding workers
+ *
+ * Only classic pcap and pcapng regular files are mapped. Files that can not be
+ * mapped are read from the libpcap handler as usual.
+ *
+ * @param capinfo Offline capture source with an opened libpcap handler
+ * @return 0 if file will be loaded by workers, 1 otherwise
+ */
+int
+capture_mmap_open(capture_info_t *capinfo);
+
+/**
+ * @brief Start decoding threads of a mapped input file
+ *
+ * @return 0 on success, 1 otherwise
+ */
+int
+capture_mmap_launch(capture_info_t *capinfo);
+
+/**
+ * @brief Read all records from the mapped file
+ *
+ * Each frame is queued to the worker of its addresses and the worker is
+ * queued in the source ring, so packets can be processed in file order.
+ */
+void
+capture_mmap_loop(capture_info_t *capinfo);
+
+/**
+ * @brief Read a record of the mapped file
+ *
+ * @param offset File offset of the record
+ * @param header Frame header filled if record is a frame
+ * @param data Frame data if record is a frame
+ * @param next File offset of next record
+ * @return 0 if record is a frame, 1 if it must be skipped, -1 at the end
+ * of the file or if the record has been truncated
+ */
+int
+capture_mmap_record(capture_mmap_t *mmap, size_t offset, struct pcap_pkthdr *header,
+                    const u_char **data, size_t *next);
+
+/**
+ * @brief Read a pcapng block of the mapped file
+ *
+ * Same return values than capture_mmap_record. Section and interfaces
+ * blocks update the file reading data.
+ */
+int
+capture_mmap_pcapng_block(capture_mmap_t *mmap, size_t offset, struct pcap_pkthdr *header,
+                          const u_char **data, size_t *next);
+
+/**
+ * @brief Add an interface from a pcapng Interface Description Block
+ */
+void
+capture_mmap_pcapng_iface(capture_mmap_t *mmap, const u_char *block, uint32_t len);
+
+/**
+ * @brief Decoding worker thread function
+ */
+void
+capture_mmap_worker_thread(void *info);
+
+/**
+ * @brief Queue a decoded packet to be processed
+ *
+ * @param worker Worker that decoded the packet
+ * @param packet Decoded packet or NULL to mark the end of current frame
+ */
+void
+capture_mmap_worker_output(capture_mmap_worker_t *worker, packet_t *packet);
+
+/**
+ * @brief Get next decoded packet in file order
+ *
+ * @return next packet or NULL if it has not been decoded yet
+ */
+packet_t *
+capture_mmap_next(capture_info_t *capinfo);
+
+/**
+ * @brief Get the ring next decoded packet will be read from
+ *
+ * This is the worker ring of the frame being processed or the source ring
+ * if all packets from the previous frame have been processed.
+ */
+ring_t *
+capture_mmap_ring(capture_info_t *capinfo);
+
+/**
+ * @brief Get worker for a captured frame based on its IP addresses
+ *
+ * Both directions of the same addresses pair will get the same worker.
+ */
+capture_mmap_worker_t *
+capture_mmap_flow_worker(capture_info_t *capinfo, const u_char *data, uint32_t len);
+
+/**
+ * @brief Read a 32 bits value from the mapped file in host byte order
+ */
+uint32_t
+capture_mmap_read32(capture_mmap_t *mmap, const u_char *data);
+
+/**
+ * @brief Read a 16 bits value from the mapped file in host byte order
+ */
+uint16_t
+capture_mmap_read16(capture_mmap_t *mmap, const u_char *data);
+
+/**
+ * @brief Release the memory of a processed packet, keeping it in the file
+ *
+ * If capture.offline.lazy is enabled, frames data of packets that are
+ * going to be stored points to the mapped file records and their payload
+ * is only copied again when it is requested.
+ */
+void
+capture_mmap_store_packet(capture_info_t *capinfo, packet_t *packet);
+
+/**
+ * @brief Get the number of already read bytes of the mapped file
+ */
+size_t
+capture_mmap_loaded(capture_info_t *capinfo);
+
+/**
+ * @brief Get the number of fragments and connections discarded by workers
+ */
+void
+capture_mmap_evicted(capture_info_t *capinfo, unsigned long *frags, unsigned long *streams);
+
+/**
+ * @brief Add frames and reassembly counters of decoding workers
+ */
+void
+capture_mmap_stats(capture_info_t *capinfo, capture_stats_t *stats);
+
+/**
+ * @brief Set a bpf filter for a mapped input file
+ *
+ * @return 0 if valid, 1 otherwise
+ */
+int
+capture_mmap_set_filter(capture_info_t *capinfo, const char *filter);
+
+/**
+ * @brief Stop decoding workers and unmap input file
+ *
+ * Parser thread of capture source must have been stopped before.
+ */
+void
+capture_mmap_close(capture_info_t *capinfo);
+
+#endif /* __SNGREP_CAPTURE_MMAP_H */
@@ -31,19 +31,37 @@
  */
 
 #include <unistd.h>
+#include <pthread.h>
 #include "capture.h"
 #include "capture_openssl.h"
+#include "capture_keylog.h"
 #include "option.h"
 #include "util.h"
 #include "sip.h"
-
-struct SSLConnection *connections;
+#include "setting.h"
+
+//! Detected connections (struct SSLConnection)
+static vector_t *connections;
+//! Detected connections indexed by their addresses
+static htable_t *connections_index;
+//! Seconds a connection is kept without receiving any segment
+static time_t connections_timeout;
+//! Capture time of next search for idle connections
+static time_t connections_sweep;
+//! Protects connections storage from concurrent decrypting threads
+static pthread_mutex_t connections_lock = PTHREAD_MUTEX_INITIALIZER;
 
 struct CipherData ciphers[] = {
 /*  { number, encoder,    ivlen, bits, digest, diglen, mode }, */
     { 0x002F, ENC_AES,    16, 128, DIG_SHA1,   20, MODE_CBC },   /* TLS_RSA_WITH_AES_128_CBC_SHA     */
     { 0x0035, ENC_AES256, 16, 256, DIG_SHA1,   20, MODE_CBC },   /* TLS_RSA_WITH_AES_256_CBC_SHA     */
     { 0x009d, ENC_AES256, 4,  256, DIG_SHA384, 48, MODE_GCM },   /* TLS_RSA_WITH_AES_256_GCM_SHA384  */
+    { 0x0033, ENC_AES,    16, 128, DIG_SHA1,   20, MODE_CBC },   /* TLS_DHE_RSA_WITH_AES_128_CBC_SHA */
+    { 0x0039, ENC_AES256, 16, 256, DIG_SHA1,   20, MODE_CBC },   /* TLS_DHE_RSA_WITH_AES_256_CBC_SHA */
+    { 0xC009, ENC_AES,    16, 128, DIG_SHA1,   20, MODE_CBC },   /* TLS_ECDHE_ECDSA_WITH_AES_128_CBC_SHA */
+    { 0xC00A, ENC_AES256, 16, 256, DIG_SHA1,   20, MODE_CBC },   /* TLS_ECDHE_ECDSA_WITH_AES_256_CBC_SHA */
+    { 0xC013, ENC_AES,    16, 128, DIG_SHA1,   20, MODE_CBC },   /* TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA */
+    { 0xC014, ENC_AES256, 16, 256, DIG_SHA1,   20, MODE_CBC },   /* TLS_ECDHE_RSA_WITH_AES_256_CBC_SHA */
     { 0,      0,          0,  0,   0,          0,  0        }
 };
 
@@ -190,39 +208,69 @@ PRF(struct SSLConnection *conn,
     return dlen;
 }
 
-struct SSLConnection *
-tls_connection_create(struct in_addr caddr, uint16_t cport, struct in_addr saddr, uint16_t sport) {
-    struct SSLConnection *conn = NULL;
-    conn = sng_malloc(sizeof(struct SSLConnection));
+EVP_PKEY *
+tls_load_key()
+{
+    static SSL_CTX *ssl_ctx = NULL;
+    static SSL *ssl = NULL;
 
-    memcpy(&conn->client_addr, &caddr, sizeof(struct in_addr));
-    memcpy(&conn->server_addr, &saddr, sizeof(struct in_addr));
-    memcpy(&conn->client_port, &cport, sizeof(uint16_t));
-    memcpy(&conn->server_port, &sport, sizeof(uint16_t));
+    // Key is loaded once and shared by all connections
+    if (ssl)
+        return SSL_get_privatekey(ssl);
 
 #if MODSSL_USE_OPENSSL_PRE_1_1_API
     SSL_library_init();
     ERR_load_crypto_strings();
     OpenSSL_add_all_algorithms();
 
-    if (!(conn->ssl_ctx = SSL_CTX_new(SSLv23_server_method())))
+    if (!(ssl_ctx = SSL_CTX_new(SSLv23_server_method())))
 #else
-    if (!(conn->ssl_ctx = SSL_CTX_new(TLS_server_method())))
+    if (!(ssl_ctx = SSL_CTX_new(TLS_server_method())))
 #endif
         return NULL;
 
-    SSL_CTX_use_PrivateKey_file(conn->ssl_ctx, capture_keyfile(),
-                                SSL_FILETYPE_PEM);
-    if (!(conn->ssl = SSL_new(conn->ssl_ctx)))
+    if (!SSL_CTX_use_PrivateKey_file(ssl_ctx, capture_keyfile(), SSL_FILETYPE_PEM)
+            || !(ssl = SSL_new(ssl_ctx))) {
+        SSL_CTX_free(ssl_ctx);
+        ssl_ctx = NULL;
+        return NULL;
+    }
+
+    return SSL_get_privatekey(ssl);
+}
+
+struct SSLConnection *
+tls_connection_create(struct in_addr caddr, uint16_t cport, struct in_addr saddr, uint16_t sport) {
+    struct SSLConnection *conn = NULL;
+    EVP_PKEY *spkey;
+
+    // Without a private key, master secrets can only be read from key log file
+    spkey = (capture_keyfile()) ? tls_load_key() : NULL;
+    if (!spkey && !capture_keylogfile())
         return NULL;
 
-    conn->server_private_key = SSL_get_privatekey(conn->ssl);
+    // Create connections storage on first connection
+    if (!connections) {
+        connections = vector_create(64, 64);
+        connections_index = htable_create(TLS_CONNECTION_HASH);
+        connections_timeout = setting_get_intvalue(SETTING_CAPTURE_TLS_TIMEOUT);
+    }
+
+    conn = sng_malloc(sizeof(struct SSLConnection));
+
+    memcpy(&conn->client_addr, &caddr, sizeof(struct in_addr));
+    memcpy(&conn->server_addr, &saddr, sizeof(struct in_addr));
+    memcpy(&conn->client_port, &cport, sizeof(uint16_t));
+    memcpy(&conn->server_port, &sport, sizeof(uint16_t));
+
+    conn->server_private_key = spkey;
     conn->client_cipher_ctx = EVP_CIPHER_CTX_new();
     conn->server_cipher_ctx = EVP_CIPHER_CTX_new();
 
     // Add this connection to the list
-    conn->next = connections;
-    connections = conn;
+    tls_connection_key(conn->key, caddr, cport, saddr, sport);
+    vector_append(connections, conn);
+    htable_insert(connections_index, conn->key, conn);
 
     return conn;
 }
@@ -230,28 +278,31 @@ tls_connection_create(struct in_addr caddr, uint16_t cport, struct in_addr saddr
 void
 tls_connection_destroy(struct SSLConnection *conn)
 {
-    struct SSLConnection *c;
-
     // Remove connection from connections list
-    if (conn == connections) {
-        connections = conn->next;
-    } else {
-        for (c = connections; c; c = c->next) {
-            if (c->next == conn) {
-                c->next = conn->next;
-                break;
-            }
-        }
-    }
+    htable_remove(connections_index, conn->key);
+    vector_remove(connections, conn);
 
     // Deallocate connection memory
     EVP_CIPHER_CTX_free(conn->client_cipher_ctx);
     EVP_CIPHER_CTX_free(conn->server_cipher_ctx);
-    SSL_CTX_free(conn->ssl_ctx);
-    SSL_free(conn->ssl);
+    sng_free(conn->key_material.client_write_MAC_key);
+    sng_free(conn->key_material.server_write_MAC_key);
+    sng_free(conn->key_material.client_write_IV);
+    sng_free(conn->key_material.server_write_IV);
+    sng_free(conn->key_material.client_write_key);
+    sng_free(conn->key_material.server_write_key);
     sng_free(conn);
 }
 
+void
+tls_connection_close(struct SSLConnection *conn)
+{
+    // Other threads could be using connections storage
+    pthread_mutex_lock(&connections_lock);
+    tls_connection_destroy(conn);
+    pthread_mutex_unlock(&connections_lock);
+}
+
 /**
  * FIXME Replace this with a tls_load_key function and use it
  * in tls_connection_create.
@@ -307,21 +358,46 @@ tls_connection_dir(struct SSLConnection *conn, struct in_addr addr, uint16_t por
     return -1;
 }
 
+void
+tls_connection_key(char *key, struct in_addr src, uint16_t sport, struct in_addr dst, uint16_t dport)
+{
+    uint32_t saddr = ntohl(src.s_addr), daddr = ntohl(dst.s_addr);
+
+    // Both directions of the connection use the same key
+    if (saddr < daddr || (saddr == daddr && sport < dport)) {
+        sprintf(key, "%08x:%04x-%08x:%04x", saddr, sport, daddr, dport);
+    } else {
+        sprintf(key, "%08x:%04x-%08x:%04x", daddr, dport, saddr, sport);
+    }
+}
+
 struct SSLConnection*
 tls_connection_find(struct in_addr src, uint16_t sport, struct in_addr dst, uint16_t dport) {
+    char key[TLS_CONNECTION_KEYLEN];
+
+    if (!connections_index)
+        return NULL;
+
+    tls_connection_key(key, src, sport, dst, dport);
+    return htable_find(connections_index, key);
+}
+
+void
+tls_connection_expire(time_t now)
+{
     struct SSLConnection *conn;
+    int i;
 
-    for (conn = connections; conn; conn = conn->next) {
-        if (tls_connection_dir(conn, src, sport) == 0 &&
-                tls_connection_dir(conn, dst, dport) == 1) {
-            return conn;
-        }
-        if (tls_connection_dir(conn, src, sport) == 1 &&
-                tls_connection_dir(conn, dst, dport) == 0) {
-            return conn;
-        }
+    // Don't check all connections for every segment
+    if (!connections || now < connections_sweep)
+        return;
+    connections_sweep = now + 1;
+
+    for (i = vector_count(connections) - 1; i >= 0; i--) {
+        conn = vector_item(connections, i);
+        if (conn->last + connections_timeout < now)
+            tls_connection_destroy(conn);
     }
-    return NULL;
 }
 
 int
@@ -339,13 +415,20 @@ tls_process_segment(packet_t *packet, struct tcphdr *tcp)
     address_t tlsserver = capture_tls_server();
 
     // Convert addresses
-    inet_pton(AF_INET, packet->src.ip, &ip_src);
-    inet_pton(AF_INET, packet->dst.ip, &ip_dst);
+    ip_src = packet->src.ip.v4;
+    ip_dst = packet->dst.ip.v4;
+
+    // Discard connections that are not receiving data anymore
+    pthread_mutex_lock(&connections_lock);
+    tls_connection_expire(packet_time(packet).tv_sec);
 
     // Try to find a session for this ip
     if ((conn = tls_connection_find(ip_src, sport, ip_dst, dport))) {
-        // Update last connection direction
+        // Update last connection direction and activity
         conn->direction = tls_connection_dir(conn, ip_src, sport);
+        conn->last = packet_time(packet).tv_sec;
+        // Connection state is only used by the thread decrypting its segments
+        pthread_mutex_unlock(&connections_lock);
 
         // Check current connection state
         switch (conn->state) {
@@ -382,7 +465,7 @@ tls_process_segment(packet_t *packet, struct tcphdr *tcp)
             case TCP_STATE_FIN:
             case TCP_STATE_CLOSED:
                 // We can delete this connection
-                tls_connection_destroy(conn);
+                tls_connection_close(conn);
                 break;
         }
     } else {
@@ -391,13 +474,16 @@ tls_process_segment(packet_t *packet, struct tcphdr *tcp)
             if (tlsserver.port) {
                 if (addressport_equals(tlsserver, packet->dst)) {
                     // New connection, store it status and leave
-                    tls_connection_create(ip_src, sport, ip_dst, dport);
+                    if ((conn = tls_connection_create(ip_src, sport, ip_dst, dport)))
+                        conn->last = packet_time(packet).tv_sec;
                 }
             } else {
                 // New connection, store it status and leave
-                tls_connection_create(ip_src, sport, ip_dst, dport);
+                if ((conn = tls_connection_create(ip_src, sport, ip_dst, dport)))
+                    conn->last = packet_time(packet).tv_sec;
             }
         }
+        pthread_mutex_unlock(&connections_lock);
     }
 
     sng_free(out);
@@ -458,7 +544,7 @@ tls_process_record_ssl2(struct SSLConnection *conn, const uint8_t *payload,
 
         // Check we have a TLS handshake
         if (clienthello->client_version.major != 0x03) {
-            tls_connection_destroy(conn);
+            tls_connection_close(conn);
             return 1;
         }
 
@@ -466,7 +552,7 @@ tls_process_record_ssl2(struct SSLConnection *conn, const uint8_t *payload,
         if (clienthello->client_version.minor != 0x01
                 && clienthello->client_version.minor != 0x02
                 && clienthello->client_version.minor != 0x03) {
-            tls_connection_destroy(conn);
+            tls_connection_close(conn);
             return 1;
         }
 
@@ -513,6 +599,11 @@ tls_process_record(struct SSLConnection *conn, const uint8_t *payload,
                     return 1;
                 break;
             case change_cipher_spec:
+                // Resumed sessions have no key exchange, use the logged master secret
+                if (!conn->key_material.client_write_key && conn->cipher_data.enc
+                        && capture_keylog_find((const uint8_t *) &conn->client_random, conn->master_secret.random) == 0)
+                    tls_connection_load_keys(conn);
+
                 // From now on, this connection will be encrypted using MasterSecret
 #if MODSSL_USE_OPENSSL_PRE_1_1_API
                 if (conn->client_cipher_ctx->cipher && conn->server_cipher_ctx->cipher)
@@ -569,7 +660,7 @@ tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment,
 
                 // Check we have a TLS handshake
                 if (!(clienthello->client_version.major == 0x03)) {
-                    tls_connection_destroy(conn);
+                    tls_connection_close(conn);
                     return 1;
                 }
 
@@ -577,7 +668,7 @@ tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment,
                 if (clienthello->client_version.minor != 0x01
                         && clienthello->client_version.minor != 0x02
                         && clienthello->client_version.minor != 0x03) {
-                    tls_connection_destroy(conn);
+                    tls_connection_close(conn);
                     return 1;
                 }
 
@@ -594,7 +685,7 @@ tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment,
                        sizeof(uint16_t));
                 // Check if we have a handled cipher
                 if (tls_connection_load_cipher(conn) != 0) {
-                    tls_connection_destroy(conn);
+                    tls_connection_close(conn);
                     return 1;
                 }
                 break;
@@ -604,112 +695,53 @@ tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment,
             case certificate_verify:
                 break;
             case client_key_exchange:
-                // Decrypt PreMasterKey
-                clientkeyex = (struct ClientKeyExchange *) body;
+                // Master secret logged by one of the endpoints
+                if (capture_keylog_find((const uint8_t *) &conn->client_random, conn->master_secret.random) != 0) {
+                    // Without a logged secret, only RSA key exchange can be decrypted
+                    if (!conn->server_private_key) {
+                        tls_connection_close(conn);
+                        return 1;
+                    }
+
+                    // Decrypt PreMasterKey
+                    clientkeyex = (struct ClientKeyExchange *) body;
 
 #if MODSSL_USE_OPENSSL_PRE_1_1_API
-                RSA_private_decrypt(UINT16_INT(clientkeyex->length),
-                                    (const unsigned char *) &clientkeyex->exchange_keys,
-                                    (unsigned char *) &conn->pre_master_secret,
-                                    conn->server_private_key->pkey.rsa, RSA_PKCS1_PADDING);
+                    RSA_private_decrypt(UINT16_INT(clientkeyex->length),
+                                        (const unsigned char *) &clientkeyex->exchange_keys,
+                                        (unsigned char *) &conn->pre_master_secret,
+                                        conn->server_private_key->pkey.rsa, RSA_PKCS1_PADDING);
 #else
-                RSA_private_decrypt(UINT16_INT(clientkeyex->length),
-                                    (const unsigned char *) &clientkeyex->exchange_keys,
-                                    (unsigned char *) &conn->pre_master_secret,
-                                    EVP_PKEY_get0_RSA(conn->server_private_key), RSA_PKCS1_PADDING);
+                    RSA_private_decrypt(UINT16_INT(clientkeyex->length),
+                                        (const unsigned char *) &clientkeyex->exchange_keys,
+                                        (unsigned char *) &conn->pre_master_secret,
+                                        EVP_PKEY_get0_RSA(conn->server_private_key), RSA_PKCS1_PADDING);
 #endif
 
-                tls_debug_print_hex("client_random", &conn->client_random, 32);
-                tls_debug_print_hex("server_random", &conn->server_random, 32);
-
-                uint8_t *seed = sng_malloc(sizeof(struct Random) * 2);
-                memcpy(seed, &conn->client_random, sizeof(struct Random));
-                memcpy(seed + sizeof(struct Random), &conn->server_random, sizeof(struct Random));
-
-                // Get MasterSecret
-                PRF(conn,
-                    (unsigned char *) &conn->master_secret, sizeof(struct MasterSecret),
-                    (unsigned char *) &conn->pre_master_secret, sizeof(struct PreMasterSecret),
-                    (unsigned char *) "master secret", seed, sizeof(struct Random) * 2);
-
-                tls_debug_print_hex("master_secret", conn->master_secret.random, 48);
-
-                memcpy(seed, &conn->server_random, sizeof(struct Random) * 2);
-                memcpy(seed + sizeof(struct Random), &conn->client_random, sizeof(struct Random));
-
-                int key_material_len = 0;
-                key_material_len += conn->cipher_data.diglen * 2;
-                key_material_len += conn->cipher_data.ivblock * 2;
-                key_material_len += conn->cipher_data.bits / 4;
-                uint8_t *key_material = sng_malloc(key_material_len);
-
-                // Generate MACs, Write Keys and IVs
-                PRF(conn,
-                    (unsigned char *) key_material, key_material_len,
-                    (unsigned char *) &conn->master_secret, sizeof(struct MasterSecret),
-                    (unsigned char *) "key expansion", seed, sizeof(struct Random) * 2);
-
-                // Get write mac keys
-                if (conn->cipher_data.mode == MODE_GCM) {
-                    // AEAD ciphers
-                    conn->key_material.client_write_MAC_key = 0;
-                    conn->key_material.server_write_MAC_key = 0;
-                } else {
-                    // Copy prf output to ssl connection key material
-                    int mk_len = conn->cipher_data.diglen;
-                    conn->key_material.client_write_MAC_key = sng_malloc(mk_len);
-                    tls_debug_print_hex("client_write_MAC_key", key_material, mk_len);
-                    memcpy(conn->key_material.client_write_MAC_key, key_material, mk_len);
-                    key_material += mk_len;
-                    conn->key_material.server_write_MAC_key = sng_malloc(mk_len);
-                    tls_debug_print_hex("server_write_MAC_key", key_material, mk_len);
-                    memcpy(conn->key_material.server_write_MAC_key, key_material, mk_len);
-                    key_material += mk_len;
-                }
+                    tls_debug_print_hex("client_random", &conn->client_random, 32);
+                    tls_debug_print_hex("server_random", &conn->server_random, 32);
 
-                // Get write keys
-                int wk_len = conn->cipher_data.bits / 8;
-                conn->key_material.client_write_key = sng_malloc(wk_len);
-                memcpy(conn->key_material.client_write_key, key_material, wk_len);
-                tls_debug_print_hex("client_write_key", key_material, wk_len);
-                key_material+=wk_len;
-
-                conn->key_material.server_write_key = sng_malloc(wk_len);
-                memcpy(conn->key_material.server_write_key, key_material, wk_len);
-                tls_debug_print_hex("server_write_key", key_material, wk_len);
-                key_material+=wk_len;
-
-                // Get IV blocks
-                conn->key_material.client_write_IV = sng_malloc(conn->cipher_data.ivblock);
-                memcpy(conn->key_material.client_write_IV, key_material, conn->cipher_data.ivblock);
-                tls_debug_print_hex("client_write_IV", key_material,  conn->cipher_data.ivblock);
-                key_material+=conn->cipher_data.ivblock;
-                conn->key_material.server_write_IV = sng_malloc(conn->cipher_data.ivblock);
-                memcpy(conn->key_material.server_write_IV, key_material, conn->cipher_data.ivblock);
-                tls_debug_print_hex("server_write_IV", key_material,  conn->cipher_data.ivblock);
-
-                // Done with the seed
-                sng_free(seed);
-
-                // Create Client decoder
-#if MODSSL_USE_OPENSSL_PRE_1_1_API
-                EVP_CIPHER_CTX_init(conn->client_cipher_ctx);
-#else
-                EVP_CIPHER_CTX_reset(conn->client_cipher_ctx);
-#endif
-                EVP_CipherInit(conn->client_cipher_ctx, conn->ciph,
-                               conn->key_material.client_write_key, conn->key_material.client_write_IV,
-                               0);
+                    uint8_t *seed = sng_malloc(sizeof(struct Random) * 2);
+                    memcpy(seed, &conn->client_random, sizeof(struct Random));
+                    memcpy(seed + sizeof(struct Random), &conn->server_random, sizeof(struct Random));
 
-#if MODSSL_USE_OPENSSL_PRE_1_1_API
-                EVP_CIPHER_CTX_init(conn->server_cipher_ctx);
-#else
-                EVP_CIPHER_CTX_reset(conn->server_cipher_ctx);
-#endif
-                EVP_CipherInit(conn->server_cipher_ctx, conn->ciph,
-                               conn->key_material.server_write_key, conn->key_material.server_write_IV,
-                               0);
+                    // Get MasterSecret
+                    PRF(conn,
+                        (unsigned char *) &conn->master_secret, sizeof(struct MasterSecret),
+                        (unsigned char *) &conn->pre_master_secret, sizeof(struct PreMasterSecret),
+                        (unsigned char *) "master secret", seed, sizeof(struct Random) * 2);
+
+                    tls_debug_print_hex("master_secret", conn->master_secret.random, 48);
 
+                    // Done with the seed
+                    sng_free(seed);
+                }
+
+                // Generate keys and create decoders
+                if (tls_connection_load_keys(conn) != 0) {
+                    tls_connection_close(conn);
+                    return 1;
+                }
                 break;
 #ifndef OLD_OPENSSL_VERSION
             case new_session_ticket:
@@ -810,3 +842,87 @@ tls_connection_load_cipher(struct SSLConnection *conn)
 
     return 0;
 }
+
+int
+tls_connection_load_keys(struct SSLConnection *conn)
+{
+    // Key expansion uses server random first
+    uint8_t *seed = sng_malloc(sizeof(struct Random) * 2);
+    memcpy(seed, &conn->server_random, sizeof(struct Random));
+    memcpy(seed + sizeof(struct Random), &conn->client_random, sizeof(struct Random));
+
+    int key_material_len = 0;
+    key_material_len += conn->cipher_data.diglen * 2;
+    key_material_len += conn->cipher_data.ivblock * 2;
+    key_material_len += conn->cipher_data.bits / 4;
+    uint8_t *key_material = sng_malloc(key_material_len);
+
+    // Generate MACs, Write Keys and IVs
+    PRF(conn,
+        (unsigned char *) key_material, key_material_len,
+        (unsigned char *) &conn->master_secret, sizeof(struct MasterSecret),
+        (unsigned char *) "key expansion", seed, sizeof(struct Random) * 2);
+
+    // Get write mac keys
+    if (conn->cipher_data.mode == MODE_GCM) {
+        // AEAD ciphers
+        conn->key_material.client_write_MAC_key = 0;
+        conn->key_material.server_write_MAC_key = 0;
+    } else {
+        // Copy prf output to ssl connection key material
+        int mk_len = conn->cipher_data.diglen;
+        conn->key_material.client_write_MAC_key = sng_malloc(mk_len);
+        tls_debug_print_hex("client_write_MAC_key", key_material, mk_len);
+        memcpy(conn->key_material.client_write_MAC_key, key_material, mk_len);
+        key_material += mk_len;
+        conn->key_material.server_write_MAC_key = sng_malloc(mk_len);
+        tls_debug_print_hex("server_write_MAC_key", key_material, mk_len);
+        memcpy(conn->key_material.server_write_MAC_key, key_material, mk_len);
+        key_material += mk_len;
+    }
+
+    // Get write keys
+    int wk_len = conn->cipher_data.bits / 8;
+    conn->key_material.client_write_key = sng_malloc(wk_len);
+    memcpy(conn->key_material.client_write_key, key_material, wk_len);
+    tls_debug_print_hex("client_write_key", key_material, wk_len);
+    key_material+=wk_len;
+
+    conn->key_material.server_write_key = sng_malloc(wk_len);
+    memcpy(conn->key_material.server_write_key, key_material, wk_len);
+    tls_debug_print_hex("server_write_key", key_material, wk_len);
+    key_material+=wk_len;
+
+    // Get IV blocks
+    conn->key_material.client_write_IV = sng_malloc(conn->cipher_data.ivblock);
+    memcpy(conn->key_material.client_write_IV, key_material, conn->cipher_data.ivblock);
+    tls_debug_print_hex("client_write_IV", key_material,  conn->cipher_data.ivblock);
+    key_material+=conn->cipher_data.ivblock;
+    conn->key_material.server_write_IV = sng_malloc(conn->cipher_data.ivblock);
+    memcpy(conn->key_material.server_write_IV, key_material, conn->cipher_data.ivblock);
+    tls_debug_print_hex("server_write_IV", key_material,  conn->cipher_data.ivblock);
+
+    // Done with the seed
+    sng_free(seed);
+
+    // Create Client decoder
+#if MODSSL_USE_OPENSSL_PRE_1_1_API
+    EVP_CIPHER_CTX_init(conn->client_cipher_ctx);
+#else
+    EVP_CIPHER_CTX_reset(conn->client_cipher_ctx);
+#endif
+    EVP_CipherInit(conn->client_cipher_ctx, conn->ciph,
+                   conn->key_material.client_write_key, conn->key_material.client_write_IV,
+                   0);
+
+#if MODSSL_USE_OPENSSL_PRE_1_1_API
+    EVP_CIPHER_CTX_init(conn->server_cipher_ctx);
+#else
+    EVP_CIPHER_CTX_reset(conn->server_cipher_ctx);
+#endif
+    EVP_CipherInit(conn->server_cipher_ctx, conn->ciph,
+                   conn->key_material.server_write_key, conn->key_material.server_write_IV,
+                   0);
+
+    return 0;
+}
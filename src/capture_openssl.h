@@ -60,6 +60,11 @@
 //! Cast three bytes into decimal (Big Endian)
 #define UINT24_INT(i) ((i.x[0] << 16) | (i.x[1] << 8) | i.x[2])
 
+//! Length of connection lookup key (client and server addresses)
+#define TLS_CONNECTION_KEYLEN 32
+//! Expected number of detected connections (index grows if required)
+#define TLS_CONNECTION_HASH 1024
+
 //The symbol SSL3_MT_NEWSESSION_TICKET appears to have been introduced at around
 //openssl 0.9.8f, and the use of if breaks builds with older openssls
 #if OPENSSL_VERSION_NUMBER < 0x00908070L
@@ -258,8 +263,6 @@ struct SSLConnection {
     //! Server port
     uint16_t server_port;
 
-    SSL *ssl;
-    SSL_CTX *ssl_ctx;
     EVP_PKEY *server_private_key;
     const EVP_CIPHER *ciph;
     struct Random client_random;
@@ -281,7 +284,10 @@ struct SSLConnection {
     EVP_CIPHER_CTX *client_cipher_ctx;
     EVP_CIPHER_CTX *server_cipher_ctx;
 
-    struct SSLConnection *next;
+    //! Lookup key built from client and server addresses
+    char key[TLS_CONNECTION_KEYLEN];
+    //! Capture time of last segment of this connection
+    time_t last;
 };
 
 /**
@@ -327,7 +333,7 @@ PRF(struct SSLConnection *conn, unsigned char *dest, int dlen, unsigned char *pr
  *
  * This will allocate enough memory to store all connection data
  * from a detected SSL connection. This will also add this structure to
- * the connections linked list.
+ * the connections list and its index.
  *
  * @param caddr Client address
  * @param cport Client port
@@ -338,17 +344,37 @@ PRF(struct SSLConnection *conn, unsigned char *dest, int dlen, unsigned char *pr
 struct SSLConnection *
 tls_connection_create(struct in_addr caddr, uint16_t cport, struct in_addr saddr, uint16_t sport);
 
+/**
+ * @brief Load server private key from configured keyfile
+ *
+ * Key is only loaded once and shared by all connections.
+ *
+ * @return server private key or NULL if it can not be loaded
+ */
+EVP_PKEY *
+tls_load_key();
+
 /**
  * @brief Destroys an existing SSLConnection
  *
- * This will free all allocated memory of SSLConnection also removing
- * the connection from connections list.
+ * This will free all allocated memory of SSLConnection (including its
+ * cipher contexts) also removing the connection from connections list.
  *
  * @param conn Existing connection pointer
  */
 void
 tls_connection_destroy(struct SSLConnection *conn);
 
+/**
+ * @brief Destroys a connection while other threads can be decrypting
+ *
+ * Same as tls_connection_destroy, holding connections storage lock
+ *
+ * @param conn Existing connection pointer
+ */
+void
+tls_connection_close(struct SSLConnection *conn);
+
 /**
  * @brief Check if given keyfile is valid
  *
@@ -383,9 +409,29 @@ tls_connection_dir(struct SSLConnection *conn, struct in_addr addr, uint16_t por
  * @param port Client or server port
  * @return an existing Connection pointer or NULL if not found
  */
+/**
+ * @brief Build the lookup key of a connection
+ *
+ * Key is the same for both directions of the connection.
+ *
+ * @param key Buffer of TLS_CONNECTION_KEYLEN bytes to store the key
+ */
+void
+tls_connection_key(char *key, struct in_addr src, uint16_t sport, struct in_addr dst, uint16_t dport);
+
 struct SSLConnection*
 tls_connection_find(struct in_addr src, uint16_t sport, struct in_addr dst, uint16_t dport);
 
+/**
+ * @brief Destroy connections without segments for a while
+ *
+ * Connections are checked at most once per second.
+ *
+ * @param now Capture time of current segment
+ */
+void
+tls_connection_expire(time_t now);
+
 /**
  * @brief Process a TCP segment to check TLS data
  *
@@ -494,4 +540,17 @@ tls_process_record_data(struct SSLConnection *conn, const opaque *fragment, cons
 int
 tls_connection_load_cipher(struct SSLConnection *conn);
 
+/**
+ * @brief Generate connection keys from its master secret
+ *
+ * Master secret can be computed from the decrypted premaster secret or
+ * read from the key log file. Both client and server decoders are created
+ * with the generated keys.
+ *
+ * @param conn Existing connection pointer
+ * @return 0 on keys loaded, 1 otherwise
+ */
+int
+tls_connection_load_keys(struct SSLConnection *conn);
+
 #endif
@@ -0,0 +1,541 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_snapshot.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in capture_snapshot.h
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "capture.h"
+#include "capture_snapshot.h"
+#include "sip.h"
+#include "rtp.h"
+#include "util.h"
+
+/**
+ * @brief Snapshot configuration and state
+ */
+static struct
+{
+    //! Snapshot file path (NULL if disabled)
+    char *file;
+    //! Seconds between snapshots (0 for only on request)
+    int interval;
+    //! Time of last written snapshot
+    time_t last;
+    //! Snapshot requested through SIGUSR1
+    atomic_bool requested;
+    //! Capture time of newest message in last snapshot
+    struct timeval checkpoint;
+} snapshot;
+
+/**
+ * @brief Stored message waiting to be written in capture order
+ */
+typedef struct
+{
+    struct timeval ts;
+    uint32_t seq;
+    packet_t *packet;
+} capture_snapshot_item_t;
+
+/**
+ * @brief Request a snapshot from signal handler
+ */
+static void
+capture_snapshot_signal(int signum)
+{
+    atomic_store(&snapshot.requested, true);
+}
+
+void
+capture_snapshot_init(const char *file, int interval)
+{
+    struct sigaction sa;
+
+    sng_free(snapshot.file);
+    snapshot.file = NULL;
+    if (!file || !strlen(file))
+        return;
+
+    snapshot.file = strdup(file);
+    snapshot.interval = (interval > 0) ? interval : 0;
+    snapshot.last = time(NULL);
+    atomic_init(&snapshot.requested, false);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = capture_snapshot_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+}
+
+bool
+capture_snapshot_enabled()
+{
+    return snapshot.file != NULL;
+}
+
+bool
+capture_snapshot_due(time_t now)
+{
+    if (!snapshot.file)
+        return false;
+    if (atomic_exchange(&snapshot.requested, false))
+        return true;
+    return snapshot.interval && now - snapshot.last >= snapshot.interval;
+}
+
+struct timeval
+capture_snapshot_checkpoint()
+{
+    return snapshot.checkpoint;
+}
+
+/**
+ * @brief Sort stored messages by capture time, keeping calls order on ties
+ */
+static int
+capture_snapshot_item_cmp(const void *a, const void *b)
+{
+    const capture_snapshot_item_t *one = a, *two = b;
+
+    if (timercmp(&one->ts, &two->ts, !=))
+        return timercmp(&one->ts, &two->ts, <) ? -1 : 1;
+    return (one->seq < two->seq) ? -1 : (one->seq > two->seq);
+}
+
+static void
+capture_snapshot_addr_write(capture_snapshot_addr_t *out, address_t addr)
+{
+    out->family = addr.family;
+    out->port = addr.port;
+    memcpy(out->ip, addr.ip.words, sizeof(out->ip));
+}
+
+static address_t
+capture_snapshot_addr_read(const capture_snapshot_addr_t *in)
+{
+    address_t addr = { };
+
+    addr.family = in->family;
+    addr.port = in->port;
+    memcpy(addr.ip.words, in->ip, sizeof(in->ip));
+    addr.hash = address_hash(&addr);
+    return addr;
+}
+
+/**
+ * @brief Write a record header and pad its data to 8 bytes
+ */
+static void
+capture_snapshot_record_begin(FILE *out, enum capture_snapshot_type type, uint32_t size)
+{
+    capture_snapshot_record_t record = { .type = type, .size = size };
+    fwrite(&record, sizeof(record), 1, out);
+}
+
+static void
+capture_snapshot_record_end(FILE *out, uint32_t size)
+{
+    static const u_char padding[8] = { 0 };
+    if (size % 8)
+        fwrite(padding, 8 - size % 8, 1, out);
+}
+
+/**
+ * @brief Write a stored SIP message and its frames
+ */
+static int
+capture_snapshot_write_packet(FILE *out, packet_t *packet)
+{
+    capture_snapshot_packet_t data = { };
+    capture_snapshot_frame_t fdata;
+    frame_buffer_t **frames;
+    uint32_t count, size, i;
+    u_char *payload;
+
+    if (!(payload = packet_payload(packet)))
+        return 1;
+
+    if (!(frames = sng_malloc(sizeof(frame_buffer_t *) * (vector_count(packet->frames) + 1))))
+        return 1;
+    count = dump_packet_frames(packet, frames);
+
+    capture_snapshot_addr_write(&data.src, packet->src);
+    capture_snapshot_addr_write(&data.dst, packet->dst);
+    data.payload_len = packet_payloadlen(packet);
+    data.hep_node = packet->hep_node;
+    data.frames = count;
+    data.ip_version = packet->ip_version;
+    data.proto = packet->proto;
+
+    size = sizeof(data) + data.payload_len;
+    for (i = 0; i < count; i++)
+        size += sizeof(fdata) + frames[i]->header.caplen;
+
+    capture_snapshot_record_begin(out, CAPTURE_SNAPSHOT_PACKET, size);
+    fwrite(&data, sizeof(data), 1, out);
+    for (i = 0; i < count; i++) {
+        fdata.sec = frames[i]->header.ts.tv_sec;
+        fdata.usec = frames[i]->header.ts.tv_usec;
+        fdata.caplen = frames[i]->header.caplen;
+        fdata.len = frames[i]->header.len;
+        fwrite(&fdata, sizeof(fdata), 1, out);
+        fwrite(frames[i]->data, fdata.caplen, 1, out);
+        frame_buffer_destroy(frames[i]);
+    }
+    fwrite(payload, data.payload_len, 1, out);
+    capture_snapshot_record_end(out, size);
+
+    sng_free(frames);
+    return 0;
+}
+
+/**
+ * @brief Write counters of a RTP stream
+ */
+static void
+capture_snapshot_write_stream(FILE *out, sip_call_t *call, rtp_stream_t *stream)
+{
+    capture_snapshot_stream_t data = { };
+    uint32_t size;
+
+    capture_snapshot_addr_write(&data.src, stream->src);
+    capture_snapshot_addr_write(&data.dst, stream->dst);
+    data.time_sec = stream->time.tv_sec;
+    data.time_usec = stream->time.tv_usec;
+    data.last_sec = stream->lasttime.tv_sec;
+    data.last_usec = stream->lasttime.tv_usec;
+    data.bytes = stream->bytes;
+    data.type = stream->type;
+    data.index = stream->index;
+    data.pktcnt = stream->pktcnt;
+    data.fmtchanges = stream->fmtchanges;
+    data.lasttm = stream->lasttm;
+    data.callid_len = strlen(call->callid);
+    memcpy(data.info, &stream->rtpinfo, sizeof(data.info));
+
+    size = sizeof(data) + sizeof(rtp_stream_stats_t) + data.callid_len;
+    capture_snapshot_record_begin(out, CAPTURE_SNAPSHOT_STREAM, size);
+    fwrite(&data, sizeof(data), 1, out);
+    fwrite(&stream->stats, sizeof(rtp_stream_stats_t), 1, out);
+    fwrite(call->callid, data.callid_len, 1, out);
+    capture_snapshot_record_end(out, size);
+}
+
+int
+capture_snapshot_save()
+{
+    capture_snapshot_header_t header = { };
+    capture_snapshot_item_t *items;
+    sip_call_t *call;
+    sip_msg_t *msg;
+    rtp_stream_t *stream;
+    FILE *out, *file;
+    char *buffer = NULL, tmpfile[PATH_MAX];
+    size_t size = 0, count = 0, total = 0, i;
+    int ret = 0;
+
+    if (!snapshot.file)
+        return 1;
+    snapshot.last = time(NULL);
+
+    // Build the whole snapshot in memory, so calls are locked without disk I/O
+    if (!(out = open_memstream(&buffer, &size)))
+        return 1;
+
+    memcpy(header.magic, CAPTURE_SNAPSHOT_MAGIC, sizeof(CAPTURE_SNAPSHOT_MAGIC));
+    header.version = CAPTURE_SNAPSHOT_VERSION;
+    header.stats_size = sizeof(rtp_stream_stats_t);
+    header.created = snapshot.last;
+    fwrite(&header, sizeof(header), 1, out);
+
+    // Reading payloads may uncompress stored frames or copy lazy payloads,
+    // so other readers (like the interface) must be kept out
+    capture_lock();
+
+    // Messages of all calls are restored in capture order
+    vector_iter_t calls = sip_calls_iterator();
+    while ((call = vector_iterator_next(&calls)))
+        total += vector_count(call->msgs);
+
+    if (!(items = sng_malloc(sizeof(capture_snapshot_item_t) * (total + 1)))) {
+        capture_unlock();
+        fclose(out);
+        free(buffer);
+        return 1;
+    }
+
+    vector_iterator_reset(&calls);
+    while ((call = vector_iterator_next(&calls))) {
+        vector_iter_t msgs = vector_iterator(call->msgs);
+        while ((msg = vector_iterator_next(&msgs)) && count < total) {
+            items[count].ts = packet_time(msg->packet);
+            items[count].seq = count;
+            items[count].packet = msg->packet;
+            count++;
+        }
+    }
+    qsort(items, count, sizeof(capture_snapshot_item_t), capture_snapshot_item_cmp);
+
+    for (i = 0; i < count; i++) {
+        if (capture_snapshot_write_packet(out, items[i].packet) != 0)
+            continue;
+        header.packets++;
+        header.last_sec = items[i].ts.tv_sec;
+        header.last_usec = items[i].ts.tv_usec;
+    }
+
+    // Streams counters are applied once their calls have been restored
+    vector_iterator_reset(&calls);
+    while ((call = vector_iterator_next(&calls))) {
+        vector_iter_t streams = vector_iterator(call->streams);
+        while ((stream = vector_iterator_next(&streams))) {
+            if (!stream->pktcnt)
+                continue;
+            capture_snapshot_write_stream(out, call, stream);
+            header.streams++;
+        }
+    }
+
+    capture_unlock();
+    sng_free(items);
+
+    if (fclose(out) != 0 || size < sizeof(header)) {
+        free(buffer);
+        return 1;
+    }
+
+    // Update header counters
+    memcpy(buffer, &header, sizeof(header));
+
+    // Replace previous snapshot only once the new one has been written
+    snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", snapshot.file);
+    if (!(file = fopen(tmpfile, "w"))) {
+        free(buffer);
+        return 1;
+    }
+    if (fwrite(buffer, 1, size, file) != size)
+        ret = 1;
+    if (fclose(file) != 0)
+        ret = 1;
+    if (ret == 0 && rename(tmpfile, snapshot.file) != 0)
+        ret = 1;
+    if (ret != 0)
+        unlink(tmpfile);
+    else
+        snapshot.checkpoint = (struct timeval) { header.last_sec, header.last_usec };
+
+    free(buffer);
+    return ret;
+}
+
+/**
+ * @brief Parse again a stored SIP message
+ */
+static void
+capture_snapshot_read_packet(const u_char *data, uint32_t size)
+{
+    capture_snapshot_packet_t pdata;
+    capture_snapshot_frame_t fdata;
+    struct pcap_pkthdr header;
+    packet_t *packet;
+    uint32_t pos, i;
+
+    if (size < sizeof(pdata))
+        return;
+    memcpy(&pdata, data, sizeof(pdata));
+
+    packet = packet_create(pdata.ip_version, pdata.proto,
+                           capture_snapshot_addr_read(&pdata.src), capture_snapshot_addr_read(&pdata.dst), 0);
+    if (!packet)
+        return;
+    packet->hep_node = pdata.hep_node;
+
+    // Frames are kept to save restored dialogs
+    pos = sizeof(pdata);
+    for (i = 0; i < pdata.frames; i++) {
+        if (pos + sizeof(fdata) > size)
+            break;
+        memcpy(&fdata, data + pos, sizeof(fdata));
+        pos += sizeof(fdata);
+        if (fdata.caplen > size - pos)
+            break;
+        header.ts.tv_sec = fdata.sec;
+        header.ts.tv_usec = fdata.usec;
+        header.caplen = fdata.caplen;
+        header.len = fdata.len;
+        packet_add_frame(packet, &header, data + pos);
+        pos += fdata.caplen;
+    }
+
+    // Truncated record
+    if (i != pdata.frames || pdata.payload_len > size - pos) {
+        packet_destroy(packet);
+        return;
+    }
+    packet_set_payload(packet, (u_char *) data + pos, pdata.payload_len);
+
+    // Restored messages are not written to output file again
+    if (capture_packet_parse(packet) == 0) {
+        capture_packet_store(NULL, packet);
+    } else {
+        packet_destroy(packet);
+    }
+}
+
+/**
+ * @brief Set counters of a restored call stream
+ */
+static void
+capture_snapshot_read_stream(const u_char *data, uint32_t size)
+{
+    capture_snapshot_stream_t sdata;
+    rtp_stream_t *stream = NULL, *other;
+    sip_call_t *call;
+    address_t src, dst;
+    char *callid;
+
+    if (size < sizeof(sdata) + sizeof(rtp_stream_stats_t))
+        return;
+    memcpy(&sdata, data, sizeof(sdata));
+    if (sdata.callid_len > size - sizeof(sdata) - sizeof(rtp_stream_stats_t))
+        return;
+
+    if (!(callid = strndup((const char *) data + sizeof(sdata) + sizeof(rtp_stream_stats_t), sdata.callid_len)))
+        return;
+    call = sip_find_by_callid(callid);
+    free(callid);
+    if (!call)
+        return;
+
+    src = capture_snapshot_addr_read(&sdata.src);
+    dst = capture_snapshot_addr_read(&sdata.dst);
+
+    // Streams setup by SDP are created again while parsing the messages
+    if ((stream = vector_item(call->streams, sdata.index))) {
+        if (stream->type != sdata.type || !addressport_equals(stream->dst, dst))
+            stream = NULL;
+    }
+
+    // Streams created by RTP packets share the media of their opposite direction
+    if (!stream) {
+        vector_iter_t it = vector_iterator(call->streams);
+        while ((other = vector_iterator_next(&it))) {
+            if (other->media && (addressport_equals(other->dst, src) || addressport_equals(other->dst, dst)))
+                break;
+        }
+        if (!other || !(stream = stream_create(other->media, dst, sdata.type)))
+            return;
+        call_add_stream(call, stream);
+    }
+
+    stream_complete(stream, src);
+    stream->time = (struct timeval) { sdata.time_sec, sdata.time_usec };
+    stream->lasttime = (struct timeval) { sdata.last_sec, sdata.last_usec };
+    stream->lasttm = sdata.lasttm;
+    stream->bytes = sdata.bytes;
+    stream->pktcnt = sdata.pktcnt;
+    stream->fmtchanges = sdata.fmtchanges;
+    memcpy(&stream->rtpinfo, sdata.info, sizeof(sdata.info));
+    memcpy(&stream->stats, data + sizeof(sdata), sizeof(rtp_stream_stats_t));
+
+    // Restored streams expire counting from their last packet
+    if (stream_is_indexed(stream))
+        rtp_index_touch(stream, stream->lasttime.tv_sec);
+}
+
+int
+capture_snapshot_load()
+{
+    capture_snapshot_header_t header;
+    capture_snapshot_record_t record;
+    struct stat st;
+    u_char *data;
+    size_t pos;
+    int fd;
+
+    if (!snapshot.file)
+        return 0;
+
+    // First start, nothing to restore
+    if ((fd = open(snapshot.file, O_RDONLY)) == -1)
+        return 0;
+
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(header)) {
+        close(fd);
+        return 1;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return 1;
+
+    // Snapshots from other versions or builds can not be restored
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, CAPTURE_SNAPSHOT_MAGIC, sizeof(CAPTURE_SNAPSHOT_MAGIC)) != 0
+            || header.version != CAPTURE_SNAPSHOT_VERSION
+            || header.stats_size != sizeof(rtp_stream_stats_t)) {
+        munmap(data, st.st_size);
+        return 1;
+    }
+
+    capture_lock();
+    for (pos = sizeof(header); pos + sizeof(record) <= (size_t) st.st_size;) {
+        memcpy(&record, data + pos, sizeof(record));
+        pos += sizeof(record);
+        if (record.size > st.st_size - pos)
+            break;
+
+        switch (record.type) {
+            case CAPTURE_SNAPSHOT_PACKET:
+                capture_snapshot_read_packet(data + pos, record.size);
+                break;
+            case CAPTURE_SNAPSHOT_STREAM:
+                capture_snapshot_read_stream(data + pos, record.size);
+                break;
+            default:
+                break;
+        }
+
+        pos += (record.size + 7) & ~7;
+    }
+    capture_unlock();
+
+    snapshot.checkpoint = (struct timeval) { header.last_sec, header.last_usec };
+    munmap(data, st.st_size);
+    return 0;
+}
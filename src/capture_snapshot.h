@@ -0,0 +1,219 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_snapshot.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to store and restore captured dialogs across restarts
+ *
+ * When capture.snapshot is set, all stored SIP messages (with their
+ * frames) and RTP streams counters are written to that file every
+ * capture.snapshot.interval seconds, when SIGUSR1 is received and when
+ * sngrep exits. Next start maps the file and restores them before any
+ * capture source is read.
+ *
+ * Restoring only parses the SIP messages payload again: no link, IP or
+ * TCP decoding is required and RTP traffic is not read, so large stores
+ * are restored in seconds while the live capture goes on.
+ *
+ * File starts with a header followed by variable size records, each one
+ * aligned to 8 bytes. Values are stored in host byte order, so snapshots
+ * are only valid in the same machine architecture.
+ */
+#ifndef __SNGREP_CAPTURE_SNAPSHOT_H
+#define __SNGREP_CAPTURE_SNAPSHOT_H
+
+#include "config.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+//! Snapshot files magic
+#define CAPTURE_SNAPSHOT_MAGIC      "SNGSNAP"
+//! Snapshot files format version
+#define CAPTURE_SNAPSHOT_VERSION    1
+
+//! Snapshot record types
+enum capture_snapshot_type {
+    //! SIP message payload and its frames
+    CAPTURE_SNAPSHOT_PACKET = 1,
+    //! RTP stream counters
+    CAPTURE_SNAPSHOT_STREAM
+};
+
+//! Shorter declaration of capture_snapshot_header structure
+typedef struct capture_snapshot_header capture_snapshot_header_t;
+//! Shorter declaration of capture_snapshot_record structure
+typedef struct capture_snapshot_record capture_snapshot_record_t;
+//! Shorter declaration of capture_snapshot_addr structure
+typedef struct capture_snapshot_addr capture_snapshot_addr_t;
+//! Shorter declaration of capture_snapshot_packet structure
+typedef struct capture_snapshot_packet capture_snapshot_packet_t;
+//! Shorter declaration of capture_snapshot_frame structure
+typedef struct capture_snapshot_frame capture_snapshot_frame_t;
+//! Shorter declaration of capture_snapshot_stream structure
+typedef struct capture_snapshot_stream capture_snapshot_stream_t;
+
+/**
+ * @brief Snapshot file header
+ */
+struct capture_snapshot_header
+{
+    //! File magic (CAPTURE_SNAPSHOT_MAGIC)
+    char magic[8];
+    //! Format version
+    uint32_t version;
+    //! Size of stored stream counters (detects incompatible builds)
+    uint32_t stats_size;
+    //! Time the snapshot was written
+    int64_t created;
+    //! Checkpoint: capture time of the newest stored message
+    int64_t last_sec, last_usec;
+    //! Number of stored messages and streams
+    uint32_t packets, streams;
+};
+
+/**
+ * @brief Header of each record
+ */
+struct capture_snapshot_record
+{
+    //! Record type (enum capture_snapshot_type)
+    uint32_t type;
+    //! Record data size (without padding)
+    uint32_t size;
+};
+
+/**
+ * @brief Stored address
+ */
+struct capture_snapshot_addr
+{
+    uint16_t family;
+    uint16_t port;
+    uint32_t ip[4];
+};
+
+/**
+ * @brief Stored SIP message, followed by its frames and payload
+ */
+struct capture_snapshot_packet
+{
+    capture_snapshot_addr_t src, dst;
+    //! Payload length
+    uint32_t payload_len;
+    //! HEP capture agent id
+    uint32_t hep_node;
+    //! Number of stored frames
+    uint16_t frames;
+    uint8_t ip_version;
+    uint8_t proto;
+    uint32_t pad;
+};
+
+/**
+ * @brief Stored frame header, followed by caplen bytes of data
+ */
+struct capture_snapshot_frame
+{
+    int64_t sec, usec;
+    uint32_t caplen;
+    uint32_t len;
+};
+
+/**
+ * @brief Stored RTP stream counters, followed by its call Call-ID
+ */
+struct capture_snapshot_stream
+{
+    capture_snapshot_addr_t src, dst;
+    int64_t time_sec, time_usec;
+    int64_t last_sec, last_usec;
+    uint64_t bytes;
+    uint32_t type;
+    uint32_t index;
+    uint32_t pktcnt;
+    uint32_t fmtchanges;
+    int32_t lasttm;
+    uint32_t callid_len;
+    //! Stream type dependent information
+    uint8_t info[8];
+    //! Quality counters (rtp_stream_stats_t)
+    uint8_t stats[];
+};
+
+/**
+ * @brief Configure snapshot file
+ *
+ * Also installs the SIGUSR1 handler that requests a new snapshot.
+ *
+ * @param file Snapshot file path (NULL or empty to disable snapshots)
+ * @param interval Seconds between snapshots (0 to only write them on
+ * SIGUSR1 and exit)
+ */
+void
+capture_snapshot_init(const char *file, int interval);
+
+/**
+ * @brief Check if snapshots are enabled
+ */
+bool
+capture_snapshot_enabled();
+
+/**
+ * @brief Check if a new snapshot must be written
+ *
+ * @return true if interval has passed or SIGUSR1 has been received
+ */
+bool
+capture_snapshot_due(time_t now);
+
+/**
+ * @brief Write all stored dialogs to snapshot file
+ *
+ * Snapshot is built in memory holding the calls write lock (stored
+ * payloads may be uncompressed or copied while reading them) and then
+ * written to a temporary file that replaces the previous snapshot, so
+ * a valid snapshot always exists.
+ *
+ * @return 0 on success, 1 on error
+ */
+int
+capture_snapshot_save();
+
+/**
+ * @brief Restore dialogs from snapshot file
+ *
+ * Must be called before capture sources are launched.
+ *
+ * @return 0 on success (or if there is no snapshot yet), 1 on error
+ */
+int
+capture_snapshot_load();
+
+/**
+ * @brief Get checkpoint of the last written or restored snapshot
+ */
+struct timeval
+capture_snapshot_checkpoint();
+
+#endif /* __SNGREP_CAPTURE_SNAPSHOT_H */
@@ -0,0 +1,294 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_tls.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in capture_tls.h
+ *
+ */
+#include "config.h"
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "capture.h"
+#include "capture_tls.h"
+#include "affinity.h"
+#include "latency.h"
+#ifdef WITH_GNUTLS
+#include "capture_gnutls.h"
+#endif
+#ifdef WITH_OPENSSL
+#include "capture_openssl.h"
+#endif
+#include "setting.h"
+#include "util.h"
+
+int
+capture_tls_launch(capture_info_t *capinfo)
+{
+    capture_tls_t *tls;
+    capture_tls_worker_t *worker;
+    uint32_t i;
+
+    // Segments are decrypted by the parser thread
+    if (setting_get_intvalue(SETTING_CAPTURE_TLS_WORKERS) <= 0)
+        return 0;
+
+    if (!(tls = sng_malloc(sizeof(capture_tls_t))))
+        return 1;
+
+    tls->count = setting_get_intvalue(SETTING_CAPTURE_TLS_WORKERS);
+    tls->size = CAPTURE_TLS_QUEUE;
+    tls->ready = vector_create(0, 64);
+    atomic_init(&tls->stopping, false);
+    if (!(tls->workers = sng_malloc(sizeof(capture_tls_worker_t) * tls->count))) {
+        vector_destroy(tls->ready);
+        sng_free(tls);
+        return 1;
+    }
+    capinfo->tls = tls;
+
+    for (i = 0; i < tls->count; i++) {
+        worker = &tls->workers[i];
+        worker->source = capinfo;
+        worker->segments = sng_malloc(sizeof(capture_tls_segment_t) * tls->size);
+        worker->queue = ring_create(tls->size);
+        worker->done = ring_create(tls->size);
+        if (!worker->segments || !worker->queue || !worker->done) {
+            // Worker threads are only joined if its done queue exists
+            if (worker->done)
+                ring_destroy(worker->done);
+            worker->done = NULL;
+            return 1;
+        }
+
+        atomic_init(&worker->waiting, false);
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_cond_init(&worker->cond, NULL);
+        if (pthread_create(&worker->thread, NULL, (void *) capture_tls_worker_thread, worker)) {
+            pthread_cond_destroy(&worker->cond);
+            pthread_mutex_destroy(&worker->lock);
+            ring_destroy(worker->done);
+            worker->done = NULL;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void
+capture_tls_close(capture_info_t *capinfo)
+{
+    capture_tls_t *tls = capinfo->tls;
+    capture_tls_worker_t *worker;
+    capture_tls_segment_t *segment;
+    packet_t *packet;
+    uint32_t i;
+
+    if (!tls)
+        return;
+
+    tls->stopping = true;
+    for (i = 0; i < tls->count; i++) {
+        worker = &tls->workers[i];
+
+        // Worker thread has been launched
+        if (worker->done) {
+            capture_tls_wakeup(worker);
+            pthread_join(worker->thread, NULL);
+            pthread_cond_destroy(&worker->cond);
+            pthread_mutex_destroy(&worker->lock);
+
+            // Discard packets that have not been processed
+            while ((segment = ring_pop(worker->queue)))
+                packet_destroy(segment->packet);
+            while ((segment = ring_pop(worker->done)))
+                packet_destroy(segment->packet);
+        }
+
+        if (worker->queue)
+            ring_destroy(worker->queue);
+        if (worker->done)
+            ring_destroy(worker->done);
+        sng_free(worker->segments);
+    }
+
+    while ((packet = vector_first(tls->ready))) {
+        vector_remove(tls->ready, packet);
+        packet_destroy(packet);
+    }
+    vector_destroy(tls->ready);
+    sng_free(tls->workers);
+    sng_free(tls);
+    capinfo->tls = NULL;
+}
+
+void
+capture_tls_queue(capture_info_t *capinfo, packet_t *packet, struct tcphdr *tcp)
+{
+    capture_tls_t *tls = capinfo->tls;
+    capture_tls_worker_t *worker = capture_tls_flow_worker(tls, packet);
+    capture_tls_segment_t *segment;
+
+    // Worker can not return more segments: keep its decrypted packets aside
+    while (worker->pending >= tls->size) {
+        if ((segment = ring_pop(worker->done))) {
+            vector_append(tls->ready, segment->packet);
+            worker->pending--;
+            continue;
+        }
+        // Nobody is going to decrypt this packet
+        if (capinfo->stopping) {
+            packet_destroy(packet);
+            return;
+        }
+        capture_tls_wakeup(worker);
+        usleep(100);
+    }
+
+    // Segments storage is reused once its packet has been returned
+    segment = &worker->segments[worker->head++ % tls->size];
+    segment->packet = packet;
+    memcpy(&segment->tcp, tcp, sizeof(struct tcphdr));
+
+    // Queue always has room for all pending segments
+    ring_push(worker->queue, segment);
+    worker->pending++;
+    capture_tls_wakeup(worker);
+}
+
+packet_t *
+capture_tls_next(capture_info_t *capinfo)
+{
+    capture_tls_t *tls = capinfo->tls;
+    capture_tls_segment_t *segment;
+    capture_tls_worker_t *worker;
+    packet_t *packet;
+    uint32_t i;
+
+    if (!tls)
+        return NULL;
+
+    // Packets taken from full workers are always older than the queued ones
+    if ((packet = vector_first(tls->ready))) {
+        vector_remove(tls->ready, packet);
+        return packet;
+    }
+
+    // Take decrypted packets from all workers in turns
+    for (i = 0; i < tls->count; i++) {
+        worker = &tls->workers[tls->next];
+        tls->next = (tls->next + 1) % tls->count;
+        if ((segment = ring_pop(worker->done))) {
+            worker->pending--;
+            return segment->packet;
+        }
+    }
+
+    return NULL;
+}
+
+uint32_t
+capture_tls_pending(capture_info_t *capinfo)
+{
+    capture_tls_t *tls = capinfo->tls;
+    uint32_t pending, i;
+
+    if (!tls)
+        return 0;
+
+    pending = vector_count(tls->ready);
+    for (i = 0; i < tls->count; i++)
+        pending += tls->workers[i].pending;
+    return pending;
+}
+
+capture_tls_worker_t *
+capture_tls_flow_worker(capture_tls_t *tls, packet_t *packet)
+{
+    // Combine addresses and ports so both directions match
+    uint32_t hash = (packet->src.hash ^ packet->dst.hash) ^ (packet->src.port ^ packet->dst.port);
+
+    return &tls->workers[(hash ^ (hash >> 16)) % tls->count];
+}
+
+void
+capture_tls_wakeup(capture_tls_worker_t *worker)
+{
+    // Make queued segments visible before checking worker status
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // Only signal the worker if it is actually sleeping
+    if (atomic_load(&worker->waiting)) {
+        pthread_mutex_lock(&worker->lock);
+        pthread_cond_signal(&worker->cond);
+        pthread_mutex_unlock(&worker->lock);
+    }
+}
+
+void
+capture_tls_worker_thread(void *info)
+{
+    capture_tls_worker_t *worker = (capture_tls_worker_t *) info;
+    capture_tls_t *tls = worker->source->tls;
+    capture_tls_segment_t *segment;
+    bool processed = false;
+    struct timespec ts;
+
+    affinity_apply(AFFINITY_PARSER);
+
+    while (!tls->stopping) {
+        // Decrypt all queued segments in capture order
+        while ((segment = ring_pop(worker->queue))) {
+            LATENCY_START(tls_start);
+            tls_process_segment(segment->packet, &segment->tcp);
+            LATENCY_RECORD(LATENCY_TLS, tls_start);
+            // Check if decrypted packet is WSS
+            capture_ws_check_packet(segment->packet);
+            // Returned segments never exceed queue size
+            ring_push(worker->done, segment);
+            processed = true;
+        }
+
+        // Notify parser once all queued segments are decrypted
+        if (processed)
+            capture_parser_wakeup(worker->source, false);
+        processed = false;
+
+        // Wait until parser queues more segments
+        pthread_mutex_lock(&worker->lock);
+        worker->waiting = true;
+        if (ring_count(worker->queue) == 0 && !tls->stopping) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += CAPTURE_RING_WAIT * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&worker->cond, &worker->lock, &ts);
+        }
+        worker->waiting = false;
+        pthread_mutex_unlock(&worker->lock);
+    }
+}
@@ -0,0 +1,178 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_tls.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to decrypt TLS segments using a pool of threads
+ *
+ * When a keyfile is configured, TCP segments of live captures are not
+ * decrypted by the parser thread. Instead, they are handed to a pool of
+ * workers, so RSA premaster and record decryption of many connections never
+ * stalls capture. All segments of the same connection are decrypted by the
+ * same worker, in the order they were captured.
+ *
+ * Decrypted packets are returned to the parser thread once ready, so TLS
+ * messages can be processed after later packets from other connections.
+ */
+#ifndef __SNGREP_CAPTURE_TLS_H
+#define __SNGREP_CAPTURE_TLS_H
+
+#include "config.h"
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "capture.h"
+
+//! Default number of decrypting workers per capture source
+#define CAPTURE_TLS_WORKERS     2
+//! Number of segments that can be pending to be returned per worker
+#define CAPTURE_TLS_QUEUE       1024
+
+//! Shorter declaration of capture_tls structure
+typedef struct capture_tls capture_tls_t;
+//! Shorter declaration of capture_tls_worker structure
+typedef struct capture_tls_worker capture_tls_worker_t;
+//! Shorter declaration of capture_tls_segment structure
+typedef struct capture_tls_segment capture_tls_segment_t;
+
+/**
+ * @brief TCP segment pending to be decrypted
+ */
+struct capture_tls_segment
+{
+    //! Packet with segment payload
+    packet_t *packet;
+    //! Copy of segment TCP header (frame could have been reassembled)
+    struct tcphdr tcp;
+};
+
+/**
+ * @brief Decrypting thread of a capture source
+ */
+struct capture_tls_worker
+{
+    //! Capture source this worker decrypts segments for
+    capture_info_t *source;
+    //! Segments storage, reused in the same order they are queued
+    capture_tls_segment_t *segments;
+    //! Next segment storage to be used (parser side)
+    uint32_t head;
+    //! Segments queued and not returned yet (parser side)
+    uint32_t pending;
+    //! Segments pending to be decrypted (capture_tls_segment_t)
+    ring_t *queue;
+    //! Decrypted segments pending to be returned (capture_tls_segment_t)
+    ring_t *done;
+    //! Worker thread
+    pthread_t thread;
+    //! Worker thread is sleeping waiting for segments
+    atomic_bool waiting;
+    //! Lock and condition to wake up worker thread
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+/**
+ * @brief Decrypting workers of a capture source
+ */
+struct capture_tls
+{
+    //! Decrypting workers
+    capture_tls_worker_t *workers;
+    //! Number of decrypting workers
+    uint32_t count;
+    //! Max number of segments pending per worker
+    uint32_t size;
+    //! Worker whose segments will be returned next
+    uint32_t next;
+    //! Decrypted packets taken while waiting for a full worker
+    vector_t *ready;
+    //! Worker threads have been requested to stop
+    atomic_bool stopping;
+};
+
+/**
+ * @brief Start decrypting workers of a capture source
+ *
+ * No workers are started if capture.tls.workers setting is 0, so
+ * segments are decrypted by the parser thread.
+ *
+ * @return 0 on success, 1 otherwise
+ */
+int
+capture_tls_launch(capture_info_t *capinfo);
+
+/**
+ * @brief Stop decrypting workers and discard pending packets
+ */
+void
+capture_tls_close(capture_info_t *capinfo);
+
+/**
+ * @brief Queue a TCP packet to the worker of its connection
+ *
+ * Packet will be returned by capture_tls_next once decrypted (or once
+ * checked it is not part of a TLS connection).
+ *
+ * @param capinfo Capture source with decrypting workers
+ * @param packet TCP packet
+ * @param tcp Last segment TCP header
+ */
+void
+capture_tls_queue(capture_info_t *capinfo, packet_t *packet, struct tcphdr *tcp);
+
+/**
+ * @brief Get next packet processed by decrypting workers
+ *
+ * @return packet or NULL if no worker has finished any packet
+ */
+packet_t *
+capture_tls_next(capture_info_t *capinfo);
+
+/**
+ * @brief Get number of packets queued and not returned yet
+ */
+uint32_t
+capture_tls_pending(capture_info_t *capinfo);
+
+/**
+ * @brief Get the worker that decrypts segments of a connection
+ *
+ * Both directions of the connection use the same worker.
+ */
+capture_tls_worker_t *
+capture_tls_flow_worker(capture_tls_t *tls, packet_t *packet);
+
+/**
+ * @brief Wake up a worker if it is sleeping
+ */
+void
+capture_tls_wakeup(capture_tls_worker_t *worker);
+
+/**
+ * @brief Decrypting worker thread function
+ */
+void
+capture_tls_worker_thread(void *info);
+
+#endif /* __SNGREP_CAPTURE_TLS_H */
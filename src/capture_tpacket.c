@@ -0,0 +1,284 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_tpacket.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in capture_tpacket.h
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include "capture_tpacket.h"
+#include "setting.h"
+#include "util.h"
+
+const char *
+capture_tpacket_device(const char *dev)
+{
+    // Explicitly requested for this device
+    if (!strncmp(dev, CAPTURE_TPACKET_PREFIX, strlen(CAPTURE_TPACKET_PREFIX)))
+        return dev + strlen(CAPTURE_TPACKET_PREFIX);
+
+    // Requested for all devices
+    if (setting_has_value(SETTING_CAPTURE_BACKEND, "tpacket"))
+        return dev;
+
+    return NULL;
+}
+
+int
+capture_tpacket_online(const char *dev, const char *outfile)
+{
+    int workers = setting_get_intvalue(SETTING_CAPTURE_TPACKET_FANOUT);
+    int group, i, ret;
+
+    // Single worker for this device
+    if (workers <= 1)
+        return capture_tpacket_open(dev, outfile, -1);
+
+    // All workers join the same fanout group. Kernel hashes each flow
+    // so both directions of a 5-tuple are always read by the same worker
+    group = getpid() & 0xffff;
+    for (i = 0; i < workers; i++) {
+        if ((ret = capture_tpacket_open(dev, outfile, group)) != 0)
+            return ret;
+    }
+
+    return 0;
+}
+
+int
+capture_tpacket_open(const char *dev, const char *outfile, int group)
+{
+    capture_info_t *capinfo;
+    capture_tpacket_t *tpacket;
+    struct tpacket_req3 req;
+    struct sockaddr_ll ll;
+    struct packet_mreq mreq;
+    int version = TPACKET_V3;
+    long pagesize = sysconf(_SC_PAGESIZE);
+    int ifindex = 0, blocks, fanout;
+
+    // Create a new structure to handle this capture source
+    if (!(capinfo = sng_malloc(sizeof(capture_info_t)))
+            || !(tpacket = sng_malloc(sizeof(capture_tpacket_t)))) {
+        fprintf(stderr, "Can't allocate memory for capture data!\n");
+        return 1;
+    }
+    capinfo->tpacket = tpacket;
+
+    // Get device index (any device captures from all interfaces)
+    if (strcmp(dev, "any") != 0 && (ifindex = if_nametoindex(dev)) == 0) {
+        fprintf(stderr, "Couldn't open device %s: %s\n", dev, strerror(errno));
+        return 2;
+    }
+
+    // Use cooked sockets to get the same header from all link types
+    if ((tpacket->fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_ALL))) < 0) {
+        fprintf(stderr, "Couldn't open device %s: %s\n", dev, strerror(errno));
+        return 2;
+    }
+
+    if (setsockopt(tpacket->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0) {
+        fprintf(stderr, "Error setting TPACKET_V3 on %s: %s\n", dev, strerror(errno));
+        close(tpacket->fd);
+        return 2;
+    }
+
+    // Block size must be a multiple of page size
+    tpacket->block_size = setting_get_intvalue(SETTING_CAPTURE_TPACKET_BLOCKSIZE) * 1024;
+    tpacket->block_size = (tpacket->block_size + pagesize - 1) / pagesize * pagesize;
+    if (tpacket->block_size < MAXIMUM_SNAPLEN)
+        tpacket->block_size = (MAXIMUM_SNAPLEN + pagesize - 1) / pagesize * pagesize;
+    blocks = setting_get_intvalue(SETTING_CAPTURE_TPACKET_BLOCKS);
+    tpacket->block_nr = (blocks > 0) ? blocks : 1;
+
+    // Request the block ring
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = tpacket->block_size;
+    req.tp_block_nr = tpacket->block_nr;
+    req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+    req.tp_frame_nr = (req.tp_block_size / req.tp_frame_size) * req.tp_block_nr;
+    req.tp_retire_blk_tov = CAPTURE_TPACKET_TIMEOUT;
+    if (setsockopt(tpacket->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0) {
+        fprintf(stderr, "Error setting capture ring on %s: %s\n", dev, strerror(errno));
+        close(tpacket->fd);
+        return 2;
+    }
+
+    tpacket->map = mmap(NULL, (size_t) tpacket->block_size * tpacket->block_nr,
+                        PROT_READ | PROT_WRITE, MAP_SHARED, tpacket->fd, 0);
+    if (tpacket->map == MAP_FAILED) {
+        fprintf(stderr, "Error mapping capture ring on %s: %s\n", dev, strerror(errno));
+        close(tpacket->fd);
+        return 2;
+    }
+
+    // Only capture from the requested device
+    memset(&ll, 0, sizeof(ll));
+    ll.sll_family = AF_PACKET;
+    ll.sll_protocol = htons(ETH_P_ALL);
+    ll.sll_ifindex = ifindex;
+    if (bind(tpacket->fd, (struct sockaddr *) &ll, sizeof(ll)) != 0) {
+        fprintf(stderr, "Couldn't activate capture: %s\n", strerror(errno));
+        capture_tpacket_close(capinfo);
+        return 2;
+    }
+
+    // Set promiscuous mode on the device
+    if (ifindex) {
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.mr_ifindex = ifindex;
+        mreq.mr_type = PACKET_MR_PROMISC;
+        if (setsockopt(tpacket->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0) {
+            fprintf(stderr, "Error setting promiscous mode on %s: %s\n", dev, strerror(errno));
+        }
+    }
+
+    // Share device frames with other workers
+    if (group >= 0) {
+        fanout = group | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+        if (setsockopt(tpacket->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) != 0) {
+            fprintf(stderr, "Error joining fanout group on %s: %s\n", dev, strerror(errno));
+            capture_tpacket_close(capinfo);
+            return 2;
+        }
+    }
+
+    // A dead pcap handler is used for filter compiling and dumping packets
+    capinfo->handle = pcap_open_dead(DLT_LINUX_SLL, MAXIMUM_SNAPLEN);
+
+    // Store capture device
+    capinfo->device = dev;
+
+    // All frames are passed with a Linux cooked header
+    capinfo->link = DLT_LINUX_SLL;
+    capinfo->link_hl = datalink_size(capinfo->link);
+    capinfo->link_decode = capture_link_sll;
+
+    // Add this capture information as packet source
+    return capture_add_source(capinfo, outfile);
+}
+
+void
+capture_tpacket_loop(capture_info_t *capinfo)
+{
+    capture_tpacket_t *tpacket = capinfo->tpacket;
+    struct tpacket_block_desc *block;
+    struct tpacket3_hdr *frame;
+    struct sockaddr_ll *ll;
+    struct pcap_pkthdr header;
+    struct pollfd pfd;
+    u_char *data;
+    uint32_t i;
+
+    pfd.fd = tpacket->fd;
+    pfd.events = POLLIN | POLLERR;
+    pfd.revents = 0;
+
+    for (;;) {
+        block = (struct tpacket_block_desc *) (tpacket->map + tpacket->block_cur * tpacket->block_size);
+
+        // Wait until kernel passes this block to us
+        if ((block->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+            if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+                break;
+            continue;
+        }
+
+        // Queue all frames of the block
+        frame = (struct tpacket3_hdr *) ((uint8_t *) block + block->hdr.bh1.offset_to_first_pkt);
+        for (i = 0; i < block->hdr.bh1.num_pkts; i++) {
+            ll = (struct sockaddr_ll *) ((uint8_t *) frame + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+
+            // Kernel leaves room for a cooked header before network data
+            data = (u_char *) frame + frame->tp_net - CAPTURE_TPACKET_SLL_LEN;
+            memset(data, 0, CAPTURE_TPACKET_SLL_LEN);
+            *(uint16_t *) (data) = htons(ll->sll_pkttype);
+            *(uint16_t *) (data + 2) = htons(ll->sll_hatype);
+            *(uint16_t *) (data + 4) = htons(ll->sll_halen);
+            memcpy(data + 6, ll->sll_addr, ll->sll_halen > 8 ? 8 : ll->sll_halen);
+            *(uint16_t *) (data + 14) = ll->sll_protocol;
+
+            header.ts.tv_sec = frame->tp_sec;
+            header.ts.tv_usec = frame->tp_nsec / 1000;
+            header.caplen = frame->tp_snaplen + CAPTURE_TPACKET_SLL_LEN;
+            header.len = frame->tp_len + CAPTURE_TPACKET_SLL_LEN;
+
+            if (!tpacket->filtered || pcap_offline_filter(&tpacket->fp, &header, data)) {
+                capture_queue_packet((u_char *) capinfo, &header, data);
+            }
+
+            frame = (struct tpacket3_hdr *) ((uint8_t *) frame + frame->tp_next_offset);
+        }
+
+        // Notify parser once per block
+        capture_parser_wakeup(capinfo, false);
+
+        // Give the block back to the kernel
+        __sync_synchronize();
+        block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        tpacket->block_cur = (tpacket->block_cur + 1) % tpacket->block_nr;
+    }
+}
+
+int
+capture_tpacket_set_filter(capture_info_t *capinfo, const char *filter)
+{
+    capture_tpacket_t *tpacket = capinfo->tpacket;
+
+    // Kernel filters on cooked sockets don't see the link header, so the
+    // filter is applied to each frame before queueing it
+    if (pcap_compile(capinfo->handle, &tpacket->fp, filter, 0, capinfo->mask) == -1)
+        return 1;
+
+    tpacket->filtered = true;
+    return 0;
+}
+
+void
+capture_tpacket_close(capture_info_t *capinfo)
+{
+    capture_tpacket_t *tpacket = capinfo->tpacket;
+
+    if (!tpacket)
+        return;
+
+    if (tpacket->map && tpacket->map != MAP_FAILED)
+        munmap(tpacket->map, (size_t) tpacket->block_size * tpacket->block_nr);
+    close(tpacket->fd);
+    if (tpacket->filtered)
+        pcap_freecode(&tpacket->fp);
+
+    sng_free(tpacket);
+    capinfo->tpacket = NULL;
+}
@@ -0,0 +1,133 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_tpacket.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to capture packets using Linux AF_PACKET sockets
+ *
+ * This capture backend maps a TPACKET_V3 block ring shared with the
+ * kernel, so frames are read in batches without a syscall per packet.
+ * Captured frames are handed to the same parsing path used by libpcap
+ * sources, prefixed with a Linux cooked (SLL) header.
+ */
+#ifndef __SNGREP_CAPTURE_TPACKET_H
+#define __SNGREP_CAPTURE_TPACKET_H
+
+#include "config.h"
+#include <stdint.h>
+#include "capture.h"
+
+//! Device prefix to request this backend in -d option
+#define CAPTURE_TPACKET_PREFIX  "tpacket:"
+//! Max time kernel keeps a block before passing it to userspace (ms)
+#define CAPTURE_TPACKET_TIMEOUT 100
+//! Linux cooked capture header length
+#define CAPTURE_TPACKET_SLL_LEN 16
+
+//! Shorter declaration of capture_tpacket structure
+typedef struct capture_tpacket capture_tpacket_t;
+
+/**
+ * @brief AF_PACKET capture source data
+ */
+struct capture_tpacket
+{
+    //! AF_PACKET socket
+    int fd;
+    //! Block ring shared with the kernel
+    uint8_t *map;
+    //! Size of each block of the ring
+    uint32_t block_size;
+    //! Number of blocks in the ring
+    uint32_t block_nr;
+    //! Next block to be read
+    uint32_t block_cur;
+    //! Compiled capture filter (applied in userspace)
+    struct bpf_program fp;
+    //! Capture filter has been set
+    bool filtered;
+};
+
+/**
+ * @brief Check if a capture device requests this backend
+ *
+ * Device will be requested if prefixed with tpacket: or capture.backend
+ * setting is tpacket.
+ *
+ * @param dev Device name as given by user
+ * @return device name without prefix or NULL if not requested
+ */
+const char *
+capture_tpacket_device(const char *dev);
+
+/**
+ * @brief Online capture function using a TPACKET_V3 ring
+ *
+ * If capture.tpacket.fanout setting is greater than one, that number of
+ * capture sources will be opened in the same PACKET_FANOUT group, each one
+ * with its own capture and parser threads.
+ *
+ * @param dev Device to start capture from (or any)
+ * @param outfile Dumpfile for captured packets
+ *
+ * @return 0 on success, 1 otherwise
+ */
+int
+capture_tpacket_online(const char *dev, const char *outfile);
+
+/**
+ * @brief Open a single TPACKET_V3 capture source
+ *
+ * @param dev Device to start capture from (or any)
+ * @param outfile Dumpfile for captured packets
+ * @param group Fanout group to join or -1 to read all device frames
+ *
+ * @return 0 on success, 1 otherwise
+ */
+int
+capture_tpacket_open(const char *dev, const char *outfile, int group);
+
+/**
+ * @brief Read frames from the block ring until capture is cancelled
+ *
+ * Each frame is queued to the capture source parser using the same
+ * function libpcap callbacks use.
+ */
+void
+capture_tpacket_loop(capture_info_t *capinfo);
+
+/**
+ * @brief Set a bpf filter for a AF_PACKET source
+ *
+ * @return 0 if valid, 1 otherwise
+ */
+int
+capture_tpacket_set_filter(capture_info_t *capinfo, const char *filter);
+
+/**
+ * @brief Unmap ring and close AF_PACKET socket
+ */
+void
+capture_tpacket_close(capture_info_t *capinfo);
+
+#endif /* __SNGREP_CAPTURE_TPACKET_H */
@@ -0,0 +1,581 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_writer.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in capture_writer.h
+ *
+ */
+#include "config.h"
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "capture.h"
+#include "capture_writer.h"
+#include "affinity.h"
+#include "setting.h"
+#include "sip.h"
+#include "util.h"
+
+capture_writer_t *
+capture_writer_open(pcap_t *handle, const char *outfile, bool blocking)
+{
+    capture_writer_t *writer;
+    const char *ext;
+    int queue;
+
+    if (!(writer = sng_malloc(sizeof(capture_writer_t))))
+        return NULL;
+
+    // Frames that can be pending to be written
+    if ((queue = setting_get_intvalue(SETTING_CAPTURE_OUTFILE_QUEUE)) <= 0)
+        queue = CAPTURE_WRITER_QUEUE;
+
+    writer->outfile = outfile;
+    writer->blocking = blocking;
+    atomic_init(&writer->ifaces_count, 0);
+
+    // Use pcapng if requested or output file has its extension
+    writer->pcapng = !strcmp(setting_get_value(SETTING_CAPTURE_OUTFILE_FORMAT), "pcapng")
+                     || ((ext = strrchr(outfile, '.')) && !strcmp(ext, CAPTURE_WRITER_PCAPNG_EXT));
+    if (writer->pcapng)
+        writer->block = sng_malloc(CAPTURE_WRITER_PCAPNG_EPB_HDR + MAX_CAPTURE_LEN + 8);
+
+    // Standard output can not be rotated
+    if (strcmp(outfile, "-") != 0) {
+        if (setting_get_intvalue(SETTING_CAPTURE_OUTFILE_SIZE) > 0)
+            writer->max_size = (uint64_t) setting_get_intvalue(SETTING_CAPTURE_OUTFILE_SIZE) * 1024 * 1024;
+        if (setting_get_intvalue(SETTING_CAPTURE_OUTFILE_INTERVAL) > 0)
+            writer->interval = setting_get_intvalue(SETTING_CAPTURE_OUTFILE_INTERVAL);
+        if (setting_get_intvalue(SETTING_CAPTURE_OUTFILE_FILES) > 0)
+            writer->max_files = setting_get_intvalue(SETTING_CAPTURE_OUTFILE_FILES);
+    }
+
+    // Rotated files keep an index of the dialogs they contain
+    if (capture_writer_rotates(writer)) {
+        writer->callids = vector_create(128, 128);
+        writer->callids_index = htable_create(CAPTURE_WRITER_INDEX);
+        writer->payload = sng_malloc(MAX_SIP_PAYLOAD + 1);
+    }
+
+    // Handler used to write the header of each output file
+    writer->handle = pcap_open_dead(pcap_datalink(handle), pcap_snapshot(handle));
+    writer->buffer = sng_malloc(CAPTURE_WRITER_BUFFER * 1024);
+
+    if (!writer->handle || capture_writer_file_open(writer) != 0
+            || !(writer->ring = ring_create(queue))) {
+        capture_writer_file_close(writer);
+        if (writer->handle)
+            pcap_close(writer->handle);
+        vector_destroy(writer->callids);
+        if (writer->callids_index)
+            htable_destroy(writer->callids_index);
+        sng_free(writer->payload);
+        sng_free(writer->block);
+        sng_free(writer->buffer);
+        sng_free(writer);
+        return NULL;
+    }
+
+    atomic_init(&writer->dropped, 0);
+    atomic_init(&writer->stopping, false);
+    atomic_init(&writer->waiting, false);
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+
+    if (pthread_create(&writer->thread, NULL, (void *) capture_writer_thread, writer)) {
+        capture_writer_file_close(writer);
+        pcap_close(writer->handle);
+        ring_destroy(writer->ring);
+        vector_destroy(writer->callids);
+        if (writer->callids_index)
+            htable_destroy(writer->callids_index);
+        sng_free(writer->payload);
+        sng_free(writer->block);
+        sng_free(writer->buffer);
+        sng_free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+void
+capture_writer_interface(capture_writer_t *writer, capture_info_t *capinfo)
+{
+    capture_writer_iface_t *iface;
+    const char *name;
+    unsigned int count;
+
+    if (!writer || !capinfo)
+        return;
+
+    count = atomic_load_explicit(&writer->ifaces_count, memory_order_relaxed);
+    if (capinfo->id != count || count == CAPTURE_WRITER_IFACES)
+        return;
+
+    iface = &writer->ifaces[count];
+    iface->link = capinfo->link;
+    iface->snaplen = pcap_snapshot(capinfo->handle);
+    if (capinfo->device) {
+        name = capinfo->device;
+    } else if (capinfo->infile) {
+        name = (name = strrchr(capinfo->infile, '/')) ? name + 1 : capinfo->infile;
+    } else {
+        name = "";
+    }
+    strncpy(iface->name, name, sizeof(iface->name) - 1);
+
+    // Let writer thread use this interface
+    atomic_store_explicit(&writer->ifaces_count, count + 1, memory_order_release);
+}
+
+void
+capture_writer_packet(capture_writer_t *writer, const packet_t *packet)
+{
+    capture_writer_record_t *record;
+    frame_buffer_t *buffer;
+    frame_t *frame;
+    char callid[1024];
+
+    if (!writer || !packet)
+        return;
+
+    record = sng_malloc(sizeof(capture_writer_record_t)
+                        + vector_count(packet->frames) * sizeof(frame_buffer_t *));
+    if (!record)
+        return;
+
+    vector_iter_t it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        // Frames without a buffer (or already freed) must be copied
+        if (frame->buffer) {
+            buffer = frame_buffer_ref(frame->buffer);
+        } else if (!frame->data || !(buffer = frame_buffer_create(frame->header, frame->data))) {
+            continue;
+        }
+        record->frames[record->count++] = buffer;
+    }
+
+    if (record->count == 0) {
+        sng_free(record);
+        return;
+    }
+
+    // Get the dialog of this message for rotated files index
+    if (writer->callids && packet->type != PACKET_RTP && packet->type != PACKET_RTCP
+            && packet->payload && packet->payload_len <= MAX_SIP_PAYLOAD) {
+        memset(callid, 0, sizeof(callid));
+        memcpy(writer->payload, packet->payload, packet->payload_len);
+        writer->payload[packet->payload_len] = '\0';
+        if (strlen(sip_get_callid(writer->payload, callid)))
+            record->callid = strdup(callid);
+    }
+
+    while (ring_push(writer->ring, record) != 0) {
+        // Never wait for the disk while capturing
+        if (!writer->blocking) {
+            atomic_fetch_add_explicit(&writer->dropped, record->count, memory_order_relaxed);
+            capture_writer_record_destroy(record);
+            break;
+        }
+        capture_writer_wakeup(writer, true);
+        usleep(100);
+    }
+}
+
+void
+capture_writer_wakeup(capture_writer_t *writer, bool force)
+{
+    if (!writer)
+        return;
+
+    // Make queued frames visible before checking writer status
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // Only signal the writer if it is actually sleeping
+    if (force || atomic_load(&writer->waiting)) {
+        pthread_mutex_lock(&writer->lock);
+        pthread_cond_signal(&writer->cond);
+        pthread_mutex_unlock(&writer->lock);
+    }
+}
+
+void
+capture_writer_thread(void *info)
+{
+    capture_writer_t *writer = (capture_writer_t *) info;
+    capture_writer_record_t *record;
+    bool pending = false;
+    struct timespec ts;
+
+    affinity_apply(AFFINITY_WRITER);
+
+    for (;;) {
+        // Write all queued packets
+        while ((record = ring_pop(writer->ring))) {
+            if (capture_writer_record(writer, record) != 0) {
+                atomic_fetch_add_explicit(&writer->dropped, record->count, memory_order_relaxed);
+            }
+            capture_writer_record_destroy(record);
+            pending = true;
+        }
+
+        // Push buffered data to file once queue is empty
+        if (pending && writer->file) {
+            fflush(writer->file);
+        }
+        pending = false;
+
+        // All queued frames have been written
+        if (writer->stopping && ring_count(writer->ring) == 0)
+            break;
+
+        // Wait until more frames are queued
+        pthread_mutex_lock(&writer->lock);
+        writer->waiting = true;
+        if (ring_count(writer->ring) == 0 && !writer->stopping) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += CAPTURE_RING_WAIT * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&writer->cond, &writer->lock, &ts);
+        }
+        writer->waiting = false;
+        pthread_mutex_unlock(&writer->lock);
+    }
+}
+
+bool
+capture_writer_rotates(capture_writer_t *writer)
+{
+    return writer->max_size || writer->interval;
+}
+
+int
+capture_writer_record(capture_writer_t *writer, capture_writer_record_t *record)
+{
+    struct timeval ts = record->frames[0]->header.ts;
+    uint64_t bytes = 0;
+    uint32_t i;
+
+    // Next file could not be opened
+    if (!writer->file)
+        return 1;
+
+    // Check if this packet must be stored in the next file
+    if (capture_writer_rotates(writer) && timerisset(&writer->first)) {
+        for (i = 0; i < record->count; i++) {
+            bytes += (writer->pcapng) ? CAPTURE_WRITER_PCAPNG_EPB_HDR + 8 : CAPTURE_WRITER_RECORD_HDR;
+            bytes += record->frames[i]->header.caplen;
+        }
+
+        if ((writer->max_size && capture_writer_file_size(writer) + bytes > writer->max_size)
+                || (writer->interval && ts.tv_sec >= writer->first.tv_sec + writer->interval)) {
+            capture_writer_file_close(writer);
+            if (capture_writer_file_open(writer) != 0)
+                return 1;
+        }
+    }
+
+    for (i = 0; i < record->count; i++) {
+        if (capture_writer_frame(writer, record->frames[i]) != 0)
+            return 1;
+    }
+
+    // Update current file index
+    if (!timerisset(&writer->first))
+        writer->first = ts;
+    writer->last = record->frames[record->count - 1]->header.ts;
+
+    if (record->callid && writer->callids_index
+            && !htable_find(writer->callids_index, record->callid)) {
+        htable_insert(writer->callids_index, record->callid, record->callid);
+        vector_append(writer->callids, record->callid);
+        record->callid = NULL;
+    }
+
+    return 0;
+}
+
+void
+capture_writer_record_destroy(capture_writer_record_t *record)
+{
+    uint32_t i;
+
+    for (i = 0; i < record->count; i++)
+        frame_buffer_destroy(record->frames[i]);
+    sng_free(record->callid);
+    sng_free(record);
+}
+
+int
+capture_writer_frame(capture_writer_t *writer, frame_buffer_t *frame)
+{
+    capture_writer_iface_t *iface;
+    uint64_t ts;
+    uint32_t len, pad, count;
+    u_char *block = writer->block;
+
+    if (!writer->pcapng) {
+        pcap_dump((u_char *) writer->pd, &frame->header, frame->data);
+        return 0;
+    }
+
+    // Frames from unknown sources are stored in the first interface
+    count = atomic_load_explicit(&writer->ifaces_count, memory_order_acquire);
+    if (count == 0 || frame->header.caplen > MAX_CAPTURE_LEN)
+        return 1;
+    iface = &writer->ifaces[frame->source < count ? frame->source : 0];
+
+    // Interfaces are described the first time they are used in each file
+    if (!iface->described && capture_writer_pcapng_iface(writer, iface) != 0)
+        return 1;
+
+    // Build the whole Enhanced Packet Block to write it at once
+    pad = (4 - frame->header.caplen % 4) % 4;
+    len = CAPTURE_WRITER_PCAPNG_EPB_HDR + frame->header.caplen + pad + 4;
+    ts = (uint64_t) frame->header.ts.tv_sec * 1000000 + frame->header.ts.tv_usec;
+    *(uint32_t *) (block) = CAPTURE_WRITER_PCAPNG_EPB;
+    *(uint32_t *) (block + 4) = len;
+    *(uint32_t *) (block + 8) = iface->id;
+    *(uint32_t *) (block + 12) = (uint32_t) (ts >> 32);
+    *(uint32_t *) (block + 16) = (uint32_t) ts;
+    *(uint32_t *) (block + 20) = frame->header.caplen;
+    *(uint32_t *) (block + 24) = frame->header.len;
+    memcpy(block + CAPTURE_WRITER_PCAPNG_EPB_HDR, frame->data, frame->header.caplen);
+    memset(block + CAPTURE_WRITER_PCAPNG_EPB_HDR + frame->header.caplen, 0, pad);
+    *(uint32_t *) (block + len - 4) = len;
+
+    if (fwrite(block, 1, len, writer->file) != len)
+        return 1;
+    writer->written += len;
+    return 0;
+}
+
+int
+capture_writer_pcapng_section(capture_writer_t *writer)
+{
+    u_char block[256];
+    uint32_t len = 24;
+
+    *(uint32_t *) (block) = CAPTURE_WRITER_PCAPNG_SHB;
+    *(uint32_t *) (block + 8) = CAPTURE_WRITER_PCAPNG_MAGIC;
+    *(uint16_t *) (block + 12) = 1;
+    *(uint16_t *) (block + 14) = 0;
+    // Section length is not known
+    *(int64_t *) (block + 16) = -1;
+    len += capture_writer_pcapng_option(block + len, 4, PACKAGE " " VERSION);
+    len += capture_writer_pcapng_option(block + len, 0, NULL);
+    *(uint32_t *) (block + 4) = len + 4;
+    *(uint32_t *) (block + len) = len + 4;
+    len += 4;
+
+    if (fwrite(block, 1, len, writer->file) != len)
+        return 1;
+    writer->written += len;
+    return 0;
+}
+
+int
+capture_writer_pcapng_iface(capture_writer_t *writer, capture_writer_iface_t *iface)
+{
+    u_char block[256];
+    uint32_t len = 16;
+
+    *(uint32_t *) (block) = CAPTURE_WRITER_PCAPNG_IDB;
+    *(uint16_t *) (block + 8) = (uint16_t) iface->link;
+    *(uint16_t *) (block + 10) = 0;
+    *(uint32_t *) (block + 12) = (uint32_t) iface->snaplen;
+    if (strlen(iface->name))
+        len += capture_writer_pcapng_option(block + len, 2, iface->name);
+    len += capture_writer_pcapng_option(block + len, 0, NULL);
+    *(uint32_t *) (block + 4) = len + 4;
+    *(uint32_t *) (block + len) = len + 4;
+    len += 4;
+
+    if (fwrite(block, 1, len, writer->file) != len)
+        return 1;
+    writer->written += len;
+    iface->described = true;
+    iface->id = writer->file_ifaces++;
+    return 0;
+}
+
+uint32_t
+capture_writer_pcapng_option(u_char *data, uint16_t code, const char *value)
+{
+    // Option values are padded to 32 bits
+    uint16_t len = value ? strlen(value) : 0;
+    uint32_t pad = (4 - len % 4) % 4;
+
+    *(uint16_t *) (data) = code;
+    *(uint16_t *) (data + 2) = len;
+    if (len) {
+        memcpy(data + 4, value, len);
+        memset(data + 4 + len, 0, pad);
+    }
+    return 4 + len + pad;
+}
+
+uint64_t
+capture_writer_file_size(capture_writer_t *writer)
+{
+    return (writer->pd) ? (uint64_t) pcap_dump_ftell(writer->pd) : writer->written;
+}
+
+int
+capture_writer_file_open(capture_writer_t *writer)
+{
+    const char *base, *ext;
+    uint32_t number;
+
+    if (capture_writer_rotates(writer)) {
+        // Number of this file (reusing old ones if requested)
+        number = writer->max_files ? writer->files % writer->max_files + 1 : writer->files + 1;
+        writer->files++;
+
+        // Add the number before file extension: file.pcap -> file.N.pcap
+        base = (base = strrchr(writer->outfile, '/')) ? base + 1 : writer->outfile;
+        if ((ext = strrchr(base, '.')) && ext != base) {
+            snprintf(writer->filename, sizeof(writer->filename), "%.*s.%u%s",
+                     (int) (ext - writer->outfile), writer->outfile, number, ext);
+        } else {
+            snprintf(writer->filename, sizeof(writer->filename), "%s.%u", writer->outfile, number);
+        }
+    } else {
+        strncpy(writer->filename, writer->outfile, sizeof(writer->filename) - 1);
+    }
+
+    // Open the file ourselves to set its buffer before anything is written
+    if (!strcmp(writer->filename, "-")) {
+        writer->file = stdout;
+    } else if (!(writer->file = fopen(writer->filename, "wb"))) {
+        return 1;
+    }
+    if (writer->buffer)
+        setvbuf(writer->file, writer->buffer, _IOFBF, CAPTURE_WRITER_BUFFER * 1024);
+
+    if (writer->pcapng) {
+        // Interfaces are described again in each file
+        writer->written = 0;
+        writer->file_ifaces = 0;
+        for (uint32_t i = 0; i < CAPTURE_WRITER_IFACES; i++)
+            writer->ifaces[i].described = false;
+        if (capture_writer_pcapng_section(writer) != 0) {
+            if (writer->file != stdout)
+                fclose(writer->file);
+            writer->file = NULL;
+            return 1;
+        }
+    } else if (!(writer->pd = pcap_dump_fopen(writer->handle, writer->file))) {
+        if (writer->file != stdout)
+            fclose(writer->file);
+        writer->file = NULL;
+        return 1;
+    }
+
+    timerclear(&writer->first);
+    timerclear(&writer->last);
+    return 0;
+}
+
+void
+capture_writer_file_close(capture_writer_t *writer)
+{
+    char filename[PATH_MAX + sizeof(CAPTURE_WRITER_INDEX_EXT)];
+    const char *callid;
+    FILE *index;
+
+    if (!writer->file)
+        return;
+
+    if (writer->pd) {
+        pcap_dump_close(writer->pd);
+    } else {
+        fclose(writer->file);
+    }
+    writer->pd = NULL;
+    writer->file = NULL;
+
+    if (!writer->callids)
+        return;
+
+    // Store the dialogs of the closed file next to it
+    snprintf(filename, sizeof(filename), "%s%s", writer->filename, CAPTURE_WRITER_INDEX_EXT);
+    if ((index = fopen(filename, "w"))) {
+        fprintf(index, "# start %ld.%06ld\n", (long) writer->first.tv_sec, (long) writer->first.tv_usec);
+        fprintf(index, "# end %ld.%06ld\n", (long) writer->last.tv_sec, (long) writer->last.tv_usec);
+        vector_iter_t it = vector_iterator(writer->callids);
+        while ((callid = vector_iterator_next(&it)))
+            fprintf(index, "%s\n", callid);
+        fclose(index);
+    }
+
+    // Start an empty index for the next file
+    vector_iter_t it = vector_iterator(writer->callids);
+    while ((callid = vector_iterator_next(&it)))
+        htable_remove(writer->callids_index, callid);
+    vector_destroy_items(writer->callids);
+    writer->callids = vector_create(128, 128);
+}
+
+unsigned long
+capture_writer_dropped(capture_writer_t *writer)
+{
+    if (!writer)
+        return 0;
+    return atomic_load_explicit(&writer->dropped, memory_order_relaxed);
+}
+
+void
+capture_writer_close(capture_writer_t *writer)
+{
+    if (!writer)
+        return;
+
+    // Let the writer empty its queue
+    writer->stopping = true;
+    capture_writer_wakeup(writer, true);
+    pthread_join(writer->thread, NULL);
+
+    if (capture_writer_dropped(writer)) {
+        fprintf(stderr, "%lu frames could not be written to %s (writer queue full)\n",
+                capture_writer_dropped(writer), writer->outfile);
+    }
+
+    capture_writer_file_close(writer);
+    pcap_close(writer->handle);
+    ring_destroy(writer->ring);
+    vector_destroy_items(writer->callids);
+    if (writer->callids_index)
+        htable_destroy(writer->callids_index);
+    sng_free(writer->payload);
+    sng_free(writer->block);
+    pthread_cond_destroy(&writer->cond);
+    pthread_mutex_destroy(&writer->lock);
+    sng_free(writer->buffer);
+    sng_free(writer);
+}
@@ -0,0 +1,307 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_writer.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to store captured packets from a dedicated thread
+ *
+ * Packets stored in the capture output file (-O) are not written while
+ * parsing. Instead, their frames are queued and a writer thread dumps them
+ * using a big file buffer, so disk latency never blocks capture threads nor
+ * interface refresh.
+ *
+ * Output can be split in several files by size or capture time. Each
+ * rotated file is stored with a sidecar index file (same name ended in
+ * .idx) with the Call-IDs of the SIP messages it contains.
+ *
+ * Files can also be stored in pcapng format, with one interface for each
+ * capture source, so frames from several devices keep their link type and
+ * the name of the device they were captured from.
+ */
+#ifndef __SNGREP_CAPTURE_WRITER_H
+#define __SNGREP_CAPTURE_WRITER_H
+
+#include "config.h"
+#include <stdio.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <pcap.h>
+#include "packet.h"
+#include "ring.h"
+#include "hash.h"
+#include "vector.h"
+
+//! Default number of frames pending to be written
+#define CAPTURE_WRITER_QUEUE    65536
+//! Output file buffer size (KB)
+#define CAPTURE_WRITER_BUFFER   1024
+//! Length of each frame header in pcap files
+#define CAPTURE_WRITER_RECORD_HDR 16
+//! Number of buckets of rotated file Call-ID index
+#define CAPTURE_WRITER_INDEX    1024
+//! Extension of rotated files index
+#define CAPTURE_WRITER_INDEX_EXT ".idx"
+//! Output files with this extension are stored in pcapng format
+#define CAPTURE_WRITER_PCAPNG_EXT ".pcapng"
+//! Max number of capture sources described in pcapng files
+#define CAPTURE_WRITER_IFACES   64
+//! pcapng block types and byte order magic
+#define CAPTURE_WRITER_PCAPNG_SHB   0x0A0D0D0A
+#define CAPTURE_WRITER_PCAPNG_IDB   0x00000001
+#define CAPTURE_WRITER_PCAPNG_EPB   0x00000006
+#define CAPTURE_WRITER_PCAPNG_MAGIC 0x1A2B3C4D
+//! Length of Enhanced Packet Block fields before frame data
+#define CAPTURE_WRITER_PCAPNG_EPB_HDR 28
+
+//! Forward declaration of capture source (capture.h)
+struct capture_info;
+
+//! Shorter declaration of capture_writer structure
+typedef struct capture_writer capture_writer_t;
+//! Shorter declaration of capture_writer_record structure
+typedef struct capture_writer_record capture_writer_record_t;
+//! Shorter declaration of capture_writer_iface structure
+typedef struct capture_writer_iface capture_writer_iface_t;
+
+/**
+ * @brief Capture source described as pcapng interface
+ */
+struct capture_writer_iface
+{
+    //! Link type of source frames
+    int link;
+    //! Max length of source frames
+    int snaplen;
+    //! Capture device or input file name
+    char name[128];
+    //! Interface has been described in current file
+    bool described;
+    //! Interface id in current file
+    uint32_t id;
+};
+
+/**
+ * @brief Frames of a packet pending to be written
+ */
+struct capture_writer_record
+{
+    //! Call-ID of the SIP message in these frames (NULL if unknown)
+    char *callid;
+    //! Number of frames
+    uint32_t count;
+    //! Packet frames
+    frame_buffer_t *frames[];
+};
+
+/**
+ * @brief Output file writer data
+ */
+struct capture_writer
+{
+    //! Output file name (as requested by user)
+    const char *outfile;
+    //! Name of current output file
+    char filename[PATH_MAX];
+    //! Dead handler with capture link type used to open output files
+    pcap_t *handle;
+    //! Output file stream
+    FILE *file;
+    //! Output file stream buffer
+    char *buffer;
+    //! libpcap dump file handler (NULL for pcapng files)
+    pcap_dumper_t *pd;
+    //! Files are written in pcapng format
+    bool pcapng;
+    //! Capture sources that can appear in pcapng files
+    capture_writer_iface_t ifaces[CAPTURE_WRITER_IFACES];
+    //! Number of capture sources (set before any of its frames is queued)
+    atomic_uint ifaces_count;
+    //! Number of interfaces described in current pcapng file
+    uint32_t file_ifaces;
+    //! Bytes written to current pcapng file
+    uint64_t written;
+    //! Buffer used to build pcapng blocks
+    u_char *block;
+    //! Max bytes of each output file (0 for no limit)
+    uint64_t max_size;
+    //! Max capture seconds stored in each output file (0 for no limit)
+    uint32_t interval;
+    //! Number of rotated files reused in a ring (0 for no limit)
+    uint32_t max_files;
+    //! Number of output files opened
+    uint32_t files;
+    //! Capture time of first and last frames of current file
+    struct timeval first, last;
+    //! Call-IDs stored in current file (sorted by first appearance)
+    vector_t *callids;
+    //! Call-IDs stored in current file indexed by value
+    htable_t *callids_index;
+    //! Payload copy used to search Call-ID headers (producer side)
+    char *payload;
+    //! Packets pending to be written (capture_writer_record_t)
+    ring_t *ring;
+    //! Wait for free slots instead of discarding frames
+    bool blocking;
+    //! Frames discarded because queue was full
+    atomic_ulong dropped;
+    //! Writer thread
+    pthread_t thread;
+    //! Writer thread has been requested to stop
+    atomic_bool stopping;
+    //! Writer thread is sleeping waiting for frames
+    atomic_bool waiting;
+    //! Lock and condition to wake up writer thread
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+/**
+ * @brief Open output file and start its writer thread
+ *
+ * If capture.outfile.size or capture.outfile.interval settings are set,
+ * packets are stored in numbered files (outfile.1.pcap, outfile.2.pcap...)
+ *
+ * @param handle Capture handler whose link type will be used in file
+ * @param outfile Output file name (- for standard output)
+ * @param blocking Wait for the writer instead of discarding frames when
+ * queue is full (used for input files)
+ * @return writer data or NULL if file can not be opened
+ */
+capture_writer_t *
+capture_writer_open(pcap_t *handle, const char *outfile, bool blocking);
+
+/**
+ * @brief Add a capture source that can be stored in output files
+ *
+ * Must be called before any frame of the source is queued.
+ */
+void
+capture_writer_interface(capture_writer_t *writer, struct capture_info *capinfo);
+
+/**
+ * @brief Queue all frames of a packet to be written
+ *
+ * Only one thread can queue packets at the same time. Callers must be
+ * holding capture lock.
+ */
+void
+capture_writer_packet(capture_writer_t *writer, const packet_t *packet);
+
+/**
+ * @brief Notify writer thread that there are queued frames
+ */
+void
+capture_writer_wakeup(capture_writer_t *writer, bool force);
+
+/**
+ * @brief Writer thread function
+ */
+void
+capture_writer_thread(void *info);
+
+/**
+ * @brief Check if output files are being rotated
+ */
+bool
+capture_writer_rotates(capture_writer_t *writer);
+
+/**
+ * @brief Write a queued packet, opening next file if required
+ *
+ * @return 0 if the packet has been written, 1 otherwise
+ */
+int
+capture_writer_record(capture_writer_t *writer, capture_writer_record_t *record);
+
+/**
+ * @brief Deallocate a queued packet and release its frames
+ */
+void
+capture_writer_record_destroy(capture_writer_record_t *record);
+
+/**
+ * @brief Write a frame to current output file
+ *
+ * @return 0 if the frame has been written, 1 otherwise
+ */
+int
+capture_writer_frame(capture_writer_t *writer, frame_buffer_t *frame);
+
+/**
+ * @brief Write pcapng Section Header Block of a new file
+ *
+ * @return 0 if the block has been written, 1 otherwise
+ */
+int
+capture_writer_pcapng_section(capture_writer_t *writer);
+
+/**
+ * @brief Write pcapng Interface Description Block of a capture source
+ *
+ * @return 0 if the block has been written, 1 otherwise
+ */
+int
+capture_writer_pcapng_iface(capture_writer_t *writer, capture_writer_iface_t *iface);
+
+/**
+ * @brief Add a pcapng block option
+ *
+ * @return length of the option (with padding)
+ */
+uint32_t
+capture_writer_pcapng_option(u_char *data, uint16_t code, const char *value);
+
+/**
+ * @brief Get current output file size
+ */
+uint64_t
+capture_writer_file_size(capture_writer_t *writer);
+
+/**
+ * @brief Open next output file
+ *
+ * @return 0 if file has been opened, 1 otherwise
+ */
+int
+capture_writer_file_open(capture_writer_t *writer);
+
+/**
+ * @brief Close current output file and write its index if rotating
+ */
+void
+capture_writer_file_close(capture_writer_t *writer);
+
+/**
+ * @brief Get number of frames discarded because writer queue was full
+ */
+unsigned long
+capture_writer_dropped(capture_writer_t *writer);
+
+/**
+ * @brief Write all queued frames and close output file
+ */
+void
+capture_writer_close(capture_writer_t *writer);
+
+#endif /* __SNGREP_CAPTURE_WRITER_H */
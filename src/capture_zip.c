@@ -0,0 +1,376 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_zip.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in capture_zip.h
+ *
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "capture_zip.h"
+#include "setting.h"
+#include "util.h"
+
+//! Preset dictionary with common SIP and SDP strings (most common last)
+static const char capture_zip_dictionary[] =
+    "a=rtpmap:101 telephone-event/8000\r\na=fmtp:101 0-16\r\na=ptime:20\r\n"
+    "a=rtpmap:8 PCMA/8000\r\na=rtpmap:0 PCMU/8000\r\na=sendrecv\r\n"
+    "v=0\r\no=- IN IP4 \r\ns=-\r\nc=IN IP4 \r\nt=0 0\r\nm=audio  RTP/AVP 0 8 101\r\n"
+    "Allow: INVITE, ACK, CANCEL, OPTIONS, BYE, REFER, NOTIFY, INFO, UPDATE\r\n"
+    "Supported: replaces, timer\r\nUser-Agent: Server: Accept: application/sdp\r\n"
+    "Subscription-State: Event: Expires: Record-Route: <sip:;lr>\r\nRoute: "
+    "Content-Type: application/sdp\r\nContent-Length: \r\n\r\n"
+    "Max-Forwards: 70\r\nContact: <sip:>\r\nCSeq: 1 INVITE\r\nCSeq: 2 BYE\r\n"
+    "Call-ID: \r\nFrom: <sip:>;tag=\r\nTo: <sip:>\r\n"
+    "SIP/2.0 100 Trying\r\nSIP/2.0 180 Ringing\r\nSIP/2.0 200 OK\r\n"
+    "Via: SIP/2.0/UDP ;branch=z9hG4bK;rport\r\n"
+    "INVITE sip: SIP/2.0\r\nACK sip: SIP/2.0\r\nBYE sip: SIP/2.0\r\n";
+
+capture_zip_t *
+capture_zip_create()
+{
+    capture_zip_t *zip;
+
+    if (!(zip = sng_malloc(sizeof(capture_zip_t))))
+        return NULL;
+
+    // Streams are reused for all packets (raw deflate, without headers)
+    if (deflateInit2(&zip->deflater, CAPTURE_ZIP_LEVEL, Z_DEFLATED, -CAPTURE_ZIP_WBITS, CAPTURE_ZIP_MEMLEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+        sng_free(zip);
+        return NULL;
+    }
+    if (inflateInit2(&zip->inflater, -CAPTURE_ZIP_WBITS) != Z_OK) {
+        deflateEnd(&zip->deflater);
+        sng_free(zip);
+        return NULL;
+    }
+
+    // Packets that are kept uncompressed
+    if (setting_get_intvalue(SETTING_CAPTURE_STORAGE_CACHE) > 0) {
+        zip->size = setting_get_intvalue(SETTING_CAPTURE_STORAGE_CACHE);
+    } else {
+        zip->size = CAPTURE_ZIP_CACHE;
+    }
+
+    return zip;
+}
+
+void
+capture_zip_store_packet(capture_zip_t *zip, packet_t *packet)
+{
+    capture_zip_entry_t *entry;
+
+    if (!zip || !packet || packet->zip)
+        return;
+
+    if (!(entry = sng_malloc(sizeof(capture_zip_entry_t))))
+        return;
+
+    // Recently stored packets are likely to be requested again soon
+    entry->packet = packet;
+    entry->cache = zip;
+    entry->loaded = true;
+    packet->zip = entry;
+    capture_zip_link(zip, entry);
+    capture_zip_shrink(zip);
+}
+
+int
+capture_zip_load(capture_zip_entry_t *entry)
+{
+    packet_t *packet = entry->packet;
+    uint32_t offset = 0;
+    z_stream stream;
+    frame_t *frame;
+    int ret;
+
+    // Already in cache, just mark it as recently used
+    if (entry->loaded) {
+        if (entry->cache && entry->cache->first != entry) {
+            capture_zip_unlink(entry->cache, entry);
+            capture_zip_link(entry->cache, entry);
+        }
+        return 0;
+    }
+
+    if (!(entry->unzipped = malloc(entry->len)))
+        return 1;
+
+    if (entry->cache) {
+        ret = capture_zip_inflate(&entry->cache->inflater, entry);
+    } else {
+        // Cache has been destroyed, use a temporal stream
+        memset(&stream, 0, sizeof(stream));
+        if (inflateInit2(&stream, -CAPTURE_ZIP_WBITS) != Z_OK) {
+            ret = 1;
+        } else {
+            ret = capture_zip_inflate(&stream, entry);
+            inflateEnd(&stream);
+        }
+    }
+
+    if (ret != 0) {
+        sng_free(entry->unzipped);
+        entry->unzipped = NULL;
+        return 1;
+    }
+
+    vector_iter_t it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        frame->data = entry->unzipped + offset;
+        offset += frame->header->caplen + 1;
+    }
+
+    if (entry->payload_offset != CAPTURE_ZIP_NO_PAYLOAD) {
+        packet->payload = entry->unzipped + entry->payload_offset;
+        packet->payload_ref = true;
+    }
+
+    entry->loaded = true;
+    if (entry->cache) {
+        capture_zip_link(entry->cache, entry);
+        capture_zip_shrink(entry->cache);
+    }
+    return 0;
+}
+
+int
+capture_zip_inflate(z_stream *stream, capture_zip_entry_t *entry)
+{
+    if (inflateReset(stream) != Z_OK
+            || inflateSetDictionary(stream, (const Bytef *) capture_zip_dictionary,
+                                    sizeof(capture_zip_dictionary) - 1) != Z_OK)
+        return 1;
+
+    stream->next_in = entry->data;
+    stream->avail_in = entry->size;
+    stream->next_out = entry->unzipped;
+    stream->avail_out = entry->len;
+    if (inflate(stream, Z_FINISH) != Z_STREAM_END || stream->total_out != entry->len)
+        return 1;
+    return 0;
+}
+
+void
+capture_zip_shrink(capture_zip_t *zip)
+{
+    capture_zip_entry_t *entry;
+
+    while (zip->count > zip->size && (entry = zip->last)) {
+        capture_zip_unlink(zip, entry);
+        // Packets that can not be compressed stay in memory
+        if (capture_zip_compress(zip, entry) != 0)
+            entry->cache = NULL;
+    }
+}
+
+int
+capture_zip_compress(capture_zip_t *zip, capture_zip_entry_t *entry)
+{
+    packet_t *packet = entry->packet;
+    frame_t *frame;
+    size_t len = 0, offset = 0, size;
+    capture_zip_entry_t *moved;
+    u_char *buffer;
+
+    // Compressed data is still valid, just release the uncompressed copy
+    if (entry->compressed) {
+        vector_iter_t it = vector_iterator(packet->frames);
+        while ((frame = vector_iterator_next(&it)))
+            frame->data = NULL;
+        packet->payload = NULL;
+        packet->payload_ref = false;
+        sng_free(entry->unzipped);
+        entry->unzipped = NULL;
+        entry->loaded = false;
+        return 0;
+    }
+
+    // Get uncompressed data length
+    entry->payload_offset = CAPTURE_ZIP_NO_PAYLOAD;
+    vector_iter_t it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        // Only frames stored in memory can be compressed
+        if (!frame->data || frame->segment)
+            return 1;
+        // Payload pointing to this frame will point to its uncompressed copy
+        if (packet->payload_ref && packet->payload >= frame->data
+                && packet->payload <= frame->data + frame->header->caplen) {
+            entry->payload_offset = len + (packet->payload - frame->data);
+        }
+        len += frame->header->caplen + 1;
+    }
+    if (packet->payload && entry->payload_offset == CAPTURE_ZIP_NO_PAYLOAD) {
+        if (packet->payload_segment)
+            return 1;
+        entry->payload_offset = len;
+        len += packet->payload_len + 1;
+    }
+    if (len >= CAPTURE_ZIP_NO_PAYLOAD)
+        return 1;
+
+    // Build uncompressed data in reusable buffers
+    if (zip->raw_size < len) {
+        if (!(buffer = realloc(zip->raw, len)))
+            return 1;
+        zip->raw = buffer;
+        zip->raw_size = len;
+    }
+    if (zip->compressed_size < deflateBound(&zip->deflater, len)) {
+        size = deflateBound(&zip->deflater, len);
+        if (!(buffer = realloc(zip->compressed, size)))
+            return 1;
+        zip->compressed = buffer;
+        zip->compressed_size = size;
+    }
+
+    it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        memcpy(zip->raw + offset, frame->data, frame->header->caplen);
+        zip->raw[offset + frame->header->caplen] = '\0';
+        offset += frame->header->caplen + 1;
+    }
+    if (entry->payload_offset == offset) {
+        memcpy(zip->raw + offset, packet->payload, packet->payload_len);
+        zip->raw[offset + packet->payload_len] = '\0';
+    }
+
+    // Common SIP strings are found in the dictionary, even in short messages
+    if (deflateReset(&zip->deflater) != Z_OK
+            || deflateSetDictionary(&zip->deflater, (const Bytef *) capture_zip_dictionary,
+                                    sizeof(capture_zip_dictionary) - 1) != Z_OK)
+        return 1;
+    zip->deflater.next_in = zip->raw;
+    zip->deflater.avail_in = len;
+    zip->deflater.next_out = zip->compressed;
+    zip->deflater.avail_out = zip->compressed_size;
+    if (deflate(&zip->deflater, Z_FINISH) != Z_STREAM_END)
+        return 1;
+    size = zip->deflater.total_out;
+
+    // Store compressed data with the entry (it is not linked in cache now)
+    if (!(moved = realloc(entry, sizeof(capture_zip_entry_t) + size)))
+        return 1;
+    entry = packet->zip = moved;
+    memcpy(entry->data, zip->compressed, size);
+    entry->compressed = true;
+    entry->size = size;
+    entry->len = len;
+
+    // Release uncompressed data
+    it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        if (frame->buffer) {
+            // Keep frame header, it is used for packet timestamps
+            frame->header = malloc(sizeof(struct pcap_pkthdr));
+            memcpy(frame->header, &frame->buffer->header, sizeof(struct pcap_pkthdr));
+            frame_buffer_destroy(frame->buffer);
+            frame->buffer = NULL;
+        } else {
+            free(frame->data);
+        }
+        frame->data = NULL;
+    }
+    if (!packet->payload_ref)
+        sng_free(packet->payload);
+    packet->payload = NULL;
+    packet->payload_ref = false;
+    entry->loaded = false;
+    return 0;
+}
+
+void
+capture_zip_link(capture_zip_t *zip, capture_zip_entry_t *entry)
+{
+    entry->prev = NULL;
+    entry->next = zip->first;
+    if (zip->first) {
+        zip->first->prev = entry;
+    } else {
+        zip->last = entry;
+    }
+    zip->first = entry;
+    zip->count++;
+}
+
+void
+capture_zip_unlink(capture_zip_t *zip, capture_zip_entry_t *entry)
+{
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        zip->first = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        zip->last = entry->prev;
+    }
+    entry->prev = entry->next = NULL;
+    zip->count--;
+}
+
+void
+capture_zip_forget(capture_zip_entry_t *entry)
+{
+    packet_t *packet = entry->packet;
+    frame_t *frame;
+
+    if (entry->cache && entry->loaded)
+        capture_zip_unlink(entry->cache, entry);
+
+    // Frames and payload point to uncompressed data (or nothing)
+    if (entry->compressed) {
+        vector_iter_t it = vector_iterator(packet->frames);
+        while ((frame = vector_iterator_next(&it)))
+            frame->data = NULL;
+        packet->payload = NULL;
+        packet->payload_ref = false;
+    }
+
+    sng_free(entry->unzipped);
+    sng_free(entry);
+    packet->zip = NULL;
+}
+
+void
+capture_zip_destroy(capture_zip_t *zip)
+{
+    capture_zip_entry_t *entry;
+
+    if (!zip)
+        return;
+
+    // Packets in cache will never be compressed
+    for (entry = zip->first; entry; entry = entry->next)
+        entry->cache = NULL;
+
+    deflateEnd(&zip->deflater);
+    inflateEnd(&zip->inflater);
+    sng_free(zip->raw);
+    sng_free(zip->compressed);
+    sng_free(zip);
+}
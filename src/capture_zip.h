@@ -0,0 +1,192 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_zip.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to store captured frames compressed in memory
+ *
+ * When capture.storage is set to compressed, stored packets are kept in a
+ * cache of recently used packets. Packets leaving the cache get all their
+ * frames data and payload compressed in a single block, and they are
+ * uncompressed (and added to the cache again) when their payload or
+ * frames are requested. A preset dictionary of common SIP strings is used,
+ * as each packet is compressed on its own.
+ *
+ * Cache is only used while holding capture lock, like any access to stored
+ * packets.
+ */
+#ifndef __SNGREP_CAPTURE_ZIP_H
+#define __SNGREP_CAPTURE_ZIP_H
+
+#include "config.h"
+#include <stdint.h>
+#include <zlib.h>
+#include "packet.h"
+
+//! Default number of uncompressed packets
+#define CAPTURE_ZIP_CACHE       1024
+//! Compression level used for stored packets (fastest)
+#define CAPTURE_ZIP_LEVEL       1
+//! Compression window bits and memory level (streams are reset for each packet)
+#define CAPTURE_ZIP_WBITS       12
+#define CAPTURE_ZIP_MEMLEVEL    2
+//! Packet has no payload
+#define CAPTURE_ZIP_NO_PAYLOAD  UINT32_MAX
+
+//! Shorter declaration of capture_zip structure
+typedef struct capture_zip capture_zip_t;
+//! Shorter declaration of capture_zip_entry structure
+typedef struct capture_zip_entry capture_zip_entry_t;
+
+/**
+ * @brief Compressed data of a stored packet
+ *
+ * Uncompressed data contains each frame data followed by a zero byte and
+ * the payload (also followed by a zero byte) if it is not part of any
+ * frame.
+ */
+struct capture_zip_entry
+{
+    //! Packet owning this data
+    packet_t *packet;
+    //! Cache this packet belongs to (NULL once cache has been destroyed)
+    capture_zip_t *cache;
+    //! Compressed data length
+    uint32_t size;
+    //! Uncompressed data length
+    uint32_t len;
+    //! Payload offset in uncompressed data
+    uint32_t payload_offset;
+    //! Uncompressed data while packet is in cache
+    u_char *unzipped;
+    //! Packet is in cache (its frames and payload can be used)
+    bool loaded;
+    //! Previous and next packets in cache (most recently used first)
+    capture_zip_entry_t *prev, *next;
+    //! Packet has left the cache at least once, data is valid
+    bool compressed;
+    //! Compressed data
+    u_char data[];
+};
+
+/**
+ * @brief Cache of uncompressed packets
+ */
+struct capture_zip
+{
+    //! Max number of uncompressed packets
+    uint32_t size;
+    //! Number of uncompressed packets
+    uint32_t count;
+    //! Most and least recently used packets
+    capture_zip_entry_t *first, *last;
+    //! Streams used to compress and uncompress packets data
+    z_stream deflater, inflater;
+    //! Buffers used to compress packets data
+    u_char *raw, *compressed;
+    //! Allocated size of compression buffers
+    size_t raw_size, compressed_size;
+};
+
+/**
+ * @brief Create compressed storage for captured frames
+ *
+ * @return compressed storage data or NULL on allocation error
+ */
+capture_zip_t *
+capture_zip_create();
+
+/**
+ * @brief Add a parsed packet to compressed storage
+ *
+ * Packet is kept uncompressed until it leaves the cache.
+ */
+void
+capture_zip_store_packet(capture_zip_t *zip, packet_t *packet);
+
+/**
+ * @brief Make frames data and payload of a stored packet available
+ *
+ * Pointers to packet frames data and payload are valid until next stored
+ * packet or next uncompressed packet makes it leave the cache.
+ *
+ * @return 0 if packet data can be used, 1 otherwise
+ */
+int
+capture_zip_load(capture_zip_entry_t *entry);
+
+/**
+ * @brief Uncompress packet data using the given stream
+ *
+ * @return 0 if packet data has been uncompressed, 1 otherwise
+ */
+int
+capture_zip_inflate(z_stream *stream, capture_zip_entry_t *entry);
+
+/**
+ * @brief Remove the least recently used packets from cache to fit its size
+ */
+void
+capture_zip_shrink(capture_zip_t *zip);
+
+/**
+ * @brief Compress packet data (the first time) and release uncompressed data
+ *
+ * Compressed data is stored with the entry, so the packet gets a new
+ * entry the first time it is compressed.
+ *
+ * @return 0 if packet data has been compressed, 1 otherwise
+ */
+int
+capture_zip_compress(capture_zip_t *zip, capture_zip_entry_t *entry);
+
+/**
+ * @brief Add a packet as most recently used one
+ */
+void
+capture_zip_link(capture_zip_t *zip, capture_zip_entry_t *entry);
+
+/**
+ * @brief Remove a packet from cache list
+ */
+void
+capture_zip_unlink(capture_zip_t *zip, capture_zip_entry_t *entry);
+
+/**
+ * @brief Free compressed data of a packet being destroyed
+ *
+ * Packet frames and payload not owned by the packet are reset.
+ */
+void
+capture_zip_forget(capture_zip_entry_t *entry);
+
+/**
+ * @brief Stop compressing stored packets
+ *
+ * Packets in cache stay uncompressed. Compressed packets can still be used
+ * until they are destroyed.
+ */
+void
+capture_zip_destroy(capture_zip_t *zip);
+
+#endif /* __SNGREP_CAPTURE_ZIP_H */
@@ -0,0 +1,225 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file ui_aggregate.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in ui_aggregate.h
+ */
+/*
+ * +------------------------------------------------------------------------------+
+ * |                              Keepalive Messages                              |
+ * +------------------------------------------------------------------------------+
+ * |  Source          Destination     Method    Resp     Count  First     Last    |
+ * |  10.0.0.1        10.0.0.2        OPTIONS   -        12345  10:00:01  10:59:58|
+ * |  10.0.0.2        10.0.0.1        OPTIONS   200      12345  10:00:01  10:59:58|
+ * |  ...                                                                         |
+ * +------------------------------------------------------------------------------+
+ * |                              Press ESC to leave                              |
+ * +------------------------------------------------------------------------------+
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <time.h>
+#include "sip.h"
+#include "sip_aggregate.h"
+#include "keybinding.h"
+#include "ui_manager.h"
+#include "ui_aggregate.h"
+
+/**
+ * Ui Structure definition for Keepalive Messages panel
+ */
+ui_t ui_aggregate = {
+    .type = PANEL_AGGREGATE,
+    .panel = NULL,
+    .create = aggregate_create,
+    .destroy = aggregate_destroy,
+    .draw = aggregate_draw,
+    .handle_key = aggregate_handle_key
+};
+
+/**
+ * @brief Sort counters with the highest count first
+ */
+static int
+aggregate_sorter(void *one, void *two)
+{
+    unsigned long count1 = ((sip_aggregate_t *) one)->count;
+    unsigned long count2 = ((sip_aggregate_t *) two)->count;
+
+    return (count1 < count2) - (count1 > count2);
+}
+
+/**
+ * @brief Format the time of day of a capture time
+ */
+static const char *
+aggregate_time(struct timeval tv, char *out, size_t len)
+{
+    time_t t = tv.tv_sec;
+    strftime(out, len, "%H:%M:%S", localtime(&t));
+    return out;
+}
+
+void
+aggregate_create(ui_t *ui)
+{
+    aggregate_info_t *info;
+
+    // Calculate window dimensions
+    ui_panel_create(ui, LINES < 30 ? LINES : 30, 80);
+
+    // Initialize panel specific data
+    info = sng_malloc(sizeof(aggregate_info_t));
+    set_panel_userptr(ui->panel, (void*) info);
+
+    // Set the window title and boxes
+    mvwprintw(ui->win, 1, ui->width / 2 - 9, "Keepalive Messages");
+    wattron(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
+    title_foot_box(ui->panel);
+    mvwprintw(ui->win, ui->height - 2, ui->width / 2 - 9, "Press ESC to leave");
+    wattroff(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
+}
+
+void
+aggregate_destroy(ui_t *ui)
+{
+    aggregate_info_t *info;
+
+    if ((info = aggregate_info(ui)))
+        sng_free(info);
+    ui_panel_destroy(ui);
+}
+
+aggregate_info_t *
+aggregate_info(ui_t *ui)
+{
+    return (aggregate_info_t *) panel_userptr(ui->panel);
+}
+
+int
+aggregate_draw(ui_t *ui)
+{
+    aggregate_info_t *info;
+    sip_aggregate_t *item;
+    vector_t *sorted;
+    char src[ADDRESSLEN], dst[ADDRESSLEN], resp[12], first[16], last[16];
+    const char *method;
+    int i, line, rows;
+
+    if (!(info = aggregate_info(ui)))
+        return -1;
+
+    // Clear previous values
+    for (line = 3; line < ui->height - 3; line++)
+        mvwprintw(ui->win, line, 1, "%*s", ui->width - 2, "");
+
+    // Counters are only kept for configured methods
+    if (!sip_aggregate_list() || !vector_count(sip_aggregate_list())) {
+        mvwprintw(ui->win, 3, 3, "No keepalive messages counted.");
+        mvwprintw(ui->win, 4, 3, "Set methods to count in %s setting.", setting_name(SETTING_SIP_AGGREGATE));
+        return 0;
+    }
+
+    wattron(ui->win, A_BOLD);
+    mvwprintw(ui->win, 3, 3, "%-15s %-15s %-9s %-4s %9s  %-8s  %-8s",
+              "Source", "Destination", "Method", "Resp", "Count", "First", "Last");
+    wattroff(ui->win, A_BOLD);
+
+    // Busiest counters first, sorted on a copy of the list
+    if (!(sorted = vector_clone(sip_aggregate_list())))
+        return 0;
+    vector_sort(sorted, aggregate_sorter);
+
+    // Keep scroll inside the list
+    rows = ui->height - 7;
+    if (info->scroll > vector_count(sorted) - rows)
+        info->scroll = vector_count(sorted) - rows;
+    if (info->scroll < 0)
+        info->scroll = 0;
+
+    for (i = info->scroll, line = 4; i < vector_count(sorted) && line < ui->height - 3; i++, line++) {
+        item = vector_item(sorted, i);
+        address_get_ip(item->src, src);
+        address_get_ip(item->dst, dst);
+        method = sip_method_str(item->method);
+        if (item->reqresp >= 100) {
+            snprintf(resp, sizeof(resp), "%d", item->reqresp);
+        } else {
+            snprintf(resp, sizeof(resp), "-");
+        }
+        mvwprintw(ui->win, line, 3, "%-15.15s %-15.15s %-9.9s %-4s %9lu  %-8s  %-8s",
+                  src, dst, method ? method : "", resp, item->count,
+                  aggregate_time(item->first, first, sizeof(first)),
+                  aggregate_time(item->last, last, sizeof(last)));
+    }
+    vector_destroy(sorted);
+
+    // Combinations that could not be counted
+    if (sip_aggregate_dropped()) {
+        mvwprintw(ui->win, ui->height - 4, 3, "%lu messages not counted (too many combinations)",
+                  sip_aggregate_dropped());
+    }
+
+    return 0;
+}
+
+int
+aggregate_handle_key(ui_t *ui, int key)
+{
+    aggregate_info_t *info;
+    int action = -1;
+
+    if (!(info = aggregate_info(ui)))
+        return KEY_NOT_HANDLED;
+
+    // Check actions for this key
+    while ((action = key_find_action(key, action)) != ERR) {
+        switch (action) {
+            case ACTION_DOWN:
+                info->scroll++;
+                break;
+            case ACTION_UP:
+                info->scroll--;
+                break;
+            case ACTION_NPAGE:
+                info->scroll += ui->height - 7;
+                break;
+            case ACTION_PPAGE:
+                info->scroll -= ui->height - 7;
+                break;
+            case ACTION_BEGIN:
+                info->scroll = 0;
+                break;
+            default:
+                // Parse next action
+                continue;
+        }
+        // This panel has handled the key successfully
+        return KEY_HANDLED;
+    }
+
+    // Return if this panel has handled or not the key
+    return KEY_NOT_HANDLED;
+}
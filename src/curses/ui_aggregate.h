@@ -0,0 +1,93 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file ui_aggregate.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to manage ui window for keepalive messages counters
+ */
+#ifndef __SNGREP_UI_AGGREGATE_H
+#define __SNGREP_UI_AGGREGATE_H
+
+//! Sorter declaration of struct aggregate_info
+typedef struct aggregate_info aggregate_info_t;
+
+/**
+ * @brief Keepalive panel status information
+ */
+struct aggregate_info {
+    //! First displayed counter
+    int scroll;
+};
+
+/**
+ * @brief Creates a new keepalive messages panel
+ *
+ * This function allocates all required memory for
+ * displaying the keepalive panel and draws its static
+ * information.
+ *
+ * @param ui UI structure pointer
+ */
+void
+aggregate_create(ui_t *ui);
+
+/**
+ * @brief Destroy keepalive messages panel
+ *
+ * @param ui UI structure pointer
+ */
+void
+aggregate_destroy(ui_t *ui);
+
+/**
+ * @brief Get custom information of given panel
+ *
+ * @param ui UI structure pointer
+ * @return a pointer to info structure of given panel
+ */
+aggregate_info_t *
+aggregate_info(ui_t *ui);
+
+/**
+ * @brief Draw keepalive messages counters
+ *
+ * Counters are sorted by number of messages each time the
+ * panel is redrawn.
+ *
+ * @param ui UI structure pointer
+ * @return 0 if the panel has been drawn, -1 otherwise
+ */
+int
+aggregate_draw(ui_t *ui);
+
+/**
+ * @brief Handle keepalive panel keys
+ *
+ * @param ui UI structure pointer
+ * @param key key code
+ * @return enum @key_handler_ret
+ */
+int
+aggregate_handle_key(ui_t *ui, int key);
+
+#endif /* __SNGREP_UI_AGGREGATE_H */
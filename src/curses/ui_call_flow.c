@@ -29,6 +29,7 @@
 #include "config.h"
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include "capture.h"
 #include "ui_manager.h"
 #include "ui_call_flow.h"
@@ -100,6 +101,11 @@ call_flow_create(ui_t *ui)
     info->columns = vector_create(2, 1);
     info->arrows = vector_create(20, 5);
     vector_set_sorter(info->arrows, call_flow_arrow_sorter);
+    info->arrowindex = htable_create(64);
+    info->colindex = htable_create(16);
+    info->colkeys = vector_create(2, 4);
+    vector_set_destroyer(info->colkeys, vector_generic_destroyer);
+    info->groupsize = -1;
 
     // Store it into panel userptr
     set_panel_userptr(ui->panel, (void*) info);
@@ -116,6 +122,10 @@ call_flow_destroy(ui_t *ui)
         vector_destroy_items(info->columns);
         // Delete panel arrows
         vector_destroy_items(info->arrows);
+        // Delete arrows and columns indexes
+        htable_destroy(info->arrowindex);
+        htable_destroy(info->colindex);
+        vector_destroy_items(info->colkeys);
         // Delete panel windows
         delwin(info->flow_win);
         delwin(info->raw_win);
@@ -165,6 +175,8 @@ int
 call_flow_draw(ui_t *ui)
 {
     char title[256];
+    bool grown;
+    int size;
 
     // Get panel information
     call_flow_info_t *info = call_flow_info(ui);
@@ -196,11 +208,16 @@ call_flow_draw(ui_t *ui)
     // Show some keybinding
     call_flow_draw_footer(ui);
 
+    // Only look for new columns and arrows if group has grown
+    size = call_flow_group_size(ui);
+    grown = (size != info->groupsize);
+    info->groupsize = size;
+
     // Redraw columns
-    call_flow_draw_columns(ui);
+    call_flow_draw_columns(ui, grown);
 
     // Redraw arrows
-    call_flow_draw_arrows(ui);
+    call_flow_draw_arrows(ui, grown);
 
     // Redraw preview
     call_flow_draw_preview(ui);
@@ -249,7 +266,7 @@ call_flow_draw_footer(ui_t *ui)
 }
 
 int
-call_flow_draw_columns(ui_t *ui)
+call_flow_draw_columns(ui_t *ui, bool grown)
 {
     call_flow_info_t *info;
     call_flow_column_t *column;
@@ -259,6 +276,7 @@ call_flow_draw_columns(ui_t *ui)
     vector_iter_t streams;
     vector_iter_t columns;
     char coltext[MAX_SETTING_LEN];
+    char ip[ADDRESSLEN];
     address_t addr;
 
     // Get panel information
@@ -272,13 +290,13 @@ call_flow_draw_columns(ui_t *ui)
     }
 
     // Load columns
-    while((msg = call_group_get_next_msg(info->group, msg))) {
+    while(grown && (msg = call_group_get_next_msg(info->group, msg))) {
         call_flow_column_add(ui, msg->call->callid, msg->packet->src);
         call_flow_column_add(ui, msg->call->callid, msg->packet->dst);
     }
 
     // Add RTP columns FIXME Really
-    if (!setting_disabled(SETTING_CF_MEDIA)) {
+    if (grown && !setting_disabled(SETTING_CF_MEDIA)) {
         while ((call = call_group_get_next(info->group, call)) ) {
             streams = vector_iterator(call->streams);
 
@@ -311,7 +329,7 @@ call_flow_draw_columns(ui_t *ui)
         if (setting_enabled(SETTING_CF_SPLITCALLID) || !column->addr.port) {
             snprintf(coltext, MAX_SETTING_LEN, "%s", column->alias);
         } else if (setting_enabled(SETTING_DISPLAY_ALIAS)) {
-            if (strlen(column->addr.ip) > 15) {
+            if (strlen(address_get_ip(column->addr, ip)) > 15) {
                 snprintf(coltext, MAX_SETTING_LEN, "..%.*s:%u",
                          MAX_SETTING_LEN - 7, column->alias + strlen(column->alias) - 13, column->addr.port);
             } else {
@@ -319,12 +337,12 @@ call_flow_draw_columns(ui_t *ui)
                          MAX_SETTING_LEN - 7, column->alias, column->addr.port);
             }
         } else {
-            if (strlen(column->addr.ip) > 15) {
+            if (strlen(address_get_ip(column->addr, ip)) > 15) {
                 snprintf(coltext, MAX_SETTING_LEN, "..%.*s:%u",
-                         MAX_SETTING_LEN - 7, column->addr.ip + strlen(column->addr.ip) - 13, column->addr.port);
+                         MAX_SETTING_LEN - 7, ip + strlen(ip) - 13, column->addr.port);
             } else {
                 snprintf(coltext, MAX_SETTING_LEN, "%.*s:%u",
-                         MAX_SETTING_LEN - 7, column->addr.ip, column->addr.port);
+                         MAX_SETTING_LEN - 7, ip, column->addr.port);
             }
         }
 
@@ -336,7 +354,7 @@ call_flow_draw_columns(ui_t *ui)
 }
 
 void
-call_flow_draw_arrows(ui_t *ui)
+call_flow_draw_arrows(ui_t *ui, bool grown)
 {
     call_flow_info_t *info;
     call_flow_arrow_t *arrow = NULL;
@@ -347,18 +365,20 @@ call_flow_draw_arrows(ui_t *ui)
 
     // Create pending SIP arrows
     sip_msg_t *msg = NULL;
-    while ((msg = call_group_get_next_msg(info->group, msg))) {
+    while (grown && (msg = call_group_get_next_msg(info->group, msg))) {
         if (!call_flow_arrow_find(ui, msg)) {
             arrow = call_flow_arrow_create(ui, msg, CF_ARROW_SIP);
             vector_append(info->arrows, arrow);
+            htable_insert(info->arrowindex, arrow->key, arrow);
         }
     }
     // Create pending RTP arrows
     rtp_stream_t *stream = NULL;
-    while ((stream = call_group_get_next_stream(info->group, stream))) {
+    while (grown && (stream = call_group_get_next_stream(info->group, stream))) {
         if (!call_flow_arrow_find(ui, stream)) {
             arrow = call_flow_arrow_create(ui, stream, CF_ARROW_RTP);
             vector_append(info->arrows, arrow);
+            htable_insert(info->arrowindex, arrow->key, arrow);
         }
     }
 
@@ -427,6 +447,7 @@ call_flow_draw_message(ui_t *ui, call_flow_arrow_t *arrow, int cline)
     const char *callid;
     char msg_method[SIP_ATTR_MAXLEN];
     char msg_time[80];
+    char ip[ADDRESSLEN];
     address_t src;
     address_t dst;
     char method[80];
@@ -486,12 +507,12 @@ call_flow_draw_message(ui_t *ui, call_flow_arrow_t *arrow, int cline)
     if (msg_has_sdp(msg) && setting_has_value(SETTING_CF_SDP_INFO, "first")) {
         sprintf(method, "%.3s (%s:%u)",
                 msg_method,
-                media->address.ip,
+                address_get_ip(media->address, ip),
                 media->address.port);
     }
 
     if (msg_has_sdp(msg) && setting_has_value(SETTING_CF_SDP_INFO, "full")) {
-        sprintf(method, "%.3s (%s)", msg_method, media->address.ip);
+        sprintf(method, "%.3s (%s)", msg_method, address_get_ip(media->address, ip));
     }
 
     // Draw message type or status and line
@@ -697,8 +718,13 @@ call_flow_draw_rtp_stream(ui_t *ui, call_flow_arrow_t *arrow, int cline)
     if (cline > height + arrow->height)
         return 0;
 
-    // Get arrow text
-    sprintf(text, "RTP (%s) %d", stream_get_format(stream), stream_get_count(stream));
+    // Get arrow text (with loss percentage if any packet is missing)
+    if (stream_get_lost(stream)) {
+        sprintf(text, "RTP (%s) %d %.1f%%", stream_get_format(stream), stream_get_count(stream),
+                stream_get_loss(stream));
+    } else {
+        sprintf(text, "RTP (%s) %d", stream_get_format(stream), stream_get_count(stream));
+    }
 
     // Get message data
     call = stream->media->msg->call;
@@ -894,6 +920,7 @@ call_flow_arrow_create(ui_t *ui, void *item, int type)
     memset(arrow, 0, sizeof(call_flow_arrow_t));
     arrow->type = type;
     arrow->item = item;
+    snprintf(arrow->key, sizeof(arrow->key), "%p", item);
     return arrow;
 }
 
@@ -928,8 +955,7 @@ call_flow_arrow_t *
 call_flow_arrow_find(ui_t *ui, const void *data)
 {
     call_flow_info_t *info;
-    call_flow_arrow_t *arrow;
-    vector_iter_t arrows;
+    char key[24];
 
     if (!data)
         return NULL;
@@ -937,12 +963,8 @@ call_flow_arrow_find(ui_t *ui, const void *data)
     if (!(info = call_flow_info(ui)))
         return NULL;
 
-    arrows = vector_iterator(info->arrows);
-    while ((arrow = vector_iterator_next(&arrows)))
-        if (arrow->item == data)
-            return arrow;
-
-    return arrow;
+    snprintf(key, sizeof(key), "%p", data);
+    return htable_find(info->arrowindex, key);
 }
 
 sip_msg_t *
@@ -1041,11 +1063,6 @@ call_flow_draw_raw(ui_t *ui, sip_msg_t *msg)
 int
 call_flow_draw_raw_rtcp(ui_t *ui, rtp_stream_t *stream)
 {
-    /**
-     * TODO This is too experimental to even display it
-     */
-    return 0;
-
     call_flow_info_t *info;
     WINDOW *raw_win;
     int raw_width, raw_height;
@@ -1095,12 +1112,25 @@ call_flow_draw_raw_rtcp(ui_t *ui, rtp_stream_t *stream)
     mvwvline(ui->win, 1, ui->width - raw_width - 2, ACS_VLINE, ui->height - 2);
     wattroff(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
 
-    mvwprintw(raw_win, 0, 0, "============ RTCP Information ============");
-    mvwprintw(raw_win, 2, 0, "Sender's packet count: %d", stream->rtcpinfo.spc);
-    mvwprintw(raw_win, 3, 0, "Fraction Lost: %d / 256", stream->rtcpinfo.flost);
-    mvwprintw(raw_win, 4, 0, "Fraction discarded: %d / 256", stream->rtcpinfo.fdiscard);
-    mvwprintw(raw_win, 6, 0, "MOS - Listening Quality: %.1f", (float) stream->rtcpinfo.mosl / 10);
-    mvwprintw(raw_win, 7, 0, "MOS - Conversational Quality: %.1f", (float) stream->rtcpinfo.mosc / 10);
+    if (stream->type == PACKET_RTP) {
+        mvwprintw(raw_win, 0, 0, "============ RTP Information =============");
+        mvwprintw(raw_win, 2, 0, "Format: %s", stream_get_format(stream));
+        mvwprintw(raw_win, 3, 0, "Packets: %u (%" PRIu64 " bytes)", stream_get_count(stream), stream->bytes);
+        mvwprintw(raw_win, 4, 0, "Expected: %u", stream_get_expected(stream));
+        mvwprintw(raw_win, 5, 0, "Lost: %u (%.1f%%)", stream_get_lost(stream), stream_get_loss(stream));
+        mvwprintw(raw_win, 6, 0, "Duplicated: %u", stream->stats.duplicated);
+        mvwprintw(raw_win, 7, 0, "Out of order: %u", stream->stats.misordered);
+        mvwprintw(raw_win, 9, 0, "Jitter: %.2f ms", stream_get_jitter(stream));
+        mvwprintw(raw_win, 10, 0, "Max delta: %.2f ms", stream->stats.max_delta);
+        mvwprintw(raw_win, 12, 0, "Estimated MOS: %.1f", stream_get_mos(stream));
+    } else {
+        mvwprintw(raw_win, 0, 0, "============ RTCP Information ============");
+        mvwprintw(raw_win, 2, 0, "Sender's packet count: %d", stream->rtcpinfo.spc);
+        mvwprintw(raw_win, 3, 0, "Fraction Lost: %d / 256", stream->rtcpinfo.flost);
+        mvwprintw(raw_win, 4, 0, "Fraction discarded: %d / 256", stream->rtcpinfo.fdiscard);
+        mvwprintw(raw_win, 6, 0, "MOS - Listening Quality: %.1f", (float) stream->rtcpinfo.mosl / 10);
+        mvwprintw(raw_win, 7, 0, "MOS - Conversational Quality: %.1f", (float) stream->rtcpinfo.mosc / 10);
+    }
 
 
 
@@ -1163,7 +1193,7 @@ call_flow_handle_key(ui_t *ui, int key)
                     info->group->callid = call->callid;
                 } else {
                     call = vector_first(info->group->calls);
-                    vector_clear(info->group->calls);
+                    call_group_clear(info->group);
                     call_group_add(info->group, call);
                     info->group->callid = 0;
                 }
@@ -1350,6 +1380,12 @@ call_flow_set_group(sip_call_group_t *group)
 
     vector_clear(info->columns);
     vector_clear(info->arrows);
+    htable_destroy(info->arrowindex);
+    info->arrowindex = htable_create(64);
+    htable_destroy(info->colindex);
+    info->colindex = htable_create(16);
+    vector_clear(info->colkeys);
+    info->groupsize = -1;
 
     info->group = group;
     info->cur_arrow = info->selected = -1;
@@ -1363,6 +1399,7 @@ call_flow_column_add(ui_t *ui, const char *callid, address_t addr)
     call_flow_info_t *info;
     call_flow_column_t *column;
     vector_iter_t columns;
+    char ip[ADDRESSLEN];
 
     if (!(info = call_flow_info(ui)))
         return;
@@ -1376,6 +1413,7 @@ call_flow_column_add(ui_t *ui, const char *callid, address_t addr)
         if (addressport_equals(column->addr, addr)) {
             if (column->colpos != 0 && vector_count(column->callids) < info->maxcallids) {
                 vector_append(column->callids, (void*)callid);
+                call_flow_column_index(ui, column, callid);
                 return;
             }
         }
@@ -1389,63 +1427,108 @@ call_flow_column_add(ui_t *ui, const char *callid, address_t addr)
     column->addr = addr;
     if (setting_enabled(SETTING_ALIAS_PORT)) {
         char addr_port[1024];
-        sprintf(addr_port, "%s:%d", addr.ip, addr.port);
+        sprintf(addr_port, "%s:%d", address_get_ip(addr, ip), addr.port);
         strcpy(column->alias, get_alias_value(addr_port));
     } else {
-        strcpy(column->alias, get_alias_value(addr.ip));
+        strcpy(column->alias, get_alias_value(address_get_ip(addr, ip)));
     }
     column->colpos = vector_count(info->columns);
     vector_append(info->columns, column);
+    call_flow_column_index(ui, column, callid);
 }
 
 call_flow_column_t *
 call_flow_column_get(ui_t *ui, const char *callid, address_t addr)
 {
     call_flow_info_t *info;
-    call_flow_column_t *column;
-    vector_iter_t columns;
-    int match_port;
     const char *alias;
+    char ip[ADDRESSLEN];
+    char key[CF_INDEX_KEYLEN];
+    int len;
 
     if (!(info = call_flow_info(ui)))
         return NULL;
 
-    // Look for address or address:port ?
-    match_port = addr.port != 0;
+    address_get_ip(addr, ip);
 
-    // Get alias value for given address
-    if (setting_enabled(SETTING_ALIAS_PORT)) {
-        char addr_port[1024];
-        sprintf(addr_port, "%s:%d", addr.ip, addr.port);
-        alias = get_alias_value(addr_port);
+    if (setting_enabled(SETTING_CF_SPLITCALLID)) {
+        // In compressed mode, we search using alias instead of address
+        if (setting_enabled(SETTING_ALIAS_PORT)) {
+            char addr_port[1024];
+            sprintf(addr_port, "%s:%d", ip, addr.port);
+            alias = get_alias_value(addr_port);
+        } else {
+            alias = get_alias_value(ip);
+        }
+        len = snprintf(key, sizeof(key), "s|%s", alias);
+    } else if (addr.port != 0) {
+        // Look for address:port with this Call-Id
+        len = snprintf(key, sizeof(key), "p|%s|%s:%u", callid ? callid : "", ip, addr.port);
     } else {
-        alias = get_alias_value(addr.ip);
+        // Dont check port
+        len = snprintf(key, sizeof(key), "a|%s", ip);
     }
 
-    columns = vector_iterator(info->columns);
-    while ((column = vector_iterator_next(&columns))) {
-        // In compressed mode, we search using alias instead of address
-        if (setting_enabled(SETTING_CF_SPLITCALLID)) {
-            if (!strcmp(column->alias, alias)) {
-                return column;
-            }
-        } else {
-            // Check if this column matches requested address
-            if (match_port) {
-                if (addressport_equals(column->addr, addr)) {
-                    if (vector_index(column->callids, (void*)callid) >= 0) {
-                        return column;
-                    }
-                }
-            } else {
-                // Dont check port
-                if (address_equals(column->addr, addr)) {
-                    return column;
-                }
-            }
+    // Truncated keys are never indexed
+    if (len < 0 || (size_t) len >= sizeof(key))
+        return NULL;
+
+    return htable_find(info->colindex, key);
+}
+
+void
+call_flow_column_index(ui_t *ui, call_flow_column_t *column, const char *callid)
+{
+    call_flow_info_t *info;
+    char ip[ADDRESSLEN];
+    char keys[3][CF_INDEX_KEYLEN];
+    int lens[3];
+    char *key;
+    int i;
+
+    if (!(info = call_flow_info(ui)))
+        return;
+
+    address_get_ip(column->addr, ip);
+    lens[0] = snprintf(keys[0], CF_INDEX_KEYLEN, "p|%s|%s:%u", callid ? callid : "", ip, column->addr.port);
+    lens[1] = snprintf(keys[1], CF_INDEX_KEYLEN, "a|%s", ip);
+    lens[2] = snprintf(keys[2], CF_INDEX_KEYLEN, "s|%s", column->alias);
+
+    // Lookups return the first column added with each key
+    for (i = 0; i < 3; i++) {
+        // Truncated keys could match other columns (too long Call-IDs)
+        if (lens[i] < 0 || lens[i] >= CF_INDEX_KEYLEN)
+            continue;
+        if (htable_find(info->colindex, keys[i]))
+            continue;
+        if (!(key = strdup(keys[i])))
+            continue;
+        vector_append(info->colkeys, key);
+        htable_insert(info->colindex, key, column);
+    }
+}
+
+int
+call_flow_group_size(ui_t *ui)
+{
+    call_flow_info_t *info = call_flow_info(ui);
+    sip_call_t *call;
+    rtp_stream_t *stream;
+    vector_iter_t calls, streams;
+    int size = 0;
+
+    calls = vector_iterator(info->group->calls);
+    while ((call = vector_iterator_next(&calls))) {
+        size += call_msg_count(call);
+        // Streams arrows are created once they have packets
+        streams = vector_iterator(call->streams);
+        while ((stream = vector_iterator_next(&streams))) {
+            if (stream_get_count(stream))
+                size++;
         }
     }
-    return NULL;
+
+    return size;
 }
 
 void
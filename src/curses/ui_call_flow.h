@@ -59,6 +59,11 @@
 #include "ui_manager.h"
 #include "group.h"
 #include "scrollbar.h"
+#include "hash.h"
+#include "setting.h"
+
+//! Max length of columns index keys (enough for any alias)
+#define CF_INDEX_KEYLEN (MAX_SETTING_LEN + 3)
 
 //! Sorter declaration of struct call_flow_info
 typedef struct call_flow_info call_flow_info_t;
@@ -107,6 +112,8 @@ struct call_flow_arrow {
     call_flow_column_t *scolumn;
     //! Destination column for this arrow
     call_flow_column_t *dcolumn;
+    //! Key of this arrow in arrows index (item address)
+    char key[24];
 };
 
 /**
@@ -144,6 +151,8 @@ struct call_flow_info {
     sip_call_group_t *group;
     //! List of arrows (call_flow_arrow_t *)
     vector_t *arrows;
+    //! Arrows indexed by their item address
+    htable_t *arrowindex;
     //! List of displayed arrows
     vector_t *darrows;
     //! First displayed arrow in the list
@@ -156,6 +165,12 @@ struct call_flow_info {
     scrollbar_t scroll;
     //! List of columns in the panel
     vector_t *columns;
+    //! Columns indexed by address, address and Call-Id, and alias
+    htable_t *colindex;
+    //! Keys of columns index (char *)
+    vector_t *colkeys;
+    //! Messages and non empty streams of the group in last draw
+    int groupsize;
     //! Max callids per column
     int maxcallids;
     //! Print timestamp next to the arrow
@@ -232,17 +247,21 @@ call_flow_draw_footer(ui_t *ui);
  * @brief Draw the visible columns in panel window
  *
  * @param ui UI structure pointer
+ * @param grown Group has new messages or streams since last draw
  */
 int
-call_flow_draw_columns(ui_t *ui);
+call_flow_draw_columns(ui_t *ui, bool grown);
 
 /**
  * @brief Draw arrows in the visible part of the panel
  *
+ * Arrows are only created for new messages and streams
+ *
  * @param ui UI structure pointer
+ * @param grown Group has new messages or streams since last draw
  */
 void
-call_flow_draw_arrows(ui_t *ui);
+call_flow_draw_arrows(ui_t *ui, bool grown);
 
 /**
  * @brief Draw panel preview of current arrow
@@ -439,6 +458,29 @@ call_flow_column_add(ui_t *ui, const char *callid, address_t addr);
 call_flow_column_t *
 call_flow_column_get(ui_t *ui, const char *callid, address_t address);
 
+/**
+ * @brief Add column index entries
+ *
+ * Columns are found by address (first column of an address), by address
+ * and Call-Id, and by alias (first column of an alias).
+ *
+ * @param ui UI structure pointer
+ * @param column Column to be indexed
+ * @param callid Call-Id added to the column
+ */
+void
+call_flow_column_index(ui_t *ui, call_flow_column_t *column, const char *callid);
+
+/**
+ * @brief Count messages and non empty streams of displayed group
+ *
+ * Group columns and arrows only need to be searched when this changes.
+ *
+ * @param ui UI structure pointer
+ */
+int
+call_flow_group_size(ui_t *ui);
+
 /**
  * @brief Move selected cursor to given arrow
  *
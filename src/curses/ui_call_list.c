@@ -45,6 +45,7 @@
 #include "ui_filter.h"
 #include "ui_save.h"
 #include "sip.h"
+#include "util.h"
 
 /**
  * Ui Structure definition for Call List panel
@@ -60,6 +61,9 @@ ui_t ui_call_list = {
     .help = call_list_help,
 };
 
+//! Columns layout of cached call texts, changed each time a column is added
+static int columns_layout = 1;
+
 void
 call_list_create(ui_t *ui)
 {
@@ -114,6 +118,7 @@ call_list_create(ui_t *ui)
     info->group = call_group_create();
 
     // Get current call list
+    info->dcalls = sip_displayed_calls_vector();
     info->cur_call = -1;
 
     // Set autoscroll default status
@@ -140,7 +145,6 @@ call_list_destroy(ui_t *ui)
 
         // Deallocate group data
         call_group_destroy(info->group);
-        vector_destroy(info->dcalls);
 
         // Deallocate panel windows
         delwin(info->list_win);
@@ -194,6 +198,7 @@ call_list_draw_header(ui_t *ui)
     int colpos, collen, i;
     char sortind;
     const char *countlb;
+    char memory[20];
     const char *device, *filterexpr, *filterbpf;
 
     // Get panel info
@@ -307,13 +312,18 @@ call_list_draw_header(ui_t *ui)
 
     // Print calls count (also filtered)
     sip_stats_t stats = sip_calls_stats();
-    mvwprintw(ui->win, 1, 45, "%*s", 30, "");
+    mvwprintw(ui->win, 1, 45, "%*s", 50, "");
     if (stats.total != stats.displayed) {
         mvwprintw(ui->win, 1, 45, "%s: %d (%d displayed)", countlb, stats.total, stats.displayed);
     } else {
         mvwprintw(ui->win, 1, 45, "%s: %d", countlb, stats.total);
     }
 
+    // Print memory used by stored calls
+    wprintw(ui->win, "  Memory: %s", size_to_str(sip_calls_memory(), memory));
+    if (sip_calls_memory_limit())
+        wprintw(ui->win, "/%s", size_to_str(sip_calls_memory_limit(), memory));
+
 }
 
 void
@@ -344,10 +354,11 @@ call_list_draw_list(ui_t *ui)
     int listh, listw, cline = 0;
     struct sip_call *call = NULL;
     int i, collen;
-    char coltext[SIP_ATTR_MAXLEN];
+    const char *coltext;
     int colid;
     int colpos;
     int color;
+    int selected;
 
     // Get panel info
     call_list_info_t *info = call_list_info(ui);
@@ -361,8 +372,7 @@ call_list_draw_list(ui_t *ui)
         call = vector_item(info->dcalls, info->cur_call);
 
     // Get the list of calls that are goint to be displayed
-    vector_destroy(info->dcalls);
-    info->dcalls = vector_copy_if(sip_calls_vector(), filter_check_call);
+    info->dcalls = sip_displayed_calls_vector();
 
     // If no active call, use the fist one (if exists)
     if (info->cur_call == -1 && vector_count(info->dcalls)) {
@@ -377,7 +387,8 @@ call_list_draw_list(ui_t *ui)
         } else {
             call_list_move(ui, 0);
         }
-    } else if (call) {
+    } else if (call && vector_item(info->dcalls, info->cur_call) != call) {
+        // Only search the selected call if it has been moved
         call_list_move(ui, vector_index(info->dcalls, call));
     }
 
@@ -399,7 +410,8 @@ call_list_draw_list(ui_t *ui)
             continue;
 
         // Show bold selected rows
-        if (call_group_exists(info->group, call))
+        selected = call_group_exists(info->group, call);
+        if (selected)
             wattron(list_win, A_BOLD | COLOR_PAIR(CP_DEFAULT));
 
         // Highlight active call
@@ -412,11 +424,12 @@ call_list_draw_list(ui_t *ui)
         // Set current line background
         mvwprintw(list_win, cline, 0, "%*s", listw, "");
         // Set current line selection box
-        mvwprintw(list_win, cline, 2, call_group_exists(info->group, call) ? "[*]" : "[ ]");
+        mvwprintw(list_win, cline, 2, selected ? "[*]" : "[ ]");
 
         // Print requested columns
         colpos = 6;
-        for (i = 0; i < info->columncnt; i++) {
+        coltext = call_list_column_text(ui, call);
+        for (i = 0; coltext && i < info->columncnt; i++) {
             // Get current column id
             colid = info->columns[i].id;
             // Get current column width
@@ -425,11 +438,9 @@ call_list_draw_list(ui_t *ui)
             if (colpos + collen >= listw)
                 break;
 
-            // Initialize column text
-            memset(coltext, 0, sizeof(coltext));
-
-            // Get call attribute for current column
-            if (!call_get_attribute(call, colid, coltext)) {
+            // Skip columns without text
+            if (!*coltext) {
+                coltext += collen + 1;
                 colpos += collen + 1;
                 continue;
             }
@@ -444,6 +455,7 @@ call_list_draw_list(ui_t *ui)
 
             // Add the column text to the existing columns
             mvwprintw(list_win, cline, colpos, "%.*s", collen, coltext);
+            coltext += collen + 1;
             colpos += collen + 1;
 
             // Disable attribute color
@@ -516,19 +528,18 @@ const char *
 call_list_line_text(ui_t *ui, sip_call_t *call, char *text)
 {
     int i, collen;
-    char call_attr[SIP_ATTR_MAXLEN];
-    char coltext[SIP_ATTR_MAXLEN];
-    int colid;
+    const char *coltext;
 
     // Get panel info
     call_list_info_t *info = call_list_info(ui);
 
+    // Get all columns text
+    if (!(coltext = call_list_column_text(ui, call)))
+        return text;
+
     // Print requested columns
     for (i = 0; i < info->columncnt; i++) {
 
-        // Get current column id
-        colid = info->columns[i].id;
-
         // Get current column width
         collen = info->columns[i].width;
 
@@ -540,21 +551,49 @@ call_list_line_text(ui_t *ui, sip_call_t *call, char *text)
         if (collen <= 0)
             break;
 
-        // Initialize column text
-        memset(coltext, 0, sizeof(coltext));
-        memset(call_attr, 0, sizeof(call_attr));
-
-        // Get call attribute for current column
-        if (call_get_attribute(call, colid, call_attr)) {
-            sprintf(coltext, "%.*s", collen, call_attr);
-        }
         // Add the column text to the existing columns
-        sprintf(text + strlen(text), "%-*s ", collen, coltext);
+        sprintf(text + strlen(text), "%-*.*s ", collen, collen, coltext);
+        coltext += info->columns[i].width + 1;
     }
 
     return text;
 }
 
+const char *
+call_list_column_text(ui_t *ui, sip_call_t *call)
+{
+    int i, collen, size = 0;
+    char call_attr[SIP_ATTR_MAXLEN];
+    char *coltext;
+
+    // Get panel info
+    call_list_info_t *info = call_list_info(ui);
+
+    // Call has not changed since its text was cached
+    if (call->coltext && call->coltext_layout == columns_layout)
+        return call->coltext;
+
+    // Each column has a slot of its width
+    for (i = 0; i < info->columncnt; i++)
+        size += info->columns[i].width + 1;
+
+    sng_free(call->coltext);
+    if (!(call->coltext = sng_malloc(size + 1)))
+        return NULL;
+
+    // Store each column text in its slot
+    for (i = 0, coltext = call->coltext; i < info->columncnt; i++) {
+        collen = info->columns[i].width;
+        memset(call_attr, 0, sizeof(call_attr));
+        if (call_get_attribute(call, info->columns[i].id, call_attr))
+            snprintf(coltext, collen + 1, "%s", call_attr);
+        coltext += collen + 1;
+    }
+
+    call->coltext_layout = columns_layout;
+    return call->coltext;
+}
+
 int
 call_list_handle_key(ui_t *ui, int key)
 {
@@ -655,6 +694,12 @@ call_list_handle_key(ui_t *ui, int key)
             case ACTION_SHOW_STATS:
                 ui_create_panel(PANEL_STATS);
                 break;
+            case ACTION_SHOW_LATENCY:
+                ui_create_panel(PANEL_LATENCY);
+                break;
+            case ACTION_SHOW_AGGREGATE:
+                ui_create_panel(PANEL_AGGREGATE);
+                break;
             case ACTION_SAVE:
                 if (capture_sources_count() > 1) {
                     dialog_run("Saving is not possible when multiple input sources are specified.");
@@ -665,7 +710,7 @@ call_list_handle_key(ui_t *ui, int key)
                 break;
             case ACTION_CLEAR:
                 // Clear group calls
-                vector_clear(info->group->calls);
+                call_group_clear(info->group);
                 break;
             case ACTION_CLEAR_CALLS:
                 // Remove all stored calls
@@ -809,8 +854,6 @@ call_list_handle_form_key(ui_t *ui, int key)
             action == ACTION_DELETE || action == ACTION_CLEAR) {
         // Updated displayed results
          call_list_clear(ui);
-         // Reset filters on each key stroke
-         filter_reset_calls();
     }
 
     // Validate all input data
@@ -828,6 +871,13 @@ call_list_handle_form_key(ui_t *ui, int key)
     filter_set(FILTER_CALL_LIST, strlen(dfilter) ? dfilter : NULL);
     free(dfilter);
 
+    // Filter has changed, re-apply filter to displayed calls
+    if (action == ACTION_PRINTABLE || action == ACTION_BACKSPACE ||
+            action == ACTION_DELETE || action == ACTION_CLEAR) {
+        // Reset filters on each key stroke
+        filter_reset_calls();
+    }
+
     // Return if this panel has handled or not the key
     return (action == ERR) ? KEY_NOT_HANDLED : KEY_HANDLED;
 }
@@ -986,6 +1036,9 @@ call_list_add_column(ui_t *ui, enum sip_attr_id id, const char* attr,
     info->columns[info->columncnt].title = title;
     info->columns[info->columncnt].width = width;
     info->columncnt++;
+
+    // Cached call texts no longer match list columns
+    columns_layout++;
     return 0;
 }
 
@@ -1000,7 +1053,7 @@ call_list_clear(ui_t *ui)
 
     // Initialize structures
     info->scroll.pos = info->cur_call = -1;
-    vector_clear(info->group->calls);
+    call_group_clear(info->group);
 
     // Clear Displayed lines
     werase(info->list_win);
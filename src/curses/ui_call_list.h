@@ -72,7 +72,7 @@ struct call_list_column {
  * panel pointer.
  */
 struct call_list_info {
-    //! Displayed calls vector
+    //! Displayed calls vector (owned by sip call list)
     vector_t *dcalls;
     //! Selected call in the list
     int cur_call;
@@ -231,6 +231,20 @@ call_list_form_activate(ui_t *ui, int active);
 const char*
 call_list_line_text(ui_t *ui, sip_call_t *call, char *text);
 
+/**
+ * @brief Get the text of all configured columns for the given call
+ *
+ * Each column text is stored null terminated in a slot of its column
+ * width (plus one), following the columns order. Text is cached in the
+ * call until it changes or list columns are modified.
+ *
+ * @param ui UI structure pointer
+ * @param call Call to get data from
+ * @return Columns text or NULL if it can not be allocated
+ */
+const char *
+call_list_column_text(ui_t *ui, sip_call_t *call);
+
 /**
  * @brief Handle Call list key strokes
  *
@@ -35,6 +35,7 @@
 #include "ui_call_raw.h"
 #include "ui_save.h"
 #include "capture.h"
+#include "capture_disk.h"
 
 /**
  * Ui Structure definition for Call Raw panel
@@ -61,9 +62,10 @@ call_raw_create(ui_t *ui)
     // Store it into panel userptr
     set_panel_userptr(ui->panel, (void*) info);
 
-    // Create a initial pad of 1000 lines
-    info->pad = newpad(500, COLS);
-    info->padline = 0;
+    // Create a initial pad for the visible messages
+    info->pad = newpad(LINES, COLS);
+    info->positions = vector_create(100, 100);
+    info->lines = 0;
     info->scroll = 0;
 }
 
@@ -75,6 +77,7 @@ call_raw_destroy(ui_t *ui)
     if ((info = call_raw_info(ui))) {
         // Delete panel windows
         delwin(info->pad);
+        vector_destroy_items(info->positions);
         sng_free(info);
     }
     ui_panel_destroy(ui);
@@ -101,73 +104,153 @@ int
 call_raw_draw(ui_t *ui)
 {
     call_raw_info_t *info;
+    call_raw_pos_t *pos;
     sip_msg_t *msg = NULL;
+    capture_disk_prefetch_t prefetch = { 0 };
+    int first, offset, padlines, line, height, width;
 
     // Get panel information
     if(!(info = call_raw_info(ui)))
         return -1;
 
+    // Add the new call group messages
     if (info->group) {
-        // Print the call group messages into the pad
+        // Request all stored payloads before measuring them one by one
+        for (msg = info->last; (msg = call_group_get_next_msg(info->group, msg));)
+            capture_disk_prefetch_packet(&prefetch, msg->packet);
+        capture_disk_prefetch_run(&prefetch);
+
         while ((msg = call_group_get_next_msg(info->group, info->last)))
-            call_raw_print_msg(ui, msg);
-    } else {
-        call_raw_set_msg(info->msg);
+            call_raw_add_msg(ui, msg);
+    }
+
+    werase(ui->win);
+    if ((first = call_raw_find_line(info, info->scroll)) == -1)
+        return 0;
+
+    // Lines required to print all visible messages
+    pos = vector_item(info->positions, first);
+    offset = info->scroll - pos->line;
+    padlines = offset + ui->height;
+
+    // Make room in the pad for the visible messages
+    getmaxyx(info->pad, height, width);
+    if (height < padlines || width != COLS) {
+        delwin(info->pad);
+        info->pad = newpad(padlines, COLS);
     }
+    werase(info->pad);
+
+    // Print only the messages in the visible part of the panel
+    vector_iter_t it = vector_iterator(info->positions);
+    vector_iterator_set_current(&it, first - 1);
+    for (line = 0; line < padlines && (pos = vector_iterator_next(&it)); line += pos->lines)
+        call_raw_print_msg(ui, pos->msg, line);
 
     // Copy the visible part of the pad into the panel window
-    copywin(info->pad, ui->win, info->scroll, 0, 0, 0, ui->height - 1, ui->width - 1, 0);
+    copywin(info->pad, ui->win, offset, 0, 0, 0, ui->height - 1, ui->width - 1, 0);
     touchwin(ui->win);
     return 0;
 }
 
 int
-call_raw_print_msg(ui_t *ui, sip_msg_t *msg)
+call_raw_add_msg(ui_t *ui, sip_msg_t *msg)
 {
     call_raw_info_t *info;
-    int payload_lines, i, column, height, width;
-    // Message ngrep style Header
-    char header[256];
-    char payload[MAX_SIP_PAYLOAD];
-    int color = 0;
+    call_raw_pos_t *pos;
 
     // Get panel information
     if (!(info = call_raw_info(ui)))
         return -1;
 
-    // Get the pad window
-    WINDOW *pad = info->pad;
+    if (!(pos = sng_malloc(sizeof(call_raw_pos_t))))
+        return -1;
 
-    // Get current pad dimensions
-    getmaxyx(pad, height, width);
+    // Header, payload and an extra line between messages
+    pos->msg = msg;
+    pos->line = info->lines;
+    pos->lines = call_raw_msg_lines(msg, COLS) + 2;
+    vector_append(info->positions, pos);
+    info->lines += pos->lines;
 
-    // Get message payload
-    strcpy(payload, msg_get_payload(msg));
+    // Set this as the last added message
+    info->last = msg;
 
-    // Check how many lines we well need to draw this message
-    payload_lines = 0;
-    column = 0;
-    for (i = 0; i < strlen(payload); i++) {
-        if (column == width || payload[i] == '\n') {
-            payload_lines++;
+    return 0;
+}
+
+int
+call_raw_msg_lines(sip_msg_t *msg, int width)
+{
+    const char *payload = msg_get_payload(msg);
+    int lines = 0, column = 0;
+
+    for (; *payload; payload++) {
+        // Dont print this characters
+        if (*payload == '\r')
+            continue;
+
+        // Move to the next line if line is filled or a we reach a line break
+        if (column > width || *payload == '\n') {
+            lines++;
             column = 0;
             continue;
         }
         column++;
     }
 
-    // Check if we have enough space in our huge pad to store this message
-    if (info->padline + payload_lines > height) {
-        // Create a new pad with more lines!
-        pad = newpad(height + 500, COLS);
-        // And copy all previous information
-        overwrite(info->pad, pad);
-        // Delete previous pad
-        delwin(info->pad);
-        // And store the new pad
-        info->pad = pad;
+    return lines;
+}
+
+int
+call_raw_find_line(call_raw_info_t *info, int line)
+{
+    call_raw_pos_t *pos;
+    int low, high, mid;
+
+    if (line < 0 || line >= info->lines)
+        return -1;
+
+    // Check cached position and its neighbours (scrolling line by line)
+    for (mid = info->first - 1; mid <= info->first + 1; mid++) {
+        if ((pos = vector_item(info->positions, mid)) && line >= pos->line && line < pos->line + pos->lines)
+            return (info->first = mid);
+    }
+
+    // Positions are sorted by line
+    low = 0;
+    high = vector_count(info->positions) - 1;
+    while (low <= high) {
+        mid = (low + high) / 2;
+        pos = vector_item(info->positions, mid);
+        if (line < pos->line) {
+            high = mid - 1;
+        } else if (line >= pos->line + pos->lines) {
+            low = mid + 1;
+        } else {
+            return (info->first = mid);
+        }
     }
 
+    return -1;
+}
+
+int
+call_raw_print_msg(ui_t *ui, sip_msg_t *msg, int line)
+{
+    call_raw_info_t *info;
+    // Message ngrep style Header
+    char header[256];
+    int color = 0;
+    int starting = line;
+
+    // Get panel information
+    if (!(info = call_raw_info(ui)))
+        return -1;
+
+    // Get the pad window
+    WINDOW *pad = info->pad;
+
     // Color the message {
     if (setting_has_value(SETTING_COLORMODE, "request")) {
         // Determine arrow color
@@ -189,18 +272,16 @@ call_raw_print_msg(ui_t *ui, sip_msg_t *msg)
 
     // Print msg header
     wattron(pad, A_BOLD);
-    mvwprintw(pad, info->padline++, 0, "%s", sip_get_msg_header(msg, header));
+    mvwprintw(pad, line++, 0, "%s", sip_get_msg_header(msg, header));
     wattroff(pad, A_BOLD);
 
     // Print msg payload
-    info->padline += draw_message_pos(pad, msg, info->padline);
+    line += draw_message_pos(pad, msg, line);
     // Extra line between messages
-    info->padline++;
+    line++;
 
-    // Set this as the last printed message
-    info->last = msg;
-
-    return 0;
+    wattroff(pad, COLOR_PAIR(color));
+    return line - starting;
 }
 
 int
@@ -254,16 +335,7 @@ call_raw_handle_key(ui_t *ui, int key)
             case ACTION_CYCLE_COLOR:
                 // Handle colors using default handler
                 ui_default_handle_key(ui, key);
-                // Create a new pad (forces messages draw)
-                delwin(info->pad);
-                info->pad = newpad(500, COLS);
-                info->last = NULL;
-                // Force refresh panel
-                if (info->group) {
-                    call_raw_set_group(info->group);
-                } else {
-                    call_raw_set_msg(info->msg);
-                }
+                // Visible messages are printed again on next draw
                 break;
             case ACTION_CLEAR_CALLS:
             case ACTION_CLEAR_CALLS_SOFT:
@@ -271,16 +343,7 @@ call_raw_handle_key(ui_t *ui, int key)
                 return KEY_PROPAGATED;
             case ACTION_SHOW_ALIAS:
                 setting_toggle(SETTING_DISPLAY_ALIAS);
-                // Create a new pad (forces messages draw)
-                delwin(info->pad);
-                info->pad = newpad(500, COLS);
-                info->last = NULL;
-                // Force refresh panel
-                if (info->group) {
-                    call_raw_set_group(info->group);
-                } else {
-                    call_raw_set_msg(info->msg);
-                }
+                // Visible messages are printed again on next draw
                 break;
             default:
                 // Parse next action
@@ -291,11 +354,11 @@ call_raw_handle_key(ui_t *ui, int key)
         break;
     }
 
-    if (info->scroll < 0 || info->padline < LINES) {
+    if (info->scroll < 0 || info->lines < LINES) {
         info->scroll = 0;   // Disable scrolling if there's nothing to scroll
     } else {
-        if (info->scroll + LINES / 2 > info->padline)
-            info->scroll = info->padline - LINES / 2;
+        if (info->scroll + LINES / 2 > info->lines)
+            info->scroll = info->lines - LINES / 2;
     }
 
     // Return if this panel has handled or not the key
@@ -321,9 +384,12 @@ call_raw_set_group(sip_call_group_t *group)
     info->group = group;
     info->msg = NULL;
 
-    // Initialize internal pad
-    info->padline = 0;
-    wclear(info->pad);
+    // Remove previous messages positions
+    vector_destroy_items(info->positions);
+    info->positions = vector_create(100, 100);
+    info->last = NULL;
+    info->first = 0;
+    info->lines = 0;
 
     return 0;
 }
@@ -347,12 +413,14 @@ call_raw_set_msg(sip_msg_t *msg)
     info->group = NULL;
     info->msg = msg;
 
-    // Initialize internal pad
-    info->padline = 0;
-    wclear(info->pad);
+    // Remove previous messages positions
+    vector_destroy_items(info->positions);
+    info->positions = vector_create(1, 1);
+    info->first = 0;
+    info->lines = 0;
 
-    // Print the message in the pad
-    call_raw_print_msg(ui, msg);
+    // Display only this message
+    call_raw_add_msg(ui, msg);
 
     return 0;
 
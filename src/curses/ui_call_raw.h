@@ -37,6 +37,23 @@
 
 //! Sorter declaration of struct call_raw_info
 typedef struct call_raw_info call_raw_info_t;
+//! Shorter declaration of struct call_raw_pos
+typedef struct call_raw_pos call_raw_pos_t;
+
+/**
+ * @brief Position of a message in Call Raw panel
+ *
+ * Messages are only printed when they are visible, so their positions
+ * are calculated once to know which of them must be printed.
+ */
+struct call_raw_pos {
+    //! Displayed message
+    sip_msg_t *msg;
+    //! First line of the message (its header)
+    int line;
+    //! Number of lines of the message (including separator)
+    int lines;
+};
 
 /**
  * @brief Call raw status information
@@ -49,13 +66,17 @@ struct call_raw_info {
     sip_call_group_t *group;
     //! Message to display on the panel (Single message raw display)
     sip_msg_t *msg;
-    //! Last printed message on panel (Call raw display)
+    //! Last added message on panel (Call raw display)
     sip_msg_t *last;
-    //! Window pad to copy on displayed screen
+    //! Displayed messages positions (call_raw_pos_t)
+    vector_t *positions;
+    //! Position of the first visible message
+    int first;
+    //! Window pad where visible messages are printed
     WINDOW *pad;
-    //! Already used lines of the window pad
-    int padline;
-    //! Scroll position of the window pad
+    //! Total lines of all displayed messages
+    int lines;
+    //! Scroll position in displayed messages lines
     int scroll;
 };
 
@@ -116,16 +137,52 @@ int
 call_raw_draw(ui_t *ui);
 
 /**
- * @brief Draw a message in call Raw
+ * @brief Add a message at the end of call Raw
  *
- * Draw a new message in the Raw pad.
+ * Only the number of lines of the message is calculated, message
+ * will be printed once it is visible.
  *
- * @param panel Ncurses panel pointer
- * @param msg New message to be printed
+ * @param ui UI structure pointer
+ * @param msg New message to be displayed
  * @return 0 in call cases
  */
 int
-call_raw_print_msg(ui_t *ui, sip_msg_t *msg);
+call_raw_add_msg(ui_t *ui, sip_msg_t *msg);
+
+/**
+ * @brief Get the number of lines required to print a message payload
+ *
+ * Lines are wrapped the same way draw_message_pos does.
+ *
+ * @param msg SIP message
+ * @param width Width of the window where message will be printed
+ */
+int
+call_raw_msg_lines(sip_msg_t *msg, int width);
+
+/**
+ * @brief Get the position of the message displayed in the given line
+ *
+ * Position of the first visible message is cached, so scrolling only
+ * checks its neighbours before searching all positions.
+ *
+ * @return message position index or -1 if there is no message in line
+ */
+int
+call_raw_find_line(call_raw_info_t *info, int line);
+
+/**
+ * @brief Draw a message in call Raw
+ *
+ * Draw a message in the Raw pad.
+ *
+ * @param ui UI structure pointer
+ * @param msg Message to be printed
+ * @param line First pad line for the message
+ * @return number of printed lines
+ */
+int
+call_raw_print_msg(ui_t *ui, sip_msg_t *msg, int line);
 
 /**
  * @brief Handle Call Raw key strokes
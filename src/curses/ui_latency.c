@@ -0,0 +1,123 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file ui_latency.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in ui_latency.h
+ */
+/*
+ * +---------------------------------------------------------+
+ * |              Packet Processing Latency                  |
+ * +---------------------------------------------------------+
+ * |  Stage        Samples        p50        p99        max  |
+ * |  packet        120345     1.2 us     8.4 us   310.5 us  |
+ * |  ip            120345      250 ns     1.1 us    95.0 us  |
+ * |  ...                                                    |
+ * +---------------------------------------------------------+
+ * |                  Press ESC to leave                     |
+ * +---------------------------------------------------------+
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include "latency.h"
+#include "ui_manager.h"
+#include "ui_latency.h"
+
+/**
+ * Ui Structure definition for Latency panel
+ */
+ui_t ui_latency = {
+    .type = PANEL_LATENCY,
+    .panel = NULL,
+    .create = latency_create,
+    .destroy = ui_panel_destroy,
+    .draw = latency_draw,
+    .handle_key = NULL
+};
+
+/**
+ * @brief Format a duration in the most readable unit
+ */
+static const char *
+latency_duration(unsigned long ns, char *out, size_t len)
+{
+    if (ns < 1000) {
+        snprintf(out, len, "%lu ns", ns);
+    } else if (ns < 1000000) {
+        snprintf(out, len, "%.1f us", ns / 1000.0);
+    } else {
+        snprintf(out, len, "%.1f ms", ns / 1000000.0);
+    }
+    return out;
+}
+
+void
+latency_create(ui_t *ui)
+{
+    // Calculate window dimensions
+    ui_panel_create(ui, LATENCY_STAGE_COUNT + 8, 60);
+
+    // Set the window title and boxes
+    mvwprintw(ui->win, 1, ui->width / 2 - 13, "Packet Processing Latency");
+    wattron(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
+    title_foot_box(ui->panel);
+    mvwprintw(ui->win, ui->height - 2, ui->width / 2 - 9, "Press ESC to leave");
+    wattroff(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
+}
+
+int
+latency_draw(ui_t *ui)
+{
+    latency_stats_t stats;
+    char p50[16], p99[16], max[16];
+    int i, line;
+
+    // Clear previous values
+    for (line = 3; line < ui->height - 3; line++)
+        mvwprintw(ui->win, line, 1, "%*s", ui->width - 2, "");
+
+    // Stages are only timed in instrumented builds
+    if (!latency_enabled()) {
+        mvwprintw(ui->win, 3, 3, "Latency measurement is not available.");
+        mvwprintw(ui->win, 4, 3, "Build sngrep using --enable-latency.");
+        return 0;
+    }
+
+    wattron(ui->win, A_BOLD);
+    mvwprintw(ui->win, 3, 3, "%-8s %12s %10s %10s %10s", "Stage", "Samples", "p50", "p99", "max");
+    wattroff(ui->win, A_BOLD);
+
+    for (i = 0; i < LATENCY_STAGE_COUNT; i++) {
+        if (latency_get_stats(i, &stats) != 0) {
+            mvwprintw(ui->win, 4 + i, 3, "%-8s %12s", latency_stage_name(i), "-");
+            continue;
+        }
+        mvwprintw(ui->win, 4 + i, 3, "%-8s %12lu %10s %10s %10s", latency_stage_name(i), stats.count,
+                  latency_duration(stats.p50, p50, sizeof(p50)),
+                  latency_duration(stats.p99, p99, sizeof(p99)),
+                  latency_duration(stats.max, max, sizeof(max)));
+    }
+
+    return 0;
+}
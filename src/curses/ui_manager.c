@@ -32,6 +32,9 @@
 #include <math.h>
 #include <stdlib.h>
 #include <locale.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
 #include "setting.h"
 #include "ui_manager.h"
 #include "capture.h"
@@ -60,7 +63,9 @@ static ui_t *panel_pool[] = {
     &ui_msg_diff,
     &ui_column_select,
     &ui_settings,
-    &ui_stats
+    &ui_stats,
+    &ui_latency,
+    &ui_aggregate
 };
 
 int
@@ -188,6 +193,7 @@ ui_wait_for_input()
     ui_t *ui;
     WINDOW *win;
     PANEL *panel;
+    uint64_t drawn = 0;
 
     // While there are still panels
     while ((panel = panel_below(NULL))) {
@@ -195,11 +201,8 @@ ui_wait_for_input()
         // Get panel interface structure
         ui = ui_find_by_panel(panel);
 
-        // Set character input timeout 200 ms
-        halfdelay(REFRESHTHSECS);
-
         // Avoid parsing any packet while UI is being drawn
-        capture_lock();
+        capture_lock_read();
         // Query the interface if it needs to be redrawn
         if (ui_draw_redraw(ui)) {
             // Redraw this panel
@@ -207,6 +210,7 @@ ui_wait_for_input()
                 capture_unlock();
                 return -1;
             }
+            drawn = ui_time_ms();
         }
         capture_unlock();
 
@@ -222,12 +226,13 @@ ui_wait_for_input()
         keypad(win, TRUE);
 
         // Get pressed key
-        int c = wgetch(win);
+        int c = ui_wait_for_key(win, drawn);
 
         // Timeout, no key pressed
         if (c == ERR)
             continue;
 
+        // User actions may change or remove calls
         capture_lock();
         // Handle received key
         int hld = KEY_NOT_HANDLED;
@@ -303,6 +308,47 @@ ui_default_handle_key(ui_t *ui, int key)
     return KEY_HANDLED;
 }
 
+int
+ui_wait_for_key(WINDOW *win, uint64_t drawn)
+{
+    struct pollfd fds[2];
+    int nfds = 1, timeout, c;
+    uint64_t elapsed = ui_time_ms() - drawn;
+
+    // Keys already read by ncurses are not notified by poll
+    nodelay(win, TRUE);
+    if ((c = wgetch(win)) != ERR)
+        return c;
+
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+
+    if (elapsed < REFRESHTHSECS * 100) {
+        // Changes are drawn together once refresh time has passed
+        timeout = REFRESHTHSECS * 100 - elapsed;
+    } else {
+        timeout = REFRESHIDLE;
+        if ((fds[1].fd = sip_calls_notify_fd()) != -1) {
+            fds[1].events = POLLIN;
+            nfds++;
+        }
+    }
+
+    // Signals (like terminal resize) also interrupt the wait
+    if (poll(fds, nfds, timeout) > 0 && nfds == 2 && (fds[1].revents & POLLIN))
+        sip_calls_notify_clear();
+
+    return wgetch(win);
+}
+
+uint64_t
+ui_time_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
 void
 ui_resize_panels()
 {
@@ -43,8 +43,10 @@
 #include "keybinding.h"
 #include "setting.h"
 
-//! Refresh UI every 200 ms
+//! Refresh UI at most every 200 ms
 #define REFRESHTHSECS   2
+//! Refresh UI at least every second (ms)
+#define REFRESHIDLE     1000
 //! Default dialog dimensions
 #define DIALOG_MAX_WIDTH 100
 #define DIALOG_MIN_WIDTH 40
@@ -61,6 +63,8 @@ extern ui_t ui_msg_diff;
 extern ui_t ui_column_select;
 extern ui_t ui_settings;
 extern ui_t ui_stats;
+extern ui_t ui_latency;
+extern ui_t ui_aggregate;
 
 /**
  * @brief Initialize ncurses mode
@@ -117,6 +121,26 @@ ui_find_by_type(enum panel_types type);
 int
 ui_wait_for_input();
 
+/**
+ * @brief Wait until a key is pressed or captured calls change
+ *
+ * Terminal input and calls changes are waited together. Changes are
+ * not checked again until REFRESHTHSECS have passed since last redraw,
+ * so any number of changes in that time cause a single redraw.
+ *
+ * @param win Window receiving user input
+ * @param drawn Time of the last redraw (ms)
+ * @return Pressed key or ERR if no key has been pressed
+ */
+int
+ui_wait_for_key(WINDOW *win, uint64_t drawn);
+
+/**
+ * @brief Get monotonic time in milliseconds
+ */
+uint64_t
+ui_time_ms();
+
 /**
  * @brief Default handler for keys
  *
@@ -28,6 +28,7 @@
  */
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include "ui_msg_diff.h"
 #include "option.h"
 
@@ -100,7 +101,13 @@ msg_diff_create(ui_t *ui)
 void
 msg_diff_destroy(ui_t *ui)
 {
-    sng_free(msg_diff_info(ui));
+    msg_diff_info_t *info;
+
+    if ((info = msg_diff_info(ui))) {
+        sng_free(info->one_hl);
+        sng_free(info->two_hl);
+        sng_free(info);
+    }
     ui_panel_destroy(ui);
 }
 
@@ -111,33 +118,144 @@ msg_diff_info(ui_t *ui)
 }
 
 int
-msg_diff_line_highlight(const char* payload1, const char* payload2, char *highlight)
+msg_diff_lines(const char *payload, msg_diff_line_t **lines)
+{
+    int count = 0, limit = 64, start = 0, i;
+    msg_diff_line_t *list, *line;
+    uint32_t hash = 2166136261u;
+
+    if (!(list = malloc(sizeof(msg_diff_line_t) * limit)))
+        return -1;
+
+    for (i = 0; payload[i]; i++) {
+        hash = (hash ^ (uint8_t) payload[i]) * 16777619u;
+        // Line ends here (last line may not have line end)
+        if (payload[i] != '\n' && payload[i + 1])
+            continue;
+
+        if (count == limit) {
+            limit *= 2;
+            if (!(line = realloc(list, sizeof(msg_diff_line_t) * limit))) {
+                free(list);
+                return -1;
+            }
+            list = line;
+        }
+
+        line = &list[count++];
+        line->start = start;
+        line->len = i - start + 1;
+        line->hash = hash;
+        start = i + 1;
+        hash = 2166136261u;
+    }
+
+    *lines = list;
+    return count;
+}
+
+static inline int
+msg_diff_line_equals(const char *one, const msg_diff_line_t *oneline,
+                     const char *two, const msg_diff_line_t *twoline)
+{
+    return oneline->hash == twoline->hash && oneline->len == twoline->len
+           && !memcmp(one + oneline->start, two + twoline->start, oneline->len);
+}
+
+int
+msg_diff_compute(const char *one, const char *two, char *onehl, char *twohl)
 {
-    char search[MAX_SIP_PAYLOAD];
-    int len, i;
-
-    // Initialize search terms
-    memset(search, 0, sizeof(search));
-    len = 0;
-
-    for (i = 0; i < strlen(payload1); i++) {
-        // Store this char in the search term
-        search[len++] = payload1[i];
-        // If we have a full line in search array
-        if (payload1[i] == '\n') {
-            // Check if this line is in the other payload
-            if (strstr(payload2, search) == NULL) {
-                // Highlight this line as different from the other payload
-                memset(highlight + i - len + 1, '1', len);
+    msg_diff_line_t *a = NULL, *b = NULL;
+    int n, m, prefix = 0, max = 0, d, k, x, y, prevk, prevx, i;
+    int *v = NULL, **trace = NULL, *prev;
+    bool found = false;
+    int ret = 1;
+
+    if ((n = msg_diff_lines(one, &a)) < 0 || (m = msg_diff_lines(two, &b)) < 0)
+        goto done;
+
+    // Skip common first and last lines
+    while (prefix < n && prefix < m && msg_diff_line_equals(one, &a[prefix], two, &b[prefix]))
+        prefix++;
+    while (n > prefix && m > prefix && msg_diff_line_equals(one, &a[n - 1], two, &b[m - 1])) {
+        n--;
+        m--;
+    }
+
+    // Compare remaining lines (diagonal k = x - y is stored in v[k + max])
+    max = (n - prefix) + (m - prefix);
+    if (!(v = calloc(2 * max + 2, sizeof(int))) || !(trace = calloc(max + 1, sizeof(int *))))
+        goto done;
+
+    for (d = 0; d <= max; d++) {
+        for (k = -d; k <= d; k += 2) {
+            // Move down (line from two) or right (line from one)
+            if (k == -d || (k != d && v[k - 1 + max] < v[k + 1 + max])) {
+                x = v[k + 1 + max];
+            } else {
+                x = v[k - 1 + max] + 1;
             }
+            y = x - k;
+            // Follow matching lines
+            while (x < n - prefix && y < m - prefix
+                   && msg_diff_line_equals(one, &a[prefix + x], two, &b[prefix + y])) {
+                x++;
+                y++;
+            }
+            v[k + max] = x;
+            // All lines of both payloads have been compared
+            if (x >= n - prefix && y >= m - prefix)
+                found = true;
+        }
+
+        // Store furthest positions of this step for backtracking
+        if (!(trace[d] = malloc(sizeof(int) * (2 * d + 1))))
+            goto done;
+        memcpy(trace[d], v + max - d, sizeof(int) * (2 * d + 1));
+
+        if (found)
+            break;
+    }
 
-            // Reset search terms
-            memset(search, 0, sizeof(search));
-            len = 0;
+    // Walk back the edit script highlighting inserted and deleted lines
+    x = n - prefix;
+    y = m - prefix;
+    for (; d > 0; d--) {
+        prev = trace[d - 1] + (d - 1);
+        k = x - y;
+        if (k == -d || (k != d && prev[k - 1] < prev[k + 1])) {
+            prevk = k + 1;
+        } else {
+            prevk = k - 1;
+        }
+        prevx = prev[prevk];
+
+        // Skip matching lines until the edit
+        while (x > prevx && y > prevx - prevk) {
+            x--;
+            y--;
         }
+
+        if (prevk == k + 1) {
+            memset(twohl + b[prefix + y - 1].start, '1', b[prefix + y - 1].len);
+        } else {
+            memset(onehl + a[prefix + x - 1].start, '1', a[prefix + x - 1].len);
+        }
+        x = prevx;
+        y = prevx - prevk;
     }
+    ret = 0;
 
-    return 0;
+done:
+    if (trace) {
+        for (i = 0; i <= max; i++)
+            free(trace[i]);
+        free(trace);
+    }
+    free(v);
+    free(a);
+    free(b);
+    return ret;
 }
 
 void
@@ -156,16 +274,10 @@ msg_diff_draw(ui_t *ui)
 {
     // Get panel information
     msg_diff_info_t *info = msg_diff_info(ui);
-    char highlight[MAX_SIP_PAYLOAD];
 
-    // Draw first message
-    memset(highlight, 0, sizeof(highlight));
-    msg_diff_line_highlight(msg_get_payload(info->one), msg_get_payload(info->two), highlight);
-    msg_diff_draw_message(info->one_win, info->one, highlight);
-    // Draw second message
-    memset(highlight, 0, sizeof(highlight));
-    msg_diff_line_highlight(msg_get_payload(info->two), msg_get_payload(info->one), highlight);
-    msg_diff_draw_message(info->two_win, info->two, highlight);
+    // Draw both messages with their differences
+    msg_diff_draw_message(info->one_win, info->one, info->one_hl);
+    msg_diff_draw_message(info->two_win, info->two, info->two_hl);
 
     // Redraw footer
     msg_diff_draw_footer(ui);
@@ -206,7 +318,7 @@ msg_diff_draw_message(WINDOW *win, sip_msg_t *msg, char *highlight)
         if (line == height)
             break;
 
-        if (highlight[i] == '1') {
+        if (highlight && highlight[i] == '1') {
             wattron(win, COLOR_PAIR(CP_YELLOW_ON_DEF));
         } else {
             wattroff(win, COLOR_PAIR(CP_YELLOW_ON_DEF));
@@ -232,6 +344,14 @@ msg_diff_set_msgs(ui_t *ui, sip_msg_t *one, sip_msg_t *two)
     info->one = one;
     info->two = two;
 
+    // Calculate differences once for this pair of messages
+    sng_free(info->one_hl);
+    sng_free(info->two_hl);
+    info->one_hl = sng_malloc(strlen(msg_get_payload(one)) + 1);
+    info->two_hl = sng_malloc(strlen(msg_get_payload(two)) + 1);
+    if (info->one_hl && info->two_hl)
+        msg_diff_compute(msg_get_payload(one), msg_get_payload(two), info->one_hl, info->two_hl);
+
     return 0;
 }
 
@@ -33,6 +33,20 @@
 
 //! Sorter declaration of struct msg_diff_info
 typedef struct msg_diff_info msg_diff_info_t;
+//! Sorter declaration of struct msg_diff_line
+typedef struct msg_diff_line msg_diff_line_t;
+
+/**
+ * @brief Line of a compared message payload
+ */
+struct msg_diff_line {
+    //! Line position in the payload
+    int start;
+    //! Line length (including line end)
+    int len;
+    //! Line content hash
+    uint32_t hash;
+};
 
 /**
  * @brief Call raw status information
@@ -49,6 +63,10 @@ struct msg_diff_info {
     WINDOW *one_win;
     //! Right displayed subwindow
     WINDOW *two_win;
+    //! Highlighted characters of first message payload ('1' if differs)
+    char *one_hl;
+    //! Highlighted characters of second message payload ('1' if differs)
+    char *two_hl;
 };
 
 /**
@@ -123,11 +141,37 @@ msg_diff_draw_footer(ui_t *ui);
 int
 msg_diff_draw_message(WINDOW *win, sip_msg_t *msg, char *highlight);
 
+/**
+ * @brief Split a payload in lines
+ *
+ * @param payload Message payload
+ * @param lines Allocated array of payload lines
+ * @return number of lines or -1 on memory error
+ */
+int
+msg_diff_lines(const char *payload, msg_diff_line_t **lines);
+
+/**
+ * @brief Highlight lines that differ between two payloads
+ *
+ * Payloads are compared line by line using Myers diff algorithm, so
+ * lines not in the longest common sequence are highlighted.
+ *
+ * @param one First message payload
+ * @param two Second message payload
+ * @param onehl First payload highlight ('1' for each different char)
+ * @param twohl Second payload highlight ('1' for each different char)
+ * @return 0 on success, 1 on memory error
+ */
+int
+msg_diff_compute(const char *one, const char *two, char *onehl, char *twohl);
+
 /**
  * @brief Set the panel working messages
  *
  * This function will access the panel information and will set the
- * msg pointers to the processed messages.
+ * msg pointers to the processed messages. Messages differences are
+ * calculated once here and used in every redraw.
  *
  * @param ui UI structure pointer
  * @param one Message pointer to be set in the internal info struct
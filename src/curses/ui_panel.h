@@ -74,6 +74,10 @@ enum panel_types {
     PANEL_SETTINGS,
     //! Stats panel
     PANEL_STATS,
+    //! Packet processing latency panel
+    PANEL_LATENCY,
+    //! Keepalive messages counters panel
+    PANEL_AGGREGATE,
     //! Panel Counter
     PANEL_COUNT,
 };
@@ -36,6 +36,7 @@
 #include "ui_save.h"
 #include "setting.h"
 #include "capture.h"
+#include "capture_disk.h"
 #include "filter.h"
 
 /**
@@ -102,7 +103,7 @@ save_create(ui_t *ui)
     set_field_back(info->fields[FLD_SAVE_FILE], A_UNDERLINE);
 
     // Disable Save RTP if RTP packets are not being captured
-    if (!setting_enabled(SETTING_CAPTURE_RTP))
+    if (!save_rtp_enabled())
         field_opts_off(info->fields[FLD_SAVE_PCAP_RTP], O_ACTIVE);
 
     // Create the form and post it
@@ -169,7 +170,7 @@ save_create(ui_t *ui)
 
     // Set default save modes
     info->savemode = (stats.displayed == stats.total) ? SAVE_ALL : SAVE_DISPLAYED;
-    info->saveformat = (setting_enabled(SETTING_CAPTURE_RTP))? SAVE_PCAP_RTP : SAVE_PCAP;
+    info->saveformat = (save_rtp_enabled())? SAVE_PCAP_RTP : SAVE_PCAP;
 
 }
 
@@ -237,7 +238,7 @@ save_draw(ui_t *ui)
 
     mvwprintw(ui->win, 4, 60, "     ");
     if (strstr(field_value, ".pcap")) {
-        info->saveformat = (setting_enabled(SETTING_CAPTURE_RTP))? SAVE_PCAP_RTP : SAVE_PCAP;
+        info->saveformat = (save_rtp_enabled())? SAVE_PCAP_RTP : SAVE_PCAP;
     } else if (strstr(field_value, ".txt")) {
         info->saveformat = SAVE_TXT;
     } else {
@@ -259,7 +260,7 @@ save_draw(ui_t *ui)
     set_field_buffer(info->fields[FLD_SAVE_TXT], 0, (info->saveformat == SAVE_TXT) ? "*" : " ");
 
     // Show disabled options with makers
-    if (!setting_enabled(SETTING_CAPTURE_RTP))
+    if (!save_rtp_enabled())
         set_field_buffer(info->fields[FLD_SAVE_PCAP_RTP], 0, "-");
 
     set_current_field(info->form, current_field(info->form));
@@ -415,11 +416,10 @@ save_to_file(ui_t *ui)
     sip_msg_t *msg = NULL;
     pcap_dumper_t *pd = NULL;
     FILE *f = NULL;
-    int cur = 0, total = 0;
-    WINDOW *progress;
-    vector_iter_t calls, msgs, rtps, packets;
-    packet_t *packet;
-    vector_t *sorted;
+    vector_iter_t calls, msgs;
+    capture_disk_prefetch_t prefetch = { 0 };
+    save_task_t *task;
+    int cancelled;
 
     // Get panel information
     save_info_t *info = save_info(ui);
@@ -506,58 +506,42 @@ save_to_file(ui_t *ui)
             dump_packet(pd, info->msg->packet);
         }
     } else if (info->saveformat == SAVE_TXT) {
-        // Save selected packets to file
+        // Request all stored payloads before printing them one by one
         while ((call = vector_iterator_next(&calls))) {
             msgs = vector_iterator(call->msgs);
-            // Save SIP message content
-            while ((msg = vector_iterator_next(&msgs))) {
-                save_msg_txt(f, msg);
-            }
-        }
-    } else {
-        // Store all messages in a time sorted vector
-        sorted = vector_create(100, 50);
-        vector_set_sorter(sorted, capture_packet_time_sorter);
-
-        // Count packages for progress bar
-        while ((call = vector_iterator_next(&calls))) {
-            total += vector_count(call->msgs);
-            if (info->saveformat == SAVE_PCAP_RTP)
-                total += vector_count(call->rtp_packets);
+            while ((msg = vector_iterator_next(&msgs)))
+                capture_disk_prefetch_packet(&prefetch, msg->packet);
         }
+        capture_disk_prefetch_run(&prefetch);
         vector_iterator_reset(&calls);
 
-        progress = dialog_progress_run("Saving packets...");
-        dialog_progress_set_value(progress, 0);
-
         // Save selected packets to file
         while ((call = vector_iterator_next(&calls))) {
             msgs = vector_iterator(call->msgs);
             // Save SIP message content
             while ((msg = vector_iterator_next(&msgs))) {
-                // Update progress bar dialog
-                dialog_progress_set_value(progress, (++cur * 100) / total);
-                vector_append(sorted, msg->packet);
-            }
-
-            // Save RTP packets
-            if (info->saveformat == SAVE_PCAP_RTP) {
-                rtps = vector_iterator(call->rtp_packets);
-                while ((packet = vector_iterator_next(&rtps))) {
-                    // Update progress bar dialog
-                    dialog_progress_set_value(progress, (++cur * 100) / total);
-                    vector_append(sorted, packet);
-                }
+                save_msg_txt(f, msg);
             }
         }
-
-        // Save sorted packets
-        packets = vector_iterator(sorted);
-        while ((packet = vector_iterator_next(&packets))) {
-            dump_packet(pd, packet);
+    } else {
+        // Take a snapshot of the packets, so capture can continue while saving
+        if (!(task = save_task_create(pd))) {
+            dump_close(pd);
+            dialog_run("Unable to save: Not enough memory.");
+            return 1;
         }
+        while ((call = vector_iterator_next(&calls)))
+            save_task_call(task, call, info->saveformat == SAVE_PCAP_RTP);
+
+        // File is closed with the snapshot
+        cancelled = save_task_run(task);
+        save_task_destroy(task);
+        pd = NULL;
 
-        dialog_progress_destroy(progress);
+        if (cancelled) {
+            dialog_run("Saving cancelled. %s is incomplete.", savefile);
+            return 1;
+        }
     }
 
     // Close saved file
@@ -577,6 +561,246 @@ save_to_file(ui_t *ui)
     return 0;
 }
 
+save_task_t *
+save_task_create(pcap_dumper_t *pd)
+{
+    save_task_t *task;
+
+    if (!(task = sng_malloc(sizeof(save_task_t))))
+        return NULL;
+
+    task->pd = pd;
+    task->lists = vector_create(10, 10);
+    atomic_init(&task->written, 0);
+    atomic_init(&task->cancelled, false);
+    atomic_init(&task->finished, false);
+    return task;
+}
+
+void
+save_task_destroy(save_task_t *task)
+{
+    save_list_t *list;
+    save_record_t *record;
+    uint32_t i;
+
+    if (!task)
+        return;
+
+    vector_iter_t lists = vector_iterator(task->lists);
+    while ((list = vector_iterator_next(&lists))) {
+        vector_iter_t records = vector_iterator(list->records);
+        while ((record = vector_iterator_next(&records))) {
+            for (i = 0; i < record->count; i++)
+                frame_buffer_destroy(record->frames[i]);
+        }
+        vector_destroy_items(list->records);
+    }
+    vector_destroy_items(task->lists);
+    dump_close(task->pd);
+    sng_free(task);
+}
+
+void
+save_task_call(save_task_t *task, sip_call_t *call, bool rtp)
+{
+    capture_disk_prefetch_t prefetch = { 0 };
+    save_list_t *list;
+    sip_msg_t *msg;
+    packet_t *packet;
+    rtp_stream_t *stream;
+    uint32_t i, count, first;
+
+    if (!task)
+        return;
+
+    // Request all stored frames before copying them one by one
+    vector_iter_t it = vector_iterator(call->msgs);
+    while ((msg = vector_iterator_next(&it)))
+        capture_disk_prefetch_packet(&prefetch, msg->packet);
+    if (rtp) {
+        it = vector_iterator(call->rtp_packets);
+        while ((packet = vector_iterator_next(&it)))
+            capture_disk_prefetch_packet(&prefetch, packet);
+    }
+    capture_disk_prefetch_run(&prefetch);
+
+    // Call messages
+    list = save_task_list(task, vector_count(call->msgs));
+    vector_iter_t msgs = vector_iterator(call->msgs);
+    while ((msg = vector_iterator_next(&msgs)))
+        save_task_packet(task, list, msg->packet);
+
+    if (!rtp)
+        return;
+
+    // Captured RTP packets
+    list = save_task_list(task, vector_count(call->rtp_packets));
+    vector_iter_t rtps = vector_iterator(call->rtp_packets);
+    while ((packet = vector_iterator_next(&rtps)))
+        save_task_packet(task, list, packet);
+
+    // Last packets kept from each stream (oldest one is next ring slot once full)
+    vector_iter_t streams = vector_iterator(call->streams);
+    while ((stream = vector_iterator_next(&streams))) {
+        if (!(count = stream_sample_count(stream)))
+            continue;
+        first = (stream->samplecnt > stream->samplemax) ? stream->samplecnt % stream->samplemax : 0;
+        list = save_task_list(task, count);
+        for (i = 0; i < count; i++)
+            save_task_packet(task, list, stream->samples[(first + i) % stream->samplemax]);
+    }
+}
+
+save_list_t *
+save_task_list(save_task_t *task, int size)
+{
+    save_list_t *list = sng_malloc(sizeof(save_list_t));
+    list->records = vector_create(size, 10);
+    list->index = vector_count(task->lists);
+    vector_append(task->lists, list);
+    return list;
+}
+
+void
+save_task_packet(save_task_t *task, save_list_t *list, const packet_t *packet)
+{
+    save_record_t *record;
+
+    if (!packet)
+        return;
+
+    record = sng_malloc(sizeof(save_record_t) + vector_count(packet->frames) * sizeof(frame_buffer_t *));
+    if (!record)
+        return;
+
+    if (!(record->count = dump_packet_frames(packet, record->frames))) {
+        sng_free(record);
+        return;
+    }
+
+    record->ts = record->frames[0]->header.ts;
+    vector_append(list->records, record);
+    task->total++;
+}
+
+int
+save_task_run(save_task_t *task)
+{
+    WINDOW *progress;
+    int key, action;
+
+    progress = dialog_progress_run("Saving packets... (Esc to cancel)");
+    dialog_progress_set_value(progress, 0);
+
+    if (pthread_create(&task->thread, NULL, (void *) save_task_thread, task) != 0) {
+        // Write the file without leaving the interface thread
+        save_task_thread(task);
+    } else {
+        // Allow parsing packets while file is being written
+        capture_set_paused(0);
+        capture_unlock();
+
+        wtimeout(progress, SAVE_PROGRESS_WAIT);
+        while (!task->finished) {
+            if (task->total)
+                dialog_progress_set_value(progress, (task->written * 100) / task->total);
+
+            if ((key = wgetch(progress)) == ERR)
+                continue;
+            action = ERR;
+            while ((action = key_find_action(key, action)) != ERR) {
+                if (action == ACTION_PREV_SCREEN)
+                    task->cancelled = true;
+            }
+        }
+
+        pthread_join(task->thread, NULL);
+        capture_lock();
+    }
+
+    dialog_progress_destroy(progress);
+    return (task->cancelled) ? 1 : 0;
+}
+
+/**
+ * @brief Check if next record of a list must be written before other's
+ *
+ * Records with the same time are written in snapshot order.
+ */
+static inline bool
+save_list_older(save_list_t *list, save_list_t *other)
+{
+    save_record_t *one = vector_item(list->records, list->pos);
+    save_record_t *two = vector_item(other->records, other->pos);
+
+    if (timercmp(&one->ts, &two->ts, !=))
+        return timercmp(&one->ts, &two->ts, <);
+    return list->index < other->index;
+}
+
+void
+save_task_thread(void *info)
+{
+    save_task_t *task = (save_task_t *) info;
+    save_list_t *list, *child, *tmp;
+    save_record_t *record;
+    save_list_t **heap;
+    int count = 0, pos, next;
+    uint32_t i;
+
+    if (!(heap = sng_malloc(sizeof(save_list_t *) * (vector_count(task->lists) + 1)))) {
+        task->finished = true;
+        return;
+    }
+
+    // Build a min-heap of lists by the time of their next record
+    vector_iter_t lists = vector_iterator(task->lists);
+    while ((list = vector_iterator_next(&lists))) {
+        if (!vector_count(list->records))
+            continue;
+        heap[count] = list;
+        for (pos = count++; pos > 0; pos = next) {
+            next = (pos - 1) / 2;
+            if (!save_list_older(heap[pos], heap[next]))
+                break;
+            tmp = heap[pos]; heap[pos] = heap[next]; heap[next] = tmp;
+        }
+    }
+
+    while (count && !task->cancelled) {
+        // Write the oldest pending record
+        list = heap[0];
+        record = vector_item(list->records, list->pos++);
+        for (i = 0; i < record->count; i++)
+            dump_frame(task->pd, record->frames[i]);
+        task->written++;
+
+        // Remove exhausted lists and sift down the new head
+        if (list->pos >= vector_count(list->records))
+            heap[0] = heap[--count];
+        for (pos = 0; (next = pos * 2 + 1) < count; pos = next) {
+            child = heap[next];
+            if (next + 1 < count && save_list_older(heap[next + 1], child))
+                child = heap[++next];
+            if (!save_list_older(child, heap[pos]))
+                break;
+            heap[next] = heap[pos];
+            heap[pos] = child;
+        }
+    }
+
+    dump_flush(task->pd);
+    sng_free(heap);
+    task->finished = true;
+}
+
+bool
+save_rtp_enabled()
+{
+    return setting_enabled(SETTING_CAPTURE_RTP) || setting_get_intvalue(SETTING_CAPTURE_RTP_SAMPLES) > 0;
+}
+
 void
 save_msg_txt(FILE *f, sip_msg_t *msg)
 {
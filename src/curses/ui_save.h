@@ -34,9 +34,14 @@
 #define __UI_SAVE_PCAP_H
 #include "config.h"
 #include <form.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "group.h"
 #include "ui_manager.h"
 
+//! Milliseconds between save progress dialog updates
+#define SAVE_PROGRESS_WAIT  100
+
 /**
  * @brief Enum of available dialog fields
  *
@@ -79,6 +84,59 @@ enum save_format {
 
 //! Sorter declaration of struct save_info
 typedef struct save_info save_info_t;
+//! Shorter declaration of struct save_record
+typedef struct save_record save_record_t;
+//! Shorter declaration of struct save_list
+typedef struct save_list save_list_t;
+//! Shorter declaration of struct save_task
+typedef struct save_task save_task_t;
+
+/**
+ * @brief Frames of a packet pending to be saved
+ */
+struct save_record {
+    //! Capture time of the first frame
+    struct timeval ts;
+    //! Number of frames
+    uint32_t count;
+    //! Packet frames
+    frame_buffer_t *frames[];
+};
+
+/**
+ * @brief Time ordered packets of a call (messages, RTP or stream samples)
+ */
+struct save_list {
+    //! Packets to be saved (save_record_t)
+    vector_t *records;
+    //! Next record to be written
+    int pos;
+    //! Position of this list in the snapshot
+    int index;
+};
+
+/**
+ * @brief Snapshot of packets written to a file by a background thread
+ *
+ * Packets of each call are already sorted, so the snapshot keeps one list
+ * per call source and the writer merges them using a heap.
+ */
+struct save_task {
+    //! Dump file
+    pcap_dumper_t *pd;
+    //! Packet lists (save_list_t)
+    vector_t *lists;
+    //! Number of packets in all lists
+    uint32_t total;
+    //! Number of packets already written
+    atomic_uint written;
+    //! User has requested to stop saving
+    atomic_bool cancelled;
+    //! Writer thread has finished
+    atomic_bool finished;
+    //! Writer thread
+    pthread_t thread;
+};
 
 /**
  * @brief Save panel private information
@@ -208,6 +266,68 @@ save_error_message(ui_t *ui, const char *message);
 int
 save_to_file(ui_t *ui);
 
+/**
+ * @brief Create an empty save snapshot
+ */
+save_task_t *
+save_task_create(pcap_dumper_t *pd);
+
+/**
+ * @brief Release all frames of a save snapshot and close its file
+ */
+void
+save_task_destroy(save_task_t *task);
+
+/**
+ * @brief Add a call packets to save snapshot
+ *
+ * Caller must be holding capture lock.
+ *
+ * @param task Save snapshot
+ * @param call Call whose packets will be saved
+ * @param rtp Also save call RTP packets
+ */
+void
+save_task_call(save_task_t *task, sip_call_t *call, bool rtp);
+
+/**
+ * @brief Add an empty list of time ordered packets to save snapshot
+ */
+save_list_t *
+save_task_list(save_task_t *task, int size);
+
+/**
+ * @brief Add a packet to the end of a snapshot list
+ */
+void
+save_task_packet(save_task_t *task, save_list_t *list, const packet_t *packet);
+
+/**
+ * @brief Write snapshot packets displaying a progress dialog
+ *
+ * Capture lock is released while the background thread writes the file.
+ * User can cancel the process with the previous screen key.
+ *
+ * @return 0 if all packets were written, 1 if cancelled
+ */
+int
+save_task_run(save_task_t *task);
+
+/**
+ * @brief Background thread that merges and writes snapshot lists
+ */
+void
+save_task_thread(void *info);
+
+/**
+ * @brief Check if RTP packets can be saved
+ *
+ * RTP packets are available when they are captured or when the last
+ * packets of each stream are kept.
+ */
+bool
+save_rtp_enabled();
+
 /**
  * @brief Save one SIP message into open file
  *
@@ -41,4 +41,16 @@
 void
 stats_create(ui_t *ui);
 
+/**
+ * @brief Draw stats panel counters
+ *
+ * Counters are read from the calls storage, so panel displays
+ * updated values each time it is redrawn.
+ *
+ * @param ui UI structure pointer
+ * @return 0 if the panel has been drawn, -1 otherwise
+ */
+int
+stats_draw(ui_t *ui);
+
 #endif /* __SNGREP_UI_STATS_H */
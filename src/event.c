@@ -0,0 +1,374 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file event.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in event.h
+ *
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "event.h"
+#include "capture.h"
+#include "setting.h"
+#include "util.h"
+
+//! Events output (only one can be configured)
+static event_output_t *events = NULL;
+
+//! Names of event types in records
+static const char *event_type_names[] = { "state", "message" };
+
+/**
+ * @brief Append text to a record being formatted
+ *
+ * If text does not fit, position is moved past the record end so the
+ * record is discarded once formatted.
+ */
+static inline void
+event_append(char *line, size_t *pos, const char *text, size_t len)
+{
+    if (*pos + len >= EVENT_LINE_LEN) {
+        *pos = EVENT_LINE_LEN;
+        return;
+    }
+    memcpy(line + *pos, text, len);
+    *pos += len;
+}
+
+/**
+ * @brief Append a quoted and escaped value to a record being formatted
+ */
+static inline void
+event_append_value(char *line, size_t *pos, enum event_format format, const char *value)
+{
+    const char *c;
+    char esc[8];
+
+    // Empty JSON fields are written as null
+    if (!value && format == EVENT_FORMAT_JSON) {
+        event_append(line, pos, "null", 4);
+        return;
+    }
+
+    event_append(line, pos, "\"", 1);
+    for (c = value; c && *c; c++) {
+        if (*c == '"') {
+            event_append(line, pos, (format == EVENT_FORMAT_JSON) ? "\\\"" : "\"\"", 2);
+        } else if (format == EVENT_FORMAT_JSON && *c == '\\') {
+            event_append(line, pos, "\\\\", 2);
+        } else if (format == EVENT_FORMAT_JSON && (u_char) *c < 0x20) {
+            event_append(line, pos, esc, sprintf(esc, "\\u%04x", (u_char) *c));
+        } else {
+            event_append(line, pos, c, 1);
+        }
+    }
+    event_append(line, pos, "\"", 1);
+}
+
+int
+event_open(const char *outfile)
+{
+    char fields[512], *name;
+    struct stat st;
+    int id, i;
+
+    // No events output configured
+    if (!outfile)
+        return 0;
+
+    if (!(events = sng_malloc(sizeof(event_output_t))))
+        return 1;
+
+    events->outfile = outfile;
+    events->format = (!strcmp(setting_get_value(SETTING_EVENTS_FORMAT), "csv"))
+                     ? EVENT_FORMAT_CSV : EVENT_FORMAT_JSON;
+    events->messages = setting_enabled(SETTING_EVENTS_MESSAGES);
+
+    // Get attributes written in each record
+    if (setting_get_value(SETTING_EVENTS_FIELDS)) {
+        snprintf(fields, sizeof(fields), "%s", setting_get_value(SETTING_EVENTS_FIELDS));
+        for (name = strtok(fields, ","); name; name = strtok(NULL, ",")) {
+            if ((id = sip_attr_from_name(name)) >= 0 && events->fieldcnt < SIP_ATTR_COUNT)
+                events->fields[events->fieldcnt++] = id;
+        }
+    }
+
+    // Keep previous records when output file already exists
+    if (!strcmp(outfile, "-")) {
+        events->file = stdout;
+    } else {
+        events->file = fopen(outfile, "a");
+    }
+    events->buffer = sng_malloc(EVENT_BUFFER * 1024);
+
+    if (!events->file || !events->buffer || !(events->ring = ring_create(EVENT_QUEUE))) {
+        if (events->file && events->file != stdout)
+            fclose(events->file);
+        sng_free(events->buffer);
+        sng_free(events);
+        events = NULL;
+        return 1;
+    }
+    setvbuf(events->file, events->buffer, _IOFBF, EVENT_BUFFER * 1024);
+
+    // CSV files start with a header line
+    if (events->format == EVENT_FORMAT_CSV
+            && (events->file == stdout || (fstat(fileno(events->file), &st) == 0 && st.st_size == 0))) {
+        fputs("event,ts,previous", events->file);
+        for (i = 0; i < events->fieldcnt; i++)
+            fprintf(events->file, ",%s", sip_attr_get_name(events->fields[i]));
+        fputs("\n", events->file);
+    }
+
+    atomic_init(&events->dropped, 0);
+    atomic_init(&events->stopping, false);
+    atomic_init(&events->waiting, false);
+    pthread_mutex_init(&events->lock, NULL);
+    pthread_cond_init(&events->cond, NULL);
+
+    if (pthread_create(&events->thread, NULL, (void *) event_thread, events)) {
+        if (events->file != stdout)
+            fclose(events->file);
+        ring_destroy(events->ring);
+        pthread_cond_destroy(&events->cond);
+        pthread_mutex_destroy(&events->lock);
+        sng_free(events->buffer);
+        sng_free(events);
+        events = NULL;
+        return 1;
+    }
+
+    return 0;
+}
+
+void
+event_close()
+{
+    if (!events)
+        return;
+
+    // Let the writer empty its queue
+    events->stopping = true;
+    event_wakeup(true);
+    pthread_join(events->thread, NULL);
+
+    if (event_dropped()) {
+        fprintf(stderr, "%lu events could not be written to %s (events queue full)\n",
+                event_dropped(), events->outfile);
+    }
+
+    // Buffer must not be used by standard output after being freed
+    if (events->file == stdout) {
+        fflush(stdout);
+        setvbuf(stdout, NULL, _IONBF, 0);
+    } else {
+        fclose(events->file);
+    }
+
+    ring_destroy(events->ring);
+    pthread_cond_destroy(&events->cond);
+    pthread_mutex_destroy(&events->lock);
+    sng_free(events->buffer);
+    sng_free(events);
+    events = NULL;
+}
+
+void
+event_call_state(sip_call_t *call, sip_msg_t *msg, int previous)
+{
+    if (!events || call->state == previous)
+        return;
+
+    event_queue(EVENT_STATE, msg, previous);
+}
+
+void
+event_message(sip_msg_t *msg)
+{
+    if (!events || !events->messages)
+        return;
+
+    event_queue(EVENT_MESSAGE, msg, 0);
+}
+
+unsigned long
+event_dropped()
+{
+    if (!events)
+        return 0;
+
+    return atomic_load_explicit(&events->dropped, memory_order_relaxed);
+}
+
+void
+event_queue(enum event_type type, sip_msg_t *msg, int previous)
+{
+    char line[EVENT_LINE_LEN];
+    char value[SIP_ATTR_MAXLEN * 2];
+    struct timeval ts = msg_get_time(msg);
+    const char *name;
+    char *record;
+    size_t pos;
+    int i;
+
+    // Event type and time of the message that triggered it
+    if (events->format == EVENT_FORMAT_JSON) {
+        pos = sprintf(line, "{\"event\":\"%s\",\"ts\":%ld.%06ld",
+                      event_type_names[type], (long) ts.tv_sec, (long) ts.tv_usec);
+        if (type == EVENT_STATE && previous) {
+            event_append(line, &pos, ",\"previous\":", 12);
+            event_append_value(line, &pos, events->format, call_state_to_str(previous));
+        }
+    } else {
+        pos = sprintf(line, "%s,%ld.%06ld,",
+                      event_type_names[type], (long) ts.tv_sec, (long) ts.tv_usec);
+        if (type == EVENT_STATE && previous)
+            event_append_value(line, &pos, events->format, call_state_to_str(previous));
+    }
+
+    // Configured call attributes
+    for (i = 0; i < events->fieldcnt; i++) {
+        if (events->format == EVENT_FORMAT_JSON) {
+            name = sip_attr_get_name(events->fields[i]);
+            event_append(line, &pos, ",\"", 2);
+            event_append(line, &pos, name, strlen(name));
+            event_append(line, &pos, "\":", 2);
+        } else {
+            event_append(line, &pos, ",", 1);
+        }
+        memset(value, 0, sizeof(value));
+        event_append_value(line, &pos, events->format,
+                           event_field_value(type, msg, events->fields[i], value));
+    }
+
+    if (events->format == EVENT_FORMAT_JSON)
+        event_append(line, &pos, "}", 1);
+    event_append(line, &pos, "\n", 1);
+
+    // Record is too long to be written
+    if (pos >= EVENT_LINE_LEN) {
+        atomic_fetch_add_explicit(&events->dropped, 1, memory_order_relaxed);
+        return;
+    }
+    line[pos] = '\0';
+
+    // Never wait for the output while capturing
+    if (!(record = strdup(line)) || ring_push(events->ring, record) != 0) {
+        atomic_fetch_add_explicit(&events->dropped, 1, memory_order_relaxed);
+        free(record);
+        return;
+    }
+
+    event_wakeup(false);
+}
+
+const char *
+event_field_value(enum event_type type, sip_msg_t *msg, enum sip_attr_id id, char *value)
+{
+    sip_call_t *call = msg_get_call(msg);
+
+    switch (id) {
+        case SIP_ATTR_CALLID:
+            // Call-ID can be longer than attribute values
+            return call->callid;
+        case SIP_ATTR_XCALLID:
+            return strlen(call->xcallid) ? call->xcallid : NULL;
+        case SIP_ATTR_SRC:
+        case SIP_ATTR_DST:
+        case SIP_ATTR_METHOD:
+        case SIP_ATTR_SIPFROM:
+        case SIP_ATTR_SIPFROMUSER:
+        case SIP_ATTR_SIPTO:
+        case SIP_ATTR_SIPTOUSER:
+        case SIP_ATTR_DATE:
+        case SIP_ATTR_TIME:
+            if (type == EVENT_MESSAGE)
+                return msg_get_attribute(msg, id, value);
+            return call_get_attribute(call, id, value);
+        default:
+            return call_get_attribute(call, id, value);
+    }
+}
+
+void
+event_wakeup(bool force)
+{
+    if (!events)
+        return;
+
+    // Make queued records visible before checking writer status
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // Only signal the writer if it is actually sleeping
+    if (force || atomic_load(&events->waiting)) {
+        pthread_mutex_lock(&events->lock);
+        pthread_cond_signal(&events->cond);
+        pthread_mutex_unlock(&events->lock);
+    }
+}
+
+void
+event_thread(void *info)
+{
+    event_output_t *output = (event_output_t *) info;
+    bool pending = false;
+    struct timespec ts;
+    char *record;
+
+    for (;;) {
+        // Write all queued records
+        while ((record = ring_pop(output->ring))) {
+            fputs(record, output->file);
+            free(record);
+            pending = true;
+        }
+
+        // Push buffered records to file once queue is empty
+        if (pending)
+            fflush(output->file);
+        pending = false;
+
+        // All queued records have been written
+        if (output->stopping && ring_count(output->ring) == 0)
+            break;
+
+        // Wait until more records are queued
+        pthread_mutex_lock(&output->lock);
+        output->waiting = true;
+        if (ring_count(output->ring) == 0 && !output->stopping) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += CAPTURE_RING_WAIT * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&output->cond, &output->lock, &ts);
+        }
+        output->waiting = false;
+        pthread_mutex_unlock(&output->lock);
+    }
+}
@@ -0,0 +1,183 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file event.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to write dialog events in JSON lines or CSV format
+ *
+ * When an events output is configured, one record is written each time a
+ * call changes its state and, optionally, for each SIP message. Records
+ * contain the event type, the time of the message that triggered it and
+ * the configured call attributes:
+ *
+ *   {"event":"state","ts":1514764800.123456,"previous":"CALL SETUP","state":"IN CALL",...}
+ *
+ * Records are formatted by the parser thread and written by a dedicated
+ * thread, so slow outputs never stall capture: records are discarded if
+ * the writer queue is full.
+ */
+#ifndef __SNGREP_EVENT_H
+#define __SNGREP_EVENT_H
+
+#include "config.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "sip.h"
+#include "ring.h"
+
+//! Number of records that can be pending to be written
+#define EVENT_QUEUE         16384
+//! Output file buffer size (KB)
+#define EVENT_BUFFER        256
+//! Max length of a formatted record
+#define EVENT_LINE_LEN      8192
+
+//! Available record formats
+enum event_format {
+    EVENT_FORMAT_JSON = 0,
+    EVENT_FORMAT_CSV,
+};
+
+//! Available event types
+enum event_type {
+    EVENT_STATE = 0,
+    EVENT_MESSAGE,
+};
+
+//! Shorter declaration of event_output structure
+typedef struct event_output event_output_t;
+
+/**
+ * @brief Events output file and writer thread
+ */
+struct event_output
+{
+    //! Output file path ("-" for standard output)
+    const char *outfile;
+    //! Output file
+    FILE *file;
+    //! Output file buffer
+    char *buffer;
+    //! Records format
+    enum event_format format;
+    //! Write a record for each SIP message
+    bool messages;
+    //! Call attributes written in each record
+    enum sip_attr_id fields[SIP_ATTR_COUNT];
+    //! Number of attributes written in each record
+    int fieldcnt;
+    //! Formatted records pending to be written (char *)
+    ring_t *ring;
+    //! Records discarded because queue was full
+    atomic_ulong dropped;
+    //! Writer thread has been requested to stop
+    atomic_bool stopping;
+    //! Writer thread is sleeping waiting for records
+    atomic_bool waiting;
+    //! Lock and condition to wake up writer thread
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    //! Writer thread
+    pthread_t thread;
+};
+
+/**
+ * @brief Open events output and start its writer thread
+ *
+ * Records format and fields are read from events.* settings. Nothing is
+ * done if no output file is given.
+ *
+ * @param outfile Output file path or "-" for standard output
+ * @return 0 on success, 1 otherwise
+ */
+int
+event_open(const char *outfile);
+
+/**
+ * @brief Write pending records and close events output
+ */
+void
+event_close();
+
+/**
+ * @brief Queue a call state transition record
+ *
+ * Callers must be holding capture lock
+ *
+ * @param call Call that has changed its state
+ * @param msg Message that triggered the transition
+ * @param previous Call state before the message
+ */
+void
+event_call_state(sip_call_t *call, sip_msg_t *msg, int previous);
+
+/**
+ * @brief Queue a SIP message record if enabled in settings
+ *
+ * Callers must be holding capture lock
+ */
+void
+event_message(sip_msg_t *msg);
+
+/**
+ * @brief Get number of records discarded because queue was full
+ */
+unsigned long
+event_dropped();
+
+/**
+ * @brief Format a record and queue it to the writer thread
+ *
+ * @param type Event type
+ * @param msg Message that triggered the event
+ * @param previous Call state before the message (only for state events)
+ */
+void
+event_queue(enum event_type type, sip_msg_t *msg, int previous);
+
+/**
+ * @brief Get the value of a record field
+ *
+ * Message events take message attributes (addresses, method, date...)
+ * from the message itself instead of the first message of its call.
+ *
+ * @return field value or NULL if empty
+ */
+const char *
+event_field_value(enum event_type type, sip_msg_t *msg, enum sip_attr_id id, char *value);
+
+/**
+ * @brief Wake up the writer thread if it is sleeping
+ */
+void
+event_wakeup(bool force);
+
+/**
+ * @brief Events writer thread function
+ */
+void
+event_thread(void *info);
+
+#endif /* __SNGREP_EVENT_H */
@@ -26,12 +26,20 @@
  * @brief Source code of functions defined in filter.h
  *
  */
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "sip.h"
+#include "sip_column.h"
+#include "capture.h"
+#include "setting.h"
 #include "curses/ui_call_list.h"
 #include "filter.h"
 
+//! Capture configuration (storage mode)
+extern capture_config_t capture_cfg;
+
 //! Storage of filter information
 filter_t filters[FILTER_COUNT] = { };
 
@@ -40,10 +48,10 @@ filter_set(int type, const char *expr)
 {
 #ifdef WITH_PCRE
     pcre *regex = NULL;
+    const char *re_err = NULL;
 
     // If we have an expression, check if compiles before changing the filter
     if (expr) {
-        const char *re_err = NULL;
         int32_t err_offset;
         int32_t pcre_options = PCRE_UNGREEDY | PCRE_CASELESS;
 
@@ -55,12 +63,49 @@ filter_set(int type, const char *expr)
     // Remove previous value
     if (filters[type].expr) {
         sng_free(filters[type].expr);
+        pcre_free_study(filters[type].extra);
         pcre_free(filters[type].regex);
     }
 
     // Set new expresion values
     filters[type].expr = (expr) ? strdup(expr) : NULL;
     filters[type].regex = regex;
+    // Filters are checked against all calls: JIT compile them if possible
+    filters[type].extra = (regex) ? pcre_study(regex, SIP_PCRE_STUDY_OPTIONS, &re_err) : NULL;
+
+#elif defined(WITH_PCRE2)
+    pcre2_code *regex = NULL;
+    pcre2_match_data *match_data = NULL;
+
+    // If we have an expression, check if compiles before changing the filter
+    if (expr) {
+        int re_err = 0;
+        PCRE2_SIZE err_offset = 0;
+        uint32_t pcre_options = PCRE2_UNGREEDY | PCRE2_CASELESS;
+
+        // Check if we have a valid expression
+        if (!(regex = pcre2_compile((PCRE2_SPTR) expr, PCRE2_ZERO_TERMINATED, pcre_options, &re_err, &err_offset, NULL)))
+            return 1;
+
+        // Filters are checked against all calls: JIT compile them if possible
+        pcre2_jit_compile(regex, PCRE2_JIT_COMPLETE);
+        if (!(match_data = pcre2_match_data_create_from_pattern(regex, NULL))) {
+            pcre2_code_free(regex);
+            return 1;
+        }
+    }
+
+    // Remove previous value
+    if (filters[type].expr) {
+        sng_free(filters[type].expr);
+        pcre2_match_data_free(filters[type].match_data);
+        pcre2_code_free(filters[type].regex);
+    }
+
+    // Set new expresion values
+    filters[type].expr = (expr) ? strdup(expr) : NULL;
+    filters[type].regex = regex;
+    filters[type].match_data = match_data;
 
 #else
     regex_t regex;
@@ -82,6 +127,16 @@ filter_set(int type, const char *expr)
     memcpy(&filters[type].regex, &regex, sizeof(regex));
 #endif
 
+    // Indexed calls can be discarded if they don't contain expression literals
+    sng_free(filters[type].grams);
+    filters[type].grams = NULL;
+    filters[type].gramcnt = 0;
+    if (expr && type == FILTER_PAYLOAD)
+        filters[type].gramcnt = filter_expr_trigrams(expr, &filters[type].grams);
+
+    // Stored results of attribute values were checked with previous expression
+    sip_column_match_reset();
+
     return 0;
 }
 
@@ -94,11 +149,7 @@ filter_get(int type)
 int
 filter_check_call(void *item)
 {
-    int i;
-    char data[MAX_SIP_PAYLOAD];
     sip_call_t *call = (sip_call_t*) item;
-    sip_msg_t *msg;
-    vector_iter_t it;
 
     // Dont filter calls without messages
     if (call_msg_count(call) == 0)
@@ -108,82 +159,227 @@ filter_check_call(void *item)
     if (call->filtered != -1)
         return (call->filtered == 0);
 
-    // By default, call matches all filters
-    call->filtered = 0;
+    // Store the result for next checks
+    call->filtered = (filter_match_call(call, filters)) ? 0 : 1;
+
+    // Return the final filter status
+    return (call->filtered == 0);
+}
+
+int
+filter_match_call(sip_call_t *call, filter_t *flist)
+{
+    int i;
+    char data[MAX_SIP_PAYLOAD];
+    const char *payload;
+    sip_msg_t *msg;
+    vector_iter_t it;
+    ui_t *ui;
+    int matched, cached;
+    enum sip_attr_id attr;
 
     // Check all filter types
     for (i=0; i < FILTER_COUNT; i++) {
         // If filter is not enabled, go to the next
-        if (!filters[i].expr)
+        if (!flist[i].expr)
             continue;
 
-        // Initialize
-        memset(data, 0, sizeof(data));
+        // Initialize (payload filter doesn't use this buffer)
+        if (i != FILTER_PAYLOAD)
+            memset(data, 0, sizeof(data));
 
         // Get filtered field
+        attr = SIP_ATTR_COUNT;
         switch(i) {
             case FILTER_SIPFROM:
-                call_get_attribute(call, SIP_ATTR_SIPFROM, data);
+                attr = SIP_ATTR_SIPFROM;
                 break;
             case FILTER_SIPTO:
-                call_get_attribute(call, SIP_ATTR_SIPTO, data);
+                attr = SIP_ATTR_SIPTO;
                 break;
             case FILTER_SOURCE:
-                call_get_attribute(call, SIP_ATTR_SRC, data);
+                attr = SIP_ATTR_SRC;
                 break;
             case FILTER_DESTINATION:
-                call_get_attribute(call, SIP_ATTR_DST, data);
+                attr = SIP_ATTR_DST;
                 break;
             case FILTER_METHOD:
-                call_get_attribute(call, SIP_ATTR_METHOD, data);
+                attr = SIP_ATTR_METHOD;
                 break;
             case FILTER_PAYLOAD:
                 break;
             case FILTER_CALL_LIST:
+                // Call list panel is destroyed before capture is stopped
+                if (!(ui = ui_find_by_type(PANEL_CALL_LIST)))
+                    break;
                 // FIXME Maybe call should know hot to calculate this line
-                call_list_line_text(ui_find_by_type(PANEL_CALL_LIST), call, data);
+                call_list_line_text(ui, call, data);
                 break;
             default:
                 // Unknown filter id
                 return 0;
         }
 
+        // Attributes stored in columns are checked once for each value
+        if (attr != SIP_ATTR_COUNT) {
+            // Results are only stored for current filters (or their worker copies)
+            cached = (flist[i].expr == filters[i].expr);
+            if (!cached || (matched = sip_column_match_get(call, attr)) == SIP_COLUMN_MATCH_UNKNOWN) {
+                call_get_attribute(call, attr, data);
+                matched = (filter_check_expr(flist[i], data, strlen(data)) == 0);
+                if (cached)
+                    sip_column_match_set(call, attr, matched);
+            }
+            if (!matched)
+                return 0;
+            continue;
+        }
+
         // For payload filtering, check all messages payload
         if (i == FILTER_PAYLOAD) {
+            // Payloads without the expression literals can not match
+            if (flist[i].gramcnt && !call_index_check(call, flist[i].grams, flist[i].gramcnt))
+                return 0;
             // Assume this call doesn't match the filter
-            call->filtered = 1;
+            matched = 0;
             // Create an iterator for the call messages
             it = vector_iterator(call->msgs);
             while ((msg = vector_iterator_next(&it))) {
-                // Copy message payload
-                strcpy(data, msg_get_payload(msg));
-                // Check if this payload matches the filter
-                if (filter_check_expr(filters[i], data) == 0) {
-                    call->filtered = 0;
+                // Check if this payload matches the filter (payload is always null terminated)
+                if ((payload = msg_get_payload(msg)) && filter_check_expr(flist[i], payload, packet_payloadlen(msg->packet)) == 0) {
+                    matched = 1;
                     break;
                 }
             }
-            if (call->filtered == 1)
-                break;
+            if (!matched)
+                return 0;
         } else {
             // Check the filter against given data
-            if (filter_check_expr(filters[i], data) != 0) {
+            if (filter_check_expr(flist[i], data, strlen(data)) != 0) {
                 // The data didn't matched the filter
-                call->filtered = 1;
-                break;
+                return 0;
             }
         }
     }
 
-    // Return the final filter status
-    return (call->filtered == 0);
+    // By default, call matches all filters
+    return 1;
+}
+
+uint32_t
+filter_expr_trigrams(const char *expr, uint32_t **bits)
+{
+    size_t exprlen = strlen(expr);
+    char *literal;
+    uint32_t *grams;
+    uint32_t count = 0;
+    size_t len = 0, i;
+    int depth = 0;
+    const char *c;
+
+    *bits = NULL;
+    if (exprlen < 3)
+        return 0;
+
+    // There can't be more literal characters than expression characters
+    literal = sng_malloc(exprlen + 1);
+    grams = sng_malloc(sizeof(uint32_t) * exprlen);
+    if (!literal || !grams) {
+        sng_free(literal);
+        sng_free(grams);
+        return 0;
+    }
+
+    for (c = expr; ; c++) {
+        switch (*c) {
+            case '\\':
+                // Escaped classes, references or codes
+                if (!c[1] || isalnum((u_char) c[1]))
+                    goto unknown;
+                // Escaped metacharacter
+                if (depth == 0)
+                    literal[len++] = *++c;
+                else
+                    c++;
+                continue;
+            case '|':
+                // Any of the alternatives could match
+                if (depth == 0)
+                    goto unknown;
+                continue;
+            case '[':
+                // Character classes are never part of literals
+                if (*++c == '^')
+                    c++;
+                if (*c == ']')
+                    c++;
+                while (*c && *c != ']') {
+                    if (*c == '\\' && c[1])
+                        c++;
+                    c++;
+                }
+                if (!*c)
+                    goto unknown;
+                break;
+            case '*':
+            case '?':
+            case '{':
+                // Previous character may not be in the text
+                if (len)
+                    len--;
+                if (*c == '{') {
+                    while (c[1] && *c != '}')
+                        c++;
+                }
+                break;
+            case '(':
+                depth++;
+                break;
+            case ')':
+                depth--;
+                break;
+            case '+':
+            case '.':
+            case '^':
+            case '$':
+            case '\0':
+                break;
+            default:
+                if (depth == 0)
+                    literal[len++] = *c;
+                continue;
+        }
+
+        // Store trigrams of the finished literal
+        for (i = 0; i + 2 < len; i++)
+            grams[count++] = call_index_trigram(literal + i);
+        len = 0;
+
+        if (!*c)
+            break;
+    }
+
+    sng_free(literal);
+    if (!count) {
+        sng_free(grams);
+        return 0;
+    }
+    *bits = grams;
+    return count;
+
+unknown:
+    sng_free(literal);
+    sng_free(grams);
+    return 0;
 }
 
 int
-filter_check_expr(filter_t filter, const char *data)
+filter_check_expr(filter_t filter, const char *data, size_t len)
 {
 #ifdef WITH_PCRE
-        return pcre_exec(filter.regex, 0, data, strlen(data), 0, 0, 0, 0);
+        return pcre_exec(filter.regex, filter.extra, data, len, 0, 0, 0, 0) < 0;
+#elif defined(WITH_PCRE2)
+        return pcre2_match(filter.regex, (PCRE2_SPTR) data, len, 0, 0, filter.match_data, NULL) < 0;
 #else
         // Call doesn't match this filter
         return regexec(&filter.regex, data, 0, NULL, 0);
@@ -194,9 +390,192 @@ void
 filter_reset_calls()
 {
     sip_call_t *call;
+    filter_job_t *job;
+    WINDOW *progress = NULL;
+    uint64_t start = ui_time_ms();
     vector_iter_t calls = sip_calls_iterator();
 
     // Force filter evaluation
     while ((call = vector_iterator_next(&calls)))
         call->filtered = -1;
+
+    // Evaluate all calls in parallel if it is worth it
+    if ((job = filter_job_start(sip_calls_vector()))) {
+        while (filter_job_running(job)) {
+            // Only display progress if filtering takes some time
+            if (!progress && ui_time_ms() - start >= FILTER_PROGRESS_WAIT)
+                progress = dialog_progress_run("Filtering calls...");
+            if (progress)
+                dialog_progress_set_value(progress, filter_job_progress(job));
+            usleep(10000);
+        }
+        filter_job_finish(job);
+        if (progress)
+            dialog_progress_destroy(progress);
+    }
+
+    // Check all calls against new filters once
+    sip_calls_refilter();
+}
+
+int
+filter_job_workers(uint32_t count)
+{
+    int workers;
+
+    // Get number of filtering threads
+    if (setting_get_intvalue(SETTING_FILTER_WORKERS) > 0) {
+        workers = setting_get_intvalue(SETTING_FILTER_WORKERS);
+    } else {
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+        if (workers > FILTER_WORKERS)
+            workers = FILTER_WORKERS;
+    }
+
+    // Uncompressing stored payloads uses a shared cache
+    if (filters[FILTER_PAYLOAD].expr && capture_cfg.storage == CAPTURE_STORAGE_COMPRESSED)
+        return 1;
+
+    // Don't start threads for a few calls
+    if ((uint32_t) workers > count / FILTER_WORKER_CALLS)
+        workers = count / FILTER_WORKER_CALLS;
+
+    return (workers < 1) ? 1 : workers;
+}
+
+filter_job_t *
+filter_job_start(vector_t *calls)
+{
+    filter_job_t *job;
+    filter_worker_t *worker;
+    uint32_t count = vector_count(calls);
+    uint32_t chunk, i;
+    int workers;
+
+    // Not worth it, calls will be checked by caller thread
+    if ((workers = filter_job_workers(count)) <= 1)
+        return NULL;
+
+    if (!(job = sng_malloc(sizeof(filter_job_t))))
+        return NULL;
+
+    job->calls = calls;
+    job->count = count;
+    job->results = sng_malloc(count);
+    job->workers = sng_malloc(sizeof(filter_worker_t) * workers);
+    atomic_init(&job->done, 0);
+    atomic_init(&job->running, 0);
+    if (!job->results || !job->workers) {
+        sng_free(job->results);
+        sng_free(job->workers);
+        sng_free(job);
+        return NULL;
+    }
+
+    // Each worker checks a contiguous range of calls
+    chunk = (count + workers - 1) / workers;
+    for (i = 0; i < (uint32_t) workers; i++) {
+        worker = &job->workers[job->wcount];
+        worker->job = job;
+        worker->first = i * chunk;
+        worker->last = (worker->first + chunk < count) ? worker->first + chunk : count;
+        filter_worker_filters(worker);
+
+        job->running++;
+        if (pthread_create(&worker->thread, NULL, (void *) filter_worker_thread, worker) != 0) {
+            // Check the remaining calls from this thread
+            worker->last = count;
+            filter_worker_thread(worker);
+            break;
+        }
+        job->wcount++;
+    }
+
+    return job;
+}
+
+bool
+filter_job_running(filter_job_t *job)
+{
+    return job->running > 0;
+}
+
+int
+filter_job_progress(filter_job_t *job)
+{
+    uint32_t done = job->done;
+
+    if (!job->count || done >= job->count)
+        return 100;
+    return (done * 100) / job->count;
+}
+
+void
+filter_job_finish(filter_job_t *job)
+{
+    sip_call_t *call;
+    uint32_t i;
+
+    for (i = 0; i < job->wcount; i++)
+        pthread_join(job->workers[i].thread, NULL);
+
+    // Publish all results at once
+    for (i = 0; i < job->count; i++) {
+        call = vector_item(job->calls, i);
+        if (job->results[i] != FILTER_RESULT_NONE)
+            call->filtered = (job->results[i] == FILTER_RESULT_MATCH) ? 0 : 1;
+    }
+
+    sng_free(job->results);
+    sng_free(job->workers);
+    sng_free(job);
+}
+
+void
+filter_worker_filters(filter_worker_t *worker)
+{
+    int i;
+
+    // Compiled expressions are shared, match data is not
+    memcpy(worker->filters, filters, sizeof(filters));
+#ifdef WITH_PCRE2
+    for (i = 0; i < FILTER_COUNT; i++) {
+        if (worker->filters[i].regex)
+            worker->filters[i].match_data = pcre2_match_data_create_from_pattern(worker->filters[i].regex, NULL);
+    }
+#else
+    (void) i;
+#endif
+}
+
+void
+filter_worker_thread(void *info)
+{
+    filter_worker_t *worker = (filter_worker_t *) info;
+    filter_job_t *job = worker->job;
+    sip_call_t *call;
+    uint32_t i;
+
+    for (i = worker->first; i < worker->last; i++) {
+        call = vector_item(job->calls, i);
+        // Calls without messages are not filtered
+        if (call_msg_count(call) == 0) {
+            job->results[i] = FILTER_RESULT_NONE;
+        } else {
+            job->results[i] = (filter_match_call(call, worker->filters))
+                              ? FILTER_RESULT_MATCH : FILTER_RESULT_NOMATCH;
+        }
+        // Progress is only informative
+        if (i % FILTER_WORKER_CALLS == 0)
+            atomic_fetch_add_explicit(&job->done, FILTER_WORKER_CALLS, memory_order_relaxed);
+    }
+
+#ifdef WITH_PCRE2
+    for (i = 0; i < FILTER_COUNT; i++) {
+        if (worker->filters[i].match_data)
+            pcre2_match_data_free(worker->filters[i].match_data);
+    }
+#endif
+
+    job->running--;
 }
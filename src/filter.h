@@ -43,13 +43,33 @@
 #include "config.h"
 #ifdef WITH_PCRE
 #include <pcre.h>
+#elif defined(WITH_PCRE2)
+#ifndef PCRE2_CODE_UNIT_WIDTH
+#define PCRE2_CODE_UNIT_WIDTH 8
+#endif
+#include <pcre2.h>
 #else
 #include <regex.h>
 #endif
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include "sip.h"
 
+//! Max number of filtering threads when filter.workers is 0
+#define FILTER_WORKERS          8
+//! Min number of calls checked by each filtering thread
+#define FILTER_WORKER_CALLS     5000
+//! Milliseconds before displaying filtering progress
+#define FILTER_PROGRESS_WAIT    100
+
 //! Shorter declaration of sip_call_group structure
 typedef struct filter filter_t;
+//! Shorter declaration of filter_job structure
+typedef struct filter_job filter_job_t;
+//! Shorter declaration of filter_worker structure
+typedef struct filter_worker filter_worker_t;
 
 /**
  * @brief Available filter types
@@ -79,15 +99,76 @@ enum filter_type {
 struct filter {
     //! The filter text
     char *expr;
+    //! Payload index bits of trigrams any matching text contains
+    uint32_t *grams;
+    //! Number of trigrams any matching text contains
+    uint32_t gramcnt;
 #ifdef WITH_PCRE
     //! The filter compiled expression
     pcre *regex;
+    //! Optimized expression data (NULL if it could not be studied)
+    pcre_extra *extra;
+#elif defined(WITH_PCRE2)
+    //! The filter compiled expression
+    pcre2_code *regex;
+    //! Match data reused for every check
+    pcre2_match_data *match_data;
 #else
     //! The filter compiled expression
     regex_t regex;
 #endif
 };
 
+/**
+ * @brief Filter result of a call checked by a filtering thread
+ */
+enum filter_result {
+    //! Call has not messages, it is not filtered
+    FILTER_RESULT_NONE = 0,
+    //! Call matches all filters
+    FILTER_RESULT_MATCH,
+    //! Call doesn't match any of the filters
+    FILTER_RESULT_NOMATCH,
+};
+
+/**
+ * @brief Filtering thread checking a range of calls
+ */
+struct filter_worker {
+    //! Filtering job this worker belongs to
+    filter_job_t *job;
+    //! Range of calls checked by this worker
+    uint32_t first, last;
+    //! Copy of filters (with its own match data)
+    filter_t filters[FILTER_COUNT];
+    //! Worker thread
+    pthread_t thread;
+};
+
+/**
+ * @brief Evaluation of filters against all calls
+ *
+ * Calls are split between several threads. Results are stored aside and
+ * set in all calls at once when all threads have finished, so caller must
+ * keep calls from changing (holding capture lock) until then.
+ */
+struct filter_job {
+    //! Calls to be checked
+    vector_t *calls;
+    //! Number of calls to be checked
+    uint32_t count;
+    //! Result of each call (enum filter_result)
+    int8_t *results;
+    //! Filtering threads
+    filter_worker_t *workers;
+    //! Number of started filtering threads
+    uint32_t wcount;
+    //! Aproximated number of checked calls
+    atomic_uint done;
+    //! Number of threads still checking calls
+    atomic_uint running;
+};
+
 /**
  * @brief Set a given filter expression
  *
@@ -120,21 +201,101 @@ filter_get(int type);
 int
 filter_check_call(void *item);
 
+/**
+ * @brief Check if a call matches the given filters
+ *
+ * Unlike filter_check_call, result is not stored in the call.
+ *
+ * @param call Call to be checked
+ * @param flist Filters array (FILTER_COUNT filters)
+ * @return 1 if call matches all filters, 0 otherwise
+ */
+int
+filter_match_call(sip_call_t *call, filter_t *flist);
+
+/**
+ * @brief Get the trigrams any text matching an expression must contain
+ *
+ * Only literal characters outside groups and not followed by optional
+ * quantifiers are considered. Expressions with alternatives or escaped
+ * classes have no required trigrams.
+ *
+ * @param expr Filter expression
+ * @param bits Payload index bits of required trigrams (must be freed)
+ * @return number of required trigrams
+ */
+uint32_t
+filter_expr_trigrams(const char *expr, uint32_t **bits);
+
 /**
  * @brief Check if data matches the filter regexp
  *
+ * @param filter filter to check
+ * @param data null terminated data
+ * @param len data length
  * @return 0 if the given data matches the filter
  */
 int
-filter_check_expr(filter_t filter, const char *data);
+filter_check_expr(filter_t filter, const char *data, size_t len);
 
 /**
  * @brief Reset filtered flag in all calls
  *
  * This function can be used to force reevaluation
- * of filters in all calls.
+ * of filters in all calls. Displayed calls list is rebuilt, so it
+ * must be invoked after changing filter expressions.
  */
 void
 filter_reset_calls();
 
+/**
+ * @brief Get number of threads worth checking the given calls
+ *
+ * Threads are only used when each one has enough calls to check and
+ * never when payloads must be uncompressed.
+ */
+int
+filter_job_workers(uint32_t count);
+
+/**
+ * @brief Start checking the filters against all given calls
+ *
+ * @param calls Calls vector (must not change until job is finished)
+ * @return job data or NULL if calls are not worth using threads
+ */
+filter_job_t *
+filter_job_start(vector_t *calls);
+
+/**
+ * @brief Check if any filtering thread is still running
+ */
+bool
+filter_job_running(filter_job_t *job);
+
+/**
+ * @brief Get percentage of calls already checked
+ */
+int
+filter_job_progress(filter_job_t *job);
+
+/**
+ * @brief Wait for filtering threads and store results in all calls
+ *
+ * Job memory is deallocated.
+ */
+void
+filter_job_finish(filter_job_t *job);
+
+/**
+ * @brief Initialize a filtering thread copy of filters
+ */
+void
+filter_worker_filters(filter_worker_t *worker);
+
+/**
+ * @brief Filtering thread function
+ */
+void
+filter_worker_thread(void *info);
+
 #endif /* __SNGREP_FILTER_H_ */
@@ -38,18 +38,21 @@ call_group_create()
         return NULL;
     }
     group->calls = vector_create(5, 2);
+    group->index = htable_create(16);
     return group;
 }
 
 void
 call_group_destroy(sip_call_group_t *group)
 {
-    // Remove all calls of the group
+    // Unlock all calls of the group
     sip_call_t *call;
-    while ((call = vector_first(group->calls))) {
-        call_group_del(group, call);
+    vector_iter_t it = vector_iterator(group->calls);
+    while ((call = vector_iterator_next(&it))) {
+        call->locked = false;
     }
     vector_destroy(group->calls);
+    htable_destroy(group->index);
     sng_free(group);
 }
 
@@ -91,6 +94,13 @@ call_group_clone(sip_call_group_t *original)
     }
 
     clone->calls = vector_clone(original->calls);
+    clone->index = htable_create(vector_count(original->calls));
+
+    sip_call_t *call;
+    vector_iter_t it = vector_iterator(clone->calls);
+    while ((call = vector_iterator_next(&it))) {
+        htable_insert(clone->index, call->callid, call);
+    }
     return clone;
 }
 
@@ -102,6 +112,7 @@ call_group_add(sip_call_group_t *group, sip_call_t *call)
     if (!call_group_exists(group, call)) {
         call->locked = true;
         vector_append(group->calls, call);
+        htable_insert(group->index, call->callid, call);
     }
 }
 
@@ -116,6 +127,7 @@ call_group_add_calls(sip_call_group_t *group, vector_t *calls)
         call->locked = true;
         if (!call_group_exists(group, call)) {
             vector_append(group->calls, call);
+            htable_insert(group->index, call->callid, call);
         }
     }
 }
@@ -125,13 +137,26 @@ call_group_del(sip_call_group_t *group, sip_call_t *call)
 {
     if (!call) return;
     call->locked = false;
+
+    // Nothing to search if the call is not in the group
+    if (!call_group_exists(group, call))
+        return;
+    htable_remove(group->index, call->callid);
     vector_remove(group->calls, call);
 }
 
+void
+call_group_clear(sip_call_group_t *group)
+{
+    vector_clear(group->calls);
+    htable_destroy(group->index);
+    group->index = htable_create(16);
+}
+
 int
 call_group_exists(sip_call_group_t *group, sip_call_t *call)
 {
-    return (vector_index(group->calls, call) >= 0) ? 1 : 0;
+    return (call && htable_find(group->index, call->callid) == call) ? 1 : 0;
 }
 
 int
@@ -223,34 +248,21 @@ call_group_msg_number(sip_call_group_t *group, sip_msg_t *msg)
 sip_msg_t *
 call_group_get_next_msg(sip_call_group_t *group, sip_msg_t *msg)
 {
-    sip_msg_t *next;
-
-    if (call_group_count(group) == 1) {
-        sip_call_t *call = vector_first(group->calls);
-        vector_iter_t it = vector_iterator(call->msgs);
-        vector_iterator_set_current(&it, vector_index(call->msgs, msg));
-        next = vector_iterator_next(&it);
-    } else {
-        vector_t *messages = vector_create(1,10);
-        vector_set_sorter(messages, call_group_msg_sorter);
-        vector_iter_t callsit = vector_iterator(group->calls);
-        sip_call_t *call;
-        while ((call = vector_iterator_next(&callsit))) {
-            vector_append_vector(messages, call->msgs);
-        }
+    sip_msg_t *next, *cand;
+    sip_call_t *call;
+    int i;
 
-        if (msg == NULL) {
-            next = vector_first(messages);
-        } else {
-            next = vector_item(messages, vector_index(messages, msg) + 1);
+    do {
+        // Merge calls messages: get the first one after msg
+        next = NULL;
+        for (i = 0; i < vector_count(group->calls); i++) {
+            call = vector_item(group->calls, i);
+            cand = call_group_call_next_msg(group, call, msg);
+            if (cand && (!next || call_group_msg_compare(group, cand, next) < 0))
+                next = cand;
         }
-        vector_destroy(messages);
-    }
-
-    next = sip_parse_msg(next);
-    if (next && group->sdp_only && !msg_has_sdp(next)) {
-        return call_group_get_next_msg(group, next);
-    }
+        msg = next = sip_parse_msg(next);
+    } while (next && group->sdp_only && !msg_has_sdp(next));
 
     return next;
 }
@@ -258,38 +270,91 @@ call_group_get_next_msg(sip_call_group_t *group, sip_msg_t *msg)
 sip_msg_t *
 call_group_get_prev_msg(sip_call_group_t *group, sip_msg_t *msg)
 {
-    sip_msg_t *prev;
-
-    if (call_group_count(group) == 1) {
-        sip_call_t *call = vector_first(group->calls);
-        vector_iter_t it = vector_iterator(call->msgs);
-        vector_iterator_set_current(&it, vector_index(call->msgs, msg));
-        prev = vector_iterator_prev(&it);
-    } else {
-        vector_t *messages = vector_create(1, 10);
-        vector_set_sorter(messages, call_group_msg_sorter);
-
-
-        vector_iter_t callsit = vector_iterator(group->calls);
-        sip_call_t *call;
-        while ((call = vector_iterator_next(&callsit))) {
-            vector_append_vector(messages, call->msgs);
+    sip_msg_t *prev, *cand;
+    sip_call_t *call;
+    int i;
+
+    do {
+        // Merge calls messages: get the last one before msg
+        prev = NULL;
+        for (i = 0; i < vector_count(group->calls); i++) {
+            call = vector_item(group->calls, i);
+            cand = call_group_call_prev_msg(group, call, msg);
+            if (cand && (!prev || call_group_msg_compare(group, cand, prev) > 0))
+                prev = cand;
         }
+        msg = prev = sip_parse_msg(prev);
+    } while (prev && group->sdp_only && !msg_has_sdp(prev));
+
+    return prev;
+}
+
+sip_msg_t *
+call_group_call_next_msg(sip_call_group_t *group, sip_call_t *call, sip_msg_t *msg)
+{
+    int low = 0, high = vector_count(call->msgs), middle;
+
+    if (!msg)
+        return vector_first(call->msgs);
 
-        if (msg == NULL) {
-            prev = vector_last(messages);
+    // Following message of the same call
+    if (msg->call == call)
+        return vector_item(call->msgs, msg->index + 1);
+
+    // Find the first message after msg
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (call_group_msg_compare(group, vector_item(call->msgs, middle), msg) <= 0) {
+            low = middle + 1;
         } else {
-            prev = vector_item(messages, vector_index(messages, msg) - 1);
+            high = middle;
         }
-        vector_destroy(messages);
     }
 
-    prev = sip_parse_msg(prev);
-    if (prev && group->sdp_only && !msg_has_sdp(prev)) {
-        return call_group_get_prev_msg(group, prev);
+    return vector_item(call->msgs, low);
+}
+
+sip_msg_t *
+call_group_call_prev_msg(sip_call_group_t *group, sip_call_t *call, sip_msg_t *msg)
+{
+    int low = 0, high = vector_count(call->msgs), middle;
+
+    if (!msg)
+        return vector_last(call->msgs);
+
+    // Preceding message of the same call
+    if (msg->call == call)
+        return vector_item(call->msgs, msg->index - 1);
+
+    // Find the first message not before msg
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (call_group_msg_compare(group, vector_item(call->msgs, middle), msg) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
     }
 
-    return prev;
+    return vector_item(call->msgs, low - 1);
+}
+
+int
+call_group_msg_compare(sip_call_group_t *group, sip_msg_t *one, sip_msg_t *two)
+{
+    struct timeval onets = msg_get_time(one), twots = msg_get_time(two);
+
+    // Sort by message time
+    if (onets.tv_sec != twots.tv_sec)
+        return (onets.tv_sec < twots.tv_sec) ? -1 : 1;
+    if (onets.tv_usec != twots.tv_usec)
+        return (onets.tv_usec < twots.tv_usec) ? -1 : 1;
+
+    // Messages with the same time follow calls order in the group
+    if (one->call != two->call)
+        return vector_index(group->calls, one->call) - vector_index(group->calls, two->call);
+
+    return one->index - two->index;
 }
 
 rtp_stream_t *
@@ -319,27 +384,3 @@ call_group_get_next_stream(sip_call_group_t *group, rtp_stream_t *stream)
 
     return next;
 }
-
-void
-call_group_msg_sorter(vector_t *vector, void *item)
-{
-    struct timeval curts, prevts;
-    int count = vector_count(vector);
-    int i;
-
-    // Current and last packet times
-    curts = msg_get_time(item);
-
-    for (i = count - 2 ; i >= 0; i--) {
-        // Get previous packet
-        prevts = msg_get_time(vector_item(vector, i));
-        // Check if the item is already in a sorted position
-        if (timeval_is_older(curts, prevts)) {
-            vector_insert(vector, item, i + 1);
-            return;
-        }
-    }
-
-    // Put this item at the begining of the vector
-    vector_insert(vector, item, 0);
-}
@@ -35,6 +35,7 @@
 
 #include "config.h"
 #include "vector.h"
+#include "hash.h"
 #include "sip.h"
 
 //! Shorter declaration of sip_call_group structure
@@ -52,6 +53,8 @@ struct sip_call_group {
     char *callid;
     //! Calls array in the group
     vector_t *calls;
+    //! Calls in the group indexed by Call-ID
+    htable_t *index;
     //! Color of the last printed call in mode Color-by-Call
     int color;
     //! Only consider SDP messages from Calls
@@ -126,6 +129,17 @@ call_group_add_calls(sip_call_group_t *group, vector_t *calls);
 void
 call_group_del(sip_call_group_t *group, sip_call_t *call);
 
+/**
+ * @brief Remove all calls from the group
+ *
+ * Calls are not accessed, so this can be used after they have been
+ * destroyed.
+ *
+ * @param group Pointer to an existing group
+ */
+void
+call_group_clear(sip_call_group_t *group);
+
 /**
  * @brief Check if a call is in the group
  *
@@ -231,11 +245,39 @@ rtp_stream_t *
 call_group_get_next_stream(sip_call_group_t *group, rtp_stream_t *stream);
 
 /**
- * @brief Sort messages in a group by message time
- * @param vector sorted vector
- * @param item item to add to the vector
+ * @brief Find the first message of a call after the given one
+ *
+ * Call messages are stored in time order, so messages of other calls
+ * are located with a binary search.
+ *
+ * @param group SIP call group structure
+ * @param call Call of the group
+ * @param msg Actual SIP msg from any call of the group (can be NULL)
+ * @return Next message of the call or NULL
  */
-void
-call_group_msg_sorter(vector_t *vector, void *item);
+sip_msg_t *
+call_group_call_next_msg(sip_call_group_t *group, sip_call_t *call, sip_msg_t *msg);
+
+/**
+ * @brief Find the last message of a call before the given one
+ *
+ * @param group SIP call group structure
+ * @param call Call of the group
+ * @param msg Actual SIP msg from any call of the group (can be NULL)
+ * @return Previous message of the call or NULL
+ */
+sip_msg_t *
+call_group_call_prev_msg(sip_call_group_t *group, sip_call_t *call, sip_msg_t *msg);
+
+/**
+ * @brief Compare the position of two messages of the group
+ *
+ * Messages are sorted by time. Messages with the same time are sorted
+ * by their call position in the group and their position in the call.
+ *
+ * @return negative if one is before two, positive if after, 0 if same
+ */
+int
+call_group_msg_compare(sip_call_group_t *group, sip_msg_t *one, sip_msg_t *two);
 
 #endif /* __SNGREP_GROUP_H_ */
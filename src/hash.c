@@ -34,22 +34,24 @@ htable_t *
 htable_create(size_t size)
 {
     htable_t *h;
+    size_t slots = HTABLE_MIN_SIZE;
 
     // Allocate memory for this table data
     if (!(h = malloc(sizeof(htable_t))))
         return NULL;
 
-    h->size = size;
+    memset(h, 0, sizeof(htable_t));
 
-    // Allocate memory for this table buckets
-    if (!(h->buckets = malloc(sizeof(hentry_t) * size))) {
+    // Enough slots to store the expected entries without growing
+    while (slots / 8 * HTABLE_MAX_LOAD < size)
+        slots <<= 1;
+
+    // Allocate memory for this table slots
+    if (htable_resize(h, slots) != 0) {
         free(h);
         return NULL;
     }
 
-    // Initialize allocated memory
-    memset(h->buckets, 0, sizeof(hentry_t) * size);
-
     // Return allocated table
     return h;
 }
@@ -64,70 +66,56 @@ htable_destroy(htable_t *table)
 int
 htable_insert(htable_t *table, const char *key, void *data)
 {
-    // Get hash position for given entry
-    size_t pos = htable_hash(table, key);
+    hentry_t entry;
 
-    // Create a new entry for given key
-    hentry_t *entry;
-    if (!(entry = malloc(sizeof(hentry_t))))
+    // Grow the table before it gets too full
+    if ((table->count + 1) * 8 > table->size * HTABLE_MAX_LOAD
+            && htable_resize(table, table->size * 2) != 0)
         return -1;
 
-    entry->key = key;
-    entry->data = data;
-    entry->next = 0;
-
-    // Check if the hash position is in use
-    hentry_t *exists = table->buckets[pos];
-
-    if (!exists) {
-        table->buckets[pos] = entry;
-    } else {
-        while (exists->next) {
-            exists = exists->next;
-        }
-        exists->next = entry;
-    }
+    entry.key = key;
+    entry.data = data;
+    entry.hash = htable_hash(table, key);
+    htable_place(table, entry);
+    table->count++;
     return 0;
 }
 
 void
 htable_remove(htable_t *table, const char *key)
 {
-    // Get hash position for given entry
-    size_t pos = htable_hash(table, key);
-
-    // Check if the hash position is in use
-    hentry_t *entry, *prev = NULL;
-    for (entry = table->buckets[pos]; entry; prev = entry, entry = entry->next) {
-        if (!strcmp(entry->key, key)) {
-            if (prev) {
-                prev->next = entry->next;
-            } else {
-                table->buckets[pos] = entry->next;
-            }
-            // Remove item memory
-            free(entry);
-        }
+    size_t mask = table->size - 1, pos, next;
+
+    // Check if the key is in the table
+    pos = htable_lookup(table, key, strlen(key), htable_hash(table, key));
+    if (pos == table->size)
+        return;
+
+    // Move back the following entries that are not in their home slot
+    for (next = (pos + 1) & mask; table->buckets[next].key; next = (next + 1) & mask) {
+        if (htable_slot(table, table->buckets[next].hash) == next)
+            break;
+        table->buckets[pos] = table->buckets[next];
+        pos = next;
     }
+
+    memset(&table->buckets[pos], 0, sizeof(hentry_t));
+    table->count--;
 }
 
 void *
 htable_find(htable_t *table, const char *key)
 {
-    // Get hash position for given entry
-    size_t pos = htable_hash(table, key);
-
-    // Check if the hash position is in use
-    hentry_t *entry;
-    for (entry = table->buckets[pos]; entry; entry = entry->next) {
-        if (!strcmp(entry->key, key)) {
-            //! Found
-            return entry->data;
-        }
-    }
+    size_t len = strlen(key);
+    size_t pos = htable_lookup(table, key, len, htable_hash_len(table, key, len));
+    return (pos < table->size) ? table->buckets[pos].data : NULL;
+}
 
-    // Not found
-    return NULL;
+void *
+htable_find_len(htable_t *table, const char *key, size_t len)
+{
+    size_t pos = htable_lookup(table, key, len, htable_hash_len(table, key, len));
+    return (pos < table->size) ? table->buckets[pos].data : NULL;
 }
 
 size_t
@@ -135,8 +123,91 @@ htable_hash(htable_t *table, const char *key)
 {
     // dbj2 - http://www.cse.yorku.ca/~oz/hash.html
     size_t hash = 5381;
-    while (*key++) {
-        hash = ((hash << 5) + hash) ^ *key;
+    while (*key) {
+        hash = ((hash << 5) + hash) ^ (unsigned char) *key++;
+    }
+    return hash;
+}
+
+size_t
+htable_hash_len(htable_t *table, const char *key, size_t len)
+{
+    // Same hash as htable_hash for the first len characters of key
+    size_t hash = 5381, i;
+    for (i = 0; i < len; i++) {
+        hash = ((hash << 5) + hash) ^ (unsigned char) key[i];
+    }
+    return hash;
+}
+
+size_t
+htable_slot(htable_t *table, size_t hash)
+{
+    // Fibonacci hashing spreads similar keys along the table
+    return (size_t) (((uint64_t) hash * 0x9E3779B97F4A7C15ULL) >> (64 - table->bits));
+}
+
+size_t
+htable_lookup(htable_t *table, const char *key, size_t len, size_t hash)
+{
+    size_t mask = table->size - 1, pos, dist;
+    hentry_t *entry;
+
+    pos = htable_slot(table, hash);
+    for (dist = 0; (entry = &table->buckets[pos])->key; dist++, pos = (pos + 1) & mask) {
+        // Compare strings only when full hash matches
+        if (entry->hash == hash && !strncmp(entry->key, key, len) && entry->key[len] == '\0')
+            return pos;
+        // Key would have taken the place of entries closer to their home
+        if (((pos - htable_slot(table, entry->hash)) & mask) < dist)
+            break;
+    }
+
+    // Not found
+    return table->size;
+}
+
+void
+htable_place(htable_t *table, hentry_t entry)
+{
+    size_t mask = table->size - 1, pos, dist, edist;
+    hentry_t swap;
+
+    pos = htable_slot(table, entry.hash);
+    for (dist = 0; table->buckets[pos].key; dist++, pos = (pos + 1) & mask) {
+        // Take the slot of entries closer to their home slot
+        edist = (pos - htable_slot(table, table->buckets[pos].hash)) & mask;
+        if (edist < dist) {
+            swap = table->buckets[pos];
+            table->buckets[pos] = entry;
+            entry = swap;
+            dist = edist;
+        }
     }
-    return hash & (table->size - 1);
+
+    table->buckets[pos] = entry;
+}
+
+int
+htable_resize(htable_t *table, size_t size)
+{
+    hentry_t *old = table->buckets;
+    size_t oldsize = table->size, i;
+
+    if (!(table->buckets = calloc(size, sizeof(hentry_t)))) {
+        table->buckets = old;
+        return -1;
+    }
+
+    table->size = size;
+    for (table->bits = 0; ((size_t) 1 << table->bits) < size; table->bits++);
+
+    // Place again existing entries
+    for (i = 0; i < oldsize; i++) {
+        if (old[i].key)
+            htable_place(table, old[i]);
+    }
+
+    free(old);
+    return 0;
 }
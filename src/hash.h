@@ -24,6 +24,13 @@
  * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
  *
  * @brief Functions to manage hash tables
+ *
+ * Hash tables use open addressing with Robin Hood probing: each slot stores
+ * the full hash of its key, so most mismatches are discarded without
+ * comparing strings, and entries far from their home slot take the place of
+ * closer ones, keeping probe sequences short. Tables grow automatically when
+ * they get too full. Keys are not copied and must remain valid while their
+ * entry is in the table.
  */
 
 #ifndef __SNGREP_HASH_H_
@@ -31,6 +38,12 @@
 
 #include "config.h"
 #include <stdio.h>
+#include <stdint.h>
+
+//! Minimum number of slots of a table
+#define HTABLE_MIN_SIZE     16
+//! Maximum table load, in slots per 8 slots, before growing
+#define HTABLE_MAX_LOAD     6
 
 //! Shorter declaration of hash structures
 typedef struct htable htable_t;
@@ -40,27 +53,44 @@ typedef struct hentry hentry_t;
  *  Structure to hold a Hash table entry
  */
 struct hentry {
-    //! Key of the hash entry
+    //! Key of the hash entry (NULL for empty slots)
     const char *key;
     //! Pointer to has entry data
     void *data;
-    //! Next entry sharing the same hash value
-    hentry_t *next;
+    //! Full hash value of the key
+    size_t hash;
 };
 
 struct htable {
-    //! Fixed hash table limit
+    //! Number of slots (always a power of two)
     size_t size;
-    // Hash table entries
-    hentry_t **buckets;
+    //! Number of used slots
+    size_t count;
+    //! Number of bits of a slot index
+    uint32_t bits;
+    // Hash table slots
+    hentry_t *buckets;
 };
 
+/**
+ * @brief Create a new hash table
+ *
+ * @param size expected number of entries, table will grow if required
+ * @return allocated table or NULL on memory error
+ */
 htable_t *
 htable_create(size_t size);
 
 void
 htable_destroy(htable_t *table);
 
+/**
+ * @brief Add a new entry to the table
+ *
+ * Existing entries with the same key are not replaced.
+ *
+ * @return 0 on success, -1 on memory error
+ */
 int
 htable_insert(htable_t *table, const char *key, void *data);
 
@@ -70,7 +100,53 @@ htable_remove(htable_t *table, const char *key);
 void *
 htable_find(htable_t *table, const char *key);
 
+/**
+ * @brief Find an entry using the first len characters of key
+ */
+void *
+htable_find_len(htable_t *table, const char *key, size_t len);
+
+/**
+ * @brief Get the full hash value of a key
+ */
 size_t
 htable_hash(htable_t *table, const char *key);
 
+/**
+ * @brief Get the full hash value of the first len characters of a key
+ */
+size_t
+htable_hash_len(htable_t *table, const char *key, size_t len);
+
+/**
+ * @brief Get the home slot of a hash value
+ */
+size_t
+htable_slot(htable_t *table, size_t hash);
+
+/**
+ * @brief Find the slot of an entry
+ *
+ * @return slot index or table size if not found
+ */
+size_t
+htable_lookup(htable_t *table, const char *key, size_t len, size_t hash);
+
+/**
+ * @brief Place an entry in the table slots
+ *
+ * Table must have at least one empty slot.
+ */
+void
+htable_place(htable_t *table, hentry_t entry);
+
+/**
+ * @brief Move all entries to a new slot array
+ *
+ * @param size new number of slots (power of two)
+ * @return 0 on success, -1 on memory error
+ */
+int
+htable_resize(htable_t *table, size_t size);
+
 #endif /* __SNGREP_HASH_H_ */
@@ -0,0 +1,122 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file intern.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in intern.h
+ *
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "hash.h"
+#include "intern.h"
+
+//! Shared strings, keyed by their own contents
+static htable_t *strings = NULL;
+//! Number of different strings in the table
+static uint32_t strings_count = 0;
+//! Strings are interned by the parser and released by the UI
+static pthread_mutex_t strings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//! Get the entry holding an interned string
+#define INTERN_ENTRY(str) \
+    ((intern_entry_t *) ((str) - offsetof(intern_entry_t, str)))
+
+const char *
+intern_get(const char *str, size_t len)
+{
+    intern_entry_t *entry;
+
+    pthread_mutex_lock(&strings_lock);
+
+    if (!strings && !(strings = htable_create(INTERN_TABLE_SIZE))) {
+        pthread_mutex_unlock(&strings_lock);
+        return NULL;
+    }
+
+    // Add a new entry for unknown strings
+    if (!(entry = htable_find_len(strings, str, len))) {
+        if (!(entry = malloc(sizeof(intern_entry_t) + len + 1))) {
+            pthread_mutex_unlock(&strings_lock);
+            return NULL;
+        }
+        entry->refs = 0;
+        memcpy(entry->str, str, len);
+        entry->str[len] = '\0';
+        if (htable_insert(strings, entry->str, entry) != 0) {
+            free(entry);
+            pthread_mutex_unlock(&strings_lock);
+            return NULL;
+        }
+        strings_count++;
+    }
+
+    entry->refs++;
+    pthread_mutex_unlock(&strings_lock);
+    return entry->str;
+}
+
+void
+intern_release(const char *str)
+{
+    intern_entry_t *entry;
+
+    if (!str)
+        return;
+
+    pthread_mutex_lock(&strings_lock);
+    entry = INTERN_ENTRY(str);
+    if (--entry->refs == 0) {
+        htable_remove(strings, entry->str);
+        strings_count--;
+        free(entry);
+    }
+    pthread_mutex_unlock(&strings_lock);
+}
+
+uint32_t
+intern_count()
+{
+    return strings_count;
+}
+
+void
+intern_clear()
+{
+    size_t i;
+
+    pthread_mutex_lock(&strings_lock);
+    if (strings) {
+        for (i = 0; i < strings->size; i++) {
+            if (strings->buckets[i].key)
+                free(strings->buckets[i].data);
+        }
+        htable_destroy(strings);
+        strings = NULL;
+    }
+    strings_count = 0;
+    pthread_mutex_unlock(&strings_lock);
+}
@@ -0,0 +1,94 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file intern.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to share repeated immutable strings
+ *
+ * Values like SIP URIs repeat in most captured messages. Instead of
+ * storing a copy in each message, they are stored once in a table and
+ * each user holds a reference to the shared string. As interned strings
+ * are unique, two of them are equal if and only if their pointers are.
+ */
+
+#ifndef __SNGREP_INTERN_H_
+#define __SNGREP_INTERN_H_
+
+#include "config.h"
+#include <stdint.h>
+#include <stddef.h>
+
+//! Interning table buckets (must be a power of two)
+#define INTERN_TABLE_SIZE   16384
+
+//! Shorter declaration of intern_entry structure
+typedef struct intern_entry intern_entry_t;
+
+/**
+ * @brief Shared string with its references count
+ */
+struct intern_entry {
+    //! Number of users of this string
+    uint32_t refs;
+    //! String contents
+    char str[];
+};
+
+/**
+ * @brief Get the shared copy of a string
+ *
+ * The string is added to the table if it is not already there. Each call
+ * must be paired with an intern_release of the returned string.
+ *
+ * @param str string to intern (not required to be null terminated)
+ * @param len string length
+ * @return shared null terminated string or NULL on allocation error
+ */
+const char *
+intern_get(const char *str, size_t len);
+
+/**
+ * @brief Release a reference to a shared string
+ *
+ * The string is removed from the table when it has no more users.
+ *
+ * @param str string returned by intern_get (or NULL)
+ */
+void
+intern_release(const char *str);
+
+/**
+ * @brief Get the number of different strings in the table
+ */
+uint32_t
+intern_count();
+
+/**
+ * @brief Remove all strings from the table
+ *
+ * Strings still referenced by someone become invalid.
+ */
+void
+intern_clear();
+
+#endif /* __SNGREP_INTERN_H_ */
@@ -90,6 +90,8 @@ enum key_actions {
     ACTION_SHOW_COLUMNS,
     ACTION_SHOW_SETTINGS,
     ACTION_SHOW_STATS,
+    ACTION_SHOW_LATENCY,
+    ACTION_SHOW_AGGREGATE,
     ACTION_COLUMN_MOVE_UP,
     ACTION_COLUMN_MOVE_DOWN,
     ACTION_SDP_INFO,
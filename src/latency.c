@@ -0,0 +1,192 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file latency.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in latency.h
+ *
+ */
+#include "config.h"
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "latency.h"
+#include "util.h"
+
+__thread latency_thread_t *latency_local = NULL;
+
+/**
+ * @brief Histograms of all threads
+ */
+static struct
+{
+    //! Registered threads histograms
+    latency_thread_t *threads;
+    //! Nanoseconds per tick
+    double ns_per_tick;
+    //! Protects threads list
+    pthread_mutex_t lock;
+} latency = { .ns_per_tick = 1, .lock = PTHREAD_MUTEX_INITIALIZER };
+
+//! Names of measured stages
+static const char *latency_stages[] = {
+    "packet", "ip", "tcp", "tls", "lock", "sip", "rtp", "dump"
+};
+
+/**
+ * @brief Get the highest duration stored in a bucket
+ */
+static inline uint64_t
+latency_bucket_max(uint32_t index)
+{
+    uint32_t next = index + 1, exp;
+
+    if (next < LATENCY_SUB_BUCKETS)
+        return index;
+
+    // Lowest value of next bucket minus one
+    exp = next / LATENCY_SUB_BUCKETS + LATENCY_SUB_BITS - 1;
+    if (exp > 63)
+        return UINT64_MAX;
+    return ((uint64_t) (LATENCY_SUB_BUCKETS + next % LATENCY_SUB_BUCKETS) << (exp - LATENCY_SUB_BITS)) - 1;
+}
+
+void
+latency_init()
+{
+#if defined(USE_LATENCY) && (defined(__x86_64__) || defined(__i386__))
+    struct timespec start, end;
+    uint64_t ticks;
+
+    // Count ticks while some time passes
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ticks = latency_ticks();
+    usleep(LATENCY_CALIBRATE_WAIT * 1000);
+    ticks = latency_ticks() - ticks;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (ticks) {
+        latency.ns_per_tick = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / ticks;
+    }
+#endif
+}
+
+bool
+latency_enabled()
+{
+#ifdef USE_LATENCY
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char *
+latency_stage_name(enum latency_stage stage)
+{
+    return (stage < LATENCY_STAGE_COUNT) ? latency_stages[stage] : NULL;
+}
+
+int
+latency_get_stats(enum latency_stage stage, latency_stats_t *stats)
+{
+    static unsigned long buckets[LATENCY_BUCKETS];
+    latency_histogram_t *histogram;
+    latency_thread_t *thread;
+    unsigned long p50, p99, seen = 0;
+    uint64_t max = 0, value;
+    uint32_t i;
+
+    memset(stats, 0, sizeof(latency_stats_t));
+
+    // Merge histograms of all threads (buckets are also protected by lock)
+    pthread_mutex_lock(&latency.lock);
+    memset(buckets, 0, sizeof(buckets));
+    for (thread = latency.threads; thread; thread = thread->next) {
+        histogram = &thread->stages[stage];
+        stats->count += atomic_load_explicit(&histogram->count, memory_order_relaxed);
+        if (atomic_load_explicit(&histogram->max, memory_order_relaxed) > max)
+            max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+        for (i = 0; i < LATENCY_BUCKETS; i++)
+            buckets[i] += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+    }
+
+    if (!stats->count) {
+        pthread_mutex_unlock(&latency.lock);
+        return 1;
+    }
+
+    // Find buckets containing requested percentiles
+    p50 = (stats->count + 1) / 2;
+    p99 = stats->count - stats->count / 100;
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        if (!buckets[i])
+            continue;
+        seen += buckets[i];
+        // Bucket highest value, but never over the measured maximum
+        value = latency_bucket_max(i);
+        if (value > max)
+            value = max;
+        if (!stats->p50 && seen >= p50)
+            stats->p50 = value * latency.ns_per_tick;
+        if (seen >= p99) {
+            stats->p99 = value * latency.ns_per_tick;
+            break;
+        }
+    }
+    stats->max = max * latency.ns_per_tick;
+    pthread_mutex_unlock(&latency.lock);
+
+    return 0;
+}
+
+void
+latency_report(FILE *out)
+{
+    latency_stats_t stats;
+    int i;
+
+    for (i = 0; i < LATENCY_STAGE_COUNT; i++) {
+        if (latency_get_stats(i, &stats) != 0)
+            continue;
+        fprintf(out, "{\"stage\":\"%s\",\"samples\":%lu,\"p50_ns\":%lu,\"p99_ns\":%lu,\"max_ns\":%lu}\n",
+                latency_stage_name(i), stats.count, stats.p50, stats.p99, stats.max);
+    }
+}
+
+latency_thread_t *
+latency_thread_register()
+{
+    latency_thread_t *thread;
+
+    if (!(thread = sng_malloc(sizeof(latency_thread_t))))
+        return NULL;
+
+    // Thread histograms are kept after the thread finishes
+    pthread_mutex_lock(&latency.lock);
+    thread->next = latency.threads;
+    latency.threads = thread;
+    pthread_mutex_unlock(&latency.lock);
+
+    return thread;
+}
@@ -0,0 +1,237 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file latency.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to measure time spent in each packet processing stage
+ *
+ * When compiled with --enable-latency, each stage of packet processing is
+ * timed using CPU timestamp counter (or monotonic clock where not
+ * available) and its duration is added to a histogram of the running
+ * thread. Histograms have logarithmic buckets split in 16 linear
+ * sub-buckets, so percentiles have a 6% precision for any duration.
+ *
+ * Each thread only writes its own histograms, so recording never requires
+ * locking. Readers merge histograms of all threads when stats are requested.
+ *
+ * Without --enable-latency, LATENCY_START and LATENCY_RECORD macros are
+ * empty and nothing is measured.
+ */
+#ifndef __SNGREP_LATENCY_H
+#define __SNGREP_LATENCY_H
+
+#include "config.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//! Bits of each logarithmic bucket used for linear sub-buckets
+#define LATENCY_SUB_BITS        4
+//! Linear sub-buckets of each logarithmic bucket
+#define LATENCY_SUB_BUCKETS     (1 << LATENCY_SUB_BITS)
+//! Number of buckets of each histogram (covers any 64 bits value)
+#define LATENCY_BUCKETS         ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+//! Time used to measure timestamp counter frequency (ms)
+#define LATENCY_CALIBRATE_WAIT  20
+
+#ifdef USE_LATENCY
+#define LATENCY_START(var)          uint64_t var = latency_ticks()
+#define LATENCY_RECORD(stage, var)  latency_record(stage, latency_ticks() - (var))
+#else
+#define LATENCY_START(var)
+#define LATENCY_RECORD(stage, var)
+#endif
+
+//! Measured packet processing stages
+enum latency_stage {
+    //! Whole frame decoding (parse_packet)
+    LATENCY_PACKET = 0,
+    //! Link and IP layers decoding and IP reassembly
+    LATENCY_IP,
+    //! TCP reassembly
+    LATENCY_TCP,
+    //! TLS decryption
+    LATENCY_TLS,
+    //! Waiting for calls storage lock
+    LATENCY_LOCK,
+    //! SIP messages parsing
+    LATENCY_SIP,
+    //! RTP streams lookup
+    LATENCY_RTP,
+    //! Output file queueing and frames storage
+    LATENCY_DUMP,
+    //! Number of measured stages
+    LATENCY_STAGE_COUNT
+};
+
+//! Shorter declaration of latency_histogram structure
+typedef struct latency_histogram latency_histogram_t;
+//! Shorter declaration of latency_thread structure
+typedef struct latency_thread latency_thread_t;
+//! Shorter declaration of latency_stats structure
+typedef struct latency_stats latency_stats_t;
+
+/**
+ * @brief Durations of a stage measured by a thread (in ticks)
+ */
+struct latency_histogram
+{
+    //! Number of measured durations
+    atomic_ulong count;
+    //! Longest measured duration
+    atomic_ulong max;
+    //! Measured durations in each bucket
+    atomic_ulong buckets[LATENCY_BUCKETS];
+};
+
+/**
+ * @brief Histograms of all stages of a thread
+ */
+struct latency_thread
+{
+    //! Histogram of each stage
+    latency_histogram_t stages[LATENCY_STAGE_COUNT];
+    //! Next thread with histograms
+    latency_thread_t *next;
+};
+
+/**
+ * @brief Durations of a stage measured by all threads (in nanoseconds)
+ */
+struct latency_stats
+{
+    unsigned long count;
+    unsigned long p50;
+    unsigned long p99;
+    unsigned long max;
+};
+
+//! Histograms of the running thread (NULL until first measure)
+extern __thread latency_thread_t *latency_local;
+
+/**
+ * @brief Measure timestamp counter frequency
+ *
+ * Must be called before any other thread is started.
+ */
+void
+latency_init();
+
+/**
+ * @brief Check if sngrep has been compiled with latency instrumentation
+ */
+bool
+latency_enabled();
+
+/**
+ * @brief Get the name of a stage
+ */
+const char *
+latency_stage_name(enum latency_stage stage);
+
+/**
+ * @brief Get merged durations of a stage from all threads
+ *
+ * @return 0 if stage has measured durations, 1 otherwise
+ */
+int
+latency_get_stats(enum latency_stage stage, latency_stats_t *stats);
+
+/**
+ * @brief Print durations of all measured stages
+ *
+ * Each stage is printed as a JSON object in its own line, so the
+ * report can be parsed by benchmark tools.
+ */
+void
+latency_report(FILE *out);
+
+/**
+ * @brief Create histograms of the running thread
+ *
+ * @return histograms or NULL if they can not be allocated
+ */
+latency_thread_t *
+latency_thread_register();
+
+/**
+ * @brief Get current timestamp in ticks
+ */
+static inline uint64_t
+latency_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Get histogram bucket of a duration
+ */
+static inline uint32_t
+latency_bucket(uint64_t value)
+{
+    uint32_t exp;
+
+    // Small values have their own bucket
+    if (value < LATENCY_SUB_BUCKETS)
+        return value;
+
+    exp = 63 - __builtin_clzll(value);
+    return (exp - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS
+           + ((value >> (exp - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+/**
+ * @brief Add a duration to the histogram of the running thread
+ *
+ * Only the owner thread writes its histograms, so counters are not
+ * increased atomically, just stored so readers never see torn values.
+ */
+static inline void
+latency_record(enum latency_stage stage, uint64_t ticks)
+{
+    latency_histogram_t *histogram;
+    atomic_ulong *bucket;
+
+    if (!latency_local && !(latency_local = latency_thread_register()))
+        return;
+
+    histogram = &latency_local->stages[stage];
+    bucket = &histogram->buckets[latency_bucket(ticks)];
+    atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&histogram->count, atomic_load_explicit(&histogram->count, memory_order_relaxed) + 1, memory_order_relaxed);
+    if (ticks > atomic_load_explicit(&histogram->max, memory_order_relaxed))
+        atomic_store_explicit(&histogram->max, ticks, memory_order_relaxed);
+}
+
+#endif /* __SNGREP_LATENCY_H */
@@ -34,14 +34,24 @@
 #include <getopt.h>
 #include "option.h"
 #include "vector.h"
+#include "util.h"
+#include "pool.h"
 #include "capture.h"
 #include "capture_eep.h"
+#include "capture_snapshot.h"
+#include "event.h"
+#include "metrics.h"
+#include "latency.h"
+#include "affinity.h"
 #ifdef WITH_GNUTLS
 #include "capture_gnutls.h"
 #endif
 #ifdef WITH_OPENSSL
 #include "capture_openssl.h"
 #endif
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+#include "capture_keylog.h"
+#endif
 #include "curses/ui_manager.h"
 
 /**
@@ -52,9 +62,9 @@
 void
 usage()
 {
-    printf("Usage: %s [-hVcivNqrD] [-IO pcap_dump] [-d dev] [-l limit] [-B buffer]"
+    printf("Usage: %s [-hVcivNqrD] [-IO pcap_dump] [-S speed] [-E events_file] [-d dev] [-l limit] [-B buffer] [-M match_file]"
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
-           " [-k keyfile]"
+           " [-k keyfile] [-K keylogfile]"
 #endif
 #ifdef USE_EEP
            " [-LH capture_url]"
@@ -64,13 +74,16 @@ usage()
            "    -V --version\t Version information\n"
            "    -d --device\t\t Use this capture device instead of default\n"
            "    -I --input\t\t Read captured data from pcap file\n"
+           "    -S --replay-speed\t Replay pcap files at capture pace (Nx speed and/or Npps rate)\n"
            "    -O --output\t\t Write captured data to pcap file\n"
+           "    -E --events\t\t Write call state changes to file (- for stdout) in JSON lines or CSV\n"
            "    -B --buffer\t\t Set pcap buffer size in MB (default: 2)\n"
            "    -c --calls\t\t Only display dialogs starting with INVITE\n"
            "    -r --rtp\t\t Capture RTP packets payload\n"
-           "    -l --limit\t\t Set capture limit to N dialogs\n"
+           "    -l --limit\t\t Set capture limit to N dialogs (or memory size with K, M or G suffix)\n"
            "    -i --icase\t\t Make <match expression> case insensitive\n"
            "    -v --invert\t\t Invert <match expression>\n"
+           "    -M --match-file\t Match any of the literal patterns in file instead of <match expression>\n"
            "    -N --no-interface\t Don't display sngrep interface, just capture\n"
            "    -q --quiet\t\t Don't print captured dialogs in no interface mode\n"
            "    -D --dump-config\t Print active configuration settings and exit\n"
@@ -78,11 +91,12 @@ usage()
            "    -F --no-config\t Do not read configuration from default config file\n"
            "    -R --rotate\t\t Rotate calls when capture limit have been reached\n"
 #ifdef USE_EEP
-           "    -H --eep-send\t Homer sipcapture url (udp:X.X.X.X:XXXX)\n"
+           "    -H --eep-send\t Homer sipcapture url (udp|tcp|tls:X.X.X.X:XXXX)\n"
            "    -L --eep-listen\t Listen for encapsulated packets (udp:X.X.X.X:XXXX)\n"
 #endif
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
            "    -k --keyfile\t RSA private keyfile to decrypt captured packets\n"
+           "    -K --keylogfile\t TLS key log file (SSLKEYLOGFILE) to decrypt captured packets\n"
 #endif
            "\n",PACKAGE);
 }
@@ -108,11 +122,20 @@ version()
 #ifdef WITH_PCRE
            " * Compiled with Perl Compatible regular expressions support.\n"
 #endif
+#ifdef WITH_PCRE2
+           " * Compiled with Perl Compatible regular expressions (v2) support.\n"
+#endif
+#ifdef WITH_HYPERSCAN
+           " * Compiled with Hyperscan support.\n"
+#endif
 #ifdef USE_IPV6
            " * Compiled with IPv6 support.\n"
 #endif
 #ifdef USE_EEP
             " * Compiled with EEP/HEP support.\n"
+#endif
+#ifdef USE_TPACKET
+            " * Compiled with AF_PACKET capture support.\n"
 #endif
            "\nWritten by Ivan Alonso [aka Kaian]\n",
            PACKAGE, VERSION);
@@ -127,17 +150,21 @@ int
 main(int argc, char* argv[])
 {
     int opt, idx, limit, only_calls, no_incomplete, pcap_buffer_size, i;
-    const char *device, *outfile;
+    size_t memory_limit;
+    const char *device, *outfile, *eventfile, *replay;
     char bpf[512];
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
-    const char *keyfile;
+    const char *keyfile, *keylogfile;
+    bool keylog_env = false;
 #endif
-    const char *match_expr;
+    const char *match_expr, *match_file = NULL;
     int match_insensitive = 0, match_invert = 0;
     int no_interface = 0, quiet = 0, rtp_capture = 0, rotate = 0, no_config = 0;
     vector_t *infiles = vector_create(0, 1);
     vector_t *indevices = vector_create(0, 1);
     char *token;
+    const char *source;
+    capture_stats_t stats;
 
     // Program options
     static struct option long_options[] = {
@@ -145,16 +172,20 @@ main(int argc, char* argv[])
         { "version", no_argument, 0, 'V' },
         { "device", required_argument, 0, 'd' },
         { "input", required_argument, 0, 'I' },
+        { "replay-speed", required_argument, 0, 'S' },
         { "output", required_argument, 0, 'O' },
+        { "events", required_argument, 0, 'E' },
         { "buffer", required_argument, 0, 'B' },
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
         { "keyfile", required_argument, 0, 'k' },
+        { "keylogfile", required_argument, 0, 'K' },
 #endif
         { "calls", no_argument, 0, 'c' },
         { "rtp", no_argument, 0, 'r' },
         { "limit", required_argument, 0, 'l' },
         { "icase", no_argument, 0, 'i' },
         { "invert", no_argument, 0, 'v' },
+        { "match-file", required_argument, 0, 'M' },
         { "no-interface", no_argument, 0, 'N' },
         { "dump-config", no_argument, 0, 'D' },
         { "rotate", no_argument, 0, 'R' },
@@ -169,7 +200,7 @@ main(int argc, char* argv[])
 
     // Parse command line arguments that have high priority
     opterr = 0;
-    char *options = "hVd:I:O:B:pqtW:k:crl:ivNqDL:H:Rf:F";
+    char *options = "hVd:I:S:O:E:B:pqtW:k:K:crl:ivM:NqDL:H:Rf:F";
     while ((opt = getopt_long(argc, argv, options, long_options, &idx)) != -1) {
         switch (opt) {
             case 'h':
@@ -192,11 +223,21 @@ main(int argc, char* argv[])
     // Get initial values for configurable arguments
     device = setting_get_value(SETTING_CAPTURE_DEVICE);
     outfile = setting_get_value(SETTING_CAPTURE_OUTFILE);
+    eventfile = setting_get_value(SETTING_EVENTS_OUTPUT);
+    replay = setting_get_value(SETTING_CAPTURE_REPLAY);
     pcap_buffer_size = setting_get_intvalue(SETTING_CAPTURE_BUFFER);
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
     keyfile = setting_get_value(SETTING_CAPTURE_KEYFILE);
+    // Use the key log file of TLS libraries if none is configured
+    if (!(keylogfile = setting_get_value(SETTING_CAPTURE_KEYLOGFILE))) {
+        keylogfile = getenv("SSLKEYLOGFILE");
+        keylog_env = (keylogfile && *keylogfile);
+        if (!keylog_env)
+            keylogfile = NULL;
+    }
 #endif
     limit = setting_get_intvalue(SETTING_CAPTURE_LIMIT);
+    memory_limit = str_to_size(setting_get_value(SETTING_CAPTURE_LIMIT_MEMORY));
     only_calls = setting_enabled(SETTING_SIP_CALLS);
     no_incomplete = setting_enabled(SETTING_SIP_NOINCOMPLETE);
     rtp_capture = setting_enabled(SETTING_CAPTURE_RTP);
@@ -221,9 +262,15 @@ main(int argc, char* argv[])
             case 'I':
                 vector_append(infiles, optarg);
                 break;
+            case 'S':
+                replay = optarg;
+                break;
             case 'O':
                 outfile = optarg;
                 break;
+            case 'E':
+                eventfile = optarg;
+                break;
             case 'B':
                 if(!(pcap_buffer_size = atoi(optarg))) {
                     fprintf(stderr, "Invalid buffer size.\n");
@@ -235,6 +282,14 @@ main(int argc, char* argv[])
                 }
                 break;
             case 'l':
+                // Sizes limit memory used by dialogs instead of their count
+                if (strlen(optarg) && !isdigit(optarg[strlen(optarg) - 1])) {
+                    if (!(memory_limit = str_to_size(optarg))) {
+                        fprintf(stderr, "Invalid memory limit value.\n");
+                        return 0;
+                    }
+                    break;
+                }
                 if(!(limit = atoi(optarg))) {
                     fprintf(stderr, "Invalid limit value.\n");
                     return 0;
@@ -247,6 +302,15 @@ main(int argc, char* argv[])
 #else
                 fprintf(stderr, "sngrep is not compiled with SSL support.");
                 exit(1);
+#endif
+            case 'K':
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+                keylogfile = optarg;
+                keylog_env = false;
+                break;
+#else
+                fprintf(stderr, "sngrep is not compiled with SSL support.");
+                exit(1);
 #endif
             case 'c':
                 only_calls = 1;
@@ -262,6 +326,9 @@ main(int argc, char* argv[])
             case 'v':
                 match_invert++;
                 break;
+            case 'M':
+                match_file = optarg;
+                break;
             case 'N':
                 no_interface = 1;
                 setting_set_value(SETTING_CAPTURE_STORAGE, "none");
@@ -325,6 +392,18 @@ main(int argc, char* argv[])
         fprintf(stderr, "%s does not contain a valid RSA private key.\n", keyfile);
         return 1;
     }
+    // Load master secrets of decrypt key log file
+    if (keylogfile && capture_keylog_open(keylogfile) != 0) {
+        capture_keylog_close();
+        // Only requested key log files are required
+        if (!keylog_env) {
+            fprintf(stderr, "Unable to read TLS key log file %s.\n", keylogfile);
+            return 1;
+        }
+        fprintf(stderr, "Ignoring unreadable SSLKEYLOGFILE %s.\n", keylogfile);
+        keylogfile = NULL;
+    }
+    capture_set_keylogfile(keylogfile);
 #endif
 
     // Check if given argument is a file
@@ -335,11 +414,28 @@ main(int argc, char* argv[])
     }
 
     // Initialize SIP Messages Storage
-    sip_init(limit, only_calls, no_incomplete);
+    sip_init(limit, memory_limit, only_calls, no_incomplete);
 
     // Set capture options
     capture_init(limit, rtp_capture, rotate, pcap_buffer_size);
 
+    // Set input files replay pace before they are opened
+    if (capture_set_replay(replay) != 0) {
+        fprintf(stderr, "Invalid replay speed %s (expected Nx and/or Npps).\n", replay);
+        return 1;
+    }
+
+    // Set CPUs of each thread role before any of them is started
+    if (affinity_set_role(AFFINITY_CAPTURE, setting_get_value(SETTING_AFFINITY_CAPTURE)) != 0
+            || affinity_set_role(AFFINITY_PARSER, setting_get_value(SETTING_AFFINITY_PARSER)) != 0
+            || affinity_set_role(AFFINITY_WRITER, setting_get_value(SETTING_AFFINITY_WRITER)) != 0
+            || affinity_set_role(AFFINITY_EEP, setting_get_value(SETTING_AFFINITY_EEP)) != 0
+            || affinity_set_role(AFFINITY_UI, setting_get_value(SETTING_AFFINITY_UI)) != 0) {
+        fprintf(stderr, "Invalid CPU list in affinity settings (expected 0-3,8,...).\n");
+        return 1;
+    }
+    affinity_set_priority(setting_get_intvalue(SETTING_AFFINITY_PRIORITY));
+
 #ifdef USE_EEP
     // Initialize EEP if enabled
     capture_eep_init();
@@ -363,6 +459,9 @@ main(int argc, char* argv[])
             return 1;
     }
 
+    // Allocate kernel capture buffers in the capture CPUs node
+    affinity_push(AFFINITY_CAPTURE);
+
     // If we have an input device, load it
     for (i = 0; i < vector_count(indevices); i++) {
         // Check if all capture data is valid
@@ -370,11 +469,23 @@ main(int argc, char* argv[])
             return 1;
     }
 
+    affinity_pop();
+
     // Remove Input files vector
     vector_destroy(infiles);
 
     // More arguments pending!
-    if (argv[optind]) {
+    if (argv[optind] && match_file) {
+        // All pending arguments are the bpf filter when patterns are read from a file
+        memset(bpf, 0, sizeof(bpf));
+        for (i = optind; i < argc; i++)
+            sprintf(bpf + strlen(bpf), "%s ", argv[i]);
+
+        if (capture_set_bpf_filter(bpf) != 0) {
+            fprintf(stderr, "Couldn't install filter %s: %s\n", bpf, capture_last_error());
+            return 1;
+        }
+    } else if (argv[optind]) {
         // Assume first pending argument is  match expression
         match_expr = argv[optind++];
 
@@ -409,14 +520,62 @@ main(int argc, char* argv[])
             }
     }
 
-    // Start a capture thread
+    // Set the capture patterns
+    if (match_file && sip_set_match_file(match_file, match_insensitive, match_invert)) {
+        fprintf(stderr, "Unable to load patterns from %s\n", match_file);
+        return 1;
+    }
+
+    // Standard output is used by the interface
+    if (eventfile && !strcmp(eventfile, "-")) {
+        if (!no_interface) {
+            fprintf(stderr, "Events can only be written to standard output in no interface mode (-N)\n");
+            return 1;
+        }
+        // Don't mix dialog count with written events
+        quiet = 1;
+    }
+
+    // Restore dialogs stored before last exit (already written in events and output files)
+    if (capture_snapshot_load() != 0) {
+        fprintf(stderr, "Unable to restore snapshot %s\n", setting_get_value(SETTING_CAPTURE_SNAPSHOT));
+        return 1;
+    }
+    if (no_interface && !quiet && sip_calls_count()) {
+        char date[20], time[20];
+        fprintf(stderr, "Restored %d dialogs captured until %s %s\n", sip_calls_count(),
+                timeval_to_date(capture_snapshot_checkpoint(), date),
+                timeval_to_time(capture_snapshot_checkpoint(), time));
+    }
+
+    // Measure timestamp counter before stages are timed
+    latency_init();
+
+    // Start writing call events before any packet is parsed
+    if (event_open(eventfile) != 0) {
+        fprintf(stderr, "Couldn't open events output file %s\n", eventfile);
+        return 1;
+    }
+
+    // Start a capture thread (frames rings are allocated in capture CPUs node)
+    affinity_push(AFFINITY_CAPTURE);
     if (capture_launch_thread() != 0) {
         ncurses_deinit();
         fprintf(stderr, "Failed to launch capture thread.\n");
         return 1;
     }
+    affinity_pop();
+
+    // Publish capture health metrics if requested
+    if (metrics_open() != 0) {
+        capture_deinit();
+        fprintf(stderr, "Failed to open metrics %s socket.\n", setting_get_value(SETTING_METRICS_MODE));
+        return 1;
+    }
 
     if (!no_interface) {
+        // Interface runs in main thread
+        affinity_apply(AFFINITY_UI);
         // Initialize interface
         ncurses_init();
         // This is a blocking call.
@@ -424,7 +583,9 @@ main(int argc, char* argv[])
         ui_create_panel(PANEL_CALL_LIST);
         ui_wait_for_input();
     } else {
-        setbuf(stdout, NULL);
+        // Dialog count is printed without buffering
+        if (!quiet)
+            setbuf(stdout, NULL);
         while(capture_is_running()) {
             if (!quiet)
                 printf("\rDialog count: %d", sip_calls_count());
@@ -432,11 +593,28 @@ main(int argc, char* argv[])
         }
         if (!quiet)
             printf("\rDialog count: %d\n", sip_calls_count());
+        // Report achieved pace of replayed files
+        if (capture_replay_enabled()) {
+            for (i = 0; i < capture_sources_count(); i++) {
+                source = capture_source_stats(i, &stats);
+                fprintf(stderr, "Replayed %s: %lu frames at %lu fps (lag %lu us, max %lu us)\n",
+                        source, stats.frames, stats.replay_rate, stats.replay_lag, stats.replay_lag_max);
+            }
+        }
+        // Instrumented builds report where packet processing time was spent
+        if (latency_enabled())
+            latency_report(stderr);
     }
 
+    // Stop publishing metrics before sources are released
+    metrics_close();
+
     // Capture deinit
     capture_deinit();
 
+    // Write pending call events
+    event_close();
+
     // Deinitialize interface
     ncurses_deinit();
 
@@ -446,6 +624,9 @@ main(int argc, char* argv[])
     // Deallocate sip stored messages
     sip_deinit();
 
+    // Release pooled structures memory
+    pool_deinit();
+
     // Leaving!
     return 0;
 }
@@ -0,0 +1,280 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file match.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in match.h
+ *
+ * The Aho-Corasick automaton is stored as a complete transition table, so
+ * each byte of data costs a single lookup. To keep the table small, bytes
+ * are grouped in classes: one class for each byte used by the patterns
+ * (both cases share a class for case insensitive matching) and a common
+ * class for all the others.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "match.h"
+
+match_patterns_t *
+match_create(int insensitive)
+{
+    match_patterns_t *match;
+
+    if (!(match = malloc(sizeof(match_patterns_t))))
+        return NULL;
+
+    memset(match, 0, sizeof(match_patterns_t));
+    match->insensitive = insensitive;
+    match->patterns = vector_create(0, 16);
+    vector_set_destroyer(match->patterns, vector_generic_destroyer);
+
+    return match;
+}
+
+void
+match_destroy(match_patterns_t *match)
+{
+    if (!match)
+        return;
+
+#ifdef WITH_HYPERSCAN
+    hs_free_scratch(match->scratch);
+    hs_free_database(match->database);
+#endif
+    vector_destroy(match->patterns);
+    free(match->delta);
+    free(match->final);
+    free(match);
+}
+
+int
+match_add_pattern(match_patterns_t *match, const char *pattern, size_t len)
+{
+    char *copy;
+
+    // Empty patterns would match everything
+    if (!len || !(copy = strndup(pattern, len)))
+        return 1;
+
+    vector_append(match->patterns, copy);
+    return 0;
+}
+
+int
+match_load_file(match_patterns_t *match, const char *filename)
+{
+    FILE *fh;
+    char line[1024];
+    size_t len;
+
+    if (!(fh = fopen(filename, "r")))
+        return 1;
+
+    while (fgets(line, sizeof(line), fh)) {
+        // Remove line ending
+        len = strlen(line);
+        while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            len--;
+        match_add_pattern(match, line, len);
+    }
+
+    fclose(fh);
+    return 0;
+}
+
+int
+match_compile(match_patterns_t *match)
+{
+    if (!match_count(match))
+        return 1;
+
+#ifdef WITH_HYPERSCAN
+    if (match_compile_hyperscan(match) == 0)
+        return 0;
+#endif
+
+    return match_compile_automaton(match);
+}
+
+int
+match_compile_automaton(match_patterns_t *match)
+{
+    const char *pattern;
+    uint32_t *fail = NULL, *queue = NULL, maxstates = 1;
+    uint32_t state, next, head = 0, tail = 0, cl;
+    int i, c;
+
+    // Assign a class to each byte used by the patterns
+    memset(match->classes, 0, sizeof(match->classes));
+    match->nclasses = 1;
+    for (i = 0; i < vector_count(match->patterns); i++) {
+        pattern = vector_item(match->patterns, i);
+        maxstates += strlen(pattern);
+        for (; *pattern; pattern++) {
+            c = match->insensitive ? tolower((u_char) *pattern) : (u_char) *pattern;
+            if (!match->classes[c])
+                match->classes[c] = match->nclasses++;
+        }
+    }
+    if (match->insensitive) {
+        for (c = 'A'; c <= 'Z'; c++)
+            match->classes[c] = match->classes[tolower(c)];
+    }
+
+    free(match->delta);
+    free(match->final);
+    match->delta = calloc((size_t) maxstates * match->nclasses, sizeof(uint32_t));
+    match->final = calloc(maxstates, sizeof(uint8_t));
+    fail = calloc(maxstates, sizeof(uint32_t));
+    queue = calloc(maxstates, sizeof(uint32_t));
+    if (!match->delta || !match->final || !fail || !queue) {
+        free(fail);
+        free(queue);
+        return 1;
+    }
+
+    // Build the trie of patterns (no transition goes back to root yet)
+    match->nstates = 1;
+    for (i = 0; i < vector_count(match->patterns); i++) {
+        state = 0;
+        for (pattern = vector_item(match->patterns, i); *pattern; pattern++) {
+            cl = match->classes[(u_char) *pattern];
+            if (!match->delta[state * match->nclasses + cl])
+                match->delta[state * match->nclasses + cl] = match->nstates++;
+            state = match->delta[state * match->nclasses + cl];
+        }
+        match->final[state] = 1;
+    }
+
+    // Fill missing transitions with the ones of the longest suffix state
+    for (cl = 0; cl < match->nclasses; cl++) {
+        if ((next = match->delta[cl]))
+            queue[tail++] = next;
+    }
+    while (head < tail) {
+        state = queue[head++];
+        match->final[state] |= match->final[fail[state]];
+        for (cl = 0; cl < match->nclasses; cl++) {
+            next = match->delta[state * match->nclasses + cl];
+            if (next) {
+                fail[next] = match->delta[fail[state] * match->nclasses + cl];
+                queue[tail++] = next;
+            } else {
+                match->delta[state * match->nclasses + cl] = match->delta[fail[state] * match->nclasses + cl];
+            }
+        }
+    }
+
+    free(fail);
+    free(queue);
+    return 0;
+}
+
+int
+match_exec(match_patterns_t *match, const char *data, size_t len)
+{
+    const u_char *byte = (const u_char *) data, *end = byte + len;
+    uint32_t state = 0;
+
+#ifdef WITH_HYPERSCAN
+    int found = 0;
+    if (match->database) {
+        hs_scan(match->database, data, len, 0, match->scratch, match_hyperscan_found, &found);
+        return found;
+    }
+#endif
+
+    if (!match->delta)
+        return 0;
+
+    for (; byte < end; byte++) {
+        state = match->delta[state * match->nclasses + match->classes[*byte]];
+        if (match->final[state])
+            return 1;
+    }
+
+    return 0;
+}
+
+int
+match_count(match_patterns_t *match)
+{
+    return vector_count(match->patterns);
+}
+
+#ifdef WITH_HYPERSCAN
+int
+match_compile_hyperscan(match_patterns_t *match)
+{
+    const char **patterns;
+    unsigned int *flags, *ids;
+    size_t *lens;
+    hs_compile_error_t *error = NULL;
+    int i, count = match_count(match), ret = 1;
+
+    patterns = calloc(count, sizeof(char *));
+    flags = calloc(count, sizeof(unsigned int));
+    ids = calloc(count, sizeof(unsigned int));
+    lens = calloc(count, sizeof(size_t));
+
+    if (patterns && flags && ids && lens) {
+        for (i = 0; i < count; i++) {
+            patterns[i] = vector_item(match->patterns, i);
+            lens[i] = strlen(patterns[i]);
+            flags[i] = HS_FLAG_SINGLEMATCH | (match->insensitive ? HS_FLAG_CASELESS : 0);
+            ids[i] = i;
+        }
+
+        if (hs_compile_lit_multi(patterns, flags, ids, lens, count, HS_MODE_BLOCK,
+                                 NULL, &match->database, &error) == HS_SUCCESS) {
+            if (hs_alloc_scratch(match->database, &match->scratch) == HS_SUCCESS) {
+                ret = 0;
+            } else {
+                hs_free_database(match->database);
+                match->database = NULL;
+            }
+        } else {
+            hs_free_compile_error(error);
+        }
+    }
+
+    free(patterns);
+    free(flags);
+    free(ids);
+    free(lens);
+    return ret;
+}
+
+int
+match_hyperscan_found(unsigned int id, unsigned long long from, unsigned long long to,
+                      unsigned int flags, void *context)
+{
+    *(int *) context = 1;
+    // Stop scanning
+    return 1;
+}
+#endif
@@ -0,0 +1,154 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file match.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to match a list of literal patterns in one pass
+ *
+ * All patterns are compiled into a single automaton, so checking if a
+ * payload contains any of them takes a single pass over its data no matter
+ * how many patterns there are. Hyperscan is used when sngrep is compiled
+ * with it, otherwise an Aho-Corasick automaton is built.
+ */
+
+#ifndef __SNGREP_MATCH_H_
+#define __SNGREP_MATCH_H_
+
+#include "config.h"
+#include <stdint.h>
+#include <stddef.h>
+#include "vector.h"
+#ifdef WITH_HYPERSCAN
+#include <hs/hs.h>
+#endif
+
+//! Shorter declaration of match_patterns structure
+typedef struct match_patterns match_patterns_t;
+
+/**
+ * @brief List of literal patterns and their compiled automaton
+ */
+struct match_patterns {
+    //! Patterns are matched ignoring case
+    int insensitive;
+    //! Added patterns (char *)
+    vector_t *patterns;
+    //! Alphabet class of each byte (0 for bytes not used by patterns)
+    uint16_t classes[256];
+    //! Number of alphabet classes
+    uint32_t nclasses;
+    //! Number of automaton states
+    uint32_t nstates;
+    //! Next state for each state and alphabet class
+    uint32_t *delta;
+    //! States where at least one pattern ends
+    uint8_t *final;
+#ifdef WITH_HYPERSCAN
+    //! Compiled Hyperscan database (NULL if Aho-Corasick is used)
+    hs_database_t *database;
+    //! Hyperscan scratch space for scans
+    hs_scratch_t *scratch;
+#endif
+};
+
+/**
+ * @brief Create an empty list of patterns
+ *
+ * @param insensitive 1 to match patterns ignoring case
+ * @return new allocated list or NULL on allocation error
+ */
+match_patterns_t *
+match_create(int insensitive);
+
+/**
+ * @brief Free a list of patterns and its automaton
+ */
+void
+match_destroy(match_patterns_t *match);
+
+/**
+ * @brief Add a literal pattern to the list
+ *
+ * Patterns added after match_compile are ignored until it is called again.
+ *
+ * @return 0 if pattern has been added, 1 otherwise
+ */
+int
+match_add_pattern(match_patterns_t *match, const char *pattern, size_t len);
+
+/**
+ * @brief Add one pattern for each non empty line of a file
+ *
+ * @return 0 if the file has been read, 1 otherwise
+ */
+int
+match_load_file(match_patterns_t *match, const char *filename);
+
+/**
+ * @brief Build the automaton for all added patterns
+ *
+ * @return 0 if the automaton has been built, 1 otherwise
+ */
+int
+match_compile(match_patterns_t *match);
+
+/**
+ * @brief Build an Aho-Corasick automaton for all added patterns
+ *
+ * @return 0 if the automaton has been built, 1 otherwise
+ */
+int
+match_compile_automaton(match_patterns_t *match);
+
+/**
+ * @brief Check if data contains any of the patterns
+ *
+ * @return 1 if any pattern is found, 0 otherwise
+ */
+int
+match_exec(match_patterns_t *match, const char *data, size_t len);
+
+/**
+ * @brief Get the number of added patterns
+ */
+int
+match_count(match_patterns_t *match);
+
+#ifdef WITH_HYPERSCAN
+/**
+ * @brief Build a Hyperscan database for all added patterns
+ *
+ * @return 0 if the database has been built, 1 otherwise
+ */
+int
+match_compile_hyperscan(match_patterns_t *match);
+
+/**
+ * @brief Hyperscan callback stopping the scan on first match
+ */
+int
+match_hyperscan_found(unsigned int id, unsigned long long from, unsigned long long to,
+                      unsigned int flags, void *context);
+#endif
+
+#endif /* __SNGREP_MATCH_H_ */
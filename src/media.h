@@ -64,7 +64,9 @@ struct sdp_media {
 /**
  * @brief Allocate memory for a new media structure
  *
- * Create a structure for a new message sdp connection data.
+ * Create a structure for a new message sdp connection data. Media is
+ * allocated in the memory of the message call, so message must already
+ * belong to a call.
  *
  * @param msg SIP Message pointer owner of this media
  * @return new allocated structure
@@ -0,0 +1,465 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file metrics.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in metrics.h
+ *
+ */
+#include "config.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include "metrics.h"
+#include "capture.h"
+#include "capture_writer.h"
+#include "event.h"
+#include "latency.h"
+#include "rtp.h"
+#include "sip.h"
+#include "setting.h"
+#include "util.h"
+
+//! Capture configuration and sources (capture.c)
+extern capture_config_t capture_cfg;
+
+//! Metrics publishing (only one can be configured)
+static metrics_t *metrics = NULL;
+
+/**
+ * @brief Capture sources metrics, taken from capture_stats_t fields
+ */
+static const struct
+{
+    const char *name;
+    const char *help;
+    bool counter;
+    size_t offset;
+} metrics_sources[] = {
+    { "frames_total", "Frames read from capture source", true, offsetof(capture_stats_t, frames) },
+    { "bytes_total", "Bytes read from capture source", true, offsetof(capture_stats_t, bytes) },
+    { "queue_frames", "Frames pending to be parsed", false, offsetof(capture_stats_t, ring_count) },
+    { "queue_size", "Max frames pending to be parsed", false, offsetof(capture_stats_t, ring_size) },
+    { "queue_dropped_total", "Frames discarded because parser queue was full", true, offsetof(capture_stats_t, ring_drops) },
+    { "pcap_received_total", "Packets received by libpcap", true, offsetof(capture_stats_t, pcap_recv) },
+    { "pcap_dropped_total", "Packets dropped by libpcap because buffer was full", true, offsetof(capture_stats_t, pcap_drop) },
+    { "pcap_ifdropped_total", "Packets dropped by network interface or driver", true, offsetof(capture_stats_t, pcap_ifdrop) },
+    { "ip_reasm_packets", "IP packets pending to receive all fragments", false, offsetof(capture_stats_t, ip_reasm_pending) },
+    { "ip_reasm_bytes", "Bytes of pending IP fragments", false, offsetof(capture_stats_t, ip_reasm_memory) },
+    { "ip_reasm_evicted_total", "IP fragments discarded by timeout or memory limit", true, offsetof(capture_stats_t, ip_reasm_evicted) },
+    { "tcp_reasm_streams", "TCP connections pending to be reassembled", false, offsetof(capture_stats_t, tcp_reasm_pending) },
+    { "tcp_reasm_bytes", "Memory used by TCP connections pending to be reassembled", false, offsetof(capture_stats_t, tcp_reasm_memory) },
+    { "tcp_reasm_evicted_total", "TCP connections discarded by timeout or memory limit", true, offsetof(capture_stats_t, tcp_reasm_evicted) },
+    { "replay_frames_per_second", "Frames per second replayed from input file", false, offsetof(capture_stats_t, replay_rate) },
+    { "replay_lag_microseconds", "Time the last replayed frame was queued after its due time", false, offsetof(capture_stats_t, replay_lag) },
+    { "replay_lag_max_microseconds", "Highest time a replayed frame was queued after its due time", false, offsetof(capture_stats_t, replay_lag_max) },
+};
+
+//! Labels of SIP response classes in sip_totals_t
+static const char *metrics_responses[] = { "0xx", "1xx", "2xx", "3xx", "4xx", "5xx", "6xx", "7xx", "8xx" };
+
+/**
+ * @brief Create a socket for configured metrics mode
+ *
+ * @return socket or -1 on error
+ */
+static int
+metrics_socket(enum metrics_mode mode)
+{
+    struct addrinfo hints, *ai;
+    char port[16];
+    int sock, reuse = 1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = (mode == METRICS_PROMETHEUS) ? SOCK_STREAM : SOCK_DGRAM;
+    hints.ai_flags = (mode == METRICS_PROMETHEUS) ? AI_PASSIVE : 0;
+
+    if (setting_get_intvalue(SETTING_METRICS_PORT) > 0) {
+        sprintf(port, "%d", setting_get_intvalue(SETTING_METRICS_PORT));
+    } else {
+        sprintf(port, "%d", (mode == METRICS_PROMETHEUS) ? METRICS_HTTP_PORT : METRICS_STATSD_PORT);
+    }
+
+    if (getaddrinfo(setting_get_value(SETTING_METRICS_ADDR), port, &hints, &ai) != 0)
+        return -1;
+
+    if ((sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) {
+        freeaddrinfo(ai);
+        return -1;
+    }
+
+    if (mode == METRICS_PROMETHEUS) {
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(sock, ai->ai_addr, ai->ai_addrlen) != 0 || listen(sock, 16) != 0) {
+            close(sock);
+            sock = -1;
+        }
+    } else if (connect(sock, ai->ai_addr, ai->ai_addrlen) != 0) {
+        close(sock);
+        sock = -1;
+    }
+
+    freeaddrinfo(ai);
+    return sock;
+}
+
+/**
+ * @brief Append formatted text to metrics buffer
+ *
+ * Text that does not fit in the buffer is discarded.
+ */
+static void
+metrics_printf(metrics_t *m, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    if (m->len >= METRICS_BUFFER_LEN - 1)
+        return;
+
+    va_start(ap, fmt);
+    len = vsnprintf(m->buffer + m->len, METRICS_BUFFER_LEN - m->len, fmt, ap);
+    va_end(ap);
+
+    if (len > 0 && m->len + len < METRICS_BUFFER_LEN) {
+        m->len += len;
+    } else {
+        // Discard truncated line
+        m->buffer[m->len] = '\0';
+    }
+}
+
+int
+metrics_open()
+{
+    const char *mode = setting_get_value(SETTING_METRICS_MODE);
+
+    if (!mode || !strcmp(mode, "off"))
+        return 0;
+
+    if (!(metrics = sng_malloc(sizeof(metrics_t))))
+        return 1;
+
+    metrics->mode = (!strcmp(mode, "statsd")) ? METRICS_STATSD : METRICS_PROMETHEUS;
+    metrics->prefix = setting_get_value(SETTING_METRICS_PREFIX);
+    if ((metrics->interval = setting_get_intvalue(SETTING_METRICS_INTERVAL)) <= 0)
+        metrics->interval = 10;
+    atomic_init(&metrics->stopping, false);
+
+    if (!(metrics->buffer = sng_malloc(METRICS_BUFFER_LEN))
+            || (metrics->sock = metrics_socket(metrics->mode)) < 0) {
+        sng_free(metrics->buffer);
+        sng_free(metrics);
+        metrics = NULL;
+        return 1;
+    }
+
+    if (pthread_create(&metrics->thread, NULL, (void *) metrics_thread, metrics)) {
+        close(metrics->sock);
+        sng_free(metrics->buffer);
+        sng_free(metrics);
+        metrics = NULL;
+        return 1;
+    }
+
+    return 0;
+}
+
+void
+metrics_close()
+{
+    if (!metrics)
+        return;
+
+    // Thread checks stopping flag at least every METRICS_WAIT ms
+    metrics->stopping = true;
+    pthread_join(metrics->thread, NULL);
+
+    close(metrics->sock);
+    sng_free(metrics->buffer);
+    sng_free(metrics);
+    metrics = NULL;
+}
+
+void
+metrics_collect(metrics_t *m)
+{
+    capture_stats_t *stats;
+    latency_stats_t latency[LATENCY_STAGE_COUNT];
+    bool measured[LATENCY_STAGE_COUNT];
+    const char **names;
+    sip_totals_t totals;
+    unsigned long added, waits, wait_time;
+    uint32_t streams;
+    size_t memory;
+    int calls, count, i, j;
+    long pages;
+    FILE *fp;
+
+    m->len = 0;
+    m->last = NULL;
+    m->buffer[0] = '\0';
+
+    // Get counters of all capture sources at once
+    count = capture_sources_count();
+    stats = sng_malloc(sizeof(capture_stats_t) * (count + 1));
+    names = sng_malloc(sizeof(char *) * (count + 1));
+    if (!stats || !names) {
+        sng_free(stats);
+        sng_free(names);
+        return;
+    }
+    for (i = 0; i < count; i++)
+        names[i] = capture_source_stats(i, &stats[i]);
+
+    // Samples of each metric must be consecutive
+    for (j = 0; j < (int) (sizeof(metrics_sources) / sizeof(metrics_sources[0])); j++) {
+        for (i = 0; i < count; i++) {
+            if (!names[i])
+                continue;
+            metrics_add(m, metrics_sources[j].name, metrics_sources[j].help, metrics_sources[j].counter,
+                        "source", names[i], *(unsigned long *) ((char *) &stats[i] + metrics_sources[j].offset));
+        }
+    }
+    sng_free(stats);
+    sng_free(names);
+
+    capture_lock_stats(&waits, &wait_time);
+    metrics_add(m, "lock_waits_total", "Times packet parsing waited for calls lock", true, NULL, NULL, waits);
+    metrics_add(m, "lock_wait_microseconds_total", "Time packet parsing waited for calls lock", true, NULL, NULL, wait_time);
+    metrics_add(m, "outfile_dropped_total", "Frames not written to output file because writer queue was full", true,
+                NULL, NULL, capture_writer_dropped(capture_cfg.writer));
+    metrics_add(m, "events_dropped_total", "Events not written because events queue was full", true,
+                NULL, NULL, event_dropped());
+
+    // Calls data is only consistent while parsing is stopped
+    capture_lock_read();
+    totals = sip_calls_totals();
+    calls = sip_calls_count();
+    memory = sip_calls_memory();
+    rtp_index_stats(&streams, &added);
+    capture_unlock();
+
+    for (i = 1; i <= SIP_METHOD_PRACK; i++) {
+        if (!sip_method_str(i))
+            continue;
+        metrics_add(m, "sip_requests_total", "SIP requests parsed by method", true,
+                    "method", sip_method_str(i), totals.methods[i]);
+    }
+    for (i = 1; i < 9; i++) {
+        metrics_add(m, "sip_responses_total", "SIP responses parsed by class", true,
+                    "class", metrics_responses[i], totals.responses[i]);
+    }
+    metrics_add(m, "calls", "Stored dialogs", false, NULL, NULL, calls);
+    metrics_add(m, "calls_created_total", "Created dialogs", true, NULL, NULL, totals.dialogs);
+    metrics_add(m, "calls_rotated_total", "Dialogs removed to store new ones", true, NULL, NULL, totals.rotated);
+    metrics_add(m, "calls_expired_total", "Dialogs removed after being inactive", true, NULL, NULL, totals.expired);
+    metrics_add(m, "messages_aggregated_total", "Messages only counted by address and method", true,
+                NULL, NULL, totals.aggregated);
+    metrics_add(m, "messages_sampled_total", "Messages discarded because their dialog was not sampled", true,
+                NULL, NULL, totals.sampled);
+    metrics_add(m, "messages_counted_total", "Messages only counted because their dialog is not an INVITE", true,
+                NULL, NULL, totals.counted);
+    metrics_add(m, "calls_memory_bytes", "Estimated memory used by stored dialogs", false, NULL, NULL, memory);
+    metrics_add(m, "rtp_streams", "RTP streams matched against RTP packets", false, NULL, NULL, streams);
+    metrics_add(m, "rtp_streams_total", "RTP streams found in SDP", true, NULL, NULL, added);
+
+    // Packet processing stages durations (only with --enable-latency)
+    if (latency_enabled()) {
+        for (i = 0; i < LATENCY_STAGE_COUNT; i++)
+            measured[i] = (latency_get_stats(i, &latency[i]) == 0);
+        for (i = 0; i < LATENCY_STAGE_COUNT; i++) {
+            metrics_add(m, "stage_samples_total", "Measured durations of packet processing stage", true,
+                        "stage", latency_stage_name(i), latency[i].count);
+        }
+        for (i = 0; i < LATENCY_STAGE_COUNT; i++) {
+            if (measured[i])
+                metrics_add(m, "stage_latency_p50_nanoseconds", "Median duration of packet processing stage", false,
+                            "stage", latency_stage_name(i), latency[i].p50);
+        }
+        for (i = 0; i < LATENCY_STAGE_COUNT; i++) {
+            if (measured[i])
+                metrics_add(m, "stage_latency_p99_nanoseconds", "99th percentile duration of packet processing stage", false,
+                            "stage", latency_stage_name(i), latency[i].p99);
+        }
+        for (i = 0; i < LATENCY_STAGE_COUNT; i++) {
+            if (measured[i])
+                metrics_add(m, "stage_latency_max_nanoseconds", "Longest duration of packet processing stage", false,
+                            "stage", latency_stage_name(i), latency[i].max);
+        }
+    }
+
+    // Resident memory of the whole process (only available in Linux)
+    if ((fp = fopen("/proc/self/statm", "r"))) {
+        if (fscanf(fp, "%*s %ld", &pages) == 1) {
+            metrics_add(m, "resident_memory_bytes", "Resident memory size", false,
+                        NULL, NULL, (unsigned long) pages * sysconf(_SC_PAGESIZE));
+        }
+        fclose(fp);
+    }
+}
+
+void
+metrics_add(metrics_t *m, const char *name, const char *help, bool counter,
+            const char *label, const char *value, unsigned long number)
+{
+    char sanitized[256];
+    const char *c;
+    size_t len;
+
+    if (m->mode == METRICS_STATSD) {
+        // Label values are appended to metric name
+        metrics_printf(m, "%s%s%s", (m->prefix) ? m->prefix : "", (m->prefix) ? "." : "", name);
+        if (label && value) {
+            for (len = 0, c = value; *c && len < sizeof(sanitized) - 1; c++)
+                sanitized[len++] = (isalnum((u_char) *c) || *c == '-') ? *c : '_';
+            sanitized[len] = '\0';
+            metrics_printf(m, ".%s", sanitized);
+        }
+        metrics_printf(m, ":%lu|g\n", number);
+        return;
+    }
+
+    // Prometheus metric description is written once before its samples
+    if (!m->last || strcmp(m->last, name) != 0) {
+        metrics_printf(m, "# HELP sngrep_%s %s\n", name, help);
+        metrics_printf(m, "# TYPE sngrep_%s %s\n", name, (counter) ? "counter" : "gauge");
+        m->last = name;
+    }
+
+    metrics_printf(m, "sngrep_%s", name);
+    if (label && value) {
+        for (len = 0, c = value; *c && len < sizeof(sanitized) - 2; c++) {
+            if (*c == '"' || *c == '\\')
+                sanitized[len++] = '\\';
+            sanitized[len++] = (*c == '\n') ? ' ' : *c;
+        }
+        sanitized[len] = '\0';
+        metrics_printf(m, "{%s=\"%s\"}", label, sanitized);
+    }
+    metrics_printf(m, " %lu\n", number);
+}
+
+void
+metrics_http_reply(metrics_t *m, int client)
+{
+    struct timeval timeout = { METRICS_HTTP_TIMEOUT, 0 };
+    char request[METRICS_REQUEST_LEN];
+    char header[256];
+    size_t len = 0;
+    ssize_t ret;
+    int hlen;
+
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // Read request headers
+    while (len < sizeof(request) - 1) {
+        if ((ret = recv(client, request + len, sizeof(request) - 1 - len, 0)) <= 0)
+            return;
+        len += ret;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n"))
+            break;
+    }
+
+    if (strncmp(request, "GET /metrics ", 13) != 0 && strncmp(request, "GET / ", 6) != 0) {
+        hlen = sprintf(header, "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        send(client, header, hlen, MSG_NOSIGNAL);
+        return;
+    }
+
+    metrics_collect(m);
+    hlen = sprintf(header, "HTTP/1.0 200 OK\r\n"
+                   "Content-Type: text/plain; version=0.0.4\r\n"
+                   "Content-Length: %zu\r\n"
+                   "Connection: close\r\n\r\n", m->len);
+    if (send(client, header, hlen, MSG_NOSIGNAL) != hlen)
+        return;
+
+    for (len = 0; len < m->len; len += ret) {
+        if ((ret = send(client, m->buffer + len, m->len - len, MSG_NOSIGNAL)) <= 0)
+            return;
+    }
+}
+
+void
+metrics_statsd_send(metrics_t *m)
+{
+    size_t start = 0, end, next;
+    char *eol;
+
+    while (start < m->len) {
+        // Add as many full lines as fit in a datagram
+        end = start;
+        while (end < m->len && (eol = memchr(m->buffer + end, '\n', m->len - end))) {
+            next = eol - m->buffer + 1;
+            if (next - start > METRICS_DGRAM_LEN && end != start)
+                break;
+            end = next;
+        }
+        if (end == start)
+            break;
+        send(m->sock, m->buffer + start, end - start, 0);
+        start = end;
+    }
+}
+
+void
+metrics_thread(void *info)
+{
+    metrics_t *m = (metrics_t *) info;
+    struct pollfd pfd = { .fd = m->sock, .events = POLLIN };
+    time_t last = 0;
+    int client;
+
+    while (!m->stopping) {
+        if (m->mode == METRICS_STATSD) {
+            // Push all metrics every interval
+            if (time(NULL) - last >= m->interval) {
+                last = time(NULL);
+                metrics_collect(m);
+                metrics_statsd_send(m);
+            }
+            usleep(METRICS_WAIT * 1000);
+            continue;
+        }
+
+        // Wait for Prometheus requests
+        if (poll(&pfd, 1, METRICS_WAIT) <= 0 || !(pfd.revents & POLLIN))
+            continue;
+        if ((client = accept(m->sock, NULL, NULL)) < 0)
+            continue;
+        metrics_http_reply(m, client);
+        close(client);
+    }
+}
@@ -0,0 +1,158 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file metrics.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to publish capture and parser health metrics
+ *
+ * Metrics are collected by a dedicated thread and published in one of
+ * these ways (metrics.mode setting):
+ *
+ *  - prometheus: HTTP listener answering GET /metrics requests with
+ *    Prometheus text format
+ *  - statsd: UDP datagrams sent to a StatsD server every few seconds
+ *
+ * Capture sources counters are read without locking. Calls, messages and
+ * streams counters are read holding capture lock for reading, so metrics
+ * requests never interrupt packet parsing for long.
+ */
+#ifndef __SNGREP_METRICS_H
+#define __SNGREP_METRICS_H
+
+#include "config.h"
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+//! Default port of Prometheus metrics listener
+#define METRICS_HTTP_PORT       9660
+//! Default port of StatsD server
+#define METRICS_STATSD_PORT     8125
+//! Max size of all formatted metrics
+#define METRICS_BUFFER_LEN      65536
+//! Max size of HTTP requests
+#define METRICS_REQUEST_LEN     1024
+//! Max size of StatsD datagrams
+#define METRICS_DGRAM_LEN       1400
+//! Max time metrics thread sleeps between checks of its stopping flag (ms)
+#define METRICS_WAIT            200
+//! Max time waiting for HTTP clients to send or receive data (s)
+#define METRICS_HTTP_TIMEOUT    2
+
+//! Available metrics publishing modes
+enum metrics_mode {
+    METRICS_OFF = 0,
+    METRICS_PROMETHEUS,
+    METRICS_STATSD,
+};
+
+//! Shorter declaration of metrics structure
+typedef struct metrics metrics_t;
+
+/**
+ * @brief Metrics publishing configuration and thread data
+ */
+struct metrics
+{
+    //! Publishing mode
+    enum metrics_mode mode;
+    //! Listening socket (prometheus) or connected socket (statsd)
+    int sock;
+    //! Prefix of StatsD metric names
+    const char *prefix;
+    //! Seconds between StatsD updates
+    int interval;
+    //! Formatted metrics
+    char *buffer;
+    //! Length of formatted metrics
+    size_t len;
+    //! Name of the last added metric (to group Prometheus samples)
+    const char *last;
+    //! Metrics thread has been requested to stop
+    atomic_bool stopping;
+    //! Metrics thread
+    pthread_t thread;
+};
+
+/**
+ * @brief Open metrics socket and start metrics thread
+ *
+ * Nothing is done if metrics.mode setting is off.
+ *
+ * @return 0 on success, 1 otherwise
+ */
+int
+metrics_open();
+
+/**
+ * @brief Stop metrics thread and close its socket
+ */
+void
+metrics_close();
+
+/**
+ * @brief Format current values of all metrics
+ *
+ * Formatted metrics are stored in metrics buffer.
+ */
+void
+metrics_collect(metrics_t *metrics);
+
+/**
+ * @brief Add a metric value to metrics buffer
+ *
+ * Samples of the same metric must be added consecutively.
+ *
+ * @param metrics Metrics being formatted
+ * @param name Metric name without prefix
+ * @param help Metric description
+ * @param counter Metric only increases (otherwise it is a gauge)
+ * @param label Label name or NULL if metric has no labels
+ * @param value Label value
+ * @param number Metric value
+ */
+void
+metrics_add(metrics_t *metrics, const char *name, const char *help, bool counter,
+            const char *label, const char *value, unsigned long number);
+
+/**
+ * @brief Answer a HTTP request from a Prometheus client
+ */
+void
+metrics_http_reply(metrics_t *metrics, int client);
+
+/**
+ * @brief Send formatted metrics to StatsD server
+ *
+ * Metrics are split in datagrams at line boundaries.
+ */
+void
+metrics_statsd_send(metrics_t *metrics);
+
+/**
+ * @brief Metrics thread function
+ */
+void
+metrics_thread(void *info);
+
+#endif /* __SNGREP_METRICS_H */
@@ -30,13 +30,24 @@
 #include <stdlib.h>
 #include <string.h>
 #include "packet.h"
+#include "pool.h"
+#include "capture_disk.h"
+#ifdef WITH_ZLIB
+#include "capture_zip.h"
+#endif
+
+//! Pool of packet structures, most captured packets are discarded
+static pool_t packet_pool = POOL_INITIALIZER(POOL_PACKET, "Packets", sizeof(packet_t));
+//! Pool of frame structures
+static pool_t frame_pool = POOL_INITIALIZER(POOL_FRAME, "Frames", sizeof(frame_t));
 
 packet_t *
 packet_create(uint8_t ip_ver, uint8_t proto, address_t src, address_t dst, uint32_t id)
 {
     // Create a new packet
     packet_t *packet;
-    packet = malloc(sizeof(packet_t));
+    if (!(packet = pool_alloc(&packet_pool)))
+        return NULL;
     memset(packet, 0, sizeof(packet_t));
     packet->ip_version = ip_ver;
     packet->proto = proto;
@@ -57,10 +68,15 @@ packet_clone(packet_t *packet)
     clone =    packet_create(packet->ip_version, packet->proto, packet->src, packet->dst, packet->ip_id);
     clone->tcp_seq = packet->tcp_seq;
 
-    // Append this frames to the original packet
+    // Append this frames to the original packet (sharing their buffers)
     vector_iter_t frames = vector_iterator(packet->frames);
-    while ((frame = vector_iterator_next(&frames)))
-        packet_add_frame(clone, frame->header, frame->data);
+    while ((frame = vector_iterator_next(&frames))) {
+        if (frame->buffer) {
+            packet_add_frame_buffer(clone, frame_buffer_ref(frame->buffer));
+        } else {
+            packet_add_frame(clone, frame->header, frame->data);
+        }
+    }
 
     return clone;
 }
@@ -73,18 +89,37 @@ packet_destroy(packet_t *packet)
     // Check we have a valid packet pointer
     if (!packet) return;
 
+#ifdef WITH_ZLIB
+    // Frames and payload may point to uncompressed data
+    if (packet->zip)
+        capture_zip_forget(packet->zip);
+#endif
+
     // Destroy frames
     vector_iter_t it = vector_iterator(packet->frames);
     while ((frame = vector_iterator_next(&it))) {
-        free(frame->header);
-        free(frame->data);
+        if (frame->shared)
+            frame_buffer_destroy(frame->shared);
+        if (frame->buffer) {
+            frame_buffer_destroy(frame->buffer);
+        } else if (frame->segment) {
+            free(frame->header);
+            capture_disk_segment_release(frame->segment);
+        } else {
+            free(frame->header);
+            free(frame->data);
+        }
     }
 
     // TODO Free remaining packet data
-    vector_set_destroyer(packet->frames, vector_generic_destroyer);
+    vector_set_destroyer(packet->frames, frame_destroyer);
     vector_destroy(packet->frames);
-    free(packet->payload);
-    free(packet);
+    if (!packet->payload_ref)
+        free(packet->payload);
+    if (packet->payload_segment)
+        capture_disk_segment_release(packet->payload_segment);
+    free(packet->hep_cid);
+    pool_free(&packet_pool, packet);
 }
 
 void
@@ -93,14 +128,39 @@ packet_destroyer(void *packet)
     packet_destroy((packet_t*) packet);
 }
 
+void
+frame_destroyer(void *frame)
+{
+    pool_free(&frame_pool, frame);
+}
+
 void
 packet_free_frames(packet_t *pkt)
 {
     frame_t *frame;
     vector_iter_t it = vector_iterator(pkt->frames);
 
+    // Payload will be still required after frames data is gone
+    if (pkt->payload_ref)
+        packet_set_payload(pkt, pkt->payload, pkt->payload_len);
+
     while ((frame = vector_iterator_next(&it))) {
-        free(frame->data);
+        if (frame->shared) {
+            frame_buffer_destroy(frame->shared);
+            frame->shared = NULL;
+        }
+        if (frame->buffer) {
+            // Keep frame header, it is used for packet timestamps
+            frame->header = malloc(sizeof(struct pcap_pkthdr));
+            memcpy(frame->header, &frame->buffer->header, sizeof(struct pcap_pkthdr));
+            frame_buffer_destroy(frame->buffer);
+            frame->buffer = NULL;
+        } else if (frame->segment) {
+            capture_disk_segment_release(frame->segment);
+            frame->segment = NULL;
+        } else {
+            free(frame->data);
+        }
         frame->data = NULL;
     }
 }
@@ -116,15 +176,143 @@ packet_set_transport_data(packet_t *pkt, uint16_t sport, uint16_t dport)
 frame_t *
 packet_add_frame(packet_t *pkt, const struct pcap_pkthdr *header, const u_char *packet)
 {
-    frame_t *frame = malloc(sizeof(frame_t));
+    frame_t *frame;
+    if (!(frame = pool_alloc(&frame_pool)))
+        return NULL;
     frame->header = malloc(sizeof(struct pcap_pkthdr));
     memcpy(frame->header, header, sizeof(struct pcap_pkthdr));
     frame->data = malloc(header->caplen);
     memcpy(frame->data, packet, header->caplen);
+    frame->buffer = NULL;
+    frame->segment = NULL;
+    frame->shared = NULL;
+    frame->shared_offset = 0;
+    vector_append(pkt->frames, frame);
+    return frame;
+}
+
+frame_t *
+packet_add_frame_buffer(packet_t *pkt, frame_buffer_t *buffer)
+{
+    frame_t *frame;
+    if (!(frame = pool_alloc(&frame_pool))) {
+        frame_buffer_destroy(buffer);
+        return NULL;
+    }
+    frame->header = &buffer->header;
+    frame->data = buffer->data;
+    frame->buffer = buffer;
+    frame->segment = NULL;
+    frame->shared = NULL;
+    frame->shared_offset = 0;
     vector_append(pkt->frames, frame);
     return frame;
 }
 
+void
+packet_move_frames(packet_t *dst, packet_t *src)
+{
+    frame_t *frame;
+    vector_iter_t it = vector_iterator(src->frames);
+
+    while ((frame = vector_iterator_next(&it)))
+        vector_append(dst->frames, frame);
+
+    // Frames belong to destination packet now
+    vector_clear(src->frames);
+}
+
+void
+packet_share_payload(packet_t *packet, packet_t *original)
+{
+    frame_t *frame, *source;
+    frame_buffer_t *buffer, *shared;
+    uint32_t prefix;
+
+    // Only single frame packets can share their payload
+    if (vector_count(packet->frames) != 1 || vector_count(original->frames) != 1)
+        return;
+    frame = vector_first(packet->frames);
+    source = vector_first(original->frames);
+
+    // Payload must be the end of a captured frame in both packets
+    if (!frame->buffer || frame->shared || !packet->payload_ref
+            || packet->payload + packet->payload_len != frame->data + frame->header->caplen)
+        return;
+    if (!(shared = source->shared ? source->shared : source->buffer) || !original->payload_ref
+            || original->payload + original->payload_len != shared->data + shared->header.caplen)
+        return;
+
+    // Retransmissions are not always byte identical
+    if (packet->payload_len != original->payload_len
+            || memcmp(packet->payload, original->payload, packet->payload_len) != 0)
+        return;
+
+    // Keep frame header and data before the payload
+    prefix = frame->header->caplen - packet->payload_len;
+    if (!(buffer = malloc(sizeof(frame_buffer_t) + prefix + 1)))
+        return;
+    memcpy(buffer, frame->buffer, sizeof(frame_buffer_t) + prefix);
+    atomic_init(&buffer->refs, 1);
+    buffer->data[prefix] = '\0';
+
+    frame_buffer_destroy(frame->buffer);
+    frame->buffer = buffer;
+    frame->header = &buffer->header;
+    frame->data = buffer->data;
+    frame->shared = frame_buffer_ref(shared);
+    frame->shared_offset = original->payload - shared->data;
+    packet->payload = original->payload;
+}
+
+u_char *
+frame_shared_data(const frame_t *frame)
+{
+    uint32_t len = frame->shared->header.caplen - frame->shared_offset;
+    uint32_t prefix = frame->header->caplen - len;
+    u_char *data;
+
+    if (!(data = malloc(frame->header->caplen)))
+        return NULL;
+    memcpy(data, frame->data, prefix);
+    memcpy(data + prefix, frame->shared->data + frame->shared_offset, len);
+    return data;
+}
+
+frame_buffer_t *
+frame_buffer_create(const struct pcap_pkthdr *header, const u_char *data)
+{
+    frame_buffer_t *buffer;
+
+    // Allocate header, data and the trailing zero byte at once
+    if (!(buffer = malloc(sizeof(frame_buffer_t) + header->caplen + 1)))
+        return NULL;
+
+    atomic_init(&buffer->refs, 1);
+    buffer->offset = 0;
+    buffer->source = 0;
+    memcpy(&buffer->header, header, sizeof(struct pcap_pkthdr));
+    memcpy(buffer->data, data, header->caplen);
+    buffer->data[header->caplen] = '\0';
+    return buffer;
+}
+
+frame_buffer_t *
+frame_buffer_ref(frame_buffer_t *buffer)
+{
+    atomic_fetch_add_explicit(&buffer->refs, 1, memory_order_relaxed);
+    return buffer;
+}
+
+void
+frame_buffer_destroy(frame_buffer_t *buffer)
+{
+    // Other owners are still using this buffer
+    if (atomic_fetch_sub_explicit(&buffer->refs, 1, memory_order_acq_rel) != 1)
+        return;
+    free(buffer);
+}
+
 void
 packet_set_type(packet_t *packet, enum packet_type type)
 {
@@ -134,19 +322,68 @@ packet_set_type(packet_t *packet, enum packet_type type)
 void
 packet_set_payload(packet_t *packet, u_char *payload, uint32_t payload_len)
 {
+    // New payload can be a copy of the one stored in this segment
+    struct capture_disk_segment *segment = packet->payload_segment;
+    packet->payload_segment = NULL;
+
     // Free previous payload
-    if (packet->payload)
+    if (packet->payload && !packet->payload_ref)
         free(packet->payload);
+    packet->payload = NULL;
+    packet->payload_ref = false;
     packet->payload_len = 0;
+    packet->payload_source = NULL;
 
     // Set new payload
     if (payload) {
         packet->payload = malloc(payload_len + 1);
-        memset(packet->payload, 0, payload_len + 1);
         memcpy(packet->payload, payload, payload_len);
         packet->payload[payload_len] = '\0';
         packet->payload_len = payload_len;
     }
+
+    if (segment)
+        capture_disk_segment_release(segment);
+}
+
+void
+packet_set_payload_ref(packet_t *packet, u_char *payload, uint32_t payload_len)
+{
+    // Payload must be a valid string to be used without copying
+    if (!payload || payload[payload_len] != '\0') {
+        packet_set_payload(packet, payload, payload_len);
+        return;
+    }
+
+    // Free previous payload
+    if (packet->payload && !packet->payload_ref)
+        free(packet->payload);
+    if (packet->payload_segment)
+        capture_disk_segment_release(packet->payload_segment);
+    packet->payload_segment = NULL;
+
+    packet->payload = payload;
+    packet->payload_len = payload_len;
+    packet->payload_ref = true;
+    packet->payload_source = NULL;
+}
+
+void
+packet_set_hep_info(packet_t *packet, uint32_t node, const char *cid, uint32_t cid_len)
+{
+    packet->hep_node = node;
+    free(packet->hep_cid);
+    packet->hep_cid = (cid && cid_len) ? strndup(cid, cid_len) : NULL;
+}
+
+void
+packet_set_payload_source(packet_t *packet, const u_char *source)
+{
+    if (packet->payload && !packet->payload_ref)
+        free(packet->payload);
+    packet->payload = NULL;
+    packet->payload_ref = false;
+    packet->payload_source = source;
 }
 
 uint32_t
@@ -158,6 +395,19 @@ packet_payloadlen(packet_t *packet)
 u_char *
 packet_payload(packet_t *packet)
 {
+#ifdef WITH_ZLIB
+    // Uncompress stored payload if required
+    if (packet->zip && capture_zip_load(packet->zip) != 0)
+        return NULL;
+#endif
+
+    // Copy the stored payload the first time it is requested
+    if (!packet->payload && packet->payload_source) {
+        if ((packet->payload = malloc(packet->payload_len + 1))) {
+            memcpy(packet->payload, packet->payload_source, packet->payload_len);
+            packet->payload[packet->payload_len] = '\0';
+        }
+    }
     return packet->payload;
 }
 
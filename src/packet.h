@@ -38,6 +38,8 @@
 
 #include <time.h>
 #include <sys/types.h>
+#include <stdbool.h>
+#include <stdatomic.h>
 #include <pcap.h>
 #include "address.h"
 #include "vector.h"
@@ -57,6 +59,12 @@ enum packet_type {
 typedef struct packet packet_t;
 //! Shorter declaration of frame structure
 typedef struct frame frame_t;
+//! Shorter declaration of frame buffer structure
+typedef struct frame_buffer frame_buffer_t;
+//! Forward declaration of disk storage segment (capture_disk.h)
+struct capture_disk_segment;
+//! Forward declaration of compressed storage data (capture_zip.h)
+struct capture_zip_entry;
 
 /**
  * @brief Packet capture data.
@@ -88,6 +96,20 @@ struct packet {
     u_char *payload;
     //! Payload length
     uint32_t payload_len;
+    //! Payload points to frame data instead of its own memory
+    bool payload_ref;
+    //! Disk storage segment holding payload not stored in any frame
+    struct capture_disk_segment *payload_segment;
+    //! Stored payload to be copied when requested (payload is NULL until then)
+    const u_char *payload_source;
+    //! Compressed storage data (frames and payload are NULL while compressed)
+    struct capture_zip_entry *zip;
+    //! Packet this one is a retransmission of (only set until it is stored)
+    packet_t *retrans;
+    //! HEP capture agent (node) id this packet was received from
+    uint32_t hep_node;
+    //! HEP correlation id sent along with this packet (Call-ID of a related dialog)
+    char *hep_cid;
     //! Packet frame list (frame_t)
     vector_t *frames;
 };
@@ -103,8 +125,61 @@ struct frame {
     struct pcap_pkthdr *header;
     //! PCAP Frame content
     u_char *data;
+    //! Memory holding both header and data when frame owns a buffer
+    frame_buffer_t *buffer;
+    //! Disk storage segment holding frame data (NULL if stored in memory)
+    struct capture_disk_segment *segment;
+    //! Buffer holding the end of frame data when it is shared with other packet
+    frame_buffer_t *shared;
+    //! Offset of shared frame data in its buffer
+    uint32_t shared_offset;
 };
 
+/**
+ *  @brief Captured frame header and data in a single memory block
+ *
+ *  Captured bytes are copied once into this buffer and frames created from
+ *  it take its ownership. Data is always followed by an extra zero byte, so
+ *  payloads that end with the frame can be used as strings.
+ *
+ *  Other threads (like the dump file writer) can hold a reference to the
+ *  buffer, so it is only freed after its last owner releases it.
+ */
+struct frame_buffer {
+    //! Number of owners of this buffer
+    atomic_uint refs;
+    //! Offset of this frame record in a mapped input file (0 if unknown)
+    uint64_t offset;
+    //! Capture source this frame was read from (interface in output files)
+    uint16_t source;
+    //! PCAP Frame Header data
+    struct pcap_pkthdr header;
+    //! PCAP Frame content
+    u_char data[];
+};
+
+/**
+ * @brief Allocate a new frame buffer and copy captured data
+ */
+frame_buffer_t *
+frame_buffer_create(const struct pcap_pkthdr *header, const u_char *data);
+
+/**
+ * @brief Add a new owner to an existing frame buffer
+ *
+ * @return the same frame buffer
+ */
+frame_buffer_t *
+frame_buffer_ref(frame_buffer_t *buffer);
+
+/**
+ * @brief Release a frame buffer
+ *
+ * Buffer memory is deallocated when its last owner releases it.
+ */
+void
+frame_buffer_destroy(frame_buffer_t *buffer);
+
 /**
  * @brief Allocate memory to store new packet data
  */
@@ -129,6 +204,40 @@ packet_set_transport_data(packet_t *pkt, uint16_t sport, uint16_t dport);
 frame_t *
 packet_add_frame(packet_t *pkt, const struct pcap_pkthdr *header, const u_char *packet);
 
+/**
+ * @brief Add a new frame to the given packet using an existing buffer
+ *
+ * Frame data is not copied. Buffer will be deallocated with the packet.
+ */
+frame_t *
+packet_add_frame_buffer(packet_t *pkt, frame_buffer_t *buffer);
+
+/**
+ * @brief Move all frames from one packet to another
+ *
+ * Source packet will have no frames after this call.
+ */
+void
+packet_move_frames(packet_t *dst, packet_t *src);
+
+/**
+ * @brief Share payload of a retransmitted packet with the original one
+ *
+ * Only single frame packets with the same payload at the end of their
+ * frame are shared. Retransmitted frame keeps its own header and data
+ * before the payload, so it can still be dumped as captured.
+ */
+void
+packet_share_payload(packet_t *packet, packet_t *original);
+
+/**
+ * @brief Get full data of a frame sharing its payload with other packet
+ *
+ * @return allocated frame data (must be freed by caller) or NULL
+ */
+u_char *
+frame_shared_data(const frame_t *frame);
+
 /**
  * @brief Deallocate a packet structure memory
  */
@@ -141,6 +250,14 @@ packet_destroy(packet_t *packet);
 void
 packet_destroyer(void *packet);
 
+/**
+ * @brief Destroyer function for frame vectors
+ *
+ * Only frame structure is released, not its data.
+ */
+void
+frame_destroyer(void *frame);
+
 /**
  * @brief Free packet frames data.
  *
@@ -161,14 +278,45 @@ packet_set_type(packet_t *packet, enum packet_type type);
 void
 packet_set_payload(packet_t *packet, u_char *payload, uint32_t payload_len);
 
+/**
+ * @brief Set packet payload pointing to one of its frames data
+ *
+ * Payload will not be copied if it is followed by a zero byte (which is
+ * always true for payloads ending with a frame buffer). Otherwise, this
+ * works as packet_set_payload.
+ */
+void
+packet_set_payload_ref(packet_t *packet, u_char *payload, uint32_t payload_len);
+
+/**
+ * @brief Set information received in packet HEP headers
+ *
+ * @param node HEP capture agent id
+ * @param cid HEP correlation id (not zero terminated, can be NULL)
+ * @param cid_len Correlation id length
+ */
+void
+packet_set_hep_info(packet_t *packet, uint32_t node, const char *cid, uint32_t cid_len);
+
 /**
  * @brief Getter for capture payload size
  */
 uint32_t
 packet_payloadlen(packet_t *packet);
 
+/**
+ * @brief Release packet payload memory, it is stored in one of its frames
+ *
+ * Payload will be copied from the given frame data the next time it is
+ * requested. Frame data doesn't need to be followed by a zero byte.
+ */
+void
+packet_set_payload_source(packet_t *packet, const u_char *source);
+
 /**
  * @brief Getter for capture payload pointer
+ *
+ * Payloads released with packet_set_payload_source are loaded again.
  */
 u_char *
 packet_payload(packet_t *packet);
@@ -0,0 +1,182 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file pool.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in pool.h
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+
+//! Round object size up to the pool alignment
+#define POOL_ROUND(size) (((size) + POOL_ALIGN - 1) & ~((size_t) POOL_ALIGN - 1))
+
+//! Pools that have allocated memory
+static pool_t *pools[POOL_COUNT];
+//! Free objects of each pool owned by this thread
+static _Thread_local pool_cache_t caches[POOL_COUNT];
+
+void *
+pool_alloc(pool_t *pool)
+{
+#ifdef POOL_USE_MALLOC
+    void *object;
+    pools[pool->id] = pool;
+    if ((object = malloc(pool->size)))
+        atomic_fetch_add_explicit(&pool->used, 1, memory_order_relaxed);
+    return object;
+#else
+    pool_cache_t *cache = &caches[pool->id];
+    pool_item_t *item;
+
+    if (!cache->items && pool_refill(pool, cache) != 0)
+        return NULL;
+
+    item = cache->items;
+    cache->items = item->next;
+    cache->count--;
+    atomic_fetch_add_explicit(&pool->used, 1, memory_order_relaxed);
+    return item;
+#endif
+}
+
+void
+pool_free(pool_t *pool, void *object)
+{
+    if (!object)
+        return;
+
+    atomic_fetch_sub_explicit(&pool->used, 1, memory_order_relaxed);
+
+#ifdef POOL_USE_MALLOC
+    free(object);
+#else
+    pool_cache_t *cache = &caches[pool->id];
+    pool_item_t *item = object;
+
+    item->next = cache->items;
+    cache->items = item;
+
+    // Threads releasing objects allocated by others return them to the pool
+    if (++cache->count > POOL_LOCAL_MAX)
+        pool_flush(pool, cache, POOL_LOCAL_MAX / 2);
+#endif
+}
+
+const char *
+pool_stats(enum pool_id id, size_t *used, size_t *total)
+{
+    if (id >= POOL_COUNT || !pools[id])
+        return NULL;
+
+    *used = atomic_load_explicit(&pools[id]->used, memory_order_relaxed);
+    *total = atomic_load_explicit(&pools[id]->total, memory_order_relaxed);
+    return pools[id]->name;
+}
+
+void
+pool_deinit()
+{
+    pool_slab_t *slab, *next;
+    int i;
+
+    for (i = 0; i < POOL_COUNT; i++) {
+        if (!pools[i])
+            continue;
+        pthread_mutex_lock(&pools[i]->lock);
+        for (slab = pools[i]->slabs; slab; slab = next) {
+            next = slab->next;
+            free(slab);
+        }
+        pools[i]->slabs = NULL;
+        pools[i]->free = NULL;
+        atomic_store(&pools[i]->used, 0);
+        atomic_store(&pools[i]->total, 0);
+        pthread_mutex_unlock(&pools[i]->lock);
+        pools[i] = NULL;
+    }
+
+    memset(caches, 0, sizeof(caches));
+}
+
+int
+pool_refill(pool_t *pool, pool_cache_t *cache)
+{
+    size_t size = POOL_ROUND(pool->size < sizeof(pool_item_t) ? sizeof(pool_item_t) : pool->size);
+    size_t count = POOL_SLAB_SIZE / size, i;
+    pool_item_t *item, *last = NULL;
+    pool_slab_t *slab;
+
+    pthread_mutex_lock(&pool->lock);
+
+    // Split a new slab in free objects
+    if (!pool->free) {
+        if (!(slab = malloc(sizeof(pool_slab_t) + POOL_SLAB_SIZE))) {
+            pthread_mutex_unlock(&pool->lock);
+            return 1;
+        }
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        for (i = count; i > 0; i--) {
+            item = (pool_item_t *) (slab->data + (i - 1) * size);
+            item->next = pool->free;
+            pool->free = item;
+        }
+        atomic_fetch_add_explicit(&pool->total, count, memory_order_relaxed);
+        pools[pool->id] = pool;
+    }
+
+    // Take up to half of the thread list maximum
+    cache->items = pool->free;
+    for (item = pool->free, count = 0; item && count < POOL_LOCAL_MAX / 2; item = item->next, count++)
+        last = item;
+    pool->free = last->next;
+    last->next = NULL;
+    cache->count = count;
+
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+void
+pool_flush(pool_t *pool, pool_cache_t *cache, uint32_t count)
+{
+    pool_item_t *first = cache->items, *last = first;
+    uint32_t i;
+
+    if (!first || !count)
+        return;
+
+    // Detach the first objects of the thread list
+    for (i = 1; i < count && last->next; i++)
+        last = last->next;
+    cache->items = last->next;
+    cache->count -= i;
+
+    pthread_mutex_lock(&pool->lock);
+    last->next = pool->free;
+    pool->free = first;
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,183 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file pool.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to manage pools of fixed size objects
+ *
+ * Small structures created and destroyed for each captured packet are
+ * taken from slabs of preallocated objects instead of using malloc. Each
+ * thread keeps its own list of free objects, so allocations don't need
+ * any lock. Objects released by other threads are moved in batches between
+ * thread lists and a shared list of the pool.
+ *
+ * Slabs are only released by pool_deinit. Sanitizer builds allocate each
+ * object with malloc, so memory errors are still detected.
+ */
+
+#ifndef __SNGREP_POOL_H_
+#define __SNGREP_POOL_H_
+
+#include "config.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+//! Size of each slab of objects
+#define POOL_SLAB_SIZE      65536
+//! Free objects a thread keeps before returning half of them to the pool
+#define POOL_LOCAL_MAX      512
+//! Alignment of pooled objects
+#define POOL_ALIGN          16
+
+#if defined(__SANITIZE_ADDRESS__)
+#define POOL_USE_MALLOC
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define POOL_USE_MALLOC
+#endif
+#endif
+
+//! Initialize a pool of objects of the given size
+#define POOL_INITIALIZER(id, name, size) \
+    { id, name, size, PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0, 0 }
+
+//! Available object pools
+enum pool_id {
+    POOL_PACKET = 0,
+    POOL_FRAME,
+    POOL_VECTOR,
+    POOL_COUNT
+};
+
+//! Shorter declaration of pool structure
+typedef struct pool pool_t;
+//! Shorter declaration of pool_item structure
+typedef struct pool_item pool_item_t;
+//! Shorter declaration of pool_slab structure
+typedef struct pool_slab pool_slab_t;
+//! Shorter declaration of pool_cache structure
+typedef struct pool_cache pool_cache_t;
+
+/**
+ * @brief Free object in a pool list
+ */
+struct pool_item {
+    //! Next free object
+    pool_item_t *next;
+};
+
+/**
+ * @brief Memory block split in pool objects
+ */
+struct pool_slab {
+    //! Previously allocated slab
+    pool_slab_t *next;
+    //! Slab objects
+    _Alignas(POOL_ALIGN) unsigned char data[];
+};
+
+/**
+ * @brief Free objects of a pool owned by one thread
+ */
+struct pool_cache {
+    //! First free object
+    pool_item_t *items;
+    //! Number of free objects
+    uint32_t count;
+};
+
+/**
+ * @brief Pool of objects of the same size
+ */
+struct pool {
+    //! Pool identifier
+    enum pool_id id;
+    //! Pool name
+    const char *name;
+    //! Objects size
+    size_t size;
+    //! Lock for pool slabs and shared free list
+    pthread_mutex_t lock;
+    //! Allocated slabs
+    pool_slab_t *slabs;
+    //! Free objects not owned by any thread
+    pool_item_t *free;
+    //! Objects being used
+    atomic_size_t used;
+    //! Objects in all slabs
+    atomic_size_t total;
+};
+
+/**
+ * @brief Get an object from a pool
+ *
+ * Object memory is not initialized.
+ *
+ * @return object or NULL on memory error
+ */
+void *
+pool_alloc(pool_t *pool);
+
+/**
+ * @brief Return an object to its pool
+ */
+void
+pool_free(pool_t *pool, void *object);
+
+/**
+ * @brief Get pool occupancy
+ *
+ * @param id pool identifier
+ * @param used objects being used
+ * @param total objects allocated in slabs
+ * @return pool name or NULL if pool has not been used yet
+ */
+const char *
+pool_stats(enum pool_id id, size_t *used, size_t *total);
+
+/**
+ * @brief Release all slabs of all pools
+ *
+ * Objects of any pool can not be used after this call.
+ */
+void
+pool_deinit();
+
+/**
+ * @brief Move shared free objects to the thread list, allocating a new
+ * slab if there are none
+ *
+ * @return 0 on success, 1 on memory error
+ */
+int
+pool_refill(pool_t *pool, pool_cache_t *cache);
+
+/**
+ * @brief Move free objects of the thread list to the shared list
+ */
+void
+pool_flush(pool_t *pool, pool_cache_t *cache, uint32_t count);
+
+#endif /* __SNGREP_POOL_H_ */
@@ -0,0 +1,124 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file ring.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source code of functions defined in ring.h
+ *
+ */
+#include "ring.h"
+#include <stdlib.h>
+
+ring_t *
+ring_create(uint32_t size)
+{
+    ring_t *ring;
+    uint32_t slots = 2;
+
+    // Round requested size to the next power of two
+    while (slots < size && slots < (1U << 31))
+        slots <<= 1;
+
+    if (!(ring = malloc(sizeof(ring_t))))
+        return NULL;
+
+    if (!(ring->slots = calloc(slots, sizeof(void *)))) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->size = slots;
+    ring->mask = slots - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->overflows, 0);
+    return ring;
+}
+
+void
+ring_destroy(ring_t *ring)
+{
+    if (!ring)
+        return;
+    free(ring->slots);
+    free(ring);
+}
+
+int
+ring_push(ring_t *ring, void *item)
+{
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    // No free slots left
+    if (head - tail >= ring->size)
+        return 1;
+
+    ring->slots[head & ring->mask] = item;
+    // Publish the slot contents before moving head
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 0;
+}
+
+void *
+ring_pop(ring_t *ring)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    void *item;
+
+    // Nothing queued
+    if (head == tail)
+        return NULL;
+
+    item = ring->slots[tail & ring->mask];
+    // Release the slot to the producer
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return item;
+}
+
+uint32_t
+ring_count(ring_t *ring)
+{
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    return head - tail;
+}
+
+uint32_t
+ring_size(ring_t *ring)
+{
+    return ring->size;
+}
+
+void
+ring_add_overflow(ring_t *ring)
+{
+    atomic_fetch_add_explicit(&ring->overflows, 1, memory_order_relaxed);
+}
+
+unsigned long
+ring_overflows(ring_t *ring)
+{
+    return atomic_load_explicit(&ring->overflows, memory_order_relaxed);
+}
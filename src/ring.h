@@ -0,0 +1,122 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file ring.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Bounded single-producer single-consumer ring of pointers
+ *
+ * This ring is used to hand items from one thread to another without
+ * taking any lock. Only one thread may push and only one thread may
+ * pop from a given ring.
+ */
+
+#ifndef __SNGREP_RING_H_
+#define __SNGREP_RING_H_
+
+#include "config.h"
+#include <stdint.h>
+#include <stdatomic.h>
+
+//! Shorter declaration of ring structure
+typedef struct ring ring_t;
+
+/**
+ * @brief Structure to hold a bounded list of pointers
+ */
+struct ring {
+    //! Number of slots (always a power of two)
+    uint32_t size;
+    //! Mask to convert positions into slot indexes
+    uint32_t mask;
+    //! Next position to be written (only modified by producer)
+    atomic_uint head;
+    //! Next position to be read (only modified by consumer)
+    atomic_uint tail;
+    //! Number of items rejected because the ring was full
+    atomic_ulong overflows;
+    //! Ring slots
+    void **slots;
+};
+
+/**
+ * @brief Create a new ring
+ *
+ * Requested size will be rounded up to the next power of two.
+ *
+ * @param size Minimum number of slots
+ * @return a new allocated ring or NULL on error
+ */
+ring_t *
+ring_create(uint32_t size);
+
+/**
+ * @brief Free ring memory
+ *
+ * Items still queued in the ring are not freed.
+ */
+void
+ring_destroy(ring_t *ring);
+
+/**
+ * @brief Add an item at the end of the ring (producer side)
+ *
+ * @return 0 if item has been queued, 1 if ring is full
+ */
+int
+ring_push(ring_t *ring, void *item);
+
+/**
+ * @brief Get the first item of the ring (consumer side)
+ *
+ * @return first queued item or NULL if ring is empty
+ */
+void *
+ring_pop(ring_t *ring);
+
+/**
+ * @brief Get number of queued items
+ */
+uint32_t
+ring_count(ring_t *ring);
+
+/**
+ * @brief Get ring total slots
+ */
+uint32_t
+ring_size(ring_t *ring);
+
+/**
+ * @brief Increase ring overflow counter
+ *
+ * Producer calls this when it discards an item because ring is full
+ */
+void
+ring_add_overflow(ring_t *ring);
+
+/**
+ * @brief Get number of items discarded because ring was full
+ */
+unsigned long
+ring_overflows(ring_t *ring);
+
+#endif /* __SNGREP_RING_H_ */
@@ -31,11 +31,19 @@
 
 #include "config.h"
 #include <stddef.h>
+#include <stdlib.h>
 #include <time.h>
 #include "rtp.h"
 #include "sip.h"
 #include "vector.h"
 
+//! Bucket of a destination address in streams index
+#define RTP_INDEX_SLOT(dst, size) \
+    ((((dst).hash ^ ((uint32_t) (dst).port * 0x9E3779B1u)) * 0x9E3779B1u) & ((size) - 1))
+
+//! Streams of all calls by destination
+static rtp_stream_index_t streams_index;
+
 /**
  * @brief Known RTP encodings
  */
@@ -72,14 +80,15 @@ stream_create(sdp_media_t *media, address_t dst, int type)
 {
     rtp_stream_t *stream;
 
-    // Allocate memory for this stream structure
-    if (!(stream = sng_malloc(sizeof(rtp_stream_t))))
+    // Allocate memory for this stream structure in its call memory
+    if (!(stream = arena_alloc(msg_get_call(media->msg)->arena, sizeof(rtp_stream_t))))
         return NULL;
 
     // Initialize all fields
     stream->type = type;
     stream->media = media;
     stream->dst = dst;
+    stream->activity = packet_time(media->msg->packet).tv_sec;
 
     return stream;
 }
@@ -94,7 +103,22 @@ stream_complete(rtp_stream_t *stream, address_t src)
 void
 stream_set_format(rtp_stream_t *stream, uint32_t format)
 {
+    const char *name = NULL, *rate;
+    int i;
+
     stream->rtpinfo.fmtcode = format;
+    stream->rtpinfo.clock = STREAM_DEFAULT_CLOCK;
+
+    // Get format name with its rate (NAME/RATE)
+    for (i = 0; encodings[i].format; i++) {
+        if (encodings[i].id == format)
+            name = encodings[i].name;
+    }
+    if (!name && stream->media)
+        name = media_get_format(stream->media, format);
+
+    if (name && (rate = strchr(name, '/')) && atoi(rate + 1) > 0)
+        stream->rtpinfo.clock = atoi(rate + 1);
 }
 
 void
@@ -104,6 +128,9 @@ stream_add_packet(rtp_stream_t *stream, packet_t *packet)
         stream->time = packet_time(packet);
 
     stream->lasttm = (int) time(NULL);
+    stream->lasttime = packet_time(packet);
+    rtp_index_touch(stream, stream->lasttime.tv_sec);
+    stream->bytes += packet_payloadlen(packet);
     stream->pktcnt++;
 }
 
@@ -113,6 +140,168 @@ stream_get_count(rtp_stream_t *stream)
     return stream->pktcnt;
 }
 
+void
+stream_update_stats(rtp_stream_t *stream, packet_t *packet)
+{
+    rtp_stream_stats_t *stats = &stream->stats;
+    u_char *payload = packet_payload(packet);
+    struct timeval arrival = packet_time(packet);
+    uint16_t seq, udelta;
+    uint32_t ts;
+    double delta, transit;
+
+    seq = (payload[2] << 8) | payload[3];
+    ts = ((uint32_t) payload[4] << 24) | (payload[5] << 16) | (payload[6] << 8) | payload[7];
+
+    // First packet of the stream
+    if (stream->pktcnt == 0) {
+        stats->base_seq = stats->max_seq = seq;
+        stats->received = 1;
+        stats->last_ts = ts;
+        stats->last_arrival = arrival;
+        return;
+    }
+
+    // Sequence number tracking
+    udelta = seq - stats->max_seq;
+    if (udelta == 0) {
+        stats->duplicated++;
+        return;
+    } else if (udelta < STREAM_MAX_DROPOUT) {
+        // In order, with permissible gap
+        if (seq < stats->max_seq)
+            stats->cycles += 65536;
+        stats->max_seq = seq;
+    } else if (udelta <= 65536 - STREAM_MAX_MISORDER) {
+        // Very large jump, the source has restarted its sequence
+        stats->cycles = 0;
+        stats->base_seq = seq;
+        stats->max_seq = seq;
+        stats->received = 0;
+    } else {
+        stats->misordered++;
+    }
+    stats->received++;
+
+    // Time between consecutive packets
+    delta = (arrival.tv_sec - stats->last_arrival.tv_sec) * 1000.0
+            + (arrival.tv_usec - stats->last_arrival.tv_usec) / 1000.0;
+    if (delta > stats->max_delta)
+        stats->max_delta = delta;
+
+    // Interarrival jitter: J = J + (|D| - J) / 16
+    transit = delta * stream->rtpinfo.clock / 1000.0 - (int32_t) (ts - stats->last_ts);
+    if (transit < 0)
+        transit = -transit;
+    stats->jitter += (transit - stats->jitter) / 16;
+
+    stats->last_ts = ts;
+    stats->last_arrival = arrival;
+}
+
+uint32_t
+stream_get_expected(rtp_stream_t *stream)
+{
+    if (!stream->pktcnt)
+        return 0;
+    return stream->stats.cycles + stream->stats.max_seq - stream->stats.base_seq + 1;
+}
+
+uint32_t
+stream_get_lost(rtp_stream_t *stream)
+{
+    uint32_t expected = stream_get_expected(stream);
+
+    return (expected > stream->stats.received) ? expected - stream->stats.received : 0;
+}
+
+float
+stream_get_loss(rtp_stream_t *stream)
+{
+    uint32_t expected = stream_get_expected(stream);
+
+    if (!expected)
+        return 0;
+    return (float) stream_get_lost(stream) * 100 / expected;
+}
+
+float
+stream_get_jitter(rtp_stream_t *stream)
+{
+    if (!stream->rtpinfo.clock)
+        return 0;
+    return stream->stats.jitter * 1000 / stream->rtpinfo.clock;
+}
+
+float
+stream_get_mos(rtp_stream_t *stream)
+{
+    float latency, r;
+
+    // Effective latency from jitter buffer size
+    latency = stream_get_jitter(stream) * 2 + 10;
+    if (latency < 160) {
+        r = 93.2 - latency / 40;
+    } else {
+        r = 93.2 - (latency - 120) / 10;
+    }
+
+    // Each percentage of loss reduces 2.5 points
+    r -= stream_get_loss(stream) * 2.5;
+
+    if (r < 0)
+        return 1.0;
+    if (r > 100)
+        r = 100;
+    return 1 + 0.035 * r + 0.000007 * r * (r - 60) * (100 - r);
+}
+
+int
+stream_add_sample(rtp_stream_t *stream, packet_t *packet, uint32_t max)
+{
+    sip_call_t *call = stream_get_call(stream);
+    uint32_t slot;
+
+    // Allocate the ring in the call memory with the first packet
+    if (!stream->samples) {
+        if (!(stream->samples = arena_alloc(call->arena, sizeof(packet_t *) * max)))
+            return 1;
+        stream->samplemax = max;
+    }
+    slot = stream->samplecnt % stream->samplemax;
+
+    // Replace the oldest packet once the ring is full
+    if (stream->samples[slot]) {
+        packet_destroy(stream->samples[slot]);
+    } else {
+        // Ring memory is only accounted while filling it
+        sip_calls_update(call, capture_packet_size(packet));
+    }
+
+    stream->samples[slot] = packet;
+    stream->samplecnt++;
+    return 0;
+}
+
+uint32_t
+stream_sample_count(rtp_stream_t *stream)
+{
+    if (!stream->samples)
+        return 0;
+    return (stream->samplecnt < stream->samplemax) ? stream->samplecnt : stream->samplemax;
+}
+
+void
+stream_clear_samples(rtp_stream_t *stream)
+{
+    uint32_t i;
+
+    for (i = 0; i < stream_sample_count(stream); i++)
+        packet_destroy(stream->samples[i]);
+    stream->samples = NULL;
+    stream->samplecnt = 0;
+}
+
 struct sip_call *
 stream_get_call(rtp_stream_t *stream) {
     if (stream && stream->media && stream->media->msg)
@@ -180,6 +369,10 @@ rtp_check_packet(packet_t *packet)
     src = packet->src;
     dst = packet->dst;
 
+    // Stop matching streams of calls finished a while ago or without packets
+    sip_calls_media_expire(packet_time(packet).tv_sec);
+    rtp_index_expire(packet_time(packet).tv_sec);
+
     if (data_is_rtp(payload, size) == 0) {
 
         // Get RTP payload type
@@ -194,6 +387,7 @@ rtp_check_packet(packet_t *packet)
 
         // We have found a stream, but with different format
         if (stream_is_complete(stream) && stream->rtpinfo.fmtcode != format) {
+            stream->fmtchanges++;
             // Create a new stream for this new format
             stream = stream_create(stream->media, dst, PACKET_RTP);
             stream_complete(stream, src);
@@ -245,7 +439,8 @@ rtp_check_packet(packet_t *packet)
             }
         }
 
-        // Add packet to stream
+        // Update quality counters and add packet to stream
+        stream_update_stats(stream, packet);
         stream_add_packet(stream, packet);
     } else if (data_is_rtcp(payload, size) == 0) {
         // Find the matching stream
@@ -333,45 +528,29 @@ rtp_find_stream_format(address_t src, address_t dst, uint32_t format)
 {
     // Structure for RTP packet streams
     rtp_stream_t *stream;
-    // Check if this is a RTP packet from active calls
-    sip_call_t *call;
-    // Iterator for active calls
-    vector_iter_t calls;
-    // Iterator for call streams
-    vector_iter_t streams;
     // Candiate stream
     rtp_stream_t *candidate = NULL;
 
-    // Get active calls (during conversation)
-    calls = sip_calls_iterator();
-    vector_iterator_set_current(&calls, vector_iterator_count(&calls));
-
-    while ((call = vector_iterator_prev(&calls))) {
-        streams = vector_iterator(call->streams);
-        vector_iterator_set_last(&streams);
-        while ((stream = vector_iterator_prev(&streams))) {
-            // Only look RTP packets
-            if (stream->type != PACKET_RTP)
-                continue;
-
-            // Stream complete, check source, dst
-            if (stream_is_complete(stream)) {
-                if (addressport_equals(stream->src, src) &&
-                    addressport_equals(stream->dst, dst)) {
-                    // Exact searched stream format
-                    if (stream->rtpinfo.fmtcode == format) {
-                        return stream;
-                    } else {
-                        // Matching addresses but different format
-                        candidate = stream;
-                    }
-                }
-            } else {
-                // Incomplete stream, if dst match is enough
-                if (addressport_equals(stream->dst, dst)) {
-                       return stream;
+    // Only streams sharing destination bucket, newest first
+    for (stream = rtp_index_first(dst); stream; stream = stream->index_next) {
+        // Only look RTP packets
+        if (stream->type != PACKET_RTP || !addressport_equals(stream->dst, dst))
+            continue;
+
+        // Stream complete, check source, dst
+        if (stream_is_complete(stream)) {
+            if (addressport_equals(stream->src, src)) {
+                // Exact searched stream format
+                if (stream->rtpinfo.fmtcode == format) {
+                    return stream;
+                } else {
+                    // Matching addresses but different format
+                    candidate = stream;
                 }
             }
+        } else {
+            // Incomplete stream, if dst match is enough
+            return stream;
         }
     }
 
@@ -382,27 +561,24 @@ rtp_stream_t *
 rtp_find_stream(address_t src, address_t dst)
 {
     // Structure for RTP packet streams
-    rtp_stream_t *stream;
-    // Check if this is a RTP packet from active calls
-    sip_call_t *call;
-    // Iterator for active calls
-    vector_iter_t calls;
-
-    // Get active calls (during conversation)
-    calls = sip_calls_iterator();
-    vector_iterator_set_current(&calls, vector_iterator_count(&calls));
-
-    while ((call = vector_iterator_prev(&calls))) {
+    rtp_stream_t *stream, *found;
+    // Call of the streams being checked
+    sip_call_t *call = NULL;
+
+    // Only calls having streams with this destination, newest first
+    for (stream = rtp_index_first(dst); stream; stream = stream->index_next) {
+        if (!addressport_equals(stream->dst, dst) || stream_get_call(stream) == call)
+            continue;
         // Check if this call has an RTP stream for current packet data
-        if ((stream = rtp_find_call_stream(call, src, dst))) {
-            return stream;
+        call = stream_get_call(stream);
+        if ((found = rtp_find_call_stream(call, src, dst))) {
+            return found;
         }
     }
 
     return NULL;
 }
 
-
 rtp_stream_t *
 rtp_find_call_stream(struct sip_call *call, address_t src, address_t dst)
 {
@@ -415,6 +591,9 @@ rtp_find_call_stream(struct sip_call *call, address_t src, address_t dst)
     // Look for an incomplete stream with this destination
     vector_iterator_set_last(&it);
     while ((stream = vector_iterator_prev(&it))) {
+        // Expired streams no longer receive packets
+        if (!stream_is_indexed(stream))
+            continue;
         if (addressport_equals(dst, stream->dst)) {
             if (!src.port) {
                 return stream;
@@ -446,6 +625,8 @@ rtp_find_call_exact_stream(struct sip_call *call, address_t src, address_t dst)
 
     vector_iterator_set_last(&it);
     while ((stream = vector_iterator_prev(&it))) {
+        if (!stream_is_indexed(stream))
+            continue;
         if (addressport_equals(src, stream->src) &&
             addressport_equals(dst, stream->dst)) {
             return stream;
@@ -456,6 +637,208 @@ rtp_find_call_exact_stream(struct sip_call *call, address_t src, address_t dst)
     return NULL;
 }
 
+int
+rtp_index_add(rtp_stream_t *stream)
+{
+    // Keep buckets as short as the number of indexed streams
+    if (streams_index.count >= streams_index.size) {
+        if (rtp_index_resize(streams_index.size ? streams_index.size * 2 : RTP_INDEX_MIN_SIZE) != 0)
+            return 1;
+    }
+
+    rtp_index_link(streams_index.buckets, streams_index.size, stream);
+    streams_index.count++;
+    streams_index.added++;
+    stream_get_call(stream)->media_streams++;
+
+    // Append to the activity list
+    if ((stream->activity_prev = streams_index.activity_last)) {
+        streams_index.activity_last->activity_next = stream;
+    } else {
+        streams_index.activity_first = stream;
+    }
+    streams_index.activity_last = stream;
+    return 0;
+}
+
+void
+rtp_index_link(rtp_stream_t **buckets, uint32_t size, rtp_stream_t *stream)
+{
+    rtp_stream_t **pos;
+
+    // Find the position of this stream in its bucket
+    pos = &buckets[RTP_INDEX_SLOT(stream->dst, size)];
+    while (*pos && stream_index_precedes(*pos, stream))
+        pos = &(*pos)->index_next;
+
+    // Link stream before the first older one
+    stream->index_next = *pos;
+    if (*pos)
+        (*pos)->index_prev = &stream->index_next;
+    stream->index_prev = pos;
+    *pos = stream;
+}
+
+void
+rtp_index_remove(rtp_stream_t *stream)
+{
+    // Not indexed stream
+    if (!stream->index_prev)
+        return;
+
+    *stream->index_prev = stream->index_next;
+    if (stream->index_next)
+        stream->index_next->index_prev = stream->index_prev;
+    stream->index_next = NULL;
+    stream->index_prev = NULL;
+    streams_index.count--;
+    stream_get_call(stream)->media_streams--;
+
+    // Remove from the activity list
+    if (stream->activity_prev) {
+        stream->activity_prev->activity_next = stream->activity_next;
+    } else {
+        streams_index.activity_first = stream->activity_next;
+    }
+    if (stream->activity_next) {
+        stream->activity_next->activity_prev = stream->activity_prev;
+    } else {
+        streams_index.activity_last = stream->activity_prev;
+    }
+    stream->activity_prev = stream->activity_next = NULL;
+}
+
+rtp_stream_t *
+rtp_index_first(address_t dst)
+{
+    if (!streams_index.count)
+        return NULL;
+    return streams_index.buckets[RTP_INDEX_SLOT(dst, streams_index.size)];
+}
+
+int
+rtp_index_resize(uint32_t size)
+{
+    rtp_stream_t **buckets, *stream, *next;
+    uint32_t i;
+
+    if (!(buckets = calloc(size, sizeof(rtp_stream_t *))))
+        return 1;
+
+    // Move all indexed streams to the new buckets
+    for (i = 0; i < streams_index.size; i++) {
+        for (stream = streams_index.buckets[i]; stream; stream = next) {
+            next = stream->index_next;
+            rtp_index_link(buckets, size, stream);
+        }
+    }
+
+    free(streams_index.buckets);
+    streams_index.buckets = buckets;
+    streams_index.size = size;
+    return 0;
+}
+
+void
+rtp_index_destroy()
+{
+    free(streams_index.buckets);
+    memset(&streams_index, 0, sizeof(streams_index));
+}
+
+void
+rtp_index_set_timeout(int timeout)
+{
+    streams_index.timeout = timeout;
+}
+
+void
+rtp_index_stats(uint32_t *count, unsigned long *added)
+{
+    *count = streams_index.count;
+    *added = streams_index.added;
+}
+
+int
+rtp_index_destinations(address_t *out, int max)
+{
+    rtp_stream_t *stream;
+    int count = 0, i;
+
+    for (stream = streams_index.activity_first; stream; stream = stream->activity_next) {
+        // Several streams (RTP and RTCP of both directions) may share destination
+        for (i = 0; i < count; i++) {
+            if (addressport_equals(out[i], stream->dst))
+                break;
+        }
+        if (i < count)
+            continue;
+        if (count == max)
+            return -1;
+        out[count++] = stream->dst;
+    }
+
+    return count;
+}
+
+void
+rtp_index_touch(rtp_stream_t *stream, time_t now)
+{
+    stream->activity = now;
+
+    // Not indexed or already the most recently active
+    if (!stream->index_prev || streams_index.activity_last == stream)
+        return;
+
+    // Unlink from current position
+    if (stream->activity_prev) {
+        stream->activity_prev->activity_next = stream->activity_next;
+    } else {
+        streams_index.activity_first = stream->activity_next;
+    }
+    stream->activity_next->activity_prev = stream->activity_prev;
+
+    // Append to the end of the list
+    stream->activity_prev = streams_index.activity_last;
+    stream->activity_next = NULL;
+    streams_index.activity_last->activity_next = stream;
+    streams_index.activity_last = stream;
+}
+
+void
+rtp_index_expire(time_t now)
+{
+    rtp_stream_t *stream;
+
+    if (streams_index.timeout <= 0)
+        return;
+
+    while ((stream = streams_index.activity_first) && stream->activity + streams_index.timeout <= now) {
+        if (!stream_is_complete(stream) && stream_get_call(stream)->state == SIP_CALLSTATE_CALLSETUP) {
+            // Still waiting for the call to be answered
+            rtp_index_touch(stream, now);
+        } else {
+            rtp_index_remove(stream);
+        }
+    }
+}
+
+bool
+stream_is_indexed(rtp_stream_t *stream)
+{
+    return stream->index_prev != NULL;
+}
+
+int
+stream_index_precedes(rtp_stream_t *one, rtp_stream_t *two)
+{
+    sip_call_t *call1 = stream_get_call(one), *call2 = stream_get_call(two);
+
+    if (call1 != call2)
+        return call1->index > call2->index;
+    return one->index > two->index;
+}
+
 int
 stream_is_older(rtp_stream_t *one, rtp_stream_t *two)
 {
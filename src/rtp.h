@@ -53,6 +53,15 @@
 // If stream does not receive a packet in this seconds, we consider it inactive
 #define STREAM_INACTIVE_SECS 3
 
+// Sequence number jumps considered packet loss or misordering (RFC 3550 A.1)
+#define STREAM_MAX_DROPOUT 3000
+#define STREAM_MAX_MISORDER 100
+// Clock rate of formats without known rate
+#define STREAM_DEFAULT_CLOCK 8000
+
+// Initial number of buckets of streams index
+#define RTP_INDEX_MIN_SIZE 1024
+
 // RTCP header types
 //! http://www.iana.org/assignments/rtp-parameters/rtp-parameters.xhtml
 enum rtcp_header_types
@@ -91,6 +100,10 @@ enum rtcp_xr_block_types
 typedef struct rtp_encoding rtp_encoding_t;
 //! Shorter declaration of rtp_stream structure
 typedef struct rtp_stream rtp_stream_t;
+//! Shorter declaration of rtp_stream_index structure
+typedef struct rtp_stream_index rtp_stream_index_t;
+//! Shorter declaration of rtp_stream_stats structure
+typedef struct rtp_stream_stats rtp_stream_stats_t;
 
 struct rtp_encoding {
     uint32_t id;
@@ -98,6 +111,36 @@ struct rtp_encoding {
     const char *format;
 };
 
+/**
+ * @brief RTP stream quality counters
+ *
+ * Counters are updated with every received packet following RFC 3550
+ * (appendix A.1 for sequence numbers and A.8 for jitter), so quality
+ * can be displayed without storing the stream packets.
+ */
+struct rtp_stream_stats {
+    //! First received sequence number
+    uint16_t base_seq;
+    //! Highest received sequence number
+    uint16_t max_seq;
+    //! Number of sequence number wraparounds (shifted 16 bits)
+    uint32_t cycles;
+    //! Packets received since base sequence number (without duplicates)
+    uint32_t received;
+    //! Packets received with the highest sequence number again
+    uint32_t duplicated;
+    //! Packets received after a higher sequence number
+    uint32_t misordered;
+    //! RTP timestamp of previous packet
+    uint32_t last_ts;
+    //! Arrival time of previous packet
+    struct timeval last_arrival;
+    //! Interarrival jitter (in timestamp units)
+    double jitter;
+    //! Max time between two consecutive packets (ms)
+    double max_delta;
+};
+
 struct rtp_stream {
     //! Determine stream type
     uint32_t type;
@@ -113,12 +156,38 @@ struct rtp_stream {
     struct timeval time;
     //! Unix timestamp of last received packet
     int lasttm;
+    //! Time of last received packet of stream
+    struct timeval lasttime;
+    //! Payload bytes of received packets
+    uint64_t bytes;
+    //! Number of packets received with a different format
+    uint32_t fmtchanges;
+    //! Last received packets (NULL if no packet has been kept)
+    packet_t **samples;
+    //! Size of samples ring
+    uint32_t samplemax;
+    //! Number of packets kept since stream creation
+    uint32_t samplecnt;
+    //! Quality counters of RTP streams
+    rtp_stream_stats_t stats;
+    //! Position of this stream in its call streams
+    int index;
+    //! Next stream in the same streams index bucket
+    rtp_stream_t *index_next;
+    //! Pointer to this stream in its index bucket (NULL if not indexed)
+    rtp_stream_t **index_prev;
+    //! Time of last received packet or stream creation (packet time)
+    time_t activity;
+    //! Previous and next indexed streams in activity order
+    rtp_stream_t *activity_prev, *activity_next;
 
     // Stream information (depending on type)
     union {
         struct {
             //! Format of first received packet of stre
             uint32_t fmtcode;
+            //! Timestamp units per second of the format
+            uint32_t clock;
         } rtpinfo;
         struct {
             //! Sender packet count
@@ -135,6 +204,29 @@ struct rtp_stream {
     };
 };
 
+/**
+ * @brief Streams of all calls by destination address
+ *
+ * Every packet lookup requires the stream destination to match, so
+ * streams are only compared with the ones sharing their destination
+ * bucket. Buckets are sorted from the newest call and stream to the
+ * oldest, the same order the calls were searched one by one.
+ */
+struct rtp_stream_index {
+    //! Number of buckets (always a power of two)
+    uint32_t size;
+    //! Number of indexed streams
+    uint32_t count;
+    //! Number of streams indexed since capture started
+    unsigned long added;
+    //! Lists of streams by destination hash
+    rtp_stream_t **buckets;
+    //! Seconds without packets before streams expire (0 for disabling)
+    int timeout;
+    //! Least and most recently active indexed streams
+    rtp_stream_t *activity_first, *activity_last;
+};
+
 struct rtcp_hdr_generic
 {
     //! version (V): 2 bits
@@ -273,6 +365,9 @@ struct rtcp_blk_xr_voip
     uint16_t jbadelay;
 };
 
+/**
+ * @brief Allocate a new stream in the memory of its media call
+ */
 rtp_stream_t *
 stream_create(sdp_media_t *media, address_t dst, int type);
 
@@ -288,6 +383,74 @@ stream_add_packet(rtp_stream_t *stream, packet_t *packet);
 uint32_t
 stream_get_count(rtp_stream_t *stream);
 
+/**
+ * @brief Update stream quality counters with a received RTP packet
+ *
+ * Must be called before the packet is added to the stream.
+ */
+void
+stream_update_stats(rtp_stream_t *stream, packet_t *packet);
+
+/**
+ * @brief Get number of packets expected from received sequence numbers
+ */
+uint32_t
+stream_get_expected(rtp_stream_t *stream);
+
+/**
+ * @brief Get number of lost packets (never negative)
+ */
+uint32_t
+stream_get_lost(rtp_stream_t *stream);
+
+/**
+ * @brief Get percentage of lost packets
+ */
+float
+stream_get_loss(rtp_stream_t *stream);
+
+/**
+ * @brief Get interarrival jitter in milliseconds
+ */
+float
+stream_get_jitter(rtp_stream_t *stream);
+
+/**
+ * @brief Estimate listening MOS from stream loss and jitter
+ *
+ * Uses a simplified E-model where delay is derived from jitter.
+ *
+ * @return MOS between 1.0 and 4.5
+ */
+float
+stream_get_mos(rtp_stream_t *stream);
+
+/**
+ * @brief Keep a packet in the stream ring of last received packets
+ *
+ * When the ring is full, the oldest packet is destroyed. Kept packets
+ * are owned by the stream until stream_clear_samples is called.
+ *
+ * @param stream Stream the packet belongs to
+ * @param packet RTP packet
+ * @param max Number of packets of the ring
+ * @return 0 if packet has been kept, 1 otherwise
+ */
+int
+stream_add_sample(rtp_stream_t *stream, packet_t *packet, uint32_t max);
+
+/**
+ * @brief Get number of packets kept in the stream ring
+ */
+uint32_t
+stream_sample_count(rtp_stream_t *stream);
+
+/**
+ * @brief Destroy all packets kept in the stream ring
+ */
+void
+stream_clear_samples(rtp_stream_t *stream);
+
 struct sip_call *
 stream_get_call(rtp_stream_t *stream);
 
@@ -312,6 +475,112 @@ rtp_find_call_stream(struct sip_call *call, address_t src, address_t dst);
 rtp_stream_t *
 rtp_find_call_exact_stream(struct sip_call *call, address_t src, address_t dst);
 
+/**
+ * @brief Add a stream to the streams index
+ *
+ * Stream must already be stored in its call.
+ *
+ * @return 0 if stream has been indexed, 1 on memory error
+ */
+int
+rtp_index_add(rtp_stream_t *stream);
+
+/**
+ * @brief Link a stream in its destination bucket
+ *
+ * Stream is placed before the first stream it precedes.
+ */
+void
+rtp_index_link(rtp_stream_t **buckets, uint32_t size, rtp_stream_t *stream);
+
+/**
+ * @brief Remove a stream from the streams index
+ */
+void
+rtp_index_remove(rtp_stream_t *stream);
+
+/**
+ * @brief Get the first stream of the bucket for a destination
+ *
+ * Following streams are linked through index_next and may have other
+ * destinations.
+ */
+rtp_stream_t *
+rtp_index_first(address_t dst);
+
+/**
+ * @brief Move all indexed streams to a new bucket array
+ *
+ * @param size new number of buckets (power of two)
+ * @return 0 on success, 1 on memory error
+ */
+int
+rtp_index_resize(uint32_t size);
+
+/**
+ * @brief Release streams index memory
+ */
+void
+rtp_index_destroy();
+
+/**
+ * @brief Set seconds without packets before indexed streams expire
+ */
+void
+rtp_index_set_timeout(int timeout);
+
+/**
+ * @brief Get number of indexed streams and streams indexed since start
+ *
+ * Callers must be holding capture lock
+ */
+void
+rtp_index_stats(uint32_t *count, unsigned long *added);
+
+/**
+ * @brief Get distinct destinations of indexed streams
+ *
+ * Callers must be holding capture lock
+ *
+ * @param out array where destinations are stored
+ * @param max size of out array
+ * @return number of destinations or -1 if there are more than max
+ */
+int
+rtp_index_destinations(address_t *out, int max);
+
+/**
+ * @brief Mark an indexed stream as the most recently active
+ */
+void
+rtp_index_touch(rtp_stream_t *stream, time_t now);
+
+/**
+ * @brief Remove from the index streams without activity since timeout
+ *
+ * Expired streams keep their data and counters, but they no longer
+ * receive packets. Streams are checked from the least recently active,
+ * so only expired ones are visited. Incomplete streams of calls still
+ * being setup are waiting for media and don't expire.
+ */
+void
+rtp_index_expire(time_t now);
+
+/**
+ * @brief Check if stream can still receive packets
+ */
+bool
+stream_is_indexed(rtp_stream_t *stream);
+
+/**
+ * @brief Check if a stream would be found before other one
+ *
+ * Streams of newer calls come first, and inside the same call, the
+ * last added ones.
+ */
+int
+stream_index_precedes(rtp_stream_t *one, rtp_stream_t *two);
+
 /**
  * @brief Check if a message is older than other
  *
@@ -44,19 +44,62 @@ setting_t settings[SETTING_COUNT] = {
     { SETTING_ALTKEY_HINT,        "hintkeyalt",         SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
     { SETTING_EXITPROMPT,         "exitprompt",         SETTING_FMT_ENUM,    SETTING_ON,  SETTING_ENUM_ONOFF },
     { SETTING_CAPTURE_LIMIT,      "capture.limit",      SETTING_FMT_NUMBER,  "20000",     NULL },
+    { SETTING_CAPTURE_LIMIT_MEMORY, "capture.limit.memory", SETTING_FMT_STRING, "0",       NULL },
+    { SETTING_CAPTURE_EXPIRE,     "capture.expire",     SETTING_FMT_NUMBER,  "0",         NULL },
+    { SETTING_CAPTURE_EXPIRE_TERMINATED, "capture.expire.terminated", SETTING_FMT_NUMBER, "0", NULL },
     { SETTING_CAPTURE_DEVICE,     "capture.device",     SETTING_FMT_STRING,  "any",       NULL },
     { SETTING_CAPTURE_OUTFILE,    "capture.outfile",    SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_CAPTURE_OUTFILE_QUEUE, "capture.outfile.queue", SETTING_FMT_NUMBER, "65536",  NULL },
+    { SETTING_CAPTURE_OUTFILE_SIZE, "capture.outfile.size", SETTING_FMT_NUMBER, "0",        NULL },
+    { SETTING_CAPTURE_OUTFILE_INTERVAL, "capture.outfile.interval", SETTING_FMT_NUMBER, "0", NULL },
+    { SETTING_CAPTURE_OUTFILE_FILES, "capture.outfile.files", SETTING_FMT_NUMBER, "0",      NULL },
+    { SETTING_CAPTURE_OUTFILE_FORMAT, "capture.outfile.format", SETTING_FMT_ENUM, "pcap",   SETTING_ENUM_FILEFORMAT },
     { SETTING_CAPTURE_BUFFER,     "capture.buffer",     SETTING_FMT_NUMBER,  "2",         NULL },
+    { SETTING_CAPTURE_RINGSIZE,   "capture.ringsize",   SETTING_FMT_NUMBER,  "8192",      NULL },
+    { SETTING_CAPTURE_BATCH,      "capture.batch",      SETTING_FMT_NUMBER,  "64",        NULL },
+    { SETTING_CAPTURE_REASM_TIMEOUT, "capture.reasm.timeout", SETTING_FMT_NUMBER, "30",    NULL },
+    { SETTING_CAPTURE_REASM_MEMORY, "capture.reasm.memory", SETTING_FMT_NUMBER, "4096",    NULL },
+    { SETTING_CAPTURE_TCP_TIMEOUT, "capture.tcp.timeout", SETTING_FMT_NUMBER,  "60",        NULL },
+    { SETTING_CAPTURE_TCP_MEMORY, "capture.tcp.memory",   SETTING_FMT_NUMBER,  "8192",      NULL },
+    { SETTING_CAPTURE_OFFLINE_WORKERS, "capture.offline.workers", SETTING_FMT_NUMBER, "0",    NULL },
+    { SETTING_CAPTURE_OFFLINE_INDEX, "capture.offline.index", SETTING_FMT_ENUM, SETTING_OFF,  SETTING_ENUM_ONOFF },
+    { SETTING_CAPTURE_OFFLINE_LAZY, "capture.offline.lazy", SETTING_FMT_ENUM, SETTING_OFF,  SETTING_ENUM_ONOFF },
+    { SETTING_CAPTURE_OFFLINE_READAHEAD, "capture.offline.readahead", SETTING_FMT_NUMBER, "32", NULL },
+    { SETTING_CAPTURE_REPLAY,     "capture.replay",     SETTING_FMT_STRING,  "",          NULL },
+#ifdef USE_TPACKET
+    { SETTING_CAPTURE_BACKEND,    "capture.backend",    SETTING_FMT_ENUM,    "pcap",      SETTING_ENUM_BACKEND },
+    { SETTING_CAPTURE_TPACKET_BLOCKSIZE, "capture.tpacket.blocksize", SETTING_FMT_NUMBER, "1024", NULL },
+    { SETTING_CAPTURE_TPACKET_BLOCKS, "capture.tpacket.blocks", SETTING_FMT_NUMBER, "64", NULL },
+    { SETTING_CAPTURE_TPACKET_FANOUT, "capture.tpacket.fanout", SETTING_FMT_NUMBER, "1", NULL },
+#endif
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
     { SETTING_CAPTURE_KEYFILE,    "capture.keyfile",    SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_CAPTURE_KEYLOGFILE, "capture.keylogfile", SETTING_FMT_STRING,  "",          NULL },
     { SETTING_CAPTURE_TLSSERVER,  "capture.tlsserver",  SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_CAPTURE_TLS_TIMEOUT, "capture.tls.timeout", SETTING_FMT_NUMBER, "3600",      NULL },
+    { SETTING_CAPTURE_TLS_WORKERS, "capture.tls.workers", SETTING_FMT_NUMBER, "2",         NULL },
 #endif
     { SETTING_CAPTURE_RTP,        "capture.rtp",        SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
+    { SETTING_CAPTURE_RTP_GRACE,  "capture.rtp.grace",  SETTING_FMT_NUMBER,  "5",         NULL },
+    { SETTING_CAPTURE_RTP_SAMPLES, "capture.rtp.samples", SETTING_FMT_NUMBER, "0",         NULL },
+    { SETTING_CAPTURE_RTP_TIMEOUT, "capture.rtp.timeout", SETTING_FMT_NUMBER, "60",        NULL },
+    { SETTING_CAPTURE_RTP_FILTER, "capture.rtp.filter",   SETTING_FMT_NUMBER,  "0",         NULL },
+    { SETTING_CAPTURE_SNAPSHOT,   "capture.snapshot",   SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_CAPTURE_SNAPSHOT_INTERVAL, "capture.snapshot.interval", SETTING_FMT_NUMBER, "0", NULL },
     { SETTING_CAPTURE_STORAGE,    "capture.storage",    SETTING_FMT_ENUM,    "memory",    SETTING_ENUM_STORAGE },
+    { SETTING_CAPTURE_STORAGE_PATH, "capture.storage.path", SETTING_FMT_STRING, "",         NULL },
+    { SETTING_CAPTURE_STORAGE_SEGMENT, "capture.storage.segment", SETTING_FMT_NUMBER, "64", NULL },
+    { SETTING_CAPTURE_STORAGE_CACHE, "capture.storage.cache", SETTING_FMT_NUMBER, "1024",   NULL },
     { SETTING_CAPTURE_ROTATE,     "capture.rotate",     SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
     { SETTING_SIP_NOINCOMPLETE,   "sip.noincomplete",   SETTING_FMT_ENUM,    SETTING_ON,  SETTING_ENUM_ONOFF },
     { SETTING_SIP_HEADER_X_CID,   "sip.xcid",           SETTING_FMT_STRING,  "X-Call-ID|X-CID", NULL },
     { SETTING_SIP_CALLS,          "sip.calls",          SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
+    { SETTING_SIP_AGGREGATE,      "sip.aggregate",      SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_SIP_SAMPLE,         "sip.sample",         SETTING_FMT_NUMBER,  "1",         NULL },
+    { SETTING_SIP_SAMPLE_PRIORITY, "sip.sample.priority", SETTING_FMT_STRING, "",         NULL },
+    { SETTING_SIP_SAMPLE_COUNTONLY, "sip.sample.countonly", SETTING_FMT_ENUM, SETTING_OFF, SETTING_ENUM_ONOFF },
+    { SETTING_SIP_EXPORT,         "sip.export",         SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_SIP_EXPORT_SLOTS,   "sip.export.slots",   SETTING_FMT_NUMBER,  "4096",      NULL },
     { SETTING_SAVEPATH,           "savepath",           SETTING_FMT_STRING,  "",          NULL },
     { SETTING_DISPLAY_ALIAS,      "displayalias",       SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
     { SETTING_ALIAS_PORT,         "aliasport",          SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
@@ -79,7 +122,24 @@ setting_t settings[SETTING_COUNT] = {
     { SETTING_CR_SCROLLSTEP,      "cr.scrollstep",      SETTING_FMT_NUMBER,  "10",        NULL },
     { SETTING_CR_NON_ASCII,       "cr.nonascii",        SETTING_FMT_STRING,  ".",        NULL },
     { SETTING_FILTER_PAYLOAD,     "filter.payload",     SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_FILTER_PAYLOAD_INDEX, "filter.payload.index", SETTING_FMT_ENUM, SETTING_OFF, SETTING_ENUM_ONOFF },
     { SETTING_FILTER_METHODS,     "filter.methods",     SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_FILTER_WORKERS,     "filter.workers",     SETTING_FMT_NUMBER,  "0",         NULL },
+    { SETTING_EVENTS_OUTPUT,      "events.output",      SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_EVENTS_FORMAT,      "events.format",      SETTING_FMT_ENUM,    "json",      SETTING_ENUM_EVENTFORMAT },
+    { SETTING_EVENTS_MESSAGES,    "events.messages",    SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
+    { SETTING_EVENTS_FIELDS,      "events.fields",      SETTING_FMT_STRING,  "callid,sipfrom,sipto,src,dst,method,state,convdur,totaldur,reason", NULL },
+    { SETTING_METRICS_MODE,       "metrics.mode",       SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_METRICS },
+    { SETTING_METRICS_ADDR,       "metrics.address",    SETTING_FMT_STRING,  "127.0.0.1", NULL },
+    { SETTING_METRICS_PORT,       "metrics.port",       SETTING_FMT_NUMBER,  "0",         NULL },
+    { SETTING_METRICS_INTERVAL,   "metrics.interval",   SETTING_FMT_NUMBER,  "10",        NULL },
+    { SETTING_METRICS_PREFIX,     "metrics.prefix",     SETTING_FMT_STRING,  "sngrep",    NULL },
+    { SETTING_AFFINITY_CAPTURE,   "affinity.capture",   SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_AFFINITY_PRIORITY,  "affinity.capture.priority", SETTING_FMT_NUMBER, "0",    NULL },
+    { SETTING_AFFINITY_PARSER,    "affinity.parser",    SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_AFFINITY_WRITER,    "affinity.writer",    SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_AFFINITY_EEP,       "affinity.eep",       SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_AFFINITY_UI,        "affinity.ui",        SETTING_FMT_STRING,  "",          NULL },
 #ifdef USE_EEP
     { SETTING_EEP_SEND,           "eep.send",           SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
     { SETTING_EEP_SEND_VER,       "eep.send.version",   SETTING_FMT_ENUM,    "3",         SETTING_ENUM_HEPVERSION },
@@ -87,12 +147,18 @@ setting_t settings[SETTING_COUNT] = {
     { SETTING_EEP_SEND_PORT,      "eep.send.port",      SETTING_FMT_NUMBER,  "9060",      NULL },
     { SETTING_EEP_SEND_PASS,      "eep.send.pass",      SETTING_FMT_STRING,  "",          NULL },
     { SETTING_EEP_SEND_ID,        "eep.send.id",        SETTING_FMT_NUMBER,  "2002",      NULL },
+    { SETTING_EEP_SEND_QUEUE,     "eep.send.queue",     SETTING_FMT_NUMBER,  "1024",      NULL },
+    { SETTING_EEP_SEND_PROTO,     "eep.send.proto",     SETTING_FMT_ENUM,    "udp",       SETTING_ENUM_EEPPROTO },
+    { SETTING_EEP_SEND_SPOOL,     "eep.send.spool",     SETTING_FMT_NUMBER,  "4096",      NULL },
     { SETTING_EEP_LISTEN,         "eep.listen",         SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
     { SETTING_EEP_LISTEN_VER,     "eep.listen.version", SETTING_FMT_ENUM,    "3",         SETTING_ENUM_HEPVERSION },
     { SETTING_EEP_LISTEN_ADDR,    "eep.listen.address", SETTING_FMT_STRING,  "0.0.0.0",   NULL },
     { SETTING_EEP_LISTEN_PORT,    "eep.listen.port",    SETTING_FMT_NUMBER,  "9060",      NULL },
     { SETTING_EEP_LISTEN_PASS,    "eep.listen.pass",    SETTING_FMT_STRING,  "",          NULL },
     { SETTING_EEP_LISTEN_UUID,    "eep.listen.uuid",    SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
+    { SETTING_EEP_LISTEN_BATCH,   "eep.listen.batch",   SETTING_FMT_NUMBER,  "64",        NULL },
+    { SETTING_EEP_LISTEN_RCVBUF,  "eep.listen.rcvbuf",  SETTING_FMT_NUMBER,  "4096",      NULL },
+    { SETTING_EEP_LISTEN_THREADS, "eep.listen.threads", SETTING_FMT_NUMBER,  "1",         NULL },
 #endif
 };
 
@@ -58,9 +58,14 @@ typedef struct setting_option setting_t;
 #define SETTING_ENUM_COLORMODE   (const char *[]){ "request", "cseq", "callid", NULL }
 #define SETTING_ENUM_HIGHLIGHT   (const char *[]){ "bold", "reverse", "reversebold", NULL }
 #define SETTING_ENUM_SDP_INFO    (const char *[]){ "off", "first", "full", "compressed", NULL}
-#define SETTING_ENUM_STORAGE     (const char *[]){ "none", "memory", NULL }
+#define SETTING_ENUM_STORAGE     (const char *[]){ "none", "memory", "disk", "compressed", NULL }
 #define SETTING_ENUM_HEPVERSION  (const char *[]){ "2", "3", NULL }
+#define SETTING_ENUM_BACKEND     (const char *[]){ "pcap", "tpacket", NULL }
 #define SETTING_ENUM_MEDIA       (const char *[]){ "off", "on", "active", NULL }
+#define SETTING_ENUM_FILEFORMAT  (const char *[]){ "pcap", "pcapng", NULL }
+#define SETTING_ENUM_EEPPROTO    (const char *[]){ "udp", "tcp", "tls", NULL }
+#define SETTING_ENUM_EVENTFORMAT (const char *[]){ "json", "csv", NULL }
+#define SETTING_ENUM_METRICS     (const char *[]){ "off", "prometheus", "statsd", NULL }
 
 //! Other useful defines
 #define SETTING_ON  "on"
@@ -80,19 +85,62 @@ enum setting_id {
     SETTING_ALTKEY_HINT,
     SETTING_EXITPROMPT,
     SETTING_CAPTURE_LIMIT,
+    SETTING_CAPTURE_LIMIT_MEMORY,
+    SETTING_CAPTURE_EXPIRE,
+    SETTING_CAPTURE_EXPIRE_TERMINATED,
     SETTING_CAPTURE_DEVICE,
     SETTING_CAPTURE_OUTFILE,
+    SETTING_CAPTURE_OUTFILE_QUEUE,
+    SETTING_CAPTURE_OUTFILE_SIZE,
+    SETTING_CAPTURE_OUTFILE_INTERVAL,
+    SETTING_CAPTURE_OUTFILE_FILES,
+    SETTING_CAPTURE_OUTFILE_FORMAT,
     SETTING_CAPTURE_BUFFER,
+    SETTING_CAPTURE_RINGSIZE,
+    SETTING_CAPTURE_BATCH,
+    SETTING_CAPTURE_REASM_TIMEOUT,
+    SETTING_CAPTURE_REASM_MEMORY,
+    SETTING_CAPTURE_TCP_TIMEOUT,
+    SETTING_CAPTURE_TCP_MEMORY,
+    SETTING_CAPTURE_OFFLINE_WORKERS,
+    SETTING_CAPTURE_OFFLINE_INDEX,
+    SETTING_CAPTURE_OFFLINE_LAZY,
+    SETTING_CAPTURE_OFFLINE_READAHEAD,
+    SETTING_CAPTURE_REPLAY,
+#ifdef USE_TPACKET
+    SETTING_CAPTURE_BACKEND,
+    SETTING_CAPTURE_TPACKET_BLOCKSIZE,
+    SETTING_CAPTURE_TPACKET_BLOCKS,
+    SETTING_CAPTURE_TPACKET_FANOUT,
+#endif
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
     SETTING_CAPTURE_KEYFILE,
+    SETTING_CAPTURE_KEYLOGFILE,
     SETTING_CAPTURE_TLSSERVER,
+    SETTING_CAPTURE_TLS_TIMEOUT,
+    SETTING_CAPTURE_TLS_WORKERS,
 #endif
     SETTING_CAPTURE_RTP,
+    SETTING_CAPTURE_RTP_GRACE,
+    SETTING_CAPTURE_RTP_SAMPLES,
+    SETTING_CAPTURE_RTP_TIMEOUT,
+    SETTING_CAPTURE_RTP_FILTER,
+    SETTING_CAPTURE_SNAPSHOT,
+    SETTING_CAPTURE_SNAPSHOT_INTERVAL,
     SETTING_CAPTURE_STORAGE,
+    SETTING_CAPTURE_STORAGE_PATH,
+    SETTING_CAPTURE_STORAGE_SEGMENT,
+    SETTING_CAPTURE_STORAGE_CACHE,
     SETTING_CAPTURE_ROTATE,
     SETTING_SIP_NOINCOMPLETE,
     SETTING_SIP_HEADER_X_CID,
     SETTING_SIP_CALLS,
+    SETTING_SIP_AGGREGATE,
+    SETTING_SIP_SAMPLE,
+    SETTING_SIP_SAMPLE_PRIORITY,
+    SETTING_SIP_SAMPLE_COUNTONLY,
+    SETTING_SIP_EXPORT,
+    SETTING_SIP_EXPORT_SLOTS,
     SETTING_SAVEPATH,
     SETTING_DISPLAY_ALIAS,
     SETTING_ALIAS_PORT,
@@ -115,7 +163,24 @@ enum setting_id {
     SETTING_CR_SCROLLSTEP,
     SETTING_CR_NON_ASCII,
     SETTING_FILTER_PAYLOAD,
+    SETTING_FILTER_PAYLOAD_INDEX,
     SETTING_FILTER_METHODS,
+    SETTING_FILTER_WORKERS,
+    SETTING_EVENTS_OUTPUT,
+    SETTING_EVENTS_FORMAT,
+    SETTING_EVENTS_MESSAGES,
+    SETTING_EVENTS_FIELDS,
+    SETTING_METRICS_MODE,
+    SETTING_METRICS_ADDR,
+    SETTING_METRICS_PORT,
+    SETTING_METRICS_INTERVAL,
+    SETTING_METRICS_PREFIX,
+    SETTING_AFFINITY_CAPTURE,
+    SETTING_AFFINITY_PRIORITY,
+    SETTING_AFFINITY_PARSER,
+    SETTING_AFFINITY_WRITER,
+    SETTING_AFFINITY_EEP,
+    SETTING_AFFINITY_UI,
 #ifdef USE_EEP
     SETTING_EEP_SEND,
     SETTING_EEP_SEND_VER,
@@ -123,12 +188,18 @@ enum setting_id {
     SETTING_EEP_SEND_PORT,
     SETTING_EEP_SEND_PASS,
     SETTING_EEP_SEND_ID,
+    SETTING_EEP_SEND_QUEUE,
+    SETTING_EEP_SEND_PROTO,
+    SETTING_EEP_SEND_SPOOL,
     SETTING_EEP_LISTEN,
     SETTING_EEP_LISTEN_VER,
     SETTING_EEP_LISTEN_ADDR,
     SETTING_EEP_LISTEN_PORT,
     SETTING_EEP_LISTEN_PASS,
     SETTING_EEP_LISTEN_UUID,
+    SETTING_EEP_LISTEN_BATCH,
+    SETTING_EEP_LISTEN_RCVBUF,
+    SETTING_EEP_LISTEN_THREADS,
 #endif
     SETTING_COUNT
 };
@@ -28,14 +28,23 @@
 #include "config.h"
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <time.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include "sip.h"
+#include "sip_scan.h"
+#include "sip_aggregate.h"
+#include "sip_column.h"
+#include "intern.h"
 #include "option.h"
 #include "setting.h"
 #include "filter.h"
+#include "event.h"
 
 /**
  * @brief Linked list of parsed calls
@@ -138,23 +147,35 @@ sip_code_t sip_codes[] = {
 };
 
 void
-sip_init(int limit, int only_calls, int no_incomplete)
+sip_init(int limit, size_t memory_limit, int only_calls, int no_incomplete)
 {
-    int match_flags, reg_rule_len, reg_rule_err;
-    char reg_rule[SIP_ATTR_MAXLEN];
-    const char *setting = NULL;
-
     // Store capture limit
     calls.limit = limit;
+    calls.memory_limit = memory_limit;
+    calls.expire = setting_get_intvalue(SETTING_CAPTURE_EXPIRE);
+    calls.expire_terminated = setting_get_intvalue(SETTING_CAPTURE_EXPIRE_TERMINATED);
+    calls.media_grace = setting_get_intvalue(SETTING_CAPTURE_RTP_GRACE);
+    rtp_index_set_timeout(setting_get_intvalue(SETTING_CAPTURE_RTP_TIMEOUT));
     calls.only_calls = only_calls;
     calls.ignore_incomplete = no_incomplete;
     calls.last_index = 0;
 
+    // Create a pipe to notify interface about changes
+    if (pipe(calls.notify) == 0) {
+        fcntl(calls.notify[0], F_SETFL, fcntl(calls.notify[0], F_GETFL) | O_NONBLOCK);
+        fcntl(calls.notify[1], F_SETFL, fcntl(calls.notify[1], F_GETFL) | O_NONBLOCK);
+    } else {
+        calls.notify[0] = calls.notify[1] = -1;
+    }
+    atomic_init(&calls.notified, false);
+
     // Create a vector to store calls
     calls.list = vector_create(200, 50);
     vector_set_destroyer(calls.list, call_destroyer);
     vector_set_sorter(calls.list, sip_list_sorter);
     calls.active = vector_create(10, 10);
+    calls.displayed = vector_create(200, 50);
+    vector_set_sorter(calls.displayed, sip_list_sorter);
 
     // Create hash table for callid search
     calls.callids = htable_create(calls.limit);
@@ -169,39 +190,27 @@ sip_init(int limit, int only_calls, int no_incomplete)
         calls.sort.asc = true;
     }
 
-    // Initialize payload parsing regexp
-    match_flags = REG_EXTENDED | REG_ICASE | REG_NEWLINE;
-    regcomp(&calls.reg_method, "^([a-zA-Z]+) [a-zA-Z]+:.+ SIP/2.0[ ]*\r", match_flags & ~REG_NEWLINE);
-    regcomp(&calls.reg_callid, "^(Call-ID|i):[ ]*([^ ]+)[ ]*\r$", match_flags);
-    setting = setting_get_value(SETTING_SIP_HEADER_X_CID);
-    reg_rule_len = strlen(setting) + 22;
-    if (reg_rule_len >= SIP_ATTR_MAXLEN) {
-        setting = "X-Call-ID|X-CID";
-        reg_rule_len = strlen(setting) + 22;
+    // Use the fastest header scanning functions
+    sip_scan_init();
+
+    // Set the headers linking dialogs
+    if (sip_header_set_xcallid(setting_get_value(SETTING_SIP_HEADER_X_CID)) != 0) {
         fprintf(stderr, "%s setting too long, using default.\n",
             setting_name(SETTING_SIP_HEADER_X_CID));
+        sip_header_set_xcallid(SIP_HEADER_XCALLID_DEFAULT);
     }
-    snprintf(reg_rule, reg_rule_len, "^(%s):[ ]*([^ ]+)[ ]*\r$", setting);
-    reg_rule_err = regcomp(&calls.reg_xcallid, reg_rule, match_flags);
-    if(reg_rule_err != 0) {
-        regerror(reg_rule_err, &calls.reg_xcallid, reg_rule, SIP_ATTR_MAXLEN);
-        regfree(&calls.reg_xcallid);
-        fprintf(stderr, "%s setting produces regex compilation error: %s"
-            "using default value instead\n",
-            setting_name(SETTING_SIP_HEADER_X_CID), reg_rule);
-        regcomp(&calls.reg_xcallid,
-            "^(X-Call-ID|X-CID):[ ]*([^ ]+)[ ]*\r$", match_flags);
-    }
-    regcomp(&calls.reg_response, "^SIP/2.0[ ]*(([0-9]{3}) [^\r]*)[ ]*\r", match_flags & ~REG_NEWLINE);
-    regcomp(&calls.reg_cseq, "^CSeq:[ ]*([0-9]{1,10}) .+\r$", match_flags);
-    regcomp(&calls.reg_from, "^(From|f):[ ]*[^:]*:(([^@>]+)@?[^\r>;]+)", match_flags);
-    regcomp(&calls.reg_to, "^(To|t):[ ]*[^:]*:(([^@>]+)@?[^\r>;]+)", match_flags);
-    regcomp(&calls.reg_valid, "^([A-Z]+ [a-zA-Z]+:|SIP/2.0 [0-9]{3})", match_flags & ~REG_NEWLINE);
-    regcomp(&calls.reg_cl, "^(Content-Length|l):[ ]*([0-9]+)[ ]*\r$", match_flags);
-    regcomp(&calls.reg_body, "\r\n\r\n(.*)", match_flags & ~REG_NEWLINE);
-    regcomp(&calls.reg_reason, "Reason:[ ]*[^\r]*;text=\"([^\r]+)\"", match_flags);
-    regcomp(&calls.reg_warning, "Warning:[ ]*([0-9]*)", match_flags);
 
+    // Set dialogs that are only counted by address and method
+    if (sip_aggregate_init(setting_get_value(SETTING_SIP_AGGREGATE)) != 0) {
+        fprintf(stderr, "Invalid %s methods, all dialogs will be stored.\n",
+            setting_name(SETTING_SIP_AGGREGATE));
+    }
+
+    // Configure which new dialogs are stored
+    if (sip_sample_init() != 0) {
+        fprintf(stderr, "Unable to load %s patterns, all dialogs will be stored.\n",
+            setting_name(SETTING_SIP_SAMPLE_PRIORITY));
+    }
 }
 
 void
@@ -209,112 +218,132 @@ sip_deinit()
 {
     // Remove all calls
     sip_calls_clear();
+    // Remove streams index
+    rtp_index_destroy();
     // Remove Call-id hash table
     htable_destroy(calls.callids);
     // Remove calls vector
     vector_destroy(calls.list);
     vector_destroy(calls.active);
-    // Deallocate regular expressions
-    regfree(&calls.reg_method);
-    regfree(&calls.reg_callid);
-    regfree(&calls.reg_xcallid);
-    regfree(&calls.reg_response);
-    regfree(&calls.reg_cseq);
-    regfree(&calls.reg_from);
-    regfree(&calls.reg_to);
-    regfree(&calls.reg_valid);
-    regfree(&calls.reg_cl);
-    regfree(&calls.reg_body);
-    regfree(&calls.reg_reason);
-    regfree(&calls.reg_warning);
+    vector_destroy(calls.displayed);
+    // Remove shared strings
+    intern_clear();
+    // Remove attribute columns
+    sip_column_clear();
+    // Remove match patterns
+    match_destroy(calls.match_patterns);
+    // Remove keepalive counters
+    sip_aggregate_deinit();
+    // Remove sampling data
+    sip_sampler_deinit(&calls.sampler);
+    // Remove changes notification pipe
+    if (calls.notify[0] != -1) {
+        close(calls.notify[0]);
+        close(calls.notify[1]);
+    }
 }
 
 
 char *
 sip_get_callid(const char* payload, char *callid)
 {
-    regmatch_t pmatch[3];
+    sip_header_table_t headers;
 
     // Try to get Call-ID from payload
-    if (regexec(&calls.reg_callid, payload, 3, pmatch, 0) == 0) {
-        // Copy the matching part of payload
-        strncpy(callid, payload + pmatch[2].rm_so, (int) pmatch[2].rm_eo - pmatch[2].rm_so);
-    }
-
-    return callid;
+    sip_header_parse(&headers, payload, strlen(payload));
+    return sip_header_copy_token(&headers.headers[SIP_HEADER_CALLID], callid);
 }
 
 char *
 sip_get_xcallid(const char *payload, char *xcallid)
 {
-    regmatch_t pmatch[3];
+    sip_header_table_t headers;
 
     // Try to get X-Call-ID from payload
-    if (regexec(&calls.reg_xcallid, (const char *)payload, 3, pmatch, 0) == 0) {
-        strncpy(xcallid, (const char *)payload +  pmatch[2].rm_so, (int)pmatch[2].rm_eo - pmatch[2].rm_so);
+    sip_header_parse(&headers, payload, strlen(payload));
+    return sip_header_copy_token(&headers.headers[SIP_HEADER_XCALLID], xcallid);
+}
+
+int
+sip_validate_packet(packet_t *packet)
+{
+    sip_validate_state_t state = { };
+    uint32_t msglen;
+    u_char *payload;
+    int valid;
+
+    valid = sip_validate_payload(packet_payload(packet), packet_payloadlen(packet), &state, &msglen);
+
+    // We got more than one SIP message in the same packet
+    if (valid == VALIDATE_MULTIPLE_SIP) {
+        // Only keep the first message (current payload is freed when replaced)
+        payload = sng_malloc(msglen);
+        memcpy(payload, packet_payload(packet), msglen);
+        packet_set_payload(packet, payload, msglen);
+        sng_free(payload);
     }
 
-    return xcallid;
+    return valid;
 }
 
 int
-sip_validate_packet(packet_t *packet)
+sip_validate_payload(const u_char *payload, uint32_t len, sip_validate_state_t *state, uint32_t *msglen)
 {
-    uint32_t plen = packet_payloadlen(packet);
-    u_char payload[MAX_SIP_PAYLOAD];
-    regmatch_t pmatch[3];
-    char cl_header[10];
-    int content_len;
-    int bodylen;
+    sip_header_table_t headers;
+    uint32_t cl_len;
+    const char *body;
 
     // Max SIP payload allowed
-    if (plen == 0 || plen > MAX_SIP_PAYLOAD)
+    if (len == 0 || len > MAX_SIP_PAYLOAD)
         return VALIDATE_NOT_SIP;
 
-    // Get payload from packet(s)
-    memset(payload, 0, MAX_SIP_PAYLOAD);
-    memcpy(payload, packet_payload(packet), plen);
+    // Look for the end of SIP headers
+    if (state->hdrlen == 0) {
+        // Check if the first line follows SIP request or response format
+        if (state->scan == 0 && sip_header_check_start((const char *) payload, len) != 0) {
+            // Not a SIP message AT ALL
+            return VALIDATE_NOT_SIP;
+        }
 
-    // Initialize variables
-    memset(cl_header, 0, sizeof(cl_header));
+        // Body separator could have started in the already searched data
+        body = sip_scan_end_of_headers((const char *) payload + (state->scan > 3 ? state->scan - 3 : 0),
+                                       (const char *) payload + len);
+        state->scan = len;
 
-    // Check if the first line follows SIP request or response format
-    if (regexec(&calls.reg_valid, (const char *) payload, 2, pmatch, 0) != 0) {
-        // Not a SIP message AT ALL
-        return VALIDATE_NOT_SIP;
-    }
+        // Check if we have Body separator field
+        if (!body) {
+            // Not a SIP message or not complete
+            return VALIDATE_PARTIAL_SIP;
+        }
 
-    // Check if we have Content Length header
-    if (regexec(&calls.reg_cl, (const char *) payload, 4, pmatch, 0) != 0) {
-        // Not a SIP message or not complete
-        return VALIDATE_PARTIAL_SIP;
-    }
+        // Check if we have Content Length header
+        sip_header_parse(&headers, (const char *) payload, (body - (const char *) payload) + 4);
+        if (!(cl_len = sip_header_number(&headers.headers[SIP_HEADER_CONTENT_LENGTH]))) {
+            // Not a SIP message or not complete
+            return VALIDATE_PARTIAL_SIP;
+        }
 
-    strncpy(cl_header, (const char *)payload +  pmatch[2].rm_so, (int)pmatch[2].rm_eo - pmatch[2].rm_so);
-    content_len = atoi(cl_header);
+        // Content-Length value is too big
+        if (cl_len >= 10)
+            return VALIDATE_NOT_SIP;
 
-    // Check if we have Body separator field
-    if (regexec(&calls.reg_body, (const char *) payload, 2, pmatch, 0) != 0) {
-        // Not a SIP message or not complete
-        return VALIDATE_PARTIAL_SIP;
+        state->content_len = atoi(headers.headers[SIP_HEADER_CONTENT_LENGTH].value);
+        state->hdrlen = (body - (const char *) payload) + 4;
     }
 
-    // Get the SIP message body length
-    bodylen = (int) pmatch[1].rm_eo - pmatch[1].rm_so;
-
     // The SDP body of the SIP message ends in another packet
-    if (content_len > bodylen) {
+    *msglen = state->hdrlen + state->content_len;
+    if (*msglen > len) {
         return VALIDATE_PARTIAL_SIP;
     }
 
-    if (content_len < bodylen) {
+    if (*msglen < len) {
         // Check body ends with '\r\n'
-        if (payload[pmatch[1].rm_so + content_len - 1] != '\n')
+        if (payload[*msglen - 1] != '\n')
             return VALIDATE_NOT_SIP;
-        if (payload[pmatch[1].rm_so + content_len - 2] != '\r')
+        if (payload[*msglen - 2] != '\r')
             return VALIDATE_NOT_SIP;
         // We got more than one SIP message in the same packet
-        packet_set_payload(packet, payload, pmatch[1].rm_so + content_len);
         return VALIDATE_MULTIPLE_SIP;
     }
 
@@ -322,56 +351,99 @@ sip_validate_packet(packet_t *packet)
     return VALIDATE_COMPLETE_SIP;
 }
 
+int
+data_is_sip(const u_char *data, uint32_t len)
+{
+    uint32_t i;
+
+    // Response first line: SIP/2.0 code
+    if (len >= 7 && !strncasecmp((const char *) data, "SIP/2.0", 7))
+        return 0;
+
+    // Request first line: Method sip:
+    for (i = 0; i < len && isalpha(data[i]); i++);
+    if (i > 0 && i + 1 < len && data[i] == ' ' && isalpha(data[i + 1]))
+        return 0;
+
+    // Not a SIP packet
+    return 1;
+}
+
 sip_msg_t *
 sip_check_packet(packet_t *packet)
 {
-    sip_msg_t *msg;
+    sip_msg_t msgdata, *msg = &msgdata, *stored;
     sip_call_t *call;
-    char callid[1024], xcallid[1024];
-    address_t src, dst;
-    u_char payload[MAX_SIP_PAYLOAD];
-    bool newcall = false;
+    const char *payload, *callid = "", *xcallid = "";
+    uint32_t len, callid_len, xcallid_len = 0;
+    sip_header_table_t headers;
+    bool newcall = false, priority = false;
+    uint64_t hash = 0;
+    int state, method, sample = SIP_SAMPLE_STORE;
 
     // Max SIP payload allowed
-    if (packet->payload_len > MAX_SIP_PAYLOAD)
+    if ((len = packet_payloadlen(packet)) > MAX_SIP_PAYLOAD)
         return NULL;
 
-    // Get Addresses from packet
-    src = packet->src;
-    dst = packet->dst;
-
-    // Initialize local variables
-    memset(callid, 0, sizeof(callid));
-    memset(xcallid, 0, sizeof(xcallid));
+    // Packet payload is always followed by a zero byte
+    if (!(payload = (const char *) packet_payload(packet)))
+        return NULL;
 
-    // Get payload from packet(s)
-    memset(payload, 0, MAX_SIP_PAYLOAD);
-    memcpy(payload, packet_payload(packet), packet_payloadlen(packet));
+    // Walk message headers once for all following checks
+    sip_header_parse(&headers, payload, len);
 
     // Get the Call-ID of this message
-    if (!sip_get_callid((const char*) payload, callid))
-        return NULL;
+    if ((callid_len = sip_header_token(&headers.headers[SIP_HEADER_CALLID])))
+        callid = headers.headers[SIP_HEADER_CALLID].value;
 
-    // Create a new message from this data
-    if (!(msg = msg_create((const char*) payload)))
-        return NULL;
+    // Find the call for this msg
+    call = htable_find_len(calls.callids, callid, callid_len);
+
+    // Dialogs not stored by sampling skip the rest of parsing
+    // Priority dialogs are checked first, as remembered Call-IDs can be false positives
+    if (!call && sip_sampler_enabled(&calls.sampler)) {
+        hash = bloom_hash(callid, callid_len);
+        priority = sip_sampler_priority(&calls.sampler, payload, len);
+        if ((sample = sip_sampler_known(&calls.sampler, hash, priority)) == SIP_SAMPLE_DISCARD) {
+            calls.totals.sampled++;
+            return NULL;
+        }
+    }
+
+    // Message data is stored in its call memory once the call is known
+    memset(&msgdata, 0, sizeof(sip_msg_t));
+
+    // Keep headers location for attributes not parsed yet
+    msg_set_headers(msg, &headers, payload);
 
     // Get Method and request for the following checks
     // There is no need to parse all payload at this point
     // If no response or request code is found, this is not a SIP message
-    if (!sip_get_msg_reqresp(msg, payload)) {
-        // Deallocate message memory
+    if (!sip_get_msg_reqresp(msg, &headers)) {
+        // Release message data
         msg_destroy(msg);
         return NULL;
     }
 
-    // Find the call for this msg
-    if (!(call = sip_find_by_callid(callid))) {
+    // Dialogs only counted by sampling are not stored
+    if (!call && sample == SIP_SAMPLE_COUNT) {
+        calls.totals.counted++;
+        goto count_message;
+    }
+
+    if (!call) {
 
         // Check if payload matches expression
-        if (!sip_check_match_expression((const char*) payload))
+        if (!sip_check_match_expression(payload, len))
             goto skip_message;
 
+        // Keepalive dialogs only update their address and method counter
+        if ((method = sip_aggregate_method(&headers))) {
+            sip_aggregate_add(packet, method, msg->reqresp);
+            calls.totals.aggregated++;
+            goto count_message;
+        }
+
         // User requested only INVITE starting dialogs
         if (calls.only_calls && msg->reqresp != SIP_METHOD_INVITE)
             goto skip_message;
@@ -381,15 +453,36 @@ sip_check_packet(packet_t *packet)
         if (calls.ignore_incomplete && msg->reqresp > SIP_METHOD_MESSAGE)
             goto skip_message;
 
-        // Get the Call-ID of this message
-        sip_get_xcallid((const char*) payload, xcallid);
+        // Check if this dialog is stored when sampling
+        if (sip_sampler_enabled(&calls.sampler)) {
+            switch (sip_sampler_check(&calls.sampler, hash, priority, msg->reqresp == SIP_METHOD_INVITE)) {
+                case SIP_SAMPLE_DISCARD:
+                    calls.totals.sampled++;
+                    goto skip_message;
+                case SIP_SAMPLE_COUNT:
+                    calls.totals.counted++;
+                    goto count_message;
+                default:
+                    break;
+            }
+        }
+
+        // Get the X-Call-ID of this message
+        if ((xcallid_len = sip_header_token(&headers.headers[SIP_HEADER_XCALLID]))) {
+            xcallid = headers.headers[SIP_HEADER_XCALLID].value;
+        } else if (packet->hep_cid && (strlen(packet->hep_cid) != callid_len
+                                       || strncmp(packet->hep_cid, callid, callid_len) != 0)) {
+            // HEP correlation id only links this dialog with a related one
+            xcallid = packet->hep_cid;
+            xcallid_len = strlen(xcallid);
+        }
 
         // Rotate call list if limit has been reached
         if (calls.limit == sip_calls_count())
             sip_calls_rotate();
 
         // Create the call if not found
-        if (!(call = call_create(callid, xcallid)))
+        if (!(call = call_create(callid, callid_len, xcallid, xcallid_len)))
             goto skip_message;
 
         // Add this Call-Id to hash table
@@ -402,13 +495,25 @@ sip_check_packet(packet_t *packet)
         newcall = true;
     }
 
+    // Move message data to its call memory
+    if (!(stored = msg_create(call))) {
+        if (newcall) {
+            htable_remove(calls.callids, call->callid);
+            call_destroy(call);
+        }
+        goto skip_message;
+    }
+    *stored = msgdata;
+    msg = stored;
+
     // At this point we know we're handling an interesting SIP Packet
     msg->packet = packet;
+    msg->fingerprint = msg_payload_fingerprint(payload, len);
 
     // Always parse first call message
     if (call_msg_count(call) == 0) {
         // Parse SIP payload
-        sip_parse_msg_payload(msg, payload);
+        sip_parse_msg_payload(msg, &headers);
         // If this call has X-Call-Id, append it to the parent call
         if (strlen(call->xcallid)) {
             call_add_xcall(sip_find_by_callid(call->xcallid), call);
@@ -417,17 +522,31 @@ sip_check_packet(packet_t *packet)
 
     // Add the message to the call
     call_add_message(call, msg);
+    sip_calls_count_msg(msg, 1);
+    if (msg->reqresp >= 100) {
+        calls.totals.responses[(msg->reqresp >= 800) ? 8 : msg->reqresp / 100]++;
+    } else if (msg->reqresp > 0 && msg->reqresp <= SIP_METHOD_PRACK) {
+        calls.totals.methods[msg->reqresp]++;
+    }
 
     // check if message is a retransmission
     call_msg_retrans_check(msg);
 
     if (call_is_invite(call)) {
         // Parse media data
-        sip_parse_msg_media(msg, payload);
+        if (headers.body)
+            sip_parse_msg_media(msg, payload + headers.body, len - headers.body);
         // Update Call State
+        state = call->state;
         call_update_state(call, msg);
+        // Finished calls stop receiving media after a while
+        sip_calls_media_update(call, msg);
+        // Terminated calls can expire sooner
+        sip_calls_schedule(call);
         // Parse extra fields
-        sip_parse_extra_headers(msg, payload);
+        sip_parse_extra_headers(msg, &headers);
+        // Write state transition once reason has been parsed
+        event_call_state(call, msg, state);
         // Check if this call should be in active call list
         if (call_is_active(call)) {
             if (sip_call_is_active(call)) {
@@ -443,21 +562,75 @@ sip_check_packet(packet_t *packet)
     if (newcall) {
         // Append this call to the call list
         vector_append(calls.list, call);
+        calls.counters.dialogs++;
+        calls.counters.states[0]++;
+        calls.totals.dialogs++;
+        // Filters are checked once per call
+        if (filter_check_call(call))
+            vector_append(calls.displayed, call);
     }
 
     // Mark the list as changed
     calls.changed = true;
 
+    // Write message record if requested
+    event_message(msg);
+
     // Return the loaded message
     return msg;
 
+count_message:
+    // Only count message type
+    if (msg->reqresp >= 100) {
+        calls.totals.responses[(msg->reqresp >= 800) ? 8 : msg->reqresp / 100]++;
+    } else if (msg->reqresp > 0 && msg->reqresp <= SIP_METHOD_PRACK) {
+        calls.totals.methods[msg->reqresp]++;
+    }
+
 skip_message:
-    // Deallocate message memory
+    // Release message data
     msg_destroy(msg);
     return NULL;
 
 }
 
+int
+sip_sample_init()
+{
+    int rate = setting_get_intvalue(SETTING_SIP_SAMPLE);
+
+    return sip_sampler_init(&calls.sampler, (rate > 0) ? rate : 0,
+                            setting_enabled(SETTING_SIP_SAMPLE_COUNTONLY),
+                            setting_get_value(SETTING_SIP_SAMPLE_PRIORITY));
+}
+
+void
+sip_calls_notify()
+{
+    // Interface has not read previous notification yet
+    if (calls.notify[1] == -1 || atomic_exchange(&calls.notified, true))
+        return;
+
+    if (write(calls.notify[1], "", 1) != 1)
+        calls.notified = false;
+}
+
+int
+sip_calls_notify_fd()
+{
+    return calls.notify[0];
+}
+
+void
+sip_calls_notify_clear()
+{
+    char buffer[64];
+
+    // Clear flag before draining so no later change is missed
+    calls.notified = false;
+    while (calls.notify[0] != -1 && read(calls.notify[0], buffer, sizeof(buffer)) > 0);
+}
+
 bool
 sip_calls_has_changed()
 {
@@ -502,17 +675,80 @@ sip_active_calls_vector()
     return calls.active;
 }
 
+sip_counters_t
+sip_calls_counters()
+{
+    return calls.counters;
+}
+
+sip_totals_t
+sip_calls_totals()
+{
+    return calls.totals;
+}
+
+void
+sip_calls_count_msg(sip_msg_t *msg, int delta)
+{
+    calls.counters.messages += delta;
+
+    if (msg->reqresp >= 100) {
+        calls.counters.responses[(msg->reqresp >= 800) ? 8 : msg->reqresp / 100] += delta;
+    } else if (msg->reqresp > 0 && msg->reqresp <= SIP_METHOD_PRACK) {
+        calls.counters.methods[msg->reqresp] += delta;
+    }
+}
+
+void
+sip_calls_count_call(sip_call_t *call, int delta)
+{
+    sip_msg_t *msg;
+    vector_iter_t it = vector_iterator(call->msgs);
+
+    calls.counters.dialogs += delta;
+    calls.counters.states[call->state] += delta;
+    while ((msg = vector_iterator_next(&it)))
+        sip_calls_count_msg(msg, delta);
+}
+
+void
+sip_calls_count_state(int from, int to)
+{
+    calls.counters.states[from]--;
+    calls.counters.states[to]++;
+}
+
+vector_t *
+sip_displayed_calls_vector()
+{
+    return calls.displayed;
+}
+
+void
+sip_calls_refilter()
+{
+    sip_call_t *call;
+    vector_iter_t it = vector_iterator(calls.list);
+
+    // Keep the same order than call list
+    vector_clear(calls.displayed);
+    vector_set_sorter(calls.displayed, NULL);
+    while ((call = vector_iterator_next(&it))) {
+        if (filter_check_call(call))
+            vector_append(calls.displayed, call);
+    }
+    vector_set_sorter(calls.displayed, sip_list_sorter);
+}
+
 sip_stats_t
 sip_calls_stats()
 {
     sip_stats_t stats;
-    vector_iter_t it = vector_iterator(calls.list);
 
     // Total number of calls without filtering
-    stats.total = vector_iterator_count(&it);
+    stats.total = vector_count(calls.list);
     // Total number of calls after filtering
-    vector_iterator_set_filter(&it, filter_check_call);
-    stats.displayed = vector_iterator_count(&it);
+    stats.displayed = vector_count(calls.displayed);
     return stats;
 }
 
@@ -529,50 +765,46 @@ sip_find_by_callid(const char *callid)
 }
 
 int
-sip_get_msg_reqresp(sip_msg_t *msg, const u_char *payload)
+sip_get_msg_reqresp(sip_msg_t *msg, const sip_header_table_t *headers)
 {
-    regmatch_t pmatch[3];
+    const sip_header_t *method = &headers->method, *status = &headers->status;
+    const sip_header_t *cseq = &headers->headers[SIP_HEADER_CSEQ];
     char resp_str[SIP_ATTR_MAXLEN];
     char reqresp[SIP_ATTR_MAXLEN];
-    char cseq[11];
     const char *resp_def;
+    uint32_t i;
 
     // Initialize variables
-    memset(pmatch, 0, sizeof(pmatch));
     memset(resp_str, 0, sizeof(resp_str));
     memset(reqresp, 0, sizeof(reqresp));
 
     // If not already parsed
     if (!msg->reqresp) {
 
-        // Method & CSeq
-        if (regexec(&calls.reg_method, (const char *)payload, 2, pmatch, 0) == 0) {
-            if ((int)(pmatch[1].rm_eo - pmatch[1].rm_so) >= SIP_ATTR_MAXLEN) {
+        // Method
+        if (method->value) {
+            if (method->len >= SIP_ATTR_MAXLEN) {
                 strncpy(reqresp, "<malformed>", 11);
             } else {
-                sprintf(reqresp, "%.*s", (int) (pmatch[1].rm_eo - pmatch[1].rm_so), payload + pmatch[1].rm_so);
+                sprintf(reqresp, "%.*s", (int) method->len, method->value);
             }
         }
 
-        // CSeq
-        if (regexec(&calls.reg_cseq, (char*)payload, 2, pmatch, 0) == 0) {
-            sprintf(cseq, "%.*s", (int)(pmatch[1].rm_eo - pmatch[1].rm_so), payload + pmatch[1].rm_so);
-            msg->cseq = atoi(cseq);
+        // CSeq: number followed by method
+        if (cseq->value) {
+            for (i = 0; i < cseq->len && i <= 10 && isdigit(cseq->value[i]); i++);
+            if (i > 0 && i <= 10 && i + 1 < cseq->len && cseq->value[i] == ' ')
+                msg->cseq = atoi(cseq->value);
         }
 
-
         // Response code
-        if (regexec(&calls.reg_response, (const char *)payload, 3, pmatch, 0) == 0) {
-            if ((int)(pmatch[1].rm_eo - pmatch[1].rm_so) >= SIP_ATTR_MAXLEN) {
+        if (status->value) {
+            if (status->len >= SIP_ATTR_MAXLEN) {
                 strncpy(resp_str, "<malformed>", 11);
             } else {
-                sprintf(resp_str, "%.*s", (int) (pmatch[1].rm_eo - pmatch[1].rm_so), payload + pmatch[1].rm_so);
-            }
-            if ((int)(pmatch[2].rm_eo - pmatch[2].rm_so) >= SIP_ATTR_MAXLEN) {
-                strncpy(resp_str, "<malformed>", 11);
-            } else {
-                sprintf(reqresp, "%.*s", (int) (pmatch[2].rm_eo - pmatch[2].rm_so), payload + pmatch[2].rm_so);
+                sprintf(resp_str, "%.*s", (int) status->len, status->value);
             }
+            sprintf(reqresp, "%.3s", status->value);
         }
 
         // Get Request/Response Code
@@ -582,7 +814,7 @@ sip_get_msg_reqresp(sip_msg_t *msg, const u_char *payload)
         if (!msg_is_request(msg)) {
             resp_def = sip_method_str(msg->reqresp);
             if (!resp_def || strcmp(resp_def, resp_str)) {
-                msg->resp_str = strdup(resp_str);
+                msg->resp_str = intern_get(resp_str, strlen(resp_str));
             }
         }
     }
@@ -604,63 +836,64 @@ sip_get_msg_reqresp_str(sip_msg_t *msg)
 sip_msg_t *
 sip_parse_msg(sip_msg_t *msg)
 {
+    sip_header_table_t headers;
+
     if (msg && !msg->cseq) {
-        sip_parse_msg_payload(msg, (u_char*) msg_get_payload(msg));
+        msg_get_header_table(msg, &headers);
+        sip_parse_msg_payload(msg, &headers);
     }
     return msg;
 }
 
 int
-sip_parse_msg_payload(sip_msg_t *msg, const u_char *payload)
+sip_parse_msg_payload(sip_msg_t *msg, const sip_header_table_t *headers)
 {
-    regmatch_t pmatch[4];
+    const char *uri;
+    uint32_t len;
 
     // From
-    if (regexec(&calls.reg_from, (const char *)payload, 4, pmatch, 0) == 0) {
-        msg->sip_from = sng_malloc((int)pmatch[2].rm_eo - pmatch[2].rm_so + 1);
-        strncpy(msg->sip_from, (const char *)payload +  pmatch[2].rm_so, (int)pmatch[2].rm_eo - pmatch[2].rm_so);
+    if ((len = sip_header_uri(&headers->headers[SIP_HEADER_FROM], &uri))) {
+        msg->sip_from = intern_get(uri, len);
     } else {
         // Malformed From Header
-        msg->sip_from = sng_malloc(12);
-        strncpy(msg->sip_from, "<malformed>", 11);
+        msg->sip_from = intern_get("<malformed>", 11);
     }
 
     // To
-    if (regexec(&calls.reg_to, (const char *)payload, 4, pmatch, 0) == 0) {
-        msg->sip_to = sng_malloc((int)pmatch[2].rm_eo - pmatch[2].rm_so + 1);
-        strncpy(msg->sip_to, (const char *)payload +  pmatch[2].rm_so, (int)pmatch[2].rm_eo - pmatch[2].rm_so);
+    if ((len = sip_header_uri(&headers->headers[SIP_HEADER_TO], &uri))) {
+        msg->sip_to = intern_get(uri, len);
     } else {
         // Malformed To Header
-        msg->sip_to = sng_malloc(12);
-        strncpy(msg->sip_to, "<malformed>", 11);
+        msg->sip_to = intern_get("<malformed>", 11);
     }
 
     return 0;
 }
 
 void
-sip_parse_msg_media(sip_msg_t *msg, const u_char *payload)
+sip_parse_msg_media(sip_msg_t *msg, const char *body, uint32_t len)
 {
 
-#define ADD_STREAM(stream) \
-    if (stream) { \
-        if (!rtp_find_call_stream(call, src, stream->dst)) { \
-          call_add_stream(call, stream); \
-      } else { \
-          sng_free(stream); \
-          stream = NULL; \
-      } \
+#define ADD_STREAMS() \
+    if (media) { \
+        ADD_STREAM(msg_rtp_dst, PACKET_RTP); \
+        ADD_STREAM(rtp_dst, PACKET_RTP); \
+        ADD_STREAM(rtcp_dst, PACKET_RTCP); \
     }
 
-    address_t dst, src = { };
-    rtp_stream_t *rtp_stream = NULL, *rtcp_stream = NULL, *msg_rtp_stream = NULL;
-    char media_type[MEDIATYPELEN] = { };
-    char media_format[30] = { };
-    uint32_t media_fmt_pref;
-    uint32_t media_fmt_code;
+#define ADD_STREAM(dst, type) \
+    if (!rtp_find_call_stream(call, src, dst) && (stream = stream_create(media, dst, type))) \
+        call_add_stream(call, stream);
+
+    address_t dst = { }, src = { }, conn, rtp_dst = { }, rtcp_dst = { }, msg_rtp_dst = { };
+    rtp_stream_t *stream;
+    char media_type[MEDIATYPELEN];
+    char media_format[30];
+    const char *line, *eol, *end = body + len, *field, *next;
+    uint32_t media_fmt_pref, media_fmt_code, linelen, fieldlen;
     sdp_media_t *media = NULL;
-    char *payload2, *tofree, *line;
     sip_call_t *call = msg_get_call(msg);
+    char ip[ADDRESSLEN];
 
     // If message is retrans, there's no need to parse the payload again
     if (msg->retrans) {
@@ -669,98 +902,140 @@ sip_parse_msg_media(sip_msg_t *msg, const u_char *payload)
         return;
     }
 
-    // Parse each line of payload looking for sdp information
-    tofree = payload2 = strdup((char*)payload);
-    while ((line = strsep(&payload2, "\r\n")) != NULL) {
-        // Check if we have a media string
-        if (!strncmp(line, "m=", 2)) {
-            if (sscanf(line, "m=%s %hu RTP/%*s %u", media_type, &dst.port, &media_fmt_pref) == 3
-            ||  sscanf(line, "m=%s %hu UDP/%*s %u", media_type, &dst.port, &media_fmt_pref) == 3) {
-
-                // Add streams from previous 'm=' line to the call
-                ADD_STREAM(msg_rtp_stream);
-                ADD_STREAM(rtp_stream);
-                ADD_STREAM(rtcp_stream);
-
-                // Create a new media structure for this message
-                if ((media = media_create(msg))) {
-                    media_set_type(media, media_type);
-                    media_set_address(media, dst);
-                    media_set_prefered_format(media, media_fmt_pref);
-                    msg_add_media(msg, media);
-
-                    /**
-                     * From SDP we can only guess destination address port. RTP Capture proccess
-                     * will determine when the stream has been completed, getting source address
-                     * and port of the stream.
-                     */
-                    // Create a new stream with this destination address:port
-
-                    // Create RTP stream with source of message as destination address
-                    msg_rtp_stream = stream_create(media, dst, PACKET_RTP);
-                    msg_rtp_stream->dst = msg->packet->src;
-                    msg_rtp_stream->dst.port = dst.port;
-
-                    // Create RTP stream
-                    rtp_stream = stream_create(media, dst, PACKET_RTP);
-
-                    // Create RTCP stream
-                    rtcp_stream = stream_create(media, dst, PACKET_RTCP);
-                    rtcp_stream->dst.port++;
-                }
+    // Parse each line of the body looking for sdp information
+    for (line = body; line < end; line = eol < end ? eol + 1 : end) {
+        if (!(eol = memchr(line, '\n', end - line)))
+            eol = end;
+        linelen = eol - line;
+        if (linelen && line[linelen - 1] == '\r')
+            linelen--;
+        if (linelen < 2 || line[1] != '=')
+            continue;
+
+        // Fields are parsed in place, payload is null terminated
+        field = line + 2;
+        eol = line + linelen;
+
+        // Check if we have a media string: m=type port RTP/profile format
+        if (line[0] == 'm') {
+            for (next = field; next < eol && *next != ' '; next++);
+            if ((fieldlen = next - field) == 0 || fieldlen >= sizeof(media_type) || next == eol)
+                continue;
+            memcpy(media_type, field, fieldlen);
+            media_type[fieldlen] = '\0';
+
+            // Port
+            for (field = next; field < eol && *field == ' '; field++);
+            if (field == eol || !isdigit(*field) || strtoul(field, (char **) &next, 10) > UINT16_MAX || *next != ' ')
+                continue;
+            dst.port = strtoul(field, NULL, 10);
+
+            // Transport
+            for (field = next; field < eol && *field == ' '; field++);
+            if (eol - field < 5 || (strncmp(field, "RTP/", 4) && strncmp(field, "UDP/", 4)) || field[4] == ' ')
+                continue;
+            for (next = field; next < eol && *next != ' '; next++);
+
+            // Prefered format
+            for (field = next; field < eol && *field == ' '; field++);
+            if (field == eol || !isdigit(*field))
+                continue;
+            media_fmt_pref = strtoul(field, NULL, 10);
+
+            // Add streams from previous 'm=' line to the call
+            ADD_STREAMS();
+
+            // Create a new media structure for this message
+            if ((media = media_create(msg))) {
+                media_set_type(media, media_type);
+                media_set_address(media, dst);
+                media_set_prefered_format(media, media_fmt_pref);
+                msg_add_media(msg, media);
+
+                /**
+                 * From SDP we can only guess destination address port. RTP Capture proccess
+                 * will determine when the stream has been completed, getting source address
+                 * and port of the stream.
+                 */
+                // RTP stream with source of message as destination address
+                msg_rtp_dst = msg->packet->src;
+                msg_rtp_dst.port = dst.port;
+                // RTP and RTCP streams destination
+                rtp_dst = rtcp_dst = dst;
+                rtcp_dst.port++;
             }
         }
 
-        // Check if we have a connection string
-        if (!strncmp(line, "c=", 2)) {
-            if (sscanf(line, "c=IN IP4 %s", dst.ip) && media) {
+        // Check if we have a connection string: c=IN IP4 address[/ttl]
+        if (line[0] == 'c') {
+            if (eol - field < 8 || strncmp(field, "IN IP", 5) || field[6] != ' ')
+                continue;
+            if (field[5] != '4' && field[5] != '6')
+                continue;
+            for (next = field + 7; next < eol && *next != ' ' && *next != '/'; next++);
+            if ((fieldlen = next - (field + 7)) == 0 || fieldlen >= sizeof(ip))
+                continue;
+            memcpy(ip, field + 7, fieldlen);
+            ip[fieldlen] = '\0';
+
+            // Connection address must be an IP of the given type
+            conn = dst;
+            if (address_set_ip(&conn, ip) != 0 || conn.family != (field[5] == '4' ? AF_INET : AF_INET6))
+                continue;
+            dst = conn;
+
+            if (media) {
                 media_set_address(media, dst);
-                strcpy(rtp_stream->dst.ip, dst.ip);
-                strcpy(rtcp_stream->dst.ip, dst.ip);
+                conn.port = rtp_dst.port;
+                rtp_dst = conn;
+                conn.port = rtcp_dst.port;
+                rtcp_dst = conn;
             }
         }
 
-        // Check if we have attribute format string
-        if (!strncmp(line, "a=rtpmap:", 9)) {
-            if (media && sscanf(line, "a=rtpmap:%u %30[^ ]", &media_fmt_code, media_format)) {
-                media_add_format(media, media_fmt_code, media_format);
-            }
+        // Check if we have attribute format string: a=rtpmap:code format
+        if (line[0] == 'a' && media && eol - field > 7 && !strncmp(field, "rtpmap:", 7)) {
+            field += 7;
+            if (!isdigit(*field))
+                continue;
+            media_fmt_code = strtoul(field, (char **) &next, 10);
+            for (field = next; field < eol && *field == ' '; field++);
+            for (next = field; next < eol && *next != ' '; next++);
+            if ((fieldlen = next - field) >= sizeof(media_format))
+                fieldlen = sizeof(media_format) - 1;
+            memcpy(media_format, field, fieldlen);
+            media_format[fieldlen] = '\0';
+            media_add_format(media, media_fmt_code, media_format);
         }
 
-        // Check if we have attribute format RTCP port
-        if (!strncmp(line, "a=rtcp:", 7) && rtcp_stream) {
-            sscanf(line, "a=rtcp:%hu", &rtcp_stream->dst.port);
+        // Check if we have attribute format RTCP port: a=rtcp:port
+        if (line[0] == 'a' && media && eol - field > 5 && !strncmp(field, "rtcp:", 5) && isdigit(field[5])) {
+            rtcp_dst.port = strtoul(field + 5, NULL, 10);
         }
-
-
     }
 
     // Add streams from last 'm=' line to the call
-    ADD_STREAM(msg_rtp_stream);
-    ADD_STREAM(rtp_stream);
-    ADD_STREAM(rtcp_stream);
-
-    sng_free(tofree);
+    ADD_STREAMS();
 
 #undef ADD_STREAM
+#undef ADD_STREAMS
 }
 
 void
-sip_parse_extra_headers(sip_msg_t *msg, const u_char *payload)
+sip_parse_extra_headers(sip_msg_t *msg, const sip_header_table_t *headers)
 {
-    regmatch_t pmatch[4];
-    char warning[10];
+    const char *text;
+    uint32_t len;
 
      // Reason text
-     if (regexec(&calls.reg_reason, (const char *)payload, 2, pmatch, 0) == 0) {
-         msg->call->reasontxt = sng_malloc((int)pmatch[1].rm_eo - pmatch[1].rm_so + 1);
-         strncpy(msg->call->reasontxt, (const char *)payload +  pmatch[1].rm_so, (int)pmatch[1].rm_eo - pmatch[1].rm_so);
+     if ((len = sip_header_reason_text(&headers->headers[SIP_HEADER_REASON], &text))) {
+         msg->call->reasontxt = sng_malloc(len + 1);
+         strncpy(msg->call->reasontxt, text, len);
      }
 
      // Warning code
-     if (regexec(&calls.reg_warning, (const char *)payload, 2, pmatch, 0) == 0) {
-         strncpy(warning, (const char *)payload +  pmatch[1].rm_so, (int)pmatch[1].rm_eo - pmatch[1].rm_so);
-         msg->call->warning = atoi(warning);
+     if (headers->headers[SIP_HEADER_WARNING].value) {
+         msg->call->warning = atoi(headers->headers[SIP_HEADER_WARNING].value);
      }
 }
 
@@ -774,44 +1049,288 @@ sip_calls_clear()
     // Remove all items from vector
     vector_clear(calls.list);
     vector_clear(calls.active);
+    vector_clear(calls.displayed);
+
+    // No call is stored
+    memset(&calls.counters, 0, sizeof(calls.counters));
+
+    // Remove keepalive counters
+    sip_aggregate_clear();
 }
 
 void
 sip_calls_clear_soft()
 {
-        // Create again the callid hash table
-        htable_destroy(calls.callids);
-        calls.callids = htable_create(calls.limit);
+    sip_call_t *call;
+    int i;
+
+    // Remove filtered out calls as if they were rotated (without counting
+    // them as rotated), so they leave every call index and are destroyed.
+    // Removing a call never moves the calls before it in the list, and stops
+    // counting it, so counters only include the remaining calls afterwards
+    for (i = vector_count(calls.list) - 1; i >= 0; i--) {
+        call = vector_item(calls.list, i);
+        if (!filter_check_call(call))
+            sip_calls_remove(call);
+    }
 
-        // Repopulate list applying current filter
-        calls.list = vector_copy_if(sip_calls_vector(), filter_check_call);
-        calls.active = vector_copy_if(sip_active_calls_vector(), filter_check_call);
+    // All remaining calls match current filters
+    sip_calls_refilter();
+}
 
-        // Repopulate callids based on filtered list
-        sip_call_t *call;
-        vector_iter_t it = vector_iterator(calls.list);
+void
+sip_calls_rotate()
+{
+    sip_call_t *call = calls.updated_first, *next;
 
-        while ((call = vector_iterator_next(&it)))
-        {
-                htable_insert(calls.callids, call->callid, call);
+    // Remove the least recently updated call that is not locked
+    while (call && sip_calls_count() >= calls.limit) {
+        next = call->updated_next;
+        if (!call->locked) {
+            sip_calls_remove(call);
+            calls.totals.rotated++;
         }
+        call = next;
+    }
 }
 
 void
-sip_calls_rotate()
+sip_calls_update(sip_call_t *call, size_t memory)
 {
-    sip_call_t *call;
-    vector_iter_t it = vector_iterator(calls.list);
-    while ((call = vector_iterator_next(&it))) {
+    // Move call to the end of update list
+    if (calls.updated_last != call) {
+        sip_calls_unlink(call);
+        call->updated_prev = calls.updated_last;
+        if (calls.updated_last) {
+            calls.updated_last->updated_next = call;
+        } else {
+            calls.updated_first = call;
+        }
+        calls.updated_last = call;
+        calls.memory += call->memory;
+    }
+
+    call->memory += memory;
+    calls.memory += memory;
+    call->update = ++calls.updates;
+
+    // Make room for this call data
+    sip_calls_evict(call);
+
+    // Expiration time is counted from the last update
+    sip_calls_schedule(call);
+
+    // Wake up interface to display this call changes
+    sip_calls_notify();
+}
+
+void
+sip_calls_unlink(sip_call_t *call)
+{
+    // Call is not in update list
+    if (!call->updated_prev && calls.updated_first != call)
+        return;
+
+    if (call->updated_prev) {
+        call->updated_prev->updated_next = call->updated_next;
+    } else {
+        calls.updated_first = call->updated_next;
+    }
+    if (call->updated_next) {
+        call->updated_next->updated_prev = call->updated_prev;
+    } else {
+        calls.updated_last = call->updated_prev;
+    }
+    call->updated_prev = call->updated_next = NULL;
+    calls.memory -= call->memory;
+}
+
+void
+sip_calls_remove(sip_call_t *call)
+{
+    sip_calls_unlink(call);
+    sip_calls_unschedule(call);
+    // Remove from callids hash (unless a newer call uses the same Call-ID)
+    if (htable_find(calls.callids, call->callid) == call)
+        htable_remove(calls.callids, call->callid);
+    // Remove call from active and call lists
+    vector_remove(calls.active, call);
+    vector_remove(calls.displayed, call);
+    // Stop counting this call before it is destroyed
+    sip_calls_count_call(call, -1);
+    vector_remove(calls.list, call);
+    // Mark the list as changed
+    calls.changed = true;
+    sip_calls_notify();
+}
+
+void
+sip_calls_evict(sip_call_t *current)
+{
+    sip_call_t *call = calls.updated_first, *next;
+
+    while (calls.memory_limit && calls.memory > calls.memory_limit && call && call != current) {
+        next = call->updated_next;
         if (!call->locked) {
-            // Remove from callids hash
-            htable_remove(calls.callids, call->callid);
-            // Remove first call from active and call lists
-            vector_remove(calls.active, call);
-            vector_remove(calls.list, call);
-            return;
+            sip_calls_remove(call);
+            calls.totals.rotated++;
+        }
+        call = next;
+    }
+}
+
+size_t
+sip_calls_memory()
+{
+    return calls.memory;
+}
+
+size_t
+sip_calls_memory_limit()
+{
+    return calls.memory_limit;
+}
+
+sip_call_t *
+sip_calls_last_updated()
+{
+    return calls.updated_last;
+}
+
+unsigned long
+sip_calls_updates()
+{
+    return calls.updates;
+}
+
+bool
+sip_calls_expire_enabled()
+{
+    return calls.expire > 0 || calls.expire_terminated > 0;
+}
+
+void
+sip_calls_schedule(sip_call_t *call)
+{
+    int ttl = calls.expire;
+    time_t expire = 0;
+    sip_call_t **slot;
+
+    // Calls that have finished can expire sooner
+    if (call->state && !call_is_active(call) && calls.expire_terminated > 0)
+        ttl = calls.expire_terminated;
+    if (ttl > 0)
+        expire = time(NULL) + ttl;
+
+    // Already in the right slot
+    if (expire == call->expire)
+        return;
+
+    sip_calls_unschedule(call);
+    if (!expire)
+        return;
+
+    call->expire = expire;
+    slot = &calls.expire_wheel[expire % SIP_EXPIRE_WHEEL];
+    if ((call->expire_next = *slot))
+        call->expire_next->expire_prev = call;
+    *slot = call;
+}
+
+void
+sip_calls_unschedule(sip_call_t *call)
+{
+    // Call is not in expiration wheel
+    if (!call->expire)
+        return;
+
+    if (call->expire_prev) {
+        call->expire_prev->expire_next = call->expire_next;
+    } else {
+        calls.expire_wheel[call->expire % SIP_EXPIRE_WHEEL] = call->expire_next;
+    }
+    if (call->expire_next)
+        call->expire_next->expire_prev = call->expire_prev;
+    call->expire_prev = call->expire_next = NULL;
+    call->expire = 0;
+}
+
+void
+sip_calls_expire(time_t now)
+{
+    sip_call_t *call, *next;
+    time_t second;
+
+    // Check each second slot once (whole wheel at most)
+    if (!calls.expire_checked || now - calls.expire_checked > SIP_EXPIRE_WHEEL)
+        calls.expire_checked = now - SIP_EXPIRE_WHEEL;
+
+    for (second = calls.expire_checked + 1; second <= now; second++) {
+        for (call = calls.expire_wheel[second % SIP_EXPIRE_WHEEL]; call; call = next) {
+            next = call->expire_next;
+            // Calls of next wheel turns and locked calls are kept
+            if (call->expire <= now && !call->locked) {
+                sip_calls_remove(call);
+                calls.totals.expired++;
+            }
         }
     }
+    calls.expire_checked = now;
+}
+
+void
+sip_calls_media_update(sip_call_t *call, sip_msg_t *msg)
+{
+    // Calls being setup or in conversation can always have media
+    if (!call->state || call_is_active(call)) {
+        sip_calls_media_unlink(call);
+        return;
+    }
+
+    // Nothing to match or already ending
+    if (!call->media_streams || call->media_end)
+        return;
+
+    // Append to the list of finished calls
+    call->media_end = packet_time(msg->packet).tv_sec + calls.media_grace;
+    if ((call->media_prev = calls.media_last)) {
+        calls.media_last->media_next = call;
+    } else {
+        calls.media_first = call;
+    }
+    calls.media_last = call;
+}
+
+void
+sip_calls_media_unlink(sip_call_t *call)
+{
+    // Call is not in media ending list
+    if (!call->media_end)
+        return;
+
+    if (call->media_prev) {
+        call->media_prev->media_next = call->media_next;
+    } else {
+        calls.media_first = call->media_next;
+    }
+    if (call->media_next) {
+        call->media_next->media_prev = call->media_prev;
+    } else {
+        calls.media_last = call->media_prev;
+    }
+    call->media_prev = call->media_next = NULL;
+    call->media_end = 0;
+}
+
+void
+sip_calls_media_expire(time_t now)
+{
+    sip_call_t *call;
+
+    while ((call = calls.media_first) && call->media_end <= now) {
+        sip_calls_media_unlink(call);
+        call_unindex_streams(call);
+    }
 }
 
 int
@@ -831,8 +1350,29 @@ sip_set_match_expression(const char *expr, int insensitive, int invert)
         pflags |= PCRE_CASELESS;
 
     // Check if we have a valid expression
-    calls.match_regex = pcre_compile(expr, pflags, &re_err, &err_offset, 0);
-    return calls.match_regex == NULL;
+    if (!(calls.match_regex = pcre_compile(expr, pflags, &re_err, &err_offset, 0)))
+        return 1;
+
+    // Expression is checked against every new dialog payload: JIT compile it if possible
+    calls.match_extra = pcre_study(calls.match_regex, SIP_PCRE_STUDY_OPTIONS, &re_err);
+    return 0;
+#elif defined(WITH_PCRE2)
+    int re_err = 0;
+    PCRE2_SIZE err_offset = 0;
+    uint32_t pflags = PCRE2_UNGREEDY | PCRE2_DOTALL;
+
+    if (insensitive)
+        pflags |= PCRE2_CASELESS;
+
+    // Check if we have a valid expression
+    calls.match_regex = pcre2_compile((PCRE2_SPTR) expr, PCRE2_ZERO_TERMINATED, pflags, &re_err, &err_offset, NULL);
+    if (!calls.match_regex)
+        return 1;
+
+    // Expression is checked against every new dialog payload: JIT compile it if possible
+    pcre2_jit_compile(calls.match_regex, PCRE2_JIT_COMPLETE);
+    calls.match_data = pcre2_match_data_create_from_pattern(calls.match_regex, NULL);
+    return calls.match_data == NULL;
 #else
     int cflags = REG_EXTENDED;
 
@@ -845,25 +1385,52 @@ sip_set_match_expression(const char *expr, int insensitive, int invert)
 #endif
 }
 
+int
+sip_set_match_file(const char *file, int insensitive, int invert)
+{
+    // Store patterns file
+    calls.match_file = file;
+    // Set invert flag
+    calls.match_invert = invert;
+
+    if (!(calls.match_patterns = match_create(insensitive)))
+        return 1;
+
+    // Check the file has patterns that can be compiled
+    return match_load_file(calls.match_patterns, file) != 0
+           || match_compile(calls.match_patterns) != 0;
+}
+
 const char *
 sip_get_match_expression()
 {
-    return calls.match_expr;
+    return calls.match_expr ? calls.match_expr : calls.match_file;
 }
 
 int
-sip_check_match_expression(const char *payload)
+sip_check_match_expression(const char *payload, uint32_t len)
 {
+    // Check if payload contains any of the patterns
+    if (calls.match_patterns)
+        return match_exec(calls.match_patterns, payload, len) != calls.match_invert;
+
     // Everything matches when there is no match
     if (!calls.match_expr)
         return 1;
 
 #ifdef WITH_PCRE
-    switch (pcre_exec(calls.match_regex, 0, payload, strlen(payload), 0, 0, 0, 0)) {
+    switch (pcre_exec(calls.match_regex, calls.match_extra, payload, len, 0, 0, 0, 0)) {
         case PCRE_ERROR_NOMATCH:
             return 1 == calls.match_invert;
     }
 
+    return 0 == calls.match_invert;
+#elif defined(WITH_PCRE2)
+    switch (pcre2_match(calls.match_regex, (PCRE2_SPTR) payload, len, 0, 0, calls.match_data, NULL)) {
+        case PCRE2_ERROR_NOMATCH:
+            return 1 == calls.match_invert;
+    }
+
     return 0 == calls.match_invert;
 #else
     // Check if payload matches the given expresion
@@ -952,41 +1519,84 @@ sip_sort_options()
 void
 sip_sort_list()
 {
-    // Cloning the vector automatically sorts it
-    vector_t *clone = vector_clone(calls.list);
+    sip_sort_key_t *keys;
+    vector_t *sorted;
+    char value[SIP_ATTR_MAXLEN + 1];
+    uint32_t *ranks = NULL;
+    int count = vector_count(calls.list), i;
 
-    // FIXME FIXME FIXME
-    // There should be a way to destroy the vector without calling the
-    // vector destroyer for each item...
-    vector_set_destroyer(calls.list, NULL);
-    vector_destroy(calls.list);
+    if (count < 2)
+        return;
+
+    if (!(keys = malloc(sizeof(sip_sort_key_t) * count)))
+        return;
+    sorted = vector_create(count, 10);
+
+    // Attributes stored in columns are sorted by the rank of their value
+    sip_column_ranks(calls.sort.by, &ranks);
+
+    // Get each call sorting value once. Calls with equal values end in
+    // reverse order, as they did when inserted one by one in a new list
+    for (i = 0; i < count; i++) {
+        keys[i].call = vector_item(calls.list, count - 1 - i);
+        keys[i].text = NULL;
+        if (ranks) {
+            keys[i].number = sip_column_rank(keys[i].call, calls.sort.by, ranks);
+        } else if (!call_attr_sort_value(keys[i].call, calls.sort.by, value, &keys[i].number)) {
+            keys[i].text = strdup(value);
+        }
+        vector_append(sorted, &keys[i]);
+    }
+    free(ranks);
+
+    if (vector_sort(sorted, sip_sort_key_compare) == 0) {
+        for (i = 0; i < count; i++) {
+            vector_set_item(calls.list, i, ((sip_sort_key_t *) vector_item(sorted, i))->call);
+        }
+    }
+
+    for (i = 0; i < count; i++)
+        free(keys[i].text);
+    vector_destroy(sorted);
+    free(keys);
+
+    // Displayed calls follow the new order
+    sip_calls_refilter();
+}
+
+int
+sip_sort_key_compare(void *one, void *two)
+{
+    sip_sort_key_t *onekey = one, *twokey = two;
+    int cmp;
+
+    if (onekey->text && twokey->text) {
+        cmp = call_attr_compare_text(onekey->text, twokey->text);
+    } else {
+        cmp = (onekey->number > twokey->number) - (onekey->number < twokey->number);
+    }
 
-    // The new sorted list
-    calls.list = clone;
+    return calls.sort.asc ? cmp : -cmp;
 }
 
 void
 sip_list_sorter(vector_t *vector, void *item)
 {
-    sip_call_t *prev, *cur = (sip_call_t *)item;
-    int count = vector_count(vector);
-    int i;
-
-    // First item is alway sorted
-    if (vector_count(vector) == 1)
-        return;
+    int low = 0, high = vector_count(vector) - 1, middle, cmp;
 
-    for (i = count - 2 ; i >= 0; i--) {
-        // Get previous item
-        prev = vector_item(vector, i);
-        // Check if the item is already in a sorted position
-        int cmp = call_attr_compare(cur, prev, calls.sort.by);
+    // Find the first call that should not be before the new one.
+    // New item is the last one, not included in the search
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        cmp = call_attr_compare(item, vector_item(vector, middle), calls.sort.by);
         if ((calls.sort.asc && cmp > 0) || (!calls.sort.asc && cmp < 0)) {
-            vector_insert(vector, item, i + 1);
-            return;
+            low = middle + 1;
+        } else {
+            high = middle;
         }
     }
 
-    // Put this item at the begining of the vector
-    vector_insert(vector, item, 0);
+    // Move the item if it is not already in a sorted position
+    if (low < vector_count(vector) - 1)
+        vector_insert(vector, item, low);
 }
@@ -34,15 +34,37 @@
 
 #include "config.h"
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <regex.h>
 #ifdef WITH_PCRE
 #include <pcre.h>
 #endif
+#ifdef WITH_PCRE2
+#ifndef PCRE2_CODE_UNIT_WIDTH
+#define PCRE2_CODE_UNIT_WIDTH 8
+#endif
+#include <pcre2.h>
+#endif
 #include "sip_call.h"
+#include "sip_header.h"
 #include "vector.h"
 #include "hash.h"
+#include "match.h"
+#include "bloom.h"
+#include "sip_sampler.h"
 
 #define MAX_SIP_PAYLOAD 10240
+//! Number of one second slots of calls expiration wheel
+#define SIP_EXPIRE_WHEEL 256
+
+#ifdef WITH_PCRE
+//! Options to optimize compiled expressions
+#ifdef PCRE_STUDY_JIT_COMPILE
+#define SIP_PCRE_STUDY_OPTIONS  PCRE_STUDY_JIT_COMPILE
+#else
+#define SIP_PCRE_STUDY_OPTIONS  0
+#endif
+#endif
 
 //! Shorter declaration of sip_call_list structure
 typedef struct sip_call_list sip_call_list_t;
@@ -50,8 +72,16 @@ typedef struct sip_call_list sip_call_list_t;
 typedef struct sip_code sip_code_t;
 //! Shorter declaration of sip stats
 typedef struct sip_stats sip_stats_t;
+//! Shorter declaration of sip_counters structure
+typedef struct sip_counters sip_counters_t;
+//! Shorter declaration of sip_totals structure
+typedef struct sip_totals sip_totals_t;
 //! Shorter declaration of sip sort
 typedef struct sip_sort sip_sort_t;
+//! Shorter declaration of sip_sort_key structure
+typedef struct sip_sort_key sip_sort_key_t;
+//! Shorter declaration of sip_validate_state structure
+typedef struct sip_validate_state sip_validate_state_t;
 
 //! SIP Methods
 enum sip_methods {
@@ -80,6 +110,22 @@ enum validate_result {
     VALIDATE_MULTIPLE_SIP   = 2
 };
 
+/**
+ * @brief Progress of a SIP message validation
+ *
+ * This allows validating a payload that is growing as new data is received
+ * without checking again the already validated part.
+ */
+struct sip_validate_state
+{
+    //! Payload bytes already searched for the end of headers
+    uint32_t scan;
+    //! Size of SIP headers including the empty line (0 until found)
+    uint32_t hdrlen;
+    //! Value of Content-Length header
+    uint32_t content_len;
+};
+
 /**
  * @brief Different Request/Response codes in SIP Protocol
  */
@@ -100,6 +146,51 @@ struct sip_stats
     int displayed;
 };
 
+/**
+ * @brief Counters of stored dialogs and messages
+ *
+ * Counters are updated when messages are stored, calls change their
+ * state and calls are removed, so they never require walking the list.
+ */
+struct sip_counters
+{
+    //! Stored dialogs
+    int dialogs;
+    //! Stored messages
+    int messages;
+    //! Stored dialogs by call state (0 for dialogs that are not calls)
+    int states[SIP_CALLSTATE_COMPLETED + 1];
+    //! Stored requests by method
+    int methods[SIP_METHOD_PRACK + 1];
+    //! Stored responses by class (1XX to 8XX, higher codes counted as 8XX)
+    int responses[9];
+};
+
+/**
+ * @brief Totals of parsed messages and created and removed dialogs
+ *
+ * Unlike stored counters, totals never decrease when calls are removed.
+ */
+struct sip_totals
+{
+    //! Parsed requests by method
+    unsigned long methods[SIP_METHOD_PRACK + 1];
+    //! Parsed responses by class (1XX to 8XX, higher codes counted as 8XX)
+    unsigned long responses[9];
+    //! Created dialogs
+    unsigned long dialogs;
+    //! Dialogs removed to store new ones (capture limit or memory limit)
+    unsigned long rotated;
+    //! Dialogs removed after being inactive
+    unsigned long expired;
+    //! Messages discarded because their dialog was not sampled
+    unsigned long sampled;
+    //! Messages only counted because their dialog is not an INVITE
+    unsigned long counted;
+    //! Messages only counted by address and method (sip_aggregate.h)
+    unsigned long aggregated;
+};
+
 /**
  * @brief Sorting information for the sip list
  */
@@ -111,6 +202,19 @@ struct sip_sort
     bool asc;
 };
 
+/**
+ * @brief Call sorting value, taken once while sorting the call list
+ */
+struct sip_sort_key
+{
+    //! Sorted call
+    sip_call_t *call;
+    //! Value of numeric attributes
+    int number;
+    //! Value of text attributes (NULL for numeric attributes)
+    char *text;
+};
+
 /**
  * @brief call structures head list
  *
@@ -121,8 +225,18 @@ struct sip_call_list {
     vector_t *list;
     //! List of active captured calls
     vector_t *active;
+    //! List of captured calls matching current filters
+    vector_t *displayed;
     //! Changed flag. For interface optimal updates
     bool changed;
+    //! Stored dialogs and messages counters
+    sip_counters_t counters;
+    //! Parsed messages and created and removed dialogs
+    sip_totals_t totals;
+    //! Pipe to wake up interface when calls change (read and write ends)
+    int notify[2];
+    //! A change has been notified and interface has not cleared it yet
+    atomic_bool notified;
     //! Sort call list following this options
     sip_sort_t sort;
     //! Last created id
@@ -132,6 +246,26 @@ struct sip_call_list {
 
     // Max call limit
     int limit;
+    //! Max memory used by stored calls (bytes). 0 for disabling
+    size_t memory_limit;
+    //! Estimated memory used by stored calls (bytes)
+    size_t memory;
+    //! Least and most recently updated calls
+    sip_call_t *updated_first, *updated_last;
+    //! Number of call updates since start
+    unsigned long updates;
+    //! Seconds without messages before calls expire (0 for disabling)
+    int expire;
+    //! Seconds without messages before terminated calls expire
+    int expire_terminated;
+    //! Calls expiring in each second (modulo wheel size)
+    sip_call_t *expire_wheel[SIP_EXPIRE_WHEEL];
+    //! Last second checked for expired calls
+    time_t expire_checked;
+    //! Seconds finished calls streams are still matched with RTP packets
+    int media_grace;
+    //! Finished calls with indexed streams (first to end first)
+    sip_call_t *media_first, *media_last;
     //! Only store dialogs starting with INVITE
     int only_calls;
     //! Only store dialogs starting with some Methods
@@ -141,37 +275,37 @@ struct sip_call_list {
 #ifdef WITH_PCRE
     //! Compiled match expression
     pcre *match_regex;
+    //! Optimized match expression data (NULL if it could not be studied)
+    pcre_extra *match_extra;
+#elif defined(WITH_PCRE2)
+    //! Compiled match expression
+    pcre2_code *match_regex;
+    //! Match data reused for every payload
+    pcre2_match_data *match_data;
 #else
     //! Compiled match expression
     regex_t match_regex;
 #endif
+    //! File with literal patterns to match
+    const char *match_file;
+    //! Compiled literal patterns (used instead of match expression)
+    match_patterns_t *match_patterns;
     //! Invert match expression result
     int match_invert;
-
-    //! Regexp for payload matching
-    regex_t reg_method;
-    regex_t reg_callid;
-    regex_t reg_xcallid;
-    regex_t reg_response;
-    regex_t reg_cseq;
-    regex_t reg_from;
-    regex_t reg_to;
-    regex_t reg_valid;
-    regex_t reg_cl;
-    regex_t reg_body;
-    regex_t reg_reason;
-    regex_t reg_warning;
+    //! New dialogs sampling
+    sip_sampler_t sampler;
 };
 
 /**
  * @brief Initialize SIP Storage structures
  *
  * @param limit Max number of Stored calls
+ * @param memory_limit Max memory used by stored calls (0 for unlimited)
  * @param only_calls only parse dialogs starting with INVITE
  * @param no_incomplete only parse dialog starting with some methods
  */
 void
-sip_init(int limit, int only_calls, int no_incomplete);
+sip_init(int limit, size_t memory_limit, int only_calls, int no_incomplete);
 
 /**
  * @brief Deallocate all memory used for SIP calls
@@ -222,6 +356,33 @@ sip_get_xcallid(const char* payload, char *xcallid);
 int
 sip_validate_packet(packet_t *packet);
 
+/**
+ * @brief Validate a payload is a SIP message
+ *
+ * Same as sip_validate_packet, but validation continues from the given
+ * state, so only data added since the last call is checked.
+ * Payload must be a zero terminated buffer.
+ *
+ * @param payload Payload data received until now
+ * @param len Payload data length
+ * @param state Validation state. Must be zeroed for a new payload
+ * @param msglen Size of the first SIP message for complete payloads
+ * @return one of validate_result values
+ */
+int
+sip_validate_payload(const u_char *payload, uint32_t len, sip_validate_state_t *state, uint32_t *msglen);
+
+/**
+ * @brief Check if the data could be a SIP message
+ *
+ * This only checks the beginning of the first line looks like a SIP
+ * request or response, so it can be used before any other parsing.
+ *
+ * @return 0 if data could be SIP, 1 otherwise
+ */
+int
+data_is_sip(const u_char *data, uint32_t len);
+
 /**
  * @brief Loads a new message from raw header/payload
  *
@@ -234,6 +395,24 @@ sip_validate_packet(packet_t *packet);
 sip_msg_t *
 sip_check_packet(packet_t *packet);
 
+/**
+ * @brief Configure which new dialogs are stored
+ *
+ * Sampling protects sngrep when it receives more dialogs than it can
+ * handle: only one of each sip.sample dialogs (selected by Call-ID hash,
+ * so all instances keep the same ones) is stored, dialogs matching any of
+ * sip.sample.priority patterns are always stored and, if
+ * sip.sample.countonly is enabled, dialogs not starting with INVITE are
+ * only counted.
+ *
+ * Call-IDs of not stored dialogs are remembered, so their following
+ * messages are skipped right after their Call-ID is read (see sip_sampler.h).
+ *
+ * @return 0 if sampling has been configured, 1 otherwise
+ */
+int
+sip_sample_init();
+
 /**
  * @brief Return if the call list has changed
  *
@@ -246,6 +425,31 @@ sip_check_packet(packet_t *packet);
 bool
 sip_calls_has_changed();
 
+/**
+ * @brief Wake up the interface because calls have changed
+ *
+ * Only one notification is sent until the interface clears it, so
+ * the interface wakes up once for any number of changes.
+ */
+void
+sip_calls_notify();
+
+/**
+ * @brief Get the file descriptor readable when calls have changed
+ *
+ * @return pipe read end or -1 if notifications are not available
+ */
+int
+sip_calls_notify_fd();
+
+/**
+ * @brief Clear pending change notifications
+ *
+ * Changes after this call will be notified again.
+ */
+void
+sip_calls_notify_clear();
+
 /**
  * @brief Getter for calls linked list size
  *
@@ -291,6 +495,23 @@ sip_calls_vector();
 vector_t *
 sip_active_calls_vector();
 
+/**
+ * @brief Return the list of calls matching current filters
+ *
+ * This list is updated when calls are added or removed, so it can be
+ * displayed without checking filters for all stored calls.
+ */
+vector_t *
+sip_displayed_calls_vector();
+
+/**
+ * @brief Rebuild the list of calls matching current filters
+ *
+ * Must be invoked after filters have changed.
+ */
+void
+sip_calls_refilter();
+
 /**
  * @brief Return stats from call list
  *
@@ -300,6 +521,42 @@ sip_active_calls_vector();
 sip_stats_t
 sip_calls_stats();
 
+/**
+ * @brief Return counters of stored dialogs and messages
+ */
+sip_counters_t
+sip_calls_counters();
+
+/**
+ * @brief Return totals of parsed messages and created and removed dialogs
+ */
+sip_totals_t
+sip_calls_totals();
+
+/**
+ * @brief Update counters with a stored or removed message
+ *
+ * @param msg SIP message
+ * @param delta 1 for stored messages, -1 for removed ones
+ */
+void
+sip_calls_count_msg(sip_msg_t *msg, int delta);
+
+/**
+ * @brief Update counters with a stored or removed call and its messages
+ *
+ * @param call SIP call
+ * @param delta 1 for stored calls, -1 for removed ones
+ */
+void
+sip_calls_count_call(sip_call_t *call, int delta);
+
+/**
+ * @brief Update counters when a call changes its state
+ */
+void
+sip_calls_count_state(int from, int to);
+
 
 /**
  * @brief Find a call structure in calls linked list given a call index
@@ -326,10 +583,10 @@ sip_find_by_callid(const char *callid);
  * @note This function assumes the msg is already part of a call
  *
  * @param msg SIP message structure
- * @param payload SIP message payload
+ * @param headers SIP message tokenized headers
  */
 void
-sip_parse_extra_headers(sip_msg_t *msg, const u_char *payload);
+sip_parse_extra_headers(sip_msg_t *msg, const sip_header_table_t *headers);
 
 /**
  * @brief Remove al calls
@@ -350,24 +607,142 @@ void
 sip_calls_clear_soft();
 
 /**
- * @brief Remove first call in the call list
+ * @brief Remove least recently updated call in the call list
  *
- * This function removes the first call in the calls vector avoiding
- * reaching the capture limit.
+ * This function removes the least recently updated unlocked call avoiding
+ * reaching the capture limit. Update list is kept by sip_calls_update so
+ * the removed call is usually its first entry.
  */
 void
 sip_calls_rotate();
 
+/**
+ * @brief Account memory added to a call and mark it as most recently updated
+ *
+ * If memory limit has been reached, least recently updated calls that are
+ * not locked are removed (given call is never removed).
+ */
+void
+sip_calls_update(sip_call_t *call, size_t memory);
+
+/**
+ * @brief Remove a call from the update list and memory accounting
+ */
+void
+sip_calls_unlink(sip_call_t *call);
+
+/**
+ * @brief Remove a call from the call list (it is not destroyed if locked)
+ */
+void
+sip_calls_remove(sip_call_t *call);
+
+/**
+ * @brief Remove least recently updated unlocked calls until memory limit
+ * is honored
+ *
+ * @param current Call being updated, it is never removed
+ */
+void
+sip_calls_evict(sip_call_t *current);
+
+/**
+ * @brief Get estimated memory used by stored calls
+ */
+size_t
+sip_calls_memory();
+
+/**
+ * @brief Get memory limit of stored calls (0 if unlimited)
+ */
+size_t
+sip_calls_memory_limit();
+
+/**
+ * @brief Get the most recently updated call
+ *
+ * Older calls can be walked using their updated_prev pointer.
+ */
+sip_call_t *
+sip_calls_last_updated();
+
+/**
+ * @brief Get the number of call updates since start
+ *
+ * Each updated call stores this counter value in its update field, so
+ * calls changed after some moment can be found.
+ */
+unsigned long
+sip_calls_updates();
+
+/**
+ * @brief Check if calls expire after some time without messages
+ */
+bool
+sip_calls_expire_enabled();
+
+/**
+ * @brief Schedule call expiration from now, based on its state
+ *
+ * Calls are stored in a wheel of one second slots, so expired calls
+ * can be found without checking all stored calls.
+ */
+void
+sip_calls_schedule(sip_call_t *call);
+
+/**
+ * @brief Remove a call from expiration wheel
+ */
+void
+sip_calls_unschedule(sip_call_t *call);
+
+/**
+ * @brief Remove unlocked calls that have expired before given time
+ *
+ * Only wheel slots of seconds since last check are checked.
+ */
+void
+sip_calls_expire(time_t now);
+
+/**
+ * @brief Update the media state of a call after a new message
+ *
+ * Streams of calls that have been completed, cancelled or rejected are
+ * removed from the streams index some seconds after their last message,
+ * so RTP packets are only matched against calls that can have media.
+ *
+ * @param call Call receiving the message
+ * @param msg Message that may have changed the call state
+ */
+void
+sip_calls_media_update(sip_call_t *call, sip_msg_t *msg);
+
+/**
+ * @brief Remove a call from the list of finished calls with media
+ */
+void
+sip_calls_media_unlink(sip_call_t *call);
+
+/**
+ * @brief Remove from the streams index finished calls media ended before given time
+ *
+ * Calls are checked in the order they finished, so only the calls
+ * whose media has ended are visited.
+ */
+void
+sip_calls_media_expire(time_t now);
+
 /**
  * @brief Get message Request/Response code
  *
  * Parse Payload to get Message Request/Response code.
  *
  * @param msg SIP Message to be parsed
+ * @param headers SIP message tokenized headers
  * @return numeric representation of Request/ResponseCode
  */
 int
-sip_get_msg_reqresp(sip_msg_t *msg, const u_char *payload);
+sip_get_msg_reqresp(sip_msg_t *msg, const sip_header_table_t *headers);
 
 /**
  * @brief Get full Response code (including text)
@@ -396,22 +771,24 @@ sip_parse_msg(sip_msg_t *msg);
  * Parse the payload content to set message attributes.
  *
  * @param msg SIP message structure
- * @param payload SIP message payload
+ * @param headers SIP message tokenized headers
  * @return 0 in all cases
  */
 int
-sip_parse_msg_payload(sip_msg_t *msg, const u_char *payload);
+sip_parse_msg_payload(sip_msg_t *msg, const sip_header_table_t *headers);
 
 /**
  * @brief Parse SIP Message payload for SDP media streams
  *
- * Parse the payload content to get SDP information
+ * Parse the body content to get SDP information. Streams are only
+ * created for media not already present in the call.
  *
  * @param msg SIP message structure
- * @return 0 in all cases
+ * @param body SIP message body
+ * @param len SIP message body length
  */
 void
-sip_parse_msg_media(sip_msg_t *msg, const u_char *payload);
+sip_parse_msg_media(sip_msg_t *msg, const char *body, uint32_t len);
 
 /**
  * @brief Set Capture Matching expression
@@ -424,10 +801,24 @@ sip_parse_msg_media(sip_msg_t *msg, const u_char *payload);
 int
 sip_set_match_expression(const char *expr, int insensitive, int invert);
 
+/**
+ * @brief Set Capture Matching patterns
+ *
+ * Payloads match if they contain any of the literal patterns read from
+ * the file (one pattern per line).
+ *
+ * @param file File containing patterns
+ * @param insensitive 1 for case insensitive matching
+ * @param invert 1 for reverse matching
+ * @return 0 if patterns have been loaded, 1 otherwise
+ */
+int
+sip_set_match_file(const char *file, int insensitive, int invert);
+
 /**
  * @brief Get Capture Matching expression
  *
- * @return String containing matching expression
+ * @return String containing matching expression (or patterns file name)
  */
 const char *
 sip_get_match_expression();
@@ -436,10 +827,11 @@ sip_get_match_expression();
  * @brief Checks if a given payload matches expression
  *
  * @param payload Packet payload
+ * @param len Packet payload length
  * @return 1 if matches, 0 otherwise
  */
 int
-sip_check_match_expression(const char *payload);
+sip_check_match_expression(const char *payload, uint32_t len);
 
 /**
  * @brief Get String value for a Method
@@ -488,9 +880,27 @@ sip_set_sort_options(sip_sort_t sort);
 sip_sort_t
 sip_sort_options();
 
+/**
+ * @brief Sort the call list using current sort options
+ *
+ * Sorting values are taken once per call and merge sorted, so the list
+ * is sorted in O(n log n).
+ */
 void
 sip_sort_list();
 
+/**
+ * @brief Compare two call sorting values using current sort options
+ */
+int
+sip_sort_key_compare(void *one, void *two);
+
+/**
+ * @brief Move a new call of the call list to its sorted position
+ *
+ * Position is found with a binary search, as the rest of the list is
+ * already sorted.
+ */
 void
 sip_list_sorter(vector_t *vector, void *item);
 
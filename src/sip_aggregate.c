@@ -0,0 +1,189 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file sip_aggregate.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in sip_aggregate.h
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "sip_aggregate.h"
+#include "sip.h"
+#include "hash.h"
+#include "util.h"
+
+/**
+ * @brief Aggregated methods and their counters
+ */
+static struct
+{
+    //! Bit mask of aggregated methods (1 << method)
+    uint32_t methods;
+    //! Counters (sip_aggregate_t)
+    vector_t *list;
+    //! Counters indexed by key
+    htable_t *index;
+    //! Combinations not counted because max has been reached
+    unsigned long dropped;
+} aggregate;
+
+int
+sip_aggregate_init(const char *methods)
+{
+    char *copy, *token;
+    int method;
+
+    aggregate.methods = 0;
+    if (!methods || !strlen(methods))
+        return 0;
+
+    if (!(copy = strdup(methods)))
+        return 1;
+
+    for (token = strtok(copy, ", "); token; token = strtok(NULL, ", ")) {
+        // Only requests methods can start an aggregated dialog
+        method = sip_method_from_str(token);
+        if (method <= 0 || method > SIP_METHOD_PRACK)
+            break;
+        aggregate.methods |= 1U << method;
+    }
+    sng_free(copy);
+
+    // Some method name is not valid
+    if (token) {
+        aggregate.methods = 0;
+        return 1;
+    }
+
+    aggregate.list = vector_create(64, 64);
+    aggregate.index = htable_create(64);
+    return 0;
+}
+
+void
+sip_aggregate_deinit()
+{
+    sip_aggregate_clear();
+    vector_destroy(aggregate.list);
+    // Nothing is allocated when no method is aggregated
+    if (aggregate.index)
+        htable_destroy(aggregate.index);
+    aggregate.list = NULL;
+    aggregate.index = NULL;
+    aggregate.methods = 0;
+}
+
+void
+sip_aggregate_clear()
+{
+    sip_aggregate_t *item;
+
+    if (!aggregate.list)
+        return;
+
+    // Counters are not freed by vector so list can be cloned by readers
+    vector_iter_t it = vector_iterator(aggregate.list);
+    while ((item = vector_iterator_next(&it)))
+        sng_free(item);
+    vector_clear(aggregate.list);
+
+    htable_destroy(aggregate.index);
+    aggregate.index = htable_create(64);
+    aggregate.dropped = 0;
+}
+
+int
+sip_aggregate_method(const sip_header_table_t *headers)
+{
+    const sip_header_t *cseq = &headers->headers[SIP_HEADER_CSEQ];
+    char name[32];
+    uint32_t start, i;
+    int method;
+
+    if (!aggregate.methods || !cseq->value)
+        return 0;
+
+    // CSeq: number followed by method
+    for (i = 0; i < cseq->len && isdigit(cseq->value[i]); i++);
+    for (; i < cseq->len && isspace(cseq->value[i]); i++);
+    for (start = i; i < cseq->len && !isspace(cseq->value[i]); i++);
+    if (i == start || i - start >= sizeof(name))
+        return 0;
+
+    memcpy(name, cseq->value + start, i - start);
+    name[i - start] = '\0';
+
+    method = sip_method_from_str(name);
+    if (method <= 0 || method > SIP_METHOD_PRACK || !(aggregate.methods & (1U << method)))
+        return 0;
+    return method;
+}
+
+void
+sip_aggregate_add(packet_t *packet, int method, int reqresp)
+{
+    sip_aggregate_t *item;
+    char key[ADDRESSLEN * 2 + 16], src[ADDRESSLEN], dst[ADDRESSLEN];
+    struct timeval ts = packet_time(packet);
+
+    address_get_ip(packet->src, src);
+    address_get_ip(packet->dst, dst);
+    snprintf(key, sizeof(key), "%s>%s %d %d", src, dst, method, reqresp);
+
+    if (!(item = htable_find(aggregate.index, key))) {
+        // Too many combinations
+        if (vector_count(aggregate.list) >= SIP_AGGREGATE_MAX
+                || !(item = sng_malloc(sizeof(sip_aggregate_t)))) {
+            aggregate.dropped++;
+            return;
+        }
+        strcpy(item->key, key);
+        item->src = packet->src;
+        item->src.port = 0;
+        item->dst = packet->dst;
+        item->dst.port = 0;
+        item->method = method;
+        item->reqresp = reqresp;
+        item->first = ts;
+        vector_append(aggregate.list, item);
+        htable_insert(aggregate.index, item->key, item);
+    }
+
+    item->count++;
+    item->last = ts;
+}
+
+vector_t *
+sip_aggregate_list()
+{
+    return aggregate.list;
+}
+
+unsigned long
+sip_aggregate_dropped()
+{
+    return aggregate.dropped;
+}
@@ -0,0 +1,130 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file sip_aggregate.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to count keepalive messages without storing dialogs
+ *
+ * Dialogs of methods configured in sip.aggregate setting (usually OPTIONS
+ * pings and REGISTER refreshes) are not stored. Each of their messages
+ * only updates a counter for its source and destination addresses (without
+ * port), dialog method and response code, with the time the combination was
+ * first and last seen.
+ *
+ * Counters are updated while parsing packets, so they are protected by the
+ * same lock as calls storage.
+ */
+#ifndef __SNGREP_SIP_AGGREGATE_H
+#define __SNGREP_SIP_AGGREGATE_H
+
+#include "config.h"
+#include <stdbool.h>
+#include <sys/time.h>
+#include "address.h"
+#include "packet.h"
+#include "sip_header.h"
+#include "vector.h"
+
+//! Max number of different counters, later combinations are not counted
+#define SIP_AGGREGATE_MAX 65536
+
+//! Shorter declaration of sip_aggregate structure
+typedef struct sip_aggregate sip_aggregate_t;
+
+/**
+ * @brief Messages counter of a source, destination, method and response
+ */
+struct sip_aggregate
+{
+    //! Lookup key built from all counter fields
+    char key[ADDRESSLEN * 2 + 16];
+    //! Source and destination addresses (port is not set)
+    address_t src;
+    address_t dst;
+    //! Dialog method (from CSeq)
+    int method;
+    //! Message method for requests or response code
+    int reqresp;
+    //! Counted messages
+    unsigned long count;
+    //! Capture time of first and last counted messages
+    struct timeval first;
+    struct timeval last;
+};
+
+/**
+ * @brief Set the methods of aggregated dialogs
+ *
+ * @param methods Method names separated by comma (NULL to disable)
+ * @return 0 if all methods are valid, 1 otherwise
+ */
+int
+sip_aggregate_init(const char *methods);
+
+/**
+ * @brief Remove all counters and free their memory
+ */
+void
+sip_aggregate_deinit();
+
+/**
+ * @brief Remove all counters
+ */
+void
+sip_aggregate_clear();
+
+/**
+ * @brief Get the method of a message if its dialog is aggregated
+ *
+ * @param headers Message headers
+ * @return CSeq method of aggregated dialogs, 0 otherwise
+ */
+int
+sip_aggregate_method(const sip_header_table_t *headers);
+
+/**
+ * @brief Count a message of an aggregated dialog
+ *
+ * @param packet Message packet
+ * @param method Dialog method
+ * @param reqresp Message method or response code
+ */
+void
+sip_aggregate_add(packet_t *packet, int method, int reqresp);
+
+/**
+ * @brief Get all counters
+ *
+ * Returned vector items (sip_aggregate_t) are owned by this module and can
+ * only be used while calls lock is held.
+ */
+vector_t *
+sip_aggregate_list();
+
+/**
+ * @brief Get the number of combinations that could not be counted
+ */
+unsigned long
+sip_aggregate_dropped();
+
+#endif /* __SNGREP_SIP_AGGREGATE_H */
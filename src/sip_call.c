@@ -29,18 +29,29 @@
  *
  */
 
+#include <ctype.h>
 #include "sip_call.h"
 #include "sip.h"
+#include "sip_export.h"
+#include "sip_column.h"
 #include "setting.h"
 
 sip_call_t *
-call_create(char *callid, char *xcallid)
+call_create(const char *callid, uint32_t callid_len, const char *xcallid, uint32_t xcallid_len)
 {
     sip_call_t *call;
+    arena_t *arena;
+
+    // Call data, messages and streams are allocated in the call memory
+    if (!(arena = arena_create(CALL_ARENA_SIZE)))
+        return NULL;
 
     // Initialize a new call structure
-    if (!(call = sng_malloc(sizeof(sip_call_t))))
+    if (!(call = arena_alloc(arena, sizeof(sip_call_t)))) {
+        arena_destroy(arena);
         return NULL;
+    }
+    call->arena = arena;
 
     // Create a vector to store call messages
     call->msgs = vector_create(2, 2);
@@ -54,7 +65,6 @@ call_create(char *callid, char *xcallid)
 
     // Create an empty vector to strore stream data
     call->streams = vector_create(0, 2);
-    vector_set_destroyer(call->streams, vector_generic_destroyer);
 
     // Create an empty vector to store x-calls
     call->xcalls = vector_create(0, 1);
@@ -63,8 +73,8 @@ call_create(char *callid, char *xcallid)
     call->filtered = -1;
 
     // Set message callid
-    call->callid = strdup(callid);
-    call->xcallid = strdup(xcallid);
+    call->callid = arena_strndup(call->arena, callid, callid_len);
+    call->xcallid = arena_strndup(call->arena, xcallid, xcallid_len);
 
     return call;
 }
@@ -72,19 +82,33 @@ call_create(char *callid, char *xcallid)
 void
 call_destroy(sip_call_t *call)
 {
+    vector_iter_t it;
+    rtp_stream_t *stream;
+
+    // Stop accounting this call memory and checking its expiration
+    sip_calls_unlink(call);
+    sip_calls_unschedule(call);
+    sip_calls_media_unlink(call);
+    // Stop publishing this call
+    sip_export_remove(call);
+    // Release first message attributes
+    sip_column_remove(call);
     // Remove all call messages
     vector_destroy(call->msgs);
     // Remove all call streams
+    call_unindex_streams(call);
+    it = vector_iterator(call->streams);
+    while ((stream = vector_iterator_next(&it)))
+        stream_clear_samples(stream);
     vector_destroy(call->streams);
     // Remove all call rtp packets
     vector_destroy(call->rtp_packets);
     // Remove all xcalls
     vector_destroy(call->xcalls);
     // Deallocate call memory
-    sng_free(call->callid);
-    sng_free(call->xcallid);
     sng_free(call->reasontxt);
-    sng_free(call);
+    sng_free(call->coltext);
+    arena_destroy(call->arena);
 }
 
 void
@@ -93,6 +117,16 @@ call_destroyer(void *call)
     call_destroy((sip_call_t*)call);
 }
 
+void
+call_unindex_streams(sip_call_t *call)
+{
+    vector_iter_t it = vector_iterator(call->streams);
+    rtp_stream_t *stream;
+
+    while ((stream = vector_iterator_next(&it)))
+        rtp_index_remove(stream);
+}
+
 bool
 call_has_changed(sip_call_t *call)
 {
@@ -102,21 +136,85 @@ call_has_changed(sip_call_t *call)
 void
 call_add_message(sip_call_t *call, sip_msg_t *msg)
 {
+    uint8_t *index = call->payload_index;
+
     // Set the message owner
     msg->call = call;
     // Put this msg at the end of the msg list
     msg->index = vector_append(call->msgs, msg);
+    // Store first message attributes in columns
+    if (msg->index == 0)
+        sip_column_add(call);
     // Flag this call as changed
     call->changed = true;
+    call->coltext_layout = 0;
+    // Allow payload filter to discard this call without checking payloads
+    if (setting_enabled(SETTING_FILTER_PAYLOAD_INDEX))
+        call_index_payload(call, msg_get_payload(msg), packet_payloadlen(msg->packet));
+    // Account message memory (and call memory for its first message)
+    sip_calls_update(call, sizeof(sip_msg_t) + capture_packet_size(msg->packet)
+                     + (msg->index == 0 ? sizeof(sip_call_t) : 0)
+                     + (call->payload_index != index ? CALL_INDEX_BITS / 8 : 0));
+}
+
+uint32_t
+call_index_trigram(const char *text)
+{
+    uint32_t gram = ((uint32_t) tolower((u_char) text[0]) << 16)
+                    | ((uint32_t) tolower((u_char) text[1]) << 8)
+                    | (uint32_t) tolower((u_char) text[2]);
+
+    // Multiplicative hash, index size is a power of two
+    return (gram * 2654435761U) % CALL_INDEX_BITS;
+}
+
+void
+call_index_payload(sip_call_t *call, const char *payload, uint32_t len)
+{
+    uint32_t i, bit;
+
+    if (!payload || len < 3)
+        return;
+
+    if (!call->payload_index) {
+        if (!(call->payload_index = arena_alloc(call->arena, CALL_INDEX_BITS / 8)))
+            return;
+    }
+
+    for (i = 0; i + 2 < len; i++) {
+        bit = call_index_trigram(payload + i);
+        call->payload_index[bit / 8] |= 1 << (bit % 8);
+    }
+}
+
+bool
+call_index_check(sip_call_t *call, const uint32_t *bits, uint32_t count)
+{
+    uint32_t i;
+
+    // Calls without index must be checked
+    if (!call->payload_index)
+        return true;
+
+    for (i = 0; i < count; i++) {
+        if (!(call->payload_index[bits[i] / 8] & (1 << (bits[i] % 8))))
+            return false;
+    }
+    return true;
 }
 
 void
 call_add_stream(sip_call_t *call, rtp_stream_t *stream)
 {
     // Store stream
-    vector_append(call->streams, stream);
+    stream->index = vector_append(call->streams, stream);
+    // Allow finding this stream by its destination
+    rtp_index_add(stream);
     // Flag this call as changed
     call->changed = true;
+    call->coltext_layout = 0;
+    // Account stream memory
+    sip_calls_update(call, sizeof(rtp_stream_t));
 }
 
 void
@@ -126,6 +224,9 @@ call_add_rtp_packet(sip_call_t *call, packet_t *packet)
     vector_append(call->rtp_packets, packet);
     // Flag this call as changed
     call->changed = true;
+    call->coltext_layout = 0;
+    // Account packet memory
+    sip_calls_update(call, capture_packet_size(packet));
 }
 
 int
@@ -153,21 +254,43 @@ call_is_invite(sip_call_t *call)
 void
 call_msg_retrans_check(sip_msg_t *msg)
 {
+    sip_call_t *call = msg->call;
     sip_msg_t *prev = NULL;
     vector_iter_t it;
+    int slot;
 
     // Get previous message in call with same origin and destination
-    it = vector_iterator(msg->call->msgs);
-    vector_iterator_set_current(&it, vector_index(msg->call->msgs, msg));
-    while ((prev = vector_iterator_prev(&it))) {
+    for (slot = 0; slot < CALL_RETRANS_SLOTS && call->last_msgs[slot]; slot++) {
+        prev = call->last_msgs[slot];
         if (addressport_equals(prev->packet->src, msg->packet->src) &&
                 addressport_equals(prev->packet->dst, msg->packet->dst))
             break;
+        prev = NULL;
+    }
+
+    // Only dialogs with many directions need to search older messages
+    if (slot == CALL_RETRANS_SLOTS) {
+        it = vector_iterator(call->msgs);
+        vector_iterator_set_current(&it, vector_index(call->msgs, msg));
+        while ((prev = vector_iterator_prev(&it))) {
+            if (addressport_equals(prev->packet->src, msg->packet->src) &&
+                    addressport_equals(prev->packet->dst, msg->packet->dst))
+                break;
+        }
+        slot--;
     }
 
+    // This message is now the last one of its direction
+    memmove(&call->last_msgs[1], &call->last_msgs[0], slot * sizeof(sip_msg_t *));
+    call->last_msgs[0] = msg;
+
     // Store the flag that determines if message is retrans
-    if (prev && !strcasecmp(msg_get_payload(msg), msg_get_payload(prev))) {
+    // (compare fingerprints first, so stored payloads are not loaded needlessly)
+    if (prev && prev->fingerprint == msg->fingerprint
+            && packet_payloadlen(prev->packet) == packet_payloadlen(msg->packet)
+            && !strcasecmp(msg_get_payload(msg), msg_get_payload(prev))) {
         msg->retrans = prev;
+        msg->packet->retrans = prev->packet;
     }
 }
 
@@ -196,7 +319,7 @@ call_msg_with_media(sip_call_t *call, address_t dst)
 void
 call_update_state(sip_call_t *call, sip_msg_t *msg)
 {
-    int reqresp;
+    int reqresp, state = call->state;
     sip_msg_t *first;
 
     if (!call_is_invite(call))
@@ -246,16 +369,27 @@ call_update_state(sip_call_t *call, sip_msg_t *msg)
             call->state = SIP_CALLSTATE_CALLSETUP;
         }
     }
+
+    // Keep call state counters updated
+    if (call->state != state)
+        sip_calls_count_state(state, call->state);
 }
 
 const char *
 call_get_attribute(sip_call_t *call, enum sip_attr_id id, char *value)
 {
     sip_msg_t *first, *last;
+    const char *column;
 
     if (!call)
         return NULL;
 
+    // First message attributes stored in columns
+    if ((column = sip_column_value(call, id))) {
+        strcpy(value, column);
+        return strlen(value) ? value : NULL;
+    }
+
     switch (id) {
         case SIP_ATTR_CALLINDEX:
             sprintf(value, "%d", call->index);
@@ -325,50 +459,55 @@ call_state_to_str(int state)
 int
 call_attr_compare(sip_call_t *one, sip_call_t *two, enum sip_attr_id id)
 {
-    char onevalue[256], twovalue[256];
-    int oneintvalue, twointvalue;
-    int comparetype; /* TODO 0 = string compare, 1 = int comprare */
+    char onevalue[SIP_ATTR_MAXLEN + 1], twovalue[SIP_ATTR_MAXLEN + 1];
+    int oneintvalue, twointvalue, cmp;
+
+    // Attributes stored in columns are compared without copying them
+    if (sip_column_compare(one, two, id, &cmp) == 0)
+        return cmp;
+
+    // Numeric attributes
+    if (call_attr_sort_value(one, id, onevalue, &oneintvalue)) {
+        call_attr_sort_value(two, id, twovalue, &twointvalue);
+        if (oneintvalue == twointvalue) return 0;
+        return (oneintvalue > twointvalue) ? 1 : -1;
+    }
+
+    call_attr_sort_value(two, id, twovalue, &twointvalue);
+    return call_attr_compare_text(onevalue, twovalue);
+}
 
+int
+call_attr_sort_value(sip_call_t *call, enum sip_attr_id id, char *value, int *number)
+{
     switch (id) {
         case SIP_ATTR_CALLINDEX:
-            oneintvalue = one->index;
-            twointvalue = two->index;
-            comparetype = 1;
-            break;
+            *number = call->index;
+            return 1;
         case SIP_ATTR_MSGCNT:
-            oneintvalue = call_msg_count(one);
-            twointvalue = call_msg_count(two);
-            comparetype = 1;
-            break;
-        default:
-            // Get attribute values
-            memset(onevalue, 0, sizeof(onevalue));
-            memset(twovalue, 0, sizeof(twovalue));
-            call_get_attribute(one, id, onevalue);
-            call_get_attribute(two, id, twovalue);
-            comparetype = 0;
-            break;
-    }
-
-    switch (comparetype) {
-        case 0:
-            if (strlen(twovalue) == 0 && strlen(onevalue) == 0)
-                return 0;
-            if (strlen(twovalue) == 0)
-                return 1;
-            if (strlen(onevalue) == 0)
-                return -1;
-            return strcmp(onevalue, twovalue);
-        case 1:
-            if (oneintvalue == twointvalue) return 0;
-            if (oneintvalue > twointvalue) return 1;
-            if (oneintvalue < twointvalue) return -1;
-            /* no break */
+            *number = call_msg_count(call);
+            return 1;
         default:
+            // Get attribute value
+            memset(value, 0, SIP_ATTR_MAXLEN + 1);
+            call_get_attribute(call, id, value);
             return 0;
     }
 }
 
+int
+call_attr_compare_text(const char *one, const char *two)
+{
+    // Empty values are sorted last
+    if (!*one && !*two)
+        return 0;
+    if (!*two)
+        return 1;
+    if (!*one)
+        return -1;
+    return strcmp(one, two);
+}
+
 void
 call_add_xcall(sip_call_t *call, sip_call_t *xcall)
 {
@@ -377,6 +516,7 @@ call_add_xcall(sip_call_t *call, sip_call_t *xcall)
 
     // Mark this call as changed
     call->changed = true;
+    call->coltext_layout = 0;
     // Add the xcall to the list
     vector_append(call->xcalls, xcall);
 }
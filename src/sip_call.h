@@ -36,6 +36,14 @@
 #include "rtp.h"
 #include "sip_msg.h"
 #include "sip_attr.h"
+#include "arena.h"
+
+//! Number of message directions remembered to detect retransmissions
+#define CALL_RETRANS_SLOTS  4
+//! Size of the first memory chunk of a call (call data and a few messages)
+#define CALL_ARENA_SIZE     2048
+//! Number of bits of each call payload index (power of two)
+#define CALL_INDEX_BITS     4096
 
 //! Shorter declaration of sip_call structure
 typedef struct sip_call sip_call_t;
@@ -60,6 +68,8 @@ enum call_state
  * data from its messages to speed up searches.
  */
 struct sip_call {
+    //! Memory holding call data, messages, SDP media and streams
+    arena_t *arena;
     // Call index in the call list
     int index;
     // Call identifier
@@ -72,6 +82,10 @@ struct sip_call {
     int state;
     //! Changed flag. For interface optimal updates
     bool changed;
+    //! Cached text of call list columns
+    char *coltext;
+    //! Call list columns layout of cached text (0 if call has changed)
+    int coltext_layout;
     //! Locked flag. Calls locked are never deleted
     bool locked;
     //! Last reason text value for this call
@@ -84,12 +98,34 @@ struct sip_call {
     uint32_t invitecseq;
     //! List of messages of this call (sip_msg_t*)
     vector_t *msgs;
+    //! Bitmap of hashed trigrams in messages payload (NULL if not indexed)
+    uint8_t *payload_index;
     //! Message when conversation started and ended
     sip_msg_t *cstart_msg, *cend_msg;
+    //! Last message of the most recent source/destination pairs (newest first)
+    sip_msg_t *last_msgs[CALL_RETRANS_SLOTS];
     //! RTP streams for this call (rtp_stream_t *)
     vector_t *streams;
+    //! Number of this call streams in the streams index
+    int media_streams;
+    //! Time media of this finished call stops being matched (0 if not finished)
+    time_t media_end;
+    //! Previous and next calls in media ending order
+    sip_call_t *media_prev, *media_next;
     //! RTP packets for this call (capture_packet_t *)
     vector_t *rtp_packets;
+    //! Estimated memory used by this call messages, packets and streams
+    size_t memory;
+    //! Previous and next calls in update order (least recently updated first)
+    sip_call_t *updated_prev, *updated_next;
+    //! Calls updates counter value in this call last update
+    unsigned long update;
+    //! Row of first message attributes in columns table (0 if not stored)
+    uint32_t column_row;
+    //! Time this call will expire (0 if it never expires)
+    time_t expire;
+    //! Previous and next calls expiring in the same wheel slot
+    sip_call_t *expire_prev, *expire_next;
 };
 
 /**
@@ -99,11 +135,13 @@ struct sip_call {
  * header structure to all the messages with the same callid.
  *
  * @param callid Call-ID Header value
+ * @param callid_len Call-ID Header value length
  * @param xcallid X-Call-ID Header value
+ * @param xcallid_len X-Call-ID Header value length
  * @return pointer to the sip_call created
  */
 sip_call_t *
-call_create(char *callid, char *xcallid);
+call_create(const char *callid, uint32_t callid_len, const char *xcallid, uint32_t xcallid_len);
 
 /**
  * @brief Free all related memory from a call and remove from call list
@@ -148,6 +186,53 @@ call_has_changed(sip_call_t *call);
 void
 call_add_message(sip_call_t *call, sip_msg_t *msg);
 
+/**
+ * @brief Get the hash of a three characters sequence
+ *
+ * Characters are compared case insensitive, like filter expressions.
+ *
+ * @return bit of the payload index for this trigram
+ */
+uint32_t
+call_index_trigram(const char *text);
+
+/**
+ * @brief Add all trigrams of a message payload to the call index
+ *
+ * Index is allocated with the first indexed message.
+ *
+ * @param call pointer to the call owner of the message
+ * @param payload message payload
+ * @param len payload length
+ */
+void
+call_index_payload(sip_call_t *call, const char *payload, uint32_t len);
+
+/**
+ * @brief Check if all given trigrams could be in any message payload
+ *
+ * Index may give false positives (trigrams with the same hash) but
+ * never false negatives.
+ *
+ * @param call pointer to the call to be checked
+ * @param bits trigram hashes as returned by call_index_trigram
+ * @param count number of trigram hashes
+ * @return false if any of the trigrams is not in the call payloads or
+ * true if they may be (or call is not indexed)
+ */
+bool
+call_index_check(sip_call_t *call, const uint32_t *bits, uint32_t count);
+
+/**
+ * @brief Remove call streams from the streams index
+ *
+ * RTP packets will no longer be matched against this call streams.
+ *
+ * @param call pointer to the call owner of the streams
+ */
+void
+call_unindex_streams(sip_call_t *call);
+
 /**
  * @brief Append a new RTP stream to the call
  *
@@ -258,6 +343,26 @@ call_state_to_str(int state);
 int
 call_attr_compare(sip_call_t *one, sip_call_t *two, enum sip_attr_id id);
 
+/**
+ * @brief Get the value used to compare calls by a given attribute
+ *
+ * @param call SIP call structure
+ * @param id attribute id
+ * @param value character array of SIP_ATTR_MAXLEN + 1 to store text values
+ * @param number pointer to store numeric values
+ * @return 1 if attribute is compared as a number, 0 if it is compared as text
+ */
+int
+call_attr_sort_value(sip_call_t *call, enum sip_attr_id id, char *value, int *number);
+
+/**
+ * @brief Compare two text attribute values
+ *
+ * Empty values are greater than any other value.
+ */
+int
+call_attr_compare_text(const char *one, const char *two);
+
 /**
  * @brief Relate this two calls
  *
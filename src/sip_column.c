@@ -0,0 +1,359 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file sip_column.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in sip_column.h
+ *
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include "sip_column.h"
+#include "util.h"
+
+/**
+ * @brief Columns table
+ */
+static struct
+{
+    //! Different values of each column
+    sip_column_dict_t dicts[SIP_COLUMN_COUNT];
+    //! Value code of each row in each column
+    uint32_t *codes[SIP_COLUMN_COUNT];
+    //! Allocated rows (row 0 is never used)
+    uint32_t size;
+    //! Rows ever used (unused ones are in free list)
+    uint32_t count;
+    //! Rows without call, reused before allocating new ones
+    uint32_t *free;
+    uint32_t freecnt;
+} columns;
+
+//! Attribute of each column
+static const enum sip_attr_id sip_column_attrs[SIP_COLUMN_COUNT] = {
+    SIP_ATTR_SIPFROM, SIP_ATTR_SIPFROMUSER, SIP_ATTR_SIPTO, SIP_ATTR_SIPTOUSER,
+    SIP_ATTR_SRC, SIP_ATTR_DST, SIP_ATTR_METHOD, SIP_ATTR_TRANSPORT
+};
+
+//! Dictionary being ranked (qsort has no user data argument)
+static sip_column_dict_t *sip_column_sorted;
+
+enum sip_column_id
+sip_column_from_attr(enum sip_attr_id id)
+{
+    enum sip_column_id col;
+
+    for (col = 0; col < SIP_COLUMN_COUNT; col++) {
+        if (sip_column_attrs[col] == id)
+            return col;
+    }
+    return SIP_COLUMN_COUNT;
+}
+
+/**
+ * @brief Make room for one more entry in a growing array
+ *
+ * @return 0 on success, 1 on memory error
+ */
+static int
+sip_column_grow(void **array, size_t item, uint32_t size)
+{
+    void *grown;
+
+    if (!(grown = realloc(*array, item * size)))
+        return 1;
+    *array = grown;
+    return 0;
+}
+
+/**
+ * @brief Get the code of a value, adding it to the dictionary if required
+ *
+ * @return 0 on success, 1 on memory error
+ */
+static int
+sip_column_dict_code(sip_column_dict_t *dict, const char *value, uint32_t *code)
+{
+    uintptr_t found;
+    uint32_t size;
+    char *copy;
+
+    if (!dict->codes && !(dict->codes = htable_create(SIP_COLUMN_CODES)))
+        return 1;
+
+    // Value already in the dictionary
+    if ((found = (uintptr_t) htable_find(dict->codes, value))) {
+        *code = found - 1;
+        dict->refs[*code]++;
+        return 0;
+    }
+
+    // Reuse a code without rows or allocate a new one
+    if (dict->freecnt) {
+        *code = dict->free[--dict->freecnt];
+    } else {
+        if (dict->count == dict->size) {
+            size = dict->size + SIP_COLUMN_CODES;
+            if (sip_column_grow((void **) &dict->values, sizeof(char *), size) != 0
+                    || sip_column_grow((void **) &dict->refs, sizeof(uint32_t), size) != 0
+                    || sip_column_grow((void **) &dict->matches, sizeof(atomic_schar), size) != 0
+                    || sip_column_grow((void **) &dict->free, sizeof(uint32_t), size) != 0)
+                return 1;
+            dict->size = size;
+        }
+        *code = dict->count++;
+    }
+
+    if (!(copy = strdup(value)) || htable_insert(dict->codes, copy, (void *) ((uintptr_t) *code + 1)) != 0) {
+        sng_free(copy);
+        dict->free[dict->freecnt++] = *code;
+        return 1;
+    }
+
+    dict->values[*code] = copy;
+    dict->refs[*code] = 1;
+    atomic_init(&dict->matches[*code], SIP_COLUMN_MATCH_UNKNOWN);
+    return 0;
+}
+
+/**
+ * @brief Release a row reference to a dictionary code
+ */
+static void
+sip_column_dict_release(sip_column_dict_t *dict, uint32_t code)
+{
+    if (--dict->refs[code])
+        return;
+
+    htable_remove(dict->codes, dict->values[code]);
+    sng_free(dict->values[code]);
+    dict->values[code] = NULL;
+    dict->free[dict->freecnt++] = code;
+}
+
+int
+sip_column_add(sip_call_t *call)
+{
+    char value[SIP_ATTR_MAXLEN + 1];
+    uint32_t row, size, code;
+    int col, i;
+
+    if (call->column_row || !vector_count(call->msgs))
+        return 0;
+
+    // Reuse a row of a removed call or allocate a new one
+    if (columns.freecnt) {
+        row = columns.free[--columns.freecnt];
+    } else {
+        if (columns.count + 1 >= columns.size) {
+            size = columns.size + SIP_COLUMN_ROWS;
+            for (col = 0; col < SIP_COLUMN_COUNT; col++) {
+                if (sip_column_grow((void **) &columns.codes[col], sizeof(uint32_t), size) != 0)
+                    return 1;
+            }
+            if (sip_column_grow((void **) &columns.free, sizeof(uint32_t), size) != 0)
+                return 1;
+            columns.size = size;
+        }
+        row = ++columns.count;
+    }
+
+    // Values are taken before the call has a row, so they come from the message
+    for (col = 0; col < SIP_COLUMN_COUNT; col++) {
+        memset(value, 0, sizeof(value));
+        call_get_attribute(call, sip_column_attrs[col], value);
+        if (sip_column_dict_code(&columns.dicts[col], value, &code) != 0) {
+            for (i = 0; i < col; i++)
+                sip_column_dict_release(&columns.dicts[i], columns.codes[i][row]);
+            columns.free[columns.freecnt++] = row;
+            return 1;
+        }
+        columns.codes[col][row] = code;
+    }
+
+    call->column_row = row;
+    return 0;
+}
+
+void
+sip_column_remove(sip_call_t *call)
+{
+    int col;
+
+    if (!call->column_row)
+        return;
+
+    for (col = 0; col < SIP_COLUMN_COUNT; col++)
+        sip_column_dict_release(&columns.dicts[col], columns.codes[col][call->column_row]);
+    columns.free[columns.freecnt++] = call->column_row;
+    call->column_row = 0;
+}
+
+void
+sip_column_clear()
+{
+    sip_column_dict_t *dict;
+    uint32_t code;
+    int col;
+
+    for (col = 0; col < SIP_COLUMN_COUNT; col++) {
+        dict = &columns.dicts[col];
+        if (dict->codes)
+            htable_destroy(dict->codes);
+        for (code = 0; code < dict->count; code++)
+            sng_free(dict->values[code]);
+        sng_free(dict->values);
+        sng_free(dict->refs);
+        sng_free(dict->matches);
+        sng_free(dict->free);
+        sng_free(columns.codes[col]);
+    }
+    sng_free(columns.free);
+    memset(&columns, 0, sizeof(columns));
+}
+
+const char *
+sip_column_value(sip_call_t *call, enum sip_attr_id id)
+{
+    enum sip_column_id col;
+
+    if (!call->column_row || (col = sip_column_from_attr(id)) == SIP_COLUMN_COUNT)
+        return NULL;
+
+    return columns.dicts[col].values[columns.codes[col][call->column_row]];
+}
+
+int
+sip_column_compare(sip_call_t *one, sip_call_t *two, enum sip_attr_id id, int *cmp)
+{
+    enum sip_column_id col;
+    uint32_t onecode, twocode;
+
+    if (!one->column_row || !two->column_row || (col = sip_column_from_attr(id)) == SIP_COLUMN_COUNT)
+        return 1;
+
+    // Equal values share their code
+    onecode = columns.codes[col][one->column_row];
+    twocode = columns.codes[col][two->column_row];
+    *cmp = (onecode == twocode) ? 0 : call_attr_compare_text(columns.dicts[col].values[onecode],
+                                                               columns.dicts[col].values[twocode]);
+    return 0;
+}
+
+/**
+ * @brief Sort used codes by their values
+ */
+static int
+sip_column_code_cmp(const void *one, const void *two)
+{
+    return call_attr_compare_text(sip_column_sorted->values[*(const uint32_t *) one],
+                                  sip_column_sorted->values[*(const uint32_t *) two]);
+}
+
+int
+sip_column_ranks(enum sip_attr_id id, uint32_t **ranks)
+{
+    enum sip_column_id col;
+    sip_column_dict_t *dict;
+    uint32_t *codes, used = 0, code, i;
+
+    if ((col = sip_column_from_attr(id)) == SIP_COLUMN_COUNT)
+        return 1;
+    dict = &columns.dicts[col];
+
+    // Last rank is for calls without row
+    if (!(*ranks = malloc(sizeof(uint32_t) * (dict->count + 1))))
+        return 1;
+    if (!(codes = malloc(sizeof(uint32_t) * (dict->count + 1)))) {
+        sng_free(*ranks);
+        *ranks = NULL;
+        return 1;
+    }
+
+    // Only different values are sorted, usually far less than calls
+    for (code = 0; code < dict->count; code++) {
+        if (dict->values[code])
+            codes[used++] = code;
+    }
+    sip_column_sorted = dict;
+    qsort(codes, used, sizeof(uint32_t), sip_column_code_cmp);
+
+    for (i = 0; i < used; i++) {
+        code = codes[i];
+        (*ranks)[code] = *dict->values[code] ? i : used;
+    }
+    (*ranks)[dict->count] = used;
+
+    sng_free(codes);
+    return 0;
+}
+
+uint32_t
+sip_column_rank(sip_call_t *call, enum sip_attr_id id, const uint32_t *ranks)
+{
+    enum sip_column_id col = sip_column_from_attr(id);
+
+    if (!call->column_row)
+        return ranks[columns.dicts[col].count];
+    return ranks[columns.codes[col][call->column_row]];
+}
+
+int
+sip_column_match_get(sip_call_t *call, enum sip_attr_id id)
+{
+    enum sip_column_id col;
+
+    if (!call->column_row || (col = sip_column_from_attr(id)) == SIP_COLUMN_COUNT)
+        return SIP_COLUMN_MATCH_UNKNOWN;
+
+    return atomic_load_explicit(&columns.dicts[col].matches[columns.codes[col][call->column_row]],
+                                memory_order_relaxed);
+}
+
+void
+sip_column_match_set(sip_call_t *call, enum sip_attr_id id, int matched)
+{
+    enum sip_column_id col;
+
+    if (!call->column_row || (col = sip_column_from_attr(id)) == SIP_COLUMN_COUNT)
+        return;
+
+    // Filter workers may store the same result of a value at the same time
+    atomic_store_explicit(&columns.dicts[col].matches[columns.codes[col][call->column_row]],
+                          matched, memory_order_relaxed);
+}
+
+void
+sip_column_match_reset()
+{
+    sip_column_dict_t *dict;
+    uint32_t code;
+    int col;
+
+    for (col = 0; col < SIP_COLUMN_COUNT; col++) {
+        dict = &columns.dicts[col];
+        for (code = 0; code < dict->count; code++)
+            atomic_store_explicit(&dict->matches[code], SIP_COLUMN_MATCH_UNKNOWN, memory_order_relaxed);
+    }
+}
@@ -0,0 +1,191 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file sip_column.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to store call attributes in dictionary encoded columns
+ *
+ * Some call attributes are taken from the first call message and never
+ * change: From and To URIs and users, source and destination addresses,
+ * method and transport. When the first message is added to a call, these
+ * values are stored once in a dictionary of each attribute and the call
+ * is given a row of the columns table, where the code of each value is
+ * kept.
+ *
+ * Most calls share a few different values, so sorting compares the rank
+ * of each code instead of the text, and filters are checked once for each
+ * different value instead of once for each call. Getting these attributes
+ * copies the stored value without parsing message headers.
+ *
+ * Columns are changed holding calls write lock, and read holding at least
+ * calls read lock.
+ */
+#ifndef __SNGREP_SIP_COLUMN_H
+#define __SNGREP_SIP_COLUMN_H
+
+#include "config.h"
+#include <stdint.h>
+#include <stdatomic.h>
+#include "sip_attr.h"
+#include "sip_call.h"
+#include "hash.h"
+
+//! Rows allocated when columns table grows
+#define SIP_COLUMN_ROWS     1024
+//! Codes allocated when a dictionary grows
+#define SIP_COLUMN_CODES    256
+
+//! Call attributes stored in columns
+enum sip_column_id {
+    SIP_COLUMN_SIPFROM = 0,
+    SIP_COLUMN_SIPFROMUSER,
+    SIP_COLUMN_SIPTO,
+    SIP_COLUMN_SIPTOUSER,
+    SIP_COLUMN_SRC,
+    SIP_COLUMN_DST,
+    SIP_COLUMN_METHOD,
+    SIP_COLUMN_TRANSPORT,
+    //! Number of stored columns
+    SIP_COLUMN_COUNT
+};
+
+//! Filter result of a value not checked yet
+#define SIP_COLUMN_MATCH_UNKNOWN    -1
+
+//! Shorter declaration of sip_column_dict structure
+typedef struct sip_column_dict sip_column_dict_t;
+
+/**
+ * @brief Different values of a column
+ */
+struct sip_column_dict
+{
+    //! Code of each value (code + 1, values are the keys)
+    htable_t *codes;
+    //! Value of each code (NULL for unused codes)
+    char **values;
+    //! Rows using each code
+    uint32_t *refs;
+    //! Filter result of each code (SIP_COLUMN_MATCH_UNKNOWN until checked)
+    atomic_schar *matches;
+    //! Allocated codes
+    uint32_t size;
+    //! Codes ever used (unused ones are in free list)
+    uint32_t count;
+    //! Codes without rows, reused before allocating new ones
+    uint32_t *free;
+    uint32_t freecnt;
+};
+
+/**
+ * @brief Get the column of an attribute
+ *
+ * @return column id or SIP_COLUMN_COUNT if attribute is not stored in columns
+ */
+enum sip_column_id
+sip_column_from_attr(enum sip_attr_id id);
+
+/**
+ * @brief Store attributes of a call first message
+ *
+ * @return 0 on success, 1 on memory error (call attributes are then taken
+ * from the message)
+ */
+int
+sip_column_add(sip_call_t *call);
+
+/**
+ * @brief Release the row of a call
+ */
+void
+sip_column_remove(sip_call_t *call);
+
+/**
+ * @brief Remove all rows and values
+ */
+void
+sip_column_clear();
+
+/**
+ * @brief Get the stored value of an attribute
+ *
+ * @return value or NULL if call has no row or attribute is not a column
+ */
+const char *
+sip_column_value(sip_call_t *call, enum sip_attr_id id);
+
+/**
+ * @brief Compare an attribute of two calls
+ *
+ * Calls without stored value are sorted as empty values (last).
+ *
+ * @param cmp Set to comparison result (as call_attr_compare_text)
+ * @return 0 if both calls have the attribute stored, 1 otherwise
+ */
+int
+sip_column_compare(sip_call_t *one, sip_call_t *two, enum sip_attr_id id, int *cmp);
+
+/**
+ * @brief Get the sorting rank of each code of a column
+ *
+ * Ranks follow call_attr_compare_text order, so empty values get the
+ * highest one (the number of used codes), as calls without row.
+ *
+ * @param ranks Set to allocated ranks (indexed by code, last one is used
+ * for calls without row)
+ * @return 0 on success, 1 on memory error or attribute is not a column
+ */
+int
+sip_column_ranks(enum sip_attr_id id, uint32_t **ranks);
+
+/**
+ * @brief Get the rank of a call attribute from sip_column_ranks result
+ */
+uint32_t
+sip_column_rank(sip_call_t *call, enum sip_attr_id id, const uint32_t *ranks);
+
+/**
+ * @brief Get the stored filter result of a call attribute value
+ *
+ * @return 0 or 1 if already checked, SIP_COLUMN_MATCH_UNKNOWN otherwise
+ */
+int
+sip_column_match_get(sip_call_t *call, enum sip_attr_id id);
+
+/**
+ * @brief Store the filter result of a call attribute value
+ *
+ * Filter results are shared by all calls with the same value.
+ */
+void
+sip_column_match_set(sip_call_t *call, enum sip_attr_id id, int matched);
+
+/**
+ * @brief Forget all stored filter results
+ *
+ * Must be called whenever filter expressions change.
+ */
+void
+sip_column_match_reset();
+
+#endif /* __SNGREP_SIP_COLUMN_H */
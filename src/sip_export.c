@@ -0,0 +1,229 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file sip_export.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in sip_export.h
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "sip_export.h"
+#include "sip.h"
+#include "rtp.h"
+#include "util.h"
+
+/**
+ * @brief Shared memory table state
+ */
+static struct
+{
+    //! Shared memory object name (NULL if disabled)
+    char *name;
+    //! Mapped table
+    sip_export_header_t *header;
+    //! Mapped table size
+    size_t size;
+    //! Calls updates counter value of last published changes
+    unsigned long published;
+    //! Summary being built before being copied to its slot
+    sip_export_slot_t slot;
+} export;
+
+int
+sip_export_init(const char *name, int slots)
+{
+    sip_export_header_t *header;
+    int fd, i;
+
+    if (!name || !strlen(name))
+        return 0;
+
+    if (slots <= 0)
+        slots = SIP_EXPORT_SLOTS;
+
+    // Shared memory names must start with a slash
+    if (!(export.name = sng_malloc(strlen(name) + 2)))
+        return 1;
+    sprintf(export.name, "%s%s", (name[0] == '/') ? "" : "/", name);
+
+    // Readers only require read permission
+    export.size = sizeof(sip_export_header_t) + (size_t) slots * sizeof(sip_export_slot_t);
+    if ((fd = shm_open(export.name, O_CREAT | O_RDWR, 0644)) == -1)
+        goto error;
+
+    // Discard contents left by a previous run
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, export.size) != 0) {
+        close(fd);
+        goto unlink;
+    }
+
+    header = mmap(NULL, export.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED)
+        goto unlink;
+
+    header->version = SIP_EXPORT_VERSION;
+    header->header_size = sizeof(sip_export_header_t);
+    header->slot_size = sizeof(sip_export_slot_t);
+    header->slots = slots;
+    header->attrs = SIP_ATTR_COUNT;
+    header->textlen = SIP_EXPORT_TEXTLEN;
+    header->pid = getpid();
+    header->created = time(NULL);
+    for (i = 0; i < SIP_ATTR_COUNT; i++)
+        snprintf(header->names[i], SIP_EXPORT_NAMELEN, "%s", sip_attr_get_name(i));
+
+    // Magic is written last, so readers never see a partial header
+    atomic_thread_fence(memory_order_release);
+    memcpy(header->magic, SIP_EXPORT_MAGIC, sizeof(SIP_EXPORT_MAGIC));
+
+    export.header = header;
+    export.published = 0;
+    return 0;
+
+unlink:
+    // Keep the error of the failed call
+    i = errno;
+    shm_unlink(export.name);
+    errno = i;
+error:
+    sng_free(export.name);
+    export.name = NULL;
+    return 1;
+}
+
+void
+sip_export_deinit()
+{
+    if (!export.header)
+        return;
+
+    munmap(export.header, export.size);
+    shm_unlink(export.name);
+    sng_free(export.name);
+    export.header = NULL;
+    export.name = NULL;
+}
+
+bool
+sip_export_enabled()
+{
+    return export.header != NULL;
+}
+
+/**
+ * @brief Write a call summary in its slot
+ */
+static void
+sip_export_write(sip_call_t *call)
+{
+    sip_export_slot_t *slot = &export.slot, *shared;
+    char value[SIP_ATTR_MAXLEN + 1];
+    rtp_stream_t *stream;
+    vector_iter_t it;
+    float mos;
+    int i;
+
+    // Calls without messages have no attributes
+    if (!vector_count(call->msgs))
+        return;
+
+    memset(slot, 0, sizeof(sip_export_slot_t));
+    slot->index = call->index;
+    slot->state = call->state;
+    slot->msgcnt = vector_count(call->msgs);
+    for (i = 0; i < SIP_ATTR_COUNT; i++) {
+        value[0] = '\0';
+        if (call_get_attribute(call, i, value))
+            snprintf(slot->attrs[i], SIP_EXPORT_TEXTLEN, "%s", value);
+    }
+
+    // Quality is only measured for RTP streams
+    it = vector_iterator(call->streams);
+    while ((stream = vector_iterator_next(&it))) {
+        slot->streams++;
+        if (stream->type != PACKET_RTP || !stream_get_count(stream))
+            continue;
+        slot->rtp_packets += stream_get_count(stream);
+        slot->rtp_lost += stream_get_lost(stream);
+        if (stream_get_jitter(stream) > slot->rtp_jitter)
+            slot->rtp_jitter = stream_get_jitter(stream);
+        mos = stream_get_mos(stream);
+        if (!slot->rtp_mos || mos < slot->rtp_mos)
+            slot->rtp_mos = mos;
+    }
+
+    // Only the slot contents are copied, its sequence is kept
+    shared = sip_export_slot(export.header, call->index % export.header->slots);
+    sip_export_slot_begin(shared);
+    memcpy((char *) shared + sizeof(shared->seq), (char *) slot + sizeof(slot->seq),
+           sizeof(sip_export_slot_t) - sizeof(slot->seq));
+    sip_export_slot_end(shared);
+}
+
+void
+sip_export_update()
+{
+    unsigned long updates = sip_calls_updates();
+    struct timeval now;
+    sip_call_t *call;
+
+    if (!export.header || updates == export.published)
+        return;
+
+    // Calls are walked from most recently updated until already published ones
+    for (call = sip_calls_last_updated(); call && call->update > export.published; call = call->updated_prev)
+        sip_export_write(call);
+    export.published = updates;
+
+    gettimeofday(&now, NULL);
+    atomic_store(&export.header->calls, sip_calls_count());
+    atomic_store(&export.header->updated, (int64_t) now.tv_sec * 1000 + now.tv_usec / 1000);
+}
+
+void
+sip_export_remove(sip_call_t *call)
+{
+    sip_export_slot_t *shared;
+
+    if (!export.header)
+        return;
+
+    // Slot may already belong to a newer call
+    shared = sip_export_slot(export.header, call->index % export.header->slots);
+    if (shared->index != call->index)
+        return;
+
+    sip_export_slot_begin(shared);
+    memset((char *) shared + sizeof(shared->seq), 0, sizeof(sip_export_slot_t) - sizeof(shared->seq));
+    sip_export_slot_end(shared);
+}
@@ -0,0 +1,234 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file sip_export.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to publish stored calls in shared memory
+ *
+ * When sip.export is set, a POSIX shared memory object with that name
+ * holds a table of call summaries: every call list attribute, state,
+ * message count and RTP streams counters. Other processes can map it
+ * read-only and poll it as often as they want, without any lock shared
+ * with sngrep.
+ *
+ * Each call is written in slot (call index % slots), so a slot can be
+ * reused by a newer call when more calls than slots are stored. Removed
+ * calls have their slot emptied (index 0).
+ *
+ * Slots are versioned as a seqlock: the writer makes the slot sequence
+ * odd before changing it and even again after, so readers copy the slot
+ * and retry while the sequence was odd or has changed meanwhile
+ * (see sip_export_slot_read).
+ *
+ * Changed calls are published by the background capture thread every
+ * 100ms, so capture and parsing threads never write the table.
+ */
+#ifndef __SNGREP_SIP_EXPORT_H
+#define __SNGREP_SIP_EXPORT_H
+
+#include "config.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "sip_attr.h"
+#include "sip_call.h"
+
+//! Shared memory table magic
+#define SIP_EXPORT_MAGIC        "SNGSHM"
+//! Shared memory table format version
+#define SIP_EXPORT_VERSION      1
+//! Default number of table slots
+#define SIP_EXPORT_SLOTS        4096
+//! Size of each exported attribute text (including null terminator)
+#define SIP_EXPORT_TEXTLEN      128
+//! Size of each attribute name in table header
+#define SIP_EXPORT_NAMELEN      32
+//! Times a reader copies a slot before giving up
+#define SIP_EXPORT_RETRIES      64
+
+//! Shorter declaration of sip_export_header structure
+typedef struct sip_export_header sip_export_header_t;
+//! Shorter declaration of sip_export_slot structure
+typedef struct sip_export_slot sip_export_slot_t;
+
+/**
+ * @brief Shared memory table header, followed by the slots
+ */
+struct sip_export_header
+{
+    //! Table magic (SIP_EXPORT_MAGIC)
+    char magic[8];
+    //! Format version
+    uint32_t version;
+    //! Size of this header (offset of first slot)
+    uint32_t header_size;
+    //! Size of each slot
+    uint32_t slot_size;
+    //! Number of slots
+    uint32_t slots;
+    //! Number of exported attributes in each slot
+    uint32_t attrs;
+    //! Size of each exported attribute text
+    uint32_t textlen;
+    //! Process writing the table
+    int64_t pid;
+    //! Time the table was created
+    int64_t created;
+    //! Time of last published changes (milliseconds since epoch)
+    _Atomic int64_t updated;
+    //! Number of stored calls in last published changes
+    _Atomic uint32_t calls;
+    uint32_t pad;
+    //! Name of each exported attribute (as in sngreprc)
+    char names[SIP_ATTR_COUNT][SIP_EXPORT_NAMELEN];
+};
+
+/**
+ * @brief Summary of a call
+ */
+struct sip_export_slot
+{
+    //! Sequence (odd while slot is being written)
+    _Atomic uint32_t seq;
+    //! Call index (0 if slot is empty)
+    int32_t index;
+    //! Call state (0 for dialogs that are not calls)
+    int32_t state;
+    //! Number of call messages
+    uint32_t msgcnt;
+    //! Number of call RTP streams
+    uint32_t streams;
+    //! Received RTP packets in all streams
+    uint32_t rtp_packets;
+    //! Lost RTP packets in all streams
+    uint32_t rtp_lost;
+    //! Highest jitter of all streams (ms)
+    float rtp_jitter;
+    //! Lowest MOS of streams with packets (0 if none)
+    float rtp_mos;
+    uint32_t pad;
+    //! Text of each attribute (empty if call has no value)
+    char attrs[SIP_ATTR_COUNT][SIP_EXPORT_TEXTLEN];
+};
+
+/**
+ * @brief Create shared memory table
+ *
+ * @param name Shared memory object name (NULL or empty to disable export,
+ * a leading slash is added if missing)
+ * @param slots Number of table slots (SIP_EXPORT_SLOTS if 0)
+ * @return 0 on success, 1 on error
+ */
+int
+sip_export_init(const char *name, int slots);
+
+/**
+ * @brief Remove shared memory table
+ */
+void
+sip_export_deinit();
+
+/**
+ * @brief Check if calls are being exported
+ */
+bool
+sip_export_enabled();
+
+/**
+ * @brief Publish calls changed since last update
+ *
+ * Only calls updated after the previous call are written, walking the
+ * calls update list from its end. Calls write lock must be held, as
+ * attributes may be read from stored payloads that are copied or
+ * uncompressed on first use.
+ */
+void
+sip_export_update();
+
+/**
+ * @brief Empty the slot of a call that is being removed
+ *
+ * Calls write lock must be held.
+ */
+void
+sip_export_remove(sip_call_t *call);
+
+/**
+ * @brief Get a slot of a mapped table
+ */
+static inline sip_export_slot_t *
+sip_export_slot(sip_export_header_t *header, uint32_t slot)
+{
+    return (sip_export_slot_t *) ((char *) header + header->header_size + (size_t) slot * header->slot_size);
+}
+
+/**
+ * @brief Start writing a slot
+ */
+static inline void
+sip_export_slot_begin(sip_export_slot_t *slot)
+{
+    atomic_store_explicit(&slot->seq, atomic_load_explicit(&slot->seq, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+/**
+ * @brief Finish writing a slot
+ */
+static inline void
+sip_export_slot_end(sip_export_slot_t *slot)
+{
+    atomic_store_explicit(&slot->seq, atomic_load_explicit(&slot->seq, memory_order_relaxed) + 1,
+                          memory_order_release);
+}
+
+/**
+ * @brief Copy a consistent version of a slot
+ *
+ * This is the function external readers are expected to replicate.
+ *
+ * @return 0 on success, 1 if slot was being written in every try
+ */
+static inline int
+sip_export_slot_read(const sip_export_slot_t *slot, sip_export_slot_t *copy)
+{
+    uint32_t before, after, i;
+
+    for (i = 0; i < SIP_EXPORT_RETRIES; i++) {
+        before = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (before & 1)
+            continue;
+        memcpy(copy, (const void *) slot, sizeof(sip_export_slot_t));
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+        if (before == after) {
+            atomic_init(&copy->seq, before);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#endif /* __SNGREP_SIP_EXPORT_H */
@@ -0,0 +1,291 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file sip_header.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in sip_header.h
+ *
+ */
+#include "config.h"
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "sip_attr.h"
+#include "sip_header.h"
+#include "sip_scan.h"
+
+static sip_header_name_t header_names[] = {
+    { SIP_HEADER_CALLID,         "Call-ID",        7,  'i' },
+    { SIP_HEADER_CSEQ,           "CSeq",           4,  0 },
+    { SIP_HEADER_FROM,           "From",           4,  'f' },
+    { SIP_HEADER_TO,             "To",             2,  't' },
+    { SIP_HEADER_CONTENT_LENGTH, "Content-Length", 14, 'l' },
+    { SIP_HEADER_REASON,         "Reason",         6,  0 },
+    { SIP_HEADER_WARNING,        "Warning",        7,  0 },
+};
+
+//! Header names linking dialogs, separated by '|'
+static char xcallid_names[SIP_ATTR_MAXLEN] = SIP_HEADER_XCALLID_DEFAULT;
+
+int
+sip_header_set_xcallid(const char *names)
+{
+    if (strlen(names) >= sizeof(xcallid_names))
+        return 1;
+
+    strcpy(xcallid_names, names);
+    return 0;
+}
+
+void
+sip_header_parse(sip_header_table_t *table, const char *payload, uint32_t len)
+{
+    const char *line = payload, *end = payload + len, *eol, *next, *colon, *value;
+    uint32_t linelen, namelen;
+    int id;
+
+    memset(table, 0, sizeof(sip_header_table_t));
+
+    while (line < end) {
+        // Get next line without its line ending
+        eol = sip_scan_line(line, end, &colon);
+        next = eol < end ? eol + 1 : end;
+        linelen = eol - line;
+        if (linelen && line[linelen - 1] == '\r')
+            linelen--;
+
+        if (line == payload) {
+            sip_header_parse_first_line(table, line, linelen);
+            line = next;
+            continue;
+        }
+
+        // Empty line after headers
+        if (linelen == 0) {
+            if (eol < end)
+                table->body = next - payload;
+            break;
+        }
+
+        if (colon && colon < line + linelen) {
+            // Whitespace is allowed between header name and colon
+            for (namelen = colon - line; namelen && (line[namelen - 1] == ' ' || line[namelen - 1] == '\t'); namelen--);
+            for (value = colon + 1; value < line + linelen && (*value == ' ' || *value == '\t'); value++);
+
+            // Only the first occurrence of each header is stored
+            if ((id = sip_header_id(line, namelen)) >= 0 && !table->headers[id].value) {
+                table->headers[id].value = value;
+                table->headers[id].len = line + linelen - value;
+            }
+            if (!table->headers[SIP_HEADER_XCALLID].value && sip_header_is_xcallid(line, namelen)) {
+                table->headers[SIP_HEADER_XCALLID].value = value;
+                table->headers[SIP_HEADER_XCALLID].len = line + linelen - value;
+            }
+        }
+
+        line = next;
+    }
+}
+
+void
+sip_header_parse_first_line(sip_header_table_t *table, const char *line, uint32_t len)
+{
+    uint32_t i, j, end;
+
+    // Response: SIP/2.0 code text
+    if (len >= 7 && !strncasecmp(line, "SIP/2.0", 7)) {
+        for (i = 7; i < len && line[i] == ' '; i++);
+        if (i + 4 <= len && isdigit(line[i]) && isdigit(line[i + 1]) && isdigit(line[i + 2]) && line[i + 3] == ' ') {
+            table->status.value = line + i;
+            table->status.len = len - i;
+        }
+        return;
+    }
+
+    // Request: Method scheme:uri SIP/2.0
+    for (i = 0; i < len && isalpha(line[i]); i++);
+    if (i == 0 || i >= len || line[i] != ' ')
+        return;
+    for (j = i + 1; j < len && isalpha(line[j]); j++);
+    if (j == i + 1 || j >= len || line[j] != ':')
+        return;
+    for (end = len; end > j && line[end - 1] == ' '; end--);
+    if (end < j + 9 || strncasecmp(line + end - 8, " SIP/2.0", 8))
+        return;
+
+    table->method.value = line;
+    table->method.len = i;
+}
+
+int
+sip_header_id(const char *name, uint32_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < sizeof(header_names) / sizeof(*header_names); i++) {
+        if (len == 1 && header_names[i].compact && tolower(*name) == header_names[i].compact)
+            return header_names[i].id;
+        if (len == header_names[i].len && !strncasecmp(name, header_names[i].name, len))
+            return header_names[i].id;
+    }
+
+    return -1;
+}
+
+int
+sip_header_is_xcallid(const char *name, uint32_t len)
+{
+    const char *candidate = xcallid_names, *sep;
+    uint32_t candidate_len;
+
+    while (*candidate) {
+        sep = strchr(candidate, '|');
+        candidate_len = sep ? (uint32_t) (sep - candidate) : strlen(candidate);
+        if (len && len == candidate_len && !strncasecmp(name, candidate, len))
+            return 1;
+        if (!sep)
+            break;
+        candidate = sep + 1;
+    }
+
+    return 0;
+}
+
+int
+sip_header_check_start(const char *payload, uint32_t len)
+{
+    uint32_t i, j;
+
+    // Response: SIP/2.0 code
+    if (len >= 11 && !strncasecmp(payload, "SIP/2.0 ", 8)
+            && isdigit(payload[8]) && isdigit(payload[9]) && isdigit(payload[10]))
+        return 0;
+
+    // Request: Method scheme:
+    for (i = 0; i < len && isalpha(payload[i]); i++);
+    if (i == 0 || i >= len || payload[i] != ' ')
+        return 1;
+    for (j = i + 1; j < len && isalpha(payload[j]); j++);
+    if (j == i + 1 || j >= len || payload[j] != ':')
+        return 1;
+
+    return 0;
+}
+
+uint32_t
+sip_header_token(const sip_header_t *header)
+{
+    uint32_t len;
+
+    if (!header->value)
+        return 0;
+
+    for (len = header->len; len && header->value[len - 1] == ' '; len--);
+    if (memchr(header->value, ' ', len))
+        return 0;
+
+    return len;
+}
+
+char *
+sip_header_copy_token(const sip_header_t *header, char *out)
+{
+    uint32_t len;
+
+    if ((len = sip_header_token(header)))
+        strncpy(out, header->value, len);
+
+    return out;
+}
+
+uint32_t
+sip_header_number(const sip_header_t *header)
+{
+    uint32_t i, len;
+
+    if (!(len = sip_header_token(header)))
+        return 0;
+
+    for (i = 0; i < len; i++) {
+        if (!isdigit(header->value[i]))
+            return 0;
+    }
+
+    return len;
+}
+
+uint32_t
+sip_header_uri(const sip_header_t *header, const char **uri)
+{
+    const char *start;
+    uint32_t len, user, end;
+
+    if (!header->value || !(start = memchr(header->value, ':', header->len)))
+        return 0;
+
+    // Skip URI scheme
+    start++;
+    len = header->len - (start - header->value);
+
+    // User part ends with domain separator
+    for (user = 0; user < len && start[user] != '@' && start[user] != '>'; user++);
+    if (user == 0)
+        return 0;
+
+    if (user < len && start[user] == '@') {
+        // Host part ends with URI or header parameters
+        for (end = user + 1; end < len && start[end] != '>' && start[end] != ';'; end++);
+    } else {
+        // Without domain separator, user part is the host
+        for (end = user; end > 1 && start[end - 1] == ';'; end--);
+        if (end < 2)
+            return 0;
+    }
+
+    *uri = start;
+    return end;
+}
+
+uint32_t
+sip_header_reason_text(const sip_header_t *header, const char **text)
+{
+    const char *param, *quote;
+    uint32_t len;
+
+    if (!header->value)
+        return 0;
+
+    // Use the last text parameter having (non empty) quoted text
+    for (len = header->len; len >= 7; len--) {
+        param = header->value + len - 7;
+        if (strncasecmp(param, ";text=\"", 7))
+            continue;
+        for (quote = header->value + header->len - 1; quote > param + 7 && *quote != '"'; quote--);
+        if (quote > param + 7) {
+            *text = param + 7;
+            return quote - *text;
+        }
+    }
+
+    return 0;
+}
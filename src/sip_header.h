@@ -0,0 +1,210 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file sip_header.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to tokenize SIP message headers
+ *
+ * SIP message headers are walked once, storing the first line fields and
+ * the value of the first occurrence of each header sngrep uses. Header
+ * names are case insensitive and compact forms (i, f, t, l) are accepted.
+ * Values point to the tokenized payload, so they are only valid while it
+ * is not modified or released.
+ */
+#ifndef __SNGREP_SIP_HEADER_H
+#define __SNGREP_SIP_HEADER_H
+
+#include "config.h"
+#include <stdint.h>
+
+//! Default names of the header linking dialogs
+#define SIP_HEADER_XCALLID_DEFAULT  "X-Call-ID|X-CID"
+
+//! Shorter declaration of sip_header structure
+typedef struct sip_header sip_header_t;
+//! Shorter declaration of sip_header_name structure
+typedef struct sip_header_name sip_header_name_t;
+//! Shorter declaration of sip_header_table structure
+typedef struct sip_header_table sip_header_table_t;
+
+/**
+ * @brief Headers stored while tokenizing a message
+ */
+enum sip_header_id {
+    SIP_HEADER_CALLID = 0,
+    SIP_HEADER_XCALLID,
+    SIP_HEADER_CSEQ,
+    SIP_HEADER_FROM,
+    SIP_HEADER_TO,
+    SIP_HEADER_CONTENT_LENGTH,
+    SIP_HEADER_REASON,
+    SIP_HEADER_WARNING,
+    SIP_HEADER_COUNT
+};
+
+/**
+ * @brief Header value inside message payload
+ */
+struct sip_header
+{
+    //! Value without leading whitespace or line ending (NULL if not found)
+    const char *value;
+    //! Value length
+    uint32_t len;
+};
+
+/**
+ * @brief Known header names
+ */
+struct sip_header_name
+{
+    //! Header id
+    enum sip_header_id id;
+    //! Header name
+    const char *name;
+    //! Header name length
+    uint32_t len;
+    //! Compact form of the header name (0 if it has none)
+    char compact;
+};
+
+/**
+ * @brief Tokenized SIP message
+ */
+struct sip_header_table
+{
+    //! Request method (not found for responses)
+    sip_header_t method;
+    //! Response code and text (not found for requests)
+    sip_header_t status;
+    //! First occurrence of each known header
+    sip_header_t headers[SIP_HEADER_COUNT];
+    //! Message body offset (0 if the empty line after headers was not found)
+    uint32_t body;
+};
+
+/**
+ * @brief Set the header names linking dialogs
+ *
+ * @param names header names separated by '|'
+ * @return 0 if names have been set, 1 if they are too long
+ */
+int
+sip_header_set_xcallid(const char *names);
+
+/**
+ * @brief Walk message headers and store the known ones
+ *
+ * Tokenizer stops at the empty line after headers or after len bytes.
+ *
+ * @param table table to fill with message first line and headers
+ * @param payload SIP message payload
+ * @param len payload length
+ */
+void
+sip_header_parse(sip_header_table_t *table, const char *payload, uint32_t len);
+
+/**
+ * @brief Parse a SIP request or response first line
+ */
+void
+sip_header_parse_first_line(sip_header_table_t *table, const char *line, uint32_t len);
+
+/**
+ * @brief Get the known header id from its name
+ *
+ * @return header id or -1 if it is not a known header
+ */
+int
+sip_header_id(const char *name, uint32_t len);
+
+/**
+ * @brief Check if a header name is one of the configured X-Call-ID names
+ */
+int
+sip_header_is_xcallid(const char *name, uint32_t len);
+
+/**
+ * @brief Check payload starts like a SIP request or response
+ *
+ * Only the beginning of the first line is checked, so it can be used with
+ * incomplete messages.
+ *
+ * @return 0 if payload could be a SIP message, 1 otherwise
+ */
+int
+sip_header_check_start(const char *payload, uint32_t len);
+
+/**
+ * @brief Get the length of a single token header value
+ *
+ * Trailing spaces are ignored. Used for Call-ID like headers.
+ *
+ * @return token length or 0 if value is empty or has several tokens
+ */
+uint32_t
+sip_header_token(const sip_header_t *header);
+
+/**
+ * @brief Copy a single token header value
+ *
+ * Nothing is copied if the header has not a single token value.
+ *
+ * @param header Call-ID like header
+ * @param out character array to store the token
+ * @return out
+ */
+char *
+sip_header_copy_token(const sip_header_t *header, char *out);
+
+/**
+ * @brief Get the length of a numeric header value
+ *
+ * Trailing spaces are ignored. Used for Content-Length header.
+ *
+ * @return number of digits or 0 if value is not a number
+ */
+uint32_t
+sip_header_number(const sip_header_t *header);
+
+/**
+ * @brief Get user and host part of a From or To header
+ *
+ * @param header From or To header
+ * @param uri pointer to the beginning of user part
+ * @return length of user and host part or 0 if header is malformed
+ */
+uint32_t
+sip_header_uri(const sip_header_t *header, const char **uri);
+
+/**
+ * @brief Get the text parameter of a Reason header
+ *
+ * @param header Reason header
+ * @param text pointer to the beginning of text
+ * @return length of text or 0 if header has no text parameter
+ */
+uint32_t
+sip_header_reason_text(const sip_header_t *header, const char **text);
+
+#endif /* __SNGREP_SIP_HEADER_H */
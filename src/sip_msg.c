@@ -31,14 +31,13 @@
 #include "sip_msg.h"
 #include "media.h"
 #include "sip.h"
+#include "intern.h"
+#include "arena.h"
 
 sip_msg_t *
-msg_create()
+msg_create(struct sip_call *call)
 {
-    sip_msg_t *msg;
-    if (!(msg = sng_malloc(sizeof(sip_msg_t))))
-        return NULL;
-    return msg;
+    return arena_alloc(call->arena, sizeof(sip_msg_t));
 }
 
 void
@@ -50,11 +49,10 @@ msg_destroy(sip_msg_t *msg)
 
     // Free message packets
     packet_destroy(msg->packet);
-    // Free all memory
-    sng_free(msg->resp_str);
-    sng_free(msg->sip_from);
-    sng_free(msg->sip_to);
-    sng_free(msg);
+    // Release shared strings, message memory belongs to its call
+    intern_release(msg->resp_str);
+    intern_release(msg->sip_from);
+    intern_release(msg->sip_to);
 }
 
 void
@@ -103,6 +101,58 @@ msg_get_payload(sip_msg_t *msg)
     return (const char *) packet_payload(msg->packet);
 }
 
+uint64_t
+msg_payload_fingerprint(const char *payload, uint32_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint32_t i;
+    u_char c;
+
+    for (i = 0; i < len; i++) {
+        c = payload[i];
+        // Same result than tolower in C locale, as used by strcasecmp
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        hash = (hash ^ c) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+void
+msg_set_headers(sip_msg_t *msg, const sip_header_table_t *table, const char *payload)
+{
+    int id;
+
+    for (id = 0; id < SIP_HEADER_COUNT; id++) {
+        if (!table->headers[id].value)
+            continue;
+        msg->headers[id].offset = table->headers[id].value - payload;
+        msg->headers[id].len = table->headers[id].len;
+    }
+}
+
+const char *
+msg_get_header(sip_msg_t *msg, enum sip_header_id id, uint32_t *len)
+{
+    const char *payload;
+
+    if (!msg->headers[id].offset || !(payload = msg_get_payload(msg)))
+        return NULL;
+
+    *len = msg->headers[id].len;
+    return payload + msg->headers[id].offset;
+}
+
+void
+msg_get_header_table(sip_msg_t *msg, sip_header_table_t *table)
+{
+    int id;
+
+    memset(table, 0, sizeof(sip_header_table_t));
+    for (id = 0; id < SIP_HEADER_COUNT; id++)
+        table->headers[id].value = msg_get_header(msg, id, &table->headers[id].len);
+}
+
 struct timeval
 msg_get_time(sip_msg_t *msg) {
     struct timeval t = { };
@@ -116,33 +166,60 @@ msg_get_time(sip_msg_t *msg) {
 const char *
 msg_get_attribute(sip_msg_t *msg, int id, char *value)
 {
+    sip_header_t header;
+    const char *text;
+    uint32_t len;
+    const char *uri;
+    char ip[ADDRESSLEN];
     char *ar;
+    int from;
 
     switch (id) {
         case SIP_ATTR_SRC:
-            sprintf(value, "%s:%u", msg->packet->src.ip, msg->packet->src.port);
+            sprintf(value, "%s:%u", address_get_ip(msg->packet->src, ip), msg->packet->src.port);
             break;
         case SIP_ATTR_DST:
-            sprintf(value, "%s:%u", msg->packet->dst.ip, msg->packet->dst.port);
+            sprintf(value, "%s:%u", address_get_ip(msg->packet->dst, ip), msg->packet->dst.port);
             break;
         case SIP_ATTR_METHOD:
             sprintf(value, "%.*s", SIP_ATTR_MAXLEN, sip_get_msg_reqresp_str(msg));
             break;
         case SIP_ATTR_SIPFROM:
-            sprintf(value, "%.*s", SIP_ATTR_MAXLEN, msg->sip_from);
-            break;
-        case SIP_ATTR_SIPTO:
-            sprintf(value, "%.*s", SIP_ATTR_MAXLEN, msg->sip_to);
-            break;
         case SIP_ATTR_SIPFROMUSER:
-            if ((ar = strchr(msg->sip_from, '@'))) {
-                strncpy(value, msg->sip_from, ar - msg->sip_from);
-            }
-            break;
+        case SIP_ATTR_SIPTO:
         case SIP_ATTR_SIPTOUSER:
-            if ((ar = strchr(msg->sip_to, '@'))) {
-                strncpy(value, msg->sip_to, ar - msg->sip_to);
+            from = (id == SIP_ATTR_SIPFROM || id == SIP_ATTR_SIPFROMUSER);
+            if ((uri = from ? msg->sip_from : msg->sip_to)) {
+                sprintf(value, "%.*s", SIP_ATTR_MAXLEN, uri);
+            } else {
+                // Not parsed yet, get it from payload
+                header.value = msg_get_header(msg, from ? SIP_HEADER_FROM : SIP_HEADER_TO, &header.len);
+                if ((len = sip_header_uri(&header, &text)))
+                    snprintf(value, SIP_ATTR_MAXLEN, "%.*s", (int) len, text);
             }
+            // Only user part of the header
+            if (id == SIP_ATTR_SIPFROMUSER || id == SIP_ATTR_SIPTOUSER) {
+                if ((ar = strchr(value, '@'))) {
+                    *ar = '\0';
+                } else {
+                    *value = '\0';
+                }
+            }
+            break;
+        case SIP_ATTR_CALLID:
+        case SIP_ATTR_XCALLID:
+            header.value = msg_get_header(msg, id == SIP_ATTR_CALLID ? SIP_HEADER_CALLID : SIP_HEADER_XCALLID, &header.len);
+            if ((len = sip_header_token(&header)))
+                snprintf(value, SIP_ATTR_MAXLEN, "%.*s", (int) len, header.value);
+            break;
+        case SIP_ATTR_REASON_TXT:
+            header.value = msg_get_header(msg, SIP_HEADER_REASON, &header.len);
+            if ((len = sip_header_reason_text(&header, &text)))
+                snprintf(value, SIP_ATTR_MAXLEN, "%.*s", (int) len, text);
+            break;
+        case SIP_ATTR_WARNING:
+            if ((header.value = msg_get_header(msg, SIP_HEADER_WARNING, &header.len)) && atoi(header.value))
+                sprintf(value, "%d", atoi(header.value));
             break;
         case SIP_ATTR_DATE:
             timeval_to_date(msg_get_time(msg), value);
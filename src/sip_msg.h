@@ -34,10 +34,23 @@
 #include "vector.h"
 #include "media.h"
 #include "sip_attr.h"
+#include "sip_header.h"
 #include "util.h"
 
 //! Shorter declaration of sip_msg structure
 typedef struct sip_msg sip_msg_t;
+//! Shorter declaration of sip_msg_header structure
+typedef struct sip_msg_header sip_msg_header_t;
+
+/**
+ * @brief Location of a header value in message payload
+ */
+struct sip_msg_header {
+    //! Value offset in payload (0 if message has not this header)
+    uint16_t offset;
+    //! Value length
+    uint16_t len;
+};
 
 /**
  * @brief Information of a single message withing a dialog.
@@ -52,14 +65,16 @@ struct sip_call;
 struct sip_msg {
     //! Request Method or Response Code @see sip_methods
     int reqresp;
-    //!  Response text if it doesn't matches an standard
-    char *resp_str;
+    //!  Response text if it doesn't matches an standard (interned)
+    const char *resp_str;
     //! Message Cseq
     uint32_t cseq;
-    //! SIP From Header
-    char *sip_from;
-    //! SIP To Header
-    char *sip_to;
+    //! SIP From Header (interned)
+    const char *sip_from;
+    //! SIP To Header (interned)
+    const char *sip_to;
+    //! Known headers values in payload @see sip_header_id
+    sip_msg_header_t headers[SIP_HEADER_COUNT];
     //! SDP payload information (sdp_media_t *)
     vector_t *medias;
     //! Captured packet for this message
@@ -68,30 +83,30 @@ struct sip_msg {
     uint32_t index;
     //! Message owner
     struct sip_call *call;
+    //! Case insensitive hash of the payload to detect retransmissions
+    uint64_t fingerprint;
     //! Message is a retransmission from other message
     sip_msg_t *retrans;
 };
 
 
 /**
- * @brief Create a new message from the readed header and payload
+ * @brief Allocate a new SIP message in its call memory
  *
- * Allocate required memory for a new SIP message. This function
- * will only store the given information, but wont parse it until
- * needed.
+ * Message memory is released with the call, msg_destroy only releases the
+ * data it references.
  *
- * @param payload Raw payload content
+ * @param call SIP call owner of the message
  * @return a new allocated message
  */
 sip_msg_t *
-msg_create();
+msg_create(struct sip_call *call);
 
 /**
  * @brief Destroy a SIP message and free its memory
  *
- * Deallocate memory of an existing SIP Message.
- * This function will remove the message from the call and the
- * passed pointer will be NULL.
+ * Release the packet, SDP media and shared strings of an existing SIP
+ * Message. Message memory itself belongs to its call.
  *
  * @param nsg SIP message to be deleted
  */
@@ -164,6 +179,52 @@ msg_add_media(sip_msg_t *msg, sdp_media_t *media);
 const char *
 msg_get_payload(sip_msg_t *msg);
 
+/**
+ * @brief Compute the case insensitive hash of a SIP payload
+ *
+ * Messages with different fingerprints can not be retransmissions of
+ * each other, so payloads are only compared when fingerprints match.
+ *
+ * @param payload SIP message payload
+ * @param len payload length
+ * @return 64 bit FNV-1a hash of the lowercase payload
+ */
+uint64_t
+msg_payload_fingerprint(const char *payload, uint32_t len);
+
+/**
+ * @brief Store the location of tokenized headers values
+ *
+ * @param msg SIP message
+ * @param table headers tokenized from payload
+ * @param payload payload used to tokenize headers
+ */
+void
+msg_set_headers(sip_msg_t *msg, const sip_header_table_t *table, const char *payload);
+
+/**
+ * @brief Get a header value from message payload
+ *
+ * Returned value is not null terminated and it is only valid while
+ * message payload is.
+ *
+ * @param msg SIP message
+ * @param id header id
+ * @param len pointer to store value length
+ * @return pointer to header value or NULL if message has not this header
+ */
+const char *
+msg_get_header(sip_msg_t *msg, enum sip_header_id id, uint32_t *len);
+
+/**
+ * @brief Fill a header table with the stored headers values
+ *
+ * Payload is not tokenized again. First line fields are not stored,
+ * so table method and status are never set.
+ */
+void
+msg_get_header_table(sip_msg_t *msg, sip_header_table_t *table);
+
 /**
  * @brief Get Time of message from packet header
  *
@@ -0,0 +1,121 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file sip_sampler.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in sip_sampler.h
+ *
+ */
+#include "config.h"
+#include <string.h>
+#include "sip_sampler.h"
+
+int
+sip_sampler_init(sip_sampler_t *sampler, uint32_t rate, bool count_only, const char *priority)
+{
+    memset(sampler, 0, sizeof(sip_sampler_t));
+    sampler->rate = rate;
+    sampler->count_only = count_only;
+
+    // Nothing to do if all dialogs are stored
+    if (rate <= 1 && !count_only)
+        return 0;
+
+    // Remember Call-IDs of dialogs that are not stored
+    sampler->discarded = bloom_create(SIP_SAMPLE_REMEMBER);
+    sampler->counted = bloom_create(SIP_SAMPLE_REMEMBER);
+    if (!sampler->discarded || !sampler->counted) {
+        sip_sampler_deinit(sampler);
+        return 1;
+    }
+
+    // Load patterns of dialogs always stored
+    if (priority && strlen(priority)) {
+        if (!(sampler->priority = match_create(0))
+                || match_load_file(sampler->priority, priority) != 0
+                || match_compile(sampler->priority) != 0) {
+            sip_sampler_deinit(sampler);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void
+sip_sampler_deinit(sip_sampler_t *sampler)
+{
+    match_destroy(sampler->priority);
+    bloom_destroy(sampler->discarded);
+    bloom_destroy(sampler->counted);
+    sampler->priority = NULL;
+    sampler->discarded = sampler->counted = NULL;
+}
+
+bool
+sip_sampler_enabled(sip_sampler_t *sampler)
+{
+    return sampler->discarded != NULL;
+}
+
+bool
+sip_sampler_priority(sip_sampler_t *sampler, const char *payload, uint32_t len)
+{
+    return sampler->priority && match_exec(sampler->priority, payload, len);
+}
+
+int
+sip_sampler_known(sip_sampler_t *sampler, uint64_t hash, bool priority)
+{
+    // Bloom filters may find priority Call-IDs that were never added
+    if (!sampler->discarded || priority)
+        return SIP_SAMPLE_STORE;
+
+    if (bloom_check(sampler->discarded, hash))
+        return SIP_SAMPLE_DISCARD;
+    if (bloom_check(sampler->counted, hash))
+        return SIP_SAMPLE_COUNT;
+    return SIP_SAMPLE_STORE;
+}
+
+int
+sip_sampler_check(sip_sampler_t *sampler, uint64_t hash, bool priority, bool invite)
+{
+    // Priority dialogs are always stored
+    if (!sampler->discarded || priority)
+        return SIP_SAMPLE_STORE;
+
+    // Only store one of each sample rate dialogs
+    if (sampler->rate > 1 && hash % sampler->rate != 0) {
+        bloom_add(sampler->discarded, hash);
+        return SIP_SAMPLE_DISCARD;
+    }
+
+    // Dialogs not starting with INVITE are only counted
+    if (sampler->count_only && !invite) {
+        bloom_add(sampler->counted, hash);
+        return SIP_SAMPLE_COUNT;
+    }
+
+    return SIP_SAMPLE_STORE;
+}
@@ -0,0 +1,131 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file sip_sampler.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to decide which new dialogs are stored when sampling
+ *
+ * Only one of each sample rate dialogs (selected by Call-ID hash, so all
+ * instances keep the same ones) is stored, dialogs matching any priority
+ * pattern are always stored and, if count only is enabled, dialogs not
+ * starting with INVITE are only counted.
+ *
+ * Call-IDs of not stored dialogs are remembered in bloom filters, so their
+ * following messages are skipped right after their Call-ID is read. Bloom
+ * filters may find Call-IDs that were never added, so priority patterns
+ * are checked before them.
+ */
+#ifndef __SNGREP_SIP_SAMPLER_H
+#define __SNGREP_SIP_SAMPLER_H
+
+#include "config.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include "match.h"
+#include "bloom.h"
+
+//! Call-IDs of not stored dialogs remembered by sampling
+#define SIP_SAMPLE_REMEMBER 65536
+
+//! Sampling decisions for new dialogs
+enum sip_sample {
+    //! Store the dialog
+    SIP_SAMPLE_STORE = 0,
+    //! Only count dialog messages
+    SIP_SAMPLE_COUNT,
+    //! Discard all dialog messages
+    SIP_SAMPLE_DISCARD,
+};
+
+//! Shorter declaration of sip_sampler structure
+typedef struct sip_sampler sip_sampler_t;
+
+/**
+ * @brief Sampling configuration and remembered decisions
+ */
+struct sip_sampler
+{
+    //! Store one of this number of new dialogs (0 or 1 to store all)
+    uint32_t rate;
+    //! Dialogs not starting with INVITE are only counted
+    bool count_only;
+    //! Dialogs matching any of these patterns are always stored
+    match_patterns_t *priority;
+    //! Call-IDs of dialogs discarded by sampling
+    bloom_t *discarded;
+    //! Call-IDs of dialogs only counted
+    bloom_t *counted;
+};
+
+/**
+ * @brief Configure sampling
+ *
+ * @param rate Store one of this number of new dialogs (0 or 1 to store all)
+ * @param count_only Only count dialogs not starting with INVITE
+ * @param priority File with patterns of dialogs always stored (or NULL)
+ * @return 0 if sampling has been configured (or is not required), 1 otherwise
+ */
+int
+sip_sampler_init(sip_sampler_t *sampler, uint32_t rate, bool count_only, const char *priority);
+
+/**
+ * @brief Release sampling data
+ */
+void
+sip_sampler_deinit(sip_sampler_t *sampler);
+
+/**
+ * @brief Check if some new dialogs may not be stored
+ */
+bool
+sip_sampler_enabled(sip_sampler_t *sampler);
+
+/**
+ * @brief Check if a message matches any priority pattern
+ */
+bool
+sip_sampler_priority(sip_sampler_t *sampler, const char *payload, uint32_t len);
+
+/**
+ * @brief Get the decision remembered for a dialog not found in calls
+ *
+ * @param hash Call-ID hash (from bloom_hash)
+ * @param priority Message matches a priority pattern (never skipped)
+ * @return SIP_SAMPLE_DISCARD or SIP_SAMPLE_COUNT if dialog was not stored,
+ * SIP_SAMPLE_STORE if it is a new dialog
+ */
+int
+sip_sampler_known(sip_sampler_t *sampler, uint64_t hash, bool priority);
+
+/**
+ * @brief Decide if a new dialog is stored and remember the decision
+ *
+ * @param hash Call-ID hash (from bloom_hash)
+ * @param priority First message matches a priority pattern
+ * @param invite First message is an INVITE request
+ * @return sampling decision (enum sip_sample)
+ */
+int
+sip_sampler_check(sip_sampler_t *sampler, uint64_t hash, bool priority, bool invite);
+
+#endif /* __SNGREP_SIP_SAMPLER_H */
@@ -0,0 +1,286 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file sip_scan.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in sip_scan.h
+ *
+ * Vector implementations compare each block of data with the searched
+ * characters and get a bit mask of the matching positions. Data shorter
+ * than a block is always scanned byte by byte.
+ */
+#include "config.h"
+#include <stdint.h>
+#include <string.h>
+#include "sip_scan.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+//! Get 4 bits for each byte of a comparison result
+#define SIP_SCAN_NEON_MASK(cmp) \
+    vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4)), 0)
+#endif
+
+//! Available implementations, slowest first
+static const sip_scan_t scan_kernels[] = {
+    { "scalar", NULL, sip_scan_line_scalar, sip_scan_end_of_headers_scalar },
+#ifdef __SSE2__
+    { "sse2", NULL, sip_scan_line_sse2, sip_scan_end_of_headers_sse2 },
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    { "avx2", sip_scan_avx2_supported, sip_scan_line_avx2, sip_scan_end_of_headers_avx2 },
+#endif
+#ifdef __ARM_NEON
+    { "neon", NULL, sip_scan_line_neon, sip_scan_end_of_headers_neon },
+#endif
+};
+
+//! Selected implementation
+static const sip_scan_t *scan = &scan_kernels[0];
+
+void
+sip_scan_init()
+{
+    const sip_scan_t *kernel;
+    int i;
+
+    for (i = 0; (kernel = sip_scan_kernel(i)); i++)
+        scan = kernel;
+}
+
+const char *
+sip_scan_name()
+{
+    return scan->name;
+}
+
+const sip_scan_t *
+sip_scan_kernel(int index)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(scan_kernels) / sizeof(*scan_kernels); i++) {
+        if (scan_kernels[i].supported && !scan_kernels[i].supported())
+            continue;
+        if (index-- == 0)
+            return &scan_kernels[i];
+    }
+
+    return NULL;
+}
+
+const char *
+sip_scan_line(const char *data, const char *end, const char **colon)
+{
+    return scan->line(data, end, colon);
+}
+
+const char *
+sip_scan_end_of_headers(const char *data, const char *end)
+{
+    return scan->end_of_headers(data, end);
+}
+
+const char *
+sip_scan_line_scalar(const char *data, const char *end, const char **colon)
+{
+    *colon = NULL;
+    for (; data < end && *data != '\n'; data++) {
+        if (*data == ':' && !*colon)
+            *colon = data;
+    }
+    return data;
+}
+
+const char *
+sip_scan_end_of_headers_scalar(const char *data, const char *end)
+{
+    while (end - data >= 4 && (data = memchr(data, '\r', end - data - 3))) {
+        if (data[1] == '\n' && data[2] == '\r' && data[3] == '\n')
+            return data;
+        data++;
+    }
+    return NULL;
+}
+
+#ifdef __SSE2__
+const char *
+sip_scan_line_sse2(const char *data, const char *end, const char **colon)
+{
+    const __m128i lf = _mm_set1_epi8('\n'), sep = _mm_set1_epi8(':');
+    const char *eol, *tail;
+    uint32_t mlf, msep;
+
+    *colon = NULL;
+    for (; end - data >= 16; data += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *) data);
+        mlf = _mm_movemask_epi8(_mm_cmpeq_epi8(block, lf));
+        msep = _mm_movemask_epi8(_mm_cmpeq_epi8(block, sep));
+        // Only colons before the line ending
+        if (mlf)
+            msep &= (mlf & -mlf) - 1;
+        if (msep && !*colon)
+            *colon = data + __builtin_ctz(msep);
+        if (mlf)
+            return data + __builtin_ctz(mlf);
+    }
+
+    eol = sip_scan_line_scalar(data, end, &tail);
+    if (!*colon)
+        *colon = tail;
+    return eol;
+}
+
+const char *
+sip_scan_end_of_headers_sse2(const char *data, const char *end)
+{
+    const __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+    uint32_t mask;
+
+    // Each position is checked against the four bytes of the sequence
+    for (; end - data >= 16 + 3; data += 16) {
+        __m128i match = _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) data), cr),
+                          _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (data + 1)), lf)),
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (data + 2)), cr),
+                          _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (data + 3)), lf)));
+        if ((mask = _mm_movemask_epi8(match)))
+            return data + __builtin_ctz(mask);
+    }
+
+    return sip_scan_end_of_headers_scalar(data, end);
+}
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+int
+sip_scan_avx2_supported()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+const char *
+sip_scan_line_avx2(const char *data, const char *end, const char **colon)
+{
+    const __m256i lf = _mm256_set1_epi8('\n'), sep = _mm256_set1_epi8(':');
+    const char *eol, *tail;
+    uint32_t mlf, msep;
+
+    *colon = NULL;
+    for (; end - data >= 32; data += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) data);
+        mlf = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, lf));
+        msep = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, sep));
+        // Only colons before the line ending
+        if (mlf)
+            msep &= (mlf & -mlf) - 1;
+        if (msep && !*colon)
+            *colon = data + __builtin_ctz(msep);
+        if (mlf)
+            return data + __builtin_ctz(mlf);
+    }
+
+    eol = sip_scan_line_scalar(data, end, &tail);
+    if (!*colon)
+        *colon = tail;
+    return eol;
+}
+
+__attribute__((target("avx2")))
+const char *
+sip_scan_end_of_headers_avx2(const char *data, const char *end)
+{
+    const __m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n');
+    uint32_t mask;
+
+    // Each position is checked against the four bytes of the sequence
+    for (; end - data >= 32 + 3; data += 32) {
+        __m256i match = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) data), cr),
+                             _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (data + 1)), lf)),
+            _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (data + 2)), cr),
+                             _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (data + 3)), lf)));
+        if ((mask = _mm256_movemask_epi8(match)))
+            return data + __builtin_ctz(mask);
+    }
+
+    return sip_scan_end_of_headers_scalar(data, end);
+}
+#endif
+
+#ifdef __ARM_NEON
+const char *
+sip_scan_line_neon(const char *data, const char *end, const char **colon)
+{
+    const uint8x16_t lf = vdupq_n_u8('\n'), sep = vdupq_n_u8(':');
+    const char *eol, *tail;
+    uint64_t mlf, msep;
+
+    *colon = NULL;
+    for (; end - data >= 16; data += 16) {
+        uint8x16_t block = vld1q_u8((const uint8_t *) data);
+        mlf = SIP_SCAN_NEON_MASK(vceqq_u8(block, lf));
+        msep = SIP_SCAN_NEON_MASK(vceqq_u8(block, sep));
+        // Only colons before the line ending
+        if (mlf)
+            msep &= (mlf & -mlf) - 1;
+        if (msep && !*colon)
+            *colon = data + (__builtin_ctzll(msep) >> 2);
+        if (mlf)
+            return data + (__builtin_ctzll(mlf) >> 2);
+    }
+
+    eol = sip_scan_line_scalar(data, end, &tail);
+    if (!*colon)
+        *colon = tail;
+    return eol;
+}
+
+const char *
+sip_scan_end_of_headers_neon(const char *data, const char *end)
+{
+    const uint8x16_t cr = vdupq_n_u8('\r'), lf = vdupq_n_u8('\n');
+    const uint8_t *bytes;
+    uint64_t mask;
+
+    // Each position is checked against the four bytes of the sequence
+    for (; end - data >= 16 + 3; data += 16) {
+        bytes = (const uint8_t *) data;
+        uint8x16_t match = vandq_u8(
+            vandq_u8(vceqq_u8(vld1q_u8(bytes), cr), vceqq_u8(vld1q_u8(bytes + 1), lf)),
+            vandq_u8(vceqq_u8(vld1q_u8(bytes + 2), cr), vceqq_u8(vld1q_u8(bytes + 3), lf)));
+        if ((mask = SIP_SCAN_NEON_MASK(match)))
+            return data + (__builtin_ctzll(mask) >> 2);
+    }
+
+    return sip_scan_end_of_headers_scalar(data, end);
+}
+#endif
@@ -0,0 +1,159 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file sip_scan.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to find SIP line and header boundaries
+ *
+ * SIP header tokenizer and TCP reassembly look for line endings, header
+ * name separators and the empty line after headers. These functions
+ * compare 16 (SSE2, NEON) or 32 (AVX2) bytes at once when the CPU supports
+ * it, falling back to a byte by byte scan otherwise. The best available
+ * implementation is selected at runtime by sip_scan_init.
+ */
+#ifndef __SNGREP_SIP_SCAN_H
+#define __SNGREP_SIP_SCAN_H
+
+#include "config.h"
+
+//! Shorter declaration of sip_scan structure
+typedef struct sip_scan sip_scan_t;
+
+/**
+ * @brief Scan implementation
+ */
+struct sip_scan
+{
+    //! Implementation name
+    const char *name;
+    //! Check if CPU supports this implementation (NULL if always supported)
+    int (*supported)();
+    //! Find the end of a line and its first colon
+    const char *(*line)(const char *data, const char *end, const char **colon);
+    //! Find the empty line after headers
+    const char *(*end_of_headers)(const char *data, const char *end);
+};
+
+/**
+ * @brief Select the fastest implementation supported by this CPU
+ */
+void
+sip_scan_init();
+
+/**
+ * @brief Get the name of the selected implementation
+ */
+const char *
+sip_scan_name();
+
+/**
+ * @brief Get one of the implementations supported by this CPU
+ *
+ * @param index implementation index, starting with 0 (byte by byte scan)
+ * @return implementation or NULL if there are no more
+ */
+const sip_scan_t *
+sip_scan_kernel(int index);
+
+/**
+ * @brief Find the end of the line starting at data
+ *
+ * @param data beginning of the line
+ * @param end end of the data
+ * @param colon pointer to the first ':' of the line (NULL if there is none)
+ * @return pointer to line '\n' or end if the line is not complete
+ */
+const char *
+sip_scan_line(const char *data, const char *end, const char **colon);
+
+/**
+ * @brief Find the "\r\n\r\n" sequence ending SIP headers
+ *
+ * @param data beginning of the data
+ * @param end end of the data
+ * @return pointer to the sequence or NULL if it is not found
+ */
+const char *
+sip_scan_end_of_headers(const char *data, const char *end);
+
+/**
+ * @brief Byte by byte implementation of sip_scan_line
+ */
+const char *
+sip_scan_line_scalar(const char *data, const char *end, const char **colon);
+
+/**
+ * @brief Byte by byte implementation of sip_scan_end_of_headers
+ */
+const char *
+sip_scan_end_of_headers_scalar(const char *data, const char *end);
+
+#ifdef __SSE2__
+/**
+ * @brief SSE2 implementation of sip_scan_line
+ */
+const char *
+sip_scan_line_sse2(const char *data, const char *end, const char **colon);
+
+/**
+ * @brief SSE2 implementation of sip_scan_end_of_headers
+ */
+const char *
+sip_scan_end_of_headers_sse2(const char *data, const char *end);
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+/**
+ * @brief Check if CPU has AVX2 instructions
+ */
+int
+sip_scan_avx2_supported();
+
+/**
+ * @brief AVX2 implementation of sip_scan_line
+ */
+const char *
+sip_scan_line_avx2(const char *data, const char *end, const char **colon);
+
+/**
+ * @brief AVX2 implementation of sip_scan_end_of_headers
+ */
+const char *
+sip_scan_end_of_headers_avx2(const char *data, const char *end);
+#endif
+
+#ifdef __ARM_NEON
+/**
+ * @brief NEON implementation of sip_scan_line
+ */
+const char *
+sip_scan_line_neon(const char *data, const char *end, const char **colon);
+
+/**
+ * @brief NEON implementation of sip_scan_end_of_headers
+ */
+const char *
+sip_scan_end_of_headers_neon(const char *data, const char *end);
+#endif
+
+#endif /* __SNGREP_SIP_SCAN_H */
@@ -156,3 +156,51 @@ strtrim(char *str)
 
     return str;
 }
+
+size_t
+str_to_size(const char *str)
+{
+    char *end;
+    unsigned long long size;
+
+    if (!str || !isdigit(*str))
+        return 0;
+
+    size = strtoull(str, &end, 10);
+    switch (toupper(*end)) {
+        case 'G':
+            size *= 1024;
+            /* fall through */
+        case 'M':
+            size *= 1024;
+            /* fall through */
+        case 'K':
+            size *= 1024;
+            end++;
+            break;
+    }
+
+    // Only a suffix is allowed after the number
+    if (*end != '\0' && toupper(*end) != 'B')
+        return 0;
+    return (size_t) size;
+}
+
+const char *
+size_to_str(size_t size, char *out)
+{
+    const char *units = "BKMG";
+    double value = size;
+
+    while (value >= 1024 && units[1]) {
+        value /= 1024;
+        units++;
+    }
+
+    if (*units == 'B') {
+        sprintf(out, "%zuB", size);
+    } else {
+        sprintf(out, "%.1f%c", value, *units);
+    }
+    return out;
+}
@@ -96,4 +96,18 @@ timeval_to_delta(struct timeval start, struct timeval end, char *out);
 char *
 strtrim(char *str);
 
+/**
+ * @brief Convert a size with an optional K, M or G suffix to bytes
+ *
+ * @return size in bytes or 0 if string is not a valid size
+ */
+size_t
+str_to_size(const char *str);
+
+/**
+ * @brief Convert a size in bytes to human readable format (12.3M)
+ */
+const char *
+size_to_str(size_t size, char *out);
+
 #endif /* __SNGREP_UTIL_H */
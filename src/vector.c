@@ -31,18 +31,27 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include "util.h"
+#include "pool.h"
+
+//! Pool of vector structures, every packet and call has a few
+static pool_t vector_pool = POOL_INITIALIZER(POOL_VECTOR, "Vectors", sizeof(vector_t));
+
+//! Check if vector list has been allocated out of the vector structure
+#define VECTOR_LIST_ALLOCATED(vector) \
+    ((vector)->list && (vector)->list - (vector)->offset != (vector)->inline_list)
 
 vector_t *
 vector_create(int limit, int step)
 {
     vector_t *v;
     // Allocate memory for this vector data
-    if (!(v = malloc(sizeof(vector_t))))
+    if (!(v = pool_alloc(&vector_pool)))
         return NULL;
 
     v->count = 0;
     v->limit = limit;
     v->step = step;
+    v->offset = 0;
     v->list = NULL;
     v->sorter = NULL;
     v->destroyer = NULL;
@@ -58,9 +67,10 @@ vector_destroy(vector_t *vector)
     // Remove all items if a destroyer is set
     vector_clear(vector);
     // Deallocate vector list
-    sng_free(vector->list);
+    if (VECTOR_LIST_ALLOCATED(vector))
+        sng_free(vector->list - vector->offset);
     // Deallocate vector itself
-    sng_free(vector);
+    pool_free(&vector_pool, vector);
 }
 
 void
@@ -76,9 +86,11 @@ vector_destroy_items(vector_t *vector)
         for (i = 0; i < vector->count; i++) {
             free(vector->list[i]);
         }
-        free(vector->list);
     }
-    free(vector);
+    if (VECTOR_LIST_ALLOCATED(vector)) {
+        free(vector->list - vector->offset);
+    }
+    pool_free(&vector_pool, vector);
 }
 
 vector_t *
@@ -96,6 +108,7 @@ vector_clone(vector_t *original)
     clone = vector_create(original->limit, original->step);
     vector_set_destroyer(clone, original->destroyer);
     vector_set_sorter(clone, original->sorter);
+    vector_reserve(clone, original->count);
 
     // Fill the clone vector with the same elements
     it = vector_iterator(original);
@@ -119,6 +132,8 @@ vector_copy_if(vector_t *original, int (*filter)(void *item))
 
     // Create a new vector structure
     clone = vector_create(0, 1);
+    // Enough room for all elements passing the filter
+    vector_reserve(clone, original->count);
     // Fill the clone vector with the same elements applying filter
     it = vector_iterator(original);
     vector_iterator_set_filter(&it, filter);
@@ -138,28 +153,69 @@ vector_clear(vector_t *vector)
 }
 
 int
-vector_append(vector_t *vector, void *item)
+vector_reserve(vector_t *vector, int count)
 {
-    // Sanity check
-    if (!item)
-        return vector->count;
+    void **list;
+    uint32_t limit;
 
     // Check if the vector has been initializated
     if (!vector->list) {
-        vector->list = malloc(sizeof(void *) * vector->limit);
-        memset(vector->list, 0, sizeof(void *) * vector->limit);
+        limit = ((uint32_t) count > vector->limit) ? (uint32_t) count : vector->limit;
+        if (limit <= VECTOR_INLINE_SIZE) {
+            vector->list = vector->inline_list;
+            limit = VECTOR_INLINE_SIZE;
+        } else if (!(vector->list = malloc(sizeof(void *) * limit))) {
+            return 1;
+        }
+        vector->limit = limit;
+        memset(vector->list, 0, sizeof(void *) * limit);
+        return 0;
     }
 
-    // Check if we need to increase vector size
-    if (vector->count == vector->limit) {
-        // Increase vector size
-        vector->limit += vector->step;
-        // Add more memory to the list
-        vector->list = realloc(vector->list, sizeof(void *) * vector->limit);
-        // Initialize new allocated memory
-        memset(vector->list + vector->limit - vector->step, 0, vector->step);
+    // Already enough room
+    if ((uint32_t) count <= vector->limit)
+        return 0;
+
+    // Reuse the space left by removed first elements once it is worth moving
+    if ((uint32_t) count <= vector->limit + vector->offset && vector->offset >= vector->count / 2) {
+        memmove(vector->list - vector->offset, vector->list, sizeof(void *) * vector->count);
+        vector->list -= vector->offset;
+        vector->limit += vector->offset;
+        memset(vector->list + vector->count, 0, sizeof(void *) * (vector->limit - vector->count));
+        vector->offset = 0;
+        return 0;
     }
 
+    // Grow list size geometrically, so appending is amortized constant time
+    limit = vector->limit + ((vector->limit / 2 > vector->step) ? vector->limit / 2 : vector->step);
+    if (limit < (uint32_t) count)
+        limit = count;
+
+    // Move elements to a new list, dropping the space before them
+    if (!(list = malloc(sizeof(void *) * limit)))
+        return 1;
+    memcpy(list, vector->list, sizeof(void *) * vector->count);
+    memset(list + vector->count, 0, sizeof(void *) * (limit - vector->count));
+    if (VECTOR_LIST_ALLOCATED(vector))
+        free(vector->list - vector->offset);
+
+    vector->list = list;
+    vector->limit = limit;
+    vector->offset = 0;
+    return 0;
+}
+
+int
+vector_append(vector_t *vector, void *item)
+{
+    // Sanity check
+    if (!item)
+        return vector->count;
+
+    // Check if we need to increase vector size
+    if (vector_reserve(vector, vector->count + 1) != 0)
+        return -1;
+
     // Add item to the end of the list
     vector->list[vector->count++] = item;
 
@@ -177,6 +233,10 @@ vector_append_vector(vector_t *dst, vector_t *src)
     if (!dst || !src)
         return 1;
 
+    // Reallocate destination list only once
+    if (vector_reserve(dst, dst->count + src->count) != 0)
+        return 1;
+
     vector_iter_t it = vector_iterator(src);
 
     void *item;
@@ -222,10 +282,20 @@ vector_remove(vector_t *vector, void *item)
 
     // Decrease item counter
     vector->count--;
-    // Move the rest of the elements one position up
-    memmove(vector->list + idx, vector->list + idx + 1, sizeof(void *) * (vector->count - idx));
-    // Reset vector last position
-    vector->list[vector->count] = NULL;
+    if (idx < vector->count / 2) {
+        // Move the previous elements one position down
+        memmove(vector->list + 1, vector->list, sizeof(void *) * idx);
+        // Vector now starts one position later
+        vector->list[0] = NULL;
+        vector->list++;
+        vector->offset++;
+        vector->limit--;
+    } else {
+        // Move the rest of the elements one position up
+        memmove(vector->list + idx, vector->list + idx + 1, sizeof(void *) * (vector->count - idx));
+        // Reset vector last position
+        vector->list[vector->count] = NULL;
+    }
 
     // Destroy the item if vector has a destroyer
     if (vector->destroyer) {
@@ -245,6 +315,43 @@ vector_set_sorter(vector_t *vector, void (*sorter) (vector_t *vector, void *item
     vector->sorter = sorter;
 }
 
+int
+vector_sort(vector_t *vector, int (*compare) (void *one, void *two))
+{
+    void **src = vector->list, **dst, **tmp;
+    int count = vector->count, width, left, middle, right, a, b, i;
+
+    if (count < 2)
+        return 0;
+
+    if (!(tmp = malloc(sizeof(void *) * count)))
+        return 1;
+
+    // Merge sorted runs of increasing width, switching buffers each pass
+    for (dst = tmp, width = 1; width < count; width *= 2) {
+        for (left = 0; left < count; left += 2 * width) {
+            middle = (left + width < count) ? left + width : count;
+            right = (left + 2 * width < count) ? left + 2 * width : count;
+            for (a = left, b = middle, i = left; i < right; i++) {
+                if (a < middle && (b >= right || compare(src[a], src[b]) <= 0)) {
+                    dst[i] = src[a++];
+                } else {
+                    dst[i] = src[b++];
+                }
+            }
+        }
+        dst = src;
+        src = (src == tmp) ? vector->list : tmp;
+    }
+
+    // Last merged pass must end in vector list
+    if (src != vector->list)
+        memcpy(vector->list, src, sizeof(void *) * count);
+
+    free(tmp);
+    return 0;
+}
+
 void
 vector_generic_destroyer(void *item)
 {
@@ -34,6 +34,9 @@
 #include "config.h"
 #include <stdint.h>
 
+//! Elements stored inside the vector structure before allocating a list
+#define VECTOR_INLINE_SIZE  2
+
 //! Shorter declaration of vector structure
 typedef struct vector vector_t;
 //! Shorter declaration of iterator structure
@@ -47,14 +50,18 @@ struct vector {
     uint32_t count;
     //! Total space in list (available + elements)
     uint32_t limit;
-    //! Number of new spaces to be reallocated
-    uint8_t step;
+    //! Minimum number of new spaces to be reallocated
+    uint32_t step;
+    //! Free spaces before the first element, left by removed elements
+    uint32_t offset;
     //! Elements of the vector
     void **list;
     //! Function to destroy one item
     void (*destroyer) (void *item);
     //! Function to sort each appended/inserted item
     void (*sorter) (vector_t *vector, void *item);
+    //! Storage of the first elements, used while they fit
+    void *inline_list[VECTOR_INLINE_SIZE];
 };
 
 struct vector_iter {
@@ -73,6 +80,10 @@ struct vector_iter {
  *
  * Create a new vector with initial size and
  * step increase settings.
+ *
+ * Vectors with an initial size of VECTOR_INLINE_SIZE or less store
+ * their first elements inside the vector structure. When the list is
+ * full, it grows by half its size or step elements, whatever is bigger.
  */
 vector_t *
 vector_create(int limit, int step);
@@ -116,6 +127,18 @@ vector_copy_if(vector_t *original, int (*filter)(void *item));
 void
 vector_clear(vector_t *vector);
 
+/**
+ * @brief Make room for a number of elements
+ *
+ * Used before appending several items, so the list is only
+ * reallocated once.
+ *
+ * @param count total number of elements the vector must be able to hold
+ * @return 0 in case of success, 1 on memory error
+ */
+int
+vector_reserve(vector_t *vector, int count);
+
 /**
  * @brief Append an item to vector
  *
@@ -146,6 +169,9 @@ vector_insert(vector_t *vector, void *item, int pos);
 
 /**
  * @brief Remove itemn from vector
+ *
+ * Elements on the shorter side of the removed item are moved, so removing
+ * items near the beginning or the end of the vector is cheap.
  */
 void
 vector_remove(vector_t *vector, void *item);
@@ -170,6 +196,17 @@ vector_set_destroyer(vector_t *vector, void (*destroyer) (void *item));
 void
 vector_set_sorter(vector_t *vector, void (*sorter) (vector_t *vector, void *item));
 
+/**
+ * @brief Sort all vector items
+ *
+ * Items comparing equal keep their relative order (merge sort).
+ *
+ * @param compare function returning <0, 0 or >0 like strcmp
+ * @return 0 if vector has been sorted, 1 on memory error
+ */
+int
+vector_sort(vector_t *vector, int (*compare) (void *one, void *two));
+
 /**
  * @brief A generic item destroyer
  *
@@ -0,0 +1,497 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file bench.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Ingest benchmark for sngrep
+ *
+ * Generates a synthetic capture file with SIP calls (and optionally their
+ * RTP streams), reads it with sngrep in no interface mode and prints a
+ * JSON object with ingest rates, peak resident memory and, for builds
+ * configured with --enable-latency, time spent in each processing stage.
+ *
+ * Same options always generate the same capture file, so results of
+ * different builds can be compared.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+//! Max size of a generated frame
+#define BENCH_FRAME_LEN     2048
+//! Time between RTP packets of each stream (ms)
+#define BENCH_RTP_PTIME     20
+//! RTP payload size (G.711 20ms)
+#define BENCH_RTP_LEN       160
+//! Max size of sngrep stage report
+#define BENCH_REPORT_LEN    8192
+
+//! Benchmark options
+struct bench_options
+{
+    //! Number of generated calls
+    int calls;
+    //! New calls per second
+    int rate;
+    //! Seconds between call answer and hangup
+    int duration;
+    //! Percentage of calls signalled over TCP
+    int tcp;
+    //! Generate RTP streams of answered calls
+    int rtp;
+    //! Generated capture file
+    const char *pcap;
+    //! sngrep binary to benchmark
+    const char *sngrep;
+    //! Only generate the capture file
+    int generate;
+};
+
+//! Generated capture counters
+struct bench_capture
+{
+    FILE *file;
+    //! Frames written
+    unsigned long packets;
+    //! Frame bytes written
+    unsigned long bytes;
+    //! Frames written in current tick (to keep timestamps ordered)
+    unsigned long tick_packets;
+};
+
+/**
+ * @brief Compute IPv4 header checksum
+ */
+static uint16_t
+bench_ip_checksum(const uint8_t *data, int len)
+{
+    uint32_t sum = 0;
+    int i;
+
+    for (i = 0; i < len; i += 2)
+        sum += (data[i] << 8) | data[i + 1];
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+    return htons(~sum & 0xffff);
+}
+
+/**
+ * @brief Write an Ethernet/IPv4/UDP or TCP frame to the capture file
+ */
+static void
+bench_write(struct bench_capture *cap, uint64_t usec, int tcp, uint32_t src, uint16_t sport,
+            uint32_t dst, uint16_t dport, uint32_t seq, const void *payload, int len)
+{
+    uint8_t frame[BENCH_FRAME_LEN] = { 0 };
+    uint8_t *ip = frame + 14, *l4 = ip + 20;
+    int l4len = (tcp) ? 20 : 8;
+    uint32_t hdr[4];
+    uint16_t u16;
+
+    if (len > BENCH_FRAME_LEN - 14 - 20 - l4len)
+        len = BENCH_FRAME_LEN - 14 - 20 - l4len;
+
+    // Ethernet header (IPv4)
+    memcpy(frame, "\x02\x00\x00\x00\x00\x02\x02\x00\x00\x00\x00\x01\x08\x00", 14);
+
+    // IPv4 header
+    ip[0] = 0x45;
+    u16 = htons(20 + l4len + len);
+    memcpy(ip + 2, &u16, 2);
+    ip[8] = 64;
+    ip[9] = (tcp) ? IPPROTO_TCP : IPPROTO_UDP;
+    src = htonl(src);
+    dst = htonl(dst);
+    memcpy(ip + 12, &src, 4);
+    memcpy(ip + 16, &dst, 4);
+    u16 = bench_ip_checksum(ip, 20);
+    memcpy(ip + 10, &u16, 2);
+
+    // Transport header
+    u16 = htons(sport);
+    memcpy(l4, &u16, 2);
+    u16 = htons(dport);
+    memcpy(l4 + 2, &u16, 2);
+    if (tcp) {
+        seq = htonl(seq);
+        memcpy(l4 + 4, &seq, 4);
+        l4[12] = 5 << 4;
+        l4[13] = 0x18; // PSH ACK
+        u16 = htons(65535);
+        memcpy(l4 + 14, &u16, 2);
+    } else {
+        u16 = htons(8 + len);
+        memcpy(l4 + 4, &u16, 2);
+    }
+    memcpy(l4 + l4len, payload, len);
+
+    // Frames of the same tick are a microsecond apart
+    usec += cap->tick_packets++;
+
+    // Record header
+    hdr[0] = usec / 1000000;
+    hdr[1] = usec % 1000000;
+    hdr[2] = hdr[3] = 14 + 20 + l4len + len;
+    fwrite(hdr, sizeof(hdr), 1, cap->file);
+    fwrite(frame, hdr[2], 1, cap->file);
+
+    cap->packets++;
+    cap->bytes += hdr[2];
+}
+
+/**
+ * @brief Addresses and ports of a generated call
+ */
+struct bench_call
+{
+    int id;
+    int tcp;
+    uint32_t caller;
+    uint32_t callee;
+    uint16_t rtp_caller;
+    uint16_t rtp_callee;
+    uint32_t seq[2];
+    uint16_t rtp_seq;
+};
+
+/**
+ * @brief Write a SIP message of a call
+ *
+ * @param dir 0 for caller to callee messages, 1 otherwise
+ */
+static void
+bench_sip(struct bench_capture *cap, struct bench_call *call, uint64_t usec, int dir,
+          const char *first, const char *method, int cseq, int sdp)
+{
+    char msg[BENCH_FRAME_LEN - 64], body[256] = "";
+    char caller[16], callee[16];
+    struct in_addr addr;
+    int len, blen = 0;
+
+    addr.s_addr = htonl(call->caller);
+    inet_ntop(AF_INET, &addr, caller, sizeof(caller));
+    addr.s_addr = htonl(call->callee);
+    inet_ntop(AF_INET, &addr, callee, sizeof(callee));
+
+    if (sdp) {
+        blen = snprintf(body, sizeof(body),
+                        "v=0\r\n"
+                        "o=- %d 1 IN IP4 %s\r\n"
+                        "s=bench\r\n"
+                        "c=IN IP4 %s\r\n"
+                        "t=0 0\r\n"
+                        "m=audio %u RTP/AVP 0\r\n"
+                        "a=rtpmap:0 PCMU/8000\r\n",
+                        call->id, (dir) ? callee : caller, (dir) ? callee : caller,
+                        (dir) ? call->rtp_callee : call->rtp_caller);
+    }
+
+    len = snprintf(msg, sizeof(msg),
+                   "%s\r\n"
+                   "Via: SIP/2.0/%s %s:5060;branch=z9hG4bK%d%s\r\n"
+                   "From: <sip:%d@%s>;tag=%da\r\n"
+                   "To: <sip:%d@%s>%s\r\n"
+                   "Call-ID: bench-%d@%s\r\n"
+                   "CSeq: %d %s\r\n"
+                   "Contact: <sip:%d@%s:5060>\r\n"
+                   "Max-Forwards: 70\r\n"
+                   "User-Agent: sngrep-bench\r\n"
+                   "%s"
+                   "Content-Length: %d\r\n"
+                   "\r\n"
+                   "%s",
+                   first, (call->tcp) ? "TCP" : "UDP", caller, call->id, method,
+                   100000 + call->id, caller, call->id,
+                   200000 + call->id, callee, (strcmp(method, "INVITE") || dir) ? ";tag=b" : "",
+                   call->id, caller,
+                   cseq, method,
+                   (dir) ? 200000 + call->id : 100000 + call->id, (dir) ? callee : caller,
+                   (sdp) ? "Content-Type: application/sdp\r\n" : "",
+                   blen, body);
+
+    if (dir) {
+        bench_write(cap, usec, call->tcp, call->callee, 5060, call->caller, 5060, call->seq[1], msg, len);
+    } else {
+        bench_write(cap, usec, call->tcp, call->caller, 5060, call->callee, 5060, call->seq[0], msg, len);
+    }
+    call->seq[dir] += len;
+}
+
+/**
+ * @brief Write one RTP packet in each direction of a call
+ */
+static void
+bench_rtp(struct bench_capture *cap, struct bench_call *call, uint64_t usec)
+{
+    uint8_t rtp[12 + BENCH_RTP_LEN];
+    uint16_t seq = htons(call->rtp_seq);
+    uint32_t ts = htonl((uint32_t) call->rtp_seq * BENCH_RTP_LEN), ssrc;
+
+    memset(rtp, 0xff, sizeof(rtp));
+    rtp[0] = 0x80;
+    rtp[1] = 0x00;
+    memcpy(rtp + 2, &seq, 2);
+    memcpy(rtp + 4, &ts, 4);
+
+    ssrc = htonl(call->id * 2);
+    memcpy(rtp + 8, &ssrc, 4);
+    bench_write(cap, usec, 0, call->caller, call->rtp_caller, call->callee, call->rtp_callee, 0, rtp, sizeof(rtp));
+    ssrc = htonl(call->id * 2 + 1);
+    memcpy(rtp + 8, &ssrc, 4);
+    bench_write(cap, usec, 0, call->callee, call->rtp_callee, call->caller, call->rtp_caller, 0, rtp, sizeof(rtp));
+    call->rtp_seq++;
+}
+
+/**
+ * @brief Generate the capture file
+ *
+ * Time advances in RTP packetization ticks. Each call sends its INVITE
+ * in the tick it starts, is answered in the next one, streams RTP for the
+ * configured duration and is hung up after that.
+ */
+static int
+bench_generate(struct bench_options *opts, struct bench_capture *cap)
+{
+    uint32_t header[6] = { 0xa1b2c3d4, 0x00040002, 0, 0, 65535, 1 };
+    struct bench_call *calls;
+    uint64_t tick, usec, start, ticks = opts->duration * 1000 / BENCH_RTP_PTIME;
+    int started = 0, first = 0, i;
+
+    if (!(cap->file = fopen(opts->pcap, "w")))
+        return 1;
+    if (!(calls = calloc(opts->calls, sizeof(struct bench_call)))) {
+        fclose(cap->file);
+        return 1;
+    }
+
+    fwrite(header, sizeof(header), 1, cap->file);
+
+    for (tick = 0; first < opts->calls; tick++) {
+        usec = 1500000000ULL * 1000000 + tick * BENCH_RTP_PTIME * 1000;
+        cap->tick_packets = 0;
+
+        // Start calls due in this tick
+        while (started < opts->calls
+               && (uint64_t) started * 1000 / opts->rate / BENCH_RTP_PTIME <= tick) {
+            struct bench_call *call = &calls[started];
+            call->id = started;
+            call->tcp = (started % 100) < opts->tcp;
+            call->caller = 0x0a010000 | (started & 0xffff);
+            call->callee = 0x0a020000 | ((started >> 16) & 0xffff);
+            call->rtp_caller = 10000 + (started % 25000) * 2;
+            call->rtp_callee = 10000 + (started % 25000) * 2;
+            bench_sip(cap, call, usec, 0, "INVITE sip:x@y SIP/2.0", "INVITE", 1, 1);
+            bench_sip(cap, call, usec, 1, "SIP/2.0 100 Trying", "INVITE", 1, 0);
+            bench_sip(cap, call, usec, 1, "SIP/2.0 180 Ringing", "INVITE", 1, 0);
+            started++;
+        }
+
+        // Progress of started calls
+        for (i = first; i < started; i++) {
+            struct bench_call *call = &calls[i];
+            start = (uint64_t) i * 1000 / opts->rate / BENCH_RTP_PTIME;
+            if (tick == start + 1) {
+                bench_sip(cap, call, usec, 1, "SIP/2.0 200 OK", "INVITE", 1, 1);
+                bench_sip(cap, call, usec, 0, "ACK sip:x@y SIP/2.0", "ACK", 1, 0);
+            } else if (tick > start + 1 && tick <= start + 1 + ticks) {
+                if (opts->rtp)
+                    bench_rtp(cap, call, usec);
+            } else if (tick == start + 2 + ticks) {
+                bench_sip(cap, call, usec, 0, "BYE sip:x@y SIP/2.0", "BYE", 2, 0);
+                bench_sip(cap, call, usec, 1, "SIP/2.0 200 OK", "BYE", 2, 0);
+                // Calls finish in the same order they started
+                if (i == first)
+                    first++;
+            }
+        }
+    }
+
+    free(calls);
+    return fclose(cap->file);
+}
+
+/**
+ * @brief Get seconds from a timeval
+ */
+static double
+bench_seconds(struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/**
+ * @brief Read capture file with sngrep and print results
+ */
+static int
+bench_run(struct bench_options *opts, struct bench_capture *cap)
+{
+    char limit[32], report[BENCH_REPORT_LEN], line[512];
+    struct timespec start, end;
+    struct rusage usage;
+    size_t len = 0;
+    int pipefd[2], status, first = 1;
+    double wall;
+    FILE *err;
+    pid_t pid;
+
+    snprintf(limit, sizeof(limit), "%d", opts->calls + 1);
+
+    if (pipe(pipefd) != 0)
+        return 1;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if ((pid = fork()) < 0) {
+        return 1;
+    } else if (pid == 0) {
+        // Stage report is written to standard error
+        dup2(pipefd[1], STDERR_FILENO);
+        close(pipefd[0]);
+        char *argv[] = { (char *) opts->sngrep, "-F", "-N", "-q", "-l", limit, "-I", (char *) opts->pcap, 0 };
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    close(pipefd[1]);
+
+    // Keep stage lines, forward anything else
+    report[0] = '\0';
+    err = fdopen(pipefd[0], "r");
+    while (fgets(line, sizeof(line), err)) {
+        if (strncmp(line, "{\"stage\"", 8) != 0) {
+            fputs(line, stderr);
+            continue;
+        }
+        line[strcspn(line, "\n")] = '\0';
+        if (len + strlen(line) + 2 < sizeof(report))
+            len += sprintf(report + len, "%s%s", (first) ? "" : ",", line);
+        first = 0;
+    }
+    fclose(err);
+
+    if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s failed reading %s\n", opts->sngrep, opts->pcap);
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    printf("{\"calls\":%d,\"rate\":%d,\"duration\":%d,\"tcp\":%d,\"rtp\":%s,"
+           "\"packets\":%lu,\"bytes\":%lu,"
+           "\"wall_s\":%.3f,\"user_s\":%.3f,\"sys_s\":%.3f,"
+           "\"packets_per_s\":%.0f,\"calls_per_s\":%.0f,\"peak_rss_kb\":%ld,"
+           "\"stages\":[%s]}\n",
+           opts->calls, opts->rate, opts->duration, opts->tcp, (opts->rtp) ? "true" : "false",
+           cap->packets, cap->bytes,
+           wall, bench_seconds(&usage.ru_utime), bench_seconds(&usage.ru_stime),
+           cap->packets / wall, opts->calls / wall, usage.ru_maxrss,
+           report);
+
+    return 0;
+}
+
+static void
+bench_usage(const char *name)
+{
+    printf("Usage: %s [-c calls] [-r rate] [-d duration] [-t tcp%%] [-R] [-o pcap] [-s sngrep] [-g]\n\n"
+           "    -c\t Number of generated calls (default: 1000)\n"
+           "    -r\t New calls per second (default: 100)\n"
+           "    -d\t Seconds between answer and hangup of each call (default: 10)\n"
+           "    -t\t Percentage of calls signalled over TCP (default: 0)\n"
+           "    -R\t Generate RTP streams of each call\n"
+           "    -o\t Generated capture file (default: bench.pcap)\n"
+           "    -s\t sngrep binary (default: ../src/sngrep)\n"
+           "    -g\t Only generate the capture file\n", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct bench_options opts = {
+        .calls = 1000,
+        .rate = 100,
+        .duration = 10,
+        .tcp = 0,
+        .rtp = 0,
+        .pcap = "bench.pcap",
+        .sngrep = "../src/sngrep",
+        .generate = 0
+    };
+    struct bench_capture cap = { 0 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:r:d:t:Ro:s:gh")) != -1) {
+        switch (opt) {
+            case 'c':
+                opts.calls = atoi(optarg);
+                break;
+            case 'r':
+                opts.rate = atoi(optarg);
+                break;
+            case 'd':
+                opts.duration = atoi(optarg);
+                break;
+            case 't':
+                opts.tcp = atoi(optarg);
+                break;
+            case 'R':
+                opts.rtp = 1;
+                break;
+            case 'o':
+                opts.pcap = optarg;
+                break;
+            case 's':
+                opts.sngrep = optarg;
+                break;
+            case 'g':
+                opts.generate = 1;
+                break;
+            default:
+                bench_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (opts.calls <= 0 || opts.rate <= 0 || opts.duration < 0 || opts.tcp < 0 || opts.tcp > 100) {
+        bench_usage(argv[0]);
+        return 1;
+    }
+
+    if (bench_generate(&opts, &cap) != 0) {
+        fprintf(stderr, "Unable to write capture file %s\n", opts.pcap);
+        return 1;
+    }
+
+    if (opts.generate) {
+        printf("{\"calls\":%d,\"packets\":%lu,\"bytes\":%lu}\n", opts.calls, cap.packets, cap.bytes);
+        return 0;
+    }
+
+    return bench_run(&opts, &cap);
+}
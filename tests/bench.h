@@ -0,0 +1,84 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file bench.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Common functions of sngrep microbenchmarks
+ *
+ * Each measured case is printed as a JSON object in its own line so
+ * results of different builds can be compared by scripts.
+ */
+#ifndef __SNGREP_BENCH_H
+#define __SNGREP_BENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+//! Default number of elements of container benchmarks
+#define BENCH_DEFAULT_COUNT 1000000
+
+/**
+ * @brief Get monotonic time in nanoseconds
+ */
+static inline uint64_t
+bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Get next value of a deterministic pseudo-random sequence
+ */
+static inline uint64_t
+bench_random(uint64_t *state)
+{
+    // xorshift64*
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * @brief Print the result of a measured case
+ *
+ * @param bench benchmark name
+ * @param name measured case
+ * @param count number of elements of the measured structure
+ * @param ops number of measured operations
+ * @param start time when measure started (bench_now)
+ */
+static inline void
+bench_report(const char *bench, const char *name, unsigned long count, unsigned long ops, uint64_t start)
+{
+    uint64_t elapsed = bench_now() - start;
+
+    printf("{\"bench\":\"%s\",\"case\":\"%s\",\"count\":%lu,\"ops\":%lu,\"ns\":%llu,\"ns_per_op\":%.2f}\n",
+           bench, name, count, ops, (unsigned long long) elapsed, ops ? (double) elapsed / ops : 0);
+    fflush(stdout);
+}
+
+#endif /* __SNGREP_BENCH_H */
@@ -0,0 +1,129 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file bench_htable.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Microbenchmark of hash table functions using Call-ID like keys
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "bench.h"
+
+//! Max length of a generated Call-ID
+#define BENCH_CALLID_LEN    64
+
+/**
+ * @brief Generate a Call-ID in one of the formats used by common SIP stacks
+ */
+static void
+bench_callid(uint64_t *seed, char *callid)
+{
+    uint64_t a = bench_random(seed), b = bench_random(seed);
+
+    switch (a % 4) {
+        case 0:
+            // UUID (FreeSWITCH, many softphones)
+            sprintf(callid, "%08x-%04x-%04x-%04x-%012llx", (uint32_t) b, (uint32_t) (a >> 8) & 0xffff,
+                    (uint32_t) (a >> 24) & 0xffff, (uint32_t) (a >> 40) & 0xffff,
+                    (unsigned long long) (b >> 16));
+            break;
+        case 1:
+            // Hex string at IP and port (Asterisk)
+            sprintf(callid, "%016llx%08x@10.%u.%u.%u:5060", (unsigned long long) b, (uint32_t) (a >> 16),
+                    (uint32_t) (a >> 8) & 0xff, (uint32_t) (b >> 8) & 0xff, (uint32_t) b & 0xff);
+            break;
+        case 2:
+            // Random token at domain (Kamailio, OpenSIPS)
+            sprintf(callid, "%llx-%u@pbx.example.com", (unsigned long long) b, (uint32_t) (a >> 32));
+            break;
+        default:
+            // Sequential numbers (gateways)
+            sprintf(callid, "%u-%u@192.168.%u.%u", (uint32_t) (a >> 32), (uint32_t) (b >> 40),
+                    (uint32_t) (a >> 8) & 0xff, (uint32_t) a & 0xff);
+            break;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned long max = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_COUNT;
+    unsigned long count, i, found;
+    uint64_t seed = 0x5eed, start;
+    htable_t *table;
+    char *keys, *missing;
+
+    if (!(keys = malloc(max * BENCH_CALLID_LEN)) || !(missing = malloc(max * BENCH_CALLID_LEN)))
+        return 1;
+    for (i = 0; i < max; i++) {
+        bench_callid(&seed, keys + i * BENCH_CALLID_LEN);
+        bench_callid(&seed, missing + i * BENCH_CALLID_LEN);
+    }
+
+    for (count = 10000; count <= max; count *= 10) {
+        // Table sized for capture limit, as calls index is created
+        table = htable_create(count);
+        start = bench_now();
+        for (i = 0; i < count; i++)
+            htable_insert(table, keys + i * BENCH_CALLID_LEN, keys + i * BENCH_CALLID_LEN);
+        bench_report("htable", "insert", count, count, start);
+        htable_destroy(table);
+
+        // Table growing from its minimum size
+        table = htable_create(0);
+        start = bench_now();
+        for (i = 0; i < count; i++)
+            htable_insert(table, keys + i * BENCH_CALLID_LEN, keys + i * BENCH_CALLID_LEN);
+        bench_report("htable", "insert_grow", count, count, start);
+
+        // Existing keys in random order
+        found = 0;
+        seed = count;
+        start = bench_now();
+        for (i = 0; i < count; i++)
+            found += htable_find(table, keys + (bench_random(&seed) % count) * BENCH_CALLID_LEN) != NULL;
+        bench_report("htable", "find_hit", count, count, start);
+        if (found != count)
+            return 1;
+
+        // Keys of packets not belonging to any stored call
+        start = bench_now();
+        for (i = 0; i < count; i++)
+            found += htable_find(table, missing + i * BENCH_CALLID_LEN) != NULL;
+        bench_report("htable", "find_miss", count, count, start);
+
+        start = bench_now();
+        for (i = 0; i < count; i++)
+            htable_remove(table, keys + i * BENCH_CALLID_LEN);
+        bench_report("htable", "remove", count, count, start);
+        htable_destroy(table);
+    }
+
+    free(keys);
+    free(missing);
+    return 0;
+}
@@ -0,0 +1,133 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file bench_rtp.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Microbenchmark of RTP stream lookup functions
+ *
+ * Calls with one stream in each direction are indexed, then streams are
+ * searched by the addresses of captured RTP packets.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sip.h"
+#include "media.h"
+#include "rtp.h"
+#include "address.h"
+#include "bench.h"
+
+//! Max number of active calls
+#define BENCH_RTP_CALLS     100000
+//! Lookups measured by each case
+#define BENCH_RTP_OPS       1000000
+
+/**
+ * @brief Create a call with its streams in both directions
+ */
+static sip_call_t *
+bench_call_create(unsigned long id, address_t *caller, address_t *callee)
+{
+    char callid[64], ip[ADDRESSLEN + 8];
+    rtp_stream_t *stream;
+    sdp_media_t *media;
+    sip_call_t *call;
+    sip_msg_t *msg;
+    int dir;
+
+    sprintf(callid, "%lu@bench", id);
+    call = call_create(callid, strlen(callid), "", 0);
+    msg = msg_create(call);
+    msg->call = call;
+
+    // Each media server handles 25000 streams
+    sprintf(ip, "10.%lu.%lu.%lu:%lu", (id >> 16) & 0xff, (id >> 8) & 0xff, id & 0xff, 10000 + (id % 1000) * 2);
+    *caller = address_from_str(ip);
+    sprintf(ip, "192.168.%lu.1:%lu", (id / 25000) & 0xff, 10000 + (id % 25000) * 2);
+    *callee = address_from_str(ip);
+
+    for (dir = 0; dir < 2; dir++) {
+        media = media_create(msg);
+        stream = stream_create(media, (dir) ? *caller : *callee, PACKET_RTP);
+        stream_complete(stream, (dir) ? *callee : *caller);
+        stream_set_format(stream, 0);
+        stream->index = vector_append(call->streams, stream);
+        rtp_index_add(stream);
+    }
+
+    return call;
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned long max = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_RTP_CALLS;
+    unsigned long count = 0, target, i, found;
+    address_t *callers, *callees, missing;
+    uint64_t seed = 0x5eed, start;
+    int equal = 0;
+
+    if (!(callers = calloc(max, sizeof(address_t))) || !(callees = calloc(max, sizeof(address_t))))
+        return 1;
+
+    for (target = 100; target <= max; target *= 10) {
+        // More active calls
+        while (count < target) {
+            bench_call_create(count, &callers[count], &callees[count]);
+            count++;
+        }
+
+        // Address comparison done with each candidate stream
+        start = bench_now();
+        for (i = 0; i < BENCH_RTP_OPS; i++)
+            equal += addressport_equals(callees[i % count], callees[bench_random(&seed) % count]);
+        bench_report("rtp", "addressport_equals", count, BENCH_RTP_OPS, start);
+
+        // Packets of existing streams
+        found = 0;
+        start = bench_now();
+        for (i = 0; i < BENCH_RTP_OPS; i++) {
+            unsigned long id = bench_random(&seed) % count;
+            found += rtp_find_stream_format(callers[id], callees[id], 0) != NULL;
+        }
+        bench_report("rtp", "find_stream_format_hit", count, BENCH_RTP_OPS, start);
+        if (found != BENCH_RTP_OPS)
+            return 1;
+
+        // UDP packets that are not RTP of any known stream
+        missing = address_from_str("172.16.0.1:20000");
+        start = bench_now();
+        for (i = 0; i < BENCH_RTP_OPS; i++) {
+            missing.port = 20000 + (i % 20000) * 2;
+            rtp_find_stream_format(missing, callees[i % count], 0);
+        }
+        bench_report("rtp", "find_stream_format_miss", count, BENCH_RTP_OPS, start);
+    }
+
+    rtp_index_destroy();
+    free(callers);
+    free(callees);
+    return 0;
+}
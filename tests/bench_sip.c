@@ -0,0 +1,193 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file bench_sip.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Microbenchmark of SIP message parsing functions
+ *
+ * Messages of a full call setup and teardown, a registration and some
+ * out of dialog requests are parsed repeatedly.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sip.h"
+#include "sip_header.h"
+#include "sip_scan.h"
+#include "intern.h"
+#include "bench.h"
+
+//! Messages parsed by each case
+#define BENCH_SIP_OPS   1000000
+
+//! Sample SIP messages
+static const char *corpus[] = {
+    "INVITE sip:bob@biloxi.example.com SIP/2.0\r\n"
+    "Via: SIP/2.0/UDP pc33.atlanta.example.com;branch=z9hG4bK776asdhds\r\n"
+    "Max-Forwards: 70\r\n"
+    "To: Bob <sip:bob@biloxi.example.com>\r\n"
+    "From: Alice <sip:alice@atlanta.example.com>;tag=1928301774\r\n"
+    "Call-ID: a84b4c76e66710@pc33.atlanta.example.com\r\n"
+    "CSeq: 314159 INVITE\r\n"
+    "Contact: <sip:alice@pc33.atlanta.example.com>\r\n"
+    "Allow: INVITE, ACK, CANCEL, OPTIONS, BYE, REFER, NOTIFY, MESSAGE, SUBSCRIBE, INFO\r\n"
+    "User-Agent: Softphone Beta1.5\r\n"
+    "Content-Type: application/sdp\r\n"
+    "Content-Length: 142\r\n"
+    "\r\n"
+    "v=0\r\n"
+    "o=alice 2890844526 2890844526 IN IP4 pc33.atlanta.example.com\r\n"
+    "s=-\r\n"
+    "c=IN IP4 192.0.2.101\r\n"
+    "t=0 0\r\n"
+    "m=audio 49172 RTP/AVP 0\r\n"
+    "a=rtpmap:0 PCMU/8000\r\n",
+
+    "SIP/2.0 100 Trying\r\n"
+    "Via: SIP/2.0/UDP pc33.atlanta.example.com;branch=z9hG4bK776asdhds;received=192.0.2.101\r\n"
+    "To: Bob <sip:bob@biloxi.example.com>\r\n"
+    "From: Alice <sip:alice@atlanta.example.com>;tag=1928301774\r\n"
+    "Call-ID: a84b4c76e66710@pc33.atlanta.example.com\r\n"
+    "CSeq: 314159 INVITE\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n",
+
+    "SIP/2.0 180 Ringing\r\n"
+    "Via: SIP/2.0/UDP pc33.atlanta.example.com;branch=z9hG4bK776asdhds;received=192.0.2.101\r\n"
+    "To: Bob <sip:bob@biloxi.example.com>;tag=a6c85cf\r\n"
+    "From: Alice <sip:alice@atlanta.example.com>;tag=1928301774\r\n"
+    "Call-ID: a84b4c76e66710@pc33.atlanta.example.com\r\n"
+    "Contact: <sip:bob@192.0.2.4>\r\n"
+    "CSeq: 314159 INVITE\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n",
+
+    "SIP/2.0 200 OK\r\n"
+    "Via: SIP/2.0/UDP pc33.atlanta.example.com;branch=z9hG4bK776asdhds;received=192.0.2.101\r\n"
+    "To: Bob <sip:bob@biloxi.example.com>;tag=a6c85cf\r\n"
+    "From: Alice <sip:alice@atlanta.example.com>;tag=1928301774\r\n"
+    "Call-ID: a84b4c76e66710@pc33.atlanta.example.com\r\n"
+    "CSeq: 314159 INVITE\r\n"
+    "Contact: <sip:bob@192.0.2.4>\r\n"
+    "Content-Type: application/sdp\r\n"
+    "Content-Length: 131\r\n"
+    "\r\n"
+    "v=0\r\n"
+    "o=bob 2808844564 2808844564 IN IP4 biloxi.example.com\r\n"
+    "s=-\r\n"
+    "c=IN IP4 192.0.2.201\r\n"
+    "t=0 0\r\n"
+    "m=audio 3456 RTP/AVP 0\r\n"
+    "a=rtpmap:0 PCMU/8000\r\n",
+
+    "ACK sip:bob@192.0.2.4 SIP/2.0\r\n"
+    "Via: SIP/2.0/UDP pc33.atlanta.example.com;branch=z9hG4bKnashds9\r\n"
+    "Max-Forwards: 70\r\n"
+    "To: Bob <sip:bob@biloxi.example.com>;tag=a6c85cf\r\n"
+    "From: Alice <sip:alice@atlanta.example.com>;tag=1928301774\r\n"
+    "Call-ID: a84b4c76e66710@pc33.atlanta.example.com\r\n"
+    "CSeq: 314159 ACK\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n",
+
+    "BYE sip:alice@pc33.atlanta.example.com SIP/2.0\r\n"
+    "Via: SIP/2.0/UDP 192.0.2.4;branch=z9hG4bKnashds10\r\n"
+    "Max-Forwards: 70\r\n"
+    "From: Bob <sip:bob@biloxi.example.com>;tag=a6c85cf\r\n"
+    "To: Alice <sip:alice@atlanta.example.com>;tag=1928301774\r\n"
+    "Call-ID: a84b4c76e66710@pc33.atlanta.example.com\r\n"
+    "CSeq: 231 BYE\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n",
+
+    "REGISTER sip:registrar.biloxi.example.com SIP/2.0\r\n"
+    "Via: SIP/2.0/TCP bobspc.biloxi.example.com:5060;branch=z9hG4bKnashds7\r\n"
+    "Max-Forwards: 70\r\n"
+    "To: Bob <sip:bob@biloxi.example.com>\r\n"
+    "From: Bob <sip:bob@biloxi.example.com>;tag=456248\r\n"
+    "Call-ID: 843817637684230@998sdasdh09\r\n"
+    "CSeq: 1826 REGISTER\r\n"
+    "Contact: <sip:bob@192.0.2.4>\r\n"
+    "Expires: 7200\r\n"
+    "Content-Length: 0\r\n"
+    "\r\n",
+
+    "OPTIONS sip:carol@chicago.example.com SIP/2.0\r\n"
+    "v: SIP/2.0/UDP pc33.atlanta.example.com;branch=z9hG4bKhjhs8ass877\r\n"
+    "Max-Forwards: 70\r\n"
+    "t: <sip:carol@chicago.example.com>\r\n"
+    "f: Alice <sip:alice@atlanta.example.com>;tag=1928301774\r\n"
+    "i: a84b4c76e66710\r\n"
+    "CSeq: 63104 OPTIONS\r\n"
+    "Accept: application/sdp\r\n"
+    "l: 0\r\n"
+    "\r\n",
+};
+
+//! Number of sample messages
+#define BENCH_CORPUS_COUNT  (sizeof(corpus) / sizeof(corpus[0]))
+
+int
+main(int argc, char *argv[])
+{
+    unsigned long ops = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_SIP_OPS;
+    sip_header_table_t headers;
+    uint32_t lengths[BENCH_CORPUS_COUNT];
+    char callid[1024];
+    sip_msg_t msg;
+    unsigned long i, found = 0;
+    uint64_t start;
+
+    // Use the fastest header scanning functions
+    sip_scan_init();
+
+    for (i = 0; i < BENCH_CORPUS_COUNT; i++)
+        lengths[i] = strlen(corpus[i]);
+
+    start = bench_now();
+    for (i = 0; i < ops; i++)
+        found += sip_get_callid(corpus[i % BENCH_CORPUS_COUNT], callid) != NULL;
+    bench_report("sip", "get_callid", BENCH_CORPUS_COUNT, ops, start);
+    if (found != ops)
+        return 1;
+
+    start = bench_now();
+    for (i = 0; i < ops; i++)
+        sip_header_parse(&headers, corpus[i % BENCH_CORPUS_COUNT], lengths[i % BENCH_CORPUS_COUNT]);
+    bench_report("sip", "header_parse", BENCH_CORPUS_COUNT, ops, start);
+
+    // Message payload is parsed from the already scanned headers
+    start = bench_now();
+    for (i = 0; i < ops; i++) {
+        memset(&msg, 0, sizeof(sip_msg_t));
+        sip_header_parse(&headers, corpus[i % BENCH_CORPUS_COUNT], lengths[i % BENCH_CORPUS_COUNT]);
+        sip_parse_msg_payload(&msg, &headers);
+        intern_release(msg.sip_from);
+        intern_release(msg.sip_to);
+    }
+    bench_report("sip", "parse_msg_payload", BENCH_CORPUS_COUNT, ops, start);
+
+    return 0;
+}
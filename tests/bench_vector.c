@@ -0,0 +1,154 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file bench_vector.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Microbenchmark of vector functions with calls list sized vectors
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include "vector.h"
+#include "bench.h"
+
+//! Operations measured in cases that move all vector items each time
+#define BENCH_MOVE_OPS  1000
+
+/**
+ * @brief Compare two vector items
+ */
+static int
+bench_compare(void *one, void *two)
+{
+    long a = (long) one, b = (long) two;
+    return (a > b) - (a < b);
+}
+
+/**
+ * @brief Keep vector sorted after appending an item
+ *
+ * Same binary search used by calls list sorter.
+ */
+static void
+bench_sorter(vector_t *vector, void *item)
+{
+    int low = 0, high = vector_count(vector) - 1, middle;
+
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (bench_compare(item, vector_item(vector, middle)) > 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low < vector_count(vector) - 1)
+        vector_insert(vector, item, low);
+}
+
+/**
+ * @brief Create a vector with count items in increasing order
+ */
+static vector_t *
+bench_vector_create(unsigned long count)
+{
+    vector_t *vector = vector_create(200, 50);
+    unsigned long i;
+
+    for (i = 1; i <= count; i++)
+        vector_append(vector, (void *) (i * 2));
+    return vector;
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned long max = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_COUNT;
+    unsigned long count, i;
+    uint64_t seed = 0x5eed, start;
+    vector_t *vector;
+
+    for (count = 100000; count <= max; count *= 10) {
+        // Calls list growing as new calls are parsed
+        vector = vector_create(200, 50);
+        start = bench_now();
+        for (i = 1; i <= count; i++)
+            vector_append(vector, (void *) (i * 2));
+        bench_report("vector", "append", count, count, start);
+        vector_destroy(vector);
+
+        // Sorted by arrival, sorter finds items already in place
+        vector = vector_create(200, 50);
+        vector_set_sorter(vector, bench_sorter);
+        start = bench_now();
+        for (i = 1; i <= count; i++)
+            vector_append(vector, (void *) (i * 2));
+        bench_report("vector", "append_sorted", count, count, start);
+
+        // Sorted by other column, sorter moves items to random positions
+        start = bench_now();
+        for (i = 0; i < BENCH_MOVE_OPS; i++)
+            vector_append(vector, (void *) ((bench_random(&seed) % count) * 2 + 1));
+        bench_report("vector", "append_sorted_random", count, BENCH_MOVE_OPS, start);
+        vector_destroy(vector);
+
+        // Move appended items to the vector start
+        vector = bench_vector_create(count);
+        start = bench_now();
+        for (i = 1; i <= BENCH_MOVE_OPS; i++) {
+            vector_append(vector, (void *) (count * 2 + i));
+            vector_insert(vector, (void *) (count * 2 + i), 0);
+        }
+        bench_report("vector", "insert_first", count, BENCH_MOVE_OPS, start);
+        vector_destroy(vector);
+
+        // Items removed at random positions
+        vector = bench_vector_create(count);
+        start = bench_now();
+        for (i = 0; i < BENCH_MOVE_OPS; i++)
+            vector_remove(vector, vector_item(vector, bench_random(&seed) % vector_count(vector)));
+        bench_report("vector", "remove_random", count, BENCH_MOVE_OPS, start);
+        vector_destroy(vector);
+
+        // Oldest items removed first (calls rotation)
+        vector = bench_vector_create(count);
+        start = bench_now();
+        for (i = 0; i < count; i++)
+            vector_remove(vector, vector_first(vector));
+        bench_report("vector", "remove_first", count, count, start);
+        vector_destroy(vector);
+
+        // Full sort after changing sort column
+        vector = vector_create(count, 50);
+        for (i = 0; i < count; i++)
+            vector_append(vector, (void *) (bench_random(&seed) % (count * 4) + 1));
+        start = bench_now();
+        vector_sort(vector, bench_compare);
+        bench_report("vector", "sort", count, count, start);
+        vector_destroy(vector);
+    }
+
+    return 0;
+}
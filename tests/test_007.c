@@ -32,6 +32,12 @@
 #include "vector.h"
 #include "util.h"
 
+int
+compare_tens(void *one, void *two)
+{
+    return (long) one / 10 - (long) two / 10;
+}
+
 int main ()
 {
     vector_t *vector;
@@ -75,6 +81,65 @@ int main ()
     vector_set_destroyer(vector, vector_generic_destroyer);
     vector_remove(vector, vector_item(vector, 12));
     assert(vector_count(vector) == 15);
+    vector_destroy(vector);
+
+    // Removing first items and appending new ones keeps the order
+    long i, first = 1, last = 0;
+    vector = vector_create(10, 10);
+    for (i = 0; i < 1000; i++) {
+        vector_append(vector, (void *) ++last);
+        if (vector_count(vector) > 100)
+            vector_remove(vector, (void *) first++);
+    }
+    assert(vector_count(vector) == 100);
+    for (i = 0; i < 100; i++)
+        assert(vector_item(vector, i) == (void *) (first + i));
+    assert(vector_item(vector, 100) == NULL);
+
+    // Remove items near both ends
+    vector_remove(vector, (void *) (first + 2));
+    vector_remove(vector, (void *) (last - 2));
+    assert(vector_count(vector) == 98);
+    assert(vector_item(vector, 2) == (void *) (first + 3));
+    assert(vector_item(vector, 96) == (void *) (last - 1));
+    vector_destroy(vector);
+
+    // Sort keeps the order of equal items
+    vector = vector_create(10, 10);
+    for (i = 0; i < 100; i++)
+        vector_append(vector, (void *) ((i * 37) % 100 + 1));
+    assert(vector_sort(vector, compare_tens) == 0);
+    assert(vector_count(vector) == 100);
+    for (i = 1; i < 100; i++) {
+        long prev = (long) vector_item(vector, i - 1), cur = (long) vector_item(vector, i);
+        assert(prev / 10 <= cur / 10);
+        // Same tens: original appending order (73 is the inverse of 37 mod 100)
+        if (prev / 10 == cur / 10)
+            assert((prev - 1) * 73 % 100 < (cur - 1) * 73 % 100);
+    }
+    vector_destroy(vector);
+
+    // Small vectors store their items inline until they grow
+    vector_t *other = vector_create(1, 1);
+    vector_append(other, (void *) 1);
+    vector_append(other, (void *) 2);
+    assert(other->list == other->inline_list);
+    vector_remove(other, (void *) 1);
+    for (i = 3; i <= 1000; i++)
+        vector_append(other, (void *) i);
+    assert(other->list != other->inline_list);
+    assert(vector_count(other) == 999);
+    for (i = 0; i < 999; i++)
+        assert(vector_item(other, i) == (void *) (i + 2));
+
+    // Appending a vector reserves all required space at once
+    vector = vector_create(0, 1);
+    assert(vector_append_vector(vector, other) == 0);
+    assert(vector->limit == 999);
+    assert(vector_count(vector) == 999);
+    assert(vector_last(vector) == (void *) 1000);
+    vector_destroy(vector);
+    vector_destroy(other);
 
     return 0;
 }
@@ -29,6 +29,7 @@
 #include "config.h"
 #include <assert.h>
 #include <string.h>
+#include <stdio.h>
 #include "hash.h"
 
 int main ()
@@ -77,6 +78,13 @@ int main ()
     const char *data10 = htable_find(table, "key10");
     assert(strcmp(data10, "data10") == 0);
 
+    // Find entries using part of a longer key
+    assert(htable_hash_len(table, "key10 x", 5) == htable_hash(table, "key10"));
+    assert(htable_find_len(table, "key10 x", 5) == data10);
+    assert(htable_find_len(table, "key1000", 5) == data10);
+    assert(htable_find_len(table, "key10", 4) != data10);
+    assert(htable_find_len(table, "key", 0) == NULL);
+
     // Remove all entries
     htable_remove(table, "key1");
     htable_remove(table, "key2");
@@ -97,8 +105,32 @@ int main ()
     // Search a not found entry
     assert(htable_find(table, "key7") == NULL);
 
+    // First character is part of the hash
+    assert(htable_hash(table, "akey") != htable_hash(table, "bkey"));
+
     // Destroy the table
     htable_destroy(table);
 
+    // Table grows beyond its initial size
+    char keys[2000][16];
+    int i;
+    table = htable_create(0);
+    for (i = 0; i < 2000; i++) {
+        sprintf(keys[i], "callid%d@host", i);
+        assert(htable_insert(table, keys[i], keys[i]) == 0);
+    }
+    assert(table->count == 2000);
+    assert(table->size > 2000);
+    for (i = 0; i < 2000; i++)
+        assert(htable_find(table, keys[i]) == keys[i]);
+
+    // Remove half of the entries, the others must still be found
+    for (i = 0; i < 2000; i += 2)
+        htable_remove(table, keys[i]);
+    assert(table->count == 1000);
+    for (i = 0; i < 2000; i++)
+        assert(htable_find(table, keys[i]) == ((i % 2) ? keys[i] : NULL));
+    htable_destroy(table);
+
     return 0;
 }
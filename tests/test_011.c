@@ -0,0 +1,89 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_011.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic testing of ring structures
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "ring.h"
+
+#define RING_TEST_ITEMS 100000
+
+void *
+ring_test_producer(void *data)
+{
+    ring_t *ring = data;
+    uintptr_t i;
+
+    for (i = 1; i <= RING_TEST_ITEMS; i++) {
+        while (ring_push(ring, (void *) i) != 0);
+    }
+    return NULL;
+}
+
+int main ()
+{
+    ring_t *ring;
+    pthread_t producer;
+    uintptr_t i, item;
+
+    // Size is rounded to the next power of two
+    ring = ring_create(10);
+    assert(ring);
+    assert(ring_size(ring) == 16);
+    assert(ring_count(ring) == 0);
+    assert(ring_pop(ring) == NULL);
+
+    // Fill the ring
+    for (i = 1; i <= 16; i++)
+        assert(ring_push(ring, (void *) i) == 0);
+    assert(ring_count(ring) == 16);
+
+    // Full ring rejects new items
+    assert(ring_push(ring, (void *) 17) == 1);
+    ring_add_overflow(ring);
+    assert(ring_overflows(ring) == 1);
+
+    // Items are returned in the same order
+    for (i = 1; i <= 16; i++)
+        assert(ring_pop(ring) == (void *) i);
+    assert(ring_pop(ring) == NULL);
+    assert(ring_count(ring) == 0);
+
+    // One thread pushing while other pops
+    pthread_create(&producer, NULL, ring_test_producer, ring);
+    for (i = 1; i <= RING_TEST_ITEMS; i++) {
+        while (!(item = (uintptr_t) ring_pop(ring)));
+        assert(item == i);
+    }
+    pthread_join(producer, NULL);
+    assert(ring_count(ring) == 0);
+
+    ring_destroy(ring);
+    return 0;
+}
@@ -0,0 +1,73 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_012.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic testing of SIP header scanning functions
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sip_scan.h"
+
+#define SCAN_TEST_SIZE  200
+
+int main ()
+{
+    const sip_scan_t *scalar, *kernel;
+    const char *colon, *kcolon, *end;
+    char data[SCAN_TEST_SIZE];
+    const char chars[] = "\r\n:ab", *header = "Call-ID: 1\r\n", *partial = "a\r\n\r";
+    int i, k, round, start, len;
+
+    // Byte by byte scan is always available
+    scalar = sip_scan_kernel(0);
+    assert(scalar && !strcmp(scalar->name, "scalar"));
+
+    end = scalar->line(header, header + strlen(header), &colon);
+    assert(end == header + 11 && colon == header + 7);
+    assert(scalar->end_of_headers(partial, partial + strlen(partial)) == NULL);
+
+    // Other implementations must return the same results
+    srand(12);
+    for (round = 0; round < 20000; round++) {
+        for (i = 0; i < SCAN_TEST_SIZE; i++)
+            data[i] = rand() % 2 ? 'x' : chars[rand() % 5];
+        start = rand() % SCAN_TEST_SIZE;
+        len = rand() % (SCAN_TEST_SIZE - start + 1);
+
+        for (k = 1; (kernel = sip_scan_kernel(k)); k++) {
+            end = scalar->line(data + start, data + start + len, &colon);
+            assert(kernel->line(data + start, data + start + len, &kcolon) == end);
+            assert(kcolon == colon);
+            end = scalar->end_of_headers(data + start, data + start + len);
+            assert(kernel->end_of_headers(data + start, data + start + len) == end);
+        }
+    }
+
+    sip_scan_init();
+    assert(sip_scan_name());
+    return 0;
+}
@@ -0,0 +1,67 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_013.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic testing of string interning functions
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <string.h>
+#include "intern.h"
+
+int main ()
+{
+    const char *alice, *alice2, *bob, *prefix;
+
+    // Equal strings share the same pointer
+    alice = intern_get("alice@example.com", 17);
+    assert(alice);
+    assert(!strcmp(alice, "alice@example.com"));
+    alice2 = intern_get("alice@example.com;tag=1", 17);
+    assert(alice2 == alice);
+    assert(intern_count() == 1);
+
+    // Different strings do not
+    bob = intern_get("bob@example.com", 15);
+    assert(bob && bob != alice);
+    prefix = intern_get("alice", 5);
+    assert(prefix && prefix != alice);
+    assert(!strcmp(prefix, "alice"));
+    assert(intern_count() == 3);
+
+    // Strings are removed when all references are released
+    intern_release(alice);
+    assert(intern_count() == 3);
+    intern_release(alice2);
+    assert(intern_count() == 2);
+    alice = intern_get("alice@example.com", 17);
+    assert(!strcmp(alice, "alice@example.com"));
+    assert(intern_get("bob@example.com", 15) == bob);
+    intern_release(NULL);
+
+    intern_clear();
+    assert(intern_count() == 0);
+    return 0;
+}
@@ -0,0 +1,78 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_014.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic testing of multi-pattern matching functions
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <string.h>
+#include "match.h"
+
+#define MATCH(m, s) match_exec(m, s, strlen(s))
+
+int main ()
+{
+    match_patterns_t *match;
+
+    // Empty lists can not be compiled
+    match = match_create(0);
+    assert(match_add_pattern(match, "", 0) == 1);
+    assert(match_compile(match) == 1);
+    assert(!MATCH(match, "INVITE"));
+    match_destroy(match);
+
+    // Case sensitive patterns, including overlapping ones
+    match = match_create(0);
+    assert(match_add_pattern(match, "34600", 5) == 0);
+    assert(match_add_pattern(match, "600111", 6) == 0);
+    assert(match_add_pattern(match, "trunk-b", 7) == 0);
+    assert(match_add_pattern(match, "unk-a", 5) == 0);
+    assert(match_count(match) == 4);
+    assert(match_compile(match) == 0);
+    assert(MATCH(match, "From: <sip:34600@a>"));
+    assert(MATCH(match, "To: <sip:+3460011199@b>"));
+    assert(MATCH(match, "To: <sip:36001119@b>"));
+    assert(MATCH(match, "X-Trunk: trunk-a"));
+    assert(MATCH(match, "X-Trunk: trunk-b"));
+    assert(!MATCH(match, "X-Trunk: TRUNK-A"));
+    assert(!MATCH(match, "From: <sip:3460@a> 60011 trunk-"));
+    assert(!MATCH(match, ""));
+    // Data after embedded zeroes is also checked
+    assert(match_exec(match, "a\0" "34600", 7));
+    match_destroy(match);
+
+    // Case insensitive patterns
+    match = match_create(1);
+    match_add_pattern(match, "Trunk-A", 7);
+    match_add_pattern(match, "ab", 2);
+    assert(match_compile(match) == 0);
+    assert(MATCH(match, "x-trunk: TRUNK-a"));
+    assert(MATCH(match, "aAB"));
+    assert(!MATCH(match, "trunk_a a b"));
+    match_destroy(match);
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_015.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic testing of memory region functions
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include "arena.h"
+
+int main ()
+{
+    arena_t *arena;
+    char *str, *data;
+    size_t size;
+    int i;
+
+    arena = arena_create(256);
+    assert(arena);
+    size = arena_size(arena);
+
+    // Allocated memory is aligned and zero filled
+    for (i = 1; i < 100; i++) {
+        data = arena_alloc(arena, i);
+        assert(data);
+        assert(((uintptr_t) data % ARENA_ALIGN) == 0);
+        assert(data[0] == 0 && data[i - 1] == 0);
+        memset(data, 0xff, i);
+    }
+
+    // Region got more chunks
+    assert(arena_size(arena) > size);
+
+    // Allocations bigger than a chunk
+    data = arena_alloc(arena, ARENA_MAX_CHUNK * 2);
+    assert(data);
+    memset(data, 0xff, ARENA_MAX_CHUNK * 2);
+
+    // String copies
+    str = arena_strndup(arena, "callid@host;tag=1", 11);
+    assert(str && !strcmp(str, "callid@host"));
+
+    arena_destroy(arena);
+    return 0;
+}
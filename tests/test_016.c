@@ -0,0 +1,109 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_016.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic testing of object pool functions
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+#include "pool.h"
+#include "ring.h"
+
+#define TEST_OBJECTS 100000
+
+static pool_t test_pool = POOL_INITIALIZER(POOL_PACKET, "Test", 40);
+static ring_t *queue;
+
+void *
+consumer(void *arg)
+{
+    char *object;
+    int i;
+
+    // Release objects allocated by other thread
+    for (i = 0; i < TEST_OBJECTS; i++) {
+        while (!(object = ring_pop(queue)));
+        assert(object[0] == (char) i);
+        pool_free(&test_pool, object);
+    }
+    return NULL;
+}
+
+int main ()
+{
+    char *objects[1000], *object;
+    const char *name;
+    size_t used, total;
+    pthread_t thread;
+    int i;
+
+    // Pool is not listed until used
+    assert(pool_stats(POOL_PACKET, &used, &total) == NULL);
+
+    // Objects are usable and different
+    for (i = 0; i < 1000; i++) {
+        objects[i] = pool_alloc(&test_pool);
+        assert(objects[i]);
+        memset(objects[i], i, 40);
+    }
+    for (i = 0; i < 1000; i++)
+        assert(objects[i][0] == (char) i && objects[i][39] == (char) i);
+
+    name = pool_stats(POOL_PACKET, &used, &total);
+    assert(name && !strcmp(name, "Test"));
+    assert(used == 1000);
+#ifndef POOL_USE_MALLOC
+    assert(total >= 1000);
+#endif
+
+    for (i = 0; i < 1000; i++)
+        pool_free(&test_pool, objects[i]);
+    pool_stats(POOL_PACKET, &used, &total);
+    assert(used == 0);
+
+    // Objects released by another thread are reused
+    queue = ring_create(64);
+    assert(queue);
+    pthread_create(&thread, NULL, consumer, NULL);
+    for (i = 0; i < TEST_OBJECTS; i++) {
+        object = pool_alloc(&test_pool);
+        assert(object);
+        object[0] = (char) i;
+        while (ring_push(queue, object) != 0);
+    }
+    pthread_join(thread, NULL);
+    pool_stats(POOL_PACKET, &used, &total);
+    assert(used == 0);
+#ifndef POOL_USE_MALLOC
+    // Memory is not lost in the thread releasing objects
+    assert(total < TEST_OBJECTS / 10);
+#endif
+
+    pool_deinit();
+    assert(pool_stats(POOL_PACKET, &used, &total) == NULL);
+    return 0;
+}
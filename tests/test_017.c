@@ -0,0 +1,89 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_017.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic testing of TLS key log file functions
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "capture_keylog.h"
+
+#define KEYLOG_TEST_RANDOM1 "0102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f20"
+#define KEYLOG_TEST_RANDOM2 "A0A1A2A3A4A5A6A7A8A9AAABACADAEAFB0B1B2B3B4B5B6B7B8B9BABBBCBDBEBF"
+#define KEYLOG_TEST_SECRET  "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f" \
+                            "202122232425262728292a2b2c2d2e2f"
+
+int main ()
+{
+    char file[] = "/tmp/sngrep-keylog-XXXXXX";
+    uint8_t random[KEYLOG_RANDOM_LEN];
+    uint8_t secret[KEYLOG_SECRET_LEN];
+    FILE *fp;
+    int fd, i;
+
+    assert((fd = mkstemp(file)) >= 0);
+    assert((fp = fdopen(fd, "w")));
+
+    // Only complete master secret lines are loaded
+    fprintf(fp, "# SSL/TLS secrets log file\n");
+    fprintf(fp, "CLIENT_HANDSHAKE_TRAFFIC_SECRET %s %s\n", KEYLOG_TEST_RANDOM1, KEYLOG_TEST_SECRET);
+    fprintf(fp, "CLIENT_RANDOM %s %s\n", KEYLOG_TEST_RANDOM1, KEYLOG_TEST_SECRET);
+    fprintf(fp, "CLIENT_RANDOM %s zz\n", KEYLOG_TEST_RANDOM2);
+    fprintf(fp, "CLIENT_RANDOM %s", KEYLOG_TEST_RANDOM2);
+    fflush(fp);
+
+    assert(capture_keylog_open(file) == 0);
+    assert(capture_keylog_count() == 1);
+
+    for (i = 0; i < KEYLOG_RANDOM_LEN; i++)
+        random[i] = i + 1;
+    assert(capture_keylog_find(random, secret) == 0);
+    for (i = 0; i < KEYLOG_SECRET_LEN; i++)
+        assert(secret[i] == i);
+
+    // Lines completed after file was read are found on lookup
+    for (i = 0; i < KEYLOG_RANDOM_LEN; i++)
+        random[i] = 0xA0 + i;
+    assert(capture_keylog_find(random, secret) != 0);
+    fprintf(fp, " %s\r\n", KEYLOG_TEST_SECRET);
+    fflush(fp);
+    assert(capture_keylog_find(random, secret) == 0);
+    assert(secret[KEYLOG_SECRET_LEN - 1] == KEYLOG_SECRET_LEN - 1);
+    assert(capture_keylog_count() == 2);
+
+    fclose(fp);
+    unlink(file);
+    capture_keylog_close();
+    assert(capture_keylog_count() == 0);
+
+    // Missing files can not be loaded
+    assert(capture_keylog_open(file) != 0);
+    capture_keylog_close();
+    return 0;
+}
@@ -0,0 +1,150 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_018.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic testing of bloom filter functions and sampling decisions using them
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "bloom.h"
+#include "sip_sampler.h"
+
+int main ()
+{
+    const char *urgent = "INVITE sip:112@sngrep SIP/2.0\r\nCall-ID: urgent@sngrep\r\n\r\n";
+    const char *other = "INVITE sip:200@sngrep SIP/2.0\r\nCall-ID: other@sngrep\r\n\r\n";
+    sip_sampler_t sampler;
+    bloom_t *bloom;
+    uint64_t hash;
+    char key[64];
+    int i, found;
+
+    assert((bloom = bloom_create(1000)));
+
+    // Nothing is found in an empty filter
+    assert(!bloom_check(bloom, bloom_hash("callid", 6)));
+
+    // Same key gives the same hash, different keys don't
+    assert(bloom_hash("callid", 6) == bloom_hash("callid@host", 6));
+    assert(bloom_hash("callid", 6) != bloom_hash("callie", 6));
+
+    // Added keys are always found
+    for (i = 0; i < 1000; i++) {
+        sprintf(key, "%d@sngrep", i);
+        bloom_add(bloom, bloom_hash(key, strlen(key)));
+    }
+    for (i = 0; i < 1000; i++) {
+        sprintf(key, "%d@sngrep", i);
+        assert(bloom_check(bloom, bloom_hash(key, strlen(key))));
+    }
+
+    // Keys not added are rarely found
+    for (i = 1000, found = 0; i < 11000; i++) {
+        sprintf(key, "%d@sngrep", i);
+        found += bloom_check(bloom, bloom_hash(key, strlen(key)));
+    }
+    assert(found < 300);
+
+    // Keys of previous generation are kept while the current one fills
+    for (i = 1000; i < 2000; i++) {
+        sprintf(key, "%d@sngrep", i);
+        bloom_add(bloom, bloom_hash(key, strlen(key)));
+    }
+    for (i = 0; i < 2000; i++) {
+        sprintf(key, "%d@sngrep", i);
+        assert(bloom_check(bloom, bloom_hash(key, strlen(key))));
+    }
+
+    // Oldest generation is forgotten
+    for (i = 2000; i < 3000; i++) {
+        sprintf(key, "%d@sngrep", i);
+        bloom_add(bloom, bloom_hash(key, strlen(key)));
+    }
+    for (i = 0, found = 0; i < 1000; i++) {
+        sprintf(key, "%d@sngrep", i);
+        found += bloom_check(bloom, bloom_hash(key, strlen(key)));
+    }
+    assert(found < 100);
+
+    // Cleared filter has no keys
+    bloom_clear(bloom);
+    assert(!bloom_check(bloom, bloom_hash("2500@sngrep", 11)));
+
+    bloom_destroy(bloom);
+
+    // Sample one of each two dialogs, always storing the ones sent to 112
+    assert(sip_sampler_init(&sampler, 2, false, NULL) == 0);
+    assert(sip_sampler_enabled(&sampler));
+    assert((sampler.priority = match_create(0)));
+    match_add_pattern(sampler.priority, "sip:112@", 8);
+    assert(match_compile(sampler.priority) == 0);
+    assert(sip_sampler_priority(&sampler, urgent, strlen(urgent)));
+    assert(!sip_sampler_priority(&sampler, other, strlen(other)));
+
+    // Fill a tiny filter with other Call-IDs until priority Call-ID is a false positive
+    bloom_destroy(sampler.discarded);
+    assert((sampler.discarded = bloom_create(1)));
+    sampler.discarded->capacity = 100000;
+    hash = bloom_hash("urgent@sngrep", 13);
+    for (i = 0; i < 100000 && !bloom_check(sampler.discarded, hash); i++) {
+        sprintf(key, "%d@sngrep", i);
+        bloom_add(sampler.discarded, bloom_hash(key, strlen(key)));
+    }
+    assert(bloom_check(sampler.discarded, hash));
+
+    // Priority dialogs are never skipped nor discarded
+    assert(sip_sampler_known(&sampler, hash, true) == SIP_SAMPLE_STORE);
+    assert(sip_sampler_check(&sampler, hash, true, true) == SIP_SAMPLE_STORE);
+    // Other dialogs with a remembered Call-ID are skipped
+    assert(sip_sampler_known(&sampler, hash, false) == SIP_SAMPLE_DISCARD);
+
+    sip_sampler_deinit(&sampler);
+    assert(!sip_sampler_enabled(&sampler));
+
+    // Discarded and counted decisions are remembered
+    assert(sip_sampler_init(&sampler, 2, false, NULL) == 0);
+    for (i = 0, found = 0; i < 100; i++) {
+        sprintf(key, "%d@sampled", i);
+        hash = bloom_hash(key, strlen(key));
+        if (sip_sampler_check(&sampler, hash, false, true) == SIP_SAMPLE_DISCARD) {
+            assert(sip_sampler_known(&sampler, hash, false) == SIP_SAMPLE_DISCARD);
+            found++;
+        }
+    }
+    assert(found > 0 && found < 100);
+    sampler.count_only = true;
+    hash = bloom_hash("0@counted", 9);
+    for (i = 0; hash % 2 != 0; i++) {
+        sprintf(key, "%d@counted", i);
+        hash = bloom_hash(key, strlen(key));
+    }
+    assert(sip_sampler_check(&sampler, hash, false, false) == SIP_SAMPLE_COUNT);
+    assert(sip_sampler_known(&sampler, hash, false) == SIP_SAMPLE_COUNT);
+
+    sip_sampler_deinit(&sampler);
+    return 0;
+}
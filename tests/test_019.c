@@ -0,0 +1,74 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_019.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic testing of CPU lists parsing
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <stddef.h>
+#include "affinity.h"
+
+int main ()
+{
+    affinity_set_t set;
+
+    // Single CPU
+    assert(affinity_parse("3", &set) == 0);
+    assert(set.count == 1);
+    assert(affinity_has_cpu(&set, 3));
+    assert(!affinity_has_cpu(&set, 2));
+
+    // Ranges and lists, repeated CPUs are counted once
+    assert(affinity_parse("0-3,8,10-11,2", &set) == 0);
+    assert(set.count == 7);
+    assert(affinity_has_cpu(&set, 0) && affinity_has_cpu(&set, 3));
+    assert(!affinity_has_cpu(&set, 4) && !affinity_has_cpu(&set, 9));
+    assert(affinity_has_cpu(&set, 8) && affinity_has_cpu(&set, 11));
+
+    // CPUs over 64 are stored in following words
+    assert(affinity_parse("63-65", &set) == 0);
+    assert(set.count == 3 && affinity_has_cpu(&set, 64));
+
+    // Invalid lists
+    assert(affinity_parse("", &set) != 0);
+    assert(affinity_parse(NULL, &set) != 0);
+    assert(affinity_parse("a", &set) != 0);
+    assert(affinity_parse("1,", &set) != 0);
+    assert(affinity_parse(",1", &set) != 0);
+    assert(affinity_parse("3-1", &set) != 0);
+    assert(affinity_parse("1-", &set) != 0);
+    assert(affinity_parse("-1", &set) != 0);
+    assert(affinity_parse("1 2", &set) != 0);
+    assert(affinity_parse("1024", &set) != 0);
+
+    // Roles without list keep default CPUs
+    assert(affinity_set_role(AFFINITY_PARSER, "") == 0);
+    assert(affinity_set_role(AFFINITY_PARSER, "0") == 0);
+    assert(affinity_set_role(AFFINITY_PARSER, "x") != 0);
+    assert(affinity_apply(AFFINITY_PARSER) == 0);
+
+    return 0;
+}